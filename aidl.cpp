@@ -16,7 +16,9 @@
 
 #include "aidl.h"
 
+#include <ctype.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,9 +26,15 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <optional>
+#include <sstream>
+#include <thread>
 
 #ifdef _WIN32
 #include <io.h>
@@ -34,10 +42,14 @@
 #include <sys/stat.h>
 #endif
 
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 
+#include "aidl_checkapi.h"
 #include "aidl_language.h"
 #include "aidl_typenames.h"
+#include "codegen_report.h"
 #include "generate_aidl_mappings.h"
 #include "generate_cpp.h"
 #include "generate_java.h"
@@ -46,13 +58,17 @@
 #include "logging.h"
 #include "options.h"
 #include "os.h"
+#include "profile.h"
+#include "sha1.h"
 
 #ifndef O_BINARY
 #  define O_BINARY  0
 #endif
 
 using android::base::Join;
+using android::base::StringPrintf;
 using android::base::Split;
+using android::base::Trim;
 using std::cerr;
 using std::endl;
 using std::set;
@@ -150,69 +166,75 @@ bool check_filename(const std::string& filename, const AidlDefinedType& defined_
     return valid;
 }
 
-bool write_dep_file(const Options& options, const AidlDefinedType& defined_type,
-                    const vector<string>& imports, const IoDelegate& io_delegate,
-                    const string& input_file, const string& output_file) {
-  string dep_file_name = options.DependencyFile();
-  if (dep_file_name.empty() && options.AutoDepFile()) {
-    dep_file_name = output_file + ".d";
+// Returns what a dependency file lists as the sources of |input_files|: the
+// inputs, then the files they import, in order and without duplicates.
+vector<string> dep_file_sources(const vector<string>& input_files,
+                                const vector<string>& imports) {
+  vector<string> sources;
+  set<string> seen;
+  for (const auto& input_file : input_files) {
+    if (seen.insert(input_file).second) {
+      sources.push_back(input_file);
+    }
+  }
+  for (const auto& import : imports) {
+    if (seen.insert(import).second) {
+      sources.push_back(import);
+    }
   }
+  return sources;
+}
 
-  if (dep_file_name.empty()) {
-    return true;  // nothing to do
+// Returns the headers generated for |defined_type|, which depend on the
+// same sources as the output file.
+vector<string> dep_file_headers(const Options& options, const AidlDefinedType& defined_type) {
+  vector<string> headers;
+  if (options.IsCppOutput()) {
+    using ::android::aidl::cpp::ClassNames;
+    using ::android::aidl::cpp::HeaderFile;
+    for (ClassNames c : {ClassNames::CLIENT, ClassNames::SERVER, ClassNames::RAW}) {
+      headers.push_back(options.OutputHeaderDir() +
+                        HeaderFile(defined_type, c, false /* use_os_sep */));
+    }
   }
+  return headers;
+}
 
+bool write_dep_file(const Options& options, const string& dep_file_name,
+                    const vector<string>& outputs, const vector<string>& headers,
+                    const vector<string>& sources, const IoDelegate& io_delegate) {
   CodeWriterPtr writer = io_delegate.GetCodeWriter(dep_file_name);
   if (!writer) {
     LOG(ERROR) << "Could not open dependency file: " << dep_file_name;
     return false;
   }
 
-  vector<string> source_aidl = {input_file};
-  for (const auto& import : imports) {
-    source_aidl.push_back(import);
-  }
+  // The order of the methods, and so the code, also depends on the
+  // transaction profiles.
+  vector<string> inputs = sources;
+  inputs.insert(inputs.end(), options.TransactionProfileFiles().begin(),
+                options.TransactionProfileFiles().end());
 
-  // Encode that the output file depends on aidl input files.
-  if (defined_type.AsUnstructuredParcelable() != nullptr &&
-      options.TargetLanguage() == Options::Language::JAVA) {
-    // Legacy behavior. For parcelable declarations in Java, don't emit output file as
-    // the dependency target. b/141372861
-    writer->Write(" : \\\n");
-  } else {
-    writer->Write("%s : \\\n", output_file.c_str());
-  }
-  writer->Write("  %s", Join(source_aidl, " \\\n  ").c_str());
-  writer->Write("\n");
+  // Encode that the output files depend on aidl input files. The file is
+  // formatted first and written at once.
+  string contents = Join(outputs, " ") + " : \\\n  " + Join(inputs, " \\\n  ") + "\n";
 
   if (!options.DependencyFileNinja()) {
-    writer->Write("\n");
+    contents += "\n";
     // Output "<input_aidl_file>: " so make won't fail if the input .aidl file
     // has been deleted, moved or renamed in incremental build.
-    for (const auto& src : source_aidl) {
-      writer->Write("%s :\n", src.c_str());
+    for (const auto& src : inputs) {
+      contents += src + " :\n";
     }
-  }
-
-  if (options.IsCppOutput()) {
-    if (!options.DependencyFileNinja()) {
-      using ::android::aidl::cpp::ClassNames;
-      using ::android::aidl::cpp::HeaderFile;
-      vector<string> headers;
-      for (ClassNames c : {ClassNames::CLIENT, ClassNames::SERVER, ClassNames::RAW}) {
-        headers.push_back(options.OutputHeaderDir() +
-                          HeaderFile(defined_type, c, false /* use_os_sep */));
-      }
-
-      writer->Write("\n");
 
+    if (!headers.empty()) {
       // Generated headers also depend on the source aidl files.
-      writer->Write("%s : \\\n    %s\n", Join(headers, " \\\n    ").c_str(),
-                    Join(source_aidl, " \\\n    ").c_str());
+      contents += "\n" + Join(headers, " \\\n    ") + " : \\\n    " +
+                  Join(inputs, " \\\n    ") + "\n";
     }
   }
 
-  return true;
+  return writer->WriteRaw(contents);
 }
 
 string generate_outputFileName(const Options& options, const AidlDefinedType& defined_type) {
@@ -343,20 +365,177 @@ bool ParsePreprocessedLine(const string& line, string* decl,
   return true;
 }
 
+// Binary form of a preprocessed file, written by --preprocess --binary-preprocessed:
+//   kBinaryPreprocessedMagic
+//   uint32 number of types
+//   uint32 size of the string table
+//   for each type, uint32 offsets in the string table of the declaration
+//   name (e.g. "parcelable") and the canonical name of the type
+//   the string table, which is NUL-terminated strings
+// All integers are little endian. Unlike the text form, nothing needs to be
+// tokenized when loading it.
+const char kBinaryPreprocessedMagic[] = "AIDLTYP1";
+const size_t kBinaryPreprocessedMagicSize = sizeof(kBinaryPreprocessedMagic) - 1;
+
+void AppendUint32(uint32_t value, string* out) {
+  for (int i = 0; i < 4; i++) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+bool ReadUint32(const string& in, size_t* pos, uint32_t* value) {
+  if (in.size() < 4 || *pos > in.size() - 4) {
+    return false;
+  }
+  *value = 0;
+  for (int i = 0; i < 4; i++) {
+    *value |= static_cast<uint32_t>(static_cast<uint8_t>(in[*pos + i])) << (8 * i);
+  }
+  *pos += 4;
+  return true;
+}
+
+// Adds a type read from a preprocessed file. Returns false if |decl| is unknown.
+bool AddPreprocessedStub(const string& decl, const vector<string>& package,
+                         const string& class_name, const AidlLocation& location,
+                         AidlTypenames* typenames) {
+  if (decl == "parcelable") {
+    // ParcelFileDescriptor is treated as a built-in type, but it's also in the framework.aidl.
+    // So aidl should ignore built-in types in framework.aidl to prevent duplication.
+    // (b/130899491)
+    if (AidlTypenames::IsBuiltinTypename(class_name)) {
+      return true;
+    }
+    AidlParcelable* doc = new AidlParcelable(
+        location, new AidlQualifiedName(location, class_name, ""), package, "" /* comments */);
+    typenames->AddPreprocessedType(unique_ptr<AidlParcelable>(doc));
+  } else if (decl == "structured_parcelable") {
+    auto temp = new std::vector<std::unique_ptr<AidlVariableDeclaration>>();
+    AidlStructuredParcelable* doc =
+        new AidlStructuredParcelable(location, new AidlQualifiedName(location, class_name, ""),
+                                     package, "" /* comments */, temp);
+    typenames->AddPreprocessedType(unique_ptr<AidlStructuredParcelable>(doc));
+  } else if (decl == "interface") {
+    auto temp = new std::vector<std::unique_ptr<AidlMember>>();
+    AidlInterface* doc = new AidlInterface(location, class_name, "", false, temp, package);
+    typenames->AddPreprocessedType(unique_ptr<AidlInterface>(doc));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseBinaryPreprocessedFile(const string& filename, const string& contents,
+                                 AidlTypenames* typenames) {
+  size_t pos = kBinaryPreprocessedMagicSize;
+  uint32_t num_types;
+  uint32_t table_size;
+  if (!ReadUint32(contents, &pos, &num_types) || !ReadUint32(contents, &pos, &table_size) ||
+      contents.size() - pos < static_cast<uint64_t>(num_types) * 8 + table_size) {
+    LOG(ERROR) << filename << ": truncated binary preprocessed file";
+    return false;
+  }
+  const size_t table_pos = pos + num_types * 8;
+  if (table_size == 0 || contents[table_pos + table_size - 1] != '\0') {
+    LOG(ERROR) << filename << ": malformed binary preprocessed file";
+    return false;
+  }
+  auto string_at = [&](uint32_t offset, string* out) {
+    if (offset >= table_size) {
+      return false;
+    }
+    *out = string(contents.c_str() + table_pos + offset);
+    return true;
+  };
+
+  for (uint32_t i = 0; i < num_types; i++) {
+    uint32_t decl_offset;
+    uint32_t name_offset;
+    ReadUint32(contents, &pos, &decl_offset);
+    ReadUint32(contents, &pos, &name_offset);
+    string decl;
+    string canonical_name;
+    if (!string_at(decl_offset, &decl) || !string_at(name_offset, &canonical_name)) {
+      LOG(ERROR) << filename << ": malformed binary preprocessed file";
+      return false;
+    }
+    // Split the same (wrong) way as ParsePreprocessedLine does, see b/17415692
+    vector<string> package;
+    string class_name = canonical_name;
+    if (size_t dot_pos = canonical_name.rfind('.'); dot_pos != string::npos) {
+      class_name = canonical_name.substr(dot_pos + 1);
+      package = Split(canonical_name.substr(0, dot_pos), ".");
+    }
+    AidlLocation::Point point = {.line = static_cast<int>(i + 1), .column = 0 /*column*/};
+    AidlLocation location = AidlLocation(filename, point, point);
+    if (!AddPreprocessedStub(decl, package, class_name, location, typenames)) {
+      LOG(ERROR) << filename << ": unknown declaration '" << decl << "' for " << class_name;
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace
 
 namespace internals {
 
+// Runs |jobs| on up to |num_threads| threads, including the calling one.
+// Returns false if any of the jobs has failed.
+bool run_jobs(size_t num_threads, const vector<std::function<bool()>>& jobs) {
+  std::atomic<size_t> next_job{0};
+  std::atomic<bool> success{true};
+  auto worker = [&]() {
+    for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+      if (!jobs[i]()) {
+        success = false;
+      }
+    }
+  };
+  vector<std::thread> threads;
+  for (size_t i = 1; i < std::min(num_threads, jobs.size()); i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return success;
+}
+
+bool run_jobs_in_order(size_t num_threads, const vector<std::function<bool()>>& jobs,
+                       std::ostream* out) {
+  vector<string> errors(jobs.size());
+  vector<std::function<bool()>> capturing_jobs;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    capturing_jobs.emplace_back([&jobs, &errors, i]() {
+      AidlErrorCapture capture;
+      const bool success = jobs[i]();
+      errors[i] = capture.str();
+      return success;
+    });
+  }
+  const bool success = run_jobs(num_threads, capturing_jobs);
+  for (const string& error : errors) {
+    *out << error;
+  }
+  return success;
+}
+
 bool parse_preprocessed_file(const IoDelegate& io_delegate, const string& filename,
                              AidlTypenames* typenames) {
   bool success = true;
-  unique_ptr<LineReader> line_reader = io_delegate.GetLineReader(filename);
-  if (!line_reader) {
+  unique_ptr<string> contents = io_delegate.GetFileContents(filename);
+  if (!contents) {
     LOG(ERROR) << "cannot open preprocessed file: " << filename;
     success = false;
     return success;
   }
+  if (contents->compare(0, kBinaryPreprocessedMagicSize, kBinaryPreprocessedMagic) == 0) {
+    return ParseBinaryPreprocessedFile(filename, *contents, typenames);
+  }
 
+  unique_ptr<LineReader> line_reader = LineReader::ReadFromMemory(*contents);
   string line;
   int lineno = 1;
   for ( ; line_reader->ReadLine(&line); ++lineno) {
@@ -376,27 +555,7 @@ bool parse_preprocessed_file(const IoDelegate& io_delegate, const string& filena
     AidlLocation::Point point = {.line = lineno, .column = 0 /*column*/};
     AidlLocation location = AidlLocation(filename, point, point);
 
-    if (decl == "parcelable") {
-      // ParcelFileDescriptor is treated as a built-in type, but it's also in the framework.aidl.
-      // So aidl should ignore built-in types in framework.aidl to prevent duplication.
-      // (b/130899491)
-      if (AidlTypenames::IsBuiltinTypename(class_name)) {
-        continue;
-      }
-      AidlParcelable* doc = new AidlParcelable(
-          location, new AidlQualifiedName(location, class_name, ""), package, "" /* comments */);
-      typenames->AddPreprocessedType(unique_ptr<AidlParcelable>(doc));
-    } else if (decl == "structured_parcelable") {
-      auto temp = new std::vector<std::unique_ptr<AidlVariableDeclaration>>();
-      AidlStructuredParcelable* doc =
-          new AidlStructuredParcelable(location, new AidlQualifiedName(location, class_name, ""),
-                                       package, "" /* comments */, temp);
-      typenames->AddPreprocessedType(unique_ptr<AidlStructuredParcelable>(doc));
-    } else if (decl == "interface") {
-      auto temp = new std::vector<std::unique_ptr<AidlMember>>();
-      AidlInterface* doc = new AidlInterface(location, class_name, "", false, temp, package);
-      typenames->AddPreprocessedType(unique_ptr<AidlInterface>(doc));
-    } else {
+    if (!AddPreprocessedStub(decl, package, class_name, location, typenames)) {
       success = false;
       break;
     }
@@ -409,18 +568,221 @@ bool parse_preprocessed_file(const IoDelegate& io_delegate, const string& filena
   return success;
 }
 
+// Fills in the backing type and the implicit values of |enum_decl|. Other
+// types that use an enum, such as interfaces and structured parcelables, need
+// to know its backing type when generating code, so this is done for every
+// known enum, including imported ones.
+static bool autofill_enum(AidlEnumDeclaration* enum_decl, const AidlTypenames& typenames) {
+  if (auto backing_type = enum_decl->BackingType(typenames); backing_type != nullptr) {
+    enum_decl->SetBackingType(std::unique_ptr<const AidlTypeSpecifier>(backing_type));
+  } else {
+    // Default to byte type for enums.
+    auto byte_type =
+        std::make_unique<AidlTypeSpecifier>(AIDL_LOCATION_HERE, "byte", false, nullptr, "");
+    byte_type->Resolve(typenames);
+    enum_decl->SetBackingType(std::move(byte_type));
+  }
+  return enum_decl->Autofill();
+}
+
+ParsedFileCache::Entry* ParsedFileCache::GetEntry(const string& path,
+                                                  const IoDelegate& io_delegate,
+                                                  map<string, unique_ptr<Entry>>* entries) {
+  auto& entry = (*entries)[path];
+  FileStamp stamp;
+  bool has_stamp = false;
+  size_t content_hash = 0;
+  if (check_for_changes_) {
+    has_stamp = io_delegate.GetFileStamp(path, &stamp);
+    if (entry != nullptr && has_stamp && entry->has_stamp && entry->stamp == stamp) {
+      return nullptr;
+    }
+    unique_ptr<string> contents = io_delegate.GetFileContents(path);
+    if (contents != nullptr) {
+      content_hash = std::hash<string>{}(*contents);
+    }
+    if (entry != nullptr && (contents == nullptr || entry->content_hash != content_hash)) {
+      entry.reset();
+    }
+  }
+  if (entry == nullptr) {
+    entry = std::make_unique<Entry>();
+    entry->content_hash = content_hash;
+    entry->has_stamp = has_stamp;
+    entry->stamp = stamp;
+    return entry.get();
+  }
+  // Touched but not changed
+  entry->has_stamp = has_stamp;
+  entry->stamp = stamp;
+  return nullptr;
+}
+
+void ParsedImport::Parse(const string& path, const IoDelegate& io_delegate,
+                         Parser::Comments comments) {
+  AidlErrorCapture capture;
+  std::unique_ptr<Parser> parser = Parser::Parse(path, io_delegate, types, comments);
+  if (parser != nullptr) {
+    ok = true;
+    for (const auto type : parser->GetDefinedTypes()) {
+      defined_types.emplace_back(type);
+    }
+  }
+  errors = capture.str();
+}
+
+bool ParsedImport::AddTo(AidlTypenames* typenames) const {
+  AidlErrorCapture::Report(errors);
+  bool success = ok;
+  for (const auto type : defined_types) {
+    // Don't stop here, like Parser which keeps adding types after a redefinition
+    if (!typenames->AddSharedDefinedType(type)) {
+      success = false;
+    }
+  }
+  return success;
+}
+
+bool ParsedFileCache::LoadImport(const string& import_path, const IoDelegate& io_delegate,
+                                 AidlTypenames* typenames, Parser::Comments comments) {
+  if (Entry* entry = GetEntry(import_path, io_delegate, &imports_); entry != nullptr) {
+    ParseEntry(import_path, io_delegate, KeptComments(comments), entry);
+  }
+  return imports_[import_path]->AddTo(typenames);
+}
+
+const vector<const AidlDefinedType*>* ParsedFileCache::DefinedTypesOf(
+    const string& path, const IoDelegate& io_delegate, Parser::Comments comments) {
+  if (Entry* entry = GetEntry(path, io_delegate, &imports_); entry != nullptr) {
+    ParseEntry(path, io_delegate, KeptComments(comments), entry);
+  }
+  const Entry& entry = *imports_[path];
+  AidlErrorCapture::Report(entry.errors);
+  return entry.ok ? &entry.defined_types : nullptr;
+}
+
+void ParsedFileCache::ParseImports(const vector<string>& import_paths,
+                                   const IoDelegate& io_delegate, Parser::Comments comments,
+                                   size_t num_threads) {
+  comments = KeptComments(comments);
+  vector<std::function<bool()>> jobs;
+  for (const string& import_path : import_paths) {
+    // Repeated paths have an entry by the time they come again
+    Entry* entry = GetEntry(import_path, io_delegate, &imports_);
+    if (entry == nullptr) {
+      continue;
+    }
+    jobs.emplace_back([&import_path, &io_delegate, comments, entry]() {
+      ParseEntry(import_path, io_delegate, comments, entry);
+      return true;
+    });
+  }
+  run_jobs(num_threads, jobs);
+}
+
+void ParsedFileCache::ParseEntry(const string& import_path, const IoDelegate& io_delegate,
+                                 Parser::Comments comments, Entry* entry) {
+  entry->Parse(import_path, io_delegate, comments);
+  for (const auto type : entry->defined_types) {
+    auto enum_decl = const_cast<AidlEnumDeclaration*>(type->AsEnumDeclaration());
+    if (enum_decl != nullptr && !autofill_enum(enum_decl, entry->types)) {
+      entry->ok = false;
+    }
+  }
+}
+
+bool ParsedFileCache::LoadPreprocessed(const string& filename, const IoDelegate& io_delegate,
+                                       AidlTypenames* typenames) {
+  if (Entry* entry = GetEntry(filename, io_delegate, &preprocessed_); entry != nullptr) {
+    entry->ok = parse_preprocessed_file(io_delegate, filename, &entry->types);
+    entry->types.IterateTypes([&](const AidlDefinedType& type) {
+      entry->defined_types.emplace_back(&type);
+      // The types are shared from here on, so they are completed now.
+      auto enum_decl = const_cast<AidlEnumDeclaration*>(type.AsEnumDeclaration());
+      if (enum_decl != nullptr && !autofill_enum(enum_decl, entry->types)) {
+        entry->ok = false;
+      }
+    });
+  }
+  const Entry& entry = *preprocessed_[filename];
+  for (const auto type : entry.defined_types) {
+    // A type can be in more than one preprocessed file. The first one wins.
+    typenames->AddSharedPreprocessedType(type);
+  }
+  return entry.ok;
+}
+
+// Parses the imports ahead of the import loop of load_and_validate_aidl when
+// there is no cache to parse them into.
+static map<string, unique_ptr<ParsedImport>> prefetch_imports(const vector<string>& paths,
+                                                              const IoDelegate& io_delegate,
+                                                              Parser::Comments comments,
+                                                              size_t num_threads) {
+  map<string, unique_ptr<ParsedImport>> imports;
+  vector<std::function<bool()>> jobs;
+  for (const string& path : paths) {
+    auto& import = imports[path];
+    if (import != nullptr) {
+      continue;
+    }
+    import = std::make_unique<ParsedImport>();
+    jobs.emplace_back([&path, &io_delegate, comments, import = import.get()]() {
+      import->Parse(path, io_delegate, comments);
+      return true;
+    });
+  }
+  internals::run_jobs(num_threads, jobs);
+  return imports;
+}
+
+// Only the Java backend and the API dumps read comments. Everything else
+// leaves them in the files, unless a node asks for them after all.
+static Parser::Comments comments_mode(const Options& options) {
+  if (options.TargetLanguage() == Options::Language::JAVA ||
+      options.GetTask() == Options::Task::DUMP_API ||
+      options.GetTask() == Options::Task::COMPUTE_HASH) {
+    return Parser::Comments::COPY;
+  }
+  return Parser::Comments::LAZY;
+}
+
 AidlError load_and_validate_aidl(const std::string& input_file_name, const Options& options,
                                  const IoDelegate& io_delegate, AidlTypenames* typenames,
                                  vector<AidlDefinedType*>* defined_types,
-                                 vector<string>* imported_files) {
+                                 vector<string>* imported_files, ParsedFileCache* cache) {
   AidlError err = AidlError::OK;
+  const Parser::Comments comments = comments_mode(options);
+
+  auto load_preprocessed = [&](const string& filename) {
+    if (cache != nullptr) {
+      return cache->LoadPreprocessed(filename, io_delegate, typenames);
+    }
+    return parse_preprocessed_file(io_delegate, filename, typenames);
+  };
+  map<string, unique_ptr<ParsedImport>> prefetched_imports;
+  auto load_import = [&](const string& import_path) {
+    if (auto it = prefetched_imports.find(import_path); it != prefetched_imports.end()) {
+      unique_ptr<ParsedImport> import = std::move(it->second);
+      prefetched_imports.erase(it);
+      const bool success = import->AddTo(typenames);
+      // Owned from here on, so its enums are completed with the others
+      typenames->AdoptTypes(&import->types);
+      return success;
+    }
+    if (cache != nullptr) {
+      return cache->LoadImport(import_path, io_delegate, typenames, comments);
+    }
+    return Parser::Parse(import_path, io_delegate, *typenames, comments) != nullptr;
+  };
 
   //////////////////////////////////////////////////////////////////////////
   // Loading phase
   //////////////////////////////////////////////////////////////////////////
+  ProfileScope loading_phase("Loading phase", input_file_name);
 
   // Parse the main input file
-  std::unique_ptr<Parser> main_parser = Parser::Parse(input_file_name, io_delegate, *typenames);
+  std::unique_ptr<Parser> main_parser =
+      Parser::Parse(input_file_name, io_delegate, *typenames, comments);
   if (main_parser == nullptr) {
     return AidlError::PARSE_ERROR;
   }
@@ -437,7 +799,7 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
 
   // Import the preprocessed file
   for (const string& s : options.PreprocessedFiles()) {
-    if (!parse_preprocessed_file(io_delegate, s, typenames)) {
+    if (!load_preprocessed(s)) {
       err = AidlError::BAD_PRE_PROCESSED_FILE;
     }
   }
@@ -446,6 +808,7 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
   }
 
   // Find files to import and parse them
+  ProfileScope import_resolution("Import resolution", input_file_name);
   vector<string> import_paths;
   ImportResolver import_resolver{io_delegate, input_file_name, options.ImportDirs(),
                                  options.InputFiles()};
@@ -471,6 +834,53 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
   vector<string> import_candidates(type_from_import_statements);
   import_candidates.insert(import_candidates.end(), unresolved_types.begin(),
                            unresolved_types.end());
+
+  map<string, string> import_files;
+  auto find_import_file = [&](const string& import) {
+    auto it = import_files.find(import);
+    if (it == import_files.end()) {
+      it = import_files.emplace(import, import_resolver.FindImportFile(import)).first;
+    }
+    return it->second;
+  };
+
+  // Resolve the files to import before the loop below, so that the IoDelegate
+  // can start reading them while the first ones are parsed. Files a cache
+  // already has aren't read again. A cache that checks for changes reads the
+  // files itself, so they aren't prefetched for it.
+  vector<string> prefetch_paths;
+  auto add_prefetch_path = [&](const string& import_path) {
+    if (cache == nullptr || cache->NeedsFile(import_path)) {
+      prefetch_paths.emplace_back(import_path);
+    }
+  };
+  for (const auto& import : import_candidates) {
+    if (!typenames->IsIgnorableImport(import)) {
+      if (string import_path = find_import_file(import); !import_path.empty()) {
+        add_prefetch_path(import_path);
+      }
+    }
+  }
+  for (const string& import_file : options.ImportFiles()) {
+    add_prefetch_path(import_file);
+  }
+  if (cache == nullptr || !cache->ChecksForChanges()) {
+    for (const string& prefetch_path : prefetch_paths) {
+      io_delegate.Prefetch(prefetch_path);
+    }
+  }
+  // With -j, the files to import are also parsed in parallel before the loop
+  // below, each into its own typenames. The loop then adds them in order, so
+  // errors and redefinitions are reported as if they were parsed one after
+  // another.
+  if (options.Jobs() > 1) {
+    if (cache != nullptr) {
+      cache->ParseImports(prefetch_paths, io_delegate, comments, options.Jobs());
+    } else {
+      prefetched_imports = prefetch_imports(prefetch_paths, io_delegate, comments, options.Jobs());
+    }
+  }
+
   for (const auto& import : import_candidates) {
     if (typenames->IsIgnorableImport(import)) {
       // There are places in the Android tree where an import doesn't resolve,
@@ -478,7 +888,7 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
       // This seems like an error, but legacy support demands we support it...
       continue;
     }
-    string import_path = import_resolver.FindImportFile(import);
+    string import_path = find_import_file(import);
     if (import_path.empty()) {
       if (typenames->ResolveTypename(import).second) {
         // Couldn't find the *.aidl file for the type from the include paths, but we
@@ -499,8 +909,7 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
 
     import_paths.emplace_back(import_path);
 
-    std::unique_ptr<Parser> import_parser = Parser::Parse(import_path, io_delegate, *typenames);
-    if (import_parser == nullptr) {
+    if (!load_import(import_path)) {
       cerr << "error while importing " << import_path << " for " << import << endl;
       err = AidlError::BAD_IMPORT;
       continue;
@@ -513,8 +922,7 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
   for (const auto& imported_file : options.ImportFiles()) {
     import_paths.emplace_back(imported_file);
 
-    std::unique_ptr<Parser> import_parser = Parser::Parse(imported_file, io_delegate, *typenames);
-    if (import_parser == nullptr) {
+    if (!load_import(imported_file)) {
       AIDL_ERROR(imported_file) << "error while importing " << imported_file;
       err = AidlError::BAD_IMPORT;
       continue;
@@ -523,6 +931,7 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
   if (err != AidlError::OK) {
     return err;
   }
+  import_resolution.End();
   const bool is_check_api = options.GetTask() == Options::Task::CHECK_API;
 
   // Resolve the unresolved type references found from the input file
@@ -532,35 +941,24 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
     return AidlError::BAD_TYPE;
   }
 
+  // The enums shared from |cache| were completed when they were parsed.
   typenames->IterateTypes([&](const AidlDefinedType& type) {
     AidlEnumDeclaration* enum_decl = const_cast<AidlEnumDeclaration*>(type.AsEnumDeclaration());
-    if (enum_decl != nullptr) {
-      // BackingType is filled in for all known enums, including imported enums,
-      // because other types that may use enums, such as Interface or
-      // StructuredParcelable, need to know the enum BackingType when
-      // generating code.
-      if (auto backing_type = enum_decl->BackingType(*typenames); backing_type != nullptr) {
-        enum_decl->SetBackingType(std::unique_ptr<const AidlTypeSpecifier>(backing_type));
-      } else {
-        // Default to byte type for enums.
-        auto byte_type =
-            std::make_unique<AidlTypeSpecifier>(AIDL_LOCATION_HERE, "byte", false, nullptr, "");
-        byte_type->Resolve(*typenames);
-        enum_decl->SetBackingType(std::move(byte_type));
-      }
-
-      if (!enum_decl->Autofill()) {
-        err = AidlError::BAD_TYPE;
-      }
+    if (enum_decl != nullptr && typenames->Owns(enum_decl) &&
+        !autofill_enum(enum_decl, *typenames)) {
+      err = AidlError::BAD_TYPE;
     }
   });
   if (err != AidlError::OK) {
     return err;
   }
 
+  loading_phase.End();
+
   //////////////////////////////////////////////////////////////////////////
   // Validation phase
   //////////////////////////////////////////////////////////////////////////
+  ProfileScope validation_phase("Validation phase", input_file_name);
 
   // For legacy reasons, by default, compiling an unstructured parcelable (which contains no output)
   // is allowed. This must not be returned as an error until the very end of this procedure since
@@ -568,26 +966,36 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
   // serious failures.
   bool contains_unstructured_parcelable = false;
 
+  // After an error in a type, the types after it are still validated, so that
+  // all errors are reported at once. The first error is returned.
+  auto fail = [&err](AidlError error) {
+    if (err == AidlError::OK) {
+      err = error;
+    }
+  };
   const int num_defined_types = main_parser->GetDefinedTypes().size();
   for (const auto defined_type : main_parser->GetDefinedTypes()) {
     CHECK(defined_type != nullptr);
 
     // Language specific validation
     if (!defined_type->LanguageSpecificCheckValid(options.TargetLanguage())) {
-      return AidlError::BAD_TYPE;
+      fail(AidlError::BAD_TYPE);
+      continue;
     }
 
     AidlParcelable* unstructuredParcelable = defined_type->AsUnstructuredParcelable();
     if (unstructuredParcelable != nullptr) {
       if (!unstructuredParcelable->CheckValid(*typenames)) {
-        return AidlError::BAD_TYPE;
+        fail(AidlError::BAD_TYPE);
+        continue;
       }
       bool isStable = unstructuredParcelable->IsStableApiParcelable(options.TargetLanguage());
       if (options.IsStructured() && !isStable) {
         AIDL_ERROR(unstructuredParcelable)
             << "Cannot declared parcelable in a --structured interface. Parcelable must be defined "
                "in AIDL directly.";
-        return AidlError::NOT_STRUCTURED;
+        fail(AidlError::NOT_STRUCTURED);
+        continue;
       }
       if (options.FailOnParcelable()) {
         AIDL_ERROR(unstructuredParcelable)
@@ -604,7 +1012,14 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
         (options.GetStability() != Options::Stability::VINTF || !options.IsStructured())) {
       AIDL_ERROR(defined_type)
           << "Must compile @VintfStability type w/ aidl_interface 'stability: \"vintf\"'";
-      return AidlError::NOT_STRUCTURED;
+      fail(AidlError::NOT_STRUCTURED);
+      continue;
+    }
+
+    if (defined_type->IsReuseParcels() && defined_type->AsInterface() == nullptr) {
+      AIDL_ERROR(defined_type) << "@ReuseParcels is only supported on interfaces";
+      fail(AidlError::BAD_TYPE);
+      continue;
     }
 
     // Ensure that a type is either an interface, structured parcelable, or
@@ -616,7 +1031,8 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
 
     // Ensure that foo.bar.IFoo is defined in <some_path>/foo/bar/IFoo.aidl
     if (num_defined_types == 1 && !check_filename(input_file_name, *defined_type)) {
-      return AidlError::BAD_PACKAGE;
+      fail(AidlError::BAD_PACKAGE);
+      continue;
     }
 
     // Check the referenced types in parsed_doc to make sure we've imported them
@@ -624,7 +1040,8 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
       // No need to do this for check api because all typespecs are already
       // using fully qualified name and we don't import in AIDL files.
       if (!defined_type->CheckValid(*typenames)) {
-        return AidlError::BAD_TYPE;
+        fail(AidlError::BAD_TYPE);
+        continue;
       }
     }
 
@@ -651,7 +1068,8 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
         interface->GetMutableMethods().emplace_back(method);
       }
       if (!check_and_assign_method_ids(interface->GetMethods())) {
-        return AidlError::BAD_METHOD_ID;
+        fail(AidlError::BAD_METHOD_ID);
+        continue;
       }
 
       // Verify and resolve the constant declarations
@@ -666,10 +1084,12 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
           case AidlConstantValue::Type::BINARY: {
             bool success = constant->CheckValid(*typenames);
             if (!success) {
-              return AidlError::BAD_TYPE;
+              fail(AidlError::BAD_TYPE);
+              continue;
             }
-            if (constant->ValueString(cpp::ConstantValueDecorator).empty()) {
-              return AidlError::BAD_TYPE;
+            if (!constant->GetValue().Evaluate(constant->GetType())) {
+              fail(AidlError::BAD_TYPE);
+              continue;
             }
             break;
           }
@@ -682,15 +1102,20 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
     }
   }
 
+  // The types that failed already would only be reported again.
+  const bool types_failed = err != AidlError::OK;
   typenames->IterateTypes([&](const AidlDefinedType& type) {
+    if (types_failed) {
+      return;
+    }
     if (options.IsStructured() && type.AsUnstructuredParcelable() != nullptr &&
         !type.AsUnstructuredParcelable()->IsStableApiParcelable(options.TargetLanguage())) {
-      err = AidlError::NOT_STRUCTURED;
+      fail(AidlError::NOT_STRUCTURED);
       LOG(ERROR) << type.GetCanonicalName()
                  << " is not structured, but this is a structured interface.";
     }
     if (options.GetStability() == Options::Stability::VINTF && !type.IsVintfStability()) {
-      err = AidlError::NOT_STRUCTURED;
+      fail(AidlError::NOT_STRUCTURED);
       LOG(ERROR) << type.GetCanonicalName()
                  << " does not have VINTF level stability, but this interface requires it.";
     }
@@ -718,108 +1143,672 @@ AidlError load_and_validate_aidl(const std::string& input_file_name, const Optio
 
 } // namespace internals
 
-int compile_aidl(const Options& options, const IoDelegate& io_delegate) {
+namespace {
+
+bool get_output_file_name(const Options& options, const AidlDefinedType& defined_type,
+                          string* output_file_name) {
+  *output_file_name = options.OutputFile();
+  // if needed, generate the output file name from the base folder
+  if (output_file_name->empty() && !options.OutputDir().empty()) {
+    *output_file_name = generate_outputFileName(options, defined_type);
+    if (output_file_name->empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether the dependency file names |defined_type| as the target. For
+// parcelable declarations in Java, it doesn't. b/141372861
+bool is_dep_file_target(const Options& options, const AidlDefinedType& defined_type) {
+  return defined_type.AsUnstructuredParcelable() == nullptr ||
+         options.TargetLanguage() != Options::Language::JAVA;
+}
+
+bool generate_code(const Options& options, const AidlTypenames& typenames,
+                   const AidlDefinedType& defined_type, const string& output_file_name,
+                   const IoDelegate& io_delegate) {
+  ProfileScope profile_scope("Generate", defined_type.GetCanonicalName());
   const Options::Language lang = options.TargetLanguage();
+  if (lang == Options::Language::CPP) {
+    return cpp::GenerateCpp(output_file_name, options, typenames, defined_type, io_delegate);
+  } else if (lang == Options::Language::NDK) {
+    ndk::GenerateNdk(output_file_name, options, typenames, defined_type, io_delegate);
+    return true;
+  } else if (lang == Options::Language::JAVA) {
+    if (defined_type.AsUnstructuredParcelable() != nullptr) {
+      // Legacy behavior. For parcelable declarations in Java, don't generate output file.
+      return true;
+    }
+    return java::generate_java(output_file_name, &defined_type, typenames, io_delegate, options);
+  }
+  LOG(FATAL) << "Should not reach here" << endl;
+  return false;
+}
+
+// Passes everything through to |delegate|, except that what is written is
+// kept in memory, for the output cache to store it before it is written out.
+class CapturingIoDelegate : public IoDelegate {
+ public:
+  explicit CapturingIoDelegate(const IoDelegate& delegate) : delegate_(delegate) {}
+
+  unique_ptr<string> GetFileContents(const string& filename,
+                                     const string& content_suffix) const override {
+    return delegate_.GetFileContents(filename, content_suffix);
+  }
+  unique_ptr<ScanBuffer> GetScanBuffer(const string& filename) const override {
+    return delegate_.GetScanBuffer(filename);
+  }
+  void Prefetch(const string& filename) const override { delegate_.Prefetch(filename); }
+  unique_ptr<LineReader> GetLineReader(const string& file_path) const override {
+    return delegate_.GetLineReader(file_path);
+  }
+  bool FileIsReadable(const string& path) const override {
+    return delegate_.FileIsReadable(path);
+  }
+  bool DirectoryExists(const string& path) const override {
+    return delegate_.DirectoryExists(path);
+  }
+  unique_ptr<CodeWriter> GetCodeWriter(const string& file_path) const override {
+    removed_.erase(file_path);
+    return CodeWriter::ForString(&outputs_[file_path]);
+  }
+  // The contents stay, as a writer may still refer to them.
+  void RemovePath(const string& file_path) const override { removed_.insert(file_path); }
+  vector<string> ListFiles(const string& dir) const override { return delegate_.ListFiles(dir); }
+
+  // The files written and not removed since, by path
+  vector<std::pair<string, const string*>> Outputs() const {
+    vector<std::pair<string, const string*>> outputs;
+    for (const auto& [path, contents] : outputs_) {
+      if (removed_.count(path) == 0) {
+        outputs.emplace_back(path, &contents);
+      }
+    }
+    return outputs;
+  }
+
+ private:
+  const IoDelegate& delegate_;
+  mutable std::map<string, string> outputs_;
+  mutable set<string> removed_;
+};
+
+// Changed whenever the format of cache entries or the way keys are computed
+// changes.
+constexpr char kOutputCacheMagic[] = "aidl-output-cache 1\n";
+
+// The key of the code generated for |defined_type| from |sources|, or an
+// empty string if one of the files cannot be read.
+string output_cache_key(const Options& options, const AidlDefinedType& defined_type,
+                        const vector<string>& sources, const IoDelegate& io_delegate) {
+  Sha1 sha1;
+  sha1.Update(kOutputCacheMagic);
+  sha1.Update(options.OutputCacheFlags());
+  sha1.Update(defined_type.GetCanonicalName() + "\n");
+  vector<string> files = sources;
+  files.insert(files.end(), options.PreprocessedFiles().begin(),
+               options.PreprocessedFiles().end());
+  for (const string& file : files) {
+    unique_ptr<string> contents = io_delegate.GetFileContents(file);
+    if (contents == nullptr) {
+      return "";
+    }
+    sha1.Update(file + "\n" + std::to_string(contents->size()) + "\n");
+    sha1.Update(*contents);
+  }
+  return sha1.HexDigest();
+}
+
+// Outputs are stored relative to the directory they are generated in, "o"
+// for --out and "h" for --header_out, so that builds into other directories
+// can use them. When one directory is inside the other, the innermost one
+// containing the file is used, and --out when they are the same. Returns
+// false for a file in neither.
+bool output_cache_path(const Options& options, const string& path, string* cache_path) {
+  const string* roots[] = {&options.OutputDir(), &options.OutputHeaderDir()};
+  const char* tags[] = {"o", "h"};
+  const string* best_root = nullptr;
+  const char* best_tag = nullptr;
+  for (size_t i = 0; i < 2; i++) {
+    const string& root = *roots[i];
+    if (!root.empty() && android::base::StartsWith(path, root) &&
+        (best_root == nullptr || root.size() > best_root->size())) {
+      best_root = &root;
+      best_tag = tags[i];
+    }
+  }
+  if (best_root == nullptr) {
+    return false;
+  }
+  *cache_path = string(best_tag) + " " + path.substr(best_root->size());
+  return true;
+}
+
+// Reads an entry made of kOutputCacheMagic, the number of files, and then for
+// each file a line with its tag and relative path, a line with its size and
+// its contents. Returns false if |entry| is not complete.
+bool parse_output_cache_entry(const Options& options, const string& entry,
+                              vector<std::pair<string, string>>* outputs) {
+  const size_t magic_size = strlen(kOutputCacheMagic);
+  if (entry.compare(0, magic_size, kOutputCacheMagic) != 0) {
+    return false;
+  }
+  size_t pos = magic_size;
+  auto read_line = [&](string* line) {
+    const size_t end = entry.find('\n', pos);
+    if (end == string::npos) return false;
+    *line = entry.substr(pos, end - pos);
+    pos = end + 1;
+    return true;
+  };
+  string line;
+  size_t count;
+  if (!read_line(&line) || !android::base::ParseUint(line, &count)) {
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    string name;
+    size_t size;
+    if (!read_line(&name) || name.size() < 3 || name[1] != ' ' || !read_line(&line) ||
+        !android::base::ParseUint(line, &size) || entry.size() - pos < size) {
+      return false;
+    }
+    const string& root = name[0] == 'h' ? options.OutputHeaderDir() : options.OutputDir();
+    if (root.empty()) {
+      return false;
+    }
+    outputs->emplace_back(root + name.substr(2), entry.substr(pos, size));
+    pos += size;
+  }
+  return pos == entry.size();
+}
+
+bool write_output(const string& path, const string& contents, const IoDelegate& io_delegate) {
+  unique_ptr<CodeWriter> writer = io_delegate.GetCodeWriter(path);
+  if (writer == nullptr || !writer->WriteRaw(contents) || !writer->Close()) {
+    AIDL_ERROR(path) << "Cannot write the generated code.";
+    return false;
+  }
+  return true;
+}
+
+// generate_code, through the cache of --output-cache. The cache is best
+// effort: entries that cannot be read or written are treated as missing. If
+// |generated| isn't null, the sizes of the files written are added to it.
+bool generate_code_cached(const Options& options, const AidlTypenames& typenames,
+                          const AidlDefinedType& defined_type, const string& output_file_name,
+                          const vector<string>& sources, const IoDelegate& io_delegate,
+                          vector<report::GeneratedFile>* generated = nullptr) {
+  if (options.OutputCacheDir().empty() && generated == nullptr) {
+    return generate_code(options, typenames, defined_type, output_file_name, io_delegate);
+  }
+  string key;
+  string entry_path;
+  if (!options.OutputCacheDir().empty()) {
+    key = output_cache_key(options, defined_type, sources, io_delegate);
+    entry_path = options.OutputCacheDir() + key;
+  }
+  if (!key.empty()) {
+    unique_ptr<string> entry = io_delegate.GetFileContents(entry_path);
+    vector<std::pair<string, string>> outputs;
+    if (entry != nullptr && parse_output_cache_entry(options, *entry, &outputs)) {
+      for (const auto& [path, contents] : outputs) {
+        if (!write_output(path, contents, io_delegate)) {
+          return false;
+        }
+        if (generated != nullptr) {
+          generated->push_back(report::Measure(path, contents));
+        }
+      }
+      return true;
+    }
+  }
+
+  CapturingIoDelegate capturing(io_delegate);
+  if (!generate_code(options, typenames, defined_type, output_file_name, capturing)) {
+    return false;
+  }
+  const auto outputs = capturing.Outputs();
+  bool cacheable = !key.empty();
+  string entry = kOutputCacheMagic + std::to_string(outputs.size()) + "\n";
+  for (const auto& [path, contents] : outputs) {
+    if (!write_output(path, *contents, io_delegate)) {
+      return false;
+    }
+    if (generated != nullptr) {
+      generated->push_back(report::Measure(path, *contents));
+    }
+    string cache_path;
+    if (output_cache_path(options, path, &cache_path)) {
+      entry += cache_path + "\n" + std::to_string(contents->size()) + "\n" + *contents;
+    } else {
+      cacheable = false;
+    }
+  }
+  if (cacheable) {
+    unique_ptr<CodeWriter> writer = io_delegate.GetCodeWriter(entry_path);
+    if (writer != nullptr) {
+      writer->WriteRaw(entry);
+      writer->Close();
+    }
+  }
+  return true;
+}
+
+// Returns a copy of |options| with the counts of its transaction profiles,
+// which are read through |io_delegate| like the inputs, or nullopt after
+// logging an error.
+std::optional<Options> read_transaction_profiles(const Options& options,
+                                                 const IoDelegate& io_delegate) {
+  Options profiled = options;
+  for (const string& file : options.TransactionProfileFiles()) {
+    unique_ptr<string> contents = io_delegate.GetFileContents(file);
+    if (contents == nullptr) {
+      LOG(ERROR) << "Cannot read transaction profile " << file << ".";
+      return std::nullopt;
+    }
+    if (!profiled.AddTransactionProfile(file, *contents)) {
+      return std::nullopt;
+    }
+  }
+  return profiled;
+}
+
+int compile_inputs(const Options& options, const IoDelegate& io_delegate,
+                   internals::ParsedFileCache* parsed_files) {
+  // Inputs compiled together usually import the same files. Parse them only once.
+  internals::ParsedFileCache local_parsed_files;
+  if (parsed_files == nullptr) {
+    parsed_files = &local_parsed_files;
+  }
+  // With -j, all inputs are loaded first and then the code is generated in
+  // parallel. Types are read-only once loaded, so the jobs can share them.
+  vector<unique_ptr<AidlTypenames>> loaded_typenames;
+  vector<std::function<bool()>> jobs;
+  // For --combined-dep, what all inputs generate and depend on
+  vector<string> combined_outputs;
+  vector<string> combined_headers;
+  vector<string> combined_imports;
+  // For --codegen-report, the entry of each type. Jobs fill them in place.
+  std::deque<string> report_entries;
   for (const string& input_file : options.InputFiles()) {
-    AidlTypenames typenames;
+    auto typenames = std::make_unique<AidlTypenames>();
 
     vector<AidlDefinedType*> defined_types;
     vector<string> imported_files;
 
-    AidlError aidl_err = internals::load_and_validate_aidl(
-        input_file, options, io_delegate, &typenames, &defined_types, &imported_files);
+    AidlError aidl_err =
+        internals::load_and_validate_aidl(input_file, options, io_delegate, typenames.get(),
+                                          &defined_types, &imported_files, parsed_files);
     bool allowError = aidl_err == AidlError::FOUND_PARCELABLE && !options.FailOnParcelable();
     if (aidl_err != AidlError::OK && !allowError) {
       return 1;
     }
 
+    // The dependencies are the same for all types of an input, so they are
+    // sorted once. With -d the input gets one dependency file for all of its
+    // outputs; with -a each output gets its own.
+    const vector<string> sources = dep_file_sources({input_file}, imported_files);
+    vector<string> outputs;
+    vector<string> headers;
     for (const auto defined_type : defined_types) {
       CHECK(defined_type != nullptr);
-
-      string output_file_name = options.OutputFile();
-      // if needed, generate the output file name from the base folder
-      if (output_file_name.empty() && !options.OutputDir().empty()) {
-        output_file_name = generate_outputFileName(options, *defined_type);
-        if (output_file_name.empty()) {
-          return 1;
+      string output_file_name;
+      if (!get_output_file_name(options, *defined_type, &output_file_name)) {
+        return 1;
+      }
+      vector<string> type_outputs;
+      if (is_dep_file_target(options, *defined_type)) {
+        type_outputs.push_back(output_file_name);
+      }
+      if (options.TargetLanguage() == Options::Language::CPP) {
+        for (const string& shard : cpp::SourceShardFiles(options, *defined_type,
+                                                         output_file_name)) {
+          type_outputs.push_back(shard);
         }
       }
-
-      if (!write_dep_file(options, *defined_type, imported_files, io_delegate, input_file,
-                          output_file_name)) {
+      vector<string> type_headers = dep_file_headers(options, *defined_type);
+      if (options.AutoDepFile() && options.DependencyFile().empty() &&
+          !write_dep_file(options, output_file_name + ".d", type_outputs, type_headers, sources,
+                          io_delegate)) {
         return 1;
       }
+      outputs.insert(outputs.end(), type_outputs.begin(), type_outputs.end());
+      headers.insert(headers.end(), type_headers.begin(), type_headers.end());
 
-      bool success = false;
-      if (lang == Options::Language::CPP) {
-        success =
-            cpp::GenerateCpp(output_file_name, options, typenames, *defined_type, io_delegate);
-      } else if (lang == Options::Language::NDK) {
-        ndk::GenerateNdk(output_file_name, options, typenames, *defined_type, io_delegate);
-        success = true;
-      } else if (lang == Options::Language::JAVA) {
-        if (defined_type->AsUnstructuredParcelable() != nullptr) {
-          // Legacy behavior. For parcelable declarations in Java, don't generate output file.
-          success = true;
-        } else {
-          success =
-              java::generate_java(output_file_name, defined_type, typenames, io_delegate, options);
-        }
-      } else {
-        LOG(FATAL) << "Should not reach here" << endl;
-        return 1;
+      string* report_entry = nullptr;
+      if (!options.CodegenReportFile().empty()) {
+        report_entry = &report_entries.emplace_back();
       }
-      if (!success) {
+      auto job = [&options, &io_delegate, &typenames = *typenames, defined_type,
+                  output_file_name, sources, report_entry]() {
+        if (report_entry == nullptr) {
+          return generate_code_cached(options, typenames, *defined_type, output_file_name,
+                                      sources, io_delegate);
+        }
+        vector<report::GeneratedFile> generated;
+        if (!generate_code_cached(options, typenames, *defined_type, output_file_name, sources,
+                                  io_delegate, &generated)) {
+          return false;
+        }
+        *report_entry = report::TypeEntry(options, *defined_type, typenames, generated);
+        return true;
+      };
+      if (options.Jobs() > 1) {
+        jobs.emplace_back(job);
+      } else if (!job()) {
         return 1;
       }
     }
+    if (!options.DependencyFile().empty() &&
+        !write_dep_file(options, options.DependencyFile(), outputs, headers, sources,
+                        io_delegate)) {
+      return 1;
+    }
+    if (!options.CombinedDependencyFile().empty()) {
+      combined_outputs.insert(combined_outputs.end(), outputs.begin(), outputs.end());
+      combined_headers.insert(combined_headers.end(), headers.begin(), headers.end());
+      combined_imports.insert(combined_imports.end(), imported_files.begin(),
+                              imported_files.end());
+    }
+    loaded_typenames.emplace_back(std::move(typenames));
+  }
+  if (!options.CombinedDependencyFile().empty() &&
+      !write_dep_file(options, options.CombinedDependencyFile(), combined_outputs,
+                      combined_headers, dep_file_sources(options.InputFiles(), combined_imports),
+                      io_delegate)) {
+    return 1;
+  }
+  if (!internals::run_jobs(options.Jobs(), jobs)) {
+    return 1;
+  }
+  if (!options.CodegenReportFile().empty() &&
+      !report::WriteReport(options, vector<string>(report_entries.begin(), report_entries.end()),
+                           io_delegate)) {
+    return 1;
   }
   return 0;
 }
 
-bool dump_mappings(const Options& options, const IoDelegate& io_delegate) {
-  android::aidl::mappings::SignatureMap all_mappings;
+}  // namespace
+
+int compile_aidl(const Options& options, const IoDelegate& io_delegate,
+                 internals::ParsedFileCache* parsed_files) {
+  if (options.TransactionProfileFiles().empty()) {
+    return compile_inputs(options, io_delegate, parsed_files);
+  }
+  // The profiles are read again for each compilation, so that a server sees
+  // them change.
+  std::optional<Options> profiled = read_transaction_profiles(options, io_delegate);
+  if (!profiled) {
+    return 1;
+  }
+  return compile_inputs(*profiled, io_delegate, parsed_files);
+}
+
+// The inputs share the files they import, and the mappings are written sorted
+// by signature with a single write.
+bool dump_mappings(const Options& options, const IoDelegate& io_delegate,
+                   internals::ParsedFileCache* parsed_files) {
+  internals::ParsedFileCache local_parsed_files;
+  if (parsed_files == nullptr) {
+    parsed_files = &local_parsed_files;
+  }
+  mappings::JavaSignatureCache signatures;
+  vector<mappings::Mapping> all_mappings;
   for (const string& input_file : options.InputFiles()) {
     AidlTypenames typenames;
     vector<AidlDefinedType*> defined_types;
     vector<string> imported_files;
 
-    AidlError aidl_err = internals::load_and_validate_aidl(
-        input_file, options, io_delegate, &typenames, &defined_types, &imported_files);
+    AidlError aidl_err =
+        internals::load_and_validate_aidl(input_file, options, io_delegate, &typenames,
+                                          &defined_types, &imported_files, parsed_files);
     if (aidl_err != AidlError::OK) {
       LOG(WARNING) << "AIDL file is invalid.\n";
       continue;
     }
     for (const auto defined_type : defined_types) {
-      auto mappings = mappings::generate_mappings(defined_type, typenames);
-      all_mappings.insert(mappings.begin(), mappings.end());
+      mappings::generate_mappings(defined_type, typenames, &signatures, &all_mappings);
     }
   }
-  std::stringstream mappings_str;
-  for (const auto& mapping : all_mappings) {
-    mappings_str << mapping.first << "\n" << mapping.second << "\n";
+  // As the same type can be given more than once, the first mapping of a
+  // signature is kept.
+  std::stable_sort(all_mappings.begin(), all_mappings.end(),
+                   [](const auto& a, const auto& b) { return a.first < b.first; });
+  all_mappings.erase(std::unique(all_mappings.begin(), all_mappings.end(),
+                                 [](const auto& a, const auto& b) { return a.first == b.first; }),
+                     all_mappings.end());
+  size_t size = 0;
+  for (const auto& [signature, location] : all_mappings) {
+    size += signature.size() + location.size() + 2;
+  }
+  string mappings_str;
+  mappings_str.reserve(size);
+  for (const auto& [signature, location] : all_mappings) {
+    mappings_str += signature;
+    mappings_str += '\n';
+    mappings_str += location;
+    mappings_str += '\n';
   }
   auto code_writer = io_delegate.GetCodeWriter(options.OutputFile());
-  code_writer->Write("%s", mappings_str.str().c_str());
+  return code_writer->WriteRaw(mappings_str);
+}
+
+// The declaration name and the canonical name of each type that |text|
+// defines, read from the package and the declarations alone: annotations,
+// type parameters and bodies are skipped by matching their brackets. Returns
+// false for text it doesn't understand, which the parser then reads instead
+// to report the error.
+static bool scan_declarations(const string& text, vector<std::pair<string, string>>* decls) {
+  size_t pos = 0;
+  bool ok = true;
+  // Skips whitespace and comments.
+  auto skip_space = [&]() {
+    while (pos < text.size()) {
+      if (isspace(static_cast<unsigned char>(text[pos]))) {
+        pos++;
+      } else if (text.compare(pos, 2, "//") == 0) {
+        pos = std::min(text.find('\n', pos), text.size());
+      } else if (text.compare(pos, 2, "/*") == 0) {
+        const size_t end = text.find("*/", pos + 2);
+        ok = ok && end != string::npos;
+        pos = end == string::npos ? text.size() : end + 2;
+      } else {
+        break;
+      }
+    }
+  };
+  auto at = [&](char c) {
+    skip_space();
+    return pos < text.size() && text[pos] == c;
+  };
+  // A name, maybe qualified, or an empty string.
+  auto word = [&]() {
+    skip_space();
+    const size_t begin = pos;
+    if (pos < text.size() && (isalpha(static_cast<unsigned char>(text[pos])) || text[pos] == '_')) {
+      while (pos < text.size() &&
+             (isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_' ||
+              text[pos] == '.')) {
+        pos++;
+      }
+    }
+    return text.substr(begin, pos - begin);
+  };
+  // Skips the string or character literal at |pos|. Like the lexer, neither
+  // has escapes, and a character literal is a single character.
+  auto skip_literal = [&]() {
+    const size_t end = text[pos] == '"' ? text.find('"', pos + 1) : pos + 2;
+    if (end >= text.size() || text[end] != text[pos]) return false;
+    pos = end + 1;
+    return true;
+  };
+  // Skips from the |open| bracket at |pos| to after the bracket that closes it.
+  auto skip_balanced = [&](char open, char close) {
+    int depth = 0;
+    do {
+      skip_space();
+      if (pos >= text.size()) return false;
+      const char c = text[pos];
+      if (c == '"' || c == '\'') {
+        if (!skip_literal()) return false;
+        continue;
+      }
+      if (c == open) depth++;
+      if (c == close) depth--;
+      pos++;
+    } while (depth > 0);
+    return true;
+  };
+
+  string package;
+  bool in_decls = false;
+  while (skip_space(), pos < text.size()) {
+    if (text[pos] == '@') {
+      pos++;
+      in_decls = true;
+      if (word().empty() || (at('(') && !skip_balanced('(', ')'))) return false;
+      continue;
+    }
+    string keyword = word();
+    if (keyword == "package" || keyword == "import") {
+      const string name = word();
+      if (in_decls || name.empty() || !at(';')) return false;
+      pos++;
+      if (keyword == "package") {
+        if (!package.empty()) return false;
+        package = name;
+      }
+      continue;
+    }
+    in_decls = true;
+    if (keyword == "oneway") {
+      keyword = word();
+      if (keyword != "interface") return false;
+    }
+    const string name = word();
+    if (name.empty()) return false;
+    string kind;
+    if (keyword == "interface" || keyword == "enum") {
+      if (!at('{') || !skip_balanced('{', '}')) return false;
+      kind = keyword;
+    } else if (keyword == "parcelable" && at('{')) {
+      if (!skip_balanced('{', '}')) return false;
+      kind = "structured_parcelable";
+    } else if (keyword == "parcelable") {
+      if (at('<') && !skip_balanced('<', '>')) return false;
+      const size_t before_header = pos;
+      if (word() == "cpp_header") {
+        if (!at('"') || !skip_literal()) return false;
+      } else {
+        pos = before_header;
+      }
+      if (!at(';')) return false;
+      pos++;
+      kind = "parcelable";
+    } else {
+      return false;
+    }
+    if (kind != "parcelable" && name.find('.') != string::npos) return false;
+    decls->emplace_back(kind, package.empty() ? name : package + "." + name);
+  }
+  return ok;
+}
+
+// The declaration name and the canonical name of each type that |file|
+// defines, for --preprocess.
+static bool read_declarations(const Options& options, const string& file,
+                              const IoDelegate& io_delegate,
+                              internals::ParsedFileCache* parsed_files,
+                              vector<std::pair<string, string>>* decls) {
+  if (options.ScanDeclarations()) {
+    ProfileScope profile_scope("ScanDeclarations", file);
+    unique_ptr<string> contents = io_delegate.GetFileContents(file);
+    if (contents != nullptr && scan_declarations(*contents, decls)) {
+      return true;
+    }
+    decls->clear();
+  }
+  if (parsed_files != nullptr) {
+    const vector<const AidlDefinedType*>* defined_types =
+        parsed_files->DefinedTypesOf(file, io_delegate, Parser::Comments::LAZY);
+    if (defined_types == nullptr) return false;
+    for (const auto defined_type : *defined_types) {
+      decls->emplace_back(defined_type->GetPreprocessDeclarationName(),
+                          defined_type->GetCanonicalName());
+    }
+    return true;
+  }
+  AidlTypenames typenames;
+  std::unique_ptr<Parser> p = Parser::Parse(file, io_delegate, typenames, Parser::Comments::LAZY);
+  if (p == nullptr) return false;
+  for (const auto& defined_type : p->GetDefinedTypes()) {
+    decls->emplace_back(defined_type->GetPreprocessDeclarationName(),
+                        defined_type->GetCanonicalName());
+  }
   return true;
 }
 
-bool preprocess_aidl(const Options& options, const IoDelegate& io_delegate) {
+// The inputs are read in parallel with -j, and their declarations are
+// written in the order of the inputs. The cache isn't thread-safe, so they
+// are read one at a time through |parsed_files| when it is given.
+bool preprocess_aidl(const Options& options, const IoDelegate& io_delegate,
+                     internals::ParsedFileCache* parsed_files) {
   unique_ptr<CodeWriter> writer = io_delegate.GetCodeWriter(options.OutputFile());
 
-  for (const auto& file : options.InputFiles()) {
-    AidlTypenames typenames;
-    std::unique_ptr<Parser> p = Parser::Parse(file, io_delegate, typenames);
-    if (p == nullptr) return false;
+  // for --binary-preprocessed
+  vector<uint32_t> records;
+  string string_table;
+  map<string, uint32_t> string_offsets;
+  auto add_string = [&](const string& str) {
+    auto it = string_offsets.find(str);
+    if (it == string_offsets.end()) {
+      it = string_offsets.emplace(str, string_table.size()).first;
+      string_table.append(str.c_str(), str.size() + 1);
+    }
+    records.push_back(it->second);
+  };
+
+  const vector<string>& files = options.InputFiles();
+  vector<vector<std::pair<string, string>>> file_decls(files.size());
+  vector<std::function<bool()>> jobs;
+  for (size_t i = 0; i < files.size(); i++) {
+    jobs.emplace_back([&options, &io_delegate, parsed_files, &files, &file_decls, i]() {
+      return read_declarations(options, files[i], io_delegate, parsed_files, &file_decls[i]);
+    });
+  }
+  if (!internals::run_jobs_in_order(parsed_files != nullptr ? 1 : options.Jobs(), jobs)) {
+    return false;
+  }
 
-    for (const auto& defined_type : p->GetDefinedTypes()) {
-      if (!writer->Write("%s %s;\n", defined_type->GetPreprocessDeclarationName().c_str(),
-                         defined_type->GetCanonicalName().c_str())) {
+  for (const auto& decls : file_decls) {
+    for (const auto& [declaration_name, canonical_name] : decls) {
+      if (options.BinaryPreprocessed()) {
+        add_string(declaration_name);
+        add_string(canonical_name);
+        continue;
+      }
+      if (!writer->Write("%s %s;\n", declaration_name.c_str(), canonical_name.c_str())) {
         return false;
       }
     }
   }
 
+  if (options.BinaryPreprocessed()) {
+    string data(kBinaryPreprocessedMagic, kBinaryPreprocessedMagicSize);
+    AppendUint32(records.size() / 2, &data);
+    AppendUint32(string_table.size(), &data);
+    for (uint32_t offset : records) {
+      AppendUint32(offset, &data);
+    }
+    data += string_table;
+    if (!writer->WriteRaw(data)) {
+      return false;
+    }
+  }
+
   return writer->Close();
 }
 
@@ -830,25 +1819,373 @@ static string GetApiDumpPathFor(const AidlDefinedType& defined_type, const Optio
          ".aidl";
 }
 
-bool dump_api(const Options& options, const IoDelegate& io_delegate) {
+// 64-bit FNV-1a. Unlike std::hash, it is the same for every build of aidl,
+// which matters as the hashes are frozen along with the API dumps.
+static string HashApiDump(const string& text) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char c : text) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return StringPrintf("%016" PRIx64, hash);
+}
+
+// Writes |contents| to |path| with a single write, unless the file already
+// holds exactly that.
+static bool WriteIfChanged(const string& path, const string& contents,
+                           const IoDelegate& io_delegate) {
+  unique_ptr<string> existing = io_delegate.GetFileContents(path);
+  if (existing != nullptr && *existing == contents) {
+    return true;
+  }
+  unique_ptr<CodeWriter> writer = io_delegate.GetCodeWriter(path);
+  if (writer == nullptr) {
+    AIDL_ERROR(path) << "Cannot open for writing.";
+    return false;
+  }
+  return writer->WriteRaw(contents) && writer->Close();
+}
+
+// All inputs are loaded first, sharing the files they import. The dumps are
+// then rendered in memory, in parallel with -j, and written out one by one.
+bool dump_api(const Options& options, const IoDelegate& io_delegate,
+              internals::ParsedFileCache* parsed_files) {
+  internals::ParsedFileCache local_parsed_files;
+  if (parsed_files == nullptr) {
+    parsed_files = &local_parsed_files;
+  }
+  vector<unique_ptr<AidlTypenames>> loaded_typenames;
+  vector<const AidlDefinedType*> types;
   for (const auto& file : options.InputFiles()) {
-    AidlTypenames typenames;
+    auto typenames = std::make_unique<AidlTypenames>();
     vector<AidlDefinedType*> defined_types;
-    if (internals::load_and_validate_aidl(file, options, io_delegate, &typenames, &defined_types,
-                                          nullptr) == AidlError::OK) {
+    if (internals::load_and_validate_aidl(file, options, io_delegate, typenames.get(),
+                                          &defined_types, nullptr,
+                                          parsed_files) != AidlError::OK) {
+      return false;
+    }
+    types.insert(types.end(), defined_types.begin(), defined_types.end());
+    loaded_typenames.emplace_back(std::move(typenames));
+  }
+
+  vector<string> dumps(types.size());
+  vector<std::function<bool()>> jobs;
+  for (size_t i = 0; i < types.size(); i++) {
+    jobs.emplace_back([&, i]() {
+      const AidlDefinedType* type = types[i];
+      string& dump = dumps[i];
+      if (!type->GetPackage().empty()) {
+        dump = string(kPreamble) + "package " + type->GetPackage() + ";\n";
+      }
+      string type_dump;
+      type->Dump(CodeWriter::ForString(&type_dump).get());
+      dump += type_dump;
+      return true;
+    });
+  }
+  if (!internals::run_jobs(options.Jobs(), jobs)) {
+    return false;
+  }
+
+  map<string, string> type_hashes;
+  for (size_t i = 0; i < types.size(); i++) {
+    type_hashes[types[i]->GetCanonicalName()] = HashApiDump(dumps[i]);
+    if (!WriteIfChanged(GetApiDumpPathFor(*types[i], options), dumps[i], io_delegate)) {
+      return false;
+    }
+  }
+  string hashes;
+  for (const auto& [name, hash] : type_hashes) {
+    hashes += name + " " + hash + "\n";
+  }
+  return WriteIfChanged(options.OutputDir() + kApiTypeHashesFile, hashes, io_delegate);
+}
+
+// The hash is the SHA-1 of one line per type, sorted by name, each made of the
+// SHA-1 of the dumped text of the type and its name, followed by a line with
+// the version if there is one. Each file is loaded on its own, so that they
+// can be loaded in parallel with -j.
+bool compute_api_hash(const Options& options, const IoDelegate& io_delegate) {
+  const string& dir = options.InputFiles().at(0);
+  vector<string> files;
+  for (const string& file : io_delegate.ListFiles(dir)) {
+    if (android::base::EndsWith(file, ".aidl")) {
+      files.push_back(file);
+    }
+  }
+  if (files.empty()) {
+    AIDL_ERROR(dir) << "No API file exist";
+    return false;
+  }
+
+  vector<map<string, string>> file_hashes(files.size());
+  vector<std::function<bool()>> jobs;
+  for (size_t i = 0; i < files.size(); i++) {
+    jobs.emplace_back([&, i]() {
+      AidlTypenames typenames;
+      vector<AidlDefinedType*> defined_types;
+      if (internals::load_and_validate_aidl(files[i], options, io_delegate, &typenames,
+                                            &defined_types, nullptr) != AidlError::OK) {
+        AIDL_ERROR(files[i]) << "Failed to read.";
+        return false;
+      }
       for (const auto type : defined_types) {
-        unique_ptr<CodeWriter> writer =
-            io_delegate.GetCodeWriter(GetApiDumpPathFor(*type, options));
-        if (!type->GetPackage().empty()) {
-          (*writer) << kPreamble << "package " << type->GetPackage() << ";\n";
-        }
-        type->Dump(writer.get());
+        string dump;
+        type->Dump(CodeWriter::ForString(&dump).get());
+        file_hashes[i][type->GetCanonicalName()] = Sha1::Of(dump);
       }
+      return true;
+    });
+  }
+  if (!internals::run_jobs_in_order(options.Jobs(), jobs)) {
+    return false;
+  }
+
+  map<string, string> type_hashes;
+  for (size_t i = 0; i < files.size(); i++) {
+    for (const auto& [name, hash] : file_hashes[i]) {
+      if (!type_hashes.emplace(name, hash).second) {
+        AIDL_ERROR(files[i]) << "Type " << name << " is defined in more than one file.";
+        return false;
+      }
+    }
+  }
+  Sha1 sha1;
+  for (const auto& [name, hash] : type_hashes) {
+    sha1.Update(hash + "  " + name + "\n");
+  }
+  if (options.Version() > 0) {
+    sha1.Update(std::to_string(options.Version()) + "\n");
+  }
+  unique_ptr<CodeWriter> writer = io_delegate.GetCodeWriter(options.OutputFile());
+  if (writer == nullptr) {
+    AIDL_ERROR(options.OutputFile()) << "Cannot open for writing.";
+    return false;
+  }
+  (*writer) << sha1.HexDigest() << "\n";
+  return writer->Close();
+}
+
+// Parses a command of --server or --batch. The options that set up how files
+// are read and written, and --profile, apply to the whole invocation, so a
+// command that has them is refused instead of running without them.
+static std::optional<Options> parse_command(const string& command) {
+  Options options = Options::From(command);
+  if (!options.Ok()) {
+    cerr << options.GetErrorMessage();
+    return std::nullopt;
+  }
+  if (options.WriteIfChanged() || options.StageOutputs() > 0 || options.PrefetchDepth() > 0 ||
+      !options.ProfileFile().empty()) {
+    cerr << "aidl: --write-if-changed, --stage-outputs, --prefetch-depth and --profile can be "
+         << "given to --server or --batch, but not to one of its commands: " << command << endl;
+    return std::nullopt;
+  }
+  return options;
+}
+
+// Runs one command of --server or --batch. Those two can't be nested.
+static int run_command(const string& command, const IoDelegate& io_delegate,
+                       internals::ParsedFileCache* parsed_files) {
+  std::optional<Options> parsed = parse_command(command);
+  if (!parsed) {
+    return 1;
+  }
+  const Options& options = *parsed;
+  switch (options.GetTask()) {
+    case Options::Task::COMPILE:
+      return compile_aidl(options, io_delegate, parsed_files);
+    case Options::Task::PREPROCESS:
+      return preprocess_aidl(options, io_delegate, parsed_files) ? 0 : 1;
+    case Options::Task::DUMP_API:
+      return dump_api(options, io_delegate, parsed_files) ? 0 : 1;
+    case Options::Task::CHECK_API:
+      return check_api(options, io_delegate, parsed_files) ? 0 : 1;
+    case Options::Task::DUMP_MAPPINGS:
+      return dump_mappings(options, io_delegate, parsed_files) ? 0 : 1;
+    case Options::Task::COMPUTE_HASH:
+      return compute_api_hash(options, io_delegate) ? 0 : 1;
+    default:
+      cerr << "aidl: unsupported request: " << command << endl;
+      return 1;
+  }
+}
+
+namespace server {
+
+bool node_contains(const AidlNode& node, const string& file, int line, int column) {
+  return node.location_.Contains(file, {line, column});
+}
+
+std::string dump_location(const AidlNode& node) {
+  return node.PrintLocation();
+}
+
+// Adds |type| and the type parameters written in it to |specifiers|.
+static void collect_type_specifiers(const AidlTypeSpecifier& type,
+                                    vector<const AidlTypeSpecifier*>* specifiers) {
+  specifiers->push_back(&type);
+  if (type.IsGeneric()) {
+    for (const auto& parameter : type.GetTypeParameters()) {
+      collect_type_specifiers(*parameter, specifiers);
+    }
+  }
+}
+
+// The type specifiers written in the body of |type|.
+static vector<const AidlTypeSpecifier*> type_specifiers_of(const AidlDefinedType& type) {
+  vector<const AidlTypeSpecifier*> specifiers;
+  if (const AidlInterface* interface = type.AsInterface(); interface != nullptr) {
+    for (const auto& method : interface->GetMethods()) {
+      collect_type_specifiers(method->GetType(), &specifiers);
+      for (const auto& arg : method->GetArguments()) {
+        collect_type_specifiers(arg->GetType(), &specifiers);
+      }
+    }
+    for (const auto& constant : interface->GetConstantDeclarations()) {
+      collect_type_specifiers(constant->GetType(), &specifiers);
+    }
+  }
+  if (const AidlStructuredParcelable* parcelable = type.AsStructuredParcelable();
+      parcelable != nullptr) {
+    for (const auto& field : parcelable->GetFields()) {
+      collect_type_specifiers(field->GetType(), &specifiers);
+    }
+  }
+  return specifiers;
+}
+
+// Validates the inputs of |command| without generating anything, and writes
+// their errors to |responses|.
+static int check(const string& command, const IoDelegate& io_delegate,
+                 internals::ParsedFileCache* parsed_files, std::ostream& responses) {
+  std::optional<Options> parsed = parse_command(command);
+  if (!parsed) {
+    return 1;
+  }
+  const Options& options = *parsed;
+  int status = 0;
+  for (const string& input_file : options.InputFiles()) {
+    AidlTypenames typenames;
+    vector<AidlDefinedType*> defined_types;
+    vector<string> imported_files;
+    AidlErrorCapture errors;
+    if (internals::load_and_validate_aidl(input_file, options, io_delegate, &typenames,
+                                          &defined_types, &imported_files,
+                                          parsed_files) != AidlError::OK) {
+      status = 1;
+    }
+    responses << errors.str();
+  }
+  return status;
+}
+
+// Writes the location of the definition of the type written at |position|,
+// FILE:LINE:COLUMN, to |responses|. FILE is loaded with the options of
+// |command|.
+static int definition(const string& position, const string& command,
+                      const IoDelegate& io_delegate, internals::ParsedFileCache* parsed_files,
+                      std::ostream& responses) {
+  const vector<string> parts = Split(position, ":");
+  int line = 0;
+  int column = 0;
+  if (parts.size() < 3 || !android::base::ParseInt(parts[parts.size() - 2], &line) ||
+      !android::base::ParseInt(parts.back(), &column)) {
+    cerr << "aidl: invalid position: " << position << endl;
+    return 1;
+  }
+  const string file = Join(vector<string>(parts.begin(), parts.end() - 2), ":");
+  std::optional<Options> parsed = parse_command(command);
+  if (!parsed) {
+    return 1;
+  }
+  const Options& options = *parsed;
+  AidlTypenames typenames;
+  vector<AidlDefinedType*> defined_types;
+  vector<string> imported_files;
+  AidlErrorCapture errors;
+  if (internals::load_and_validate_aidl(file, options, io_delegate, &typenames, &defined_types,
+                                        &imported_files, parsed_files) != AidlError::OK) {
+    responses << errors.str();
+    return 1;
+  }
+  for (const AidlDefinedType* defined_type : defined_types) {
+    for (const AidlTypeSpecifier* type : type_specifiers_of(*defined_type)) {
+      if (!node_contains(*type, file, line, column)) {
+        continue;
+      }
+      const AidlDefinedType* target = typenames.TryGetDefinedType(type->GetName());
+      if (target == nullptr) {
+        // A builtin type, which isn't defined in any file.
+        return 1;
+      }
+      responses << dump_location(*target) << endl;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+}  // namespace server
+
+// Besides command lines, the server answers the requests of editors:
+//   check COMMAND                        the errors of the inputs of COMMAND
+//   definition FILE:LINE:COLUMN COMMAND  where the type at the position is
+//                                        defined, loading FILE with COMMAND
+// Only the edited files are parsed again, as imports are cached until they
+// change. Each response is a line "STATUS LENGTH" followed by the LENGTH
+// bytes of the answer, which is empty for command lines. Errors can span
+// several lines, so the length is what tells where a response ends.
+int run_server(const IoDelegate& io_delegate, std::istream& requests, std::ostream& responses) {
+  internals::ParsedFileCache parsed_files(true /* check_for_changes */);
+  string request;
+  while (std::getline(requests, request)) {
+    request = Trim(request);
+    if (request.empty()) {
+      continue;
+    }
+    // Each request succeeds or fails on its own.
+    ::AidlError::ClearHadError();
+    const vector<string> words = Split(request, " ");
+    std::ostringstream answer;
+    int status;
+    if (words[0] == "check" && words.size() > 1) {
+      status = server::check(request.substr(words[0].size() + 1), io_delegate, &parsed_files,
+                             answer);
+    } else if (words[0] == "definition" && words.size() > 2) {
+      status = server::definition(words[1], request.substr(words[0].size() + words[1].size() + 2),
+                                  io_delegate, &parsed_files, answer);
     } else {
-      return false;
+      status = run_command(request, io_delegate, &parsed_files);
     }
+    const string body = answer.str();
+    responses << status << " " << body.size() << "\n" << body << std::flush;
   }
-  return true;
+  return 0;
+}
+
+// Unlike --server, a batch is one build step, so the files it reads don't
+// change while it runs.
+int run_batch(const Options& options, const IoDelegate& io_delegate) {
+  const string& manifest = options.InputFiles().at(0);
+  unique_ptr<string> commands = io_delegate.GetFileContents(manifest);
+  if (commands == nullptr) {
+    AIDL_ERROR(manifest) << "Cannot read the batch manifest.";
+    return 1;
+  }
+  internals::ParsedFileCache parsed_files;
+  const vector<string> lines = Split(*commands, "\n");
+  for (size_t i = 0; i < lines.size(); i++) {
+    const string command = Trim(lines[i]);
+    if (command.empty() || command[0] == '#') {
+      continue;
+    }
+    if (run_command(command, io_delegate, &parsed_files) != 0) {
+      AIDL_ERROR(manifest + ":" + std::to_string(i + 1)) << "Command failed: " << command;
+      return 1;
+    }
+  }
+  return 0;
 }
 
 }  // namespace aidl
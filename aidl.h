@@ -16,7 +16,10 @@
 
 #pragma once
 
+#include <functional>
+#include <iostream>
 #include <limits>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -45,10 +48,33 @@ enum class AidlError {
   OK = 0,
 };
 
-int compile_aidl(const Options& options, const IoDelegate& io_delegate);
-bool preprocess_aidl(const Options& options, const IoDelegate& io_delegate);
-bool dump_api(const Options& options, const IoDelegate& io_delegate);
-bool dump_mappings(const Options& options, const IoDelegate& io_delegate);
+namespace internals {
+class ParsedFileCache;
+}  // namespace internals
+
+// When |parsed_files| is not null, imported and preprocessed files are
+// taken from it, and it keeps the files parsed by this call.
+int compile_aidl(const Options& options, const IoDelegate& io_delegate,
+                 internals::ParsedFileCache* parsed_files = nullptr);
+bool preprocess_aidl(const Options& options, const IoDelegate& io_delegate,
+                     internals::ParsedFileCache* parsed_files = nullptr);
+bool dump_api(const Options& options, const IoDelegate& io_delegate,
+              internals::ParsedFileCache* parsed_files = nullptr);
+bool dump_mappings(const Options& options, const IoDelegate& io_delegate,
+                   internals::ParsedFileCache* parsed_files = nullptr);
+bool compute_api_hash(const Options& options, const IoDelegate& io_delegate);
+
+// Runs the commands read from |requests|, one command line per line, and
+// writes a response for each of them to |responses|: a line with the exit
+// status and the length of the answer, and then the answer. Only the check
+// and definition requests of editors have an answer. Parsed imported and
+// preprocessed files are kept across the commands.
+int run_server(const IoDelegate& io_delegate, std::istream& requests, std::ostream& responses);
+
+// Runs the command lines in the manifest file given as the input of
+// |options|, one per line, sharing the parsed imported and preprocessed files.
+// Stops at the first command that fails.
+int run_batch(const Options& options, const IoDelegate& io_delegate);
 
 const char kPreamble[] =
     R"(///////////////////////////////////////////////////////////////////////////////
@@ -70,19 +96,126 @@ const char kPreamble[] =
 
 )";
 
+// Written by --dumpapi next to the dumped files. Each line is
+//   <canonical name> <hash>
+// where <hash> is the 64-bit FNV-1a hash, in hex, of the dumped text of the
+// type. --checkapi doesn't compare the types whose hashes are the same in two
+// adjacent dumps, and doesn't load them when they are the same in all the
+// pairs that a dump is in.
+const char kApiTypeHashesFile[] = ".type_hashes";
+
 const string kGetInterfaceVersion("getInterfaceVersion");
 const string kGetInterfaceHash("getInterfaceHash");
 
 namespace internals {
 
+// A file parsed into its own typenames, so that files can be parsed in
+// parallel and their types added to the typenames of an input afterwards.
+struct ParsedImport {
+  bool ok = false;
+  AidlTypenames types;
+  vector<const AidlDefinedType*> defined_types;
+  // Errors from parsing the file, which every AddTo reports
+  string errors;
+
+  // Parses |path|, keeping the errors instead of reporting them.
+  void Parse(const string& path, const IoDelegate& io_delegate, Parser::Comments comments);
+  // Reports the errors and makes the types visible through |typenames|.
+  // Returns false if the file couldn't be parsed or redefines a type.
+  bool AddTo(AidlTypenames* typenames) const;
+};
+
+// Imported and preprocessed files parsed while compiling several input files
+// in one invocation. Each file is parsed only once; the resulting types are
+// then shared, read-only, by the AidlTypenames of every input that needs them.
+class ParsedFileCache final {
+ public:
+  // If |check_for_changes| is true, files whose contents have changed since
+  // they were parsed are parsed again. This is for caches that outlive one
+  // invocation, like the one of run_server.
+  explicit ParsedFileCache(bool check_for_changes = false)
+      : check_for_changes_(check_for_changes) {}
+
+  // Makes the types defined in |import_path| visible through |typenames|,
+  // parsing the file on first use. Returns false if the file cannot be parsed
+  // or if it redefines a type already known to |typenames|. The errors of a
+  // file that cannot be parsed are reported again on every load. A file that
+  // was parsed with lazy comments still reads them when they are used, except
+  // in a cache that checks for changes: it copies the comments, as its files
+  // may be rewritten while it keeps them, which would change the mapped text
+  // that lazy comments read.
+  bool LoadImport(const string& import_path, const IoDelegate& io_delegate,
+                  AidlTypenames* typenames,
+                  Parser::Comments comments = Parser::Comments::COPY);
+  // Parses those of |import_paths| that aren't in the cache yet with
+  // |num_threads| threads, for LoadImport to pick up. The errors they report
+  // are kept for it, so that they come out in the order of the loads.
+  void ParseImports(const vector<string>& import_paths, const IoDelegate& io_delegate,
+                    Parser::Comments comments, size_t num_threads);
+  // The types that |path| defines, in the order of the file, parsing it on
+  // first use like LoadImport. Returns nullptr after reporting the errors if
+  // the file cannot be parsed.
+  const vector<const AidlDefinedType*>* DefinedTypesOf(const string& path,
+                                                       const IoDelegate& io_delegate,
+                                                       Parser::Comments comments);
+  bool ChecksForChanges() const { return check_for_changes_; }
+  // Whether |import_path| has to be read for LoadImport, because it isn't
+  // parsed yet or may have changed since.
+  bool NeedsFile(const string& import_path) const {
+    return check_for_changes_ || imports_.count(import_path) == 0;
+  }
+  // Same as LoadImport, for a preprocessed file.
+  bool LoadPreprocessed(const string& filename, const IoDelegate& io_delegate,
+                        AidlTypenames* typenames);
+
+ private:
+  struct Entry : ParsedImport {
+    // When the file has a stamp, its contents are hashed only if the stamp
+    // changes.
+    bool has_stamp = false;
+    FileStamp stamp;
+    size_t content_hash = 0;
+  };
+  // |comments|, or COPY if the files may change while they are kept
+  Parser::Comments KeptComments(Parser::Comments comments) const {
+    return check_for_changes_ ? Parser::Comments::COPY : comments;
+  }
+  // Parses |import_path| into |entry|, keeping the errors in it, and
+  // completes its enums, as they are shared from then on.
+  static void ParseEntry(const string& import_path, const IoDelegate& io_delegate,
+                         Parser::Comments comments, Entry* entry);
+  // Returns the entry for |path| in |entries| if it is still valid, otherwise
+  // a new empty entry which is to be filled by the caller.
+  Entry* GetEntry(const string& path, const IoDelegate& io_delegate,
+                  map<string, unique_ptr<Entry>>* entries);
+
+  const bool check_for_changes_;
+  map<string, unique_ptr<Entry>> imports_;
+  map<string, unique_ptr<Entry>> preprocessed_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParsedFileCache);
+};
+
+// When |cache| is not null, imported and preprocessed files are taken from it
+// instead of being parsed into |typenames|.
 AidlError load_and_validate_aidl(const std::string& input_file_name, const Options& options,
                                  const IoDelegate& io_delegate, AidlTypenames* typenames,
                                  vector<AidlDefinedType*>* defined_types,
-                                 vector<string>* imported_files);
+                                 vector<string>* imported_files,
+                                 ParsedFileCache* cache = nullptr);
 
 bool parse_preprocessed_file(const IoDelegate& io_delegate, const std::string& filename,
                              AidlTypenames* typenames);
 
+// Runs |jobs| on up to |num_threads| threads, including the calling one.
+// Returns false if any of the jobs has failed.
+bool run_jobs(size_t num_threads, const vector<std::function<bool()>>& jobs);
+
+// Same as run_jobs, but the errors of each job are written to |out| once all
+// of them are done, in the order of |jobs|.
+bool run_jobs_in_order(size_t num_threads, const vector<std::function<bool()>>& jobs,
+                       std::ostream* out = &std::cerr);
+
 } // namespace internals
 
 }  // namespace aidl
@@ -19,8 +19,15 @@
 #include "import_resolver.h"
 #include "logging.h"
 #include "options.h"
+#include "os.h"
 
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <iostream>
 #include <map>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -29,9 +36,11 @@
 namespace android {
 namespace aidl {
 
+using android::base::Split;
 using std::map;
 using std::set;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 
 static set<AidlAnnotation> get_strict_annotations(const AidlAnnotatable& node) {
@@ -46,8 +55,12 @@ static set<AidlAnnotation> get_strict_annotations(const AidlAnnotatable& node) {
   // - a new implementation might change so that it no longer returns null
   // values (remove @nullable)
   // - a new implementation might start accepting null values (add @nullable)
+  //
+  // @Utf8Strings is the exception: are_compatible_interfaces() lets it be added,
+  // as proxies only write UTF-8 to a remote of its version, but not removed.
   static const set<std::string> kIgnoreAnnotations{
       "nullable",
+      "Utf8Strings",
   };
   set<AidlAnnotation> annotations;
   for (const AidlAnnotation& annotation : node.GetAnnotations()) {
@@ -85,6 +98,11 @@ static bool are_compatible_types(const AidlTypeSpecifier& older, const AidlTypeS
 static bool are_compatible_interfaces(const AidlInterface& older, const AidlInterface& newer) {
   bool compatible = true;
   compatible &= have_compatible_annotations(older, newer);
+  if (older.IsUtf8Strings() && !newer.IsUtf8Strings()) {
+    AIDL_ERROR(newer) << "Removed @Utf8Strings from " << older.GetCanonicalName()
+                      << ". Proxies of the older version write UTF-8 to it.";
+    compatible = false;
+  }
 
   map<string, AidlMethod*> new_methods;
   for (const auto& m : newer.AsInterface()->GetMethods()) {
@@ -245,101 +263,216 @@ static bool are_compatible_enums(const AidlEnumDeclaration& older,
   return compatible;
 }
 
-bool check_api(const Options& options, const IoDelegate& io_delegate) {
-  CHECK(options.IsStructured());
-  CHECK(options.InputFiles().size() == 2) << "--checkapi requires two inputs "
-                                          << "but got " << options.InputFiles().size();
-  AidlTypenames old_tns;
-  const string old_dir = options.InputFiles().at(0);
-  vector<AidlDefinedType*> old_types;
-  vector<string> old_files = io_delegate.ListFiles(old_dir);
-  if (old_files.size() == 0) {
-    AIDL_ERROR(old_dir) << "No API file exist";
+// The types of an API dump directory. The files of one dump are loaded in
+// order into the same typenames, as a file can refer to the types of the
+// files loaded before it.
+struct ApiDump {
+  AidlTypenames typenames;
+  vector<AidlDefinedType*> types;
+};
+
+static string api_file_path(const string& dir, const string& relative_path) {
+  if (!dir.empty() && dir.back() == OS_PATH_SEPARATOR) {
+    return dir + relative_path;
+  }
+  return dir + OS_PATH_SEPARATOR + relative_path;
+}
+
+// The hashes in the kApiTypeHashesFile of |dir| by type name. Empty for the
+// dumps made before the file existed.
+static map<string, string> read_type_hashes(const string& dir, const IoDelegate& io_delegate) {
+  map<string, string> hashes;
+  unique_ptr<string> contents =
+      io_delegate.GetFileContents(api_file_path(dir, kApiTypeHashesFile));
+  if (contents == nullptr) {
+    return hashes;
+  }
+  for (const string& line : Split(*contents, "\n")) {
+    const vector<string> fields = Split(line, " ");
+    if (fields.size() == 2) {
+      hashes[fields[0]] = fields[1];
+    }
+  }
+  return hashes;
+}
+
+// The names of the types whose hashes are the same in both dumps.
+static set<string> unchanged_api_types(const string& old_dir, const string& new_dir,
+                                       const IoDelegate& io_delegate) {
+  const map<string, string> old_hashes = read_type_hashes(old_dir, io_delegate);
+  const map<string, string> new_hashes = read_type_hashes(new_dir, io_delegate);
+  set<string> types;
+  for (const auto& [name, hash] : old_hashes) {
+    const auto found = new_hashes.find(name);
+    if (found != new_hashes.end() && found->second == hash) {
+      types.insert(name);
+    }
+  }
+  return types;
+}
+
+// The paths, relative to the dump directories, of the files of |types|.
+static set<string> api_files_of(const set<string>& types) {
+  set<string> files;
+  for (const string& name : types) {
+    string path = name;
+    std::replace(path.begin(), path.end(), '.', OS_PATH_SEPARATOR);
+    files.insert(path + ".aidl");
+  }
+  return files;
+}
+
+static bool load_api_dump(const string& dir, const Options& options,
+                          const IoDelegate& io_delegate, const set<string>& skipped_files,
+                          internals::ParsedFileCache* parsed_files, ApiDump* dump) {
+  vector<string> files = io_delegate.ListFiles(dir);
+  if (files.size() == 0) {
+    AIDL_ERROR(dir) << "No API file exist";
     return false;
   }
-  for (const auto& file : old_files) {
+  for (const auto& file : files) {
     if (!android::base::EndsWith(file, ".aidl")) continue;
+    const size_t relative_start = file.find_first_not_of(OS_PATH_SEPARATOR, dir.size());
+    if (relative_start != string::npos && skipped_files.count(file.substr(relative_start))) {
+      continue;
+    }
 
     vector<AidlDefinedType*> types;
-    if (internals::load_and_validate_aidl(file, options, io_delegate, &old_tns, &types,
-                                          nullptr /* imported_files */) != AidlError::OK) {
+    if (internals::load_and_validate_aidl(file, options, io_delegate, &dump->typenames, &types,
+                                          nullptr /* imported_files */,
+                                          parsed_files) != AidlError::OK) {
       AIDL_ERROR(file) << "Failed to read.";
       return false;
     }
-    old_types.insert(old_types.end(), types.begin(), types.end());
+    dump->types.insert(dump->types.end(), types.begin(), types.end());
+  }
+  return true;
+}
+
+// Loads each dump of |options| once, without the files in the matching entry
+// of |skipped_files|. The cache isn't thread-safe, so the dumps are loaded one
+// at a time when there is one.
+static bool load_api_dumps(const Options& options, const IoDelegate& io_delegate,
+                           const vector<set<string>>& skipped_files,
+                           internals::ParsedFileCache* parsed_files,
+                           vector<unique_ptr<ApiDump>>* dumps, std::ostream* errors) {
+  const vector<string>& dirs = options.InputFiles();
+  dumps->clear();
+  vector<std::function<bool()>> load_jobs;
+  for (size_t i = 0; i < dirs.size(); i++) {
+    dumps->push_back(std::make_unique<ApiDump>());
+    load_jobs.emplace_back([&, i, dump = dumps->back().get()]() {
+      return load_api_dump(dirs[i], options, io_delegate, skipped_files[i], parsed_files, dump);
+    });
   }
+  const size_t jobs = parsed_files != nullptr ? 1 : options.Jobs();
+  return internals::run_jobs_in_order(jobs, load_jobs, errors);
+}
 
-  AidlTypenames new_tns;
-  const string new_dir = options.InputFiles().at(1);
-  vector<AidlDefinedType*> new_types;
-  vector<string> new_files = io_delegate.ListFiles(new_dir);
-  if (new_files.size() == 0) {
-    AIDL_ERROR(new_dir) << "No API file exist";
+static bool is_compatible_type(const AidlDefinedType* old_type,
+                               const map<string, AidlDefinedType*>& new_map) {
+  const auto found = new_map.find(old_type->GetCanonicalName());
+  if (found == new_map.end()) {
+    AIDL_ERROR(old_type) << "Removed type: " << old_type->GetCanonicalName();
     return false;
   }
-  for (const auto& file : new_files) {
-    if (!android::base::EndsWith(file, ".aidl")) continue;
+  const auto new_type = found->second;
 
-    vector<AidlDefinedType*> types;
-    if (internals::load_and_validate_aidl(file, options, io_delegate, &new_tns, &types,
-                                          nullptr /* imported_files */) != AidlError::OK) {
-      AIDL_ERROR(file) << "Failed to read.";
+  if (old_type->AsInterface() != nullptr) {
+    if (new_type->AsInterface() == nullptr) {
+      AIDL_ERROR(new_type) << "Type mismatch: " << old_type->GetCanonicalName()
+                           << " is changed from " << old_type->GetPreprocessDeclarationName()
+                           << " to " << new_type->GetPreprocessDeclarationName();
+      return false;
+    }
+    return are_compatible_interfaces(*(old_type->AsInterface()), *(new_type->AsInterface()));
+  } else if (old_type->AsStructuredParcelable() != nullptr) {
+    if (new_type->AsStructuredParcelable() == nullptr) {
+      AIDL_ERROR(new_type) << "Parcelable" << new_type->GetCanonicalName()
+                           << " is not structured. ";
       return false;
     }
-    new_types.insert(new_types.end(), types.begin(), types.end());
+    return are_compatible_parcelables(*(old_type->AsStructuredParcelable()),
+                                      *(new_type->AsStructuredParcelable()));
+  } else if (old_type->AsEnumDeclaration() != nullptr) {
+    if (new_type->AsEnumDeclaration() == nullptr) {
+      AIDL_ERROR(new_type) << "Type mismatch: " << old_type->GetCanonicalName()
+                           << " is changed from " << old_type->GetPreprocessDeclarationName()
+                           << " to " << new_type->GetPreprocessDeclarationName();
+      return false;
+    }
+    return are_compatible_enums(*(old_type->AsEnumDeclaration()),
+                                *(new_type->AsEnumDeclaration()));
   }
+  AIDL_ERROR(old_type) << "Unsupported type " << old_type->GetPreprocessDeclarationName()
+                       << " for " << old_type->GetCanonicalName();
+  return false;
+}
 
-  map<string, AidlDefinedType*> new_map;
-  for (const auto t : new_types) {
-    new_map.emplace(t->GetCanonicalName(), t);
+bool check_api(const Options& options, const IoDelegate& io_delegate,
+               internals::ParsedFileCache* parsed_files) {
+  CHECK(options.IsStructured());
+  const vector<string>& dirs = options.InputFiles();
+  CHECK(dirs.size() >= 2) << "--checkapi requires at least two inputs "
+                          << "but got " << dirs.size();
+  // Each dump is loaded once, even though the ones in the middle are both the
+  // new dump of one pair and the old dump of the next.
+  // The types whose hashes match in a pair of dumps are not compared. A dump
+  // doesn't load their files at all if they also match in the other pair it
+  // is in. If a changed type uses one of them, the dumps are loaded again in
+  // full.
+  // With -j, the dumps are loaded at the same time, and then the old types of
+  // each pair are checked in parallel. Errors are still printed in the serial
+  // order.
+  vector<set<string>> unchanged_types;  // of each pair
+  for (size_t i = 0; i + 1 < dirs.size(); i++) {
+    unchanged_types.push_back(unchanged_api_types(dirs[i], dirs[i + 1], io_delegate));
+  }
+  vector<set<string>> skipped_files;  // of each dump
+  bool skips_any = false;
+  for (size_t i = 0; i < dirs.size(); i++) {
+    set<string> skipped = i > 0 ? unchanged_types[i - 1] : unchanged_types[i];
+    if (i > 0 && i < unchanged_types.size()) {
+      set<string> in_both;
+      std::set_intersection(skipped.begin(), skipped.end(), unchanged_types[i].begin(),
+                            unchanged_types[i].end(), std::inserter(in_both, in_both.end()));
+      skipped = std::move(in_both);
+    }
+    skipped_files.push_back(api_files_of(skipped));
+    skips_any = skips_any || !skipped.empty();
+  }
+  vector<unique_ptr<ApiDump>> dumps;
+  bool loaded = false;
+  if (skips_any) {
+    std::ostringstream ignored_errors;
+    loaded = load_api_dumps(options, io_delegate, skipped_files, parsed_files, &dumps,
+                            &ignored_errors);
+  }
+  if (!loaded && !load_api_dumps(options, io_delegate, vector<set<string>>(dirs.size()),
+                                 parsed_files, &dumps, &std::cerr)) {
+    return false;
   }
 
   bool compatible = true;
-  for (const auto old_type : old_types) {
-    const auto found = new_map.find(old_type->GetCanonicalName());
-    if (found == new_map.end()) {
-      AIDL_ERROR(old_type) << "Removed type: " << old_type->GetCanonicalName();
-      compatible = false;
-      continue;
+  for (size_t i = 0; i + 1 < dumps.size(); i++) {
+    map<string, AidlDefinedType*> new_map;
+    for (const auto t : dumps[i + 1]->types) {
+      new_map.emplace(t->GetCanonicalName(), t);
     }
-    const auto new_type = found->second;
 
-    if (old_type->AsInterface() != nullptr) {
-      if (new_type->AsInterface() == nullptr) {
-        AIDL_ERROR(new_type) << "Type mismatch: " << old_type->GetCanonicalName()
-                             << " is changed from " << old_type->GetPreprocessDeclarationName()
-                             << " to " << new_type->GetPreprocessDeclarationName();
-        compatible = false;
-        continue;
-      }
-      compatible &=
-          are_compatible_interfaces(*(old_type->AsInterface()), *(new_type->AsInterface()));
-    } else if (old_type->AsStructuredParcelable() != nullptr) {
-      if (new_type->AsStructuredParcelable() == nullptr) {
-        AIDL_ERROR(new_type) << "Parcelable" << new_type->GetCanonicalName()
-                             << " is not structured. ";
-        compatible = false;
-        continue;
-      }
-      compatible &= are_compatible_parcelables(*(old_type->AsStructuredParcelable()),
-                                               *(new_type->AsStructuredParcelable()));
-    } else if (old_type->AsEnumDeclaration() != nullptr) {
-      if (new_type->AsEnumDeclaration() == nullptr) {
-        AIDL_ERROR(new_type) << "Type mismatch: " << old_type->GetCanonicalName()
-                             << " is changed from " << old_type->GetPreprocessDeclarationName()
-                             << " to " << new_type->GetPreprocessDeclarationName();
-        compatible = false;
-        continue;
+    vector<std::function<bool()>> check_jobs;
+    for (const auto old_type : dumps[i]->types) {
+      if (unchanged_types[i].count(old_type->GetCanonicalName()) > 0) continue;
+      check_jobs.emplace_back(
+          [old_type, &new_map]() { return is_compatible_type(old_type, new_map); });
+    }
+    if (!internals::run_jobs_in_order(options.Jobs(), check_jobs)) {
+      if (dumps.size() > 2) {
+        AIDL_ERROR(dirs[i + 1]) << "Not backwards compatible with " << dirs[i];
       }
-      compatible &=
-          are_compatible_enums(*(old_type->AsEnumDeclaration()), *(new_type->AsEnumDeclaration()));
-    } else {
-      AIDL_ERROR(old_type) << "Unsupported type " << old_type->GetPreprocessDeclarationName()
-                           << " for " << old_type->GetCanonicalName();
       compatible = false;
     }
   }
-
   return compatible;
 }
 
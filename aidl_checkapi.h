@@ -14,15 +14,18 @@
  */
 #pragma once
 
+#include "aidl.h"
 #include "io_delegate.h"
 #include "options.h"
 
 namespace android {
 namespace aidl {
 
-// Compare the two API dumps, which are given as input files, and test whether
-// the second API dump is backwards compatible with the first API dump.
-bool check_api(const Options& options, const IoDelegate& io_delegate);
+// Compare the API dumps, which are given as input files in version order, and
+// test whether each API dump is backwards compatible with the one before it.
+// If |parsed_files| is given, the dumps are parsed through it, one at a time.
+bool check_api(const Options& options, const IoDelegate& io_delegate,
+               internals::ParsedFileCache* parsed_files = nullptr);
 
 }  // namespace aidl
 }  // namespace android
@@ -316,23 +316,21 @@ AidlConstantValue* AidlConstantValue::ShallowIntegralCopy(const AidlConstantValu
     AIDL_ERROR(other) << "Failed to parse expression as integer: " << other.value_;
     return nullptr;
   }
-  const std::string& value = other.ValueString(type, AidlConstantValueDecorator);
-  if (value.empty()) {
+  if (!other.Evaluate(type)) {
     return nullptr;  // error already logged
   }
 
-  AidlConstantValue* result = Integral(AIDL_LOCATION_HERE, value);
+  AidlConstantValue* result = Integral(AIDL_LOCATION_HERE, *other.RawValue(type));
   if (result == nullptr) {
     AIDL_FATAL(other) << "Unable to perform ShallowIntegralCopy.";
   }
   return result;
 }
 
-string AidlConstantValue::ValueString(const AidlTypeSpecifier& type,
-                                      const ConstantValueDecorator& decorator) const {
+bool AidlConstantValue::Evaluate(const AidlTypeSpecifier& type) const {
   if (type.IsGeneric()) {
     AIDL_ERROR(type) << "Generic type cannot be specified with a constant literal.";
-    return "";
+    return false;
   }
   if (!is_evaluated_) {
     // TODO(b/142722772) CheckValid() should be called before ValueString()
@@ -340,77 +338,68 @@ string AidlConstantValue::ValueString(const AidlTypeSpecifier& type,
     success &= evaluate(type);
     if (!success) {
       // the detailed error message shall be printed in evaluate
-      return "";
+      return false;
     }
   }
   if (!is_valid_) {
     AIDL_ERROR(this) << "Invalid constant value: " + value_;
-    return "";
+    return false;
+  }
+  if (final_type_ != Type::ARRAY) {
+    return RawValue(type).has_value();
+  }
+
+  bool success = type.IsArray();
+  if (success) {
+    const AidlTypeSpecifier& array_base = type.ArrayBase();
+    for (const auto& value : values_) {
+      if (!value->Evaluate(array_base)) {
+        success = false;
+        break;
+      }
+    }
+  }
+  if (!success) {
+    AIDL_ERROR(this) << "Invalid type specifier for " << ToString(final_type_) << ": "
+                     << type.GetName();
   }
+  return success;
+}
+
+std::optional<string> AidlConstantValue::RawValue(const AidlTypeSpecifier& type) const {
   const string& type_string = type.GetName();
-  int err = 0;
+  if ((final_type_ == Type::CHARACTER && type_string == "char") ||
+      (final_type_ == Type::STRING && type_string == "String")) {
+    return final_string_value_;
+  }
 
+  string raw_value;
+  int err = -1;
   switch (final_type_) {
-    case Type::CHARACTER:
-      if (type_string == "char") {
-        return decorator(type, final_string_value_);
-      }
-      err = -1;
-      break;
-    case Type::STRING:
-      if (type_string == "String") {
-        return decorator(type, final_string_value_);
-      }
-      err = -1;
-      break;
     case Type::BOOLEAN:  // fall-through
     case Type::INT8:     // fall-through
     case Type::INT32:    // fall-through
     case Type::INT64:
       if (type_string == "byte") {
         if (final_value_ > INT8_MAX || final_value_ < INT8_MIN) {
-          err = -1;
           break;
         }
-        return decorator(type, std::to_string(static_cast<int8_t>(final_value_)));
+        raw_value = std::to_string(static_cast<int8_t>(final_value_));
+        err = 0;
       } else if (type_string == "int") {
         if (final_value_ > INT32_MAX || final_value_ < INT32_MIN) {
-          err = -1;
           break;
         }
-        return decorator(type, std::to_string(static_cast<int32_t>(final_value_)));
+        raw_value = std::to_string(static_cast<int32_t>(final_value_));
+        err = 0;
       } else if (type_string == "long") {
-        return decorator(type, std::to_string(final_value_));
+        raw_value = std::to_string(final_value_);
+        err = 0;
       } else if (type_string == "boolean") {
-        return decorator(type, final_value_ ? "true" : "false");
+        raw_value = final_value_ ? "true" : "false";
+        err = 0;
       }
-      err = -1;
       break;
-    case Type::ARRAY: {
-      if (!type.IsArray()) {
-        err = -1;
-        break;
-      }
-      vector<string> value_strings;
-      value_strings.reserve(values_.size());
-      bool success = true;
-
-      for (const auto& value : values_) {
-        const AidlTypeSpecifier& array_base = type.ArrayBase();
-        const string value_string = value->ValueString(array_base, decorator);
-        if (value_string.empty()) {
-          success = false;
-          break;
-        }
-        value_strings.push_back(value_string);
-      }
-      if (!success) {
-        err = -1;
-        break;
-      }
-
-      return decorator(type, "{" + Join(value_strings, ", ") + "}");
-    }
     case Type::FLOATING: {
       std::string_view raw_view(value_.c_str());
       bool is_float_literal = ConsumeSuffix(&raw_view, "f");
@@ -420,31 +409,49 @@ string AidlConstantValue::ValueString(const AidlTypeSpecifier& type,
         double parsed_value;
         if (!android::base::ParseDouble(stripped_value, &parsed_value)) {
           AIDL_ERROR(this) << "Could not parse " << value_;
-          err = -1;
           break;
         }
-        return decorator(type, std::to_string(parsed_value));
-      }
-      if (is_float_literal && type_string == "float") {
+        raw_value = std::to_string(parsed_value);
+        err = 0;
+      } else if (is_float_literal && type_string == "float") {
         float parsed_value;
         if (!android::base::ParseFloat(stripped_value, &parsed_value)) {
           AIDL_ERROR(this) << "Could not parse " << value_;
-          err = -1;
           break;
         }
-        return decorator(type, std::to_string(parsed_value) + "f");
+        raw_value = std::to_string(parsed_value) + "f";
+        err = 0;
       }
-      err = -1;
       break;
     }
     default:
-      err = -1;
       break;
   }
 
-  CHECK(err != 0);
-  AIDL_ERROR(this) << "Invalid type specifier for " << ToString(final_type_) << ": " << type_string;
-  return "";
+  if (err != 0) {
+    AIDL_ERROR(this) << "Invalid type specifier for " << ToString(final_type_) << ": "
+                     << type_string;
+    return std::nullopt;
+  }
+  return raw_value;
+}
+
+string AidlConstantValue::ValueString(const AidlTypeSpecifier& type,
+                                      const ConstantValueDecorator& decorator) const {
+  if (!Evaluate(type)) {
+    return "";
+  }
+  if (final_type_ != Type::ARRAY) {
+    return decorator(type, *RawValue(type));
+  }
+
+  vector<string> value_strings;
+  value_strings.reserve(values_.size());
+  const AidlTypeSpecifier& array_base = type.ArrayBase();
+  for (const auto& value : values_) {
+    value_strings.push_back(value->ValueString(array_base, decorator));
+  }
+  return decorator(type, "{" + Join(value_strings, ", ") + "}");
 }
 
 bool AidlConstantValue::CheckValid() const {
@@ -17,11 +17,17 @@
 #include "aidl_language.h"
 #include "aidl_typenames.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <set>
 #include <sstream>
 #include <string>
@@ -33,6 +39,7 @@
 
 #include "aidl_language_y-module.h"
 #include "logging.h"
+#include "profile.h"
 
 #include "aidl.h"
 
@@ -78,22 +85,169 @@ inline bool HasHideComment(const std::string& comment) {
 }
 }  // namespace
 
-void yylex_init(void **);
+int yylex_init_extra(Parser*, void**);
 void yylex_destroy(void *);
 void yyset_in(FILE *f, void *);
 int yyparse(Parser*);
 YY_BUFFER_STATE yy_scan_buffer(char *, size_t, void *);
 void yy_delete_buffer(YY_BUFFER_STATE, void *);
 
-AidlToken::AidlToken(const std::string& text, const std::string& comments)
-    : text_(text),
-      comments_(comments) {}
+struct AidlComments::Text {
+  explicit Text(std::string text) : lazy(false), text(std::move(text)) {}
+  Text(std::shared_ptr<android::aidl::ScanBuffer> source, std::string_view span)
+      : lazy(true), source(std::move(source)), span(span) {}
+
+  const bool lazy;
+  // Released once the text is read.
+  mutable std::shared_ptr<android::aidl::ScanBuffer> source;
+  const std::string_view span;
+  mutable std::once_flag once;
+  mutable std::string text;
+};
+
+AidlComments::AidlComments(std::string text) {
+  if (!text.empty()) {
+    text_ = std::make_shared<const Text>(std::move(text));
+  }
+}
+
+AidlComments::AidlComments(std::shared_ptr<android::aidl::ScanBuffer> source,
+                           std::string_view span)
+    : text_(std::make_shared<const Text>(std::move(source), span)) {}
+
+const std::string& AidlComments::str() const {
+  static const std::string kEmpty;
+  if (text_ == nullptr) {
+    return kEmpty;
+  }
+  if (text_->lazy) {
+    const Text* text = text_.get();
+    std::call_once(text->once, [text] {
+      text->text = Scan(text->span);
+      text->source.reset();
+    });
+  }
+  return text_->text;
+}
+
+std::string AidlComments::Scan(std::string_view span) {
+  // Block comments are kept as they are, and line comments get back the
+  // newline that ends them. The whitespace in between is dropped.
+  std::string text;
+  while (!span.empty()) {
+    size_t end = 1;
+    if (span.substr(0, 2) == "/*") {
+      end = span.find("*/", 2);
+      end = (end == std::string_view::npos) ? span.size() : end + 2;
+      text.append(span.substr(0, end));
+    } else if (span.substr(0, 2) == "//") {
+      end = std::min(span.find('\n'), span.size());
+      text.append(span.substr(0, end));
+      text += '\n';
+    }
+    span.remove_prefix(end);
+  }
+  return text;
+}
+
+AidlToken::AidlToken(std::string_view text, AidlComments comments)
+    : text_(text), comments_(std::move(comments)) {}
+
+namespace {
+
+// Nodes of up to kMaxPooledNodeSize bytes are carved out of chunks, which
+// are aligned to their size so that a node finds its chunk from its address.
+// A chunk counts its live nodes, plus one while a thread still allocates from
+// it, and is freed when that count drops to zero. So the nodes of one
+// compilation are freed together with it, while those kept by a cache keep
+// only their own chunks. A node can be freed by any thread.
+constexpr size_t kNodeAlignment = alignof(std::max_align_t);
+constexpr size_t kMaxPooledNodeSize = 512;
+constexpr size_t kNodeChunkSize = 64 * 1024;
+
+class NodeChunk {
+ public:
+  static NodeChunk* New() {
+    void* memory = ::operator new(kNodeChunkSize, std::align_val_t(kNodeChunkSize));
+    return new (memory) NodeChunk;
+  }
+  static NodeChunk* Of(void* node) {
+    return reinterpret_cast<NodeChunk*>(reinterpret_cast<uintptr_t>(node) &
+                                        ~(uintptr_t{kNodeChunkSize} - 1));
+  }
+
+  // Returns null if the chunk is full
+  void* Allocate(size_t rounded_size) {
+    if (kNodeChunkSize - used_ < rounded_size) {
+      return nullptr;
+    }
+    void* node = reinterpret_cast<char*>(this) + used_;
+    used_ += rounded_size;
+    refs_.fetch_add(1, std::memory_order_relaxed);
+    return node;
+  }
+
+  // For each node, and once by the allocating thread when it is done with
+  // the chunk
+  void Release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->~NodeChunk();
+      ::operator delete(this, std::align_val_t(kNodeChunkSize));
+    }
+  }
+
+ private:
+  NodeChunk() = default;
+
+  std::atomic<size_t> refs_{1};
+  // Only touched by the allocating thread
+  size_t used_ = (sizeof(NodeChunk) + kNodeAlignment - 1) / kNodeAlignment * kNodeAlignment;
+};
+
+class NodePool {
+ public:
+  ~NodePool() {
+    if (chunk_ != nullptr) chunk_->Release();
+  }
+
+  void* Allocate(size_t size) {
+    const size_t rounded_size = (std::max<size_t>(size, 1) + kNodeAlignment - 1) /
+                                kNodeAlignment * kNodeAlignment;
+    if (chunk_ != nullptr) {
+      if (void* node = chunk_->Allocate(rounded_size); node != nullptr) {
+        return node;
+      }
+      chunk_->Release();
+    }
+    chunk_ = NodeChunk::New();
+    return chunk_->Allocate(rounded_size);
+  }
+
+  static void Free(void* node) { NodeChunk::Of(node)->Release(); }
+
+ private:
+  NodeChunk* chunk_ = nullptr;
+};
+
+thread_local NodePool node_pool;
+
+}  // namespace
 
 AidlLocation::AidlLocation(const std::string& file, Point begin, Point end)
-    : file_(file), begin_(begin), end_(end) {}
+    : AidlLocation(std::make_shared<const std::string>(file), begin, end) {}
+
+AidlLocation::AidlLocation(std::shared_ptr<const std::string> file, Point begin, Point end)
+    : file_(std::move(file)), begin_(begin), end_(end) {}
+
+bool AidlLocation::Contains(const std::string& file, Point point) const {
+  auto before = [](Point a, Point b) {
+    return a.line < b.line || (a.line == b.line && a.column < b.column);
+  };
+  return *file_ == file && !before(point, begin_) && before(point, end_);
+}
 
 std::ostream& operator<<(std::ostream& os, const AidlLocation& l) {
-  os << l.file_ << ":" << l.begin_.line << "." << l.begin_.column << "-";
+  os << *l.file_ << ":" << l.begin_.line << "." << l.begin_.column << "-";
   if (l.begin_.line != l.end_.line) {
     os << l.end_.line << ".";
   }
@@ -103,26 +257,54 @@ std::ostream& operator<<(std::ostream& os, const AidlLocation& l) {
 
 AidlNode::AidlNode(const AidlLocation& location) : location_(location) {}
 
+void* AidlNode::operator new(size_t size) {
+  if (size > kMaxPooledNodeSize) {
+    return ::operator new(size);
+  }
+  return node_pool.Allocate(size);
+}
+
+void AidlNode::operator delete(void* node, size_t size) {
+  if (size > kMaxPooledNodeSize) {
+    ::operator delete(node);
+    return;
+  }
+  NodePool::Free(node);
+}
+
 std::string AidlNode::PrintLine() const {
   std::stringstream ss;
-  ss << location_.file_ << ":" << location_.begin_.line;
+  ss << *location_.file_ << ":" << location_.begin_.line;
   return ss.str();
 }
 
 std::string AidlNode::PrintLocation() const {
   std::stringstream ss;
-  ss << location_.file_ << ":" << location_.begin_.line << ":" << location_.begin_.column << ":"
+  ss << *location_.file_ << ":" << location_.begin_.line << ":" << location_.begin_.column << ":"
      << location_.end_.line << ":" << location_.end_.column;
   return ss.str();
 }
 
-AidlError::AidlError(bool fatal) : os_(std::cerr), fatal_(fatal) {
-  sHadError = true;
+AidlError::AidlError(bool fatal) : os_(fatal ? std::cerr : *sStream), fatal_(fatal) {
+  if (&os_ == &std::cerr) {
+    sHadError = true;
+  }
 
   os_ << "ERROR: ";
 }
 
-bool AidlError::sHadError = false;
+std::atomic<bool> AidlError::sHadError{false};
+thread_local std::ostream* AidlError::sStream = &std::cerr;
+
+void AidlErrorCapture::Report(const std::string& errors) {
+  if (errors.empty()) {
+    return;
+  }
+  *AidlError::sStream << errors;
+  if (AidlError::sStream == &std::cerr) {
+    AidlError::sHadError = true;
+  }
+}
 
 static const string kNullable("nullable");
 static const string kUtf8InCpp("utf8InCpp");
@@ -131,6 +313,69 @@ static const string kUnsupportedAppUsage("UnsupportedAppUsage");
 static const string kJavaStableParcelable("JavaOnlyStableParcelable");
 static const string kHide("Hide");
 static const string kBacking("Backing");
+static const string kReuseParcels("ReuseParcels");
+static const string kSharedMemory("SharedMemory");
+static const string kView("View");
+static const string kBatchable("Batchable");
+static const string kDispatchOn("DispatchOn");
+static const string kPropagateCallContext("PropagateCallContext");
+static const string kLazy("Lazy");
+static const string kRaw("Raw");
+static const string kUtf8Strings("Utf8Strings");
+static const string kPackedArrays("PackedArrays");
+static const string kFixedSize("FixedSize");
+static const string kChunked("Chunked");
+
+// The most elements that @FixedSize allows.
+static constexpr size_t kMaxFixedSize = 4096;
+
+// The bytes of a chunk of a @Chunked result when no size is given. This
+// keeps a reply well under the 1MB transaction buffer of a process.
+static constexpr size_t kDefaultChunkBytes = 256 * 1024;
+
+// Bits of AidlAnnotatable::flags_
+enum : uint32_t {
+  kNullableFlag = 1u << 0,
+  kUtf8InCppFlag = 1u << 1,
+  kVintfStabilityFlag = 1u << 2,
+  kJavaStableParcelableFlag = 1u << 3,
+  kHideFlag = 1u << 4,
+  kReuseParcelsFlag = 1u << 5,
+  kSharedMemoryFlag = 1u << 6,
+  kViewFlag = 1u << 7,
+  kBatchableFlag = 1u << 8,
+  kPropagateCallContextFlag = 1u << 9,
+  kLazyFlag = 1u << 10,
+  kRawFlag = 1u << 11,
+  kUtf8StringsFlag = 1u << 12,
+  kPackedArraysFlag = 1u << 13,
+  kFixedSizeFlag = 1u << 14,
+  kChunkedFlag = 1u << 15,
+  kUnsupportedAppUsageFlag = 1u << 16,
+  kBackingFlag = 1u << 17,
+  kDispatchOnFlag = 1u << 18,
+};
+
+static const std::map<string, uint32_t> kAnnotationFlags{
+    {kNullable, kNullableFlag},
+    {kUtf8InCpp, kUtf8InCppFlag},
+    {kVintfStability, kVintfStabilityFlag},
+    {kJavaStableParcelable, kJavaStableParcelableFlag},
+    {kHide, kHideFlag},
+    {kReuseParcels, kReuseParcelsFlag},
+    {kSharedMemory, kSharedMemoryFlag},
+    {kView, kViewFlag},
+    {kBatchable, kBatchableFlag},
+    {kPropagateCallContext, kPropagateCallContextFlag},
+    {kLazy, kLazyFlag},
+    {kRaw, kRawFlag},
+    {kUtf8Strings, kUtf8StringsFlag},
+    {kPackedArrays, kPackedArraysFlag},
+    {kFixedSize, kFixedSizeFlag},
+    {kChunked, kChunkedFlag},
+    {kUnsupportedAppUsage, kUnsupportedAppUsageFlag},
+    {kBacking, kBackingFlag},
+    {kDispatchOn, kDispatchOnFlag}};
 
 static const std::map<string, std::map<std::string, std::string>> kAnnotationParameters{
     {kNullable, {}},
@@ -144,7 +389,19 @@ static const std::map<string, std::map<std::string, std::string>> kAnnotationPar
       {"trackingBug", "long"}}},
     {kJavaStableParcelable, {}},
     {kHide, {}},
-    {kBacking, {{"type", "String"}}}};
+    {kBacking, {{"type", "String"}}},
+    {kReuseParcels, {}},
+    {kSharedMemory, {}},
+    {kView, {}},
+    {kBatchable, {}},
+    {kDispatchOn, {{"pool", "String"}}},
+    {kPropagateCallContext, {}},
+    {kLazy, {}},
+    {kRaw, {}},
+    {kUtf8Strings, {}},
+    {kPackedArrays, {}},
+    {kFixedSize, {{"size", "int"}}},
+    {kChunked, {{"bytes", "int"}}}};
 
 AidlAnnotation* AidlAnnotation::Parse(
     const AidlLocation& location, const string& name,
@@ -234,6 +491,24 @@ std::map<std::string, std::string> AidlAnnotation::AnnotationParams(
   return raw_params;
 }
 
+std::string AidlAnnotation::ParamValue(const std::string& name) const {
+  auto it = parameters_.find(name);
+  if (it == parameters_.end()) {
+    return "";
+  }
+  const auto& supported_params = kAnnotationParameters.at(GetName());
+  auto type_it = supported_params.find(name);
+  if (type_it == supported_params.end()) {
+    return "";
+  }
+  AidlTypeSpecifier type{AIDL_LOCATION_HERE, type_it->second, false, nullptr, ""};
+  AidlErrorCapture errors;
+  if (!it->second->CheckValid()) {
+    return "";
+  }
+  return it->second->ValueString(type, AidlConstantValueDecorator);
+}
+
 std::string AidlAnnotation::ToString(const ConstantValueDecorator& decorator) const {
   if (parameters_.empty()) {
     return "@" + GetName();
@@ -246,15 +521,6 @@ std::string AidlAnnotation::ToString(const ConstantValueDecorator& decorator) co
   }
 }
 
-static bool HasAnnotation(const vector<AidlAnnotation>& annotations, const string& name) {
-  for (const auto& a : annotations) {
-    if (a.GetName() == name) {
-      return true;
-    }
-  }
-  return false;
-}
-
 static const AidlAnnotation* GetAnnotation(const vector<AidlAnnotation>& annotations,
                                            const string& name) {
   for (const auto& a : annotations) {
@@ -267,45 +533,139 @@ static const AidlAnnotation* GetAnnotation(const vector<AidlAnnotation>& annotat
 
 AidlAnnotatable::AidlAnnotatable(const AidlLocation& location) : AidlNode(location) {}
 
+// Strips the quotes off a String parameter value.
+static std::string Unquote(const std::string& value) {
+  return value.size() >= 2 ? value.substr(1, value.size() - 2) : "";
+}
+
+void AidlAnnotatable::Annotate(vector<AidlAnnotation>&& annotations) {
+  for (auto& annotation : annotations) {
+    // Like the lookups by name, the parameters are taken from the first
+    // annotation of a name.
+    if (auto it = kAnnotationFlags.find(annotation.GetName());
+        it != kAnnotationFlags.end() && (flags_ & it->second) == 0) {
+      flags_ |= it->second;
+      TakeParameters(annotation);
+    }
+    annotations_.emplace_back(std::move(annotation));
+  }
+}
+
+void AidlAnnotatable::TakeParameters(const AidlAnnotation& annotation) {
+  const string& name = annotation.GetName();
+  if (name == kFixedSize) {
+    int32_t size;
+    if (android::base::ParseInt(annotation.ParamValue("size"), &size, 1)) {
+      fixed_size_ = size;
+    }
+  } else if (name == kChunked) {
+    // Without bytes, the default is used. Bytes that aren't a positive int
+    // leave 0, which CheckValid() rejects.
+    const string bytes_value = annotation.ParamValue("bytes");
+    int32_t bytes;
+    if (bytes_value.empty()) {
+      chunk_bytes_ = kDefaultChunkBytes;
+    } else if (android::base::ParseInt(bytes_value, &bytes, 1)) {
+      chunk_bytes_ = bytes;
+    }
+  } else if (name == kDispatchOn) {
+    dispatch_pool_ = Unquote(annotation.ParamValue("pool"));
+  } else if (name == kBacking) {
+    backing_type_ = Unquote(annotation.ParamValue("type"));
+  }
+}
+
 bool AidlAnnotatable::IsNullable() const {
-  return HasAnnotation(annotations_, kNullable);
+  return (flags_ & kNullableFlag) != 0;
 }
 
 bool AidlAnnotatable::IsUtf8InCpp() const {
-  return HasAnnotation(annotations_, kUtf8InCpp);
+  return (flags_ & kUtf8InCppFlag) != 0;
 }
 
 bool AidlAnnotatable::IsVintfStability() const {
-  return HasAnnotation(annotations_, kVintfStability);
+  return (flags_ & kVintfStabilityFlag) != 0;
 }
 
 const AidlAnnotation* AidlAnnotatable::UnsupportedAppUsage() const {
+  if ((flags_ & kUnsupportedAppUsageFlag) == 0) {
+    return nullptr;
+  }
   return GetAnnotation(annotations_, kUnsupportedAppUsage);
 }
 
 const AidlTypeSpecifier* AidlAnnotatable::BackingType(const AidlTypenames& typenames) const {
-  auto annotation = GetAnnotation(annotations_, kBacking);
-  if (annotation != nullptr) {
-    auto annotation_params = annotation->AnnotationParams(AidlConstantValueDecorator);
-    if (auto it = annotation_params.find("type"); it != annotation_params.end()) {
-      const string& type = it->second;
-      AidlTypeSpecifier* type_specifier =
-          new AidlTypeSpecifier(AIDL_LOCATION_HERE,
-                                // Strip the quotes off the type String.
-                                type.substr(1, type.length() - 2), false, nullptr, "");
-      type_specifier->Resolve(typenames);
-      return type_specifier;
-    }
+  if (backing_type_.empty()) {
+    return nullptr;
   }
-  return nullptr;
+  AidlTypeSpecifier* type_specifier =
+      new AidlTypeSpecifier(AIDL_LOCATION_HERE, backing_type_, false, nullptr, "");
+  type_specifier->Resolve(typenames);
+  return type_specifier;
 }
 
 bool AidlAnnotatable::IsStableApiParcelable(Options::Language lang) const {
-  return HasAnnotation(annotations_, kJavaStableParcelable) && lang == Options::Language::JAVA;
+  return (flags_ & kJavaStableParcelableFlag) != 0 && lang == Options::Language::JAVA;
 }
 
 bool AidlAnnotatable::IsHide() const {
-  return HasAnnotation(annotations_, kHide);
+  return (flags_ & kHideFlag) != 0;
+}
+
+bool AidlAnnotatable::IsReuseParcels() const {
+  return (flags_ & kReuseParcelsFlag) != 0;
+}
+
+bool AidlAnnotatable::IsSharedMemory() const {
+  return (flags_ & kSharedMemoryFlag) != 0;
+}
+
+bool AidlAnnotatable::IsView() const {
+  return (flags_ & kViewFlag) != 0;
+}
+
+bool AidlAnnotatable::IsBatchable() const {
+  return (flags_ & kBatchableFlag) != 0;
+}
+
+bool AidlAnnotatable::IsPropagateCallContext() const {
+  return (flags_ & kPropagateCallContextFlag) != 0;
+}
+
+bool AidlAnnotatable::IsLazy() const {
+  return (flags_ & kLazyFlag) != 0;
+}
+
+bool AidlAnnotatable::IsRaw() const {
+  return (flags_ & kRawFlag) != 0;
+}
+
+bool AidlAnnotatable::IsUtf8Strings() const {
+  return (flags_ & kUtf8StringsFlag) != 0;
+}
+
+bool AidlAnnotatable::IsPackedArrays() const {
+  return (flags_ & kPackedArraysFlag) != 0;
+}
+
+bool AidlAnnotatable::IsFixedSize() const {
+  return (flags_ & kFixedSizeFlag) != 0;
+}
+
+size_t AidlAnnotatable::FixedSize() const {
+  return fixed_size_;
+}
+
+bool AidlAnnotatable::IsChunked() const {
+  return (flags_ & kChunkedFlag) != 0;
+}
+
+size_t AidlAnnotatable::ChunkBytes() const {
+  return chunk_bytes_;
+}
+
+std::string AidlAnnotatable::DispatchPool() const {
+  return dispatch_pool_;
 }
 
 void AidlAnnotatable::DumpAnnotations(CodeWriter* writer) const {
@@ -336,7 +696,7 @@ string AidlAnnotatable::ToString() const {
 AidlTypeSpecifier::AidlTypeSpecifier(const AidlLocation& location, const string& unresolved_name,
                                      bool is_array,
                                      vector<unique_ptr<AidlTypeSpecifier>>* type_params,
-                                     const string& comments)
+                                     const AidlComments& comments)
     : AidlAnnotatable(location),
       AidlParameterizable<unique_ptr<AidlTypeSpecifier>>(type_params),
       unresolved_name_(unresolved_name),
@@ -388,14 +748,92 @@ bool AidlTypeSpecifier::Resolve(const AidlTypenames& typenames) {
   if (result.second) {
     fully_qualified_name_ = result.first;
     split_name_ = Split(fully_qualified_name_, ".");
+    builtin_kind_ = AidlTypenames::BuiltinKindOf(fully_qualified_name_);
   }
   return result.second;
 }
 
+AidlBuiltinKind AidlTypeSpecifier::GetBackingKind(const AidlTypenames& typenames) const {
+  CHECK(IsResolved()) << ToString();
+  if (builtin_kind_ != AidlBuiltinKind::NONE) {
+    return builtin_kind_;
+  }
+  const AidlEnumDeclaration* enum_decl = typenames.GetEnumDeclaration(*this);
+  return enum_decl != nullptr ? enum_decl->GetBackingType().GetBuiltinKind()
+                              : AidlBuiltinKind::NONE;
+}
+
 bool AidlTypeSpecifier::CheckValid(const AidlTypenames& typenames) const {
   if (!CheckValidAnnotations()) {
     return false;
   }
+  if (IsSharedMemory() && (GetName() != "byte" || !IsArray() || IsNullable())) {
+    AIDL_ERROR(this) << "@SharedMemory is only supported on non-nullable byte[], but got '"
+                     << ToString() << "'";
+    return false;
+  }
+  // The view points into the parcel, so the elements have to be laid out
+  // there as in memory and aligned. Parcels align to 4 bytes.
+  if (IsView() && (!(GetName() == "byte" || GetName() == "int" || GetName() == "float") ||
+                   !IsArray() || IsNullable() || IsSharedMemory())) {
+    AIDL_ERROR(this) << "@View is only supported on non-nullable byte[], int[] and float[], "
+                     << "but got '" << ToString() << "'";
+    return false;
+  }
+  // A raw parcelable finds the end of its bytes from the size that a
+  // structured parcelable writes before its fields.
+  if (IsRaw()) {
+    const AidlDefinedType* defined_type = typenames.TryGetDefinedType(GetName());
+    if (IsArray() || IsNullable() || defined_type == nullptr ||
+        defined_type->AsStructuredParcelable() == nullptr) {
+      AIDL_ERROR(this) << "@Raw is only supported on non-nullable structured parcelable types, "
+                       << "but got '" << ToString() << "'";
+      return false;
+    }
+  }
+  if (IsUtf8Strings()) {
+    AIDL_ERROR(this) << "@Utf8Strings is only supported on interfaces.";
+    return false;
+  }
+  if (IsPackedArrays()) {
+    AIDL_ERROR(this) << "@PackedArrays is only supported on interfaces.";
+    return false;
+  }
+  // A fixed-size array is held in a std::array in C++, which has to be small
+  // enough to be a local of the generated code.
+  if (IsFixedSize()) {
+    if (!IsArray() || IsNullable() || IsView() || IsSharedMemory() ||
+        !AidlTypenames::IsPrimitiveTypename(GetName())) {
+      AIDL_ERROR(this) << "@FixedSize is only supported on non-nullable arrays of primitive "
+                       << "types, but got '" << ToString() << "'";
+      return false;
+    }
+    if (FixedSize() == 0 || FixedSize() > kMaxFixedSize) {
+      AIDL_ERROR(this) << "@FixedSize needs a size between 1 and " << kMaxFixedSize << ".";
+      return false;
+    }
+  }
+  // The chunks of a result are written one parcelable after another, so
+  // that a chunk can be cut at any element.
+  if (IsChunked()) {
+    const AidlTypeSpecifier* element = this;
+    if (GetName() == "List" && GetTypeParameters().size() == 1) {
+      element = GetTypeParameters()[0].get();
+    } else if (!IsArray()) {
+      element = nullptr;
+    }
+    const AidlDefinedType* defined_type =
+        element != nullptr ? typenames.TryGetDefinedType(element->GetName()) : nullptr;
+    if (IsNullable() || defined_type == nullptr || defined_type->AsParcelable() == nullptr) {
+      AIDL_ERROR(this) << "@Chunked is only supported on non-nullable Lists and arrays of "
+                       << "parcelables, but got '" << ToString() << "'";
+      return false;
+    }
+    if (ChunkBytes() == 0) {
+      AIDL_ERROR(this) << "@Chunked needs a positive number of bytes.";
+      return false;
+    }
+  }
   if (IsGeneric()) {
     const string& type_name = GetName();
 
@@ -514,7 +952,7 @@ bool AidlVariableDeclaration::CheckValid(const AidlTypenames& typenames) const {
 
   if (!valid) return false;
 
-  return !ValueString(AidlConstantValueDecorator).empty();
+  return default_value_->Evaluate(GetType());
 }
 
 string AidlVariableDeclaration::ToString() const {
@@ -614,14 +1052,14 @@ string AidlConstantDeclaration::Signature() const {
 
 AidlMethod::AidlMethod(const AidlLocation& location, bool oneway, AidlTypeSpecifier* type,
                        const std::string& name, std::vector<std::unique_ptr<AidlArgument>>* args,
-                       const std::string& comments)
+                       const AidlComments& comments)
     : AidlMethod(location, oneway, type, name, args, comments, 0, true) {
   has_id_ = false;
 }
 
 AidlMethod::AidlMethod(const AidlLocation& location, bool oneway, AidlTypeSpecifier* type,
                        const std::string& name, std::vector<std::unique_ptr<AidlArgument>>* args,
-                       const std::string& comments, int id, bool is_user_defined)
+                       const AidlComments& comments, int id, bool is_user_defined)
     : AidlMember(location),
       oneway_(oneway),
       comments_(comments),
@@ -664,7 +1102,7 @@ string AidlMethod::ToString() const {
 }
 
 AidlDefinedType::AidlDefinedType(const AidlLocation& location, const std::string& name,
-                                 const std::string& comments,
+                                 const AidlComments& comments,
                                  const std::vector<std::string>& package)
     : AidlAnnotatable(location), name_(name), comments_(comments), package_(package) {}
 
@@ -691,8 +1129,9 @@ void AidlDefinedType::DumpHeader(CodeWriter* writer) const {
 }
 
 AidlParcelable::AidlParcelable(const AidlLocation& location, AidlQualifiedName* name,
-                               const std::vector<std::string>& package, const std::string& comments,
-                               const std::string& cpp_header, std::vector<std::string>* type_params)
+                               const std::vector<std::string>& package,
+                               const AidlComments& comments, const std::string& cpp_header,
+                               std::vector<std::string>* type_params)
     : AidlDefinedType(location, name->GetDotName(), comments, package),
       AidlParameterizable<std::string>(type_params),
       name_(name),
@@ -759,7 +1198,7 @@ void AidlParcelable::Dump(CodeWriter* writer) const {
 
 AidlStructuredParcelable::AidlStructuredParcelable(
     const AidlLocation& location, AidlQualifiedName* name, const std::vector<std::string>& package,
-    const std::string& comments, std::vector<std::unique_ptr<AidlVariableDeclaration>>* variables)
+    const AidlComments& comments, std::vector<std::unique_ptr<AidlVariableDeclaration>>* variables)
     : AidlParcelable(location, name, package, comments, "" /*cpp_header*/),
       variables_(std::move(*variables)) {}
 
@@ -778,9 +1217,56 @@ void AidlStructuredParcelable::Dump(CodeWriter* writer) const {
 }
 
 bool AidlStructuredParcelable::CheckValid(const AidlTypenames& typenames) const {
+  // Each field is checked even after an invalid one, so that all of their
+  // errors are reported at once.
+  auto check_field = [&](const std::unique_ptr<AidlVariableDeclaration>& v) {
+    if (!v->CheckValid(typenames)) {
+      return false;
+    }
+    if (v->GetType().IsSharedMemory()) {
+      AIDL_ERROR(v) << "@SharedMemory is only supported on in arguments of methods.";
+      return false;
+    }
+    if (v->GetType().IsView()) {
+      AIDL_ERROR(v) << "@View is only supported on in arguments of methods.";
+      return false;
+    }
+    if (v->GetType().IsBatchable()) {
+      AIDL_ERROR(v) << "@Batchable is only supported on oneway methods.";
+      return false;
+    }
+    if (v->GetType().IsChunked()) {
+      AIDL_ERROR(v) << "@Chunked is only supported on return values of methods.";
+      return false;
+    }
+    if (!v->GetType().DispatchPool().empty()) {
+      AIDL_ERROR(v) << "@DispatchOn is only supported on oneway methods and interfaces.";
+      return false;
+    }
+    if (v->GetType().IsPropagateCallContext()) {
+      AIDL_ERROR(v) << "@PropagateCallContext is only supported on methods and interfaces.";
+      return false;
+    }
+    if (v->GetType().IsRaw()) {
+      AIDL_ERROR(v) << "@Raw is only supported on in arguments and return values of methods.";
+      return false;
+    }
+    // The extent of a lazy field is found from the size that a structured
+    // parcelable writes before its fields, without reading them.
+    if (const AidlTypeSpecifier& type = v->GetType(); type.IsLazy()) {
+      const AidlDefinedType* defined_type = typenames.TryGetDefinedType(type.GetName());
+      if (type.IsArray() || type.IsNullable() || defined_type == nullptr ||
+          defined_type->AsStructuredParcelable() == nullptr) {
+        AIDL_ERROR(v) << "@Lazy is only supported on non-nullable fields of structured "
+                      << "parcelable types, but got '" << type.ToString() << "'";
+        return false;
+      }
+    }
+    return true;
+  };
   bool success = true;
   for (const auto& v : GetFields()) {
-    success = success && v->CheckValid(typenames);
+    success = check_field(v) && success;
   }
   return success;
 }
@@ -819,6 +1305,11 @@ bool AidlTypeSpecifier::LanguageSpecificCheckValid(Options::Language lang) const
           }
         }
       }
+    } else if (this->GetName() != "Map" && lang != Options::Language::JAVA) {
+      // Native backends have no template to instantiate for a generic parcelable.
+      AIDL_ERROR(this) << "Currently, only the Java backend supports generic parcelable "
+                       << "'" << this->ToString() << "'.";
+      return false;
     }
   }
   if (this->GetName() == "Map" || this->GetName() == "CharSequence") {
@@ -865,12 +1356,16 @@ bool AidlStructuredParcelable::LanguageSpecificCheckValid(Options::Language lang
     if (!v->GetType().LanguageSpecificCheckValid(lang)) {
       return false;
     }
+    if (v->GetType().IsLazy() && lang != Options::Language::CPP) {
+      AIDL_ERROR(v) << "@Lazy is only supported in the cpp backend.";
+      return false;
+    }
   }
   return true;
 }
 
 AidlEnumerator::AidlEnumerator(const AidlLocation& location, const std::string& name,
-                               AidlConstantValue* value, const std::string& comments)
+                               AidlConstantValue* value, const AidlComments& comments)
     : AidlNode(location), name_(name), value_(value), comments_(comments) {}
 
 bool AidlEnumerator::CheckValid(const AidlTypeSpecifier& enum_backing_type) const {
@@ -880,7 +1375,7 @@ bool AidlEnumerator::CheckValid(const AidlTypeSpecifier& enum_backing_type) cons
   if (!GetValue()->CheckValid()) {
     return false;
   }
-  if (GetValue()->ValueString(enum_backing_type, AidlConstantValueDecorator).empty()) {
+  if (!GetValue()->Evaluate(enum_backing_type)) {
     AIDL_ERROR(this) << "Enumerator type differs from enum backing type.";
     return false;
   }
@@ -895,7 +1390,7 @@ string AidlEnumerator::ValueString(const AidlTypeSpecifier& backing_type,
 AidlEnumDeclaration::AidlEnumDeclaration(const AidlLocation& location, const std::string& name,
                                          std::vector<std::unique_ptr<AidlEnumerator>>* enumerators,
                                          const std::vector<std::string>& package,
-                                         const std::string& comments)
+                                         const AidlComments& comments)
     : AidlDefinedType(location, name, comments, package), enumerators_(std::move(*enumerators)) {}
 
 void AidlEnumDeclaration::SetBackingType(std::unique_ptr<const AidlTypeSpecifier> type) {
@@ -933,7 +1428,7 @@ bool AidlEnumDeclaration::CheckValid(const AidlTypenames&) const {
   }
   bool success = true;
   for (const auto& enumerator : enumerators_) {
-    success = success && enumerator->CheckValid(GetBackingType());
+    success = enumerator->CheckValid(GetBackingType()) && success;
   }
   return success;
 }
@@ -956,6 +1451,30 @@ bool AidlInterface::LanguageSpecificCheckValid(Options::Language lang) const {
     if (!m->GetType().LanguageSpecificCheckValid(lang)) {
       return false;
     }
+    // A stub that can't take the batch would drop the calls silently.
+    if (m->GetType().IsBatchable() &&
+        (lang == Options::Language::JAVA || lang == Options::Language::NDK)) {
+      AIDL_ERROR(m) << "@Batchable is only supported in the cpp backend.";
+      return false;
+    }
+    // The rest of a chunked result is held by a cursor binder of the cpp
+    // stub, which the other backends don't read.
+    if (m->GetType().IsChunked() && lang != Options::Language::CPP) {
+      AIDL_ERROR(m) << "@Chunked is only supported in the cpp backend.";
+      return false;
+    }
+    if (lang != Options::Language::CPP &&
+        (m->GetType().IsRaw() ||
+         std::any_of(m->GetArguments().begin(), m->GetArguments().end(),
+                     [](const auto& arg) { return arg->GetType().IsRaw(); }))) {
+      AIDL_ERROR(m) << "@Raw is only supported in the cpp backend.";
+      return false;
+    }
+    if ((!m->GetType().DispatchPool().empty() || !DispatchPool().empty()) &&
+        lang == Options::Language::JAVA) {
+      AIDL_ERROR(m) << "@DispatchOn is only supported in the cpp and ndk backends.";
+      return false;
+    }
     for (const auto& arg : m->GetArguments()) {
       if (!arg->GetType().LanguageSpecificCheckValid(lang)) {
         return false;
@@ -966,7 +1485,7 @@ bool AidlInterface::LanguageSpecificCheckValid(Options::Language lang) const {
 }
 
 AidlInterface::AidlInterface(const AidlLocation& location, const std::string& name,
-                             const std::string& comments, bool oneway,
+                             const AidlComments& comments, bool oneway,
                              std::vector<std::unique_ptr<AidlMember>>* members,
                              const std::vector<std::string>& package)
     : AidlDefinedType(location, name, comments, package) {
@@ -1010,13 +1529,42 @@ void AidlInterface::Dump(CodeWriter* writer) const {
   writer->Write("}\n");
 }
 
+bool AidlInterface::PropagatesCallContext(const AidlMethod& method) const {
+  if (!method.IsUserDefined() || method.GetType().IsBatchable()) {
+    return false;
+  }
+  return method.GetType().IsPropagateCallContext() || IsPropagateCallContext();
+}
+
+bool AidlInterface::IsUtf8WireString(const AidlTypeSpecifier& type) const {
+  return IsUtf8Strings() && type.GetName() == "String" && !type.IsArray() && !type.IsGeneric();
+}
+
+bool AidlInterface::HasUtf8WireStrings(const AidlMethod& method) const {
+  if (!method.IsUserDefined()) {
+    return false;
+  }
+  if (IsUtf8WireString(method.GetType())) {
+    return true;
+  }
+  return std::any_of(method.GetArguments().begin(), method.GetArguments().end(),
+                     [this](const auto& arg) { return IsUtf8WireString(arg->GetType()); });
+}
+
+bool AidlInterface::IsPackedWireArray(const AidlTypeSpecifier& type) const {
+  return IsPackedArrays() && type.IsArray() && !type.IsFixedSize() &&
+         (type.GetName() == "boolean" || type.GetName() == "char");
+}
+
 bool AidlInterface::CheckValid(const AidlTypenames& typenames) const {
   if (!CheckValidAnnotations()) {
     return false;
   }
+  // Each method, and each argument of a method, is checked even after an
+  // invalid one, so that all of their errors are reported at once.
   // Has to be a pointer due to deleting copy constructor. No idea why.
   map<string, const AidlMethod*> method_names;
-  for (const auto& m : GetMethods()) {
+  auto check_method = [&](const std::unique_ptr<AidlMethod>& m) {
     if (!m->GetType().CheckValid(typenames)) {
       return false;
     }
@@ -1026,8 +1574,45 @@ bool AidlInterface::CheckValid(const AidlTypenames& typenames) const {
       return false;
     }
 
+    if (m->GetType().IsSharedMemory()) {
+      AIDL_ERROR(m) << "@SharedMemory is only supported on in arguments of methods.";
+      return false;
+    }
+
+    if (m->GetType().IsView()) {
+      AIDL_ERROR(m) << "@View is only supported on in arguments of methods.";
+      return false;
+    }
+
+    if (m->GetType().IsLazy()) {
+      AIDL_ERROR(m) << "@Lazy is only supported on fields of parcelables.";
+      return false;
+    }
+
+    if (m->GetType().IsBatchable() && !m->IsOneway()) {
+      AIDL_ERROR(m) << "@Batchable is only supported on oneway methods, but '" << m->GetName()
+                    << "' isn't oneway.";
+      return false;
+    }
+
+    // A batch has one interface token for all of its calls, and no header.
+    if (m->GetType().IsPropagateCallContext() && m->GetType().IsBatchable()) {
+      AIDL_ERROR(m) << "@PropagateCallContext isn't supported on @Batchable methods.";
+      return false;
+    }
+
+    // The stub of a two-way method has to write the reply before onTransact
+    // returns, so only oneway calls can be handed off.
+    const bool dispatched =
+        !m->GetType().DispatchPool().empty() || (m->IsOneway() && !DispatchPool().empty());
+    if (!m->GetType().DispatchPool().empty() && !m->IsOneway()) {
+      AIDL_ERROR(m) << "@DispatchOn is only supported on oneway methods, but '" << m->GetName()
+                    << "' isn't oneway.";
+      return false;
+    }
+
     set<string> argument_names;
-    for (const auto& arg : m->GetArguments()) {
+    auto check_argument = [&](const std::unique_ptr<AidlArgument>& arg) {
       auto it = argument_names.find(arg->GetName());
       if (it != argument_names.end()) {
         AIDL_ERROR(m) << "method '" << m->GetName() << "' has duplicate argument name '"
@@ -1040,6 +1625,61 @@ bool AidlInterface::CheckValid(const AidlTypenames& typenames) const {
         return false;
       }
 
+      if (arg->GetType().IsSharedMemory() && arg->GetDirection() != AidlArgument::IN_DIR) {
+        AIDL_ERROR(arg) << "@SharedMemory is only supported on in arguments of methods.";
+        return false;
+      }
+
+      if (arg->GetType().IsView() && arg->GetDirection() != AidlArgument::IN_DIR) {
+        AIDL_ERROR(arg) << "@View is only supported on in arguments of methods.";
+        return false;
+      }
+
+      // Out arrays are sized with the vector helpers of the parcels, which
+      // take no std::array.
+      if (arg->GetType().IsFixedSize() && arg->GetDirection() != AidlArgument::IN_DIR) {
+        AIDL_ERROR(arg) << "@FixedSize is only supported on in arguments, return values and "
+                        << "fields.";
+        return false;
+      }
+
+      if (arg->GetType().IsBatchable()) {
+        AIDL_ERROR(arg) << "@Batchable is only supported on oneway methods.";
+        return false;
+      }
+
+      if (arg->GetType().IsChunked()) {
+        AIDL_ERROR(arg) << "@Chunked is only supported on return values of methods.";
+        return false;
+      }
+
+      if (arg->GetType().IsLazy()) {
+        AIDL_ERROR(arg) << "@Lazy is only supported on fields of parcelables.";
+        return false;
+      }
+
+      if (arg->GetType().IsRaw() && arg->GetDirection() != AidlArgument::IN_DIR) {
+        AIDL_ERROR(arg) << "@Raw is only supported on in arguments and return values of methods.";
+        return false;
+      }
+
+      if (arg->GetType().IsPropagateCallContext()) {
+        AIDL_ERROR(arg) << "@PropagateCallContext is only supported on methods and interfaces.";
+        return false;
+      }
+
+      if (!arg->GetType().DispatchPool().empty()) {
+        AIDL_ERROR(arg) << "@DispatchOn is only supported on oneway methods and interfaces.";
+        return false;
+      }
+
+      // A view points into the data parcel, which is gone by the time the
+      // executor makes the call.
+      if (dispatched && arg->GetType().IsView()) {
+        AIDL_ERROR(arg) << "@View arguments aren't supported in @DispatchOn methods.";
+        return false;
+      }
+
       if (m->IsOneway() && arg->IsOut()) {
         AIDL_ERROR(m) << "oneway method '" << m->GetName() << "' cannot have out parameters";
         return false;
@@ -1067,6 +1707,11 @@ bool AidlInterface::CheckValid(const AidlTypenames& typenames) const {
         AIDL_ERROR(arg) << "Argument name cannot begin with '_aidl'";
         return false;
       }
+      return true;
+    };
+    bool success = true;
+    for (const auto& arg : m->GetArguments()) {
+      success = check_argument(arg) && success;
     }
 
     auto it = method_names.find(m->GetName());
@@ -1086,9 +1731,13 @@ bool AidlInterface::CheckValid(const AidlTypenames& typenames) const {
       AIDL_ERROR(m) << " method " << m->Signature() << " is reserved for internal use." << endl;
       return false;
     }
-  }
+    return success;
+  };
 
   bool success = true;
+  for (const auto& m : GetMethods()) {
+    success = check_method(m) && success;
+  }
   set<string> constant_names;
   for (const std::unique_ptr<AidlConstantDeclaration>& constant : GetConstantDeclarations()) {
     if (constant_names.count(constant->GetName()) > 0) {
@@ -1096,14 +1745,14 @@ bool AidlInterface::CheckValid(const AidlTypenames& typenames) const {
       success = false;
     }
     constant_names.insert(constant->GetName());
-    success = success && constant->CheckValid(typenames);
+    success = constant->CheckValid(typenames) && success;
   }
 
   return success;
 }
 
 AidlQualifiedName::AidlQualifiedName(const AidlLocation& location, const std::string& term,
-                                     const std::string& comments)
+                                     const AidlComments& comments)
     : AidlNode(location), terms_({term}), comments_(comments) {
   if (term.find('.') != string::npos) {
     terms_ = Split(term, ".");
@@ -1124,21 +1773,24 @@ AidlImport::AidlImport(const AidlLocation& location, const std::string& needed_c
 
 std::unique_ptr<Parser> Parser::Parse(const std::string& filename,
                                       const android::aidl::IoDelegate& io_delegate,
-                                      AidlTypenames& typenames) {
+                                      AidlTypenames& typenames, Comments comments) {
+  android::aidl::ProfileScope profile_scope("Parse", filename);
   // Make sure we can read the file first, before trashing previous state.
-  unique_ptr<string> raw_buffer = io_delegate.GetFileContents(filename);
-  if (raw_buffer == nullptr) {
+  // The buffer ends with the two nulls yacc demands, as we scan it in place.
+  std::shared_ptr<android::aidl::ScanBuffer> buffer = io_delegate.GetScanBuffer(filename);
+  if (buffer == nullptr) {
     AIDL_ERROR(filename) << "Error while opening file for parsing";
     return nullptr;
   }
 
-  // We're going to scan this buffer in place, and yacc demands we put two
-  // nulls at the end.
-  raw_buffer->append(2u, '\0');
+  android::aidl::Profile::Count(android::aidl::ProfileCounter::FILES_PARSED);
+  android::aidl::Profile::Count(android::aidl::ProfileCounter::BYTES_LEXED, buffer->Size() - 2);
 
-  std::unique_ptr<Parser> parser(new Parser(filename, *raw_buffer, typenames));
+  std::unique_ptr<Parser> parser(new Parser(filename, std::move(buffer), comments, typenames));
 
   if (yy::parser(parser.get()).parse() != 0 || parser->HasError()) return nullptr;
+  // Lazy comments keep their own references to the buffer.
+  parser->scan_buffer_.reset();
 
   return parser;
 }
@@ -1150,6 +1802,17 @@ std::vector<std::string> Parser::Package() const {
   return package_->GetTerms();
 }
 
+AidlComments Parser::MakeComments(const char* begin, const char* end) const {
+  if (begin == nullptr) {
+    return AidlComments();
+  }
+  std::string_view span(begin, end - begin);
+  if (comments_ == Comments::LAZY) {
+    return AidlComments(scan_buffer_, span);
+  }
+  return AidlComments(AidlComments::Scan(span));
+}
+
 void Parser::AddImport(std::unique_ptr<AidlImport>&& import) {
   for (const auto& i : imports_) {
     if (i->GetNeededClass() == import->GetNeededClass()) {
@@ -1171,11 +1834,14 @@ bool Parser::Resolve() {
   return success;
 }
 
-Parser::Parser(const std::string& filename, std::string& raw_buffer,
-               android::aidl::AidlTypenames& typenames)
-    : filename_(filename), typenames_(typenames) {
-  yylex_init(&scanner_);
-  buffer_ = yy_scan_buffer(&raw_buffer[0], raw_buffer.length(), scanner_);
+Parser::Parser(const std::string& filename, std::shared_ptr<android::aidl::ScanBuffer> buffer,
+               Comments comments, android::aidl::AidlTypenames& typenames)
+    : filename_(std::make_shared<const std::string>(filename)),
+      typenames_(typenames),
+      scan_buffer_(std::move(buffer)),
+      comments_(comments) {
+  yylex_init_extra(this, &scanner_);
+  buffer_ = yy_scan_buffer(scan_buffer_->Data(), scan_buffer_->Size(), scanner_);
 }
 
 Parser::~Parser() {
@@ -21,9 +21,13 @@
 #include "io_delegate.h"
 #include "options.h"
 
+#include <atomic>
 #include <memory>
+#include <optional>
 #include <regex>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <vector>
 
@@ -33,6 +37,7 @@
 struct yy_buffer_state;
 typedef yy_buffer_state* YY_BUFFER_STATE;
 
+using android::aidl::AidlBuiltinKind;
 using android::aidl::AidlTypenames;
 using android::aidl::CodeWriter;
 using android::aidl::Options;
@@ -50,19 +55,46 @@ std::string dump_location(const AidlNode& method);
 namespace java {
 std::string dump_location(const AidlNode& method);
 }  // namespace java
+namespace server {
+bool node_contains(const AidlNode& node, const std::string& file, int line, int column);
+std::string dump_location(const AidlNode& node);
+}  // namespace server
 }  // namespace aidl
 }  // namespace android
 
+// The comments before a token. Nodes made from the token share them instead of
+// copying them; e.g. a method, its return type and its first annotation.
+class AidlComments {
+ public:
+  AidlComments() = default;
+  AidlComments(std::string text);
+  AidlComments(const char* text) : AidlComments(std::string(text)) {}
+  // Comments that are only read out of |span| of |source| when str() is first
+  // called. |source| is kept alive until then.
+  AidlComments(std::shared_ptr<android::aidl::ScanBuffer> source, std::string_view span);
+
+  const std::string& str() const;
+
+  // The text of the comments in |span|, which holds only comments and the
+  // whitespace between them, as the lexer collects it.
+  static std::string Scan(std::string_view span);
+
+ private:
+  struct Text;
+  std::shared_ptr<const Text> text_;
+};
+
 class AidlToken {
  public:
-  AidlToken(const std::string& text, const std::string& comments);
+  AidlToken(std::string_view text, AidlComments comments);
 
-  const std::string& GetText() const { return text_; }
-  const std::string& GetComments() const { return comments_; }
+  // Points into the scan buffer, so it is only valid while the file is parsed.
+  std::string_view GetText() const { return text_; }
+  const AidlComments& GetComments() const { return comments_; }
 
  private:
-  std::string text_;
-  std::string comments_;
+  std::string_view text_;
+  AidlComments comments_;
 
   DISALLOW_COPY_AND_ASSIGN(AidlToken);
 };
@@ -75,12 +107,18 @@ class AidlLocation {
   };
 
   AidlLocation(const std::string& file, Point begin, Point end);
+  // For the nodes of a parsed file, which share the name of the file.
+  AidlLocation(std::shared_ptr<const std::string> file, Point begin, Point end);
+
+  // Whether |point| of |file| is in this location, whose end is exclusive.
+  bool Contains(const std::string& file, Point point) const;
 
   friend std::ostream& operator<<(std::ostream& os, const AidlLocation& l);
   friend class AidlNode;
 
  private:
-  const std::string file_;
+  // Shared, as every node of a file has the same one.
+  std::shared_ptr<const std::string> file_;
   Point begin_;
   Point end_;
 };
@@ -101,6 +139,12 @@ class AidlNode {
   AidlNode(AidlNode&&) = default;
   virtual ~AidlNode() = default;
 
+  // Nodes are small and many, so they are carved out of chunks of the
+  // allocating thread rather than taken from malloc. A chunk is freed once
+  // all of its nodes are.
+  static void* operator new(size_t size);
+  static void operator delete(void* node, size_t size);
+
   // DO NOT ADD. This is intentionally omitted. Nothing should refer to the location
   // for a functional purpose. It is only for error messages.
   // NO const AidlLocation& GetLocation() const { return location_; } NO
@@ -109,6 +153,8 @@ class AidlNode {
   friend class AidlError;
   friend std::string android::aidl::mappings::dump_location(const AidlNode&);
   friend std::string android::aidl::java::dump_location(const AidlNode&);
+  friend bool android::aidl::server::node_contains(const AidlNode&, const std::string&, int, int);
+  friend std::string android::aidl::server::dump_location(const AidlNode&);
 
  private:
   std::string PrintLine() const;
@@ -136,17 +182,44 @@ class AidlError {
   std::ostream& os_;
 
   static bool hadError() { return sHadError; }
+  // Forgets the errors reported so far, for the next request of a server.
+  static void ClearHadError() { sHadError = false; }
 
  private:
   AidlError(bool fatal);
 
   bool fatal_;
 
-  static bool sHadError;
+  static std::atomic<bool> sHadError;
+  // Where the non-fatal errors of the calling thread go.
+  static thread_local std::ostream* sStream;
 
+  friend class AidlErrorCapture;
   DISALLOW_COPY_AND_ASSIGN(AidlError);
 };
 
+// While in scope, the non-fatal errors of the calling thread are kept instead
+// of being printed. Jobs run in parallel use this so that their errors can be
+// printed in a deterministic order afterwards. Kept errors do not count for
+// hadError(), as the caller decides whether they are reported.
+class AidlErrorCapture {
+ public:
+  AidlErrorCapture() : previous_(AidlError::sStream) { AidlError::sStream = &errors_; }
+  ~AidlErrorCapture() { AidlError::sStream = previous_; }
+
+  std::string str() const { return errors_.str(); }
+
+  // Reports |errors| kept by a capture, maybe on another thread, as if they
+  // happened now on the calling thread.
+  static void Report(const std::string& errors);
+
+ private:
+  std::ostringstream errors_;
+  std::ostream* const previous_;
+
+  DISALLOW_COPY_AND_ASSIGN(AidlErrorCapture);
+};
+
 #define AIDL_ERROR(CONTEXT) ::AidlError(false /*fatal*/, (CONTEXT)).os_
 #define AIDL_FATAL(CONTEXT) ::AidlError(true /*fatal*/, (CONTEXT)).os_
 #define AIDL_FATAL_IF(CONDITION, CONTEXT) \
@@ -207,15 +280,19 @@ class AidlAnnotation : public AidlNode {
   string ToString(const ConstantValueDecorator& decorator) const;
   std::map<std::string, std::string> AnnotationParams(
       const ConstantValueDecorator& decorator) const;
-  const string& GetComments() const { return comments_; }
-  void SetComments(const string& comments) { comments_ = comments; }
+  // The undecorated value of the parameter |name|, or "" if it isn't given or
+  // isn't valid. Invalid values are reported by CheckValid().
+  std::string ParamValue(const std::string& name) const;
+  const string& GetComments() const { return comments_.str(); }
+  const AidlComments& GetSharedComments() const { return comments_; }
+  void SetComments(const AidlComments& comments) { comments_ = comments; }
 
  private:
   AidlAnnotation(const AidlLocation& location, const string& name);
   AidlAnnotation(const AidlLocation& location, const string& name,
                  std::map<std::string, std::shared_ptr<AidlConstantValue>>&& parameters);
   const string name_;
-  string comments_;
+  AidlComments comments_;
   std::map<std::string, std::shared_ptr<AidlConstantValue>> parameters_;
 };
 
@@ -234,16 +311,29 @@ class AidlAnnotatable : public AidlNode {
   AidlAnnotatable(AidlAnnotatable&&) = default;
   virtual ~AidlAnnotatable() = default;
 
-  void Annotate(vector<AidlAnnotation>&& annotations) {
-    for (auto& annotation : annotations) {
-      annotations_.emplace_back(std::move(annotation));
-    }
-  }
+  void Annotate(vector<AidlAnnotation>&& annotations);
   bool IsNullable() const;
   bool IsUtf8InCpp() const;
   bool IsVintfStability() const;
   bool IsStableApiParcelable(Options::Language lang) const;
   bool IsHide() const;
+  bool IsReuseParcels() const;
+  bool IsSharedMemory() const;
+  bool IsView() const;
+  bool IsBatchable() const;
+  bool IsPropagateCallContext() const;
+  bool IsLazy() const;
+  bool IsRaw() const;
+  bool IsUtf8Strings() const;
+  bool IsPackedArrays() const;
+  bool IsFixedSize() const;
+  // The number of elements of @FixedSize, or 0 if there is none.
+  size_t FixedSize() const;
+  bool IsChunked() const;
+  // The most bytes of a chunk of a @Chunked result, or 0 if there is none.
+  size_t ChunkBytes() const;
+  // The name of the executor pool of @DispatchOn, or "" if there is none.
+  std::string DispatchPool() const;
 
   void DumpAnnotations(CodeWriter* writer) const;
 
@@ -255,7 +345,19 @@ class AidlAnnotatable : public AidlNode {
   bool CheckValidAnnotations() const;
 
  private:
+  // Keeps the parameters of |annotation| that the getters return
+  void TakeParameters(const AidlAnnotation& annotation);
+
   vector<AidlAnnotation> annotations_;
+  // One bit for each annotation that is present, so that IsNullable() and the
+  // like don't look for it by name
+  uint32_t flags_ = 0;
+  // The parameters of the first annotation of each name that takes them, as
+  // Annotate() parsed them
+  size_t fixed_size_ = 0;
+  size_t chunk_bytes_ = 0;
+  std::string dispatch_pool_;
+  std::string backing_type_;
 };
 
 class AidlQualifiedName;
@@ -266,7 +368,8 @@ class AidlTypeSpecifier final : public AidlAnnotatable,
                                 public AidlParameterizable<unique_ptr<AidlTypeSpecifier>> {
  public:
   AidlTypeSpecifier(const AidlLocation& location, const string& unresolved_name, bool is_array,
-                    vector<unique_ptr<AidlTypeSpecifier>>* type_params, const string& comments);
+                    vector<unique_ptr<AidlTypeSpecifier>>* type_params,
+                    const AidlComments& comments);
   virtual ~AidlTypeSpecifier() = default;
 
   // Copy of this type which is not an array.
@@ -295,16 +398,23 @@ class AidlTypeSpecifier final : public AidlAnnotatable,
 
   bool IsHidden() const;
 
-  const string& GetComments() const { return comments_; }
+  const string& GetComments() const { return comments_.str(); }
+  const AidlComments& GetSharedComments() const { return comments_; }
 
   const std::vector<std::string> GetSplitName() const { return split_name_; }
 
-  void SetComments(const string& comment) { comments_ = comment; }
+  void SetComments(const AidlComments& comment) { comments_ = comment; }
 
   bool IsResolved() const { return fully_qualified_name_ != ""; }
 
   bool IsArray() const { return is_array_; }
 
+  // The kind of the resolved base type, NONE for a defined type.
+  AidlBuiltinKind GetBuiltinKind() const { return builtin_kind_; }
+
+  // Same as GetBuiltinKind(), but the kind of the backing type for an enum.
+  AidlBuiltinKind GetBackingKind(const AidlTypenames& typenames) const;
+
   // Resolve the base type name to a fully-qualified name. Return false if the
   // resolution fails.
   bool Resolve(const AidlTypenames& typenames);
@@ -319,8 +429,9 @@ class AidlTypeSpecifier final : public AidlAnnotatable,
   const string unresolved_name_;
   string fully_qualified_name_;
   bool is_array_;
-  string comments_;
+  AidlComments comments_;
   vector<string> split_name_;
+  AidlBuiltinKind builtin_kind_ = AidlBuiltinKind::NONE;
 };
 
 // Returns the universal value unaltered.
@@ -443,6 +554,10 @@ class AidlConstantValue : public AidlNode {
 
   virtual bool CheckValid() const;
 
+  // Evaluates the value as |type| and keeps the result, so that ValueString()
+  // only has to decorate it. Returns false and logs if the value is invalid.
+  bool Evaluate(const AidlTypeSpecifier& type) const;
+
   // Raw value of type (currently valid in C++ and Java). Empty string on error.
   string ValueString(const AidlTypeSpecifier& type, const ConstantValueDecorator& decorator) const;
 
@@ -457,6 +572,9 @@ class AidlConstantValue : public AidlNode {
   static bool IsHex(const string& value);
 
   virtual bool evaluate(const AidlTypeSpecifier& type) const;
+  // The undecorated value of a non-array constant as |type|, or nullopt after
+  // logging an error. Only valid after evaluate().
+  std::optional<string> RawValue(const AidlTypeSpecifier& type) const;
 
   const Type type_ = Type::ERROR;
   const vector<unique_ptr<AidlConstantValue>> values_;  // if type_ == ARRAY
@@ -546,15 +664,15 @@ class AidlConstantDeclaration : public AidlMember {
 class AidlMethod : public AidlMember {
  public:
   AidlMethod(const AidlLocation& location, bool oneway, AidlTypeSpecifier* type, const string& name,
-             vector<unique_ptr<AidlArgument>>* args, const string& comments);
+             vector<unique_ptr<AidlArgument>>* args, const AidlComments& comments);
   AidlMethod(const AidlLocation& location, bool oneway, AidlTypeSpecifier* type, const string& name,
-             vector<unique_ptr<AidlArgument>>* args, const string& comments, int id,
+             vector<unique_ptr<AidlArgument>>* args, const AidlComments& comments, int id,
              bool is_user_defined = true);
   virtual ~AidlMethod() = default;
 
   AidlMethod* AsMethod() override { return this; }
   bool IsHidden() const;
-  const string& GetComments() const { return comments_; }
+  const string& GetComments() const { return comments_.str(); }
   const AidlTypeSpecifier& GetType() const { return *type_; }
   AidlTypeSpecifier* GetMutableType() { return type_.get(); }
 
@@ -592,7 +710,7 @@ class AidlMethod : public AidlMember {
 
  private:
   bool oneway_;
-  std::string comments_;
+  AidlComments comments_;
   std::unique_ptr<AidlTypeSpecifier> type_;
   std::string name_;
   const std::vector<std::unique_ptr<AidlArgument>> arguments_;
@@ -613,11 +731,12 @@ class AidlStructuredParcelable;
 class AidlQualifiedName : public AidlNode {
  public:
   AidlQualifiedName(const AidlLocation& location, const std::string& term,
-                    const std::string& comments);
+                    const AidlComments& comments);
   virtual ~AidlQualifiedName() = default;
 
   const std::vector<std::string>& GetTerms() const { return terms_; }
-  const std::string& GetComments() const { return comments_; }
+  const std::string& GetComments() const { return comments_.str(); }
+  const AidlComments& GetSharedComments() const { return comments_; }
   std::string GetDotName() const { return android::base::Join(terms_, '.'); }
   std::string GetColonName() const { return android::base::Join(terms_, "::"); }
 
@@ -625,7 +744,7 @@ class AidlQualifiedName : public AidlNode {
 
  private:
   std::vector<std::string> terms_;
-  std::string comments_;
+  AidlComments comments_;
 
   DISALLOW_COPY_AND_ASSIGN(AidlQualifiedName);
 };
@@ -638,13 +757,14 @@ class AidlStructuredParcelable;
 class AidlDefinedType : public AidlAnnotatable {
  public:
   AidlDefinedType(const AidlLocation& location, const std::string& name,
-                  const std::string& comments, const std::vector<std::string>& package);
+                  const AidlComments& comments, const std::vector<std::string>& package);
   virtual ~AidlDefinedType() = default;
 
   const std::string& GetName() const { return name_; };
   bool IsHidden() const;
-  const std::string& GetComments() const { return comments_; }
-  void SetComments(const std::string comments) { comments_ = comments; }
+  const std::string& GetComments() const { return comments_.str(); }
+  const AidlComments& GetSharedComments() const { return comments_; }
+  void SetComments(const AidlComments& comments) { comments_ = comments; }
 
   /* dot joined package, example: "android.package.foo" */
   std::string GetPackage() const;
@@ -695,7 +815,7 @@ class AidlDefinedType : public AidlAnnotatable {
 
  private:
   std::string name_;
-  std::string comments_;
+  AidlComments comments_;
   const std::vector<std::string> package_;
 
   DISALLOW_COPY_AND_ASSIGN(AidlDefinedType);
@@ -704,7 +824,7 @@ class AidlDefinedType : public AidlAnnotatable {
 class AidlParcelable : public AidlDefinedType, public AidlParameterizable<std::string> {
  public:
   AidlParcelable(const AidlLocation& location, AidlQualifiedName* name,
-                 const std::vector<std::string>& package, const std::string& comments,
+                 const std::vector<std::string>& package, const AidlComments& comments,
                  const std::string& cpp_header = "",
                  std::vector<std::string>* type_params = nullptr);
   virtual ~AidlParcelable() = default;
@@ -732,7 +852,7 @@ class AidlParcelable : public AidlDefinedType, public AidlParameterizable<std::s
 class AidlStructuredParcelable : public AidlParcelable {
  public:
   AidlStructuredParcelable(const AidlLocation& location, AidlQualifiedName* name,
-                           const std::vector<std::string>& package, const std::string& comments,
+                           const std::vector<std::string>& package, const AidlComments& comments,
                            std::vector<std::unique_ptr<AidlVariableDeclaration>>* variables);
 
   const std::vector<std::unique_ptr<AidlVariableDeclaration>>& GetFields() const {
@@ -756,12 +876,12 @@ class AidlStructuredParcelable : public AidlParcelable {
 class AidlEnumerator : public AidlNode {
  public:
   AidlEnumerator(const AidlLocation& location, const std::string& name, AidlConstantValue* value,
-                 const std::string& comments);
+                 const AidlComments& comments);
   virtual ~AidlEnumerator() = default;
 
   const std::string& GetName() const { return name_; }
   AidlConstantValue* GetValue() const { return value_.get(); }
-  const std::string& GetComments() const { return comments_; }
+  const std::string& GetComments() const { return comments_.str(); }
   bool CheckValid(const AidlTypeSpecifier& enum_backing_type) const;
 
   string ValueString(const AidlTypeSpecifier& backing_type,
@@ -772,7 +892,7 @@ class AidlEnumerator : public AidlNode {
  private:
   const std::string name_;
   unique_ptr<AidlConstantValue> value_;
-  const std::string comments_;
+  const AidlComments comments_;
 
   DISALLOW_COPY_AND_ASSIGN(AidlEnumerator);
 };
@@ -781,7 +901,7 @@ class AidlEnumDeclaration : public AidlDefinedType {
  public:
   AidlEnumDeclaration(const AidlLocation& location, const string& name,
                       std::vector<std::unique_ptr<AidlEnumerator>>* enumerators,
-                      const std::vector<std::string>& package, const std::string& comments);
+                      const std::vector<std::string>& package, const AidlComments& comments);
   virtual ~AidlEnumDeclaration() = default;
 
   void SetBackingType(std::unique_ptr<const AidlTypeSpecifier> type);
@@ -807,7 +927,7 @@ class AidlEnumDeclaration : public AidlDefinedType {
 
 class AidlInterface final : public AidlDefinedType {
  public:
-  AidlInterface(const AidlLocation& location, const std::string& name, const std::string& comments,
+  AidlInterface(const AidlLocation& location, const std::string& name, const AidlComments& comments,
                 bool oneway_, std::vector<std::unique_ptr<AidlMember>>* members,
                 const std::vector<std::string>& package);
   virtual ~AidlInterface() = default;
@@ -824,6 +944,24 @@ class AidlInterface final : public AidlDefinedType {
 
   void Dump(CodeWriter* writer) const override;
 
+  // Whether calls of |method| start with the deadline and priority class of
+  // the client, because of a @PropagateCallContext on the method or on the
+  // interface. @Batchable methods don't.
+  bool PropagatesCallContext(const AidlMethod& method) const;
+
+  // Whether |type|, of an argument or the return value of a user-defined
+  // method, is a String that @Utf8Strings lets go as UTF-8. Such a String is
+  // written as in other interfaces, or as -2 followed by a byte array of its
+  // UTF-8 encoding. Readers take both.
+  bool IsUtf8WireString(const AidlTypeSpecifier& type) const;
+  // Whether |method| has an argument or return value of IsUtf8WireString().
+  bool HasUtf8WireStrings(const AidlMethod& method) const;
+  // Whether |type|, of an argument or the return value of a method, is a
+  // boolean[] or char[], but not a @FixedSize one, that @PackedArrays packs:
+  // the length, or -1 for null, then a byte array of the elements, one bit
+  // per boolean and two little-endian bytes per char.
+  bool IsPackedWireArray(const AidlTypeSpecifier& type) const;
+
   bool CheckValid(const AidlTypenames& typenames) const override;
   bool LanguageSpecificCheckValid(Options::Language lang) const override;
 
@@ -853,17 +991,30 @@ class Parser {
  public:
   ~Parser();
 
+  // How the comments before tokens are kept.
+  enum class Comments {
+    COPY,  // copied out of the file while it is parsed
+    LAZY,  // kept as spans of the file, which stays loaded until they are read
+  };
+
   // Parse contents of file |filename|. Should only be called once.
   static std::unique_ptr<Parser> Parse(const std::string& filename,
                                        const android::aidl::IoDelegate& io_delegate,
-                                       AidlTypenames& typenames);
+                                       AidlTypenames& typenames,
+                                       Comments comments = Comments::COPY);
 
   void AddError() { error_++; }
   bool HasError() { return error_ != 0; }
 
-  const std::string& FileName() const { return filename_; }
+  const std::string& FileName() const { return *filename_; }
+  // The file name for the locations of the nodes, shared by all of them
+  const std::shared_ptr<const std::string>& LocationFileName() const { return filename_; }
   void* Scanner() const { return scanner_; }
 
+  // Called by the lexer with the span of the comments before a token. |begin|
+  // is null if there are none.
+  AidlComments MakeComments(const char* begin, const char* end) const;
+
   void AddImport(std::unique_ptr<AidlImport>&& import);
   const std::vector<std::unique_ptr<AidlImport>>& GetImports() {
     return imports_;
@@ -894,13 +1045,16 @@ class Parser {
   vector<AidlDefinedType*>& GetDefinedTypes() { return defined_types_; }
 
  private:
-  explicit Parser(const std::string& filename, std::string& raw_buffer,
-                  android::aidl::AidlTypenames& typenames);
+  explicit Parser(const std::string& filename, std::shared_ptr<android::aidl::ScanBuffer> buffer,
+                  Comments comments, android::aidl::AidlTypenames& typenames);
 
-  std::string filename_;
+  std::shared_ptr<const std::string> filename_;
   std::unique_ptr<AidlQualifiedName> package_;
   AidlTypenames& typenames_;
 
+  std::shared_ptr<android::aidl::ScanBuffer> scan_buffer_;
+  Comments comments_;
+
   void* scanner_ = nullptr;
   YY_BUFFER_STATE buffer_;
   int error_ = 0;
@@ -22,6 +22,18 @@
 #include "aidl_language_y-module.h"
 
 #define YY_USER_ACTION yylloc->columns(yyleng);
+
+// Tokens view their text in the scan buffer, which outlives the parse.
+#define TOKEN_TEXT std::string_view(yytext, yyleng)
+
+// Comments are only marked in the scan buffer, and Parser::MakeComments
+// decides whether to copy them out now or later.
+#define ADD_COMMENT                                         \
+  do {                                                      \
+    if (comments_begin == nullptr) comments_begin = yytext; \
+    comments_end = yytext + yyleng;                         \
+  } while (0)
+#define COMMENTS yyextra->MakeComments(comments_begin, comments_end)
 %}
 
 %option yylineno
@@ -31,6 +43,7 @@
 %option reentrant
 %option bison-bridge
 %option bison-locations
+%option extra-type="Parser*"
 
 %x LONG_COMMENT
 
@@ -43,20 +56,21 @@ floatvalue  [0-9]*\.?[0-9]+([eE][-+]?[0-9]+)?f?
 %%
 %{
   /* This happens at every call to yylex (every time we receive one token) */
-  std::string extra_text;
+  const char* comments_begin = nullptr;
+  const char* comments_end = nullptr;
   yylloc->step();
 %}
 
-\/\*                  { extra_text += yytext; BEGIN(LONG_COMMENT); }
-<LONG_COMMENT>\*+\/   { extra_text += yytext; yylloc->step(); BEGIN(INITIAL);  }
-<LONG_COMMENT>\*+     { extra_text += yytext; }
-<LONG_COMMENT>\n+     { extra_text += yytext; yylloc->lines(yyleng); }
-<LONG_COMMENT>[^*\n]+ { extra_text += yytext; }
+\/\*                  { ADD_COMMENT; BEGIN(LONG_COMMENT); }
+<LONG_COMMENT>\*+\/   { ADD_COMMENT; yylloc->step(); BEGIN(INITIAL);  }
+<LONG_COMMENT>\*+     { ADD_COMMENT; }
+<LONG_COMMENT>\n+     { ADD_COMMENT; yylloc->lines(yyleng); }
+<LONG_COMMENT>[^*\n]+ { ADD_COMMENT; }
 
-\"[^\"]*\"            { yylval->token = new AidlToken(yytext, extra_text);
+\"[^\"]*\"            { yylval->token = new AidlToken(TOKEN_TEXT, COMMENTS);
                         return yy::parser::token::C_STR; }
 
-\/\/.*                { extra_text += yytext; extra_text += "\n"; }
+\/\/.*                { ADD_COMMENT; }
 
 \n+                   { yylloc->lines(yyleng); yylloc->step(); }
 {whitespace}          {}
@@ -96,12 +110,12 @@ floatvalue  [0-9]*\.?[0-9]+([eE][-+]?[0-9]+)?f?
 "!="                  { return(yy::parser::token::NEQ); }
 
     /* annotations */
-@{identifier}         { yylval->token = new AidlToken(yytext + 1, extra_text);
+@{identifier}         { yylval->token = new AidlToken(TOKEN_TEXT.substr(1), COMMENTS);
                         return yy::parser::token::ANNOTATION;
                       }
 
     /* keywords */
-parcelable            { yylval->token = new AidlToken("parcelable", extra_text);
+parcelable            { yylval->token = new AidlToken("parcelable", COMMENTS);
                         return yy::parser::token::PARCELABLE;
                       }
 import                { return yy::parser::token::IMPORT; }
@@ -110,33 +124,33 @@ in                    { return yy::parser::token::IN; }
 out                   { return yy::parser::token::OUT; }
 inout                 { return yy::parser::token::INOUT; }
 cpp_header            { return yy::parser::token::CPP_HEADER; }
-const                 { yylval->token = new AidlToken("const", extra_text);
+const                 { yylval->token = new AidlToken("const", COMMENTS);
                         return yy::parser::token::CONST; }
 true                  { return yy::parser::token::TRUE_LITERAL; }
 false                 { return yy::parser::token::FALSE_LITERAL; }
 
-interface             { yylval->token = new AidlToken("interface", extra_text);
+interface             { yylval->token = new AidlToken("interface", COMMENTS);
                         return yy::parser::token::INTERFACE;
                       }
-oneway                { yylval->token = new AidlToken("oneway", extra_text);
+oneway                { yylval->token = new AidlToken("oneway", COMMENTS);
                         return yy::parser::token::ONEWAY;
                       }
-enum                  { yylval->token = new AidlToken("enum", extra_text);
+enum                  { yylval->token = new AidlToken("enum", COMMENTS);
                         return yy::parser::token::ENUM;
                       }
 
     /* scalars */
-{identifier}          { yylval->token = new AidlToken(yytext, extra_text);
+{identifier}          { yylval->token = new AidlToken(TOKEN_TEXT, COMMENTS);
                         return yy::parser::token::IDENTIFIER;
                       }
 '.'                   { yylval->character = yytext[1];
                         return yy::parser::token::CHARVALUE;
                       }
-{intvalue}            { yylval->token = new AidlToken(yytext, extra_text);
+{intvalue}            { yylval->token = new AidlToken(TOKEN_TEXT, COMMENTS);
                         return yy::parser::token::INTVALUE; }
-{floatvalue}          { yylval->token = new AidlToken(yytext, extra_text);
+{floatvalue}          { yylval->token = new AidlToken(TOKEN_TEXT, COMMENTS);
                         return yy::parser::token::FLOATVALUE; }
-{hexvalue}            { yylval->token = new AidlToken(yytext, extra_text);
+{hexvalue}            { yylval->token = new AidlToken(TOKEN_TEXT, COMMENTS);
                         return yy::parser::token::HEXVALUE; }
 
   /* lexical error! */
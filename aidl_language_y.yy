@@ -27,7 +27,9 @@
 
 int yylex(yy::parser::semantic_type *, yy::parser::location_type *, void *);
 
-AidlLocation loc(const yy::parser::location_type& begin, const yy::parser::location_type& end) {
+// The file name of the locations is |ps|'s, which all nodes of the file share.
+AidlLocation loc(const Parser* ps, const yy::parser::location_type& begin,
+                 const yy::parser::location_type& end) {
   CHECK(begin.begin.filename == begin.end.filename);
   CHECK(begin.end.filename == end.begin.filename);
   CHECK(end.begin.filename == end.end.filename);
@@ -39,11 +41,11 @@ AidlLocation loc(const yy::parser::location_type& begin, const yy::parser::locat
     .line = end.end.line,
     .column = end.end.column,
   };
-  return AidlLocation(*begin.begin.filename, begin_point, end_point);
+  return AidlLocation(ps->LocationFileName(), begin_point, end_point);
 }
 
-AidlLocation loc(const yy::parser::location_type& l) {
-  return loc(l, l);
+AidlLocation loc(const Parser* ps, const yy::parser::location_type& l) {
+  return loc(ps, l, l);
 }
 
 #define lex_scanner ps->Scanner()
@@ -204,18 +206,18 @@ imports
 
 import
  : IMPORT qualified_name ';'
-  { ps->AddImport(std::make_unique<AidlImport>(loc(@2), $2->GetDotName()));
+  { ps->AddImport(std::make_unique<AidlImport>(loc(ps, @2), $2->GetDotName()));
     delete $2;
   };
 
 qualified_name
  : identifier {
-    $$ = new AidlQualifiedName(loc(@1), $1->GetText(), $1->GetComments());
+    $$ = new AidlQualifiedName(loc(ps, @1), std::string($1->GetText()), $1->GetComments());
     delete $1;
   }
  | qualified_name '.' identifier
   { $$ = $1;
-    $$->AddTerm($3->GetText());
+    $$->AddTerm(std::string($3->GetText()));
     delete $3;
   };
 
@@ -238,7 +240,7 @@ decl
 
     if ($1->size() > 0 && $$ != nullptr) {
       // copy comments from annotation to decl
-      $$->SetComments($1->begin()->GetComments());
+      $$->SetComments($1->begin()->GetSharedComments());
       $$->Annotate(std::move(*$1));
     }
 
@@ -270,21 +272,23 @@ type_params
 
 parcelable_decl
  : PARCELABLE qualified_name ';' {
-    $$ = new AidlParcelable(loc(@2), $2, ps->Package(), $1->GetComments());
+    $$ = new AidlParcelable(loc(ps, @2), $2, ps->Package(), $1->GetComments());
     delete $1;
   }
  | PARCELABLE qualified_name '<' type_params '>' ';' {
-    $$ = new AidlParcelable(loc(@2), $2, ps->Package(), $1->GetComments(), "", $4);
+    $$ = new AidlParcelable(loc(ps, @2), $2, ps->Package(), $1->GetComments(), "", $4);
     delete $1;
  }
  | PARCELABLE qualified_name CPP_HEADER C_STR ';' {
-    $$ = new AidlParcelable(loc(@2), $2, ps->Package(), $1->GetComments(), $4->GetText());
+    $$ = new AidlParcelable(loc(ps, @2), $2, ps->Package(), $1->GetComments(),
+                            std::string($4->GetText()));
     delete $1;
     delete $4;
   }
  | PARCELABLE identifier '{' variable_decls '}' {
-    AidlQualifiedName* name = new AidlQualifiedName(loc(@2), $2->GetText(), $2->GetComments());
-    $$ = new AidlStructuredParcelable(loc(@2), name, ps->Package(), $1->GetComments(), $4);
+    AidlQualifiedName* name =
+        new AidlQualifiedName(loc(ps, @2), std::string($2->GetText()), $2->GetComments());
+    $$ = new AidlStructuredParcelable(loc(ps, @2), name, ps->Package(), $1->GetComments(), $4);
     delete $1;
     delete $2;
     delete $4;
@@ -308,12 +312,12 @@ variable_decls
 
 variable_decl
  : type identifier ';' {
-   $$ = new AidlVariableDeclaration(loc(@2), $1, $2->GetText());
+   $$ = new AidlVariableDeclaration(loc(ps, @2), $1, std::string($2->GetText()));
    delete $2;
  }
  | type identifier '=' const_expr ';' {
    // TODO(b/123321528): Support enum type default assignments (TestEnum foo = TestEnum.FOO).
-   $$ = new AidlVariableDeclaration(loc(@2), $1, $2->GetText(),  $4);
+   $$ = new AidlVariableDeclaration(loc(ps, @2), $1, std::string($2->GetText()),  $4);
    delete $2;
  }
  | error ';' {
@@ -323,12 +327,14 @@ variable_decl
 
 interface_decl
  : INTERFACE identifier '{' interface_members '}' {
-    $$ = new AidlInterface(loc(@1), $2->GetText(), $1->GetComments(), false, $4, ps->Package());
+    $$ = new AidlInterface(loc(ps, @1), std::string($2->GetText()), $1->GetComments(), false, $4,
+                           ps->Package());
     delete $1;
     delete $2;
   }
  | ONEWAY INTERFACE identifier '{' interface_members '}' {
-    $$ = new AidlInterface(loc(@2), $3->GetText(),  $1->GetComments(), true, $5, ps->Package());
+    $$ = new AidlInterface(loc(ps, @2), std::string($3->GetText()), $1->GetComments(), true, $5,
+                           ps->Package());
     delete $1;
     delete $2;
     delete $3;
@@ -353,105 +359,105 @@ interface_members
   };
 
 const_expr
- : TRUE_LITERAL { $$ = AidlConstantValue::Boolean(loc(@1), true); }
- | FALSE_LITERAL { $$ = AidlConstantValue::Boolean(loc(@1), false); }
- | CHARVALUE { $$ = AidlConstantValue::Character(loc(@1), $1); }
+ : TRUE_LITERAL { $$ = AidlConstantValue::Boolean(loc(ps, @1), true); }
+ | FALSE_LITERAL { $$ = AidlConstantValue::Boolean(loc(ps, @1), false); }
+ | CHARVALUE { $$ = AidlConstantValue::Character(loc(ps, @1), $1); }
  | INTVALUE {
-    $$ = AidlConstantValue::Integral(loc(@1), $1->GetText());
+    $$ = AidlConstantValue::Integral(loc(ps, @1), std::string($1->GetText()));
     if ($$ == nullptr) {
       std::cerr << "ERROR: Could not parse integer: "
                 << $1->GetText() << " at " << @1 << ".\n";
       ps->AddError();
-      $$ = AidlConstantValue::Integral(loc(@1), "0");
+      $$ = AidlConstantValue::Integral(loc(ps, @1), "0");
     }
     delete $1;
   }
  | FLOATVALUE {
-    $$ = AidlConstantValue::Floating(loc(@1), $1->GetText());
+    $$ = AidlConstantValue::Floating(loc(ps, @1), std::string($1->GetText()));
     delete $1;
   }
  | HEXVALUE {
-    $$ = AidlConstantValue::Integral(loc(@1), $1->GetText());
+    $$ = AidlConstantValue::Integral(loc(ps, @1), std::string($1->GetText()));
     if ($$ == nullptr) {
       std::cerr << "ERROR: Could not parse hexvalue: "
                 << $1->GetText() << " at " << @1 << ".\n";
       ps->AddError();
-      $$ = AidlConstantValue::Integral(loc(@1), "0");
+      $$ = AidlConstantValue::Integral(loc(ps, @1), "0");
     }
     delete $1;
   }
  | C_STR {
-    $$ = AidlConstantValue::String(loc(@1), $1->GetText());
+    $$ = AidlConstantValue::String(loc(ps, @1), std::string($1->GetText()));
     delete $1;
   }
  | '{' constant_value_list '}' {
-    $$ = AidlConstantValue::Array(loc(@1), std::unique_ptr<vector<unique_ptr<AidlConstantValue>>>($2));
+    $$ = AidlConstantValue::Array(loc(ps, @1), std::unique_ptr<vector<unique_ptr<AidlConstantValue>>>($2));
   }
  | const_expr LOGICAL_OR const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "||", std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "||", std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr LOGICAL_AND const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "&&", std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "&&", std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '|' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "|" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "|" , std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '^' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "^" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "^" , std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '&' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "&" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "&" , std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr EQUALITY const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "==", std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "==", std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr NEQ const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "!=", std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "!=", std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '<' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "<" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "<" , std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '>' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), ">" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), ">" , std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr LEQ const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "<=", std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "<=", std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr GEQ const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), ">=", std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), ">=", std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr LSHIFT const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "<<", std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "<<", std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr RSHIFT const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), ">>", std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), ">>", std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '+' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "+" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "+" , std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '-' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "-" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "-" , std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '*' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "*" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "*" , std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '/' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "/" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "/" , std::unique_ptr<AidlConstantValue>($3));
   }
  | const_expr '%' const_expr {
-    $$ = new AidlBinaryConstExpression(loc(@1), std::unique_ptr<AidlConstantValue>($1), "%" , std::unique_ptr<AidlConstantValue>($3));
+    $$ = new AidlBinaryConstExpression(loc(ps, @1), std::unique_ptr<AidlConstantValue>($1), "%" , std::unique_ptr<AidlConstantValue>($3));
   }
  | '+' const_expr %prec UNARY_PLUS  {
-    $$ = new AidlUnaryConstExpression(loc(@1), "+", std::unique_ptr<AidlConstantValue>($2));
+    $$ = new AidlUnaryConstExpression(loc(ps, @1), "+", std::unique_ptr<AidlConstantValue>($2));
   }
  | '-' const_expr %prec UNARY_MINUS {
-    $$ = new AidlUnaryConstExpression(loc(@1), "-", std::unique_ptr<AidlConstantValue>($2));
+    $$ = new AidlUnaryConstExpression(loc(ps, @1), "-", std::unique_ptr<AidlConstantValue>($2));
   }
  | '!' const_expr {
-    $$ = new AidlUnaryConstExpression(loc(@1), "!", std::unique_ptr<AidlConstantValue>($2));
+    $$ = new AidlUnaryConstExpression(loc(ps, @1), "!", std::unique_ptr<AidlConstantValue>($2));
   }
  | '~' const_expr {
-    $$ = new AidlUnaryConstExpression(loc(@1), "~", std::unique_ptr<AidlConstantValue>($2));
+    $$ = new AidlUnaryConstExpression(loc(ps, @1), "~", std::unique_ptr<AidlConstantValue>($2));
   }
  | '(' const_expr ')'
   {
@@ -462,7 +468,7 @@ const_expr
      std::cerr << "ERROR: invalid const expression within parenthesis at " << @1 << ".\n";
      ps->AddError();
      // to avoid segfaults
-     $$ = AidlConstantValue::Integral(loc(@1), "0");
+     $$ = AidlConstantValue::Integral(loc(ps, @1), "0");
    }
  ;
 
@@ -489,7 +495,7 @@ constant_value_non_empty_list
 constant_decl
  : CONST type identifier '=' const_expr ';' {
     $2->SetComments($1->GetComments());
-    $$ = new AidlConstantDeclaration(loc(@3), $2, $3->GetText(), $5);
+    $$ = new AidlConstantDeclaration(loc(ps, @3), $2, std::string($3->GetText()), $5);
     delete $1;
     delete $3;
    }
@@ -497,11 +503,11 @@ constant_decl
 
 enumerator
  : identifier '=' const_expr {
-    $$ = new AidlEnumerator(loc(@1), $1->GetText(), $3, $1->GetComments());
+    $$ = new AidlEnumerator(loc(ps, @1), std::string($1->GetText()), $3, $1->GetComments());
     delete $1;
    }
  | identifier {
-    $$ = new AidlEnumerator(loc(@1), $1->GetText(), nullptr, $1->GetComments());
+    $$ = new AidlEnumerator(loc(ps, @1), std::string($1->GetText()), nullptr, $1->GetComments());
     delete $1;
    }
  ;
@@ -524,7 +530,8 @@ enum_decl_body
 
 enum_decl
  : ENUM identifier enum_decl_body {
-    $$ = new AidlEnumDeclaration(loc(@2), $2->GetText(), $3, ps->Package(), $1->GetComments());
+    $$ = new AidlEnumDeclaration(loc(ps, @2), std::string($2->GetText()), $3, ps->Package(),
+                                 $1->GetComments());
     delete $1;
     delete $2;
     delete $3;
@@ -533,12 +540,14 @@ enum_decl
 
 method_decl
  : type identifier '(' arg_list ')' ';' {
-    $$ = new AidlMethod(loc(@2), false, $1, $2->GetText(), $4, $1->GetComments());
+    $$ = new AidlMethod(loc(ps, @2), false, $1, std::string($2->GetText()), $4,
+                        $1->GetSharedComments());
     delete $2;
   }
  | annotation_list ONEWAY type identifier '(' arg_list ')' ';' {
-    const std::string& comments = ($1->size() > 0) ? $1->begin()->GetComments() : $2->GetComments();
-    $$ = new AidlMethod(loc(@4), true, $3, $4->GetText(), $6, comments);
+    const AidlComments& comments =
+        ($1->size() > 0) ? $1->begin()->GetSharedComments() : $2->GetComments();
+    $$ = new AidlMethod(loc(ps, @4), true, $3, std::string($4->GetText()), $6, comments);
     $3->Annotate(std::move(*$1));
     delete $1;
     delete $2;
@@ -546,22 +555,24 @@ method_decl
   }
  | type identifier '(' arg_list ')' '=' INTVALUE ';' {
     int32_t serial = 0;
-    if (!android::base::ParseInt($7->GetText(), &serial)) {
-        AIDL_ERROR(loc(@7)) << "Could not parse int value: " << $7->GetText();
+    if (!android::base::ParseInt(std::string($7->GetText()), &serial)) {
+        AIDL_ERROR(loc(ps, @7)) << "Could not parse int value: " << $7->GetText();
         ps->AddError();
     }
-    $$ = new AidlMethod(loc(@2), false, $1, $2->GetText(), $4, $1->GetComments(), serial);
+    $$ = new AidlMethod(loc(ps, @2), false, $1, std::string($2->GetText()), $4,
+                        $1->GetSharedComments(), serial);
     delete $2;
     delete $7;
   }
  | annotation_list ONEWAY type identifier '(' arg_list ')' '=' INTVALUE ';' {
-    const std::string& comments = ($1->size() > 0) ? $1->begin()->GetComments() : $2->GetComments();
+    const AidlComments& comments =
+        ($1->size() > 0) ? $1->begin()->GetSharedComments() : $2->GetComments();
     int32_t serial = 0;
-    if (!android::base::ParseInt($9->GetText(), &serial)) {
-        AIDL_ERROR(loc(@9)) << "Could not parse int value: " << $9->GetText();
+    if (!android::base::ParseInt(std::string($9->GetText()), &serial)) {
+        AIDL_ERROR(loc(ps, @9)) << "Could not parse int value: " << $9->GetText();
         ps->AddError();
     }
-    $$ = new AidlMethod(loc(@4), true, $3, $4->GetText(), $6, comments, serial);
+    $$ = new AidlMethod(loc(ps, @4), true, $3, std::string($4->GetText()), $6, comments, serial);
     $3->Annotate(std::move(*$1));
     delete $1;
     delete $2;
@@ -587,28 +598,28 @@ arg_list
 
 arg
  : direction type identifier {
-    $$ = new AidlArgument(loc(@3), $1, $2, $3->GetText());
+    $$ = new AidlArgument(loc(ps, @3), $1, $2, std::string($3->GetText()));
     delete $3;
   }
  | type identifier {
-    $$ = new AidlArgument(loc(@2), $1, $2->GetText());
+    $$ = new AidlArgument(loc(ps, @2), $1, std::string($2->GetText()));
     delete $2;
   }
  ;
 
 unannotated_type
  : qualified_name {
-    $$ = new AidlTypeSpecifier(loc(@1), $1->GetDotName(), false, nullptr, $1->GetComments());
+    $$ = new AidlTypeSpecifier(loc(ps, @1), $1->GetDotName(), false, nullptr, $1->GetSharedComments());
     ps->DeferResolution($$);
     delete $1;
   }
  | qualified_name '[' ']' {
-    $$ = new AidlTypeSpecifier(loc(@1), $1->GetDotName(), true, nullptr, $1->GetComments());
+    $$ = new AidlTypeSpecifier(loc(ps, @1), $1->GetDotName(), true, nullptr, $1->GetSharedComments());
     ps->DeferResolution($$);
     delete $1;
   }
  | qualified_name '<' type_args '>' {
-    $$ = new AidlTypeSpecifier(loc(@1), $1->GetDotName(), false, $3, $1->GetComments());
+    $$ = new AidlTypeSpecifier(loc(ps, @1), $1->GetDotName(), false, $3, $1->GetSharedComments());
     ps->DeferResolution($$);
     delete $1;
   };
@@ -618,7 +629,7 @@ type
     $$ = $2;
     if ($1->size() > 0) {
       // copy comments from annotation to type
-      $2->SetComments($1->begin()->GetComments());
+      $2->SetComments($1->begin()->GetSharedComments());
     }
     $2->Annotate(std::move(*$1));
     delete $1;
@@ -648,7 +659,8 @@ annotation_list
 
 parameter
   : identifier '=' const_expr {
-    $$ = new AidlAnnotationParameter{$1->GetText(), std::unique_ptr<AidlConstantValue>($3)};
+    $$ = new AidlAnnotationParameter{std::string($1->GetText()),
+                                     std::unique_ptr<AidlConstantValue>($3)};
     delete $1;
   };
 
@@ -669,7 +681,7 @@ parameter_non_empty_list
   | parameter_non_empty_list ',' parameter {
     $$ = $1;
     if ($$->find($3->name) != $$->end()) {
-      AIDL_ERROR(loc(@3)) << "Trying to redefine parameter " << $3->name << ".";
+      AIDL_ERROR(loc(ps, @3)) << "Trying to redefine parameter " << $3->name << ".";
       ps->AddError();
     }
     $$->emplace(std::move($3->name), std::move($3->value));
@@ -679,7 +691,7 @@ parameter_non_empty_list
 annotation
  : ANNOTATION
   {
-    $$ = AidlAnnotation::Parse(loc(@1), $1->GetText(), nullptr);
+    $$ = AidlAnnotation::Parse(loc(ps, @1), std::string($1->GetText()), nullptr);
     if ($$) {
       $$->SetComments($1->GetComments());
     } else {
@@ -688,7 +700,7 @@ annotation
     delete $1;
   };
  | ANNOTATION '(' parameter_list ')' {
-    $$ = AidlAnnotation::Parse(loc(@1, @4), $1->GetText(), $3);
+    $$ = AidlAnnotation::Parse(loc(ps, @1, @4), std::string($1->GetText()), $3);
     if ($$) {
       $$->SetComments($1->GetComments());
     } else {
@@ -712,6 +724,6 @@ direction
 #include <stdio.h>
 
 void yy::parser::error(const yy::parser::location_type& l, const std::string& errstr) {
-  AIDL_ERROR(loc(l)) << errstr;
+  AIDL_ERROR(loc(ps, l)) << errstr;
   // parser will return error value
 }
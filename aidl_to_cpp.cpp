@@ -16,6 +16,7 @@
 
 #include "aidl_to_cpp.h"
 #include "aidl_language.h"
+#include "aidl_to_cpp_common.h"
 #include "logging.h"
 
 #include <android-base/stringprintf.h>
@@ -36,7 +37,7 @@ namespace cpp {
 namespace {
 std::string RawParcelMethod(const AidlTypeSpecifier& raw_type, const AidlTypenames& typenames,
                             bool readMethod) {
-  static map<string, string> kBuiltin = {
+  static const map<string, string> kBuiltin = {
       {"byte", "Byte"},
       {"boolean", "Bool"},
       {"char", "Char"},
@@ -50,7 +51,7 @@ std::string RawParcelMethod(const AidlTypeSpecifier& raw_type, const AidlTypenam
       {"String", "String16"},
   };
 
-  static map<string, string> kBuiltinVector = {
+  static const map<string, string> kBuiltinVector = {
       {"FileDescriptor", "UniqueFileDescriptorVector"},
       {"double", "DoubleVector"},
       {"char", "CharVector"},
@@ -86,7 +87,7 @@ std::string RawParcelMethod(const AidlTypeSpecifier& raw_type, const AidlTypenam
         CHECK(aidl_name == "String");
         return readMethod ? "Utf8VectorFromUtf16Vector" : "Utf8VectorAsUtf16Vector";
       }
-      return kBuiltinVector[aidl_name];
+      return kBuiltinVector.at(aidl_name);
     }
   } else {
     if (kBuiltin.find(aidl_name) != kBuiltin.end()) {
@@ -101,7 +102,7 @@ std::string RawParcelMethod(const AidlTypeSpecifier& raw_type, const AidlTypenam
         CHECK(aidl_name == "String");
         return readMethod ? "Utf8FromUtf16" : "Utf8AsUtf16";
       }
-      return kBuiltin[aidl_name];
+      return kBuiltin.at(aidl_name);
     }
   }
   CHECK(!AidlTypenames::IsBuiltinTypename(aidl_name));
@@ -134,20 +135,26 @@ std::string GetRawCppName(const AidlTypeSpecifier& type) {
   return "::" + Join(type.GetSplitName(), "::");
 }
 
+// The type that holds a @nullable value of |type_str|.
+std::string NullableOf(const std::string& type_str, bool nullable_optional) {
+  return (nullable_optional ? "::std::optional<" : "::std::unique_ptr<") + type_str + ">";
+}
+
 std::string WrapIfNullable(const std::string type_str, const AidlTypeSpecifier& raw_type,
-                           const AidlTypenames& typenames) {
+                           const AidlTypenames& typenames, bool nullable_optional) {
   const auto& type = raw_type.IsGeneric() ? (*raw_type.GetTypeParameters().at(0)) : raw_type;
 
   if (raw_type.IsNullable() && !AidlTypenames::IsPrimitiveTypename(type.GetName()) &&
       type.GetName() != "IBinder" && typenames.GetEnumDeclaration(type) == nullptr) {
-    return "::std::unique_ptr<" + type_str + ">";
+    return NullableOf(type_str, nullable_optional);
   }
   return type_str;
 }
 
-std::string GetCppName(const AidlTypeSpecifier& raw_type, const AidlTypenames& typenames) {
+std::string GetCppName(const AidlTypeSpecifier& raw_type, const AidlTypenames& typenames,
+                       bool nullable_optional = false) {
   // map from AIDL built-in type name to the corresponding Cpp type name
-  static map<string, string> m = {
+  static const map<string, string> m = {
       {"boolean", "bool"},
       {"byte", "int8_t"},
       {"char", "char16_t"},
@@ -172,16 +179,37 @@ std::string GetCppName(const AidlTypeSpecifier& raw_type, const AidlTypenames& t
       return "uint8_t";
     } else if (raw_type.IsUtf8InCpp()) {
       CHECK(aidl_name == "String");
-      return WrapIfNullable("::std::string", raw_type, typenames);
+      return WrapIfNullable("::std::string", raw_type, typenames, nullable_optional);
     }
-    return WrapIfNullable(m[aidl_name], raw_type, typenames);
+    return WrapIfNullable(m.at(aidl_name), raw_type, typenames, nullable_optional);
   }
   auto definedType = typenames.TryGetDefinedType(type.GetName());
   if (definedType != nullptr && definedType->AsInterface() != nullptr) {
     return "::android::sp<" + GetRawCppName(type) + ">";
   }
 
-  return WrapIfNullable(GetRawCppName(type), raw_type, typenames);
+  return WrapIfNullable(GetRawCppName(type), raw_type, typenames, nullable_optional);
+}
+
+std::string CppNameOfType(const AidlTypeSpecifier& type, const AidlTypenames& typenames,
+                          bool nullable_optional) {
+  if (type.IsView()) {
+    return "::android::aidl::ArrayView<" + GetCppName(type, typenames) + ">";
+  }
+  if (type.IsRaw()) {
+    return "::android::aidl::Raw<" + GetCppName(type, typenames) + ">";
+  }
+  if (type.IsArray() || type.IsGeneric()) {
+    std::string cpp_name = GetCppName(type, typenames, nullable_optional);
+    if (type.IsFixedSize()) {
+      return StringPrintf("::std::array<%s, %zu>", cpp_name.c_str(), type.FixedSize());
+    }
+    if (type.IsNullable()) {
+      return NullableOf("::std::vector<" + cpp_name + ">", nullable_optional);
+    }
+    return "::std::vector<" + cpp_name + ">";
+  }
+  return GetCppName(type, typenames, nullable_optional);
 }
 }  // namespace
 std::string ConstantValueDecorator(const AidlTypeSpecifier& type, const std::string& raw_value) {
@@ -209,14 +237,12 @@ std::string GetTransactionIdFor(const AidlMethod& method) {
 }
 
 std::string CppNameOf(const AidlTypeSpecifier& type, const AidlTypenames& typenames) {
-  if (type.IsArray() || type.IsGeneric()) {
-    std::string cpp_name = GetCppName(type, typenames);
-    if (type.IsNullable()) {
-      return "::std::unique_ptr<::std::vector<" + cpp_name + ">>";
-    }
-    return "::std::vector<" + cpp_name + ">";
-  }
-  return GetCppName(type, typenames);
+  return CppNameOfType(type, typenames, false /* nullable_optional */);
+}
+
+std::string CppNameOf(const AidlTypeSpecifier& type, const AidlTypenames& typenames,
+                      const Options& options) {
+  return CppNameOfType(type, typenames, options.NullableOptional());
 }
 
 bool IsNonCopyableType(const AidlTypeSpecifier& type, const AidlTypenames& typenames) {
@@ -267,8 +293,44 @@ std::string ParcelWriteCastOf(const AidlTypeSpecifier& type, const AidlTypenames
   return variable_name;
 }
 
-void AddHeaders(const AidlTypeSpecifier& raw_type, const AidlTypenames& typenames,
-                std::set<std::string>& headers) {
+ParcelSizeEstimate ParcelSizeEstimateOf(const AidlTypeSpecifier& type,
+                                        const AidlTypenames& typenames,
+                                        const std::string& variable_name) {
+  ParcelSizeEstimate estimate;
+  // Enums are written as their backing type.
+  string name = type.GetName();
+  if (auto enum_decl = typenames.GetEnumDeclaration(type); enum_decl != nullptr) {
+    name = enum_decl->GetBackingType().GetName();
+  }
+  if (type.IsNullable() && (type.IsArray() || name == "String")) {
+    // Only the size or the null marker is counted.
+    estimate.fixed_size = 4;
+  } else if (type.IsArray()) {
+    // The number of elements, then the elements. Bytes are packed, and other
+    // primitives take as much as they do outside of an array. An empty string
+    // takes 8 bytes; that is counted for each string.
+    estimate.fixed_size = 4;
+    size_t element_size = name == "byte" ? 1 : ParcelPrimitiveSize(name);
+    if (name == "String") {
+      element_size = 8;
+    }
+    if (element_size > 0) {
+      estimate.dynamic_size =
+          StringPrintf("(%s).size() * %zu", variable_name.c_str(), element_size);
+    }
+  } else if (name == "String") {
+    // The length, then the UTF-16 characters and a terminating NUL.
+    estimate.fixed_size = 4 + 2;
+    estimate.dynamic_size = StringPrintf("(%s).size() * 2", variable_name.c_str());
+  } else if (!type.IsGeneric()) {
+    estimate.fixed_size = ParcelPrimitiveSize(name);
+  }
+  return estimate;
+}
+
+namespace {
+void AddTypeHeaders(const AidlTypeSpecifier& raw_type, const AidlTypenames& typenames,
+                    bool nullable_optional, std::set<std::string>& headers) {
   bool isVector = raw_type.IsArray() || raw_type.IsGeneric();
   bool isNullable = raw_type.IsNullable();
   bool utf8 = raw_type.IsUtf8InCpp();
@@ -278,12 +340,14 @@ void AddHeaders(const AidlTypeSpecifier& raw_type, const AidlTypenames& typename
   const auto& type = raw_type.IsGeneric() ? *raw_type.GetTypeParameters().at(0) : raw_type;
   auto definedType = typenames.TryGetDefinedType(type.GetName());
 
-  if (isVector) {
+  if (raw_type.IsFixedSize()) {
+    headers.insert("array");
+  } else if (isVector) {
     headers.insert("vector");
   }
   if (isNullable) {
     if (type.GetName() != "IBinder") {
-      headers.insert("memory");
+      headers.insert(nullable_optional ? "optional" : "memory");
     }
   }
   if (type.GetName() == "String") {
@@ -318,6 +382,17 @@ void AddHeaders(const AidlTypeSpecifier& raw_type, const AidlTypenames& typename
     headers.insert(cpp_header);
   }
 }
+}  // namespace
+
+void AddHeaders(const AidlTypeSpecifier& raw_type, const AidlTypenames& typenames,
+                std::set<std::string>& headers) {
+  AddTypeHeaders(raw_type, typenames, false /* nullable_optional */, headers);
+}
+
+void AddHeaders(const AidlTypeSpecifier& raw_type, const AidlTypenames& typenames,
+                const Options& options, std::set<std::string>& headers) {
+  AddTypeHeaders(raw_type, typenames, options.NullableOptional(), headers);
+}
 
 void AddHeaders(const AidlDefinedType& definedType, std::set<std::string>& headers) {
   vector<string> name = definedType.GetSplitPackage();
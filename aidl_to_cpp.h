@@ -39,6 +39,11 @@ std::string GetTransactionIdFor(const AidlMethod& method);
 
 std::string CppNameOf(const AidlTypeSpecifier& type, const AidlTypenames& typenames);
 
+// Same as above, except that @nullable values are held in std::optional
+// instead of std::unique_ptr under --nullable-optional.
+std::string CppNameOf(const AidlTypeSpecifier& type, const AidlTypenames& typenames,
+                      const Options& options);
+
 bool IsNonCopyableType(const AidlTypeSpecifier& type, const AidlTypenames& typenames);
 
 // Returns the name of the Parcel method suitable for reading data of the
@@ -59,9 +64,27 @@ std::string ParcelWriteMethodOf(const AidlTypeSpecifier& type, const AidlTypenam
 std::string ParcelWriteCastOf(const AidlTypeSpecifier& type, const AidlTypenames& typenames,
                               const std::string& variable_name);
 
+// About how many bytes writing a value adds to a Parcel: |fixed_size| plus
+// what |dynamic_size|, a C++ expression, evaluates to. |dynamic_size| is empty
+// when the size is known statically.
+struct ParcelSizeEstimate {
+  size_t fixed_size = 0;
+  std::string dynamic_size;
+};
+
+// Estimates the size of |variable_name| of the given type in a Parcel. Types
+// without a cheap estimate, such as parcelables and binders, are counted as
+// zero bytes; the estimate is only a hint for the capacity of the Parcel.
+ParcelSizeEstimate ParcelSizeEstimateOf(const AidlTypeSpecifier& type,
+                                        const AidlTypenames& typenames,
+                                        const std::string& variable_name);
+
 void AddHeaders(const AidlTypeSpecifier& type, const AidlTypenames& typenames,
                 std::set<std::string>& headers);
 
+void AddHeaders(const AidlTypeSpecifier& type, const AidlTypenames& typenames,
+                const Options& options, std::set<std::string>& headers);
+
 void AddHeaders(const AidlDefinedType& parcelable, std::set<std::string>& headers);
 }  // namespace cpp
 }  // namespace aidl
@@ -16,6 +16,9 @@
 #include "aidl_to_cpp_common.h"
 
 #include <android-base/strings.h>
+#include <algorithm>
+#include <array>
+#include <map>
 #include <unordered_map>
 
 #include "ast_cpp.h"
@@ -164,19 +167,19 @@ const static std::unordered_map<std::string, TypeInfo> kTypeInfoMap = {
     // missing List, Map, ParcelFileDescriptor, IBinder
 };
 
-TypeInfo GetTypeInfo(const AidlTypeSpecifier& aidl) {
+const TypeInfo& GetTypeInfo(const AidlTypeSpecifier& aidl) {
   CHECK(aidl.IsResolved()) << aidl.ToString();
-  const string& aidl_name = aidl.GetName();
-
-  TypeInfo info;
-  if (AidlTypenames::IsBuiltinTypename(aidl_name)) {
-    auto it = kTypeInfoMap.find(aidl_name);
-    if (it != kTypeInfoMap.end()) {
-      info = it->second;
+  // kTypeInfoMap indexed by kind, with an empty TypeInfo for the types missing
+  // from it.
+  static const std::array<TypeInfo, kAidlBuiltinKindCount> infos = [] {
+    std::array<TypeInfo, kAidlBuiltinKindCount> infos;
+    for (const auto& [name, info] : kTypeInfoMap) {
+      infos[static_cast<size_t>(AidlTypenames::BuiltinKindOf(name))] = info;
     }
-  }
+    return infos;
+  }();
   // Missing interface and parcelable type
-  return info;
+  return infos[static_cast<size_t>(aidl.GetBuiltinKind())];
 }
 
 inline bool CanWriteLog(const TypeInfo& t) {
@@ -189,7 +192,7 @@ bool CanWriteLog(const AidlTypeSpecifier& aidl) {
 
 void WriteLogFor(CodeWriter& writer, const AidlTypeSpecifier& type, const std::string& name,
                  bool isPointer, const std::string& log, bool isNdk) {
-  const TypeInfo info = GetTypeInfo(type);
+  const TypeInfo& info = GetTypeInfo(type);
   if (!CanWriteLog(info)) {
     return;
   }
@@ -228,13 +231,15 @@ void WriteLogForArguments(CodeWriterPtr& writer, const AidlArgument& a, bool isS
   (*writer).Dedent();
 }
 
-const string GenLogBeforeExecute(const string className, const AidlMethod& method, bool isServer,
-                                 bool isNdk) {
+const string GenLogBeforeExecute(const string className, const AidlInterface& interface,
+                                 const AidlMethod& method, bool isServer, bool isNdk) {
   string code;
   CodeWriterPtr writer = CodeWriter::ForString(&code);
   (*writer) << "Json::Value _log_input_args(Json::arrayValue);\n";
+  (*writer) << "const bool _log_sampled = " << className
+            << "::logFunc != nullptr && " << GenLogSampled(interface, method) << ";\n";
 
-  (*writer) << "if (" << className << "::logFunc != nullptr) {\n";
+  (*writer) << "if (_log_sampled) {\n";
   (*writer).Indent();
 
   for (const auto& a : method.GetArguments()) {
@@ -246,7 +251,8 @@ const string GenLogBeforeExecute(const string className, const AidlMethod& metho
   (*writer).Dedent();
   (*writer) << "}\n";
 
-  (*writer) << "auto _log_start = std::chrono::steady_clock::now();\n";
+  (*writer) << "auto _log_start = _log_sampled ? std::chrono::steady_clock::now()\n"
+            << "                             : std::chrono::steady_clock::time_point();\n";
   writer->Close();
   return code;
 }
@@ -257,7 +263,7 @@ const string GenLogAfterExecute(const string className, const AidlInterface& int
   string code;
   CodeWriterPtr writer = CodeWriter::ForString(&code);
 
-  (*writer) << "if (" << className << "::logFunc != nullptr) {\n";
+  (*writer) << "if (_log_sampled && " << className << "::logFunc != nullptr) {\n";
   (*writer).Indent();
 
   // Write the log as a Json object. For example,
@@ -356,6 +362,271 @@ const string GenLogAfterExecute(const string className, const AidlInterface& int
   return code;
 }
 
+const char kTransactionLogDeclaration[] =
+    R"(#ifndef AIDL_TRANSACTION_LOG_DECLARED_
+#define AIDL_TRANSACTION_LOG_DECLARED_
+
+namespace android {
+
+namespace aidl {
+
+// A call recorded by --log=binary. The layout is fixed, so that records can
+// be copied out of the process and decoded later by decodeTransactionRecord()
+// of the interface with the matching interfaceId.
+struct TransactionRecord {
+  uint32_t interfaceId;
+  uint32_t methodId;
+  uint8_t isServer;
+  // The number of bytes of argBytes in use.
+  uint8_t argBytesSize;
+  uint16_t reserved;
+  int32_t exceptionCode;
+  int32_t transactionError;
+  // The sizes of the data and reply parcels. Stubs record the reply size as 0,
+  // since they record the call before they write the reply.
+  uint32_t dataSize;
+  uint32_t replySize;
+  // CLOCK_MONOTONIC nanoseconds.
+  int64_t startNs;
+  int64_t durationNs;
+  // The start of the data parcel, if TransactionLog::captureArgs is set and
+  // the backend can read the parcel.
+  uint8_t argBytes[64];
+};
+
+// A lock-free ring of the latest kCapacity records of the process. Writers
+// only claim a slot with one atomic increment, and mark it with a sequence
+// number while they write it, so that readers can skip torn records.
+class TransactionLog {
+public:
+  static constexpr size_t kCapacity = 4096;
+
+  static TransactionLog& get() {
+    static TransactionLog log;
+    return log;
+  }
+
+  static int64_t nowNs() {
+    return ::std::chrono::duration_cast<::std::chrono::nanoseconds>(
+               ::std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Whether records copy the start of the data parcel into argBytes.
+  ::std::atomic<bool> captureArgs{false};
+
+  void record(uint32_t interfaceId, uint32_t methodId, bool isServer, int32_t exceptionCode,
+              int32_t transactionError, size_t dataSize, size_t replySize, int64_t startNs,
+              const uint8_t* args) {
+    const size_t slot = next_.fetch_add(1, ::std::memory_order_relaxed) % kCapacity;
+    const uint32_t sequence = sequences_[slot].load(::std::memory_order_relaxed) | 1;
+    sequences_[slot].store(sequence, ::std::memory_order_relaxed);
+    ::std::atomic_thread_fence(::std::memory_order_release);
+    TransactionRecord& r = records_[slot];
+    r.interfaceId = interfaceId;
+    r.methodId = methodId;
+    r.isServer = isServer ? 1 : 0;
+    r.argBytesSize = 0;
+    if (args != nullptr && captureArgs.load(::std::memory_order_relaxed)) {
+      r.argBytesSize = static_cast<uint8_t>(::std::min(dataSize, sizeof(r.argBytes)));
+      ::std::memcpy(r.argBytes, args, r.argBytesSize);
+    }
+    r.exceptionCode = exceptionCode;
+    r.transactionError = transactionError;
+    r.dataSize = static_cast<uint32_t>(dataSize);
+    r.replySize = static_cast<uint32_t>(replySize);
+    r.startNs = startNs;
+    r.durationNs = nowNs() - startNs;
+    sequences_[slot].store(sequence + 1, ::std::memory_order_release);
+  }
+
+  // Returns the complete records, oldest first.
+  ::std::vector<TransactionRecord> snapshot() const {
+    ::std::vector<TransactionRecord> records;
+    for (size_t slot = 0; slot < kCapacity; slot++) {
+      const uint32_t before = sequences_[slot].load(::std::memory_order_acquire);
+      if (before == 0 || (before & 1) != 0) continue;
+      TransactionRecord r = records_[slot];
+      ::std::atomic_thread_fence(::std::memory_order_acquire);
+      if (sequences_[slot].load(::std::memory_order_relaxed) == before) {
+        records.push_back(r);
+      }
+    }
+    ::std::sort(records.begin(), records.end(),
+                [](const TransactionRecord& a, const TransactionRecord& b) {
+                  return a.startNs < b.startNs;
+                });
+    return records;
+  }
+
+  // The JSON of the --log callback for |record|, without the arguments,
+  // which the record only has as raw bytes.
+  static ::std::string toJson(const TransactionRecord& record, const char* interfaceName,
+                              const char* methodName) {
+    ::std::ostringstream json;
+    json << "{\"duration_ms\": " << record.durationNs / 1e6 << ", \"interface_name\": \""
+         << interfaceName << "\", \"method_name\": \"" << methodName << "\", \"side\": \""
+         << (record.isServer ? "stub" : "proxy") << "\", \"start_ns\": " << record.startNs
+         << ", \"data_size\": " << record.dataSize << ", \"reply_size\": " << record.replySize
+         << ", \"binder_status\": {\"exception_code\": " << record.exceptionCode
+         << ", \"transaction_error\": " << record.transactionError << "}, \"arg_bytes\": \"";
+    static const char kHex[] = "0123456789abcdef";
+    for (size_t i = 0; i < record.argBytesSize; i++) {
+      json << kHex[record.argBytes[i] >> 4] << kHex[record.argBytes[i] & 0xf];
+    }
+    json << "\"}";
+    return json.str();
+  }
+
+private:
+  ::std::atomic<size_t> next_{0};
+  // Odd while the record of the slot is being written.
+  ::std::atomic<uint32_t> sequences_[kCapacity] = {};
+  TransactionRecord records_[kCapacity] = {};
+};
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // AIDL_TRANSACTION_LOG_DECLARED_
+)";
+
+// FNV-1a of the name, so that the id is stable across builds.
+uint32_t TransactionLogInterfaceId(const AidlInterface& interface) {
+  uint32_t id = 2166136261u;
+  for (char c : interface.GetCanonicalName()) {
+    id = (id ^ static_cast<uint8_t>(c)) * 16777619u;
+  }
+  return id;
+}
+
+std::string GenLogSamplingDeclarations(const AidlInterface& interface) {
+  std::ostringstream code;
+  code << "// A method is logged once every logSamplePeriods[i] calls, where i is\n"
+       << "// its index in the interface, and never if that is 0. All calls are logged\n"
+       << "// by default.\n"
+       << "static std::atomic<uint32_t> logSamplePeriods[" << interface.GetMethods().size()
+       << "];\n"
+       << "static bool shouldLog(size_t index) {\n"
+       << "  const uint32_t period = logSamplePeriods[index].load(std::memory_order_relaxed);\n"
+       << "  if (period <= 1) return period == 1;\n"
+       << "  static thread_local uint32_t calls = 0;\n"
+       << "  return ++calls % period == 0;\n"
+       << "}\n"
+       << "// Sets the period of all methods.\n"
+       << "static void setLogSamplePeriod(uint32_t period);\n"
+       << "// Sets the period of |method|. Returns false if there is no such method.\n"
+       << "static bool setLogSamplePeriod(const std::string& method, uint32_t period);\n";
+  return code.str();
+}
+
+std::string GenLogSamplingDefinitions(const AidlInterface& interface) {
+  const std::string clazz = ClassName(interface, ClassNames::INTERFACE);
+  const size_t num_methods = interface.GetMethods().size();
+  std::vector<std::string> names;
+  std::vector<std::string> periods;
+  for (const auto& method : interface.GetMethods()) {
+    names.push_back("\"" + method->GetName() + "\"");
+    periods.push_back("1");
+  }
+  std::ostringstream code;
+  code << "std::atomic<uint32_t> " << clazz << "::logSamplePeriods[" << num_methods << "] = {"
+       << Join(periods, ", ") << "};\n"
+       << "void " << clazz << "::setLogSamplePeriod(uint32_t period) {\n"
+       << "  for (auto& p : logSamplePeriods) p.store(period, std::memory_order_relaxed);\n"
+       << "}\n"
+       << "bool " << clazz << "::setLogSamplePeriod(const std::string& method, uint32_t period) {\n"
+       << "  static const char* const kMethodNames[] = {" << Join(names, ", ") << "};\n"
+       << "  for (size_t i = 0; i < " << num_methods << "; i++) {\n"
+       << "    if (method == kMethodNames[i]) {\n"
+       << "      logSamplePeriods[i].store(period, std::memory_order_relaxed);\n"
+       << "      return true;\n"
+       << "    }\n"
+       << "  }\n"
+       << "  return false;\n"
+       << "}\n";
+  return code.str();
+}
+
+std::string GenLogSampled(const AidlInterface& interface, const AidlMethod& method) {
+  size_t index = 0;
+  while (interface.GetMethods()[index].get() != &method) {
+    index++;
+  }
+  return ClassName(interface, ClassNames::INTERFACE) + "::shouldLog(" + std::to_string(index) +
+         ")";
+}
+
+std::string GenBinaryLogBeforeExecute(const AidlInterface& interface, const AidlMethod& method,
+                                      bool isServer, bool isNdk) {
+  std::string code = "const bool _aidl_log_sampled = " + GenLogSampled(interface, method) +
+                     ";\n"
+                     "const int64_t _aidl_log_start =\n"
+                     "    _aidl_log_sampled ? ::android::aidl::TransactionLog::nowNs() : 0;\n";
+  // The NDK proxy gives its data parcel away to the transaction, so it notes
+  // the size of the parcel before.
+  if (isNdk && !isServer) {
+    code += "int32_t _aidl_log_data_size = 0;\n";
+  }
+  return code;
+}
+
+std::string GenBinaryLogAfterExecute(const AidlInterface& interface, const AidlMethod& method,
+                                     bool isServer, bool isNdk) {
+  std::string status;
+  std::string data_size;
+  std::string reply_size = "0";
+  std::string args = "nullptr";
+  if (isNdk) {
+    status = "AStatus_getExceptionCode(_aidl_status.get()), AStatus_getStatus(_aidl_status.get())";
+    if (isServer) {
+      data_size = "AParcel_getDataPosition(_aidl_in)";
+    } else {
+      data_size = "_aidl_log_data_size";
+      reply_size = "(_aidl_out.get() != nullptr ? AParcel_getDataPosition(_aidl_out.get()) : 0)";
+    }
+  } else {
+    status = "_aidl_status.exceptionCode(), _aidl_status.transactionError()";
+    data_size = "_aidl_data.dataSize()";
+    args = "_aidl_data.data()";
+    if (!isServer) {
+      reply_size = "_aidl_reply.dataSize()";
+    }
+  }
+  std::ostringstream code;
+  code << "if (_aidl_log_sampled) {\n"
+       << "  ::android::aidl::TransactionLog::get().record(" << std::hex << "0x"
+       << TransactionLogInterfaceId(interface) << std::dec << "u, " << method.GetId() << ", "
+       << (isServer ? "true" : "false") << ", " << status << ", " << data_size << ", "
+       << reply_size << ", _aidl_log_start, " << args << ");\n"
+       << "}\n";
+  return code.str();
+}
+
+std::string GenTransactionRecordDecoder(const AidlInterface& interface, const string& clazz) {
+  std::ostringstream code;
+  code << "std::string " << clazz
+       << "::decodeTransactionRecord(const ::android::aidl::TransactionRecord& record) {\n"
+       << "  const char* method_name = nullptr;\n"
+       << "  switch (record.methodId) {\n";
+  for (const auto& method : interface.GetMethods()) {
+    if (method->IsUserDefined()) {
+      code << "    case " << method->GetId() << ": method_name = \"" << method->GetName()
+           << "\"; break;\n";
+    }
+  }
+  code << "  }\n"
+       << "  if (record.interfaceId != " << std::hex << "0x" << TransactionLogInterfaceId(interface)
+       << std::dec << "u || method_name == nullptr) {\n"
+       << "    return \"\";\n"
+       << "  }\n"
+       << "  return ::android::aidl::TransactionLog::toJson(record, \""
+       << interface.GetCanonicalName() << "\", method_name);\n"
+       << "}\n";
+  return code.str();
+}
+
 std::string GenerateEnumValues(const AidlEnumDeclaration& enum_decl,
                                const std::vector<std::string>& enclosing_namespaces_of_enum_decl) {
   const auto fq_name =
@@ -376,6 +647,1140 @@ std::string GenerateEnumValues(const AidlEnumDeclaration& enum_decl,
   return code.str();
 }
 
+std::string GenerateEnumToString(const AidlEnumDeclaration& enum_decl,
+                                 const std::string& backing_type) {
+  const std::string& name = enum_decl.GetName();
+  // Values are keyed by their evaluated, undecorated value. When enumerators
+  // share a value, the first declared one names it.
+  auto raw = [](const AidlTypeSpecifier&, const std::string& value) { return value; };
+  std::map<int64_t, std::string> names;
+  for (const auto& enumerator : enum_decl.GetEnumerators()) {
+    const int64_t value = std::stoll(enumerator->ValueString(enum_decl.GetBackingType(), raw));
+    names.emplace(value, enumerator->GetName());
+  }
+  const size_t count = names.size();
+  const uint64_t span =
+      static_cast<uint64_t>(names.rbegin()->first) - static_cast<uint64_t>(names.begin()->first);
+  const bool dense = span < 2 * count + 16;
+
+  std::ostringstream code;
+  // Known values map to string literals, so naming them never allocates. Unknown values
+  // yield an empty view, which no enumerator name can be.
+  code << "static constexpr inline std::string_view toStringView(" << name << " val) {\n";
+  if (dense) {
+    const size_t size = span + 1;
+    const uint64_t first = static_cast<uint64_t>(names.begin()->first);
+    std::vector<std::string> table(size);
+    for (const auto& [value, enumerator] : names) {
+      table[static_cast<uint64_t>(value) - first] = enumerator;
+    }
+    code << "  constexpr std::string_view kNames[" << size << "] = {\n";
+    for (const auto& entry : table) {
+      code << "    \"" << entry << "\",\n";
+    }
+    code << "  };\n";
+    code << "  const uint64_t index = static_cast<uint64_t>(static_cast<" << backing_type
+         << ">(val)) - static_cast<uint64_t>(static_cast<" << backing_type << ">(" << name
+         << "::" << names.begin()->second << "));\n";
+    code << "  if (index >= " << size << ") {\n";
+    code << "    return std::string_view();\n";
+    code << "  }\n";
+    code << "  return kNames[index];\n";
+  } else {
+    code << "  constexpr " << name << " kValues[" << count << "] = {\n";
+    for (const auto& [value, enumerator] : names) {
+      code << "    " << name << "::" << enumerator << ",\n";
+    }
+    code << "  };\n";
+    code << "  constexpr std::string_view kNames[" << count << "] = {\n";
+    for (const auto& [value, enumerator] : names) {
+      code << "    \"" << enumerator << "\",\n";
+    }
+    code << "  };\n";
+    code << "  size_t lo = 0;\n";
+    code << "  size_t hi = " << count << ";\n";
+    code << "  while (lo < hi) {\n";
+    code << "    const size_t mid = lo + (hi - lo) / 2;\n";
+    code << "    if (static_cast<" << backing_type << ">(kValues[mid]) < static_cast<"
+         << backing_type << ">(val)) {\n";
+    code << "      lo = mid + 1;\n";
+    code << "    } else {\n";
+    code << "      hi = mid;\n";
+    code << "    }\n";
+    code << "  }\n";
+    code << "  if (lo < " << count << " && kValues[lo] == val) {\n";
+    code << "    return kNames[lo];\n";
+    code << "  }\n";
+    code << "  return std::string_view();\n";
+  }
+  code << "}\n";
+  code << "static inline void toString(" << name << " val, std::string* out) {\n";
+  code << "  std::string_view name = toStringView(val);\n";
+  code << "  if (!name.empty()) {\n";
+  code << "    out->append(name);\n";
+  code << "  } else {\n";
+  code << "    out->append(std::to_string(static_cast<" << backing_type << ">(val)));\n";
+  code << "  }\n";
+  code << "}\n";
+  code << "static inline std::string toString(" << name << " val) {\n";
+  code << "  std::string_view name = toStringView(val);\n";
+  code << "  if (!name.empty()) {\n";
+  code << "    return std::string(name);\n";
+  code << "  }\n";
+  code << "  return std::to_string(static_cast<" << backing_type << ">(val));\n";
+  code << "}\n";
+  return code.str();
+}
+
+size_t ParcelPrimitiveSize(const AidlTypeSpecifier& type) {
+  if (type.IsArray() || type.IsGeneric()) {
+    return 0;
+  }
+  return ParcelPrimitiveSize(type.GetName());
+}
+
+size_t ParcelPrimitiveSize(const std::string& type_name) {
+  static const std::unordered_map<std::string, size_t> kSizes = {
+      {"boolean", 4}, {"byte", 4}, {"char", 4},   {"int", 4},
+      {"float", 4},   {"long", 8}, {"double", 8},
+  };
+  auto it = kSizes.find(type_name);
+  return it != kSizes.end() ? it->second : 0;
+}
+
+std::vector<ParcelFieldRun> SplitParcelFields(const AidlStructuredParcelable& parcel, bool batch) {
+  std::vector<ParcelFieldRun> runs;
+  ParcelFieldRun primitives;
+  auto flush_primitives = [&]() {
+    if (primitives.fields.size() == 1) {
+      primitives.size = 0;
+    }
+    if (!primitives.fields.empty()) {
+      runs.push_back(std::move(primitives));
+    }
+    primitives = ParcelFieldRun();
+  };
+  for (const auto& variable : parcel.GetFields()) {
+    const size_t size = batch ? ParcelPrimitiveSize(variable->GetType()) : 0;
+    if (size > 0) {
+      primitives.fields.push_back(variable.get());
+      primitives.size += size;
+      continue;
+    }
+    flush_primitives();
+    runs.push_back(ParcelFieldRun{{variable.get()}, 0});
+  }
+  flush_primitives();
+  return runs;
+}
+
+ParcelFieldRun FixedParcelLayoutOf(const AidlStructuredParcelable& parcel) {
+  ParcelFieldRun layout;
+  for (const auto& variable : parcel.GetFields()) {
+    const size_t size = ParcelPrimitiveSize(variable->GetType());
+    if (size == 0) {
+      return ParcelFieldRun();
+    }
+    layout.fields.push_back(variable.get());
+    layout.size += size;
+  }
+  return layout;
+}
+
+// The alignment of a field of |type| in the C++ and NDK classes. Strings,
+// vectors, pointers and parcelables are counted as 8-byte aligned, as they
+// are on 64-bit targets.
+static size_t FieldAlignmentOf(const AidlTypeSpecifier& type, const AidlTypenames& typenames) {
+  static const std::unordered_map<std::string, size_t> kAlignments = {
+      {"boolean", 1}, {"byte", 1},   {"char", 2}, {"int", 4},
+      {"float", 4},   {"long", 8},   {"double", 8}, {"FileDescriptor", 4},
+  };
+  if ((type.IsArray() && !type.IsFixedSize()) || type.IsGeneric() || type.IsNullable()) {
+    return 8;
+  }
+  std::string name = type.GetName();
+  if (auto enum_decl = typenames.GetEnumDeclaration(type); enum_decl != nullptr) {
+    name = enum_decl->GetBackingType().GetName();
+  }
+  auto it = kAlignments.find(name);
+  return it != kAlignments.end() ? it->second : 8;
+}
+
+std::vector<const AidlVariableDeclaration*> FieldsInDeclarationOrder(
+    const AidlStructuredParcelable& parcel, const AidlTypenames& typenames,
+    const Options& options) {
+  std::vector<const AidlVariableDeclaration*> fields;
+  for (const auto& variable : parcel.GetFields()) {
+    fields.push_back(variable.get());
+  }
+  if (options.CompactParcelLayout()) {
+    std::stable_sort(fields.begin(), fields.end(), [&typenames](const auto* a, const auto* b) {
+      return FieldAlignmentOf(a->GetType(), typenames) > FieldAlignmentOf(b->GetType(), typenames);
+    });
+  }
+  return fields;
+}
+
+bool HasSharedMemoryArguments(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    for (const auto& arg : method->GetArguments()) {
+      if (arg->GetType().IsSharedMemory()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool HasViewArguments(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    for (const auto& arg : method->GetArguments()) {
+      if (arg->GetType().IsView()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool HasRawParcelables(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (method->GetType().IsRaw()) {
+      return true;
+    }
+    for (const auto& arg : method->GetArguments()) {
+      if (arg->GetType().IsRaw()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool HasBatchableMethods(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (method->GetType().IsBatchable()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool HasChunkedMethods(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (method->GetType().IsChunked()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// As for --java-dispatch-table, the table is used only when the ids are dense
+// enough not to waste much of it.
+size_t NativeDispatchTableSize(const AidlInterface& iface, const Options& options) {
+  if (!options.NativeDispatchTable()) {
+    return 0;
+  }
+  size_t num_methods = 0;
+  int max_id = -1;
+  for (const auto& method : iface.GetMethods()) {
+    if (method->IsUserDefined()) {
+      num_methods++;
+      max_id = std::max(max_id, method->GetId());
+    }
+  }
+  if (num_methods == 0 || static_cast<size_t>(max_id) >= 2 * num_methods + 16) {
+    return 0;
+  }
+  return max_id + 1;
+}
+
+std::vector<const AidlMethod*> MethodsByCallCount(const AidlInterface& iface,
+                                                  const Options& options) {
+  std::vector<const AidlMethod*> methods;
+  for (const auto& method : iface.GetMethods()) {
+    methods.push_back(method.get());
+  }
+  if (options.HasTransactionProfile()) {
+    const std::string name = iface.GetCanonicalName();
+    std::stable_sort(methods.begin(), methods.end(), [&](const AidlMethod* a, const AidlMethod* b) {
+      return options.TransactionCount(name, a->GetName()) >
+             options.TransactionCount(name, b->GetName());
+    });
+  }
+  return methods;
+}
+
+std::string HandlerPlacement(const AidlInterface& iface, const AidlMethod& method,
+                             const Options& options) {
+  if (!options.HasTransactionProfile()) {
+    return "";
+  }
+  return options.TransactionCount(iface.GetCanonicalName(), method.GetName()) > 0
+             ? "__attribute__((hot)) "
+             : "__attribute__((cold)) ";
+}
+
+std::string GenStatsDeclarations(const AidlInterface& iface) {
+  std::ostringstream code;
+  code << "// Latency statistics of one method. Bucket i of the histogram counts\n"
+       << "// the calls that took less than 2^i and at least 2^(i-1) microseconds.\n"
+       << "struct CallStats {\n"
+       << "  static constexpr size_t kBuckets = 32;\n"
+       << "  std::atomic<uint64_t> count;\n"
+       << "  std::atomic<uint64_t> total_us;\n"
+       << "  std::atomic<uint64_t> histogram[kBuckets];\n"
+       << "  void record(std::chrono::steady_clock::time_point start);\n"
+       << "  // The upper bound in microseconds of the latency of |permille| of the calls.\n"
+       << "  uint64_t percentileUs(uint64_t permille) const;\n"
+       << "  void dump(int fd, const char* method, const char* side) const;\n"
+       << "};\n"
+       << "class ScopedCallStats {\n"
+       << " public:\n"
+       << "  explicit ScopedCallStats(CallStats* stats)\n"
+       << "      : stats_(stats), start_(std::chrono::steady_clock::now()) {}\n"
+       << "  ~ScopedCallStats() { stats_->record(start_); }\n"
+       << "\n"
+       << " private:\n"
+       << "  CallStats* const stats_;\n"
+       << "  const std::chrono::steady_clock::time_point start_;\n"
+       << "};\n"
+       << "static CallStats clientStats[" << iface.GetMethods().size() << "];\n"
+       << "static CallStats serverStats[" << iface.GetMethods().size() << "];\n"
+       << "// Writes the call count, mean and percentiles of each method called\n"
+       << "// through a proxy or a stub of this interface to |fd|.\n"
+       << "static void dumpStats(int fd);\n";
+  return code.str();
+}
+
+std::string GenStatsDefinitions(const AidlInterface& iface) {
+  const std::string clazz = ClassName(iface, ClassNames::INTERFACE);
+  const size_t num_methods = iface.GetMethods().size();
+  std::vector<std::string> names;
+  for (const auto& method : iface.GetMethods()) {
+    names.push_back("\"" + method->GetName() + "\"");
+  }
+  std::ostringstream code;
+  code << clazz << "::CallStats " << clazz << "::clientStats[" << num_methods << "];\n"
+       << clazz << "::CallStats " << clazz << "::serverStats[" << num_methods << "];\n"
+       << "void " << clazz
+       << "::CallStats::record(std::chrono::steady_clock::time_point start) {\n"
+       << "  const int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(\n"
+       << "      std::chrono::steady_clock::now() - start).count();\n"
+       << "  const uint64_t us = elapsed > 0 ? elapsed : 0;\n"
+       << "  const size_t bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);\n"
+       << "  count.fetch_add(1, std::memory_order_relaxed);\n"
+       << "  total_us.fetch_add(us, std::memory_order_relaxed);\n"
+       << "  histogram[std::min(bucket, kBuckets - 1)].fetch_add(1, std::memory_order_relaxed);\n"
+       << "}\n"
+       << "uint64_t " << clazz << "::CallStats::percentileUs(uint64_t permille) const {\n"
+       << "  const uint64_t n = count.load(std::memory_order_relaxed);\n"
+       << "  uint64_t seen = 0;\n"
+       << "  for (size_t i = 0; i < kBuckets; i++) {\n"
+       << "    seen += histogram[i].load(std::memory_order_relaxed);\n"
+       << "    if (seen * 1000 >= n * permille) return uint64_t{1} << i;\n"
+       << "  }\n"
+       << "  return uint64_t{1} << (kBuckets - 1);\n"
+       << "}\n"
+       << "void " << clazz
+       << "::CallStats::dump(int fd, const char* method, const char* side) const {\n"
+       << "  const uint64_t n = count.load(std::memory_order_relaxed);\n"
+       << "  if (n == 0) return;\n"
+       << "  dprintf(fd, \"%s %s: count=%\" PRIu64 \" mean=%\" PRIu64 \"us p50<%\" PRIu64\n"
+       << "          \"us p90<%\" PRIu64 \"us p99<%\" PRIu64 \"us\\n\", method, side, n,\n"
+       << "          total_us.load(std::memory_order_relaxed) / n, percentileUs(500),\n"
+       << "          percentileUs(900), percentileUs(990));\n"
+       << "}\n"
+       << "void " << clazz << "::dumpStats(int fd) {\n"
+       << "  static const char* const kMethodNames[] = {" << Join(names, ", ") << "};\n"
+       << "  for (size_t i = 0; i < " << num_methods << "; i++) {\n"
+       << "    clientStats[i].dump(fd, kMethodNames[i], \"client\");\n"
+       << "    serverStats[i].dump(fd, kMethodNames[i], \"server\");\n"
+       << "  }\n"
+       << "}\n";
+  return code.str();
+}
+
+std::string GenTransactionNamesDeclarations(const AidlInterface& iface,
+                                            const std::string& first_call_transaction) {
+  std::vector<const AidlMethod*> by_code;
+  for (const auto& method : iface.GetMethods()) {
+    by_code.push_back(method.get());
+  }
+  std::vector<const AidlMethod*> by_name = by_code;
+  std::sort(by_code.begin(), by_code.end(),
+            [](const AidlMethod* a, const AidlMethod* b) { return a->GetId() < b->GetId(); });
+  std::sort(by_name.begin(), by_name.end(), [](const AidlMethod* a, const AidlMethod* b) {
+    return a->GetName() < b->GetName();
+  });
+  auto entries = [&](const std::vector<const AidlMethod*>& methods) {
+    std::vector<std::string> rows;
+    for (const AidlMethod* method : methods) {
+      rows.push_back("    {" + first_call_transaction + " + " + std::to_string(method->GetId()) +
+                     ", \"" + method->GetName() + "\"},\n");
+    }
+    return Join(rows, "");
+  };
+  const size_t num_methods = by_code.size();
+  std::ostringstream code;
+  if (num_methods == 0) {
+    // Arrays can't be empty, so an interface without methods has no tables
+    code << "static constexpr size_t kNumTransactionNames = 0;\n"
+         << "static constexpr const char* getTransactionName(uint32_t) { return nullptr; }\n"
+         << "static constexpr uint32_t getTransactionCode(std::string_view) { return 0; }\n";
+    return code.str();
+  }
+  code << "struct TransactionName {\n"
+       << "  uint32_t code;\n"
+       << "  const char* name;\n"
+       << "};\n"
+       << "static constexpr size_t kNumTransactionNames = " << num_methods << ";\n"
+       << "static constexpr TransactionName kTransactionNamesByCode[] = {\n"
+       << entries(by_code) << "};\n"
+       << "static constexpr TransactionName kTransactionNamesByName[] = {\n"
+       << entries(by_name) << "};\n"
+       << "// The name of the method called by transaction |code|, or nullptr if\n"
+       << "// |code| is not a transaction of this interface.\n"
+       << "static constexpr const char* getTransactionName(uint32_t code) {\n"
+       << "  size_t lo = 0, hi = kNumTransactionNames;\n"
+       << "  while (lo < hi) {\n"
+       << "    const size_t mid = lo + (hi - lo) / 2;\n"
+       << "    if (kTransactionNamesByCode[mid].code < code) {\n"
+       << "      lo = mid + 1;\n"
+       << "    } else {\n"
+       << "      hi = mid;\n"
+       << "    }\n"
+       << "  }\n"
+       << "  return lo < kNumTransactionNames && kTransactionNamesByCode[lo].code == code\n"
+       << "      ? kTransactionNamesByCode[lo].name : nullptr;\n"
+       << "}\n"
+       << "// The transaction code of method |name|, or 0 if there is no such method.\n"
+       << "static constexpr uint32_t getTransactionCode(std::string_view name) {\n"
+       << "  size_t lo = 0, hi = kNumTransactionNames;\n"
+       << "  while (lo < hi) {\n"
+       << "    const size_t mid = lo + (hi - lo) / 2;\n"
+       << "    if (std::string_view(kTransactionNamesByName[mid].name) < name) {\n"
+       << "      lo = mid + 1;\n"
+       << "    } else {\n"
+       << "      hi = mid;\n"
+       << "    }\n"
+       << "  }\n"
+       << "  return lo < kNumTransactionNames &&\n"
+       << "      std::string_view(kTransactionNamesByName[lo].name) == name\n"
+       << "      ? kTransactionNamesByName[lo].code : 0;\n"
+       << "}\n";
+  return code.str();
+}
+
+std::string GenStatsScope(const AidlInterface& iface, const AidlMethod& method, bool isServer) {
+  const std::string clazz = ClassName(iface, ClassNames::INTERFACE);
+  size_t index = 0;
+  while (iface.GetMethods()[index].get() != &method) {
+    index++;
+  }
+  std::ostringstream code;
+  code << clazz << "::ScopedCallStats _aidl_stats(&" << clazz << "::"
+       << (isServer ? "serverStats" : "clientStats") << "[" << index << "]);\n";
+  return code.str();
+}
+
+const char kAsyncExecutorDeclaration[] =
+    R"(#ifndef AIDL_ASYNC_EXECUTOR_DECLARED_
+#define AIDL_ASYNC_EXECUTOR_DECLARED_
+
+namespace android {
+
+namespace aidl {
+
+// Runs a call made by an Async() method of an interface.
+using AsyncExecutor = ::std::function<void(::std::function<void()>)>;
+
+// The threads that the calls of Async() methods run on, unless the process
+// called setAsyncExecutor(). They are started by the first call, and there
+// are never more than kThreads calls in flight.
+class AsyncWorkerPool {
+public:
+  static constexpr size_t kThreads = 4;
+
+  static AsyncWorkerPool& get() {
+    // Never destroyed, as the threads outlive static destructors.
+    static AsyncWorkerPool* pool = new AsyncWorkerPool();
+    return *pool;
+  }
+
+  void run(::std::function<void()> task) {
+    {
+      ::std::lock_guard<::std::mutex> lock(mutex_);
+      tasks_.push_back(::std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+private:
+  AsyncWorkerPool() {
+    for (size_t i = 0; i < kThreads; i++) {
+      ::std::thread([this] { work(); }).detach();
+    }
+  }
+
+  void work() {
+    for (;;) {
+      ::std::function<void()> task;
+      {
+        ::std::unique_lock<::std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return !tasks_.empty(); });
+        task = ::std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  ::std::mutex mutex_;
+  ::std::condition_variable cv_;
+  ::std::deque<::std::function<void()>> tasks_;
+};
+
+inline AsyncExecutor& asyncExecutor() {
+  static AsyncExecutor executor = [](::std::function<void()> task) {
+    AsyncWorkerPool::get().run(::std::move(task));
+  };
+  return executor;
+}
+
+// Makes the Async() methods run their calls with |executor|, e.g. on the
+// threads of a pool the process already has. Set it before the first call.
+inline void setAsyncExecutor(AsyncExecutor executor) {
+  asyncExecutor() = ::std::move(executor);
+}
+
+// The executors that stubs hand the calls of @DispatchOn methods to, by the
+// name of their pool. Calls to a pool without one run with asyncExecutor().
+// They may run concurrently and in any order.
+class DispatchExecutors {
+public:
+  static void set(const ::std::string& pool, AsyncExecutor executor) {
+    ::std::lock_guard<::std::mutex> lock(mutex());
+    executors()[pool] = ::std::move(executor);
+  }
+
+  static void run(const ::std::string& pool, ::std::function<void()> task) {
+    AsyncExecutor executor;
+    {
+      ::std::lock_guard<::std::mutex> lock(mutex());
+      auto it = executors().find(pool);
+      executor = it != executors().end() ? it->second : asyncExecutor();
+    }
+    executor(::std::move(task));
+  }
+
+private:
+  static ::std::mutex& mutex() {
+    static ::std::mutex* mutex = new ::std::mutex();
+    return *mutex;
+  }
+  static ::std::map<::std::string, AsyncExecutor>& executors() {
+    static auto* executors = new ::std::map<::std::string, AsyncExecutor>();
+    return *executors;
+  }
+};
+
+// Makes the stubs hand the calls of methods with @DispatchOn(pool=|pool|) to
+// |executor|, e.g. an application's work-stealing pool.
+inline void setDispatchExecutor(const ::std::string& pool, AsyncExecutor executor) {
+  DispatchExecutors::set(pool, ::std::move(executor));
+}
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // AIDL_ASYNC_EXECUTOR_DECLARED_
+)";
+
+const char kAwaitableDeclaration[] =
+    R"(#ifndef AIDL_AWAITABLE_DECLARED_
+#define AIDL_AWAITABLE_DECLARED_
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+
+namespace android {
+
+namespace aidl {
+
+// Makes |call| with asyncExecutor() when it is co_awaited, and then resumes
+// the coroutine on the same thread with the status that |call| returned.
+template <typename Status>
+class Awaitable {
+public:
+  explicit Awaitable(::std::function<Status()> call) : call_(::std::move(call)) {}
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(::std::coroutine_handle<> handle) {
+    asyncExecutor()([this, handle] {
+      status_.emplace(call_());
+      handle.resume();
+    });
+  }
+  Status await_resume() { return ::std::move(*status_); }
+
+private:
+  ::std::function<Status()> call_;
+  ::std::optional<Status> status_;
+};
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#endif  // AIDL_AWAITABLE_DECLARED_
+)";
+
+const char kCallContextDeclaration[] =
+    R"(#ifndef AIDL_CALL_CONTEXT_DECLARED_
+#define AIDL_CALL_CONTEXT_DECLARED_
+
+namespace android {
+
+namespace aidl {
+
+// The deadline and priority class that calls of @PropagateCallContext
+// methods carry from the client to the server. Stubs make the context of the
+// call current while the implementation runs, so that the calls it makes
+// carry the context further. A stub doesn't run a call past its deadline.
+struct CallContext {
+  // The CLOCK_MONOTONIC time in nanoseconds by which the call has to start,
+  // or 0 for no deadline.
+  int64_t deadlineNs = 0;
+  int32_t priority = 0;
+
+  static int64_t nowNs() {
+    return ::std::chrono::duration_cast<::std::chrono::nanoseconds>(
+               ::std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  bool hasExpired() const { return deadlineNs != 0 && nowNs() > deadlineNs; }
+
+  // The context of the calls that this thread makes.
+  static CallContext& current() {
+    static thread_local CallContext context;
+    return context;
+  }
+};
+
+// Makes |context| current until the end of the scope.
+class ScopedCallContext {
+public:
+  explicit ScopedCallContext(const CallContext& context) : outer_(CallContext::current()) {
+    CallContext::current() = context;
+  }
+  ~ScopedCallContext() { CallContext::current() = outer_; }
+  ScopedCallContext(const ScopedCallContext&) = delete;
+  ScopedCallContext& operator=(const ScopedCallContext&) = delete;
+
+private:
+  CallContext outer_;
+};
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // AIDL_CALL_CONTEXT_DECLARED_
+)";
+
+bool HasCallContextMethods(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (iface.PropagatesCallContext(*method)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A @View argument points into memory of the caller that the call would
+// outlive, so such methods have no Async() variant.
+bool HasAsyncVariant(const AidlMethod& method) {
+  if (!method.IsUserDefined()) {
+    return false;
+  }
+  for (const auto& arg : method.GetArguments()) {
+    if (arg->GetType().IsView()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The in and inout arguments are moved into a tuple that the call owns, and
+// the out arguments and the return value are locals of the call.
+std::string GenAsyncMethod(const AidlMethod& method, const std::string& status_type,
+                           const std::string& self,
+                           const std::function<std::string(const AidlTypeSpecifier&)>& name_of) {
+  const bool returns_value = method.GetType().GetName() != "void";
+  std::vector<std::string> params;
+  std::vector<std::string> in_types;
+  std::vector<std::string> in_values;
+  std::vector<std::string> results = {"const " + status_type + "&"};
+  std::vector<std::string> locals;
+  std::vector<std::string> call_args;
+  std::vector<std::string> callback_args = {"_aidl_status"};
+  if (returns_value) {
+    results.push_back("const " + name_of(method.GetType()) + "&");
+    callback_args.push_back("_aidl_return");
+  }
+  for (const auto& arg : method.GetArguments()) {
+    const std::string type = name_of(arg->GetType());
+    const std::string& name = arg->GetName();
+    if (arg->IsIn()) {
+      const std::string element =
+          "::std::get<" + std::to_string(in_types.size()) + ">(*_aidl_args)";
+      params.push_back(type + " " + name);
+      in_types.push_back(type);
+      in_values.push_back("::std::move(" + name + ")");
+      call_args.push_back(arg->IsOut() ? "&" + element : "::std::move(" + element + ")");
+      if (arg->IsOut()) {
+        callback_args.push_back(element);
+      }
+    } else {
+      locals.push_back(type + " " + name + ";\n");
+      call_args.push_back("&" + name);
+      callback_args.push_back(name);
+    }
+    if (arg->IsOut()) {
+      results.push_back("const " + type + "&");
+    }
+  }
+  if (returns_value) {
+    locals.push_back(name_of(method.GetType()) + " _aidl_return{};\n");
+    call_args.push_back("&_aidl_return");
+  }
+  params.push_back("::std::function<void(" + Join(results, ", ") + ")> _aidl_callback");
+
+  std::ostringstream code;
+  code << "// Calls " << method.GetName() << "() with asyncExecutor(), and then passes what it\n"
+       << "// returned to |_aidl_callback| on the same thread.\n"
+       << "void " << method.GetName() << "Async(" << Join(params, ", ") << ") {\n";
+  std::string captures = "_aidl_self, _aidl_callback";
+  if (!in_types.empty()) {
+    code << "  auto _aidl_args = ::std::make_shared<::std::tuple<" << Join(in_types, ", ")
+         << ">>(" << Join(in_values, ", ") << ");\n";
+    captures = "_aidl_self, _aidl_args, _aidl_callback";
+  }
+  code << "  auto _aidl_self = " << self << ";\n"
+       << "  ::android::aidl::asyncExecutor()([" << captures << "] {\n";
+  for (const std::string& local : locals) {
+    code << "    " << local;
+  }
+  code << "    " << status_type << " _aidl_status = _aidl_self->" << method.GetName() << "("
+       << Join(call_args, ", ") << ");\n"
+       << "    _aidl_callback(" << Join(callback_args, ", ") << ");\n"
+       << "  });\n"
+       << "}\n";
+  return code.str();
+}
+
+std::string DispatchPoolOf(const AidlInterface& iface, const AidlMethod& method) {
+  if (!method.IsUserDefined() || !method.IsOneway()) {
+    return "";
+  }
+  const std::string pool = method.GetType().DispatchPool();
+  return pool.empty() ? iface.DispatchPool() : pool;
+}
+
+bool HasDispatchedMethods(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (!DispatchPoolOf(iface, *method).empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<const AidlDefinedType*> ForwardDeclaredTypes(const AidlInterface& iface,
+                                                         const AidlTypenames& typenames,
+                                                         const Options& options) {
+  if (!options.ForwardDeclareTypes() || options.GenAsync() || options.GenCoroutines() ||
+      HasDispatchedMethods(iface) ||
+      (options.TargetLanguage() == Options::Language::CPP && options.InArgsByValue())) {
+    return {};
+  }
+  std::map<std::string, const AidlDefinedType*> types;
+  auto add = [&](const AidlTypeSpecifier& type) {
+    const AidlTypeSpecifier& element = type.IsGeneric() ? *type.GetTypeParameters().at(0) : type;
+    const AidlDefinedType* defined_type = typenames.TryGetDefinedType(element.GetName());
+    if (defined_type != nullptr && defined_type != &iface &&
+        (defined_type->AsInterface() != nullptr ||
+         defined_type->AsStructuredParcelable() != nullptr)) {
+      types.emplace(defined_type->GetCanonicalName(), defined_type);
+    }
+  };
+  for (const auto& method : iface.GetMethods()) {
+    add(method->GetType());
+    for (const auto& arg : method->GetArguments()) {
+      add(arg->GetType());
+    }
+  }
+  std::vector<const AidlDefinedType*> result;
+  for (const auto& [name, defined_type] : types) {
+    result.push_back(defined_type);
+  }
+  return result;
+}
+
+// The arguments, which are all in arguments, are moved from the locals that
+// the stub read them into.
+std::string GenDispatchCall(const AidlMethod& method, const std::string& pool,
+                            const std::string& self,
+                            const std::function<std::string(const AidlTypeSpecifier&)>& name_of) {
+  std::vector<std::string> types;
+  std::vector<std::string> values;
+  std::vector<std::string> call_args;
+  for (const auto& arg : method.GetArguments()) {
+    call_args.push_back("::std::move(::std::get<" + std::to_string(types.size()) +
+                        ">(*_aidl_args))");
+    types.push_back(name_of(arg->GetType()));
+    values.push_back("::std::move(" + BuildVarName(*arg) + ")");
+  }
+  std::ostringstream code;
+  code << "{\n";
+  std::string captures = "_aidl_self = " + self;
+  if (!types.empty()) {
+    code << "  auto _aidl_args = ::std::make_shared<::std::tuple<" << Join(types, ", ") << ">>("
+         << Join(values, ", ") << ");\n";
+    captures += ", _aidl_args";
+  }
+  code << "  ::android::aidl::DispatchExecutors::run(\"" << pool << "\", [" << captures << "] {\n"
+       << "    _aidl_self->" << method.GetName() << "(" << Join(call_args, ", ") << ");\n"
+       << "  });\n"
+       << "}\n";
+  return code.str();
+}
+
+// The out and inout arguments are pointers that the coroutine keeps valid
+// while it is suspended, so only the in arguments are moved into the call.
+std::string GenAwaitMethods(const AidlInterface& iface, const std::string& status_type,
+                            const std::string& self,
+                            const std::function<std::string(const AidlTypeSpecifier&)>& name_of) {
+  std::ostringstream code;
+  code << "#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)\n";
+  for (const auto& method : iface.GetMethods()) {
+    if (!HasAsyncVariant(*method)) {
+      continue;
+    }
+    std::vector<std::string> params;
+    std::vector<std::string> in_types;
+    std::vector<std::string> in_values;
+    std::vector<std::string> captures = {"_aidl_self"};
+    std::vector<std::string> call_args;
+    for (const auto& arg : method->GetArguments()) {
+      const std::string type = name_of(arg->GetType());
+      const std::string& name = arg->GetName();
+      if (arg->IsOut()) {
+        params.push_back(type + "* " + name);
+        captures.push_back(name);
+        call_args.push_back(name);
+      } else {
+        params.push_back(type + " " + name);
+        call_args.push_back("::std::move(::std::get<" + std::to_string(in_types.size()) +
+                            ">(*_aidl_args))");
+        in_types.push_back(type);
+        in_values.push_back("::std::move(" + name + ")");
+      }
+    }
+    if (method->GetType().GetName() != "void") {
+      params.push_back(name_of(method->GetType()) + "* _aidl_return");
+      captures.push_back("_aidl_return");
+      call_args.push_back("_aidl_return");
+    }
+    if (!in_types.empty()) {
+      captures.insert(captures.begin() + 1, "_aidl_args");
+    }
+    const std::string awaitable = "::android::aidl::Awaitable<" + status_type + ">";
+    code << awaitable << " " << method->GetName() << "Await(" << Join(params, ", ") << ") {\n";
+    if (!in_types.empty()) {
+      code << "  auto _aidl_args = ::std::make_shared<::std::tuple<" << Join(in_types, ", ")
+           << ">>(" << Join(in_values, ", ") << ");\n";
+    }
+    code << "  auto _aidl_self = " << self << ";\n"
+         << "  return " << awaitable << "([" << Join(captures, ", ") << "] {\n"
+         << "    return _aidl_self->" << method->GetName() << "(" << Join(call_args, ", ")
+         << ");\n"
+         << "  });\n"
+         << "}\n";
+  }
+  code << "#endif  // defined(__cpp_impl_coroutine) && __has_include(<coroutine>)\n";
+  return code.str();
+}
+
+const char kArgCodeDeclaration[] =
+    R"(#ifndef AIDL_ARG_CODE_DECLARED_
+#define AIDL_ARG_CODE_DECLARED_
+
+namespace android {
+
+namespace aidl {
+
+// The type of an argument in a table of --optimize-for=size. STRING16 is an
+// ::android::String16 and STRING an ::std::string, which the NDK and
+// @utf8InCpp use.
+enum class ArgCode : uint8_t { BOOLEAN, BYTE, CHAR, INT, LONG, FLOAT, DOUBLE, STRING16, STRING };
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // AIDL_ARG_CODE_DECLARED_
+)";
+
+const char kCppArgTableDeclaration[] =
+    R"(#ifndef AIDL_CPP_ARG_TABLE_DECLARED_
+#define AIDL_CPP_ARG_TABLE_DECLARED_
+
+namespace android {
+
+namespace aidl {
+
+// Writes each of the |count| arguments, where |values[i]| points to an
+// argument of the type |codes[i]|.
+inline ::android::status_t writeArgs(::android::Parcel* parcel, const ArgCode* codes,
+                                     size_t count, const void* const* values) {
+  for (size_t i = 0; i < count; i++) {
+    ::android::status_t status = ::android::BAD_VALUE;
+    switch (codes[i]) {
+      case ArgCode::BOOLEAN:
+        status = parcel->writeBool(*static_cast<const bool*>(values[i]));
+        break;
+      case ArgCode::BYTE:
+        status = parcel->writeByte(*static_cast<const int8_t*>(values[i]));
+        break;
+      case ArgCode::CHAR:
+        status = parcel->writeChar(*static_cast<const char16_t*>(values[i]));
+        break;
+      case ArgCode::INT:
+        status = parcel->writeInt32(*static_cast<const int32_t*>(values[i]));
+        break;
+      case ArgCode::LONG:
+        status = parcel->writeInt64(*static_cast<const int64_t*>(values[i]));
+        break;
+      case ArgCode::FLOAT:
+        status = parcel->writeFloat(*static_cast<const float*>(values[i]));
+        break;
+      case ArgCode::DOUBLE:
+        status = parcel->writeDouble(*static_cast<const double*>(values[i]));
+        break;
+      case ArgCode::STRING16:
+        status = parcel->writeString16(*static_cast<const ::android::String16*>(values[i]));
+        break;
+      case ArgCode::STRING:
+        status = parcel->writeUtf8AsUtf16(*static_cast<const ::std::string*>(values[i]));
+        break;
+    }
+    if (status != ::android::OK) return status;
+  }
+  return ::android::OK;
+}
+
+// Reads each of the |count| arguments into |values[i]|, which points to a
+// variable of the type |codes[i]|.
+inline ::android::status_t readArgs(const ::android::Parcel& parcel, const ArgCode* codes,
+                                    size_t count, void* const* values) {
+  for (size_t i = 0; i < count; i++) {
+    ::android::status_t status = ::android::BAD_VALUE;
+    switch (codes[i]) {
+      case ArgCode::BOOLEAN:
+        status = parcel.readBool(static_cast<bool*>(values[i]));
+        break;
+      case ArgCode::BYTE:
+        status = parcel.readByte(static_cast<int8_t*>(values[i]));
+        break;
+      case ArgCode::CHAR:
+        status = parcel.readChar(static_cast<char16_t*>(values[i]));
+        break;
+      case ArgCode::INT:
+        status = parcel.readInt32(static_cast<int32_t*>(values[i]));
+        break;
+      case ArgCode::LONG:
+        status = parcel.readInt64(static_cast<int64_t*>(values[i]));
+        break;
+      case ArgCode::FLOAT:
+        status = parcel.readFloat(static_cast<float*>(values[i]));
+        break;
+      case ArgCode::DOUBLE:
+        status = parcel.readDouble(static_cast<double*>(values[i]));
+        break;
+      case ArgCode::STRING16:
+        status = parcel.readString16(static_cast<::android::String16*>(values[i]));
+        break;
+      case ArgCode::STRING:
+        status = parcel.readUtf8FromUtf16(static_cast<::std::string*>(values[i]));
+        break;
+    }
+    if (status != ::android::OK) return status;
+  }
+  return ::android::OK;
+}
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // AIDL_CPP_ARG_TABLE_DECLARED_
+)";
+
+const char kNdkArgTableDeclaration[] =
+    R"(#ifndef AIDL_NDK_ARG_TABLE_DECLARED_
+#define AIDL_NDK_ARG_TABLE_DECLARED_
+
+namespace android {
+
+namespace aidl {
+
+// Writes each of the |count| arguments, where |values[i]| points to an
+// argument of the type |codes[i]|.
+inline binder_status_t writeNdkArgs(AParcel* parcel, const ArgCode* codes, size_t count,
+                                    const void* const* values) {
+  for (size_t i = 0; i < count; i++) {
+    binder_status_t status = STATUS_BAD_VALUE;
+    switch (codes[i]) {
+      case ArgCode::BOOLEAN:
+        status = AParcel_writeBool(parcel, *static_cast<const bool*>(values[i]));
+        break;
+      case ArgCode::BYTE:
+        status = AParcel_writeByte(parcel, *static_cast<const int8_t*>(values[i]));
+        break;
+      case ArgCode::CHAR:
+        status = AParcel_writeChar(parcel, *static_cast<const char16_t*>(values[i]));
+        break;
+      case ArgCode::INT:
+        status = AParcel_writeInt32(parcel, *static_cast<const int32_t*>(values[i]));
+        break;
+      case ArgCode::LONG:
+        status = AParcel_writeInt64(parcel, *static_cast<const int64_t*>(values[i]));
+        break;
+      case ArgCode::FLOAT:
+        status = AParcel_writeFloat(parcel, *static_cast<const float*>(values[i]));
+        break;
+      case ArgCode::DOUBLE:
+        status = AParcel_writeDouble(parcel, *static_cast<const double*>(values[i]));
+        break;
+      case ArgCode::STRING:
+        status = ::ndk::AParcel_writeString(parcel, *static_cast<const ::std::string*>(values[i]));
+        break;
+      case ArgCode::STRING16:
+        break;
+    }
+    if (status != STATUS_OK) return status;
+  }
+  return STATUS_OK;
+}
+
+// Reads each of the |count| arguments into |values[i]|, which points to a
+// variable of the type |codes[i]|.
+inline binder_status_t readNdkArgs(const AParcel* parcel, const ArgCode* codes, size_t count,
+                                   void* const* values) {
+  for (size_t i = 0; i < count; i++) {
+    binder_status_t status = STATUS_BAD_VALUE;
+    switch (codes[i]) {
+      case ArgCode::BOOLEAN:
+        status = AParcel_readBool(parcel, static_cast<bool*>(values[i]));
+        break;
+      case ArgCode::BYTE:
+        status = AParcel_readByte(parcel, static_cast<int8_t*>(values[i]));
+        break;
+      case ArgCode::CHAR:
+        status = AParcel_readChar(parcel, static_cast<char16_t*>(values[i]));
+        break;
+      case ArgCode::INT:
+        status = AParcel_readInt32(parcel, static_cast<int32_t*>(values[i]));
+        break;
+      case ArgCode::LONG:
+        status = AParcel_readInt64(parcel, static_cast<int64_t*>(values[i]));
+        break;
+      case ArgCode::FLOAT:
+        status = AParcel_readFloat(parcel, static_cast<float*>(values[i]));
+        break;
+      case ArgCode::DOUBLE:
+        status = AParcel_readDouble(parcel, static_cast<double*>(values[i]));
+        break;
+      case ArgCode::STRING:
+        status = ::ndk::AParcel_readString(parcel, static_cast<::std::string*>(values[i]));
+        break;
+      case ArgCode::STRING16:
+        break;
+    }
+    if (status != STATUS_OK) return status;
+  }
+  return STATUS_OK;
+}
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // AIDL_NDK_ARG_TABLE_DECLARED_
+)";
+
+// Returns the code of arguments of |type| in tables of --optimize-for=size,
+// or "" if such arguments are marshalled with code of their own.
+static std::string ArgCodeOf(const AidlTypeSpecifier& type, bool is_ndk) {
+  static const std::unordered_map<std::string, std::string> kCodes = {
+      {"boolean", "BOOLEAN"}, {"byte", "BYTE"},   {"char", "CHAR"},     {"int", "INT"},
+      {"long", "LONG"},       {"float", "FLOAT"}, {"double", "DOUBLE"},
+  };
+  if (type.IsArray() || type.IsNullable() || type.IsView() || type.IsSharedMemory()) {
+    return "";
+  }
+  if (type.GetName() == "String") {
+    return is_ndk || type.IsUtf8InCpp() ? "STRING" : "STRING16";
+  }
+  auto it = kCodes.find(type.GetName());
+  return it == kCodes.end() ? "" : it->second;
+}
+
+bool HasArgTable(const AidlInterface& iface, const AidlMethod& method, const Options& options) {
+  if (!options.OptimizeForSize() || !method.IsUserDefined() || method.GetArguments().empty() ||
+      iface.HasUtf8WireStrings(method)) {
+    return false;
+  }
+  for (const auto& arg : method.GetArguments()) {
+    if (arg->IsOut() || ArgCodeOf(arg->GetType(), false).empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HasArgTables(const AidlInterface& iface, const Options& options) {
+  for (const auto& method : iface.GetMethods()) {
+    if (HasArgTable(iface, *method, options)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string GenArgTable(const AidlMethod& method, bool is_ndk, bool is_server,
+                        const std::vector<std::string>& arg_names) {
+  std::vector<std::string> codes;
+  std::vector<std::string> values;
+  for (size_t i = 0; i < method.GetArguments().size(); i++) {
+    codes.push_back("::android::aidl::ArgCode::" +
+                    ArgCodeOf(method.GetArguments()[i]->GetType(), is_ndk));
+    values.push_back("&" + arg_names[i]);
+  }
+  std::ostringstream code;
+  code << "static constexpr ::android::aidl::ArgCode _aidl_arg_codes[] = {" << Join(codes, ", ")
+       << "};\n"
+       << (is_server ? "void*" : "const void*") << " const _aidl_arg_values[] = {"
+       << Join(values, ", ") << "};\n";
+  return code.str();
+}
+
 }  // namespace cpp
 }  // namespace aidl
 }  // namespace android
@@ -16,8 +16,10 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 #include "aidl_language.h"
 
@@ -50,12 +52,31 @@ void EnterNamespace(CodeWriter& out, const AidlDefinedType& defined_type);
 void LeaveNamespace(CodeWriter& out, const AidlDefinedType& defined_type);
 
 string BuildVarName(const AidlArgument& a);
-const string GenLogBeforeExecute(const string className, const AidlMethod& method, bool isServer,
-                                 bool isNdk);
+const string GenLogBeforeExecute(const string className, const AidlInterface& interface,
+                                 const AidlMethod& method, bool isServer, bool isNdk);
 const string GenLogAfterExecute(const string className, const AidlInterface& interface,
                                 const AidlMethod& method, const string& statusVarName,
                                 const string& returnVarName, bool isServer, bool isNdk);
 
+// Code for --log=binary. Interface headers declare the per-process
+// TransactionLog, and the interface class decodeTransactionRecord(), which
+// GenTransactionRecordDecoder defines. Proxies and stubs record each call
+// with the code of GenBinaryLogBeforeExecute and GenBinaryLogAfterExecute.
+extern const char kTransactionLogDeclaration[];
+uint32_t TransactionLogInterfaceId(const AidlInterface& interface);
+std::string GenBinaryLogBeforeExecute(const AidlInterface& interface, const AidlMethod& method,
+                                      bool isServer, bool isNdk);
+std::string GenBinaryLogAfterExecute(const AidlInterface& interface, const AidlMethod& method,
+                                     bool isServer, bool isNdk);
+std::string GenTransactionRecordDecoder(const AidlInterface& interface, const string& clazz);
+
+// Code for sampling both kinds of --log. The interface class holds a sample
+// period per method, which proxies and stubs check with GenLogSampled before
+// they log a call.
+std::string GenLogSamplingDeclarations(const AidlInterface& interface);
+std::string GenLogSamplingDefinitions(const AidlInterface& interface);
+std::string GenLogSampled(const AidlInterface& interface, const AidlMethod& method);
+
 template <typename T, typename = std::enable_if_t<std::is_copy_constructible_v<T>>>
 std::vector<T> Append(std::vector<T> as, const std::vector<T>& bs) {
   as.insert(as.end(), bs.begin(), bs.end());
@@ -73,6 +94,156 @@ std::vector<T> Append(std::vector<T>&& as, std::vector<T>&& bs) {
 std::string GenerateEnumValues(const AidlEnumDeclaration& enum_decl,
                                const std::vector<std::string>& enclosing_namespaces_of_enum_decl);
 
+// Generates toStringView() and the toString() overloads of an enum whose
+// underlying type is spelled |backing_type|. Names are looked up in a flat
+// table indexed by value when the values are dense, and by binary search over
+// the sorted values otherwise.
+std::string GenerateEnumToString(const AidlEnumDeclaration& enum_decl,
+                                 const std::string& backing_type);
+
+// Returns how many bytes a value of |type| takes in a parcel if it is a
+// primitive written as a fixed number of bytes, or 0 otherwise. boolean, byte
+// and char are written as 32-bit ints.
+size_t ParcelPrimitiveSize(const AidlTypeSpecifier& type);
+// Same as above, for a value of the primitive type named |type_name|.
+size_t ParcelPrimitiveSize(const std::string& type_name);
+
+// Adjacent fields of a parcelable. A batched run has at least two fields, all
+// with a ParcelPrimitiveSize, that are read and written as one block of |size|
+// bytes. Any other field is a run of its own with size 0.
+struct ParcelFieldRun {
+  std::vector<const AidlVariableDeclaration*> fields;
+  size_t size = 0;
+  bool IsBatched() const { return size > 0; }
+};
+
+// Splits the fields of |parcel| into runs. Without |batch|, every field is a
+// run of its own.
+std::vector<ParcelFieldRun> SplitParcelFields(const AidlStructuredParcelable& parcel, bool batch);
+
+// Returns all the fields of |parcel| as one run if they all have a
+// ParcelPrimitiveSize, so that the parcelable always takes the same number of
+// bytes in a parcel. Otherwise, the returned run is empty.
+ParcelFieldRun FixedParcelLayoutOf(const AidlStructuredParcelable& parcel);
+
+// Returns the fields of |parcel| in the order that the C++ and NDK classes
+// declare them: the order of the AIDL file, or with --compact-parcel-layout,
+// by decreasing alignment, so that there is as little padding between them
+// as there can be. Fields of the same alignment keep their order. The fields
+// are still read, written and compared in the order of the AIDL file.
+std::vector<const AidlVariableDeclaration*> FieldsInDeclarationOrder(
+    const AidlStructuredParcelable& parcel, const AidlTypenames& typenames,
+    const Options& options);
+
+// Whether any method of |iface| has a @SharedMemory argument.
+bool HasSharedMemoryArguments(const AidlInterface& iface);
+
+// Whether any method of |iface| has a @View argument.
+bool HasViewArguments(const AidlInterface& iface);
+
+// Whether any method of |iface| takes or returns a @Raw parcelable.
+bool HasRawParcelables(const AidlInterface& iface);
+
+// Whether any method of |iface| is @Batchable.
+bool HasBatchableMethods(const AidlInterface& iface);
+
+// Whether any method of |iface| is @Chunked.
+bool HasChunkedMethods(const AidlInterface& iface);
+
+// The meta transaction that carries a batch of @Batchable calls. It follows
+// the ids of getInterfaceVersion and getInterfaceHash in aidl.cpp, in the
+// range reserved for meta transactions.
+constexpr int kBatchMethodId = 0x00fffffe - 2;
+
+// The size of the table of --native-dispatch-table, which holds the
+// transaction handler of each user-defined method of |iface| at its id. It is
+// 0 if options don't ask for the table, or if the ids are too sparse for it.
+size_t NativeDispatchTableSize(const AidlInterface& iface, const Options& options);
+
+// The methods of |iface| by decreasing count in --transaction-profile, which
+// is the order of the cases of onTransact. Declaration order without one.
+std::vector<const AidlMethod*> MethodsByCallCount(const AidlInterface& iface,
+                                                  const Options& options);
+
+// The attribute that puts the handler of |method| for --native-dispatch-table
+// with the hot code if it is in --transaction-profile, or with the cold code
+// if it isn't. Empty without a profile.
+std::string HandlerPlacement(const AidlInterface& iface, const AidlMethod& method,
+                             const Options& options);
+
+// Code for --gen-stats. The interface class holds a CallStats per method for
+// the proxy and for the stub. GenStatsScope declares a guard that records the
+// latency of the enclosing call into the stats of |method|.
+std::string GenStatsDeclarations(const AidlInterface& iface);
+std::string GenStatsDefinitions(const AidlInterface& iface);
+std::string GenStatsScope(const AidlInterface& iface, const AidlMethod& method, bool isServer);
+
+// Code for --transaction_names. The interface class holds constexpr tables of
+// its transaction codes and method names, sorted both ways, and lookups over
+// them. |first_call_transaction| is the backend's name of the first call code.
+std::string GenTransactionNamesDeclarations(const AidlInterface& iface,
+                                            const std::string& first_call_transaction);
+
+// Code for --gen-async. Every interface header declares the executor that
+// the Async() methods run their calls with, which is a small pool of worker
+// threads unless the process sets another one. GenAsyncMethod defines the
+// Async() variant of |method|, where |self| holds a strong reference to the
+// interface and |name_of| is the backend's type name of a local variable.
+extern const char kAsyncExecutorDeclaration[];
+bool HasAsyncVariant(const AidlMethod& method);
+std::string GenAsyncMethod(const AidlMethod& method, const std::string& status_type,
+                           const std::string& self,
+                           const std::function<std::string(const AidlTypeSpecifier&)>& name_of);
+
+// Code for @DispatchOn. The stub of a oneway method with a dispatch pool, its
+// own or its interface's, reads the arguments and hands the call to the
+// executor of the pool, from the declaration of --gen-async, instead of
+// making it on the binder thread. GenDispatchCall writes the hand-off, where
+// |self| is a strong reference to the implementation.
+std::string DispatchPoolOf(const AidlInterface& iface, const AidlMethod& method);
+bool HasDispatchedMethods(const AidlInterface& iface);
+std::string GenDispatchCall(const AidlMethod& method, const std::string& pool,
+                            const std::string& self,
+                            const std::function<std::string(const AidlTypeSpecifier&)>& name_of);
+
+// Code for @PropagateCallContext. Every interface header with such methods
+// declares the CallContext that their calls carry ahead of the arguments.
+extern const char kCallContextDeclaration[];
+bool HasCallContextMethods(const AidlInterface& iface);
+
+// Code for --gen-coroutines, on top of the executor of --gen-async. The
+// Await() variant of a method takes the same arguments, but the in arguments
+// by value, and returns an Awaitable of its status.
+extern const char kAwaitableDeclaration[];
+std::string GenAwaitMethods(const AidlInterface& iface, const std::string& status_type,
+                            const std::string& self,
+                            const std::function<std::string(const AidlTypeSpecifier&)>& name_of);
+
+// With --forward-declare-types, the interfaces and structured parcelables
+// that the methods of |iface| refer to, other than itself, by canonical name.
+// The interface header declares them, and the source includes their headers.
+// There are none when the header needs the complete types, i.e. when it
+// copies arguments for the executor or takes them by value.
+std::vector<const AidlDefinedType*> ForwardDeclaredTypes(const AidlInterface& iface,
+                                                         const AidlTypenames& typenames,
+                                                         const Options& options);
+
+// Code for --optimize-for=size. A method has an argument table when all of
+// its arguments are in primitives or Strings, other than the Strings that
+// @Utf8Strings writes as UTF-8. Proxies and stubs then marshal
+// the arguments with writeArgs() and readArgs() of the declaration, which
+// every interface header with such methods declares, rather than with a call
+// per argument. GenArgTable declares the table, _aidl_arg_codes, and
+// _aidl_arg_values, which points to the argument variables |arg_names|.
+// kArgCodeDeclaration goes ahead of the declaration of either backend.
+extern const char kArgCodeDeclaration[];
+extern const char kCppArgTableDeclaration[];
+extern const char kNdkArgTableDeclaration[];
+bool HasArgTable(const AidlInterface& iface, const AidlMethod& method, const Options& options);
+bool HasArgTables(const AidlInterface& iface, const Options& options);
+std::string GenArgTable(const AidlMethod& method, bool is_ndk, bool is_server,
+                        const std::vector<std::string>& arg_names);
+
 }  // namespace cpp
 }  // namespace aidl
 }  // namespace android
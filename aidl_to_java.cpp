@@ -21,10 +21,16 @@
 
 #include <android-base/strings.h>
 
+#include <algorithm>
+#include <array>
+#include <cctype>
 #include <functional>
+#include <initializer_list>
 #include <iostream>
 #include <map>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace android {
@@ -56,7 +62,7 @@ const string& JavaNameOf(const AidlTypeSpecifier& aidl, const AidlTypenames& typ
     // And instantiable type has to be either the type in List, Map, ParcelFileDescriptor or
     // user-defined type.
 
-    static map<string, string> instantiable_m = {
+    static const map<string, string> instantiable_m = {
         {"List", "java.util.ArrayList"},
         {"Map", "java.util.HashMap"},
         {"ParcelFileDescriptor", "android.os.ParcelFileDescriptor"},
@@ -64,12 +70,12 @@ const string& JavaNameOf(const AidlTypeSpecifier& aidl, const AidlTypenames& typ
     const string& aidl_name = aidl.GetName();
 
     if (instantiable_m.find(aidl_name) != instantiable_m.end()) {
-      return instantiable_m[aidl_name];
+      return instantiable_m.at(aidl_name);
     }
   }
 
   // map from AIDL built-in type name to the corresponding Java type name
-  static map<string, string> m = {
+  static const map<string, string> m = {
       {"void", "void"},
       {"boolean", "boolean"},
       {"byte", "byte"},
@@ -88,7 +94,7 @@ const string& JavaNameOf(const AidlTypeSpecifier& aidl, const AidlTypenames& typ
   };
 
   // map from primitive types to the corresponding boxing types
-  static map<string, string> boxing_types = {
+  static const map<string, string> boxing_types = {
       {"void", "Void"},   {"boolean", "Boolean"}, {"byte", "Byte"},   {"char", "Character"},
       {"int", "Integer"}, {"long", "Long"},       {"float", "Float"}, {"double", "Double"},
   };
@@ -100,18 +106,18 @@ const string& JavaNameOf(const AidlTypeSpecifier& aidl, const AidlTypenames& typ
     const string& backing_type_name = enum_decl->GetBackingType().GetName();
     CHECK(m.find(backing_type_name) != m.end());
     CHECK(AidlTypenames::IsBuiltinTypename(backing_type_name));
-    return m[backing_type_name];
+    return m.at(backing_type_name);
   }
 
   const string& aidl_name = aidl.GetName();
   if (boxing && AidlTypenames::IsPrimitiveTypename(aidl_name)) {
     // Every primitive type must have the corresponding boxing type
     CHECK(boxing_types.find(aidl_name) != m.end());
-    return boxing_types[aidl_name];
+    return boxing_types.at(aidl_name);
   }
   if (m.find(aidl_name) != m.end()) {
     CHECK(AidlTypenames::IsBuiltinTypename(aidl_name));
-    return m[aidl_name];
+    return m.at(aidl_name);
   } else {
     // 'foo.bar.IFoo' in AIDL maps to 'foo.bar.IFoo' in Java
     return aidl_name;
@@ -155,6 +161,41 @@ string AidlBackingTypeName(const AidlTypeSpecifier& type, const AidlTypenames& t
   return type_name;
 }
 
+// Generates the code to read or write a value of a builtin type.
+using ParcelCodeGenerator = void (*)(const CodeGeneratorContext&);
+
+// The ParcelCodeGenerator of each builtin type and array of it, or nullptr.
+using ParcelCodeGenerators = std::array<ParcelCodeGenerator, 2 * kAidlBuiltinKindCount>;
+
+size_t ParcelCodeGeneratorIndex(AidlBuiltinKind kind, bool is_array) {
+  return 2 * static_cast<size_t>(kind) + (is_array ? 1 : 0);
+}
+
+// Lays out |generators|, keyed by backing type names like "int[]", by kind.
+ParcelCodeGenerators IndexParcelCodeGenerators(
+    std::initializer_list<std::pair<string, ParcelCodeGenerator>> generators) {
+  ParcelCodeGenerators indexed{};
+  for (const auto& [name, generator] : generators) {
+    const bool is_array = android::base::EndsWith(name, "[]");
+    const AidlBuiltinKind kind =
+        AidlTypenames::BuiltinKindOf(is_array ? name.substr(0, name.size() - 2) : name);
+    CHECK(kind != AidlBuiltinKind::NONE) << name;
+    indexed[ParcelCodeGeneratorIndex(kind, is_array)] = generator;
+  }
+  return indexed;
+}
+
+// Returns the generator for the backing type of |c.type|, or nullptr if there
+// is none, e.g. for a parcelable.
+ParcelCodeGenerator FindParcelCodeGenerator(const ParcelCodeGenerators& generators,
+                                            const CodeGeneratorContext& c) {
+  const AidlBuiltinKind kind = c.type.GetBackingKind(c.typenames);
+  if (kind == AidlBuiltinKind::NONE) {
+    return nullptr;
+  }
+  return generators[ParcelCodeGeneratorIndex(kind, c.type.IsArray())];
+}
+
 }  // namespace
 
 string JavaSignatureOf(const AidlTypeSpecifier& aidl, const AidlTypenames& typenames) {
@@ -166,7 +207,7 @@ string InstantiableJavaSignatureOf(const AidlTypeSpecifier& aidl, const AidlType
 }
 
 string DefaultJavaValueOf(const AidlTypeSpecifier& aidl, const AidlTypenames& typenames) {
-  static map<string, string> m = {
+  static const map<string, string> m = {
       {"boolean", "false"}, {"byte", "0"},     {"char", R"('\u0000')"}, {"int", "0"},
       {"long", "0L"},       {"float", "0.0f"}, {"double", "0.0d"},
   };
@@ -176,7 +217,7 @@ string DefaultJavaValueOf(const AidlTypeSpecifier& aidl, const AidlTypenames& ty
 
   if (!aidl.IsArray() && m.find(name) != m.end()) {
     CHECK(AidlTypenames::IsBuiltinTypename(name));
-    return m[name];
+    return m.at(name);
   } else {
     return "null";
   }
@@ -190,8 +231,16 @@ static string GetFlagFor(const CodeGeneratorContext& c) {
   }
 }
 
+// The suffix of the locals that the code for |var| declares, which keeps
+// those of a value nested in it apart from its own.
+static string LocalsSuffixOf(const string& var) {
+  string suffix = "_" + var;
+  std::replace_if(suffix.begin(), suffix.end(), [](char ch) { return !isalnum(ch); }, '_');
+  return suffix;
+}
+
 bool WriteToParcelFor(const CodeGeneratorContext& c) {
-  static map<string, function<void(const CodeGeneratorContext&)>> method_map{
+  static const ParcelCodeGenerators generators = IndexParcelCodeGenerators({
       {"boolean",
        [](const CodeGeneratorContext& c) {
          c.writer << c.parcel << ".writeInt(((" << c.var << ")?(1):(0)));\n";
@@ -286,24 +335,30 @@ bool WriteToParcelFor(const CodeGeneratorContext& c) {
            c.writer.Dedent();
            c.writer << "} else {\n";
            c.writer.Indent();
+           const string value_type = JavaSignatureOfInternal(*c.type.GetTypeParameters().at(1),
+                                                             c.typenames, false, false, true);
+           const string entry = "_aidl_entry" + LocalsSuffixOf(c.var);
+           const string value = "_aidl_value" + LocalsSuffixOf(c.var);
            c.writer << c.parcel << ".writeInt(" << c.var << ".size());\n";
-           c.writer << c.var << ".forEach((k, v) -> {\n";
+           c.writer << "for (java.util.Map.Entry<String, " << value_type << "> " << entry << " : "
+                    << c.var << ".entrySet()) {\n";
            c.writer.Indent();
-           c.writer << c.parcel << ".writeString(k);\n";
+           c.writer << c.parcel << ".writeString(" << entry << ".getKey());\n";
+           c.writer << value_type << " " << value << " = " << entry << ".getValue();\n";
 
            CodeGeneratorContext value_context{
                c.writer,
                c.typenames,
                *c.type.GetTypeParameters()[1].get(),
                c.parcel,
-               "v",
+               value,
                c.is_return_value,
                c.is_classloader_created,
                c.filename,
            };
            WriteToParcelFor(value_context);
            c.writer.Dedent();
-           c.writer << "});\n";
+           c.writer << "}\n";
 
            c.writer.Dedent();
            c.writer << "}\n";
@@ -364,11 +419,9 @@ bool WriteToParcelFor(const CodeGeneratorContext& c) {
          c.writer.Dedent();
          c.writer << "}\n";
        }},
-  };
-  const string type_name = AidlBackingTypeName(c.type, c.typenames);
-  const auto found = method_map.find(type_name);
-  if (found != method_map.end()) {
-    found->second(c);
+  });
+  if (ParcelCodeGenerator generator = FindParcelCodeGenerator(generators, c)) {
+    generator(c);
   } else {
     const AidlDefinedType* t = c.typenames.TryGetDefinedType(c.type.GetName());
     CHECK(t != nullptr) << "Unknown type: " << c.type.GetName() << endl;
@@ -414,8 +467,15 @@ static string EnsureAndGetClassloader(CodeGeneratorContext& c) {
   return "cl";
 }
 
+// Structured parcelables have a static readFrom(), which is called directly
+// rather than through their CREATOR.
+static bool HasStaticReadFrom(const string& type_name, const AidlTypenames& typenames) {
+  const AidlDefinedType* t = typenames.TryGetDefinedType(type_name);
+  return t != nullptr && t->AsStructuredParcelable() != nullptr;
+}
+
 bool CreateFromParcelFor(const CodeGeneratorContext& c) {
-  static map<string, function<void(const CodeGeneratorContext&)>> method_map{
+  static const ParcelCodeGenerators generators = IndexParcelCodeGenerators({
       {"boolean",
        [](const CodeGeneratorContext& c) {
          c.writer << c.var << " = (0!=" << c.parcel << ".readInt());\n";
@@ -493,9 +553,24 @@ bool CreateFromParcelFor(const CodeGeneratorContext& c) {
            } else {
              const AidlDefinedType* t = c.typenames.TryGetDefinedType(contained_type);
              CHECK(t != nullptr) << "Unknown type: " << contained_type << endl;
-             if (t->AsParcelable() != nullptr) {
-               c.writer << c.var << " = " << c.parcel << ".createTypedArrayList("
-                        << JavaNameOf(*(c.type.GetTypeParameters().at(0)), c.typenames)
+             const string& element = JavaNameOf(*(c.type.GetTypeParameters().at(0)), c.typenames);
+             if (HasStaticReadFrom(contained_type, c.typenames)) {
+               // Same as createTypedArrayList, without the CREATOR.
+               c.writer << "{\n";
+               c.writer.Indent();
+               c.writer << "int _aidl_size = " << c.parcel << ".readInt();\n";
+               c.writer << c.var << " = _aidl_size < 0 ? null : new java.util.ArrayList<" << element
+                        << ">(_aidl_size);\n";
+               c.writer << "for (int _aidl_i = 0; _aidl_i < _aidl_size; _aidl_i++) {\n";
+               c.writer.Indent();
+               c.writer << c.var << ".add((0!=" << c.parcel << ".readInt()) ? " << element
+                        << ".readFrom(" << c.parcel << ") : null);\n";
+               c.writer.Dedent();
+               c.writer << "}\n";
+               c.writer.Dedent();
+               c.writer << "}\n";
+             } else if (t->AsParcelable() != nullptr) {
+               c.writer << c.var << " = " << c.parcel << ".createTypedArrayList(" << element
                         << ".CREATOR);\n";
              }
            }
@@ -509,29 +584,36 @@ bool CreateFromParcelFor(const CodeGeneratorContext& c) {
          if (c.type.IsGeneric()) {
            c.writer << "{\n";
            c.writer.Indent();
-           c.writer << "int N = " << c.parcel << ".readInt();\n";
-           c.writer << c.var << " = N < 0 ? null : new java.util.HashMap<>();\n";
-
-           auto creator = JavaNameOf(*(c.type.GetTypeParameters().at(1)), c.typenames) + ".CREATOR";
-           c.writer << "java.util.stream.IntStream.range(0, N).forEach(i -> {\n";
+           const string size = "_aidl_size" + LocalsSuffixOf(c.var);
+           const string index = "_aidl_i" + LocalsSuffixOf(c.var);
+           const string key = "_aidl_key" + LocalsSuffixOf(c.var);
+           const string value = "_aidl_value" + LocalsSuffixOf(c.var);
+           c.writer << "int " << size << " = " << c.parcel << ".readInt();\n";
+           // Sized for the entries up front. Each one takes at least 8 bytes,
+           // which bounds the size that a parcel can claim.
+           c.writer << c.var << " = " << size << " < 0 ? null : new java.util.HashMap<>(Math.min("
+                    << size << ", " << c.parcel << ".dataAvail() / 8) * 4 / 3 + 1);\n";
+           c.writer << "for (int " << index << " = 0; " << index << " < " << size << "; " << index
+                    << "++) {\n";
            c.writer.Indent();
-           c.writer << "String k = " << c.parcel << ".readString();\n";
-           c.writer << JavaNameOf(*(c.type.GetTypeParameters().at(1)), c.typenames) << " v;\n";
+           c.writer << "String " << key << " = " << c.parcel << ".readString();\n";
+           c.writer << JavaNameOf(*(c.type.GetTypeParameters().at(1)), c.typenames) << " " << value
+                    << ";\n";
            CodeGeneratorContext value_context{
                c.writer,
                c.typenames,
                *c.type.GetTypeParameters()[1].get(),
                c.parcel,
-               "v",
+               value,
                c.is_return_value,
                c.is_classloader_created,
                c.filename,
            };
            CreateFromParcelFor(value_context);
-           c.writer << c.var << ".put(k, v);\n";
+           c.writer << c.var << ".put(" << key << ", " << value << ");\n";
 
            c.writer.Dedent();
-           c.writer << "});\n";
+           c.writer << "}\n";
 
            c.writer.Dedent();
            c.writer << "}\n";
@@ -592,10 +674,9 @@ bool CreateFromParcelFor(const CodeGeneratorContext& c) {
          c.writer.Dedent();
          c.writer << "}\n";
        }},
-  };
-  const auto found = method_map.find(AidlBackingTypeName(c.type, c.typenames));
-  if (found != method_map.end()) {
-    found->second(c);
+  });
+  if (ParcelCodeGenerator generator = FindParcelCodeGenerator(generators, c)) {
+    generator(c);
   } else {
     const AidlDefinedType* t = c.typenames.TryGetDefinedType(c.type.GetName());
     CHECK(t != nullptr) << "Unknown type: " << c.type.GetName() << endl;
@@ -605,7 +686,23 @@ bool CreateFromParcelFor(const CodeGeneratorContext& c) {
                  << ".readStrongBinder());\n";
       }
     } else if (t->AsParcelable() != nullptr || t->AsStructuredParcelable() != nullptr) {
-      if (c.type.IsArray()) {
+      const bool has_read_from = HasStaticReadFrom(c.type.GetName(), c.typenames);
+      if (c.type.IsArray() && has_read_from) {
+        // Same as createTypedArray, without the CREATOR.
+        c.writer << "{\n";
+        c.writer.Indent();
+        c.writer << "int _aidl_size = " << c.parcel << ".readInt();\n";
+        c.writer << c.var << " = _aidl_size < 0 ? null : new " << c.type.GetName()
+                 << "[_aidl_size];\n";
+        c.writer << "for (int _aidl_i = 0; _aidl_i < _aidl_size; _aidl_i++) {\n";
+        c.writer.Indent();
+        c.writer << c.var << "[_aidl_i] = (0!=" << c.parcel << ".readInt()) ? " << c.type.GetName()
+                 << ".readFrom(" << c.parcel << ") : null;\n";
+        c.writer.Dedent();
+        c.writer << "}\n";
+        c.writer.Dedent();
+        c.writer << "}\n";
+      } else if (c.type.IsArray()) {
         c.writer << c.var << " = " << c.parcel << ".createTypedArray("
                  << JavaNameOf(c.type, c.typenames) << ".CREATOR);\n";
       } else {
@@ -613,8 +710,12 @@ bool CreateFromParcelFor(const CodeGeneratorContext& c) {
         // Keeping below code just not to break unit tests.
         c.writer << "if ((0!=" << c.parcel << ".readInt())) {\n";
         c.writer.Indent();
-        c.writer << c.var << " = " << c.type.GetName() << ".CREATOR.createFromParcel(" << c.parcel
-                 << ");\n";
+        if (has_read_from) {
+          c.writer << c.var << " = " << c.type.GetName() << ".readFrom(" << c.parcel << ");\n";
+        } else {
+          c.writer << c.var << " = " << c.type.GetName() << ".CREATOR.createFromParcel("
+                   << c.parcel << ");\n";
+        }
         c.writer.Dedent();
         c.writer << "}\n";
         c.writer << "else {\n";
@@ -629,7 +730,7 @@ bool CreateFromParcelFor(const CodeGeneratorContext& c) {
 }
 
 bool ReadFromParcelFor(const CodeGeneratorContext& c) {
-  static map<string, function<void(const CodeGeneratorContext&)>> method_map{
+  static const ParcelCodeGenerators generators = IndexParcelCodeGenerators({
       {"boolean[]",
        [](const CodeGeneratorContext& c) {
          c.writer << c.parcel << ".readBooleanArray(" << c.var << ");\n";
@@ -689,27 +790,37 @@ bool ReadFromParcelFor(const CodeGeneratorContext& c) {
       {"Map",
        [](const CodeGeneratorContext& c) {
          if (c.type.IsGeneric()) {
+           const string size = "_aidl_size" + LocalsSuffixOf(c.var);
+           const string index = "_aidl_i" + LocalsSuffixOf(c.var);
+           const string key = "_aidl_key" + LocalsSuffixOf(c.var);
+           const string value = "_aidl_value" + LocalsSuffixOf(c.var);
            c.writer << "if (" << c.var << " != null) " << c.var << ".clear();\n";
-           c.writer << "java.util.stream.IntStream.range(0, " << c.parcel
-                    << ".readInt()).forEach(i -> {\n";
+           c.writer << "{\n";
+           c.writer.Indent();
+           c.writer << "int " << size << " = " << c.parcel << ".readInt();\n";
+           c.writer << "for (int " << index << " = 0; " << index << " < " << size << "; " << index
+                    << "++) {\n";
            c.writer.Indent();
-           c.writer << "String k = " << c.parcel << ".readString();\n";
-           c.writer << JavaNameOf(*(c.type.GetTypeParameters().at(1)), c.typenames) << " v;\n";
+           c.writer << "String " << key << " = " << c.parcel << ".readString();\n";
+           c.writer << JavaNameOf(*(c.type.GetTypeParameters().at(1)), c.typenames) << " " << value
+                    << ";\n";
            CodeGeneratorContext value_context{
                c.writer,
                c.typenames,
                *c.type.GetTypeParameters()[1].get(),
                c.parcel,
-               "v",
+               value,
                c.is_return_value,
                c.is_classloader_created,
                c.filename,
            };
            CreateFromParcelFor(value_context);
-           c.writer << c.var << ".put(k, v);\n";
+           c.writer << c.var << ".put(" << key << ", " << value << ");\n";
 
            c.writer.Dedent();
-           c.writer << "});\n";
+           c.writer << "}\n";
+           c.writer.Dedent();
+           c.writer << "}\n";
 
            c.writer.Dedent();
            c.writer << "}\n";
@@ -739,10 +850,9 @@ bool ReadFromParcelFor(const CodeGeneratorContext& c) {
          c.writer << c.parcel << ".readTypedArray(" << c.var
                   << ", android.os.ParcelFileDescriptor.CREATOR);\n";
        }},
-  };
-  const auto& found = method_map.find(AidlBackingTypeName(c.type, c.typenames));
-  if (found != method_map.end()) {
-    found->second(c);
+  });
+  if (ParcelCodeGenerator generator = FindParcelCodeGenerator(generators, c)) {
+    generator(c);
   } else {
     const AidlDefinedType* t = c.typenames.TryGetDefinedType(c.type.GetName());
     CHECK(t != nullptr) << "Unknown type: " << c.type.GetName() << endl;
@@ -762,6 +872,60 @@ bool ReadFromParcelFor(const CodeGeneratorContext& c) {
   return true;
 }
 
+// Whether ReadFromParcelFor() reads |type| into an existing array or List,
+// which then holds the elements of the parcel only.
+static bool IsRefillable(const AidlTypeSpecifier& type, const AidlTypenames& typenames) {
+  if (type.IsSharedMemory()) {
+    return false;
+  }
+  if (type.IsArray()) {
+    static const std::set<string> kRefillableArrays = {
+        "boolean[]", "byte[]", "char[]", "int[]", "long[]", "float[]", "double[]", "String[]"};
+    return kRefillableArrays.count(AidlBackingTypeName(type, typenames)) > 0;
+  }
+  if (type.GetName() != "List" || !type.IsGeneric()) {
+    return false;
+  }
+  const AidlTypeSpecifier& element = *type.GetTypeParameters().at(0);
+  if (element.GetName() == "String" || element.GetName() == "IBinder") {
+    return true;
+  }
+  const AidlDefinedType* defined_type = typenames.TryGetDefinedType(element.GetName());
+  return defined_type != nullptr && defined_type->AsParcelable() != nullptr;
+}
+
+bool RefillFromParcelFor(const CodeGeneratorContext& c) {
+  if (!IsRefillable(c.type, c.typenames)) {
+    return CreateFromParcelFor(c);
+  }
+  const string start = "_aidl_start" + LocalsSuffixOf(c.var);
+  const string length = "_aidl_length" + LocalsSuffixOf(c.var);
+  c.writer << "{\n";
+  c.writer.Indent();
+  c.writer << "int " << start << " = " << c.parcel << ".dataPosition();\n";
+  c.writer << "int " << length << " = " << c.parcel << ".readInt();\n";
+  c.writer << c.parcel << ".setDataPosition(" << start << ");\n";
+  // The readers of arrays need one of the length read, and those of Lists
+  // can't read null into one.
+  if (c.type.IsArray()) {
+    c.writer << "if (" << c.var << " != null && " << c.var << ".length == " << length
+             << ") {\n";
+  } else {
+    c.writer << "if (" << c.var << " != null && " << length << " >= 0) {\n";
+  }
+  c.writer.Indent();
+  ReadFromParcelFor(c);
+  c.writer.Dedent();
+  c.writer << "} else {\n";
+  c.writer.Indent();
+  CreateFromParcelFor(c);
+  c.writer.Dedent();
+  c.writer << "}\n";
+  c.writer.Dedent();
+  c.writer << "}\n";
+  return true;
+}
+
 }  // namespace java
 }  // namespace aidl
 }  // namespace android
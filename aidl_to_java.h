@@ -99,6 +99,11 @@ bool CreateFromParcelFor(const CodeGeneratorContext& c);
 // array or a List.
 bool ReadFromParcelFor(const CodeGeneratorContext& c);
 
+// Writes code fragment that reads data from the parcel into the array or List
+// that the variable holds, if it fits, and creates one as
+// CreateFromParcelFor() does otherwise.
+bool RefillFromParcelFor(const CodeGeneratorContext& c);
+
 }  // namespace java
 }  // namespace aidl
 }  // namespace android
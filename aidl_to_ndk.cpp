@@ -20,6 +20,7 @@
 
 #include <android-base/strings.h>
 
+#include <array>
 #include <functional>
 
 using ::android::base::Join;
@@ -145,11 +146,12 @@ TypeInfo ParcelableTypeInfo(const AidlParcelable& type) {
               .read_func = StandardRead("::ndk::AParcel_readParcelable"),
               .write_func = StandardWrite("::ndk::AParcel_writeParcelable"),
           },
+      // Read and written with the loops of the generated ElementVector helpers.
       .array = std::shared_ptr<TypeInfo::Aspect>(new TypeInfo::Aspect{
           .cpp_name = "std::vector<" + clazz + ">",
           .value_is_cheap = false,
-          .read_func = StandardRead("::ndk::AParcel_readVector"),
-          .write_func = StandardWrite("::ndk::AParcel_writeVector"),
+          .read_func = StandardRead("ReadElementVector"),
+          .write_func = StandardWrite("WriteElementVector"),
       }),
       .nullable = std::shared_ptr<TypeInfo::Aspect>(new TypeInfo::Aspect{
           .cpp_name = "std::optional<" + clazz + ">",
@@ -164,7 +166,7 @@ TypeInfo ParcelableTypeInfo(const AidlParcelable& type) {
 TypeInfo EnumDeclarationTypeInfo(const AidlEnumDeclaration& enum_decl) {
   const std::string clazz = NdkFullClassName(enum_decl, cpp::ClassNames::RAW);
 
-  static map<std::string, std::string> kAParcelTypeNameMap = {
+  static const map<std::string, std::string> kAParcelTypeNameMap = {
       {"byte", "Byte"},
       {"int", "Int32"},
       {"long", "Int64"},
@@ -232,7 +234,7 @@ TypeInfo EnumDeclarationTypeInfo(const AidlEnumDeclaration& enum_decl) {
 }
 
 // map from AIDL built-in type name to the corresponding Ndk type info
-static map<std::string, TypeInfo> kNdkTypeInfoMap = {
+static const map<std::string, TypeInfo> kNdkTypeInfoMap = {
     {"void", TypeInfo{{"void", true, nullptr, nullptr}, nullptr, nullptr, nullptr}},
     {"boolean", PrimitiveType("bool", "Bool")},
     {"byte", PrimitiveType("int8_t", "Byte")},
@@ -253,8 +255,8 @@ static map<std::string, TypeInfo> kNdkTypeInfoMap = {
          .array = std::shared_ptr<TypeInfo::Aspect>(new TypeInfo::Aspect{
              .cpp_name = "std::vector<std::string>",
              .value_is_cheap = false,
-             .read_func = StandardRead("::ndk::AParcel_readVector"),
-             .write_func = StandardWrite("::ndk::AParcel_writeVector"),
+             .read_func = StandardRead("ReadElementVector"),
+             .write_func = StandardWrite("WriteElementVector"),
          }),
          .nullable = std::shared_ptr<TypeInfo::Aspect>(new TypeInfo::Aspect{
              .cpp_name = "std::optional<std::string>",
@@ -265,8 +267,8 @@ static map<std::string, TypeInfo> kNdkTypeInfoMap = {
          .nullable_array = std::shared_ptr<TypeInfo::Aspect>(new TypeInfo::Aspect{
              .cpp_name = "std::optional<std::vector<std::optional<std::string>>>",
              .value_is_cheap = false,
-             .read_func = StandardRead("::ndk::AParcel_readVector"),
-             .write_func = StandardWrite("::ndk::AParcel_writeVector"),
+             .read_func = StandardRead("ReadElementVector"),
+             .write_func = StandardWrite("WriteElementVector"),
          }),
      }},
     // TODO(b/136048684) {"Map", ""},
@@ -313,14 +315,95 @@ static map<std::string, TypeInfo> kNdkTypeInfoMap = {
      }},
 };
 
+// kNdkTypeInfoMap, indexed by kind. Types missing from it are nullptr.
+static const TypeInfo* NdkBuiltinTypeInfo(AidlBuiltinKind kind) {
+  static const std::array<const TypeInfo*, kAidlBuiltinKindCount> infos = [] {
+    std::array<const TypeInfo*, kAidlBuiltinKindCount> infos{};
+    for (const auto& [name, info] : kNdkTypeInfoMap) {
+      infos[static_cast<size_t>(AidlTypenames::BuiltinKindOf(name))] = &info;
+    }
+    return infos;
+  }();
+  return infos[static_cast<size_t>(kind)];
+}
+
+static const TypeInfo::Aspect& SelectAspect(const TypeInfo& info, const AidlTypeSpecifier& aidl) {
+  if (aidl.IsArray()) {
+    if (aidl.IsNullable()) {
+      AIDL_FATAL_IF(info.nullable_array == nullptr, aidl) << "Unsupported type in NDK Backend.";
+      return *info.nullable_array;
+    }
+    AIDL_FATAL_IF(info.array == nullptr, aidl) << "Unsupported type in NDK Backend.";
+    return *info.array;
+  }
+
+  if (aidl.IsNullable()) {
+    AIDL_FATAL_IF(info.nullable == nullptr, aidl) << "Unsupported type in NDK Backend.";
+    return *info.nullable;
+  }
+
+  return info.raw;
+}
+
+// A @FixedSize array is a std::array, written as other arrays are. Its
+// allocator only takes the length of the std::array, so reading an array of
+// another length fails.
+static TypeInfo::Aspect FixedSizeArrayAspect(const AidlTypeSpecifier& aidl) {
+  // The element type and the name of the AParcel functions of each primitive
+  static const map<std::string, std::pair<std::string, std::string>> kElements = {
+      {"boolean", {"bool", "Bool"}}, {"byte", {"int8_t", "Byte"}},
+      {"char", {"char16_t", "Char"}}, {"int", {"int32_t", "Int32"}},
+      {"long", {"int64_t", "Int64"}}, {"float", {"float", "Float"}},
+      {"double", {"double", "Double"}},
+  };
+  const auto& [element, pretty_name] = kElements.at(aidl.GetName());
+  const std::string size = std::to_string(aidl.FixedSize());
+  const std::string cpp_name = "std::array<" + element + ", " + size + ">";
+  if (element == "bool") {
+    return TypeInfo::Aspect{
+        .cpp_name = cpp_name,
+        .value_is_cheap = false,
+        .read_func =
+            [cpp_name, size](const CodeGeneratorContext& c) {
+              c.writer << "AParcel_readBoolArray(" << c.parcel << ", " << c.var
+                       << ", [](void*, int32_t _aidl_length) { return _aidl_length == " << size
+                       << "; }, [](void* _aidl_array, size_t _aidl_index, bool _aidl_value) { "
+                       << "(*static_cast<" << cpp_name
+                       << "*>(_aidl_array))[_aidl_index] = _aidl_value; })";
+            },
+        .write_func =
+            [cpp_name, size](const CodeGeneratorContext& c) {
+              c.writer << "AParcel_writeBoolArray(" << c.parcel << ", &(" << c.var << "), "
+                       << size << ", [](const void* _aidl_array, size_t _aidl_index) { "
+                       << "return (*static_cast<const " << cpp_name
+                       << "*>(_aidl_array))[_aidl_index]; })";
+            },
+    };
+  }
+  return TypeInfo::Aspect{
+      .cpp_name = cpp_name,
+      .value_is_cheap = false,
+      .read_func =
+          [=](const CodeGeneratorContext& c) {
+            c.writer << "AParcel_read" << pretty_name << "Array(" << c.parcel << ", " << c.var
+                     << ", [](void* _aidl_array, int32_t _aidl_length, " << element
+                     << "** _aidl_buffer) { *_aidl_buffer = static_cast<" << cpp_name
+                     << "*>(_aidl_array)->data(); return _aidl_length == " << size << "; })";
+          },
+      .write_func =
+          [=](const CodeGeneratorContext& c) {
+            c.writer << "AParcel_write" << pretty_name << "Array(" << c.parcel << ", (" << c.var
+                     << ").data(), " << size << ")";
+          },
+  };
+}
+
 static TypeInfo::Aspect GetTypeAspect(const AidlTypenames& types, const AidlTypeSpecifier& aidl) {
   CHECK(aidl.IsResolved()) << aidl.ToString();
   auto& aidl_name = aidl.GetName();
 
-  TypeInfo info;
-
   // TODO(b/136048684): For now, List<T> is converted to T[].(Both are using vector<T>)
-  if (aidl_name == "List") {
+  if (aidl.GetBuiltinKind() == AidlBuiltinKind::LIST) {
     AIDL_FATAL_IF(!aidl.IsGeneric(), aidl) << "List must be generic type.";
     AIDL_FATAL_IF(aidl.GetTypeParameters().size() != 1, aidl)
         << "List can accept only one type parameter.";
@@ -340,41 +423,32 @@ static TypeInfo::Aspect GetTypeAspect(const AidlTypenames& types, const AidlType
   // All generic types should be handled above.
   AIDL_FATAL_IF(aidl.IsGeneric(), aidl);
 
-  if (AidlTypenames::IsBuiltinTypename(aidl_name)) {
-    auto it = kNdkTypeInfoMap.find(aidl_name);
-    CHECK(it != kNdkTypeInfoMap.end());
-    info = it->second;
-  } else {
-    const AidlDefinedType* type = types.TryGetDefinedType(aidl_name);
-    AIDL_FATAL_IF(type == nullptr, aidl_name) << "Unrecognized type.";
-
-    if (const AidlInterface* intf = type->AsInterface(); intf != nullptr) {
-      info = InterfaceTypeInfo(*intf);
-    } else if (const AidlParcelable* parcelable = type->AsParcelable(); parcelable != nullptr) {
-      info = ParcelableTypeInfo(*parcelable);
-    } else if (const AidlEnumDeclaration* enum_decl = type->AsEnumDeclaration();
-               enum_decl != nullptr) {
-      info = EnumDeclarationTypeInfo(*enum_decl);
-    } else {
-      AIDL_FATAL(aidl_name) << "Unrecognized type";
-    }
+  if (aidl.IsFixedSize()) {
+    return FixedSizeArrayAspect(aidl);
   }
 
-  if (aidl.IsArray()) {
-    if (aidl.IsNullable()) {
-      AIDL_FATAL_IF(info.nullable_array == nullptr, aidl) << "Unsupported type in NDK Backend.";
-      return *info.nullable_array;
-    }
-    AIDL_FATAL_IF(info.array == nullptr, aidl) << "Unsupported type in NDK Backend.";
-    return *info.array;
+  // Builtin types are looked up by kind, without copying their TypeInfo.
+  if (aidl.GetBuiltinKind() != AidlBuiltinKind::NONE) {
+    const TypeInfo* info = NdkBuiltinTypeInfo(aidl.GetBuiltinKind());
+    CHECK(info != nullptr) << aidl_name;
+    return SelectAspect(*info, aidl);
   }
 
-  if (aidl.IsNullable()) {
-    AIDL_FATAL_IF(info.nullable == nullptr, aidl) << "Unsupported type in NDK Backend.";
-    return *info.nullable;
-  }
+  const AidlDefinedType* type = types.TryGetDefinedType(aidl_name);
+  AIDL_FATAL_IF(type == nullptr, aidl_name) << "Unrecognized type.";
 
-  return info.raw;
+  TypeInfo info;
+  if (const AidlInterface* intf = type->AsInterface(); intf != nullptr) {
+    info = InterfaceTypeInfo(*intf);
+  } else if (const AidlParcelable* parcelable = type->AsParcelable(); parcelable != nullptr) {
+    info = ParcelableTypeInfo(*parcelable);
+  } else if (const AidlEnumDeclaration* enum_decl = type->AsEnumDeclaration();
+             enum_decl != nullptr) {
+    info = EnumDeclarationTypeInfo(*enum_decl);
+  } else {
+    AIDL_FATAL(aidl_name) << "Unrecognized type";
+  }
+  return SelectAspect(info, aidl);
 }
 
 std::string NdkFullClassName(const AidlDefinedType& type, cpp::ClassNames name) {
@@ -405,6 +479,18 @@ std::string NdkNameOf(const AidlTypenames& types, const AidlTypeSpecifier& aidl,
   }
 }
 
+bool UsesElementVectorHelpers(const AidlTypenames& types, const AidlTypeSpecifier& type) {
+  if (!type.IsArray() && type.GetBuiltinKind() != AidlBuiltinKind::LIST) {
+    return false;
+  }
+  const AidlTypeSpecifier& element = type.IsGeneric() ? *type.GetTypeParameters().at(0) : type;
+  if (element.GetName() == "String") {
+    return true;
+  }
+  const AidlDefinedType* defined_type = types.TryGetDefinedType(element.GetName());
+  return defined_type != nullptr && defined_type->AsParcelable() != nullptr;
+}
+
 void WriteToParcelFor(const CodeGeneratorContext& c) {
   TypeInfo::Aspect aspect = GetTypeAspect(c.types, c.type);
   aspect.write_func(c);
@@ -53,6 +53,11 @@ struct CodeGeneratorContext {
 void WriteToParcelFor(const CodeGeneratorContext& c);
 void ReadFromParcelFor(const CodeGeneratorContext& c);
 
+// Whether WriteToParcelFor and ReadFromParcelFor use the ElementVector
+// helpers, which the file has to define, for |type|: arrays and Lists of
+// String and of parcelables.
+bool UsesElementVectorHelpers(const AidlTypenames& types, const AidlTypeSpecifier& type);
+
 // Returns argument list of a method where each arg is formatted by the fomatter
 std::string NdkArgList(
     const AidlTypenames& types, const AidlMethod& method,
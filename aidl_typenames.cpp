@@ -20,10 +20,13 @@
 
 #include <android-base/strings.h>
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -41,12 +44,12 @@ namespace android {
 namespace aidl {
 
 // The built-in AIDL types..
-static const set<string> kBuiltinTypes = {
+static const std::unordered_set<string> kBuiltinTypes = {
     "void", "boolean", "byte",           "char",         "int",
     "long", "float",   "double",         "String",       "List",
     "Map",  "IBinder", "FileDescriptor", "CharSequence", "ParcelFileDescriptor"};
 
-static const set<string> kPrimitiveTypes = {"void", "boolean", "byte",  "char",
+static const std::unordered_set<string> kPrimitiveTypes = {"void", "boolean", "byte",  "char",
                                             "int",  "long",    "float", "double"};
 
 // Note: these types may look wrong because they look like Java
@@ -54,7 +57,7 @@ static const set<string> kPrimitiveTypes = {"void", "boolean", "byte",  "char",
 // was the only target language of this compiler. They are added here for
 // backwards compatibility, but we internally treat them as List and Map,
 // respectively.
-static const map<string, string> kJavaLikeTypeToAidlType = {
+static const std::unordered_map<string, string> kJavaLikeTypeToAidlType = {
     {"java.util.List", "List"},
     {"java.util.Map", "Map"},
     {"android.os.ParcelFileDescriptor", "ParcelFileDescriptor"},
@@ -94,30 +97,72 @@ bool AidlTypenames::IsIgnorableImport(const string& import) const {
   return in_ignore_import || defined_type_not_from_preprocessed;
 }
 
-bool AidlTypenames::AddDefinedType(unique_ptr<AidlDefinedType> type) {
+bool AidlTypenames::AddTypeTo(const AidlDefinedType* type, TypeTable* types) {
   const string name = type->GetCanonicalName();
-  if (defined_types_.find(name) != defined_types_.end()) {
+  if (types->canonical_index.find(name) != types->canonical_index.end()) {
     return false;
   }
   if (!IsValidName(type->GetPackage()) || !IsValidName(type->GetName())) {
     return false;
   }
-  defined_types_.emplace(name, std::move(type));
+  types->by_canonical_name.emplace(name, type);
+  types->canonical_index.emplace(name, type);
+  auto [it, inserted] = types->by_name.emplace(type->GetName(), type);
+  if (!inserted && name < it->second->GetCanonicalName()) {
+    it->second = type;
+  }
   return true;
 }
 
-bool AidlTypenames::AddPreprocessedType(unique_ptr<AidlDefinedType> type) {
-  const string name = type->GetCanonicalName();
-  if (preprocessed_types_.find(name) != preprocessed_types_.end()) {
+const AidlDefinedType* AidlTypenames::TypeTable::Find(const string& type_name) const {
+  if (auto it = canonical_index.find(type_name); it != canonical_index.end()) {
+    return it->second;
+  }
+  return nullptr;
+}
+
+void AidlTypenames::TypeTable::Clear() {
+  by_canonical_name.clear();
+  canonical_index.clear();
+  by_name.clear();
+}
+
+bool AidlTypenames::AddDefinedType(unique_ptr<AidlDefinedType> type) {
+  if (!AddTypeTo(type.get(), &defined_types_)) {
     return false;
   }
-  if (!IsValidName(type->GetPackage()) || !IsValidName(type->GetName())) {
+  owned_types_.emplace_back(std::move(type));
+  return true;
+}
+
+bool AidlTypenames::AddPreprocessedType(unique_ptr<AidlDefinedType> type) {
+  if (!AddTypeTo(type.get(), &preprocessed_types_)) {
     return false;
   }
-  preprocessed_types_.insert(make_pair(name, std::move(type)));
+  owned_types_.emplace_back(std::move(type));
   return true;
 }
 
+bool AidlTypenames::AddSharedDefinedType(const AidlDefinedType* type) {
+  return AddTypeTo(type, &defined_types_);
+}
+
+bool AidlTypenames::AddSharedPreprocessedType(const AidlDefinedType* type) {
+  return AddTypeTo(type, &preprocessed_types_);
+}
+
+void AidlTypenames::AdoptTypes(AidlTypenames* other) {
+  for (auto& type : other->owned_types_) {
+    owned_types_.emplace_back(std::move(type));
+  }
+  other->owned_types_.clear();
+}
+
+bool AidlTypenames::Owns(const AidlDefinedType* type) const {
+  return std::any_of(owned_types_.begin(), owned_types_.end(),
+                     [type](const auto& owned) { return owned.get() == type; });
+}
+
 bool AidlTypenames::IsBuiltinTypename(const string& type_name) {
   return kBuiltinTypes.find(type_name) != kBuiltinTypes.end() ||
       kJavaLikeTypeToAidlType.find(type_name) != kJavaLikeTypeToAidlType.end();
@@ -127,6 +172,28 @@ bool AidlTypenames::IsPrimitiveTypename(const string& type_name) {
   return kPrimitiveTypes.find(type_name) != kPrimitiveTypes.end();
 }
 
+AidlBuiltinKind AidlTypenames::BuiltinKindOf(const string& type_name) {
+  static const std::unordered_map<string, AidlBuiltinKind> kinds = {
+      {"void", AidlBuiltinKind::VOID},
+      {"boolean", AidlBuiltinKind::BOOLEAN},
+      {"byte", AidlBuiltinKind::BYTE},
+      {"char", AidlBuiltinKind::CHAR},
+      {"int", AidlBuiltinKind::INT},
+      {"long", AidlBuiltinKind::LONG},
+      {"float", AidlBuiltinKind::FLOAT},
+      {"double", AidlBuiltinKind::DOUBLE},
+      {"String", AidlBuiltinKind::STRING},
+      {"List", AidlBuiltinKind::LIST},
+      {"Map", AidlBuiltinKind::MAP},
+      {"IBinder", AidlBuiltinKind::IBINDER},
+      {"FileDescriptor", AidlBuiltinKind::FILE_DESCRIPTOR},
+      {"CharSequence", AidlBuiltinKind::CHAR_SEQUENCE},
+      {"ParcelFileDescriptor", AidlBuiltinKind::PARCEL_FILE_DESCRIPTOR},
+  };
+  auto found = kinds.find(type_name);
+  return found != kinds.end() ? found->second : AidlBuiltinKind::NONE;
+}
+
 const AidlDefinedType* AidlTypenames::TryGetDefinedType(const string& type_name) const {
   return TryGetDefinedTypeImpl(type_name).type;
 }
@@ -134,28 +201,21 @@ const AidlDefinedType* AidlTypenames::TryGetDefinedType(const string& type_name)
 AidlTypenames::DefinedImplResult AidlTypenames::TryGetDefinedTypeImpl(
     const string& type_name) const {
   // Do the exact match first.
-  auto found_def = defined_types_.find(type_name);
-  if (found_def != defined_types_.end()) {
-    return DefinedImplResult(found_def->second.get(), false);
+  if (auto found = defined_types_.Find(type_name); found != nullptr) {
+    return DefinedImplResult(found, false);
   }
-
-  auto found_prep = preprocessed_types_.find(type_name);
-  if (found_prep != preprocessed_types_.end()) {
-    return DefinedImplResult(found_prep->second.get(), true);
+  if (auto found = preprocessed_types_.Find(type_name); found != nullptr) {
+    return DefinedImplResult(found, true);
   }
 
   // Then match with the class name. Defined types has higher priority than
   // types from the preprocessed file.
-  for (auto it = defined_types_.begin(); it != defined_types_.end(); it++) {
-    if (it->second->GetName() == type_name) {
-      return DefinedImplResult(it->second.get(), false);
-    }
+  if (auto it = defined_types_.by_name.find(type_name); it != defined_types_.by_name.end()) {
+    return DefinedImplResult(it->second, false);
   }
-
-  for (auto it = preprocessed_types_.begin(); it != preprocessed_types_.end(); it++) {
-    if (it->second->GetName() == type_name) {
-      return DefinedImplResult(it->second.get(), true);
-    }
+  if (auto it = preprocessed_types_.by_name.find(type_name);
+      it != preprocessed_types_.by_name.end()) {
+    return DefinedImplResult(it->second, true);
   }
 
   return DefinedImplResult(nullptr, false);
@@ -208,17 +268,18 @@ const AidlInterface* AidlTypenames::GetInterface(const AidlTypeSpecifier& type)
 }
 
 void AidlTypenames::IterateTypes(const std::function<void(const AidlDefinedType&)>& body) const {
-  for (const auto& kv : defined_types_) {
+  for (const auto& kv : defined_types_.by_canonical_name) {
     body(*kv.second);
   }
-  for (const auto& kv : preprocessed_types_) {
+  for (const auto& kv : preprocessed_types_.by_canonical_name) {
     body(*kv.second);
   }
 }
 
 void AidlTypenames::Reset() {
-  defined_types_.clear();
-  preprocessed_types_.clear();
+  defined_types_.Clear();
+  preprocessed_types_.Clear();
+  owned_types_.clear();
 }
 
 }  // namespace aidl
@@ -15,11 +15,13 @@
  */
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -38,6 +40,29 @@ class AidlTypeSpecifier;
 namespace android {
 namespace aidl {
 
+// The builtin types. Backends index tables of what to generate for a type by
+// its kind, instead of looking the type up by name each time.
+enum class AidlBuiltinKind : uint8_t {
+  NONE,  // a defined type
+  VOID,
+  BOOLEAN,
+  BYTE,
+  CHAR,
+  INT,
+  LONG,
+  FLOAT,
+  DOUBLE,
+  STRING,
+  LIST,
+  MAP,
+  IBINDER,
+  FILE_DESCRIPTOR,
+  CHAR_SEQUENCE,
+  PARCEL_FILE_DESCRIPTOR,
+};
+constexpr size_t kAidlBuiltinKindCount =
+    static_cast<size_t>(AidlBuiltinKind::PARCEL_FILE_DESCRIPTOR) + 1;
+
 // AidlTypenames is a collection of AIDL types available to a compilation unit.
 //
 // Basic types (such as int, String, etc.) are added by default, while defined
@@ -55,8 +80,17 @@ class AidlTypenames final {
   void Reset();
   bool AddDefinedType(unique_ptr<AidlDefinedType> type);
   bool AddPreprocessedType(unique_ptr<AidlDefinedType> type);
+  // Same as above, but the type is owned by someone else (e.g. a cache of
+  // parsed files shared by many compilation units) and must outlive this.
+  bool AddSharedDefinedType(const AidlDefinedType* type);
+  bool AddSharedPreprocessedType(const AidlDefinedType* type);
+  // Takes over the types owned by |other|, so that they live as long as this.
+  // They still have to be added with AddSharedDefinedType to be visible here.
+  void AdoptTypes(AidlTypenames* other);
   static bool IsBuiltinTypename(const string& type_name);
   static bool IsPrimitiveTypename(const string& type_name);
+  // Returns the kind of the resolved |type_name|, NONE if it isn't builtin.
+  static AidlBuiltinKind BuiltinKindOf(const string& type_name);
   const AidlDefinedType* TryGetDefinedType(const string& type_name) const;
   pair<string, bool> ResolveTypename(const string& type_name) const;
   bool CanBeOutParameter(const AidlTypeSpecifier& type) const;
@@ -67,6 +101,9 @@ class AidlTypenames final {
   // Returns the AidlInterface of the given type, or nullptr if the type
   // is not an AidlInterface;
   const AidlInterface* GetInterface(const AidlTypeSpecifier& type) const;
+  // Whether |type| was added with AddDefinedType or AddPreprocessedType, or
+  // adopted, rather than shared.
+  bool Owns(const AidlDefinedType* type) const;
   // Iterates over all defined and then preprocessed types
   void IterateTypes(const std::function<void(const AidlDefinedType&)>& body) const;
 
@@ -77,9 +114,23 @@ class AidlTypenames final {
     const AidlDefinedType* type;
     const bool from_preprocessed;
   };
+  // Types indexed by canonical name and by name without the package, so that
+  // either lookup is a hash table lookup. Of the types with the same name,
+  // by_name keeps the one that comes first in by_canonical_name.
+  struct TypeTable {
+    // Ordered, so that IterateTypes is deterministic.
+    map<string, const AidlDefinedType*> by_canonical_name;
+    std::unordered_map<string, const AidlDefinedType*> canonical_index;
+    std::unordered_map<string, const AidlDefinedType*> by_name;
+    const AidlDefinedType* Find(const string& type_name) const;
+    void Clear();
+  };
   DefinedImplResult TryGetDefinedTypeImpl(const string& type_name) const;
-  map<string, unique_ptr<AidlDefinedType>> defined_types_;
-  map<string, unique_ptr<AidlDefinedType>> preprocessed_types_;
+  static bool AddTypeTo(const AidlDefinedType* type, TypeTable* types);
+  TypeTable defined_types_;
+  TypeTable preprocessed_types_;
+  // Types in defined_types_ and preprocessed_types_ which are owned by this.
+  vector<unique_ptr<AidlDefinedType>> owned_types_;
 };
 
 }  // namespace aidl
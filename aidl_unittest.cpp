@@ -16,9 +16,11 @@
 
 #include <memory>
 #include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <gtest/gtest.h>
 
@@ -28,9 +30,11 @@
 #include "aidl_to_cpp.h"
 #include "aidl_to_java.h"
 #include "options.h"
+#include "profile.h"
 #include "tests/fake_io_delegate.h"
 
 using android::aidl::internals::parse_preprocessed_file;
+using android::aidl::internals::ParsedFileCache;
 using android::aidl::test::FakeIoDelegate;
 using android::base::StringPrintf;
 using std::set;
@@ -87,12 +91,15 @@ public class Rect implements android.os.Parcelable
   public int y;
 
   public android.os.ParcelFileDescriptor fd;
+  public static Rect readFrom(android.os.Parcel _aidl_source) {
+    Rect _aidl_out = new Rect();
+    _aidl_out.readFromParcel(_aidl_source);
+    return _aidl_out;
+  }
   public static final android.os.Parcelable.Creator<Rect> CREATOR = new android.os.Parcelable.Creator<Rect>() {
     @Override
     public Rect createFromParcel(android.os.Parcel _aidl_source) {
-      Rect _aidl_out = new Rect();
-      _aidl_out.readFromParcel(_aidl_source);
-      return _aidl_out;
+      return readFrom(_aidl_source);
     }
     @Override
     public Rect[] newArray(int _aidl_size) {
@@ -164,6 +171,14 @@ class AidlTest : public ::testing::Test {
 
   void AddExpectedStderr(string expected) { expected_stderr_.push_back(expected); }
 
+  // Returns what has been written to stderr so far and keeps capturing it, so
+  // that TearDown() still sees the rest.
+  string TakeCapturedStderr() {
+    string actual_stderr = GetCapturedStderr();
+    CaptureStderr();
+    return actual_stderr;
+  }
+
   AidlDefinedType* Parse(const string& path, const string& contents, AidlTypenames& typenames_,
                          Options::Language lang, AidlError* error = nullptr,
                          const vector<string> additional_arguments = {}) {
@@ -308,6 +323,24 @@ TEST_F(AidlTest, ParsesNullableAnnotation) {
   }
 }
 
+TEST_F(AidlTest, ResolvesBuiltinKinds) {
+  io_delegate_.SetFileContents("a/E.aidl",
+                               "package a; @Backing(type=\"long\") enum E { A, B }");
+  import_paths_.emplace("");
+  auto parse_result = Parse("a/IFoo.aidl",
+                            "package a; import a.E; interface IFoo { "
+                            "String f(in List<String> a, in E[] b, in IFoo c); }",
+                            typenames_, Options::Language::JAVA);
+  ASSERT_NE(nullptr, parse_result);
+  const AidlMethod& method = *parse_result->AsInterface()->GetMethods()[0];
+  EXPECT_EQ(AidlBuiltinKind::STRING, method.GetType().GetBuiltinKind());
+  const auto& args = method.GetArguments();
+  EXPECT_EQ(AidlBuiltinKind::LIST, args[0]->GetType().GetBuiltinKind());
+  EXPECT_EQ(AidlBuiltinKind::NONE, args[1]->GetType().GetBuiltinKind());
+  EXPECT_EQ(AidlBuiltinKind::LONG, args[1]->GetType().GetBackingKind(typenames_));
+  EXPECT_EQ(AidlBuiltinKind::NONE, args[2]->GetType().GetBackingKind(typenames_));
+}
+
 TEST_F(AidlTest, ParsesUtf8Annotations) {
   for (auto is_utf8: {true, false}) {
     auto parse_result = Parse(
@@ -323,6 +356,21 @@ TEST_F(AidlTest, ParsesUtf8Annotations) {
   }
 }
 
+TEST_F(AidlTest, KeepsAnnotationFlagsInCopies) {
+  auto parse_result = Parse("a/IFoo.aidl",
+                            "package a; interface IFoo { "
+                            "@nullable @utf8InCpp String[] f(in @View byte[] a); }",
+                            typenames_, Options::Language::CPP);
+  ASSERT_NE(nullptr, parse_result);
+  const AidlMethod& method = *parse_result->AsInterface()->GetMethods()[0];
+  const AidlTypeSpecifier base = method.GetType().ArrayBase();
+  EXPECT_TRUE(base.IsNullable());
+  EXPECT_TRUE(base.IsUtf8InCpp());
+  EXPECT_FALSE(base.IsView());
+  EXPECT_TRUE(method.GetArguments()[0]->GetType().IsView());
+  EXPECT_FALSE(method.GetArguments()[0]->GetType().IsNullable());
+}
+
 TEST_F(AidlTest, VintfRequiresStructuredAndStability) {
   AidlError error;
   auto parse_result = Parse("IFoo.aidl", "@VintfStability interface IFoo {}", typenames_,
@@ -433,6 +481,1686 @@ TEST_F(AidlTest, ParsesPreprocessedFileWithWhitespace) {
   EXPECT_TRUE(typenames_.ResolveTypename("b.IBar").second);
 }
 
+TEST_F(AidlTest, ParsedFileCacheReparsesChangedFiles) {
+  ParsedFileCache cache(true /* check_for_changes */);
+  io_delegate_.SetFileContents("p/Foo.aidl", "package p; parcelable Foo { int a; }");
+  io_delegate_.SetFileContents("path", "parcelable a.Foo;");
+
+  AidlTypenames first;
+  EXPECT_TRUE(cache.LoadImport("p/Foo.aidl", io_delegate_, &first));
+  EXPECT_TRUE(cache.LoadPreprocessed("path", io_delegate_, &first));
+  EXPECT_TRUE(first.ResolveTypename("p.Foo").second);
+  EXPECT_TRUE(first.ResolveTypename("a.Foo").second);
+
+  // Unchanged files are not parsed again
+  AidlTypenames second;
+  EXPECT_TRUE(cache.LoadImport("p/Foo.aidl", io_delegate_, &second));
+  EXPECT_EQ(first.TryGetDefinedType("p.Foo"), second.TryGetDefinedType("p.Foo"));
+
+  io_delegate_.SetFileContents("p/Foo.aidl", "package p; parcelable Bar { int a; }");
+  io_delegate_.SetFileContents("path", "parcelable a.Bar;");
+  AidlTypenames third;
+  EXPECT_TRUE(cache.LoadImport("p/Foo.aidl", io_delegate_, &third));
+  EXPECT_TRUE(cache.LoadPreprocessed("path", io_delegate_, &third));
+  EXPECT_FALSE(third.ResolveTypename("p.Foo").second);
+  EXPECT_TRUE(third.ResolveTypename("p.Bar").second);
+  EXPECT_FALSE(third.ResolveTypename("a.Foo").second);
+  EXPECT_TRUE(third.ResolveTypename("a.Bar").second);
+}
+
+TEST_F(AidlTest, ParsedFileCacheKeepsErrorsAndCompletesEnumsOnce) {
+  ParsedFileCache cache;
+  io_delegate_.SetFileContents("p/Bad.aidl", "package p; parcelable Bad { int a }");
+  TakeCapturedStderr();
+  AidlTypenames first;
+  EXPECT_FALSE(cache.LoadImport("p/Bad.aidl", io_delegate_, &first));
+  const string errors = TakeCapturedStderr();
+  EXPECT_NE(string::npos, errors.find("p/Bad.aidl"));
+  // Every load of the file gives the reason again
+  AidlTypenames second;
+  EXPECT_FALSE(cache.LoadImport("p/Bad.aidl", io_delegate_, &second));
+  EXPECT_EQ(errors, TakeCapturedStderr());
+
+  io_delegate_.SetFileContents("p/E.aidl", "package p; @Backing(type=\"int\") enum E { A, B }");
+  AidlTypenames third;
+  EXPECT_TRUE(cache.LoadImport("p/E.aidl", io_delegate_, &third));
+  const AidlEnumDeclaration* enum_decl = third.TryGetDefinedType("p.E")->AsEnumDeclaration();
+  ASSERT_NE(nullptr, enum_decl);
+  EXPECT_EQ("int", enum_decl->GetBackingType().GetName());
+  EXPECT_FALSE(third.Owns(enum_decl));
+}
+
+TEST_F(AidlTest, ParsedFileCacheCopiesCommentsOfFilesThatMayChange) {
+  // Large enough to be mapped, so lazy comments would read the new text
+  TemporaryDir dir;
+  const string path = string(dir.path) + "/IFoo.aidl";
+  const string tail = "// " + string(32 * 1024, 'a') + "\n";
+  ASSERT_TRUE(android::base::WriteStringToFile(
+      "package p;\n/** Old doc */\ninterface IFoo { void foo(); }\n" + tail, path));
+  IoDelegate io_delegate;
+  ParsedFileCache cache(true /* check_for_changes */);
+  AidlTypenames typenames;
+  ASSERT_TRUE(cache.LoadImport(path, io_delegate, &typenames, Parser::Comments::LAZY));
+
+  ASSERT_TRUE(android::base::WriteStringToFile(
+      "package p;\n/** New doc */\ninterface IFoo { void foo(); }\n" + tail, path));
+  const AidlDefinedType* type = typenames.TryGetDefinedType("p.IFoo");
+  ASSERT_NE(nullptr, type);
+  EXPECT_EQ("/** Old doc */", type->GetComments());
+}
+
+TEST_F(AidlTest, ProfileRecordsPhasesAndCounters) {
+  io_delegate_.SetFileContents("foo/IFoo.aidl",
+                               "package foo; import foo.Data; interface IFoo { Data get(); }");
+  io_delegate_.SetFileContents("foo/Data.aidl", "package foo; parcelable Data { int x; }");
+  Options options = Options::From("aidl --lang=java --profile=trace.json -I . -o out foo/IFoo.aidl");
+  EXPECT_EQ("trace.json", options.ProfileFile());
+
+  Profile::Enable();
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  EXPECT_EQ(2u, Profile::GetCount(ProfileCounter::FILES_PARSED));
+  string trace;
+  EXPECT_TRUE(Profile::Write(CodeWriter::ForString(&trace).get()));
+  Profile::Disable();
+
+  EXPECT_EQ(0u, trace.find("{\"traceEvents\":["));
+  for (const char* name : {"Parse", "Loading phase", "Import resolution", "Validation phase",
+                           "Generate"}) {
+    EXPECT_NE(string::npos, trace.find(StringPrintf("\"name\":\"%s\"", name))) << name;
+  }
+  EXPECT_NE(string::npos, trace.find("\"detail\":\"./foo/Data.aidl\""));
+  EXPECT_NE(string::npos, trace.find("\"files_parsed\":2"));
+}
+
+TEST_F(AidlTest, ProfileShowsTheAllocationsOfEachSpan) {
+  Profile::Enable();
+  {
+    ProfileScope scope("Outer", "foo/IFoo.aidl");
+    Profile::CountAllocation(16);
+    {
+      ProfileScope inner("Inner");
+      Profile::CountAllocation(8);
+    }
+  }
+  EXPECT_EQ(2u, Profile::GetCount(ProfileCounter::ALLOCATIONS));
+  EXPECT_EQ(24u, Profile::GetCount(ProfileCounter::ALLOCATED_BYTES));
+  string trace;
+  EXPECT_TRUE(Profile::Write(CodeWriter::ForString(&trace).get()));
+  Profile::Disable();
+
+  // Spans include the allocations of the spans inside them
+  EXPECT_NE(string::npos,
+            trace.find("\"detail\":\"foo/IFoo.aidl\",\"allocations\":2,\"allocated_bytes\":24,"));
+  EXPECT_NE(string::npos, trace.find("\"args\":{\"allocations\":1,\"allocated_bytes\":8,"));
+  EXPECT_NE(string::npos, trace.find("\"max_rss_kb\":"));
+}
+
+TEST_F(AidlTest, BatchesPrimitiveFieldsOfCppParcelables) {
+  io_delegate_.SetFileContents("p/Data.aidl",
+                               "package p; parcelable Data { int a; long b; boolean c; String s;"
+                               " byte d; char e; float f; double g; int[] h; }");
+  Options options =
+      Options::From("aidl --lang=cpp --batch-primitive-fields -o out -h out p/Data.aidl");
+  EXPECT_TRUE(options.BatchPrimitiveFields());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Data.cpp", &code));
+
+  EXPECT_NE(string::npos, code.find("#include <cstring>"));
+  // a, b and c, then d, e, f and g. The rest are written one by one.
+  EXPECT_NE(string::npos, code.find("_aidl_parcel->writeInplace(16)"));
+  EXPECT_NE(string::npos, code.find("_aidl_parcel->readInplace(16)"));
+  EXPECT_NE(string::npos, code.find("_aidl_parcel->writeInplace(20)"));
+  EXPECT_NE(string::npos, code.find("_aidl_parcel->readInplace(20)"));
+  EXPECT_NE(string::npos, code.find("memcpy(&b, _aidl_run + 4, sizeof(b));"));
+  EXPECT_NE(string::npos, code.find("c = _aidl_value != 0;"));
+  EXPECT_NE(string::npos, code.find("e = static_cast<char16_t>(_aidl_value);"));
+  EXPECT_NE(string::npos, code.find("memcpy(_aidl_run + 12, &g, sizeof(g));"));
+  EXPECT_NE(string::npos, code.find("_aidl_parcel->writeString16(s)"));
+  EXPECT_NE(string::npos, code.find("_aidl_parcel->writeInt32Vector(h)"));
+  // Parcelables written by older versions with fewer fields are still read field by field.
+  EXPECT_NE(string::npos, code.find("_aidl_parcel->readInt64(&b)"));
+
+  Options unbatched = Options::From("aidl --lang=cpp -o out2 -h out2 p/Data.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(unbatched, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out2/p/Data.cpp", &code));
+  EXPECT_EQ(string::npos, code.find("Inplace"));
+}
+
+TEST_F(AidlTest, BatchesPrimitiveFieldReadsOfNdkParcelables) {
+  io_delegate_.SetFileContents("p/Data.aidl",
+                               "package p; parcelable Data { int a; long b; String s; int c; }");
+  Options options =
+      Options::From("aidl --lang=ndk --batch-primitive-fields -o out -h out p/Data.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Data.cpp", &code));
+  // One check for a and b, which takes the per-field path only for older writers.
+  EXPECT_NE(string::npos,
+            code.find("if (AParcel_getDataPosition(parcel) - _aidl_start_pos + 12 <= "
+                      "_aidl_parcelable_size) {\n"
+                      "    _aidl_ret_status = AParcel_readInt32(parcel, &a);\n"
+                      "    if (_aidl_ret_status != STATUS_OK) return _aidl_ret_status;\n\n"
+                      "    _aidl_ret_status = AParcel_readInt64(parcel, &b);\n"));
+  EXPECT_EQ(string::npos, code.find("+ 4 <= _aidl_parcelable_size"));
+}
+
+TEST_F(AidlTest, ReadsLazyFieldsOnFirstUse) {
+  io_delegate_.SetFileContents("p/Inner.aidl", "package p; parcelable Inner { int a; }");
+  io_delegate_.SetFileContents("p/Outer.aidl",
+                               "package p; import p.Inner; parcelable Outer { @Lazy Inner inner; int b; }");
+  Options options = Options::From("aidl --lang=cpp -I . -o out -h out p/Outer.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string header;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Outer.h", &header));
+  EXPECT_NE(string::npos, header.find("const ::p::Inner& inner() const;\n"
+                                      "  ::p::Inner* mutable_inner();\n"));
+  EXPECT_NE(string::npos, header.find("return std::tie(inner(), b)<std::tie(rhs.inner(), rhs.b);"));
+  EXPECT_NE(string::npos,
+            header.find("std::shared_ptr<_aidl_LazyField<::p::Inner>> _aidl_pending_inner;"));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Outer.cpp", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = _aidl_lazy->data.appendFrom(_aidl_parcel, "
+                                    "_aidl_lazy_start, _aidl_lazy_size);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = _aidl_parcel->appendFrom("
+                                    "&_aidl_pending_inner->data, 0, "
+                                    "_aidl_pending_inner->data.dataSize());"));
+  EXPECT_NE(string::npos, code.find("_aidl_lazy->data.readParcelable(&_aidl_lazy->value);"));
+
+  io_delegate_.SetFileContents("p/Bad.aidl", "package p; parcelable Bad { @Lazy int c; }");
+  Options bad_options = Options::From("aidl --lang=cpp -I . -o out -h out p/Bad.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(bad_options, io_delegate_));
+  EXPECT_NE(string::npos, TakeCapturedStderr().find("@Lazy is only supported on non-nullable "
+                                                    "fields of structured parcelable types, but "
+                                                    "got 'int'"));
+}
+
+TEST_F(AidlTest, RelaysRawParcelables) {
+  io_delegate_.SetFileContents("p/Data.aidl", "package p; parcelable Data { int a; }");
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; import p.Data; interface IFoo {"
+                               " @Raw Data relay(in @Raw Data d); }");
+  Options options = Options::From("aidl --lang=cpp -I . -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string header;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &header));
+  EXPECT_NE(string::npos, header.find("class Raw : public ::android::Parcelable {"));
+  EXPECT_NE(string::npos,
+            header.find("relay(const ::android::aidl::Raw<::p::Data>& d, "
+                        "::android::aidl::Raw<::p::Data>* _aidl_return) = 0;"));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("::android::aidl::Raw<::p::Data> in_d;"));
+  EXPECT_NE(string::npos, code.find("_aidl_data.readParcelable(&in_d);"));
+
+  Options java_options = Options::From("aidl --lang=java -I . -o out p/IFoo.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(java_options, io_delegate_));
+  EXPECT_NE(string::npos,
+            TakeCapturedStderr().find("@Raw is only supported in the cpp backend."));
+}
+
+TEST_F(AidlTest, ForwardDeclaresTypesInInterfaceHeaders) {
+  io_delegate_.SetFileContents("p/Data.aidl", "package p; parcelable Data { int a; }");
+  io_delegate_.SetFileContents("p/IBar.aidl", "package p; interface IBar { void bar(); }");
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; import p.Data; import p.IBar; interface IFoo {"
+                               " Data foo(in IBar bar, in Data[] data); }");
+  Options options =
+      Options::From("aidl --lang=cpp --forward-declare-types -I . -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.ForwardDeclareTypes());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string header;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &header));
+  EXPECT_EQ(string::npos, header.find("#include <p/Data.h>"));
+  EXPECT_EQ(string::npos, header.find("#include <p/IBar.h>"));
+  EXPECT_NE(string::npos, header.find("#include <vector>"));
+  EXPECT_NE(string::npos, header.find("namespace p {\n\nclass Data;\n\n}  // namespace p"));
+  EXPECT_NE(string::npos, header.find("namespace p {\n\nclass IBar;\n\n}  // namespace p"));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("#include <p/Data.h>"));
+  EXPECT_NE(string::npos, code.find("#include <p/IBar.h>"));
+
+  Options ndk_options =
+      Options::From("aidl --lang=ndk --forward-declare-types -I . -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/aidl/p/IFoo.h", &header));
+  EXPECT_EQ(string::npos, header.find("#include <aidl/p/Data.h>"));
+  EXPECT_NE(string::npos, header.find("namespace aidl {\nnamespace p {\nclass Data;\n"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("#include <aidl/p/Data.h>"));
+}
+
+TEST_F(AidlTest, ReservesDataCapacityInCppProxies) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo {"
+                               " void foo(int a, long b, in int[] c, String d, out byte[] e,"
+                               " @nullable String f, inout byte[] g); }");
+  Options options =
+      Options::From("aidl --lang=cpp --parcel-capacity-hints -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.ParcelCapacityHints());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  // The token takes 12 + 16 bytes for "p.IFoo", a 4, b 8, c 4, d 6, e 4, f 4 and g 4.
+  EXPECT_NE(string::npos, code.find("_aidl_data.setDataCapacity(62 + (c).size() * 4 + "
+                                    "(d).size() * 2 + (*g).size() * 1);"));
+}
+
+TEST_F(AidlTest, UsesStaticInterfaceTokenInCpp) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  Options options = Options::From(
+      "aidl --lang=cpp --static-interface-token --version=3 -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.StaticInterfaceToken());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_data.writeInterfaceToken(IFoo::descriptor);"));
+  EXPECT_NE(string::npos, code.find("data.writeInterfaceToken(IFoo::descriptor);"));
+  EXPECT_NE(string::npos, code.find("if (!(_aidl_data.enforceInterface(IFoo::descriptor))) {"));
+  EXPECT_EQ(string::npos, code.find("getInterfaceDescriptor()"));
+  EXPECT_EQ(string::npos, code.find("checkInterface(this)"));
+}
+
+TEST_F(AidlTest, ReturnsStaticOkStatusFromNdkProxies) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { int foo(); }");
+  Options options = Options::From("aidl --lang=ndk --static-ok-status -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.StaticOkStatus());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_status.set(_aidl_ret_status == STATUS_OK ? AStatus_newOk() : "
+                      "AStatus_fromStatus(_aidl_ret_status));\n"));
+  EXPECT_EQ(string::npos, code.find("_aidl_status.set(AStatus_fromStatus(_aidl_ret_status));"));
+}
+
+TEST_F(AidlTest, WritesFileDescriptorArraysInBulk) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl",
+      "package p; interface IFoo { ParcelFileDescriptor[] foo(in FileDescriptor[] a,"
+      " in @nullable FileDescriptor[] b); }");
+  Options options = Options::From("aidl --lang=cpp --bulk-fd-arrays -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.BulkFdArrays());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("::android::status_t WriteFileDescriptorArray("));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = WriteFileDescriptorArray(&_aidl_data, a);"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = ReadFileDescriptorArray(&_aidl_reply, _aidl_return);"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = _aidl_data.writeUniqueFileDescriptorVector(b);"));
+
+  io_delegate_.SetFileContents(
+      "p/IBar.aidl", "package p; interface IBar { void bar(out ParcelFileDescriptor[] a); }");
+  Options ndk = Options::From("aidl --lang=ndk --bulk-fd-arrays -o out -h out p/IBar.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IBar.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = ReadFileDescriptorArray(_aidl_out.get(), out_a);"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = WriteFileDescriptorArray(_aidl_out, out_a);"));
+}
+
+TEST_F(AidlTest, WritesStringsOfUtf8StringsInterfacesAsUtf8) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl",
+      "package p; @Utf8Strings interface IFoo { @utf8InCpp String foo(@utf8InCpp String a,"
+      " in String[] b); }");
+  Options options = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = WriteUtf8String(&_aidl_data, a, true);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = _aidl_data.writeString16Vector(b);"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = ReadUtf8String(&_aidl_reply, _aidl_return, nullptr);"));
+  EXPECT_NE(string::npos, code.find("bool _aidl_utf8 = true;"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = ReadUtf8String(&_aidl_data, &in_a, &_aidl_utf8);"));
+  EXPECT_NE(string::npos, code.find("WriteUtf8String(_aidl_reply, _aidl_return, _aidl_utf8);"));
+
+  Options versioned = Options::From("aidl --lang=cpp --version=2 -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(versioned, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("WriteUtf8String(&_aidl_data, a, getInterfaceVersion() >= "
+                                    "IFoo::VERSION);"));
+  EXPECT_NE(string::npos, code.find("bool _aidl_utf8 = false;"));
+
+  Options ndk = Options::From("aidl --lang=ndk -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = WriteUtf8String(_aidl_in.get(), in_a, _aidl_utf8);"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = ReadUtf8String(_aidl_in, &in_a, &_aidl_utf8);"));
+
+  Options java = Options::From("aidl --lang=java -o out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(java, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  EXPECT_NE(string::npos, code.find("writeUtf8String(_data, a, true);"));
+  EXPECT_NE(string::npos, code.find("_result = readUtf8String(_reply, null);"));
+
+  io_delegate_.SetFileContents("p/IBar.aidl",
+                               "package p; interface IBar { void bar(@Utf8Strings String a); }");
+  Options bar = Options::From("aidl --lang=cpp -o out -h out p/IBar.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(bar, io_delegate_));
+}
+
+TEST_F(AidlTest, PacksBooleanAndCharArraysOfPackedArraysInterfaces) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl",
+      "package p; @PackedArrays interface IFoo { boolean[] foo(in char[] a, out boolean[] b,"
+      " in int[] c); }");
+  Options options = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = WritePackedArray(&_aidl_data, a);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = _aidl_data.writeInt32Vector(c);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ReadPackedArray(&_aidl_reply, b);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ReadPackedArray(&_aidl_data, &in_a);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = WritePackedArray(_aidl_reply, out_b);"));
+
+  Options ndk = Options::From("aidl --lang=ndk -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = ReadPackedArray(_aidl_out.get(), _aidl_return);"));
+
+  Options java = Options::From("aidl --lang=java -o out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(java, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  EXPECT_NE(string::npos, code.find("writePackedCharArray(_data, a);"));
+  EXPECT_NE(string::npos, code.find("_arg0 = createPackedCharArray(data);"));
+  EXPECT_NE(string::npos, code.find("readPackedBooleanArray(_reply, b);"));
+}
+
+TEST_F(AidlTest, HoldsNullableValuesInOptionalWithNullableOptional) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl", "package p; interface IFoo { @nullable String foo(in @nullable int[] a); }");
+  io_delegate_.SetFileContents("p/Bar.aidl",
+                               "package p; parcelable Bar { @nullable @utf8InCpp String s; }");
+  Options options =
+      Options::From("aidl --lang=cpp --nullable-optional -o out -h out p/IFoo.aidl p/Bar.aidl");
+  EXPECT_TRUE(options.NullableOptional());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("#include <optional>"));
+  EXPECT_NE(string::npos, code.find("foo(const ::std::optional<::std::vector<int32_t>>& a, "
+                                    "::std::optional<::android::String16>* _aidl_return)"));
+  EXPECT_EQ(string::npos, code.find("unique_ptr<::std::vector"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Bar.h", &code));
+  EXPECT_NE(string::npos, code.find("::std::optional<::std::string> s;"));
+
+  Options defaults = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_FALSE(defaults.NullableOptional());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(defaults, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("::std::unique_ptr<::android::String16>* _aidl_return"));
+}
+
+TEST_F(AidlTest, HoldsFixedSizeArraysInStdArray) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl", "package p; interface IFoo { void foo(in @FixedSize(size=16) byte[] a); }");
+  io_delegate_.SetFileContents(
+      "p/Bar.aidl", "package p; parcelable Bar { @FixedSize(size=3) boolean[] flags; }");
+  Options options = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl p/Bar.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("foo(const ::std::array<uint8_t, 16>& a)"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = WriteFixedSizeArray(&_aidl_data, a);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ReadFixedSizeArray(&_aidl_data, &in_a);"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Bar.h", &code));
+  EXPECT_NE(string::npos, code.find("::std::array<bool, 3> flags;"));
+
+  Options ndk = Options::From("aidl --lang=ndk -o out -h out p/IFoo.aidl p/Bar.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("AParcel_writeByteArray(_aidl_in.get(), (in_a).data(), 16)"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/aidl/p/Bar.h", &code));
+  EXPECT_NE(string::npos, code.find("std::array<bool, 3> flags;"));
+
+  io_delegate_.SetFileContents("p/Baz.aidl",
+                               "package p; parcelable Baz { @FixedSize(size=2) String[] s; }");
+  io_delegate_.SetFileContents("p/Qux.aidl",
+                               "package p; parcelable Qux { @FixedSize(size=0) int[] i; }");
+  for (const string file : {"p/Baz.aidl", "p/Qux.aidl"}) {
+    Options bad_options = Options::From("aidl --lang=cpp -o out -h out " + file);
+    EXPECT_NE(0, ::android::aidl::compile_aidl(bad_options, io_delegate_)) << file;
+  }
+  const string errors = TakeCapturedStderr();
+  EXPECT_NE(string::npos, errors.find("@FixedSize is only supported on non-nullable arrays of "
+                                      "primitive types, but got 'String[]'"));
+  EXPECT_NE(string::npos, errors.find("@FixedSize needs a size between 1 and 4096."));
+}
+
+TEST_F(AidlTest, ReportsInvalidAnnotationParametersOnce) {
+  io_delegate_.SetFileContents(
+      "p/Foo.aidl", "package p; parcelable Foo { @FixedSize(size=\"two\") int[] i; }");
+  Options options = Options::From("aidl --lang=cpp -o out -h out p/Foo.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  const string errors = TakeCapturedStderr();
+  EXPECT_NE(string::npos,
+            errors.find("Invalid value for parameter size on annotation FixedSize."));
+  const string error = "Invalid type specifier for a literal string: int";
+  const size_t first = errors.find(error);
+  EXPECT_NE(string::npos, first);
+  EXPECT_EQ(string::npos, errors.find(error, first + 1));
+}
+
+TEST_F(AidlTest, DeclaresFieldsByAlignmentWithCompactParcelLayout) {
+  io_delegate_.SetFileContents(
+      "p/Foo.aidl", "package p; parcelable Foo { byte a; long b; boolean c; int d; String e; }");
+  Options options =
+      Options::From("aidl --lang=cpp --compact-parcel-layout -o out -h out p/Foo.aidl");
+  EXPECT_TRUE(options.CompactParcelLayout());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Foo.h", &code));
+  EXPECT_NE(string::npos, code.find("int64_t b;\n  ::android::String16 e;\n  int32_t d;\n"
+                                    "  int8_t a;\n  bool c;\n"));
+  // Comparisons keep the order of the AIDL file.
+  EXPECT_NE(string::npos, code.find("std::tie(a, b, c, d, e)"));
+
+  Options ndk = Options::From("aidl --lang=ndk --compact-parcel-layout -o out -h out p/Foo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/aidl/p/Foo.h", &code));
+  EXPECT_NE(string::npos, code.find("int64_t b;\n  std::string e;\n  int32_t d;\n"
+                                    "  int8_t a;\n  bool c;\n"));
+}
+
+TEST_F(AidlTest, MarshalsTypedJavaMapsWithLoops) {
+  io_delegate_.SetFileContents("p/Bar.aidl", "package p; parcelable Bar { int x; }");
+  io_delegate_.SetFileContents("p/Foo.aidl",
+                               "package p; import p.Bar; parcelable Foo { Map<String, Bar> m; }");
+  Options options = Options::From("aidl --lang=java -I . -o out p/Foo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Foo.java", &code));
+  EXPECT_NE(string::npos, code.find("for (java.util.Map.Entry<String, p.Bar> _aidl_entry_m : "
+                                    "m.entrySet()) {"));
+  EXPECT_NE(string::npos, code.find("new java.util.HashMap<>(Math.min(_aidl_size_m, "));
+  EXPECT_EQ(string::npos, code.find("IntStream"));
+  EXPECT_EQ(string::npos, code.find("forEach("));
+}
+
+TEST_F(AidlTest, RefillsJavaContainersWithReuseContainers) {
+  io_delegate_.SetFileContents("p/Foo.aidl",
+                               "package p; parcelable Foo { int[] a; List<String> b; int c; }");
+  Options options = Options::From("aidl --lang=java --reuse-containers -o out p/Foo.aidl");
+  EXPECT_TRUE(options.ReuseContainers());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Foo.java", &code));
+  EXPECT_NE(string::npos, code.find("        if (a != null && a.length == _aidl_length_a) {\n"
+                                    "          _aidl_parcel.readIntArray(a);\n"
+                                    "        } else {\n"
+                                    "          a = _aidl_parcel.createIntArray();\n"));
+  EXPECT_NE(string::npos, code.find("        if (b != null && _aidl_length_b >= 0) {\n"
+                                    "          _aidl_parcel.readStringList(b);\n"));
+  EXPECT_NE(string::npos, code.find("c = _aidl_parcel.readInt();"));
+
+  Options replaces = Options::From("aidl --lang=java -o out p/Foo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(replaces, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Foo.java", &code));
+  EXPECT_EQ(string::npos, code.find("readIntArray("));
+}
+
+TEST_F(AidlTest, ReadsNdkStringAndParcelableVectorsInLoops) {
+  io_delegate_.SetFileContents("p/Bar.aidl", "package p; parcelable Bar { int x; }");
+  io_delegate_.SetFileContents("p/Foo.aidl",
+                               "package p; import p.Bar; parcelable Foo { String[] a; Bar[] b; int[] c; }");
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { List<String> foo(); int[] bar(); }");
+  Options options = Options::From("aidl --lang=ndk -I . -o out -h out p/Foo.aidl p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Foo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("binder_status_t ReadElementVector("));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ReadElementVector(parcel, &a);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ReadElementVector(parcel, &b);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = WriteElementVector(parcel, b);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ::ndk::AParcel_readVector(parcel, &c);"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("ReadElementVector(_aidl_out.get(), _aidl_return);"));
+
+  io_delegate_.SetFileContents("p/Foo.aidl", "package p; parcelable Foo { int[] c; }");
+  Options primitives = Options::From("aidl --lang=ndk -I . -o out -h out p/Foo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(primitives, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Foo.cpp", &code));
+  EXPECT_EQ(string::npos, code.find("ElementVector"));
+}
+
+TEST_F(AidlTest, SplitsCppMethodsIntoSourceShards) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void foo(); void bar(); void baz(); }");
+  Options options = Options::From(
+      "aidl --lang=cpp --source-shards=2 --native-dispatch-table -d out/IFoo.d -o out -h out "
+      "p/IFoo.aidl");
+  EXPECT_EQ(2u, options.SourceShards());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("BnFoo::onTransact("));
+  EXPECT_EQ(string::npos, code.find("BpFoo::foo()"));
+  EXPECT_EQ(string::npos, code.find("BnFoo::_aidl_onTransact_foo("));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo-1.cpp", &code));
+  EXPECT_NE(string::npos, code.find("#include <p/BpFoo.h>"));
+  EXPECT_NE(string::npos, code.find("BpFoo::foo()"));
+  EXPECT_NE(string::npos, code.find("BpFoo::baz()"));
+  EXPECT_NE(string::npos, code.find("BnFoo::_aidl_onTransact_foo("));
+  EXPECT_EQ(string::npos, code.find("BpFoo::bar()"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo-2.cpp", &code));
+  EXPECT_NE(string::npos, code.find("BpFoo::bar()"));
+  EXPECT_NE(string::npos, code.find("BnFoo::_aidl_onTransact_bar("));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/IFoo.d", &code));
+  EXPECT_EQ(0u, code.find("out/p/IFoo.cpp out/p/IFoo-1.cpp out/p/IFoo-2.cpp : \\\n"));
+
+  EXPECT_FALSE(Options::From("aidl --lang=cpp --source-shards=0 -o out -h out p/IFoo.aidl").Ok());
+}
+
+TEST_F(AidlTest, DispatchesJavaTransactionsThroughTable) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void foo() = 0; int bar(int a) = 2; }");
+  Options options = Options::From("aidl --lang=java --java-dispatch-table -o out p/IFoo.aidl");
+  EXPECT_TRUE(options.JavaDispatchTable());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  EXPECT_NE(string::npos,
+            code.find("private static final TransactionHandler[] TRANSACTION_HANDLERS = {\n"
+                      "      (stub, data, reply) -> stub.onTransact$foo$(data, reply),\n"
+                      "      null,\n"
+                      "      (stub, data, reply) -> stub.onTransact$bar$(data, reply),\n"
+                      "    };\n"));
+  EXPECT_NE(string::npos,
+            code.find("return TRANSACTION_HANDLERS[index].onTransact(this, data, reply);"));
+  EXPECT_NE(string::npos, code.find("case INTERFACE_TRANSACTION:"));
+  EXPECT_EQ(string::npos, code.find("case TRANSACTION_foo:"));
+
+  // Sparse ids would waste most of the table. The switch is used for them.
+  io_delegate_.SetFileContents("p/IBar.aidl", "package p; interface IBar { void foo() = 1000; }");
+  Options sparse = Options::From("aidl --lang=java --java-dispatch-table -o out p/IBar.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(sparse, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IBar.java", &code));
+  EXPECT_EQ(string::npos, code.find("TRANSACTION_HANDLERS"));
+  EXPECT_NE(string::npos, code.find("case TRANSACTION_foo:"));
+}
+
+TEST_F(AidlTest, DispatchesNativeTransactionsThroughTable) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void foo() = 0; int bar(int a) = 2; }");
+  Options options =
+      Options::From("aidl --lang=cpp --native-dispatch-table -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.NativeDispatchTable());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("      &BnFoo::_aidl_onTransact_foo,\n"
+                                    "      nullptr,\n"
+                                    "      &BnFoo::_aidl_onTransact_bar,\n"
+                                    "  };\n"));
+  EXPECT_NE(string::npos, code.find("::android::status_t BnFoo::_aidl_onTransact_bar("));
+  EXPECT_EQ(string::npos,
+            code.find("case ::android::IBinder::FIRST_CALL_TRANSACTION + 0 /* foo */:"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/BnFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("private:"));
+  EXPECT_NE(string::npos, code.find("::android::status_t _aidl_onTransact_foo("));
+
+  Options ndk =
+      Options::From("aidl --lang=ndk --native-dispatch-table -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("static constexpr _aidl_Handler _aidl_handlers[] = {\n"
+                                    "    _aidl_onTransact_foo,\n"
+                                    "    nullptr,\n"
+                                    "    _aidl_onTransact_bar,\n"
+                                    "};\n"));
+  EXPECT_NE(string::npos,
+            code.find("return _aidl_handlers[_aidl_index](_aidl_impl, _aidl_in, _aidl_out);"));
+
+  // As in Java, sparse ids are dispatched through the switch.
+  io_delegate_.SetFileContents("p/IBar.aidl", "package p; interface IBar { void foo() = 1000; }");
+  Options sparse =
+      Options::From("aidl --lang=cpp --native-dispatch-table -o out -h out p/IBar.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(sparse, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IBar.cpp", &code));
+  EXPECT_EQ(string::npos, code.find("_aidl_handlers"));
+}
+
+TEST_F(AidlTest, OrdersTransactionsByProfile) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void a(); void b(int x); "
+                               "void c(int x, int y); }");
+  io_delegate_.SetFileContents("calls.txt", "c 50\nb 5\n");
+  const string profile_flag = " --transaction-profile=calls.txt";
+
+  Options java = Options::From("aidl --lang=java --outline-threshold=2 --non-outline-count=1" +
+                               profile_flag + " -o out p/IFoo.aidl");
+  ASSERT_TRUE(java.Ok());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(java, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  // The hottest method stays in onTransact(), ahead of the others.
+  EXPECT_EQ(string::npos, code.find("onTransact$c$"));
+  EXPECT_NE(string::npos, code.find("onTransact$b$"));
+  EXPECT_NE(string::npos, code.find("onTransact$a$"));
+  EXPECT_LT(code.find("case TRANSACTION_c:"), code.find("case TRANSACTION_b:"));
+  EXPECT_LT(code.find("case TRANSACTION_b:"), code.find("case TRANSACTION_a:"));
+
+  Options cpp = Options::From("aidl --lang=cpp --native-dispatch-table" + profile_flag +
+                              " -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("__attribute__((hot)) ::android::status_t BnFoo::_aidl_onTransact_c("));
+  EXPECT_NE(string::npos,
+            code.find("__attribute__((cold)) ::android::status_t BnFoo::_aidl_onTransact_a("));
+
+  // The outputs depend on the profile, which is read again for each compilation.
+  Options with_dep = Options::From("aidl --lang=java" + profile_flag +
+                                   " -d out/IFoo.d -o out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(with_dep, io_delegate_));
+  string dep;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/IFoo.d", &dep));
+  EXPECT_NE(string::npos, dep.find("  p/IFoo.aidl \\\n  calls.txt\n"));
+  EXPECT_NE(string::npos, dep.find("calls.txt :\n"));
+
+  io_delegate_.SetFileContents("calls.txt", "c 50\nb many\n");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(with_dep, io_delegate_));
+  EXPECT_NE(string::npos, TakeCapturedStderr().find("calls.txt:2: Invalid transaction profile"));
+}
+
+TEST_F(AidlTest, MovesNativeErrorPathsOutOfLine) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { int foo(int a); }");
+  Options options = Options::From("aidl --lang=cpp --cold-error-paths -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.ColdErrorPaths());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("static __attribute__((cold, noinline)) bool _aidl_defaultImpl_foo("
+                      "int32_t a, int32_t* _aidl_return, "
+                      "::android::binder::Status* _aidl_status) {\n"
+                      "  const ::android::sp<IFoo>& _aidl_default_impl = IFoo::getDefaultImpl();\n"
+                      "  if (!_aidl_default_impl) return false;\n"
+                      "  *_aidl_status = _aidl_default_impl->foo(a, _aidl_return);\n"
+                      "  return true;\n"
+                      "}\n"));
+  EXPECT_NE(string::npos,
+            code.find("if (UNLIKELY(_aidl_ret_status == ::android::UNKNOWN_TRANSACTION) && "
+                      "_aidl_defaultImpl_foo(a, _aidl_return, &_aidl_status)) {\n"
+                      "     return _aidl_status;\n"));
+  EXPECT_EQ(string::npos, code.find("&& IFoo::getDefaultImpl()"));
+  EXPECT_NE(string::npos, code.find("if (__builtin_expect(_aidl_ret_status != ::android::OK, 0))"));
+  EXPECT_EQ(string::npos, code.find("if (((_aidl_ret_status) != (::android::OK)))"));
+
+  Options ndk = Options::From("aidl --lang=ndk --cold-error-paths -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("if (__builtin_expect(_aidl_ret_status == STATUS_UNKNOWN_TRANSACTION, 0) && "
+                      "_aidl_defaultImpl_foo(in_a, _aidl_return, &_aidl_status)) {\n"
+                      "    return _aidl_status;\n"));
+  EXPECT_NE(string::npos,
+            code.find("if (__builtin_expect(_aidl_ret_status != STATUS_OK, 0)) goto _aidl_error;"));
+  EXPECT_EQ(string::npos, code.find("if (_aidl_ret_status != STATUS_OK)"));
+}
+
+TEST_F(AidlTest, MarshalsSimpleArgumentsWithTablesForSize) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { int foo(int a, String b);"
+                               " void bar(in int[] c); }");
+  Options options =
+      Options::From("aidl --lang=cpp --optimize-for=size -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.OptimizeForSize());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("    static constexpr ::android::aidl::ArgCode _aidl_arg_codes[] = "
+                      "{::android::aidl::ArgCode::INT, ::android::aidl::ArgCode::STRING16};\n"
+                      "    const void* const _aidl_arg_values[] = {&a, &b};\n"
+                      "    _aidl_ret_status = ::android::aidl::writeArgs(&_aidl_data, "
+                      "_aidl_arg_codes, 2, _aidl_arg_values);\n"));
+  EXPECT_NE(string::npos, code.find("      void* const _aidl_arg_values[] = {&in_a, &in_b};\n"
+                                    "      _aidl_ret_status = ::android::aidl::readArgs(_aidl_data, "
+                                    "_aidl_arg_codes, 2, _aidl_arg_values);\n"));
+  // Arrays are still marshalled with code of their own.
+  EXPECT_NE(string::npos, code.find("_aidl_data.writeInt32Vector(c)"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("inline ::android::status_t writeArgs("));
+
+  Options ndk = Options::From("aidl --lang=ndk --optimize-for=size -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("{::android::aidl::ArgCode::INT, "
+                                    "::android::aidl::ArgCode::STRING};\n"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ::android::aidl::writeNdkArgs("
+                                    "_aidl_in.get(), _aidl_arg_codes, 2, _aidl_arg_values);\n"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ::android::aidl::readNdkArgs("
+                                    "_aidl_in, _aidl_arg_codes, 2, _aidl_arg_values);\n"));
+
+  Options speed = Options::From("aidl --lang=cpp --optimize-for=speed -o out -h out p/IFoo.aidl");
+  EXPECT_FALSE(speed.OptimizeForSize());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(speed, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_EQ(string::npos, code.find("_aidl_arg_codes"));
+
+  EXPECT_FALSE(Options::From("aidl --lang=cpp --optimize-for=fast -o out -h out p/IFoo.aidl").Ok());
+}
+
+TEST_F(AidlTest, RecordsCallsInBinaryTransactionLog) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { int foo(int a); }");
+  Options options = Options::From("aidl --lang=cpp --log=binary -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.GenBinaryLog());
+  EXPECT_FALSE(options.GenLog());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("const int64_t _aidl_log_start =\n"
+                      "      _aidl_log_sampled ? ::android::aidl::TransactionLog::nowNs() : 0;\n"));
+  EXPECT_NE(string::npos, code.find("::android::aidl::TransactionLog::get().record("));
+  EXPECT_NE(string::npos, code.find(", 0, false, _aidl_status.exceptionCode(), "
+                                    "_aidl_status.transactionError(), _aidl_data.dataSize(), "
+                                    "_aidl_reply.dataSize(), _aidl_log_start, "
+                                    "_aidl_data.data());"));
+  EXPECT_NE(string::npos, code.find("std::string IFoo::decodeTransactionRecord("));
+  EXPECT_NE(string::npos, code.find("case 0: method_name = \"foo\"; break;"));
+  EXPECT_EQ(string::npos, code.find("Json::Value"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("class TransactionLog {"));
+
+  Options ndk = Options::From("aidl --lang=ndk --log=binary -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_log_data_size = AParcel_getDataPosition(_aidl_in.get());"));
+  EXPECT_NE(string::npos, code.find(", 0, true, AStatus_getExceptionCode(_aidl_status.get()), "
+                                    "AStatus_getStatus(_aidl_status.get()), "
+                                    "AParcel_getDataPosition(_aidl_in), 0, _aidl_log_start, "
+                                    "nullptr);"));
+
+  EXPECT_TRUE(Options::From("aidl --lang=cpp --log -o out -h out p/IFoo.aidl").GenLog());
+  EXPECT_FALSE(Options::From("aidl --lang=cpp --log=text -o out -h out p/IFoo.aidl").Ok());
+  EXPECT_FALSE(Options::From("aidl --lang=java --log=binary -o out p/IFoo.aidl").Ok());
+}
+
+TEST_F(AidlTest, SamplesLoggedCalls) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void foo(int a); void bar(); }");
+  Options options = Options::From("aidl --lang=cpp --log -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("const bool _log_sampled = BpFoo::logFunc != nullptr && "
+                                    "IFoo::shouldLog(1);"));
+  EXPECT_NE(string::npos, code.find("if (_log_sampled && BnFoo::logFunc != nullptr) {"));
+  EXPECT_NE(string::npos, code.find("std::atomic<uint32_t> IFoo::logSamplePeriods[2] = {1, 1};"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("static bool setLogSamplePeriod(const std::string& method, "
+                                    "uint32_t period);"));
+
+  Options ndk = Options::From("aidl --lang=ndk --log=binary -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("const bool _aidl_log_sampled = IFoo::shouldLog(0);"));
+  EXPECT_NE(string::npos, code.find("      if (_aidl_log_sampled) {\n"
+                                    "        ::android::aidl::TransactionLog::get().record("));
+}
+
+TEST_F(AidlTest, NamesEnumeratorsWithoutAllocating) {
+  io_delegate_.SetFileContents("p/Foo.aidl", "package p; enum Foo { A, B, C = 1 }");
+  Options options = Options::From("aidl --lang=cpp -o out -h out p/Foo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Foo.h", &code));
+  EXPECT_NE(string::npos,
+            code.find("static constexpr inline std::string_view toStringView(Foo val) {"));
+  EXPECT_NE(string::npos, code.find("  constexpr std::string_view kNames[2] = {\n"
+                                    "    \"A\",\n"
+                                    "    \"B\",\n"
+                                    "  };\n"));
+  EXPECT_NE(string::npos, code.find("static inline void toString(Foo val, std::string* out) {"));
+
+  Options ndk = Options::From("aidl --lang=ndk -o out -h out p/Foo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/aidl/p/Foo.h", &code));
+  EXPECT_NE(string::npos, code.find("#include <string_view>"));
+  EXPECT_NE(string::npos, code.find("    out->append(std::to_string(static_cast<int8_t>(val)));"));
+}
+
+TEST_F(AidlTest, LooksUpEnumeratorNamesByDensity) {
+  io_delegate_.SetFileContents("p/Foo.aidl", "package p; enum Foo { A = -1, B = 2 }");
+  io_delegate_.SetFileContents("p/Bar.aidl",
+                               "package p; @Backing(type=\"long\") enum Bar { A = 7, B = 1000 }");
+  Options options = Options::From("aidl --lang=cpp -o out -h out p/Foo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Foo.h", &code));
+  EXPECT_NE(string::npos, code.find("  constexpr std::string_view kNames[4] = {\n"
+                                    "    \"A\",\n"
+                                    "    \"\",\n"
+                                    "    \"\",\n"
+                                    "    \"B\",\n"));
+  EXPECT_NE(string::npos, code.find("static_cast<uint64_t>(static_cast<int8_t>(Foo::A));"));
+  Options sparse = Options::From("aidl --lang=cpp -o out -h out p/Bar.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(sparse, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Bar.h", &code));
+  EXPECT_NE(string::npos, code.find("  constexpr Bar kValues[2] = {\n"
+                                    "    Bar::A,\n"
+                                    "    Bar::B,\n"));
+  EXPECT_NE(string::npos, code.find("if (static_cast<int64_t>(kValues[mid]) < "
+                                    "static_cast<int64_t>(val)) {"));
+}
+
+TEST_F(AidlTest, ReusesParcelsInJavaProxies) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl", "package p; @ReuseParcels interface IFoo { int foo(); oneway void bar(); }");
+  Options options = Options::From("aidl --lang=java -o out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  EXPECT_NE(string::npos,
+            code.find("android.os.Parcel _data = obtainReusedParcel(sReusedDataParcel);"));
+  EXPECT_NE(string::npos,
+            code.find("android.os.Parcel _reply = obtainReusedParcel(sReusedReplyParcel);"));
+  EXPECT_NE(string::npos, code.find("releaseReusedParcel(sReusedReplyParcel, _reply);"));
+  EXPECT_NE(string::npos, code.find("releaseReusedParcel(sReusedDataParcel, _data);"));
+  EXPECT_EQ(string::npos, code.find("android.os.Parcel _data = android.os.Parcel.obtain();"));
+
+  io_delegate_.SetFileContents("p/Bar.aidl", "package p; @ReuseParcels parcelable Bar { int x; }");
+  Options parcelable = Options::From("aidl --lang=java -o out p/Bar.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(parcelable, io_delegate_));
+}
+
+TEST_F(AidlTest, CachesNdkInterfaceHashWithoutLockOnRead) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  Options options =
+      Options::From("aidl --lang=ndk --version=3 --hash=abcdefg -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  // The cached hash is checked before any lock is taken.
+  EXPECT_NE(string::npos,
+            code.find("::ndk::ScopedAStatus _aidl_status;\n"
+                      "  if (_aidl_cached_hash_ready.load(std::memory_order_acquire)) {\n"
+                      "    *_aidl_return = _aidl_cached_hash;\n"));
+  EXPECT_NE(string::npos,
+            code.find("const std::lock_guard<std::mutex> lock(_aidl_cached_hash_mutex);\n"
+                      "    if (!_aidl_cached_hash_ready.load(std::memory_order_relaxed)) {\n"
+                      "      _aidl_cached_hash = *_aidl_return;\n"
+                      "      _aidl_cached_hash_ready.store(true, std::memory_order_release);\n"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_cached_version.store(*_aidl_return, std::memory_order_relaxed);"));
+  // The proxies hold the cached values in atomics, so their headers include <atomic>.
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/aidl/p/BpFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("#include <atomic>\n"));
+  Options cpp =
+      Options::From("aidl --lang=cpp --version=3 --hash=abcdefg -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/BpFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("#include <atomic>\n"));
+}
+
+TEST_F(AidlTest, PassesSharedMemoryArgumentsThroughRegions) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl", "package p; interface IFoo { void foo(in @SharedMemory byte[] blob); }");
+  Options java_options = Options::From("aidl --lang=java -o out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(java_options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  EXPECT_NE(string::npos, code.find("writeSharedMemoryByteArray(_data, blob);"));
+  EXPECT_NE(string::npos, code.find("_arg0 = readSharedMemoryByteArray(data);"));
+  EXPECT_EQ(string::npos, code.find("writeByteArray(blob)"));
+
+  Options cpp_options = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = WriteSharedMemoryByteVector(&_aidl_data, blob);"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = ReadSharedMemoryByteVector(_aidl_data, &in_blob);"));
+
+  Options ndk_options = Options::From("aidl --lang=ndk -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = WriteSharedMemoryByteVector(_aidl_in.get(), in_blob);"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = ReadSharedMemoryByteVector(_aidl_in, &in_blob);"));
+}
+
+TEST_F(AidlTest, RejectsSharedMemoryOutsideInByteArrays) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void foo(in @SharedMemory int[] a); }");
+  io_delegate_.SetFileContents(
+      "p/IBar.aidl", "package p; interface IBar { void foo(out @SharedMemory byte[] a); }");
+  io_delegate_.SetFileContents("p/Baz.aidl",
+                               "package p; parcelable Baz { @SharedMemory byte[] a; }");
+  Options foo = Options::From("aidl --lang=java -o out p/IFoo.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(foo, io_delegate_));
+  Options bar = Options::From("aidl --lang=java -o out p/IBar.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(bar, io_delegate_));
+  Options baz = Options::From("aidl --lang=java -o out p/Baz.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(baz, io_delegate_));
+}
+
+TEST_F(AidlTest, ReadsViewArgumentsInPlace) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl",
+      "package p; interface IFoo { void foo(in @View byte[] a, in @View float[] b, in int[] c); }");
+  Options cpp_options = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  string header;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &header));
+  EXPECT_NE(string::npos, header.find("class ArrayView {"));
+  EXPECT_NE(string::npos,
+            header.find("foo(::android::aidl::ArrayView<uint8_t> a, "
+                        "::android::aidl::ArrayView<float> b, const ::std::vector<int32_t>& c)"));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = WriteArrayView(&_aidl_data, a);"));
+  EXPECT_NE(string::npos, code.find("::android::aidl::ArrayView<float> in_b;"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ReadArrayView(&_aidl_data, &in_b);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = _aidl_data.readInt32Vector(&in_c);"));
+
+  // The other backends read the arrays as before.
+  Options java_options = Options::From("aidl --lang=java -o out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(java_options, io_delegate_));
+  Options ndk_options = Options::From("aidl --lang=ndk -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+}
+
+TEST_F(AidlTest, RejectsViewOutsideInArraysOfAlignedPrimitives) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void foo(in @View long[] a); }");
+  io_delegate_.SetFileContents("p/IBar.aidl",
+                               "package p; interface IBar { void foo(out @View int[] a); }");
+  io_delegate_.SetFileContents(
+      "p/IBaz.aidl", "package p; interface IBaz { void foo(in @nullable @View int[] a); }");
+  io_delegate_.SetFileContents("p/Qux.aidl", "package p; parcelable Qux { @View int[] a; }");
+  for (const string file : {"p/IFoo.aidl", "p/IBar.aidl", "p/IBaz.aidl", "p/Qux.aidl"}) {
+    Options options = Options::From("aidl --lang=cpp -o out -h out " + file);
+    EXPECT_NE(0, ::android::aidl::compile_aidl(options, io_delegate_)) << file;
+  }
+  EXPECT_NE(string::npos,
+            TakeCapturedStderr().find(
+                "@View is only supported on non-nullable byte[], int[] and float[], but got "
+                "'long[]'"));
+}
+
+TEST_F(AidlTest, BatchesCallsOfBatchableOnewayMethods) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl",
+      "package p; interface IFoo { @Batchable oneway void foo(int a); void bar(); }");
+  Options options = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = _aidl_batch.writeInt32(a);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = flushBatchedCalls();"));
+  EXPECT_NE(string::npos, code.find("case ::android::IBinder::FIRST_CALL_TRANSACTION + 16777212 "
+                                    "/* batch */:"));
+  EXPECT_NE(string::npos, code.find("switch (_aidl_batched_code) {"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/BpFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("::android::status_t flushBatchedCalls() override;"));
+
+  for (const string lang : {"java", "ndk"}) {
+    Options other_options = Options::From("aidl --lang=" + lang + " -o out -h out p/IFoo.aidl");
+    EXPECT_NE(0, ::android::aidl::compile_aidl(other_options, io_delegate_)) << lang;
+  }
+  EXPECT_NE(string::npos,
+            TakeCapturedStderr().find("@Batchable is only supported in the cpp backend."));
+
+  io_delegate_.SetFileContents("p/IBar.aidl",
+                               "package p; interface IBar { @Batchable void foo(int a); }");
+  Options bar_options = Options::From("aidl --lang=cpp -o out -h out p/IBar.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(bar_options, io_delegate_));
+  EXPECT_NE(string::npos, TakeCapturedStderr().find(
+                              "@Batchable is only supported on oneway methods, but 'foo' isn't "
+                              "oneway."));
+}
+
+TEST_F(AidlTest, StreamsChunkedResultsInCpp) {
+  io_delegate_.SetFileContents("p/Item.aidl", "package p; parcelable Item { int id; }");
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; import p.Item; interface IFoo {\n"
+                               "  @Chunked Item[] list(int a);\n"
+                               "  @Chunked(bytes=1024) Item[] array();\n"
+                               "}");
+  Options options = Options::From("aidl --lang=cpp -I . -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("#ifndef AIDL_CHUNKED_DECLARED_"));
+  EXPECT_NE(string::npos,
+            code.find("virtual ::android::binder::Status listChunks(int32_t a, "
+                      "::android::aidl::ChunkReader<::p::Item>* _aidl_return) {"));
+  EXPECT_NE(string::npos, code.find("::android::binder::Status _aidl_status = list(a, "
+                                    "&_aidl_values);"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ::android::aidl::readChunks(_aidl_reply, "
+                                    "_aidl_return);"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_ret_status = _aidl_return->readFromParcel(_aidl_reply);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ::android::aidl::writeChunks(_aidl_reply, "
+                                    "std::move(_aidl_return), 262144);"));
+  EXPECT_NE(string::npos, code.find("_aidl_ret_status = ::android::aidl::writeChunks(_aidl_reply, "
+                                    "std::move(_aidl_return), 1024);"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/BpFoo.h", &code));
+  EXPECT_NE(string::npos,
+            code.find("::android::binder::Status arrayChunks("
+                      "::android::aidl::ChunkReader<::p::Item>* _aidl_return) override;"));
+
+  Options ndk_options = Options::From("aidl --lang=ndk -I . -o out -h out p/IFoo.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_NE(string::npos,
+            TakeCapturedStderr().find("@Chunked is only supported in the cpp backend."));
+
+  io_delegate_.SetFileContents("p/IBar.aidl",
+                               "package p; interface IBar { @Chunked List<String> foo(); }");
+  Options bar_options = Options::From("aidl --lang=cpp -o out -h out p/IBar.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(bar_options, io_delegate_));
+  EXPECT_NE(string::npos, TakeCapturedStderr().find(
+                              "@Chunked is only supported on non-nullable Lists and arrays of "
+                              "parcelables"));
+}
+
+TEST_F(AidlTest, GeneratesPrewarmForNativeInterfaces) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  Options cpp_options = Options::From("aidl --lang=cpp --gen-prewarm -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(cpp_options.GenPrewarm());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos,
+            code.find("static std::future<::android::sp<IFoo>> prewarm(const ::android::String16& "
+                      "name) {"));
+  EXPECT_NE(string::npos, code.find("return ::android::waitForService<IFoo>(name);"));
+
+  Options ndk_options = Options::From("aidl --lang=ndk --gen-prewarm -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/aidl/p/IFoo.h", &code));
+  EXPECT_NE(string::npos,
+            code.find("static std::future<std::shared_ptr<IFoo>> prewarm(const std::string& "
+                      "instance) {"));
+  EXPECT_NE(string::npos, code.find("#include <android/binder_manager.h>"));
+}
+
+TEST_F(AidlTest, GeneratesAsyncMethodsWithCallbacks) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl",
+      "package p; interface IFoo { int foo(in String a, out int[] b, inout List<String> c); }");
+  Options cpp_options = Options::From("aidl --lang=cpp --gen-async -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(cpp_options.GenAsync());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("#ifndef AIDL_ASYNC_EXECUTOR_DECLARED_"));
+  EXPECT_NE(string::npos,
+            code.find("void fooAsync(::android::String16 a, ::std::vector<::android::String16> c, "
+                      "::std::function<void(const ::android::binder::Status&, const int32_t&, "
+                      "const ::std::vector<int32_t>&, const ::std::vector<::android::String16>&)> "
+                      "_aidl_callback) {"));
+  EXPECT_NE(string::npos, code.find("auto _aidl_self = ::android::sp<IFoo>(this);"));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_self->foo(::std::move(::std::get<0>(*_aidl_args)), &b, "
+                      "&::std::get<1>(*_aidl_args), &_aidl_return);"));
+  EXPECT_NE(string::npos, code.find("_aidl_callback(_aidl_status, _aidl_return, b, "
+                                    "::std::get<1>(*_aidl_args));"));
+
+  Options ndk_options = Options::From("aidl --lang=ndk --gen-async -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/aidl/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("#ifndef AIDL_ASYNC_EXECUTOR_DECLARED_"));
+  EXPECT_NE(string::npos, code.find("::std::function<void(const ::ndk::ScopedAStatus&, "));
+  EXPECT_NE(string::npos, code.find("auto _aidl_self = ref<IFoo>();"));
+}
+
+TEST_F(AidlTest, GeneratesAwaitableMethodsForCoroutines) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl",
+      "package p; interface IFoo { int foo(in String a, out int[] b, inout List<String> c); }");
+  Options cpp_options = Options::From("aidl --lang=cpp --gen-coroutines -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(cpp_options.GenCoroutines());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("#ifndef AIDL_ASYNC_EXECUTOR_DECLARED_"));
+  EXPECT_NE(string::npos, code.find("#ifndef AIDL_AWAITABLE_DECLARED_"));
+  EXPECT_NE(string::npos, code.find("::android::aidl::Awaitable<::android::binder::Status> "
+                                    "fooAwait(::android::String16 a, ::std::vector<int32_t>* b, "
+                                    "::std::vector<::android::String16>* c, int32_t* "
+                                    "_aidl_return) {"));
+  EXPECT_NE(string::npos,
+            code.find("return _aidl_self->foo(::std::move(::std::get<0>(*_aidl_args)), b, c, "
+                      "_aidl_return);"));
+  EXPECT_EQ(string::npos, code.find("fooAsync("));
+
+  Options ndk_options = Options::From("aidl --lang=ndk --gen-coroutines -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/aidl/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("::android::aidl::Awaitable<::ndk::ScopedAStatus> fooAwait("));
+}
+
+TEST_F(AidlTest, DispatchesOnewayCallsToNamedExecutors) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl",
+      "package p; @DispatchOn(pool=\"media\") interface IFoo { oneway void foo(in String a); "
+      "@DispatchOn(pool=\"slow\") oneway void bar(); int baz(); }");
+  Options cpp_options = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("inline void setDispatchExecutor("));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("auto _aidl_args = ::std::make_shared<::std::tuple<::android::String16>>("
+                      "::std::move(in_a));"));
+  EXPECT_NE(string::npos, code.find("::android::aidl::DispatchExecutors::run(\"media\", "
+                                    "[_aidl_self = ::android::sp<BnFoo>(this), _aidl_args] {"));
+  EXPECT_NE(string::npos,
+            code.find("::android::aidl::DispatchExecutors::run(\"slow\", "
+                      "[_aidl_self = ::android::sp<BnFoo>(this)] {"));
+  EXPECT_NE(string::npos, code.find("::android::binder::Status _aidl_status(baz(&_aidl_return));"));
+
+  Options ndk_options = Options::From("aidl --lang=ndk -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("::android::aidl::DispatchExecutors::run(\"media\", "
+                                    "[_aidl_self = _aidl_impl, _aidl_args] {"));
+}
+
+TEST_F(AidlTest, RejectsDispatchOnTwoWayMethods) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl", "package p; interface IFoo { @DispatchOn(pool=\"slow\") int foo(); }");
+  Options options = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  EXPECT_NE(string::npos,
+            TakeCapturedStderr().find(
+                "@DispatchOn is only supported on oneway methods, but 'foo' isn't oneway."));
+
+  io_delegate_.SetFileContents(
+      "p/IBar.aidl",
+      "package p; @DispatchOn(pool=\"slow\") interface IBar { oneway void foo(); }");
+  Options java_options = Options::From("aidl --lang=java -o out p/IBar.aidl");
+  EXPECT_NE(0, ::android::aidl::compile_aidl(java_options, io_delegate_));
+  EXPECT_NE(string::npos, TakeCapturedStderr().find(
+                              "@DispatchOn is only supported in the cpp and ndk backends."));
+}
+
+TEST_F(AidlTest, PropagatesCallContextsAheadOfTheArguments) {
+  io_delegate_.SetFileContents(
+      "p/IFoo.aidl",
+      "package p; interface IFoo { @PropagateCallContext int foo(in String a); void bar(); }");
+  Options cpp_options = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("#ifndef AIDL_CALL_CONTEXT_DECLARED_"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_data.writeInt64(::android::aidl::CallContext::current()"
+                                    ".deadlineNs);"));
+  EXPECT_NE(string::npos, code.find("_aidl_context.hasExpired()"));
+  EXPECT_NE(string::npos, code.find("\"foo() missed its deadline\""));
+  EXPECT_NE(string::npos,
+            code.find("::android::aidl::ScopedCallContext _aidl_context_scope(_aidl_context);\n"
+                      "    ::android::binder::Status _aidl_status(foo(in_a, &_aidl_return));"));
+  // Only foo() carries the context.
+  EXPECT_EQ(code.find("writeInt64(::android::aidl::CallContext"),
+            code.rfind("writeInt64(::android::aidl::CallContext"));
+
+  Options ndk_options = Options::From("aidl --lang=ndk -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("AParcel_readInt64(_aidl_in, &_aidl_context.deadlineNs);"));
+
+  Options java_options = Options::From("aidl --lang=java -o out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(java_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  EXPECT_NE(string::npos, code.find("public static final class CallContext {"));
+  EXPECT_NE(string::npos, code.find("p.IFoo.CallContext.current().writeToParcel(_data);"));
+  EXPECT_NE(string::npos, code.find("p.IFoo.CallContext _aidl_context = "
+                                    "p.IFoo.CallContext.readFromParcel(data);"));
+  EXPECT_NE(string::npos, code.find("p.IFoo.CallContext.setCurrent(_aidl_outer_context);"));
+}
+
+TEST_F(AidlTest, RecordsCallStatsInProxiesAndStubs) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void foo(); int bar(int a); }");
+  Options cpp_options = Options::From("aidl --lang=cpp --gen-stats -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(cpp_options.GenStats());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("IFoo::ScopedCallStats _aidl_stats(&IFoo::clientStats[1]);"));
+  EXPECT_NE(string::npos, code.find("IFoo::ScopedCallStats _aidl_stats(&IFoo::serverStats[0]);"));
+  EXPECT_NE(string::npos, code.find("void IFoo::dumpStats(int fd) {"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("static CallStats clientStats[2];"));
+
+  Options ndk_options = Options::From("aidl --lang=ndk --gen-stats -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("IFoo::ScopedCallStats _aidl_stats(&IFoo::clientStats[0]);"));
+  EXPECT_NE(string::npos, code.find("IFoo::ScopedCallStats _aidl_stats(&IFoo::serverStats[1]);"));
+
+  Options java_options = Options::From("aidl --lang=java --gen-stats -o out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(java_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  EXPECT_NE(string::npos, code.find("recordStats(sClientStats, 1, _aidl_stats_start);"));
+  EXPECT_NE(string::npos, code.find("recordStats(sServerStats, 0, _aidl_stats_start);"));
+  EXPECT_NE(string::npos, code.find("public static void dumpStats(java.io.PrintWriter pw) {"));
+
+  // Nothing is recorded without the option.
+  Options plain = Options::From("aidl --lang=java -o out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(plain, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  EXPECT_EQ(string::npos, code.find("recordStats"));
+}
+
+TEST_F(AidlTest, TracesClientCallsAndParcelSizes) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { int foo(int a); }");
+  Options cpp_options =
+      Options::From("aidl --lang=cpp -t --trace-parcel-sizes -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(cpp_options.TraceParcelSizes());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("atrace_int(ATRACE_TAG_AIDL, \"IFoo::foo::cppClient::dataSize\", "
+                      "static_cast<int32_t>(_aidl_data.dataSize()));"));
+  EXPECT_NE(string::npos,
+            code.find("atrace_int(ATRACE_TAG_AIDL, \"IFoo::foo::cppClient::replySize\", "
+                      "static_cast<int32_t>(_aidl_reply.dataSize()));"));
+
+  Options ndk_options =
+      Options::From("aidl --lang=ndk -t --trace-parcel-sizes -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("ScopedTrace _aidl_trace(\"IFoo::foo::ndkClient\");"));
+  EXPECT_NE(string::npos, code.find("ScopedTrace _aidl_trace(\"IFoo::foo::ndkServer\");"));
+  EXPECT_NE(string::npos,
+            code.find("ATrace_setCounter(\"IFoo::foo::ndkClient::dataSize\", "
+                      "AParcel_getDataPosition(_aidl_in.get()));"));
+  EXPECT_NE(string::npos,
+            code.find("ATrace_setCounter(\"IFoo::foo::ndkClient::replySize\", "
+                      "AParcel_getDataPosition(_aidl_out.get()));"));
+  EXPECT_NE(string::npos, code.find("#if !defined(__ANDROID__) || __ANDROID_API__ >= 29\n"
+                                    "  ATrace_setCounter(\"IFoo::foo::ndkClient::dataSize\""));
+}
+
+TEST_F(AidlTest, GeneratesConstexprTransactionNameTablesForNative) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void foo(); int bar(int a); }");
+  Options cpp_options =
+      Options::From("aidl --lang=cpp --transaction_names -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp_options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("static constexpr const char* getTransactionName("));
+  EXPECT_NE(string::npos, code.find("static constexpr uint32_t getTransactionCode("));
+  const size_t by_code = code.find("kTransactionNamesByCode[] = {");
+  const size_t by_name = code.find("kTransactionNamesByName[] = {");
+  ASSERT_NE(string::npos, by_code);
+  ASSERT_NE(string::npos, by_name);
+  // Sorted by code, foo comes first; sorted by name, bar does.
+  EXPECT_LT(code.find("{::android::IBinder::FIRST_CALL_TRANSACTION + 0, \"foo\"}", by_code),
+            code.find("{::android::IBinder::FIRST_CALL_TRANSACTION + 1, \"bar\"}", by_code));
+  EXPECT_GT(code.find("{::android::IBinder::FIRST_CALL_TRANSACTION + 0, \"foo\"}", by_name),
+            code.find("{::android::IBinder::FIRST_CALL_TRANSACTION + 1, \"bar\"}", by_name));
+
+  Options ndk_options =
+      Options::From("aidl --lang=ndk --transaction_names -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk_options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/aidl/p/IFoo.h", &code));
+  EXPECT_NE(string::npos, code.find("{FIRST_CALL_TRANSACTION + 1, \"bar\"}"));
+  EXPECT_NE(string::npos, code.find("#include <string_view>"));
+
+  Options plain = Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(plain, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_EQ(string::npos, code.find("kTransactionNamesByCode"));
+
+  io_delegate_.SetFileContents("p/IEmpty.aidl", "package p; interface IEmpty {}");
+  Options empty = Options::From("aidl --lang=cpp --transaction_names -o out -h out p/IEmpty.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(empty, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IEmpty.h", &code));
+  EXPECT_EQ(string::npos, code.find("kTransactionNamesByCode"));
+  EXPECT_NE(string::npos, code.find("getTransactionName(uint32_t) { return nullptr; }"));
+}
+
+TEST_F(AidlTest, LazyCommentsMatchCopiedComments) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p;\n"
+                               "/* doc */\n"
+                               "// line\n"
+                               "interface IFoo {\n"
+                               "  // one\n"
+                               "  /** two */ void foo();\n"
+                               "}");
+  for (Parser::Comments mode : {Parser::Comments::COPY, Parser::Comments::LAZY}) {
+    AidlTypenames typenames;
+    auto parser = Parser::Parse("p/IFoo.aidl", io_delegate_, typenames, mode);
+    ASSERT_NE(nullptr, parser);
+    const AidlInterface* iface = parser->GetDefinedTypes()[0]->AsInterface();
+    ASSERT_NE(nullptr, iface);
+    EXPECT_EQ("/* doc */// line\n", iface->GetComments());
+    EXPECT_EQ("// one\n/** two */", iface->GetMethods()[0]->GetComments());
+  }
+}
+
+TEST_F(AidlTest, ConstantValueIsEvaluatedOnceAndDecoratedPerCall) {
+  std::unique_ptr<AidlConstantValue> value(AidlConstantValue::Integral(AIDL_LOCATION_HERE, "300"));
+  ASSERT_NE(nullptr, value);
+  AidlTypeSpecifier int_type(AIDL_LOCATION_HERE, "int", false, nullptr, "");
+  AidlTypeSpecifier byte_type(AIDL_LOCATION_HERE, "byte", false, nullptr, "");
+  auto parenthesize = [](const AidlTypeSpecifier&, const std::string& raw_value) {
+    return "(" + raw_value + ")";
+  };
+
+  EXPECT_TRUE(value->Evaluate(int_type));
+  EXPECT_EQ("300", value->ValueString(int_type, AidlConstantValueDecorator));
+  EXPECT_EQ("(300)", value->ValueString(int_type, parenthesize));
+
+  TakeCapturedStderr();
+  EXPECT_FALSE(value->Evaluate(byte_type));
+  EXPECT_EQ("", value->ValueString(byte_type, AidlConstantValueDecorator));
+  EXPECT_NE("", TakeCapturedStderr());
+  EXPECT_EQ("(300)", value->ValueString(int_type, parenthesize));
+}
+
+TEST_F(AidlTest, ParallelImportsBehaveLikeSequentialImports) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; import q.A; import q.B; import q.C;\n"
+                               "interface IFoo { void foo(in A a, in B b, in C c); }");
+  io_delegate_.SetFileContents("q/A.aidl", "package q; parcelable A { int x = ; }");
+  io_delegate_.SetFileContents("q/B.aidl", "package q; parcelable B { int y; }");
+  io_delegate_.SetFileContents("q/C.aidl", "package q; parcelable C { int z }");
+
+  auto compile = [&](const string& jobs) {
+    TakeCapturedStderr();
+    Options options = Options::From("aidl --lang=cpp -I . " + jobs + " -o out -h out p/IFoo.aidl");
+    const int ret = ::android::aidl::compile_aidl(options, io_delegate_);
+    return std::make_pair(ret, TakeCapturedStderr());
+  };
+  const auto sequential = compile("-j 1");
+  EXPECT_NE(0, sequential.first);
+  EXPECT_NE("", sequential.second);
+  EXPECT_EQ(sequential, compile("-j 4"));
+
+  // Without a cache, the imports are parsed ahead on their own
+  auto load = [&](const string& jobs) {
+    TakeCapturedStderr();
+    Options options = Options::From("aidl --lang=cpp -I . " + jobs + " -o out -h out p/IFoo.aidl");
+    AidlTypenames typenames;
+    vector<AidlDefinedType*> types;
+    const AidlError err = ::android::aidl::internals::load_and_validate_aidl(
+        "p/IFoo.aidl", options, io_delegate_, &typenames, &types, nullptr /* imported_files */);
+    return std::make_pair(err, TakeCapturedStderr());
+  };
+  const auto loaded = load("-j 1");
+  EXPECT_NE(AidlError::OK, loaded.first);
+  EXPECT_EQ(loaded, load("-j 4"));
+
+  io_delegate_.SetFileContents("q/A.aidl", "package q; parcelable A { int x = 1; }");
+  io_delegate_.SetFileContents("q/C.aidl", "package q; parcelable C { int z; }");
+  EXPECT_EQ(std::make_pair(0, string()), compile("-j 4"));
+}
+
+TEST_F(AidlTest, WritesVectorsOfFixedLayoutParcelablesAsOneBlock) {
+  io_delegate_.SetFileContents("p/Point.aidl",
+                               "package p; parcelable Point { int x; long y; boolean z; }");
+  io_delegate_.SetFileContents("p/Named.aidl", "package p; parcelable Named { String name; }");
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; import p.Point; import p.Named; interface IFoo {"
+                               " Point[] repeat(in Point[] a, out Point[] b, in Named[] c); }");
+  Options options = Options::From(
+      "aidl --lang=cpp --parcel-traits -I . -o out -h out p/Point.aidl p/Named.aidl p/IFoo.aidl");
+  EXPECT_TRUE(options.ParcelTraits());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+
+  string header;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Point.h", &header));
+  // 1 for non-null, the size and 16 bytes of fields.
+  EXPECT_NE(string::npos, header.find("static constexpr size_t kParcelSize = 24;"));
+  EXPECT_NE(string::npos, header.find("static ::android::status_t readVectorFromParcel("));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Point.cpp", &code));
+  EXPECT_NE(string::npos,
+            code.find("_aidl_parcel->writeInplace(_aidl_vector.size() * kParcelSize)"));
+  EXPECT_NE(string::npos, code.find("memcpy(_aidl_run + 12, &_aidl_element.y, "));
+  EXPECT_NE(string::npos, code.find("_aidl_element.z = _aidl_value != 0;"));
+  EXPECT_NE(string::npos, code.find("return _aidl_parcel->readParcelableVector(_aidl_vector);"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Named.h", &header));
+  EXPECT_EQ(string::npos, header.find("kParcelSize"));
+
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("::p::Point::writeVectorToParcel(&_aidl_data, a)"));
+  EXPECT_NE(string::npos, code.find("::p::Point::readVectorFromParcel(&_aidl_reply, b)"));
+  EXPECT_NE(string::npos, code.find("::p::Point::readVectorFromParcel(&_aidl_data, &in_a)"));
+  EXPECT_NE(string::npos, code.find("::p::Point::writeVectorToParcel(_aidl_reply, _aidl_return)"));
+  EXPECT_NE(string::npos, code.find("_aidl_data.writeParcelableVector(c)"));
+}
+
+TEST_F(AidlTest, PassesInArgumentsByValueToMoveThemIntoTheImplementation) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo {"
+                               " void foo(in int[] a, String b, int c, out int[] d); }");
+  Options options =
+      Options::From("aidl --lang=cpp --in-args-by-value -I . -o out -h out p/IFoo.aidl");
+  EXPECT_TRUE(options.InArgsByValue());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+
+  string header;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &header));
+  const string signature =
+      "foo(::std::vector<int32_t> a, ::android::String16 b, int32_t c, "
+      "::std::vector<int32_t>* d)";
+  EXPECT_NE(string::npos, header.find("virtual ::android::binder::Status " + signature + " = 0;"));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("::android::binder::Status BpFoo::" + signature + " {"));
+  EXPECT_NE(string::npos, code.find("foo(std::move(in_a), std::move(in_b), in_c, &out_d)"));
+  EXPECT_NE(string::npos, code.find("getDefaultImpl()->foo(std::move(a), std::move(b), c, d)"));
+
+  Options by_reference = Options::From("aidl --lang=cpp -I . -o out2 -h out2 p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(by_reference, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out2/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("foo(in_a, in_b, in_c, &out_d)"));
+}
+
+TEST_F(AidlTest, RunServer) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  io_delegate_.SetFileContents("p/IBar.aidl", "package p; interface IBar { void bar(); }");
+  std::istringstream requests(
+      "aidl --lang=java -o out p/IFoo.aidl\n"
+      "\n"
+      "aidl --lang=java -o out p/IBar.aidl p/IMissing.aidl\n"
+      "aidl --lang=cpp -o out -h out p/IBar.aidl\n");
+  std::ostringstream responses;
+  EXPECT_EQ(0, run_server(io_delegate_, requests, responses));
+  EXPECT_EQ("0 0\n1 0\n0 0\n", responses.str());
+
+  string content;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &content));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IBar.cpp", &content));
+}
+
+TEST_F(AidlTest, RunServerAnswersEditorRequests) {
+  io_delegate_.SetFileContents("p/Bar.aidl", "package p; parcelable Bar { int x; }");
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p;\n"
+                               "import p.Bar;\n"
+                               "interface IFoo {\n"
+                               "  List<Bar> foo(in Bar bar);\n"
+                               "}\n");
+  std::istringstream requests(
+      "check aidl --lang=java -o out -I . p/IFoo.aidl\n"
+      "definition p/IFoo.aidl:4:8 aidl --lang=java -o out -I . p/IFoo.aidl\n"
+      "definition p/IFoo.aidl:4:20 aidl --lang=java -o out -I . p/IFoo.aidl\n"
+      "definition p/IFoo.aidl:4:3 aidl --lang=java -o out -I . p/IFoo.aidl\n");
+  std::ostringstream responses;
+  EXPECT_EQ(0, run_server(io_delegate_, requests, responses));
+  EXPECT_EQ("0 0\n0 23\n./p/Bar.aidl:1:22:1:26\n0 23\n./p/Bar.aidl:1:22:1:26\n1 0\n",
+            responses.str());
+
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; interface IFoo { void foo(in Baz baz); }");
+  std::istringstream edited("check aidl --lang=java -o out -I . p/IFoo.aidl\n");
+  std::ostringstream errors;
+  EXPECT_EQ(0, run_server(io_delegate_, edited, errors));
+  EXPECT_EQ("1 52\nERROR: p/IFoo.aidl:1.40-44: Failed to resolve 'Baz'\n", errors.str());
+}
+
+TEST_F(AidlTest, RunServerRunsEachRequestOnItsOwn) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  std::istringstream requests(
+      "aidl --lang=java -o out p/IMissing.aidl\n"
+      "aidl --lang=java -o out p/IFoo.aidl\n");
+  std::ostringstream responses;
+  EXPECT_EQ(0, run_server(io_delegate_, requests, responses));
+  EXPECT_EQ("1 0\n0 0\n", responses.str());
+  EXPECT_FALSE(::AidlError::hadError());
+
+  std::istringstream per_request(
+      "aidl --lang=java --write-if-changed -o out p/IFoo.aidl\n"
+      "check aidl --lang=java --profile=profile.json p/IFoo.aidl\n");
+  std::ostringstream rejected;
+  EXPECT_EQ(0, run_server(io_delegate_, per_request, rejected));
+  EXPECT_NE(string::npos, TakeCapturedStderr().find("but not to one of its commands"));
+  EXPECT_EQ("1 0\n1 0\n", rejected.str());
+}
+
+TEST_F(AidlTest, RunBatch) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  io_delegate_.SetFileContents("p/IBar.aidl", "package p; interface IBar { void bar(); }");
+  io_delegate_.SetFileContents("manifest",
+                               "# Java first\n"
+                               "aidl --lang=java -o out p/IFoo.aidl\n"
+                               "\n"
+                               "aidl --lang=cpp -o out -h out p/IBar.aidl\n");
+  Options options = Options::From("aidl --batch manifest");
+  EXPECT_EQ(0, run_batch(options, io_delegate_));
+  string content;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &content));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IBar.cpp", &content));
+
+  io_delegate_.SetFileContents("failing",
+                               "aidl --lang=java -o out2 p/IMissing.aidl\n"
+                               "aidl --lang=java -o out2 p/IFoo.aidl\n");
+  Options failing = Options::From("aidl --batch failing");
+  EXPECT_EQ(1, run_batch(failing, io_delegate_));
+  EXPECT_FALSE(io_delegate_.GetWrittenContents("out2/p/IFoo.java", &content));
+}
+
+TEST_F(AidlTest, WritesCodegenReport) {
+  io_delegate_.SetFileContents("p/Baz.aidl", "package p; parcelable Baz { int x; }");
+  io_delegate_.SetFileContents("p/Bar.aidl",
+                               "package p; import p.Baz; parcelable Bar { Baz baz; }");
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; import p.Bar; import p.Baz; interface IFoo {\n"
+                               "  Bar foo(in Bar a, out int[] b);\n"
+                               "  oneway void bar();\n"
+                               "}\n");
+  Options options = Options::From(
+      "aidl --lang=java --java-dispatch-table --codegen-report=report.json -I . -o out "
+      "p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.java", &code));
+  string report;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("report.json", &report));
+  EXPECT_EQ(0u, report.find("{\"backend\":\"java\",\"types\":[\n{\"type\":\"p.IFoo\""));
+  EXPECT_NE(string::npos,
+            report.find(StringPrintf("{\"path\":\"out/p/IFoo.java\",\"lines\":%zu,\"bytes\":%zu}",
+                                     std::count(code.begin(), code.end(), '\n'), code.size())));
+  EXPECT_NE(string::npos,
+            report.find("{\"name\":\"foo\",\"id\":0,\"oneway\":false,\"parcel_writes\":2,"
+                        "\"parcel_reads\":3,\"nested_parcelable_depth\":2,\"outlined\":true}"));
+  EXPECT_NE(string::npos,
+            report.find("{\"name\":\"bar\",\"id\":1,\"oneway\":true,\"parcel_writes\":1,"
+                        "\"parcel_reads\":0,\"nested_parcelable_depth\":0,\"outlined\":true}"));
+}
+
+TEST_F(AidlTest, MakesDescriptorsOnFirstUse) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  Options eager = Options::From(
+      "aidl --lang=cpp --codegen-report=eager.json -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(eager, io_delegate_));
+  string report;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("eager.json", &report));
+  EXPECT_NE(string::npos, report.find("\"static_initializers\":[\"IFoo::descriptor\"]"));
+
+  Options cpp = Options::From(
+      "aidl --lang=cpp --lazy-descriptors --codegen-report=lazy.json -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(cpp, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.h", &code));
+  EXPECT_EQ(string::npos, code.find("DECLARE_META_INTERFACE(Foo)"));
+  EXPECT_NE(string::npos, code.find("static constexpr _aidl_Descriptor descriptor{};\n"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_EQ(string::npos, code.find("IMPLEMENT_META_INTERFACE"));
+  EXPECT_NE(string::npos, code.find("IFoo::_aidl_Descriptor::operator const ::android::String16&"
+                                    "() const {\n"
+                                    "  static const ::android::String16 value(u\"p.IFoo\");\n"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("lazy.json", &report));
+  EXPECT_NE(string::npos, report.find("\"static_initializers\":[]"));
+
+  Options ndk =
+      Options::From("aidl --lang=ndk --lazy-descriptors -o out -h out p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(ndk, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("static AIBinder_Class* _g_aidl_clazz() {\n"));
+  EXPECT_NE(string::npos, code.find("AIBinder_new(_g_aidl_clazz(), "));
+}
+
+TEST_F(AidlTest, ReusesCachedOutputs) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  Options options =
+      Options::From("aidl --lang=cpp --output-cache=cache -o out1 -h include1 p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out1/p/IFoo.cpp", &code));
+  string entry_path;
+  for (const string& file : io_delegate_.ListOutputFiles()) {
+    if (android::base::StartsWith(file, "cache/")) {
+      entry_path = file;
+    }
+  }
+  string entry;
+  ASSERT_TRUE(io_delegate_.GetWrittenContents(entry_path, &entry));
+  EXPECT_NE(string::npos, entry.find("\no p/IFoo.cpp\n"));
+  EXPECT_NE(string::npos, entry.find("\nh p/BpFoo.h\n"));
+
+  // A hit copies the cached code, here marked, instead of generating it.
+  const size_t pos = entry.find("BpFoo::BpFoo");
+  ASSERT_NE(string::npos, pos);
+  entry.replace(pos, 12, "BpFoo::BpFoX");
+  io_delegate_.SetFileContents(entry_path, entry);
+  Options again =
+      Options::From("aidl --lang=cpp --output-cache=cache -o out2 -h include2 p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(again, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out2/p/IFoo.cpp", &code));
+  EXPECT_NE(string::npos, code.find("BpFoo::BpFoX"));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("include2/p/BnFoo.h", nullptr));
+
+  // Flags that change the code change the key.
+  Options traced =
+      Options::From("aidl --lang=cpp --output-cache=cache -t -o out3 -h out3 p/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(traced, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out3/p/IFoo.cpp", &code));
+  EXPECT_EQ(string::npos, code.find("BpFoo::BpFoX"));
+}
+
 TEST_F(AidlTest, PreferImportToPreprocessed) {
   io_delegate_.SetFileContents("preprocessed", "interface another.IBar;");
   io_delegate_.SetFileContents("one/IBar.aidl", "package one; "
@@ -494,6 +2222,121 @@ TEST_F(AidlTest, WritePreprocessedFile) {
   EXPECT_EQ("parcelable p.Outer.Inner;\ninterface one.IBar;\n", output);
 }
 
+TEST_F(AidlTest, ScansDeclarationsForPreprocessedFile) {
+  io_delegate_.SetFileContents("p/Outer.aidl",
+                               "package p; parcelable Outer.Inner cpp_header \"a{.h\";");
+  io_delegate_.SetFileContents("one/IBar.aidl",
+                               "/* } */ package one; import p.Outer;\n"
+                               "@DispatchOn(pool=\"(\") oneway interface IBar {\n"
+                               "  // }\n"
+                               "  const String S = \"}\";\n"
+                               "  const char C = '}';\n"
+                               "}");
+  io_delegate_.SetFileContents("one/Data.aidl",
+                               "package one; parcelable Data { int a; } enum E { A }");
+  const string inputs = " p/Outer.aidl one/IBar.aidl one/Data.aidl";
+
+  Options parsed = Options::From("aidl --preprocess parsed" + inputs);
+  EXPECT_TRUE(::android::aidl::preprocess_aidl(parsed, io_delegate_));
+  Options scanned = Options::From("aidl --preprocess --scan-declarations -j 2 scanned" + inputs);
+  EXPECT_TRUE(scanned.Ok());
+  EXPECT_TRUE(::android::aidl::preprocess_aidl(scanned, io_delegate_));
+
+  string parsed_output;
+  string scanned_output;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("parsed", &parsed_output));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("scanned", &scanned_output));
+  EXPECT_EQ(parsed_output, scanned_output);
+
+  // Errors inside the bodies are skipped, but files that the scan doesn't
+  // understand go to the parser, which reports the error.
+  io_delegate_.SetFileContents("one/IBad.aidl", "package one; interface IBad { void f() }");
+  Options bad = Options::From("aidl --preprocess --scan-declarations bad one/IBad.aidl");
+  EXPECT_TRUE(::android::aidl::preprocess_aidl(bad, io_delegate_));
+  io_delegate_.SetFileContents("one/IWorse.aidl", "package one; interface IWorse { ");
+  Options worse = Options::From("aidl --preprocess --scan-declarations worse one/IWorse.aidl");
+  EXPECT_FALSE(::android::aidl::preprocess_aidl(worse, io_delegate_));
+
+  EXPECT_FALSE(Options::From("aidl --lang=java --scan-declarations -o out p/Outer.aidl").Ok());
+}
+
+TEST_F(AidlTest, WriteAndReadBinaryPreprocessedFile) {
+  io_delegate_.SetFileContents("p/Outer.aidl", "package p; parcelable Outer.Inner;");
+  io_delegate_.SetFileContents("one/IBar.aidl", "package one; interface IBar {}");
+  io_delegate_.SetFileContents("one/Data.aidl", "package one; parcelable Data { int a; }");
+  Options options = Options::From(
+      "aidl --preprocess --binary-preprocessed preprocessed p/Outer.aidl one/IBar.aidl "
+      "one/Data.aidl");
+  EXPECT_TRUE(options.Ok());
+  EXPECT_TRUE(::android::aidl::preprocess_aidl(options, io_delegate_));
+
+  string output;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("preprocessed", &output));
+  EXPECT_EQ(0u, output.find("AIDLTYP1"));
+
+  // Loads the same as the text form
+  io_delegate_.SetFileContents("binary", output);
+  io_delegate_.SetFileContents("text",
+                               "parcelable p.Outer.Inner;\n"
+                               "interface one.IBar;\n"
+                               "structured_parcelable one.Data;\n");
+  AidlTypenames from_binary;
+  AidlTypenames from_text;
+  EXPECT_TRUE(parse_preprocessed_file(io_delegate_, "binary", &from_binary));
+  EXPECT_TRUE(parse_preprocessed_file(io_delegate_, "text", &from_text));
+  for (const auto name : {"p.Outer.Inner", "one.IBar", "one.Data"}) {
+    const AidlDefinedType* binary_type = from_binary.TryGetDefinedType(name);
+    const AidlDefinedType* text_type = from_text.TryGetDefinedType(name);
+    ASSERT_NE(nullptr, binary_type) << name;
+    ASSERT_NE(nullptr, text_type) << name;
+    EXPECT_EQ(text_type->GetPreprocessDeclarationName(),
+              binary_type->GetPreprocessDeclarationName());
+  }
+
+  io_delegate_.SetFileContents("truncated", output.substr(0, output.size() - 4));
+  AidlTypenames from_truncated;
+  EXPECT_FALSE(parse_preprocessed_file(io_delegate_, "truncated", &from_truncated));
+}
+
+TEST_F(AidlTest, ReadsNestedStructuredParcelablesWithoutTheirCreator) {
+  io_delegate_.SetFileContents("p/Inner.aidl", "package p; parcelable Inner { int a; }");
+  io_delegate_.SetFileContents("p/Unstructured.aidl", "package p; parcelable Unstructured;");
+  io_delegate_.SetFileContents("p/Outer.aidl",
+                               "package p; import p.Inner; import p.Unstructured; parcelable Outer "
+                               "{ Inner a; Inner[] b; List<Inner> c; Unstructured d; }");
+  Options options = Options::From("aidl --lang=java -I . -o out p/Outer.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Outer.java", &code));
+  EXPECT_NE(string::npos, code.find("a = p.Inner.readFrom(_aidl_parcel);"));
+  EXPECT_NE(string::npos, code.find("b[_aidl_i] = (0!=_aidl_parcel.readInt()) ? "
+                                    "p.Inner.readFrom(_aidl_parcel) : null;"));
+  EXPECT_NE(string::npos, code.find("c.add((0!=_aidl_parcel.readInt()) ? "
+                                    "p.Inner.readFrom(_aidl_parcel) : null);"));
+  EXPECT_NE(string::npos, code.find("d = p.Unstructured.CREATOR.createFromParcel(_aidl_parcel);"));
+}
+
+TEST_F(AidlTest, WritesTheSizeOfFixedSizeJavaParcelablesUpFront) {
+  io_delegate_.SetFileContents("p/Fixed.aidl",
+                               "package p; parcelable Fixed { int a; long b; boolean c; }");
+  io_delegate_.SetFileContents("p/Variable.aidl",
+                               "package p; import p.Fixed; parcelable Variable { "
+                               "int a; String b; byte[] c; long[] d; Fixed e; IBinder f; }");
+  Options options = Options::From("aidl --lang=java -I . -o out p/Fixed.aidl p/Variable.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string code;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Fixed.java", &code));
+  EXPECT_NE(string::npos, code.find("_aidl_parcel.writeInt(20);\n    _aidl_parcel.writeInt(a);"));
+  EXPECT_EQ(string::npos, code.find("setDataPosition(_aidl_end_pos)"));
+
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out/p/Variable.java", &code));
+  EXPECT_NE(string::npos, code.find("int _aidl_start_pos = _aidl_parcel.dataPosition();\n"
+                                    "    _aidl_parcel.writeInt(0);"));
+  EXPECT_NE(string::npos, code.find("setDataPosition(_aidl_end_pos)"));
+  EXPECT_EQ(string::npos, code.find("estimatedSize"));
+  EXPECT_EQ(string::npos, code.find("setDataCapacity"));
+}
+
 TEST_F(AidlTest, JavaParcelableOutput) {
   io_delegate_.SetFileContents(
       "Rect.aidl",
@@ -586,6 +2429,23 @@ TEST_F(AidlTest, FailOnDuplicateConstantNames) {
   EXPECT_EQ(AidlError::BAD_TYPE, reported_error);
 }
 
+TEST_F(AidlTest, ReportsAllInvalidMembers) {
+  AidlError reported_error;
+  EXPECT_EQ(nullptr, Parse("p/IFoo.aidl",
+                           "package p; interface IFoo {\n"
+                           "  oneway int foo();\n"
+                           "  void bar(int a, int a);\n"
+                           "  void baz(int _aidl_x, out int y);\n"
+                           "}\n",
+                           typenames_, Options::Language::CPP, &reported_error));
+  EXPECT_EQ(AidlError::BAD_TYPE, reported_error);
+  const string errors = TakeCapturedStderr();
+  EXPECT_NE(string::npos, errors.find("oneway method 'foo' cannot return a value"));
+  EXPECT_NE(string::npos, errors.find("method 'bar' has duplicate argument name 'a'"));
+  EXPECT_NE(string::npos, errors.find("Argument name cannot begin with '_aidl'"));
+  EXPECT_NE(string::npos, errors.find("can only be an in parameter."));
+}
+
 TEST_F(AidlTest, FailOnManyDefinedTypes) {
   AidlError reported_error;
   AddExpectedStderr("ERROR: p/IFoo.aidl: You must declare only one type per a file.\n");
@@ -1027,6 +2887,18 @@ TEST_F(AidlTest, UserDefinedUnstructuredGenericParcelableType) {
   EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
 }
 
+TEST_F(AidlTest, RejectsGenericParcelablesInNativeBackends) {
+  io_delegate_.SetFileContents("p/Bar.aidl", "package p; parcelable Bar<T, V>;");
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p; import p.Bar; interface IFoo { Bar<int, String> foo(); }");
+  for (const string lang : {"cpp", "ndk"}) {
+    Options options = Options::From("aidl --lang=" + lang + " -I . -o out -h out p/IFoo.aidl");
+    EXPECT_NE(0, ::android::aidl::compile_aidl(options, io_delegate_));
+    EXPECT_NE(string::npos,
+              TakeCapturedStderr().find("only the Java backend supports generic parcelable"));
+  }
+}
+
 TEST_F(AidlTest, FailOnMultipleTypesInSingleFile) {
   std::vector<std::string> rawOptions{"aidl --lang=java -o out foo/bar/Foo.aidl",
                                       "aidl --lang=cpp -o out -h out/include foo/bar/Foo.aidl"};
@@ -1110,6 +2982,107 @@ TEST_F(AidlTest, MultipleInputFilesCpp) {
   }
 }
 
+TEST_F(AidlTest, MultipleInputFilesSharingImports) {
+  io_delegate_.SetFileContents("foo/bar/IFoo.aidl",
+                               "package foo.bar;\n"
+                               "import foo.bar.Data;\n"
+                               "interface IFoo { Data getData(); }\n");
+  io_delegate_.SetFileContents("foo/bar/IBar.aidl",
+                               "package foo.bar;\n"
+                               "import foo.bar.Data;\n"
+                               "interface IBar { void setData(in Data d); }\n");
+  io_delegate_.SetFileContents("imports/foo/bar/Data.aidl",
+                               "package foo.bar;\n"
+                               "parcelable Data { int x; }\n");
+
+  // Compiling the files together must generate the same code as compiling them one by one.
+  Options together = Options::From(
+      "aidl --lang=cpp -o together -h together -I imports foo/bar/IFoo.aidl foo/bar/IBar.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(together, io_delegate_));
+  Options foo_alone =
+      Options::From("aidl --lang=cpp -o alone -h alone -I imports foo/bar/IFoo.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(foo_alone, io_delegate_));
+  Options bar_alone =
+      Options::From("aidl --lang=cpp -o alone -h alone -I imports foo/bar/IBar.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(bar_alone, io_delegate_));
+
+  for (const auto file : {"foo/bar/IFoo.cpp", "foo/bar/IFoo.h", "foo/bar/IBar.cpp",
+                          "foo/bar/IBar.h"}) {
+    string expected;
+    string actual;
+    EXPECT_TRUE(io_delegate_.GetWrittenContents(string("alone/") + file, &expected));
+    EXPECT_TRUE(io_delegate_.GetWrittenContents(string("together/") + file, &actual));
+    EXPECT_EQ(expected, actual) << file;
+  }
+}
+
+TEST_F(AidlTest, WritesCombinedDependencyFile) {
+  io_delegate_.SetFileContents("foo/bar/IFoo.aidl",
+                               "package foo.bar;\n"
+                               "import foo.bar.Data;\n"
+                               "interface IFoo { Data getData(); }\n");
+  io_delegate_.SetFileContents("foo/bar/IBar.aidl",
+                               "package foo.bar;\n"
+                               "import foo.bar.Data;\n"
+                               "interface IBar { void setData(in Data d); }\n");
+  io_delegate_.SetFileContents("imports/foo/bar/Data.aidl",
+                               "package foo.bar;\n"
+                               "parcelable Data { int x; }\n");
+
+  // The import shared by both inputs is listed only once.
+  Options options = Options::From(
+      "aidl --lang=java --ninja --combined-dep=dep/file/path -o out -I imports "
+      "foo/bar/IFoo.aidl foo/bar/IBar.aidl");
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(options, io_delegate_));
+  string actual_dep_file_contents;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("dep/file/path", &actual_dep_file_contents));
+  EXPECT_EQ(
+      "out/foo/bar/IFoo.java out/foo/bar/IBar.java : \\\n"
+      "  foo/bar/IFoo.aidl \\\n"
+      "  foo/bar/IBar.aidl \\\n"
+      "  imports/foo/bar/Data.aidl\n",
+      actual_dep_file_contents);
+}
+
+TEST_F(AidlTest, MultipleInputFilesWithJobs) {
+  const vector<string> files = {"foo/bar/IFoo", "foo/bar/IBar", "foo/bar/Data", "foo/bar/Enum"};
+  io_delegate_.SetFileContents("foo/bar/IFoo.aidl",
+                               "package foo.bar;\n"
+                               "import foo.bar.Data;\n"
+                               "import foo.bar.Enum;\n"
+                               "interface IFoo { Data getData(); Enum getEnum(); }\n");
+  io_delegate_.SetFileContents("foo/bar/IBar.aidl",
+                               "package foo.bar;\n"
+                               "import foo.bar.Data;\n"
+                               "import foo.bar.IFoo;\n"
+                               "interface IBar { void setFoo(IFoo foo, in Data d); }\n");
+  io_delegate_.SetFileContents("foo/bar/Data.aidl",
+                               "package foo.bar;\n"
+                               "import foo.bar.Enum;\n"
+                               "parcelable Data { int x; Enum e; }\n");
+  io_delegate_.SetFileContents("foo/bar/Enum.aidl",
+                               "package foo.bar;\n"
+                               "@Backing(type=\"int\") enum Enum { A, B }\n");
+  const string inputs = " -I . foo/bar/IFoo.aidl foo/bar/IBar.aidl foo/bar/Data.aidl "
+                        "foo/bar/Enum.aidl";
+
+  Options serial = Options::From("aidl --lang=cpp -o serial -h serial" + inputs);
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(serial, io_delegate_));
+  Options parallel = Options::From("aidl --lang=cpp -j 3 -o parallel -h parallel" + inputs);
+  EXPECT_EQ(3u, parallel.Jobs());
+  EXPECT_EQ(0, ::android::aidl::compile_aidl(parallel, io_delegate_));
+
+  for (const auto& file : files) {
+    for (const auto& ext : {".cpp", ".h"}) {
+      string expected;
+      string actual;
+      EXPECT_TRUE(io_delegate_.GetWrittenContents("serial/" + file + ext, &expected));
+      EXPECT_TRUE(io_delegate_.GetWrittenContents("parallel/" + file + ext, &actual));
+      EXPECT_EQ(expected, actual) << file << ext;
+    }
+  }
+}
+
 TEST_F(AidlTest, ConflictWithMetaTransactions) {
   Options options = Options::From("aidl --lang=java -o place/for/output p/IFoo.aidl");
   // int getInterfaceVersion() is one of the meta transactions
@@ -1148,6 +3121,17 @@ TEST_F(AidlTest, DifferentOrderAnnotationsInCheckAPI) {
   EXPECT_TRUE(::android::aidl::check_api(options, io_delegate_));
 }
 
+TEST_F(AidlTest, AddsButDoesNotRemoveUtf8StringsInCheckAPI) {
+  Options options = Options::From("aidl --checkapi old new");
+  io_delegate_.SetFileContents("old/p/IFoo.aidl", "package p; interface IFoo{ void foo();}");
+  io_delegate_.SetFileContents("new/p/IFoo.aidl",
+                               "package p; @Utf8Strings interface IFoo{ void foo();}");
+  EXPECT_TRUE(::android::aidl::check_api(options, io_delegate_));
+
+  Options reversed = Options::From("aidl --checkapi new old");
+  EXPECT_FALSE(::android::aidl::check_api(reversed, io_delegate_));
+}
+
 TEST_F(AidlTest, SuccessOnIdenticalApiDumps) {
   Options options = Options::From("aidl --checkapi old new");
   io_delegate_.SetFileContents("old/p/IFoo.aidl", "package p; interface IFoo{ void foo();}");
@@ -1525,6 +3509,163 @@ TEST_F(AidlTestIncompatibleChanges, ChangedConstValue) {
   EXPECT_FALSE(::android::aidl::check_api(options_, io_delegate_));
 }
 
+TEST_F(AidlTestIncompatibleChanges, ParallelCheckReportsErrorsInOrder) {
+  for (const char* name : {"A", "B", "C", "D", "E", "F"}) {
+    const string type = string("I") + name;
+    io_delegate_.SetFileContents("old/p/" + type + ".aidl",
+                                 "package p; interface " + type + " { void foo(); void bar(); }");
+    io_delegate_.SetFileContents("new/p/" + type + ".aidl",
+                                 "package p; interface " + type + " { void foo(); }");
+  }
+  TakeCapturedStderr();
+  EXPECT_FALSE(::android::aidl::check_api(options_, io_delegate_));
+  const string serial_errors = TakeCapturedStderr();
+  EXPECT_NE(string::npos, serial_errors.find("p.IA.bar"));
+
+  Options parallel = Options::From("aidl --checkapi --jobs=4 old new");
+  EXPECT_FALSE(::android::aidl::check_api(parallel, io_delegate_));
+  EXPECT_EQ(serial_errors, TakeCapturedStderr());
+}
+
+TEST_F(AidlTest, DumpApiWritesTypeHashes) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  io_delegate_.SetFileContents("p/Data.aidl", "package p; parcelable Data { int a; }");
+  Options options = Options::From("aidl --dumpapi -o dump p/IFoo.aidl p/Data.aidl");
+  ASSERT_TRUE(dump_api(options, io_delegate_));
+  string hashes;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents(string("dump/") + kApiTypeHashesFile, &hashes));
+  const vector<string> lines = android::base::Split(hashes, "\n");
+  ASSERT_EQ(3u, lines.size());
+  EXPECT_TRUE(android::base::StartsWith(lines[0], "p.Data "));
+  EXPECT_TRUE(android::base::StartsWith(lines[1], "p.IFoo "));
+  EXPECT_EQ(23u, lines[1].size());
+  EXPECT_EQ("", lines[2]);
+
+  // The hash depends only on the dumped text.
+  Options again = Options::From("aidl --dumpapi -o dump2 p/IFoo.aidl");
+  ASSERT_TRUE(dump_api(again, io_delegate_));
+  string hashes2;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents(string("dump2/") + kApiTypeHashesFile, &hashes2));
+  EXPECT_EQ(lines[1] + "\n", hashes2);
+}
+
+TEST_F(AidlTest, DumpApiSkipsUnchangedFiles) {
+  io_delegate_.SetFileContents("p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  io_delegate_.SetFileContents("p/IBar.aidl", "package p; interface IBar { void bar(); }");
+  Options options = Options::From("aidl --dumpapi -j 2 -o dump p/IFoo.aidl p/IBar.aidl");
+  ASSERT_TRUE(dump_api(options, io_delegate_));
+  string foo;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("dump/p/IFoo.aidl", &foo));
+  EXPECT_NE(string::npos, foo.find("package p;\ninterface IFoo {\n  void foo();\n}\n"));
+
+  io_delegate_.SetFileContents("again/p/IFoo.aidl", foo);
+  Options again = Options::From("aidl --dumpapi -j 2 -o again p/IFoo.aidl p/IBar.aidl");
+  ASSERT_TRUE(dump_api(again, io_delegate_));
+  EXPECT_FALSE(io_delegate_.GetWrittenContents("again/p/IFoo.aidl", nullptr));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("again/p/IBar.aidl", nullptr));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents(string("again/") + kApiTypeHashesFile, nullptr));
+}
+
+TEST_F(AidlTest, DumpMappingsSortsSignatures) {
+  io_delegate_.SetFileContents("p/IFoo.aidl",
+                               "package p;\ninterface IFoo {\n  String foo(in int[] a);\n"
+                               "  void bar(in List<String> b, in p.IBar c);\n}\n");
+  io_delegate_.SetFileContents("p/IBar.aidl", "package p;\ninterface IBar { void bar(); }");
+  Options options = Options::From("aidl --apimapping out.txt -I . p/IFoo.aidl p/IBar.aidl");
+  ASSERT_TRUE(dump_mappings(options, io_delegate_));
+  string mappings;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("out.txt", &mappings));
+  EXPECT_EQ(
+      "p.IBar|bar||void\n"
+      "p/IBar.aidl:2\n"
+      "p.IFoo|bar|java.util.List<java.lang.String>,p.IBar,|void\n"
+      "p/IFoo.aidl:4\n"
+      "p.IFoo|foo|int[],|java.lang.String\n"
+      "p/IFoo.aidl:3\n",
+      mappings);
+}
+
+TEST_F(AidlTest, CheckApiSkipsTypesWithSameHashes) {
+  Options options = Options::From("aidl --checkapi old new");
+  io_delegate_.SetFileContents("old/p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  io_delegate_.SetFileContents("new/p/IFoo.aidl", "package p; interface IFoo { }");
+  io_delegate_.SetFileContents("old/p/IBar.aidl", "package p; interface IBar { void bar(); }");
+  io_delegate_.SetFileContents("new/p/IBar.aidl", "package p; interface IBar { }");
+  EXPECT_FALSE(::android::aidl::check_api(options, io_delegate_));
+
+  // IFoo has the same hash in both dumps, so only the removal from IBar counts.
+  io_delegate_.SetFileContents(string("old/") + kApiTypeHashesFile,
+                               "p.IBar 0000000000000001\np.IFoo 0123456789abcdef\n");
+  io_delegate_.SetFileContents(string("new/") + kApiTypeHashesFile,
+                               "p.IBar 0000000000000002\np.IFoo 0123456789abcdef\n");
+  TakeCapturedStderr();
+  EXPECT_FALSE(::android::aidl::check_api(options, io_delegate_));
+  const string errors = TakeCapturedStderr();
+  EXPECT_NE(string::npos, errors.find("p.IBar.bar"));
+  EXPECT_EQ(string::npos, errors.find("p.IFoo.foo"));
+
+  io_delegate_.SetFileContents("new/p/IBar.aidl", "package p; interface IBar { void bar(); }");
+  EXPECT_TRUE(::android::aidl::check_api(options, io_delegate_));
+}
+
+TEST_F(AidlTest, CheckApiChecksEachVersionAgainstThePreviousOne) {
+  Options options = Options::From("aidl --checkapi -j 2 v1 v2 v3");
+  ASSERT_TRUE(options.Ok());
+  io_delegate_.SetFileContents("v1/p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  io_delegate_.SetFileContents("v2/p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  io_delegate_.SetFileContents("v3/p/IFoo.aidl",
+                               "package p; interface IFoo { void foo(); void bar(); }");
+  io_delegate_.SetFileContents("v1/p/IBar.aidl", "package p; interface IBar { }");
+  io_delegate_.SetFileContents("v2/p/IBar.aidl", "package p; interface IBar { void bar(); }");
+  io_delegate_.SetFileContents("v3/p/IBar.aidl", "package p; interface IBar { }");
+  // IFoo is the same in v1 and v2, so v2 still loads it for checking v3.
+  io_delegate_.SetFileContents(string("v1/") + kApiTypeHashesFile,
+                               "p.IBar 0000000000000001\np.IFoo 0123456789abcdef\n");
+  io_delegate_.SetFileContents(string("v2/") + kApiTypeHashesFile,
+                               "p.IBar 0000000000000002\np.IFoo 0123456789abcdef\n");
+  TakeCapturedStderr();
+  EXPECT_FALSE(::android::aidl::check_api(options, io_delegate_));
+  const string errors = TakeCapturedStderr();
+  EXPECT_NE(string::npos, errors.find("p.IBar.bar"));
+  EXPECT_NE(string::npos, errors.find("Not backwards compatible with v2"));
+  EXPECT_EQ(string::npos, errors.find("with v1"));
+
+  io_delegate_.SetFileContents("v3/p/IBar.aidl", "package p; interface IBar { void bar(); }");
+  EXPECT_TRUE(::android::aidl::check_api(options, io_delegate_));
+
+  EXPECT_FALSE(Options::From("aidl --checkapi v1").Ok());
+}
+
+TEST_F(AidlTest, ComputesApiHashFromParsedTypes) {
+  io_delegate_.SetFileContents("api/p/IFoo.aidl", "package p; interface IFoo { void foo(); }");
+  io_delegate_.SetFileContents("api/p/Data.aidl", "package p; parcelable Data { int a; }");
+  Options options = Options::From("aidl --compute-hash --jobs=2 hash api");
+  ASSERT_TRUE(options.Ok());
+  EXPECT_TRUE(::android::aidl::compute_api_hash(options, io_delegate_));
+  string hash;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("hash", &hash));
+  EXPECT_EQ(41u, hash.size());
+
+  // Formatting and comments do not change the hash.
+  io_delegate_.SetFileContents("api/p/IFoo.aidl",
+                               "// comment\npackage p;\ninterface IFoo {\n  void foo( );\n}\n");
+  EXPECT_TRUE(::android::aidl::compute_api_hash(options, io_delegate_));
+  string same_hash;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("hash", &same_hash));
+  EXPECT_EQ(hash, same_hash);
+
+  // But the version and the types do.
+  Options versioned = Options::From("aidl --compute-hash --version=2 hash api");
+  EXPECT_TRUE(::android::aidl::compute_api_hash(versioned, io_delegate_));
+  string other_hash;
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("hash", &other_hash));
+  EXPECT_NE(hash, other_hash);
+  io_delegate_.SetFileContents("api/p/IFoo.aidl", "package p; interface IFoo { void bar(); }");
+  EXPECT_TRUE(::android::aidl::compute_api_hash(options, io_delegate_));
+  EXPECT_TRUE(io_delegate_.GetWrittenContents("hash", &other_hash));
+  EXPECT_NE(hash, other_hash);
+}
+
 TEST_F(AidlTest, RejectAmbiguousImports) {
   Options options = Options::From("aidl --lang=java -o out -I dir1 -I dir2 p/IFoo.aidl");
   io_delegate_.SetFileContents("p/IFoo.aidl", "package p; import q.IBar; interface IFoo{}");
@@ -1639,6 +3780,26 @@ TEST_F(AidlTest, FailOnAmbiguousImports) {
   EXPECT_NE(0, ::android::aidl::compile_aidl(options, io_delegate_));
 }
 
+TEST_F(AidlTest, ImportResolverSkipsRootsWithoutPackage) {
+  io_delegate_.SetFileContents("dir/p/IBar.aidl", "package p; interface IBar{}");
+  io_delegate_.SetFileContents("dir2/q/IBaz.aidl", "package q; interface IBaz{}");
+  io_delegate_.SetFileContents("dir3/p/IBar.aidl", "package p; interface IBar{}");
+  const string input_file = "IFoo.aidl";
+  ImportResolver resolver{io_delegate_, input_file, {"dir", "dir2"}, {}};
+  EXPECT_EQ("dir/p/IBar.aidl", resolver.FindImportFile("p.IBar"));
+  EXPECT_EQ("dir/p/IBar.aidl", resolver.FindImportFile("p.IBar"));
+  EXPECT_EQ("dir2/q/IBaz.aidl", resolver.FindImportFile("q.IBaz"));
+  EXPECT_EQ("", resolver.FindImportFile("r.IQux"));
+
+  // Duplicates are reported every time they are looked up
+  ImportResolver ambiguous{io_delegate_, input_file, {"dir", "dir3"}, {}};
+  for (int i = 0; i < 2; i++) {
+    TakeCapturedStderr();
+    EXPECT_EQ("", ambiguous.FindImportFile("p.IBar"));
+    EXPECT_NE(string::npos, TakeCapturedStderr().find("Duplicate files found for p.IBar"));
+  }
+}
+
 class AidlOutputPathTest : public AidlTest {
  protected:
   void SetUp() override {
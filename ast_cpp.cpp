@@ -41,6 +41,12 @@ void LiteralDecl::Write(CodeWriter* to) const {
   to->Write("%s", expression_.c_str());
 }
 
+StreamedDecl::StreamedDecl(std::function<void(CodeWriter&)> write) : write_(std::move(write)) {}
+
+void StreamedDecl::Write(CodeWriter* to) const {
+  write_(*to);
+}
+
 ClassDecl::ClassDecl(const std::string& name, const std::string& parent)
     : name_(name),
       parent_(parent) {}
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -61,6 +62,20 @@ class LiteralDecl : public Declaration {
   DISALLOW_COPY_AND_ASSIGN(LiteralDecl);
 };  // class LiteralDecl
 
+// A declaration that is written by a function when the document is written,
+// for code that doesn't need to be built as a tree of nodes first.
+class StreamedDecl : public Declaration {
+ public:
+  explicit StreamedDecl(std::function<void(CodeWriter&)> write);
+  ~StreamedDecl() = default;
+  void Write(CodeWriter* to) const override;
+
+ private:
+  const std::function<void(CodeWriter&)> write_;
+
+  DISALLOW_COPY_AND_ASSIGN(StreamedDecl);
+};  // class StreamedDecl
+
 class ClassDecl : public Declaration {
  public:
   ClassDecl(const std::string& name,
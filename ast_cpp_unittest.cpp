@@ -258,6 +258,21 @@ TEST_F(AstCppTests, GeneratesMethodImpl) {
   CompareGeneratedCode(m, kExpectedMethodImplOutput);
 }
 
+TEST_F(AstCppTests, GeneratesStreamedDecl) {
+  StreamedDecl decl([](CodeWriter& out) {
+    out << "void foo() {\n";
+    out.Indent();
+    out << "bar();\n";
+    out.Dedent();
+    out << "}\n";
+  });
+  CppNamespace ns("ns", unique_ptr<Declaration>(new StreamedDecl([](CodeWriter& out) {
+    out << "int baz;\n";
+  })));
+  CompareGeneratedCode(decl, "void foo() {\n  bar();\n}\n");
+  CompareGeneratedCode(ns, "namespace ns {\n\nint baz;\n\n}  // namespace ns\n");
+}
+
 TEST_F(AstCppTests, ToString) {
   std::string literal = "void foo() {}";
   LiteralDecl decl(literal);
@@ -19,8 +19,11 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <memory>
+#include <new>
 #include <optional>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -60,6 +63,44 @@ struct AstNode {
   std::string ToString();
 };
 
+// Owns the nodes of the trees that are built for one file. Nodes are
+// allocated in large blocks and deleted all at once with the arena, so they
+// point to each other with plain pointers and cost neither a heap
+// allocation nor a reference count each.
+//
+// While an AstArena is alive, New() allocates in it on the same thread.
+class AstArena {
+ public:
+  AstArena();
+  ~AstArena();
+
+  // Returns the innermost arena that is alive on this thread.
+  static AstArena* Current();
+
+  void* Allocate(size_t size, size_t alignment);
+  void Adopt(AstNode* node) { nodes_.push_back(node); }
+
+ private:
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char* next_ = nullptr;
+  size_t available_ = 0;
+  std::vector<AstNode*> nodes_;
+  AstArena* const enclosing_;
+
+  AstArena(const AstArena&) = delete;
+  AstArena& operator=(const AstArena&) = delete;
+};
+
+// Makes a node in the current AstArena, which owns it.
+template <typename T, typename... Args>
+T* New(Args&&... args) {
+  static_assert(std::is_base_of<AstNode, T>::value, "only AST nodes live in an AstArena");
+  AstArena* arena = AstArena::Current();
+  T* node = new (arena->Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  arena->Adopt(node);
+  return node;
+}
+
 struct ClassElement : public AstNode {
   ClassElement() = default;
   virtual ~ClassElement() = default;
@@ -99,10 +140,10 @@ struct Variable : public Expression {
 };
 
 struct FieldVariable : public Expression {
-  std::variant<std::shared_ptr<Expression>, std::string> receiver;
+  std::variant<Expression*, std::string> receiver;
   std::string name;
 
-  FieldVariable(std::shared_ptr<Expression> object, const std::string& name);
+  FieldVariable(Expression* object, const std::string& name);
   FieldVariable(const std::string& clazz, const std::string& name);
   virtual ~FieldVariable() = default;
 
@@ -113,11 +154,11 @@ struct Field : public ClassElement {
   std::string comment;
   std::vector<std::string> annotations;
   int modifiers = 0;
-  std::shared_ptr<Variable> variable = nullptr;
+  Variable* variable = nullptr;
   std::string value;
 
   Field() = default;
-  Field(int modifiers, std::shared_ptr<Variable> variable);
+  Field(int modifiers, Variable* variable);
   virtual ~Field() = default;
 
   void Write(CodeWriter* to) const override;
@@ -138,108 +179,105 @@ struct LiteralStatement : public Statement {
 };
 
 struct StatementBlock : public Statement {
-  std::vector<std::shared_ptr<Statement>> statements;
+  std::vector<Statement*> statements;
 
   StatementBlock() = default;
   virtual ~StatementBlock() = default;
   void Write(CodeWriter* to) const override;
 
-  void Add(std::shared_ptr<Statement> statement);
-  void Add(std::shared_ptr<Expression> expression);
+  void Add(Statement* statement);
+  void Add(Expression* expression);
 };
 
 struct ExpressionStatement : public Statement {
-  std::shared_ptr<Expression> expression;
+  Expression* expression;
 
-  explicit ExpressionStatement(std::shared_ptr<Expression> expression);
+  explicit ExpressionStatement(Expression* expression);
   virtual ~ExpressionStatement() = default;
   void Write(CodeWriter* to) const override;
 };
 
 struct Assignment : public Expression {
-  std::shared_ptr<Variable> lvalue;
-  std::shared_ptr<Expression> rvalue;
+  Variable* lvalue;
+  Expression* rvalue;
   std::optional<std::string> cast = std::nullopt;
 
-  Assignment(std::shared_ptr<Variable> lvalue, std::shared_ptr<Expression> rvalue);
-  Assignment(std::shared_ptr<Variable> lvalue, std::shared_ptr<Expression> rvalue,
-             std::string cast);
+  Assignment(Variable* lvalue, Expression* rvalue);
+  Assignment(Variable* lvalue, Expression* rvalue, std::string cast);
   virtual ~Assignment() = default;
   void Write(CodeWriter* to) const override;
 };
 
 struct MethodCall : public Expression {
-  std::variant<std::monostate, std::shared_ptr<Expression>, std::string> receiver;
+  std::variant<std::monostate, Expression*, std::string> receiver;
   std::string name;
-  std::vector<std::shared_ptr<Expression>> arguments;
+  std::vector<Expression*> arguments;
   std::vector<std::string> exceptions;
 
   explicit MethodCall(const std::string& name);
-  MethodCall(const std::string& name, const std::vector<std::shared_ptr<Expression>>& args);
-  MethodCall(std::shared_ptr<Expression> obj, const std::string& name);
+  MethodCall(const std::string& name, const std::vector<Expression*>& args);
+  MethodCall(Expression* obj, const std::string& name);
   MethodCall(const std::string& clazz, const std::string& name);
-  MethodCall(std::shared_ptr<Expression> obj, const std::string& name,
-             const std::vector<std::shared_ptr<Expression>>& args);
+  MethodCall(Expression* obj, const std::string& name, const std::vector<Expression*>& args);
   MethodCall(const std::string&, const std::string& name,
-             const std::vector<std::shared_ptr<Expression>>& args);
+             const std::vector<Expression*>& args);
   virtual ~MethodCall() = default;
   void Write(CodeWriter* to) const override;
 };
 
 struct Comparison : public Expression {
-  std::shared_ptr<Expression> lvalue;
+  Expression* lvalue;
   std::string op;
-  std::shared_ptr<Expression> rvalue;
+  Expression* rvalue;
 
-  Comparison(std::shared_ptr<Expression> lvalue, const std::string& op,
-             std::shared_ptr<Expression> rvalue);
+  Comparison(Expression* lvalue, const std::string& op, Expression* rvalue);
   virtual ~Comparison() = default;
   void Write(CodeWriter* to) const override;
 };
 
 struct NewExpression : public Expression {
   const std::string instantiableName;
-  std::vector<std::shared_ptr<Expression>> arguments;
+  std::vector<Expression*> arguments;
 
   explicit NewExpression(const std::string& name);
-  NewExpression(const std::string& name, const std::vector<std::shared_ptr<Expression>>& args);
+  NewExpression(const std::string& name, const std::vector<Expression*>& args);
   virtual ~NewExpression() = default;
   void Write(CodeWriter* to) const override;
 };
 
 struct NewArrayExpression : public Expression {
   const std::string type;
-  std::shared_ptr<Expression> size;
+  Expression* size;
 
-  NewArrayExpression(const std::string& type, std::shared_ptr<Expression> size);
+  NewArrayExpression(const std::string& type, Expression* size);
   virtual ~NewArrayExpression() = default;
   void Write(CodeWriter* to) const override;
 };
 
 struct Cast : public Expression {
   const std::string type;
-  std::shared_ptr<Expression> expression = nullptr;
+  Expression* expression = nullptr;
 
   Cast() = default;
-  Cast(const std::string& type, std::shared_ptr<Expression> expression);
+  Cast(const std::string& type, Expression* expression);
   virtual ~Cast() = default;
   void Write(CodeWriter* to) const override;
 };
 
 struct VariableDeclaration : public Statement {
-  std::shared_ptr<Variable> lvalue = nullptr;
-  std::shared_ptr<Expression> rvalue = nullptr;
+  Variable* lvalue = nullptr;
+  Expression* rvalue = nullptr;
 
-  explicit VariableDeclaration(std::shared_ptr<Variable> lvalue);
-  VariableDeclaration(std::shared_ptr<Variable> lvalue, std::shared_ptr<Expression> rvalue);
+  explicit VariableDeclaration(Variable* lvalue);
+  VariableDeclaration(Variable* lvalue, Expression* rvalue);
   virtual ~VariableDeclaration() = default;
   void Write(CodeWriter* to) const override;
 };
 
 struct IfStatement : public Statement {
-  std::shared_ptr<Expression> expression = nullptr;
-  std::shared_ptr<StatementBlock> statements = std::make_shared<StatementBlock>();
-  std::shared_ptr<IfStatement> elseif = nullptr;
+  Expression* expression = nullptr;
+  StatementBlock* statements = New<StatementBlock>();
+  IfStatement* elseif = nullptr;
 
   IfStatement() = default;
   virtual ~IfStatement() = default;
@@ -247,15 +285,15 @@ struct IfStatement : public Statement {
 };
 
 struct ReturnStatement : public Statement {
-  std::shared_ptr<Expression> expression;
+  Expression* expression;
 
-  explicit ReturnStatement(std::shared_ptr<Expression> expression);
+  explicit ReturnStatement(Expression* expression);
   virtual ~ReturnStatement() = default;
   void Write(CodeWriter* to) const override;
 };
 
 struct TryStatement : public Statement {
-  std::shared_ptr<StatementBlock> statements = std::make_shared<StatementBlock>();
+  StatementBlock* statements = New<StatementBlock>();
 
   TryStatement() = default;
   virtual ~TryStatement() = default;
@@ -263,7 +301,7 @@ struct TryStatement : public Statement {
 };
 
 struct FinallyStatement : public Statement {
-  std::shared_ptr<StatementBlock> statements = std::make_shared<StatementBlock>();
+  StatementBlock* statements = New<StatementBlock>();
 
   FinallyStatement() = default;
   virtual ~FinallyStatement() = default;
@@ -272,7 +310,7 @@ struct FinallyStatement : public Statement {
 
 struct Case : public AstNode {
   std::vector<std::string> cases;
-  std::shared_ptr<StatementBlock> statements = std::make_shared<StatementBlock>();
+  StatementBlock* statements = New<StatementBlock>();
 
   Case() = default;
   explicit Case(const std::string& c);
@@ -281,10 +319,10 @@ struct Case : public AstNode {
 };
 
 struct SwitchStatement : public Statement {
-  std::shared_ptr<Expression> expression;
-  std::vector<std::shared_ptr<Case>> cases;
+  Expression* expression;
+  std::vector<Case*> cases;
 
-  explicit SwitchStatement(std::shared_ptr<Expression> expression);
+  explicit SwitchStatement(Expression* expression);
   virtual ~SwitchStatement() = default;
   void Write(CodeWriter* to) const override;
 };
@@ -295,9 +333,9 @@ struct Method : public ClassElement {
   int modifiers = 0;
   std::optional<std::string> returnType = std::nullopt;  // nullopt means constructor
   std::string name;
-  std::vector<std::shared_ptr<Variable>> parameters;
+  std::vector<Variable*> parameters;
   std::vector<std::string> exceptions;
-  std::shared_ptr<StatementBlock> statements = nullptr;
+  StatementBlock* statements = nullptr;
 
   Method() = default;
   virtual ~Method() = default;
@@ -324,7 +362,7 @@ struct Class : public ClassElement {
   std::string type;
   std::optional<std::string> extends = std::nullopt;
   std::vector<std::string> interfaces;
-  std::vector<std::shared_ptr<ClassElement>> elements;
+  std::vector<ClassElement*> elements;
 
   Class() = default;
   virtual ~Class() = default;
@@ -346,11 +384,11 @@ class Document : public AstNode {
   std::unique_ptr<Class> clazz_;
 };
 
-extern std::shared_ptr<Expression> NULL_VALUE;
-extern std::shared_ptr<Expression> THIS_VALUE;
-extern std::shared_ptr<Expression> SUPER_VALUE;
-extern std::shared_ptr<Expression> TRUE_VALUE;
-extern std::shared_ptr<Expression> FALSE_VALUE;
+extern Expression* const NULL_VALUE;
+extern Expression* const THIS_VALUE;
+extern Expression* const SUPER_VALUE;
+extern Expression* const TRUE_VALUE;
+extern Expression* const FALSE_VALUE;
 }  // namespace java
 }  // namespace aidl
 }  // namespace android
@@ -50,6 +50,26 @@ TEST(AstJavaTests, GeneratesClass) {
   EXPECT_EQ(string(kExpectedClassOutput), actual_output);
 }
 
+TEST(AstJavaTests, BuildsTreesInArenas) {
+  AstArena arena;
+  EXPECT_EQ(&arena, AstArena::Current());
+  StatementBlock* block = New<StatementBlock>();
+  {
+    // Nodes made in an inner arena go with it.
+    AstArena inner;
+    EXPECT_EQ(&inner, AstArena::Current());
+    EXPECT_NE(nullptr, New<LiteralStatement>("unused;\n"));
+  }
+  EXPECT_EQ(&arena, AstArena::Current());
+  // Enough nodes to take several blocks.
+  for (int i = 0; i < 10000; i++) {
+    block->Add(New<ReturnStatement>(i % 2 == 0 ? TRUE_VALUE : FALSE_VALUE));
+  }
+  string actual_output;
+  block->Write(CodeWriter::ForString(&actual_output).get());
+  EXPECT_EQ(0u, actual_output.find("{\n  return true;\n  return false;\n"));
+}
+
 TEST(AstJavaTests, ToString) {
   std::string literal = "public void foo() {}";
   LiteralClassElement ce(literal);
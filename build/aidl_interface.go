@@ -101,17 +101,17 @@ var (
 	}, "imports", "outDir")
 
 	aidlCheckApiRule = pctx.StaticRule("aidlCheckApiRule", blueprint.RuleParams{
-		Command: `(${aidlCmd} ${optionalFlags} --checkapi ${old} ${new} && touch ${out}) || ` +
+		Command: `(${aidlCmd} ${optionalFlags} --checkapi ${dumps} && touch ${out}) || ` +
 			`(cat ${messageFile} && exit 1)`,
 		CommandDeps: []string{"${aidlCmd}"},
-		Description: "AIDL CHECK API: ${new} against ${old}",
-	}, "optionalFlags", "old", "new", "messageFile")
+		Description: "AIDL CHECK API: ${dumps}",
+	}, "optionalFlags", "dumps", "messageFile")
 
 	aidlDiffApiRule = pctx.StaticRule("aidlDiffApiRule", blueprint.RuleParams{
-		Command: `if diff -r -B -I '//.*' -x '${hashFile}' '${old}' '${new}'; then touch '${out}'; else ` +
+		Command: `if diff -r -B -I '//.*' -x '${hashFile}' -x '${typeHashesFile}' '${old}' '${new}'; then touch '${out}'; else ` +
 			`cat '${messageFile}' && exit 1; fi`,
 		Description: "Check equality of ${new} and ${old}",
-	}, "old", "new", "hashFile", "messageFile")
+	}, "old", "new", "hashFile", "typeHashesFile", "messageFile")
 
 	aidlVerifyHashRule = pctx.StaticRule("aidlVerifyHashRule", blueprint.RuleParams{
 		Command: `if [ $$(cd '${apiDir}' && { find ./ -name "*.aidl" -print0 | LC_ALL=C sort -z | xargs -0 sha1sum && echo ${version}; } | sha1sum | cut -d " " -f 1) = $$(read -r <'${hashFile}' hash extra; printf %s $$hash) ]; then ` +
@@ -212,16 +212,19 @@ func isRelativePath(path string) bool {
 }
 
 type aidlGenProperties struct {
-	Srcs      []string `android:"path"`
-	AidlRoot  string   // base directory for the input aidl file
-	Imports   []string
-	Stability *string
-	Lang      string // target language [java|cpp|ndk]
-	BaseName  string
-	GenLog    bool
-	Version   string
-	GenTrace  bool
-	Unstable  *bool
+	Srcs          []string `android:"path"`
+	AidlRoot      string   // base directory for the input aidl file
+	Imports       []string
+	Stability     *string
+	Lang          string // target language [java|cpp|ndk]
+	BaseName      string
+	GenLog        bool
+	GenPrewarm    bool
+	GenAsync      bool
+	GenCoroutines bool
+	Version       string
+	GenTrace      bool
+	Unstable      *bool
 }
 
 type aidlGenRule struct {
@@ -383,6 +386,15 @@ func (g *aidlGenRule) generateBuildActionsForSingleAidl(ctx android.ModuleContex
 		if g.properties.GenLog {
 			optionalFlags = append(optionalFlags, "--log")
 		}
+		if g.properties.GenPrewarm {
+			optionalFlags = append(optionalFlags, "--gen-prewarm")
+		}
+		if g.properties.GenAsync {
+			optionalFlags = append(optionalFlags, "--gen-async")
+		}
+		if g.properties.GenCoroutines {
+			optionalFlags = append(optionalFlags, "--gen-coroutines")
+		}
 
 		aidlLang := g.properties.Lang
 		if aidlLang == langNdkPlatform {
@@ -491,8 +503,14 @@ type apiDump struct {
 	dir      android.Path
 	files    android.Paths
 	hashFile android.OptionalPath
+	// Written by --dumpapi for --checkapi to skip the unchanged types. It isn't
+	// part of the API, so it is neither hashed nor compared.
+	typeHashesFile android.OptionalPath
 }
 
+// The name of the type hashes file, which is kApiTypeHashesFile of aidl.h.
+const typeHashesFileName = ".type_hashes"
+
 func (m *aidlApi) createApiDumpFromSource(ctx android.ModuleContext) apiDump {
 	srcs, imports := getPaths(ctx, m.properties.Srcs)
 
@@ -511,6 +529,7 @@ func (m *aidlApi) createApiDumpFromSource(ctx android.ModuleContext) apiDump {
 	var apiDir android.WritablePath
 	var apiFiles android.WritablePaths
 	var hashFile android.WritablePath
+	var typeHashesFile android.WritablePath
 
 	apiDir = android.PathForModuleOut(ctx, "dump")
 	aidlRoot := android.PathForModuleSrc(ctx, m.properties.AidlRoot)
@@ -521,6 +540,7 @@ func (m *aidlApi) createApiDumpFromSource(ctx android.ModuleContext) apiDump {
 		apiFiles = append(apiFiles, outFile)
 	}
 	hashFile = android.PathForModuleOut(ctx, "dump", ".hash")
+	typeHashesFile = android.PathForModuleOut(ctx, "dump", typeHashesFileName)
 	latestVersion := "latest-version"
 	if len(m.properties.Versions) >= 1 {
 		latestVersion = m.properties.Versions[len(m.properties.Versions)-1]
@@ -533,7 +553,7 @@ func (m *aidlApi) createApiDumpFromSource(ctx android.ModuleContext) apiDump {
 
 	ctx.ModuleBuild(pctx, android.ModuleBuildParams{
 		Rule:    aidlDumpApiRule,
-		Outputs: append(apiFiles, hashFile),
+		Outputs: append(apiFiles, hashFile, typeHashesFile),
 		Inputs:  srcs,
 		Args: map[string]string{
 			"optionalFlags": strings.Join(optionalFlags, " "),
@@ -543,7 +563,8 @@ func (m *aidlApi) createApiDumpFromSource(ctx android.ModuleContext) apiDump {
 			"latestVersion": latestVersion,
 		},
 	})
-	return apiDump{apiDir, apiFiles.Paths(), android.OptionalPathForPath(hashFile)}
+	return apiDump{apiDir, apiFiles.Paths(), android.OptionalPathForPath(hashFile),
+		android.OptionalPathForPath(typeHashesFile)}
 }
 
 func (m *aidlApi) makeApiDumpAsVersion(ctx android.ModuleContext, dump apiDump, version string) android.WritablePath {
@@ -557,7 +578,12 @@ func (m *aidlApi) makeApiDumpAsVersion(ctx android.ModuleContext, dump apiDump,
 	rb.Command().Text("mkdir -p " + targetDir)
 	rb.Command().Text("rm -rf " + targetDir + "/*")
 	if version != currentVersion {
-		rb.Command().Text("cp -rf " + dump.dir.String() + "/. " + targetDir).Implicits(dump.files)
+		// A frozen version keeps its .type_hashes, so that --checkapi doesn't
+		// compare the types that the next version leaves unchanged.
+		cp := rb.Command().Text("cp -rf " + dump.dir.String() + "/. " + targetDir).Implicits(dump.files)
+		if dump.typeHashesFile.Valid() {
+			cp.Implicit(dump.typeHashesFile.Path())
+		}
 		// If this is making a new frozen (i.e. non-current) version of the interface,
 		// modify Android.bp file to add the new version to the 'versions' property.
 		rb.Command().BuiltTool(ctx, "bpmodify").
@@ -565,7 +591,9 @@ func (m *aidlApi) makeApiDumpAsVersion(ctx android.ModuleContext, dump apiDump,
 			Text("-parameter versions -a " + version).
 			Text(android.PathForModuleSrc(ctx, "Android.bp").String())
 	} else {
-		// In this case (unfrozen interface), don't copy .hash
+		// In this case (unfrozen interface), don't copy .hash or .type_hashes. The
+		// current version changes until it is frozen, so its types are always
+		// compared in full.
 		rb.Command().Text("cp -rf " + dump.dir.String() + "/* " + targetDir).Implicits(dump.files)
 	}
 	rb.Command().Text("touch").Output(timestampFile)
@@ -575,8 +603,11 @@ func (m *aidlApi) makeApiDumpAsVersion(ctx android.ModuleContext, dump apiDump,
 	return timestampFile
 }
 
-func (m *aidlApi) checkCompatibility(ctx android.ModuleContext, oldDump apiDump, newDump apiDump) android.WritablePath {
-	newVersion := newDump.dir.Base()
+// Checks that each of the dumps, in version order, is backwards compatible with
+// the one before it. A single aidl invocation loads each dump once for all the
+// pairs.
+func (m *aidlApi) checkCompatibility(ctx android.ModuleContext, dumps []apiDump) android.WritablePath {
+	newVersion := dumps[len(dumps)-1].dir.Base()
 	timestampFile := android.PathForModuleOut(ctx, "checkapi_"+newVersion+".timestamp")
 	messageFile := android.PathForSource(ctx, "system/tools/aidl/build/message_check_compatibility.txt")
 
@@ -586,8 +617,14 @@ func (m *aidlApi) checkCompatibility(ctx android.ModuleContext, oldDump apiDump,
 	}
 
 	var implicits android.Paths
-	implicits = append(implicits, oldDump.files...)
-	implicits = append(implicits, newDump.files...)
+	var dirs []string
+	for _, dump := range dumps {
+		implicits = append(implicits, dump.files...)
+		if dump.typeHashesFile.Valid() {
+			implicits = append(implicits, dump.typeHashesFile.Path())
+		}
+		dirs = append(dirs, dump.dir.String())
+	}
 	implicits = append(implicits, messageFile)
 	ctx.ModuleBuild(pctx, android.ModuleBuildParams{
 		Rule:      aidlCheckApiRule,
@@ -595,8 +632,7 @@ func (m *aidlApi) checkCompatibility(ctx android.ModuleContext, oldDump apiDump,
 		Output:    timestampFile,
 		Args: map[string]string{
 			"optionalFlags": strings.Join(optionalFlags, " "),
-			"old":           oldDump.dir.String(),
-			"new":           newDump.dir.String(),
+			"dumps":         strings.Join(dirs, " "),
 			"messageFile":   messageFile.String(),
 		},
 	})
@@ -630,10 +666,11 @@ func (m *aidlApi) checkEquality(ctx android.ModuleContext, oldDump apiDump, newD
 		Implicits: implicits,
 		Output:    timestampFile,
 		Args: map[string]string{
-			"old":         oldDump.dir.String(),
-			"new":         newDump.dir.String(),
-			"hashFile":    newDump.hashFile.Path().Base(),
-			"messageFile": formattedMessageFile.String(),
+			"old":            oldDump.dir.String(),
+			"new":            newDump.dir.String(),
+			"hashFile":       newDump.hashFile.Path().Base(),
+			"typeHashesFile": typeHashesFileName,
+			"messageFile":    formattedMessageFile.String(),
 		},
 	})
 	return timestampFile
@@ -682,6 +719,8 @@ func (m *aidlApi) GenerateAndroidBuildActions(ctx android.ModuleContext) {
 			dir:      currentApiDir.Path(),
 			files:    ctx.Glob(filepath.Join(currentApiDir.Path().String(), "**/*.aidl"), nil),
 			hashFile: android.ExistentPathForSource(ctx, ctx.ModuleDir(), m.apiDir(), currentVersion, ".hash"),
+			typeHashesFile: android.ExistentPathForSource(ctx, ctx.ModuleDir(), m.apiDir(),
+				currentVersion, typeHashesFileName),
 		}
 		checked := m.checkEquality(ctx, currentApiDump, totApiDump)
 		m.checkApiTimestamps = append(m.checkApiTimestamps, checked)
@@ -711,6 +750,8 @@ func (m *aidlApi) GenerateAndroidBuildActions(ctx android.ModuleContext) {
 				dir:      apiDirPath.Path(),
 				files:    ctx.Glob(filepath.Join(apiDirPath.String(), "**/*.aidl"), nil),
 				hashFile: android.ExistentPathForSource(ctx, ctx.ModuleDir(), m.apiDir(), ver, ".hash"),
+				typeHashesFile: android.ExistentPathForSource(ctx, ctx.ModuleDir(), m.apiDir(), ver,
+					typeHashesFileName),
 			})
 		} else if ctx.Config().AllowMissingDependencies() {
 			ctx.AddMissingDependencies([]string{apiDir})
@@ -726,11 +767,9 @@ func (m *aidlApi) GenerateAndroidBuildActions(ctx android.ModuleContext) {
 			checkHashTimestamp := m.checkIntegrity(ctx, dumps[i])
 			m.checkHashTimestamps = append(m.checkHashTimestamps, checkHashTimestamp)
 		}
-
-		if i == 0 {
-			continue
-		}
-		checked := m.checkCompatibility(ctx, dumps[i-1], dumps[i])
+	}
+	if len(dumps) >= 2 {
+		checked := m.checkCompatibility(ctx, dumps)
 		m.checkApiTimestamps = append(m.checkApiTimestamps, checked)
 	}
 
@@ -786,6 +825,18 @@ type CommonNativeBackendProperties struct {
 	// about the transactions.
 	// Default: false
 	Gen_log *bool
+	// Whether to generate prewarm(), which starts a lazy service before its
+	// first call.
+	// Default: false
+	Gen_prewarm *bool
+	// Whether to generate an Async() variant of each method, which makes the
+	// call on a worker thread and passes its results to a callback.
+	// Default: false
+	Gen_async *bool
+	// Whether to generate an Await() variant of each method, which a C++20
+	// coroutine can co_await.
+	// Default: false
+	Gen_coroutines *bool
 
 	// VNDK properties for correspdoning backend.
 	cc.VndkProperties
@@ -1192,16 +1243,19 @@ func addCppLibrary(mctx android.LoadHookContext, i *aidlInterface, version strin
 	mctx.CreateModule(aidlGenFactory, &nameProperties{
 		Name: proptools.StringPtr(cppSourceGen),
 	}, &aidlGenProperties{
-		Srcs:      srcs,
-		AidlRoot:  aidlRoot,
-		Imports:   concat(i.properties.Imports, []string{i.ModuleBase.Name()}),
-		Stability: i.properties.Stability,
-		Lang:      lang,
-		BaseName:  i.ModuleBase.Name(),
-		GenLog:    genLog,
-		Version:   version,
-		GenTrace:  genTrace,
-		Unstable:  i.properties.Unstable,
+		Srcs:          srcs,
+		AidlRoot:      aidlRoot,
+		Imports:       concat(i.properties.Imports, []string{i.ModuleBase.Name()}),
+		Stability:     i.properties.Stability,
+		Lang:          lang,
+		BaseName:      i.ModuleBase.Name(),
+		GenLog:        genLog,
+		GenPrewarm:    proptools.Bool(commonProperties.Gen_prewarm),
+		GenAsync:      proptools.Bool(commonProperties.Gen_async),
+		GenCoroutines: proptools.Bool(commonProperties.Gen_coroutines),
+		Version:       version,
+		GenTrace:      genTrace,
+		Unstable:      i.properties.Unstable,
 	})
 
 	importExportDependencies := wrap("", i.properties.Imports, "-"+lang)
@@ -16,57 +16,86 @@
 #include "code_writer.h"
 
 #include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
-#include <vector>
 
 #include <android-base/logging.h>
-#include <android-base/stringprintf.h>
+
+#include "profile.h"
 
 namespace android {
 namespace aidl {
 
 CodeWriter::CodeWriter(std::unique_ptr<std::ostream> ostream) : ostream_(std::move(ostream)) {}
 
-std::string CodeWriter::ApplyIndent(const std::string& str) {
-  std::string output;
-  if (!start_of_line_ || str == "\n") {
-    output = str;
-  } else {
-    output = std::string(indent_level_ * 2, ' ') + str;
+bool CodeWriter::WriteIndented(const char* data, size_t size) {
+  // Spaces for indentation are written from here, a chunk at a time.
+  static constexpr char kSpaces[] = "                                                                ";
+  constexpr size_t kNumSpaces = sizeof(kSpaces) - 1;
+
+  // Each line is indented unless it is empty. An empty line is preserved.
+  while (size > 0) {
+    const char* newline = static_cast<const char*>(memchr(data, '\n', size));
+    const size_t line_size = newline != nullptr ? newline - data + 1 : size;
+    if (start_of_line_ && !(line_size == 1 && data[0] == '\n')) {
+      for (size_t indent = indent_level_ * 2; indent > 0;) {
+        const size_t chunk = std::min(indent, kNumSpaces);
+        ostream_->write(kSpaces, chunk);
+        indent -= chunk;
+      }
+    }
+    ostream_->write(data, line_size);
+    start_of_line_ = data[line_size - 1] == '\n';
+    data += line_size;
+    size -= line_size;
   }
-  start_of_line_ = !output.empty() && output.back() == '\n';
-  return output;
+  return !ostream_->fail();
 }
 
 bool CodeWriter::Write(const char* format, ...) {
+  // Many formats have no conversions at all; they are written as they are.
+  if (strchr(format, '%') == nullptr) {
+    return WriteIndented(format, strlen(format));
+  }
+  // operator<< writes strings through here, so that subclasses see them too.
+  if (strcmp(format, "%s") == 0) {
+    va_list ap;
+    va_start(ap, format);
+    const char* s = va_arg(ap, const char*);
+    va_end(ap);
+    return WriteIndented(s, strlen(s));
+  }
+
+  // Format into a buffer that is kept across calls, so that it is allocated
+  // only when a formatted string is longer than any before.
+  if (format_buffer_.empty()) {
+    format_buffer_.resize(256);
+  }
   va_list ap;
   va_start(ap, format);
-  std::string formatted;
-  android::base::StringAppendV(&formatted, format, ap);
+  va_list retry;
+  va_copy(retry, ap);
+  int len = vsnprintf(&format_buffer_[0], format_buffer_.size(), format, ap);
   va_end(ap);
-
-  // extract lines. empty line is preserved.
-  std::vector<std::string> lines;
-  size_t pos = 0;
-  while (pos < formatted.size()) {
-    size_t line_end = formatted.find('\n', pos);
-    if (line_end != std::string::npos) {
-      lines.push_back(formatted.substr(pos, (line_end - pos) + 1));
-      pos = line_end + 1;
-    } else {
-      lines.push_back(formatted.substr(pos));
-      break;
-    }
+  if (len >= 0 && static_cast<size_t>(len) >= format_buffer_.size()) {
+    format_buffer_.resize(len + 1);
+    len = vsnprintf(&format_buffer_[0], format_buffer_.size(), format, retry);
   }
-
-  std::string indented;
-  for (const auto& line : lines) {
-    indented.append(ApplyIndent(line));
+  va_end(retry);
+  if (len < 0) {
+    return false;
   }
+  return WriteIndented(format_buffer_.data(), len);
+}
 
-  (*ostream_) << indented;
+bool CodeWriter::WriteRaw(const std::string& data) {
+  ostream_->write(data.data(), data.size());
+  start_of_line_ = !data.empty() && data.back() == '\n';
   return !ostream_->fail();
 }
 
@@ -82,6 +111,10 @@ void CodeWriter::Dedent() {
 bool CodeWriter::Close() {
   if (ostream_.get()->rdbuf() != std::cout.rdbuf()) {
     // if the steam is for file (not stdout), do the close.
+    // tellp() is -1 once the stream has failed, and then nothing is counted
+    if (const std::streamoff written = ostream_->tellp(); written > 0) {
+      Profile::Count(ProfileCounter::BYTES_WRITTEN, written);
+    }
     static_cast<std::fstream*>(ostream_.get())->close();
     return !ostream_->fail();
   }
@@ -109,6 +142,54 @@ CodeWriterPtr CodeWriter::ForFile(const std::string& filename) {
   return CodeWriterPtr(new CodeWriter(std::move(stream)));
 }
 
+CodeWriterPtr CodeWriter::ForFileIfChanged(const std::string& filename) {
+  if (filename == "-") {
+    return ForFile(filename);
+  }
+  class IfChangedCodeWriter : public CodeWriter {
+   public:
+    IfChangedCodeWriter(const std::string& filename)
+        : CodeWriter(std::unique_ptr<std::ostream>(new std::stringstream())), filename_(filename) {}
+    ~IfChangedCodeWriter() override { Close(); }
+    bool Close() override {
+      if (closed_) {
+        return true;
+      }
+      closed_ = true;
+      const std::string contents = static_cast<std::stringstream*>(ostream_.get())->str();
+      if (HasSameContents(contents)) {
+        return true;
+      }
+      Profile::Count(ProfileCounter::BYTES_WRITTEN, contents.size());
+      std::ofstream out(filename_, std::ios::out | std::ios::binary | std::ios::trunc);
+      out.write(contents.data(), contents.size());
+      out.close();
+      return !out.fail();
+    }
+
+   private:
+    // Compares the sizes first so that a changed file is usually not read.
+    bool HasSameContents(const std::string& contents) const {
+      std::ifstream in(filename_, std::ios::in | std::ios::binary);
+      if (!in) {
+        return false;
+      }
+      in.seekg(0, std::ios::end);
+      if (in.tellg() != static_cast<std::streamoff>(contents.size())) {
+        return false;
+      }
+      in.seekg(0, std::ios::beg);
+      std::string existing(contents.size(), '\0');
+      in.read(&existing[0], existing.size());
+      return !in.fail() && existing == contents;
+    }
+
+    const std::string filename_;
+    bool closed_ = false;
+  };
+  return CodeWriterPtr(new IfChangedCodeWriter(filename));
+}
+
 CodeWriterPtr CodeWriter::ForString(std::string* buf) {
   // This class is defined inside this static function of CodeWriter
   // in order to have access to private constructor and private member
@@ -35,6 +35,11 @@ class CodeWriter {
   // Get a CodeWriter that writes to a file. When filename is "-",
   // it is written to stdout.
   static CodeWriterPtr ForFile(const std::string& filename);
+  // Get a CodeWriter that writes to a file only when the new contents differ
+  // from what the file already has, so that an unchanged file keeps its
+  // mtime. The contents are buffered and the file is written on Close() or
+  // when the CodeWriter is deleted.
+  static CodeWriterPtr ForFileIfChanged(const std::string& filename);
   // Get a CodeWriter that writes to a string buffer.
   // The buffer gets updated only after Close() is called or the CodeWriter
   // is deleted -- much like a real file.
@@ -42,6 +47,9 @@ class CodeWriter {
   // Write a formatted string to this writer in the usual printf sense.
   // Returns false on error.
   virtual bool Write(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  // Write |data| as is, without formatting or indentation. It may contain NULs.
+  // Returns false on error.
+  virtual bool WriteRaw(const std::string& data);
   void Indent();
   void Dedent();
   virtual bool Close();
@@ -53,8 +61,10 @@ class CodeWriter {
 
  private:
   CodeWriter(std::unique_ptr<std::ostream> ostream);
-  std::string ApplyIndent(const std::string& str);
+  // Writes |size| bytes of |data|, indenting each line that is started.
+  bool WriteIndented(const char* data, size_t size);
   const std::unique_ptr<std::ostream> ostream_;
+  std::string format_buffer_;
   int indent_level_ {0};
   bool start_of_line_ {true};
 };
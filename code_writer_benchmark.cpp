@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "code_writer.h"
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+namespace android {
+namespace aidl {
+
+namespace {
+
+// Writes roughly what the generators write for an interface with
+// |num_methods| methods: mostly short lines through operator<<, some through
+// Write() with a few arguments, all nested a few levels deep.
+void WriteLargeInterface(CodeWriter* writer, int num_methods) {
+  *writer << "namespace android {\n";
+  *writer << "namespace aidl {\n\n";
+  *writer << "class BpFoo : public ::android::BpInterface<IFoo> {\n";
+  *writer << "public:\n";
+  writer->Indent();
+  for (int i = 0; i < num_methods; i++) {
+    writer->Write("::android::binder::Status method%d(int32_t arg, ::std::string* _aidl_return) {\n",
+                  i);
+    writer->Indent();
+    *writer << "::android::Parcel _aidl_data;\n";
+    *writer << "::android::Parcel _aidl_reply;\n";
+    *writer << "::android::status_t _aidl_ret_status = ::android::OK;\n";
+    writer->Write("_aidl_ret_status = remote()->transact(%s + %d, _aidl_data, &_aidl_reply);\n",
+                  "::android::IBinder::FIRST_CALL_TRANSACTION", i);
+    *writer << "if (((_aidl_ret_status) != (::android::OK))) {\n";
+    writer->Indent();
+    *writer << "goto _aidl_error;\n";
+    writer->Dedent();
+    *writer << "}\n";
+    *writer << "return _aidl_status;\n";
+    writer->Dedent();
+    *writer << "}\n\n";
+  }
+  writer->Dedent();
+  *writer << "};\n\n";
+  *writer << "}  // namespace aidl\n";
+  *writer << "}  // namespace android\n";
+}
+
+void BM_WriteLargeInterface(benchmark::State& state) {
+  for (auto _ : state) {
+    std::string output;
+    CodeWriterPtr writer = CodeWriter::ForString(&output);
+    WriteLargeInterface(writer.get(), state.range(0));
+    writer->Close();
+    benchmark::DoNotOptimize(output);
+  }
+}
+BENCHMARK(BM_WriteLargeInterface)->Arg(100)->Arg(1000);
+
+}  // namespace
+
+}  // namespace aidl
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -16,9 +16,14 @@
 
 #include "code_writer.h"
 
+#include <sys/stat.h>
+#include <utime.h>
+
 #include <gtest/gtest.h>
 #include <string>
 
+#include <android-base/file.h>
+
 using android::aidl::CodeWriter;
 using std::string;
 using std::unique_ptr;
@@ -44,5 +49,51 @@ TEST(CodeWriterTest, AppendOperatorCascade) {
   EXPECT_EQ(str, "Write this and that");
 }
 
+TEST(CodeWriterTest, IndentsLinesButNotEmptyOnes) {
+  string str;
+  CodeWriterPtr writer = CodeWriter::ForString(&str);
+  writer->Write("class Foo {\n");
+  writer->Indent();
+  writer->Write("int %s;\n\nint ", "x");
+  *writer << "y;\n";
+  writer->Dedent();
+  writer->Write("};\n");
+  writer->Close();
+  EXPECT_EQ("class Foo {\n  int x;\n\n  int y;\n};\n", str);
+}
+
+TEST(CodeWriterTest, WritesFormattedStringsOfAnyLength) {
+  const string long_name(1000, 'a');
+  string str;
+  CodeWriterPtr writer = CodeWriter::ForString(&str);
+  writer->Write("%s %d%%", "short", 1);
+  writer->Write(" %s", long_name.c_str());
+  writer->Close();
+  EXPECT_EQ("short 1% " + long_name, str);
+}
+
+TEST(CodeWriterTest, ForFileIfChangedKeepsUnchangedFile) {
+  TemporaryFile file;
+  ASSERT_TRUE(android::base::WriteStringToFile("int x;\n", file.path));
+  struct utimbuf old_times = {1000, 1000};
+  ASSERT_EQ(0, utime(file.path, &old_times));
+
+  CodeWriterPtr writer = CodeWriter::ForFileIfChanged(file.path);
+  *writer << "int x;\n";
+  EXPECT_TRUE(writer->Close());
+  struct stat st;
+  ASSERT_EQ(0, stat(file.path, &st));
+  EXPECT_EQ(1000, st.st_mtime);
+
+  writer = CodeWriter::ForFileIfChanged(file.path);
+  *writer << "int y;\n";
+  writer.reset();
+  ASSERT_EQ(0, stat(file.path, &st));
+  EXPECT_NE(1000, st.st_mtime);
+  string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(file.path, &contents));
+  EXPECT_EQ("int y;\n", contents);
+}
+
 }  // namespace aidl
 }  // namespace android
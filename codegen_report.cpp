@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "codegen_report.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <unordered_set>
+
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#include "aidl_to_cpp_common.h"
+#include "aidl_typenames.h"
+#include "generate_java.h"
+#include "logging.h"
+#include "profile.h"
+
+using android::base::Join;
+using android::base::StringPrintf;
+using std::string;
+using std::vector;
+
+namespace android {
+namespace aidl {
+namespace report {
+
+namespace {
+
+const char* backend_name(Options::Language language) {
+  switch (language) {
+    case Options::Language::JAVA:
+      return "java";
+    case Options::Language::CPP:
+      return "cpp";
+    case Options::Language::NDK:
+      return "ndk";
+    default:
+      return "unspecified";
+  }
+}
+
+const char* kind_of(const AidlDefinedType& type) {
+  if (type.AsInterface() != nullptr) return "interface";
+  if (type.AsEnumDeclaration() != nullptr) return "enum";
+  if (type.AsStructuredParcelable() != nullptr) return "parcelable";
+  return "unstructured_parcelable";
+}
+
+// How many parcelables are nested in |type|: 1 for a parcelable of primitive
+// fields, 0 for a type that isn't a parcelable. A parcelable that contains
+// itself is counted once. Imports aren't followed, so fields of types that
+// weren't loaded for the compiled file aren't counted.
+size_t parcelable_depth(const AidlTypeSpecifier& type, const AidlTypenames& typenames,
+                        std::set<const AidlDefinedType*>* visiting) {
+  size_t depth = 0;
+  if (type.IsGeneric()) {
+    for (const auto& parameter : type.GetTypeParameters()) {
+      depth = std::max(depth, parcelable_depth(*parameter, typenames, visiting));
+    }
+  }
+  const AidlDefinedType* defined = typenames.TryGetDefinedType(type.GetName());
+  if (defined == nullptr || defined->AsParcelable() == nullptr ||
+      !visiting->insert(defined).second) {
+    return depth;
+  }
+  size_t fields_depth = 0;
+  if (const AidlStructuredParcelable* parcelable = defined->AsStructuredParcelable();
+      parcelable != nullptr) {
+    for (const auto& field : parcelable->GetFields()) {
+      fields_depth =
+          std::max(fields_depth, parcelable_depth(field->GetType(), typenames, visiting));
+    }
+  }
+  visiting->erase(defined);
+  return std::max(depth, fields_depth + 1);
+}
+
+// The objects of the code generated for |type| that are initialized when the
+// library is loaded, by dynamic initializers. Java classes are initialized on
+// first use, so only C++ and NDK code has them.
+vector<string> static_initializers(const Options& options, const AidlDefinedType& type) {
+  const AidlInterface* iface = type.AsInterface();
+  const Options::Language language = options.TargetLanguage();
+  if (iface == nullptr || language == Options::Language::JAVA) {
+    return {};
+  }
+  const string i_name = cpp::ClassName(*iface, cpp::ClassNames::INTERFACE);
+  vector<string> objects;
+  if (!options.LazyDescriptors()) {
+    objects.push_back(language == Options::Language::CPP ? i_name + "::descriptor"
+                                                         : "_g_aidl_clazz");
+  }
+  if (language == Options::Language::NDK && !options.Hash().empty()) {
+    objects.push_back(i_name + "::hash");
+  }
+  if (options.GenLog()) {
+    objects.push_back(cpp::ClassName(*iface, cpp::ClassNames::CLIENT) + "::logFunc");
+    objects.push_back(cpp::ClassName(*iface, cpp::ClassNames::SERVER) + "::logFunc");
+  }
+  return objects;
+}
+
+string method_entry(const AidlMethod& method, const AidlTypenames& typenames,
+                    const std::unordered_set<const AidlMethod*>* outlined) {
+  const bool returns = method.GetType().GetName() != "void";
+  // The interface token, and the status of the reply
+  size_t writes = 1;
+  size_t reads = method.IsOneway() ? 0 : 1;
+  std::set<const AidlDefinedType*> visiting;
+  size_t depth = returns ? parcelable_depth(method.GetType(), typenames, &visiting) : 0;
+  if (returns) {
+    reads++;
+  }
+  for (const auto& arg : method.GetArguments()) {
+    if (arg->IsIn()) writes++;
+    if (arg->IsOut()) reads++;
+    depth = std::max(depth, parcelable_depth(arg->GetType(), typenames, &visiting));
+  }
+  string entry = StringPrintf(
+      "{\"name\":\"%s\",\"id\":%d,\"oneway\":%s,\"parcel_writes\":%zu,\"parcel_reads\":%zu,"
+      "\"nested_parcelable_depth\":%zu",
+      EscapeJson(method.GetName()).c_str(), method.GetId(), method.IsOneway() ? "true" : "false",
+      writes, reads, depth);
+  if (outlined != nullptr) {
+    entry += StringPrintf(",\"outlined\":%s", outlined->count(&method) ? "true" : "false");
+  }
+  return entry + "}";
+}
+
+}  // namespace
+
+GeneratedFile Measure(const string& path, const string& contents) {
+  size_t lines = std::count(contents.begin(), contents.end(), '\n');
+  if (!contents.empty() && contents.back() != '\n') {
+    lines++;
+  }
+  return GeneratedFile{path, lines, contents.size()};
+}
+
+string TypeEntry(const Options& options, const AidlDefinedType& type,
+                 const AidlTypenames& typenames, const vector<GeneratedFile>& files) {
+  size_t lines = 0;
+  size_t bytes = 0;
+  vector<string> file_entries;
+  for (const GeneratedFile& file : files) {
+    lines += file.lines;
+    bytes += file.bytes;
+    file_entries.push_back(StringPrintf("{\"path\":\"%s\",\"lines\":%zu,\"bytes\":%zu}",
+                                        EscapeJson(file.path).c_str(), file.lines, file.bytes));
+  }
+  string entry = StringPrintf(
+      "{\"type\":\"%s\",\"kind\":\"%s\",\"lines\":%zu,\"bytes\":%zu,\"files\":[%s]",
+      EscapeJson(type.GetCanonicalName()).c_str(), kind_of(type), lines, bytes,
+      Join(file_entries, ",").c_str());
+  vector<string> initializers;
+  for (const string& object : static_initializers(options, type)) {
+    initializers.push_back("\"" + EscapeJson(object) + "\"");
+  }
+  entry += ",\"static_initializers\":[" + Join(initializers, ",") + "]";
+  if (const AidlInterface* iface = type.AsInterface(); iface != nullptr) {
+    // Only the Java stub outlines methods.
+    const bool java = options.TargetLanguage() == Options::Language::JAVA;
+    std::unordered_set<const AidlMethod*> outlined;
+    if (java) {
+      outlined = java::OutlinedMethods(*iface, options);
+    }
+    vector<string> method_entries;
+    for (const auto& method : iface->GetMethods()) {
+      method_entries.push_back(method_entry(*method, typenames, java ? &outlined : nullptr));
+    }
+    entry += ",\"methods\":[" + Join(method_entries, ",") + "]";
+  }
+  return entry + "}";
+}
+
+bool WriteReport(const Options& options, const vector<string>& entries,
+                 const IoDelegate& io_delegate) {
+  const string& path = options.CodegenReportFile();
+  std::unique_ptr<CodeWriter> writer = io_delegate.GetCodeWriter(path);
+  if (writer == nullptr) {
+    AIDL_ERROR(path) << "Cannot open for writing.";
+    return false;
+  }
+  (*writer) << "{\"backend\":\"" << backend_name(options.TargetLanguage()) << "\",\"types\":[";
+  for (size_t i = 0; i < entries.size(); i++) {
+    (*writer) << (i == 0 ? "\n" : ",\n") << entries[i];
+  }
+  (*writer) << "\n]}\n";
+  return writer->Close();
+}
+
+}  // namespace report
+}  // namespace aidl
+}  // namespace android
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "aidl_language.h"
+#include "io_delegate.h"
+#include "options.h"
+
+namespace android {
+namespace aidl {
+namespace report {
+
+// A file generated for a type
+struct GeneratedFile {
+  std::string path;
+  size_t lines;
+  size_t bytes;
+};
+
+GeneratedFile Measure(const std::string& path, const std::string& contents);
+
+// The JSON object that --codegen-report writes for |type|, which |files| are
+// generated for. Each method of an interface gets the parcel reads and writes
+// of a call on the proxy side, one for each argument it sends or receives
+// whatever the type, and how deeply the parcelables of the call nest. The
+// objects of the generated code that still need a static initializer when
+// the library is loaded are listed too.
+std::string TypeEntry(const Options& options, const AidlDefinedType& type,
+                      const AidlTypenames& typenames, const std::vector<GeneratedFile>& files);
+
+// Writes |entries|, each made by TypeEntry, to the file of --codegen-report.
+bool WriteReport(const Options& options, const std::vector<std::string>& entries,
+                 const IoDelegate& io_delegate);
+
+}  // namespace report
+}  // namespace aidl
+}  // namespace android
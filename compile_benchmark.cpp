@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "aidl.h"
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "aidl_checkapi.h"
+#include "options.h"
+#include "tests/fake_io_delegate.h"
+
+using android::aidl::test::FakeIoDelegate;
+using std::string;
+using std::to_string;
+using std::vector;
+
+namespace android {
+namespace aidl {
+
+namespace {
+
+// How large the generated corpus is along each of the axes that the
+// compiler's cost grows with.
+struct Corpus {
+  int num_methods;
+  int num_fields;
+  int num_imports;
+  int enum_size;
+  int expression_depth;
+};
+
+// A sum like (2 + (1 + 1)) that is |depth| deep.
+string Expression(int depth) {
+  string expression = "1";
+  for (int i = 0; i < depth; i++) {
+    expression = "(" + to_string(i % 7 + 1) + " + " + expression + ")";
+  }
+  return expression;
+}
+
+// Writes the corpus to |io_delegate| under |dir| and returns its files. The
+// interface p/IFoo imports |num_imports| parcelables, each with |num_fields|
+// fields, and an enum of |enum_size| values.
+vector<string> AddCorpus(const Corpus& corpus, const string& dir, FakeIoDelegate* io_delegate) {
+  vector<string> files;
+  auto add_file = [&](const string& name, const string& contents) {
+    files.push_back("p/" + name + ".aidl");
+    io_delegate->SetFileContents(dir + files.back(), contents);
+  };
+
+  string e = "package p;\n@Backing(type=\"int\")\nenum E {\n";
+  for (int i = 0; i < corpus.enum_size; i++) {
+    e += "  V" + to_string(i) + " = " + to_string(i) + ",\n";
+  }
+  add_file("E", e + "}\n");
+
+  string foo = "package p;\nimport p.E;\n";
+  for (int i = 0; i < corpus.num_imports; i++) {
+    const string name = "P" + to_string(i);
+    string parcelable = "package p;\nimport p.E;\nparcelable " + name + " {\n";
+    for (int f = 0; f < corpus.num_fields; f++) {
+      switch (f % 4) {
+        case 0:
+          parcelable += "  int f" + to_string(f) + " = " + Expression(corpus.expression_depth);
+          break;
+        case 1:
+          parcelable += "  @utf8InCpp String f" + to_string(f);
+          break;
+        case 2:
+          parcelable += "  long[] f" + to_string(f);
+          break;
+        default:
+          parcelable += "  E f" + to_string(f);
+          break;
+      }
+      parcelable += ";\n";
+    }
+    add_file(name, parcelable + "}\n");
+    foo += "import p." + name + ";\n";
+  }
+
+  foo += "interface IFoo {\n";
+  for (int i = 0; i < corpus.num_methods; i++) {
+    const string arg = corpus.num_imports > 0 ? "P" + to_string(i % corpus.num_imports) : "int";
+    foo += "  " + arg + " method" + to_string(i) + "(in " + arg + " a, E b, out int[] c, " +
+           "@nullable String d);\n";
+  }
+  foo += "  const int VALUE = " + Expression(corpus.expression_depth) + ";\n}\n";
+  add_file("IFoo", foo);
+  return files;
+}
+
+Corpus CorpusOf(const benchmark::State& state) {
+  return Corpus{static_cast<int>(state.range(0)), static_cast<int>(state.range(1)),
+                static_cast<int>(state.range(2)), static_cast<int>(state.range(3)),
+                static_cast<int>(state.range(4))};
+}
+
+// Reports the number of inputs and the bytes of |output_dir| per second.
+void ReportThroughput(benchmark::State& state, const vector<string>& files,
+                      FakeIoDelegate* io_delegate, const string& output_dir) {
+  size_t output_bytes = 0;
+  for (const string& output : io_delegate->ListOutputFiles()) {
+    string contents;
+    if (output.compare(0, output_dir.size(), output_dir) == 0 &&
+        io_delegate->GetWrittenContents(output, &contents)) {
+      output_bytes += contents.size();
+    }
+  }
+  state.counters["files"] = benchmark::Counter(static_cast<double>(files.size()),
+                                               benchmark::Counter::kIsIterationInvariantRate);
+  state.SetBytesProcessed(state.iterations() * output_bytes);
+}
+
+void Compile(benchmark::State& state, const string& lang) {
+  FakeIoDelegate io_delegate;
+  const vector<string> files = AddCorpus(CorpusOf(state), "", &io_delegate);
+  string args = "aidl --lang=" + lang + " -I . -o out";
+  if (lang != "java") {
+    args += " -h out";
+  }
+  for (const string& file : files) {
+    args += " " + file;
+  }
+  const Options options = Options::From(args);
+  for (auto _ : state) {
+    if (compile_aidl(options, io_delegate) != 0) {
+      state.SkipWithError("Cannot compile the corpus");
+      return;
+    }
+  }
+  ReportThroughput(state, files, &io_delegate, "out/");
+}
+
+// Methods, fields, imports, enum size and expression depth, grown one at a
+// time from a small corpus.
+void CorpusArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"methods", "fields", "imports", "enum", "depth"});
+  b->Args({10, 10, 4, 10, 4});
+  b->Args({1000, 10, 4, 10, 4});
+  b->Args({10, 500, 4, 10, 4});
+  b->Args({10, 10, 100, 10, 4});
+  b->Args({10, 10, 4, 5000, 4});
+  b->Args({10, 10, 4, 10, 200});
+}
+
+void BM_CompileCpp(benchmark::State& state) {
+  Compile(state, "cpp");
+}
+BENCHMARK(BM_CompileCpp)->Apply(CorpusArgs);
+
+void BM_CompileNdk(benchmark::State& state) {
+  Compile(state, "ndk");
+}
+BENCHMARK(BM_CompileNdk)->Apply(CorpusArgs);
+
+void BM_CompileJava(benchmark::State& state) {
+  Compile(state, "java");
+}
+BENCHMARK(BM_CompileJava)->Apply(CorpusArgs);
+
+void BM_DumpApi(benchmark::State& state) {
+  FakeIoDelegate io_delegate;
+  const vector<string> files = AddCorpus(CorpusOf(state), "", &io_delegate);
+  string args = "aidl --dumpapi -I . -o dump";
+  for (const string& file : files) {
+    args += " " + file;
+  }
+  const Options options = Options::From(args);
+  for (auto _ : state) {
+    if (!dump_api(options, io_delegate)) {
+      state.SkipWithError("Cannot dump the corpus");
+      return;
+    }
+  }
+  ReportThroughput(state, files, &io_delegate, "dump/");
+}
+BENCHMARK(BM_DumpApi)->Apply(CorpusArgs);
+
+// check_api generates no code, so it reports the bytes of the dumps it compares.
+void BM_CheckApi(benchmark::State& state) {
+  FakeIoDelegate io_delegate;
+  const Corpus corpus = CorpusOf(state);
+  const vector<string> files = AddCorpus(corpus, "old/", &io_delegate);
+  AddCorpus(corpus, "new/", &io_delegate);
+  const Options options = Options::From("aidl --checkapi old new");
+  for (auto _ : state) {
+    if (!check_api(options, io_delegate)) {
+      state.SkipWithError("Cannot compare the corpus");
+      return;
+    }
+  }
+  size_t input_bytes = 0;
+  for (const string& file : files) {
+    for (const char* dir : {"old/", "new/"}) {
+      input_bytes += io_delegate.GetFileContents(string(dir) + file)->size();
+    }
+  }
+  state.counters["files"] = benchmark::Counter(static_cast<double>(files.size()),
+                                               benchmark::Counter::kIsIterationInvariantRate);
+  state.SetBytesProcessed(state.iterations() * input_bytes);
+}
+BENCHMARK(BM_CheckApi)->Apply(CorpusArgs);
+
+}  // namespace
+
+}  // namespace aidl
+}  // namespace android
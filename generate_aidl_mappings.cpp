@@ -17,7 +17,7 @@
 #include "generate_aidl_mappings.h"
 #include "aidl_to_java.h"
 
-#include <sstream>
+#include <string>
 
 namespace android {
 namespace aidl {
@@ -27,27 +27,37 @@ std::string dump_location(const AidlNode& method) {
   return method.PrintLine();
 }
 
-SignatureMap generate_mappings(const AidlDefinedType* defined_type,
-                               const AidlTypenames& typenames) {
+static const std::string& java_signature_of(const AidlTypeSpecifier& type,
+                                            const AidlTypenames& typenames,
+                                            JavaSignatureCache* signatures) {
+  auto [it, inserted] = signatures->try_emplace(type.ToString());
+  if (inserted) {
+    it->second = java::JavaSignatureOf(type, typenames);
+  }
+  return it->second;
+}
+
+void generate_mappings(const AidlDefinedType* defined_type, const AidlTypenames& typenames,
+                       JavaSignatureCache* signatures, std::vector<Mapping>* mappings) {
   const AidlInterface* interface = defined_type->AsInterface();
-  SignatureMap mappings;
   if (interface == nullptr) {
-    return mappings;
+    return;
   }
   for (const auto& method : interface->GetMethods()) {
     if (method->IsUserDefined()) {
-      std::stringstream signature;
-      signature << interface->GetCanonicalName() << "|";
-      signature << method->GetName() << "|";
+      std::string signature = interface->GetCanonicalName();
+      signature += '|';
+      signature += method->GetName();
+      signature += '|';
       for (const auto& arg : method->GetArguments()) {
-        signature << java::JavaSignatureOf(arg->GetType(), typenames) << ",";
+        signature += java_signature_of(arg->GetType(), typenames, signatures);
+        signature += ',';
       }
-      signature << "|";
-      signature << java::JavaSignatureOf(method->GetType(), typenames);
-      mappings[signature.str()] = dump_location(*method);
+      signature += '|';
+      signature += java_signature_of(method->GetType(), typenames, signatures);
+      mappings->emplace_back(std::move(signature), dump_location(*method));
     }
   }
-  return mappings;
 }
 
 }  // namespace mappings
@@ -18,15 +18,23 @@
 
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include "aidl_language.h"
 
 namespace android {
 namespace aidl {
 namespace mappings {
 
-using SignatureMap = std::unordered_map<std::string, std::string>;
+// Method signature and the location of its declaration
+using Mapping = std::pair<std::string, std::string>;
+// Java signatures by AIDL type name, shared across the types of one dump
+using JavaSignatureCache = std::unordered_map<std::string, std::string>;
 
-SignatureMap generate_mappings(const AidlDefinedType* iface, const AidlTypenames& typenames);
+// Appends the mappings of the methods of |iface|, if it is an interface, to
+// |mappings|.
+void generate_mappings(const AidlDefinedType* iface, const AidlTypenames& typenames,
+                       JavaSignatureCache* signatures, std::vector<Mapping>* mappings);
 }  // namespace mappings
 }  // namespace aidl
 }  // namespace android
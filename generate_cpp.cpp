@@ -70,20 +70,1010 @@ const char kTraceHeader[] = "utils/Trace.h";
 const char kStrongPointerHeader[] = "utils/StrongPointer.h";
 const char kAndroidBaseMacrosHeader[] = "android-base/macros.h";
 
-unique_ptr<AstNode> BreakOnStatusNotOk() {
-  IfStatement* ret = new IfStatement(new Comparison(
-      new LiteralExpression(kAndroidStatusVarName), "!=",
-      new LiteralExpression(kAndroidStatusOk)));
-  ret->OnTrue()->AddLiteral("break");
-  return unique_ptr<AstNode>(ret);
+// Payloads of @SharedMemory arguments above the threshold go through a memfd
+// region, in the wire format of the Java backend: an int32 0 followed by the
+// vector, or an int32 1 followed by the length and a ParcelFileDescriptor.
+const char kSharedMemoryWriter[] =
+    R"(namespace {
+
+constexpr size_t kSharedMemoryThreshold = 16 * 1024;
+
+::android::status_t WriteSharedMemoryByteVector(::android::Parcel* parcel,
+                                                const ::std::vector<uint8_t>& value) {
+  if (value.size() > kSharedMemoryThreshold && value.size() <= INT32_MAX) {
+    ::android::base::unique_fd fd(memfd_create("aidl", MFD_CLOEXEC));
+    void* addr = MAP_FAILED;
+    if (fd.ok() && ftruncate(fd.get(), value.size()) == 0) {
+      addr = mmap(nullptr, value.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+    }
+    if (addr != MAP_FAILED) {
+      memcpy(addr, value.data(), value.size());
+      munmap(addr, value.size());
+      ::android::status_t status = parcel->writeInt32(1);
+      if (status != ::android::OK) return status;
+      status = parcel->writeInt32(static_cast<int32_t>(value.size()));
+      if (status != ::android::OK) return status;
+      return parcel->writeParcelable(::android::os::ParcelFileDescriptor(std::move(fd)));
+    }
+  }
+  ::android::status_t status = parcel->writeInt32(0);
+  if (status != ::android::OK) return status;
+  return parcel->writeByteVector(value);
 }
 
-unique_ptr<AstNode> GotoErrorOnBadStatus() {
-  IfStatement* ret = new IfStatement(new Comparison(
-      new LiteralExpression(kAndroidStatusVarName), "!=",
-      new LiteralExpression(kAndroidStatusOk)));
-  ret->OnTrue()->AddLiteral(StringPrintf("goto %s", kErrorLabel));
-  return unique_ptr<AstNode>(ret);
+}  // namespace
+)";
+
+const char kSharedMemoryReader[] =
+    R"(namespace {
+
+::android::status_t ReadSharedMemoryByteVector(const ::android::Parcel& parcel,
+                                               ::std::vector<uint8_t>* value) {
+  int32_t kind;
+  ::android::status_t status = parcel.readInt32(&kind);
+  if (status != ::android::OK) return status;
+  if (kind == 0) return parcel.readByteVector(value);
+  int32_t size;
+  status = parcel.readInt32(&size);
+  if (status != ::android::OK) return status;
+  if (size <= 0) return ::android::BAD_VALUE;
+  ::android::os::ParcelFileDescriptor region;
+  status = parcel.readParcelable(&region);
+  if (status != ::android::OK) return status;
+  // A region smaller than the size would fault when read.
+  struct stat st;
+  if (fstat(region.get(), &st) != 0 || (S_ISREG(st.st_mode) && st.st_size < size)) {
+    return ::android::BAD_VALUE;
+  }
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, region.get(), 0);
+  if (addr == MAP_FAILED) return ::android::NO_MEMORY;
+  const uint8_t* begin = static_cast<const uint8_t*>(addr);
+  value->assign(begin, begin + size);
+  munmap(addr, size);
+  return ::android::OK;
+}
+
+}  // namespace
+)";
+
+// @View arguments are received as an ArrayView over the data parcel, which is
+// declared in every interface header that needs it. The elements are laid out
+// as a vector of them is written.
+const char kArrayViewDeclaration[] =
+    R"(#ifndef AIDL_ARRAY_VIEW_DECLARED_
+#define AIDL_ARRAY_VIEW_DECLARED_
+
+namespace android {
+
+namespace aidl {
+
+// A read-only view of an array that it doesn't own. The elements of a @View
+// argument are only valid until the method returns.
+template <typename T>
+class ArrayView {
+public:
+  ArrayView() = default;
+  ArrayView(const T* data, size_t size) : data_(data), size_(size) {}
+  ArrayView(const ::std::vector<T>& vector)  // NOLINT(google-explicit-constructor)
+      : data_(vector.data()), size_(vector.size()) {}
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+  const T& operator[](size_t i) const { return data_[i]; }
+  ::std::vector<T> ToVector() const { return ::std::vector<T>(begin(), end()); }
+
+private:
+  const T* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // AIDL_ARRAY_VIEW_DECLARED_
+)";
+
+// @Raw parcelables are passed as a Raw<T>, which is declared in every interface
+// header that needs it.
+const char kRawParcelableDeclaration[] =
+    R"(#ifndef AIDL_RAW_PARCELABLE_DECLARED_
+#define AIDL_RAW_PARCELABLE_DECLARED_
+
+namespace android {
+
+namespace aidl {
+
+// A structured parcelable T kept as the bytes it was read from, which are
+// written back as they are. Relaying it costs a copy of the bytes rather than
+// decoding and encoding it. Copies share the bytes, which don't change.
+template <typename T>
+class Raw : public ::android::Parcelable {
+public:
+  Raw() = default;
+  explicit Raw(const T& value) {
+    auto data = ::std::make_shared<::android::Parcel>();
+    encoded_ = value.writeToParcel(data.get());
+    data_ = ::std::move(data);
+  }
+
+  // Decodes the parcelable into |value|.
+  ::android::status_t decode(T* value) const {
+    if (encoded_ != ::android::OK) return encoded_;
+    if (data_ == nullptr) {
+      *value = T();
+      return ::android::OK;
+    }
+    ::android::Parcel parcel;
+    ::android::status_t status = parcel.appendFrom(data_.get(), 0, data_->dataSize());
+    if (status != ::android::OK) return status;
+    parcel.setDataPosition(0);
+    return value->readFromParcel(&parcel);
+  }
+
+  ::android::status_t readFromParcel(const ::android::Parcel* parcel) override {
+    size_t start = parcel->dataPosition();
+    int32_t size = parcel->readInt32();
+    if (size < 4) return ::android::BAD_VALUE;
+    auto data = ::std::make_shared<::android::Parcel>();
+    encoded_ = data->appendFrom(parcel, start, static_cast<size_t>(size));
+    if (encoded_ != ::android::OK) return encoded_;
+    parcel->setDataPosition(start + static_cast<size_t>(size));
+    data_ = ::std::move(data);
+    return ::android::OK;
+  }
+
+  ::android::status_t writeToParcel(::android::Parcel* parcel) const override {
+    if (encoded_ != ::android::OK) return encoded_;
+    if (data_ == nullptr) return T().writeToParcel(parcel);
+    return parcel->appendFrom(data_.get(), 0, data_->dataSize());
+  }
+
+private:
+  ::std::shared_ptr<const ::android::Parcel> data_;
+  ::android::status_t encoded_ = ::android::OK;
+};
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // AIDL_RAW_PARCELABLE_DECLARED_
+)";
+
+// @Chunked results are written a chunk at a time, and the elements that don't
+// fit in the reply are kept by a cursor binder of the stub until the client
+// reads them. The templates are declared in every interface header that needs
+// them.
+const char kChunkedDeclaration[] =
+    R"(#ifndef AIDL_CHUNKED_DECLARED_
+#define AIDL_CHUNKED_DECLARED_
+
+namespace android {
+
+namespace aidl {
+
+// Writes the elements of |values| from |*position| on, as a count followed by
+// the parcelables, until the next one would take the chunk over |budget|
+// bytes. A chunk has at least one element if any are left.
+template <typename T>
+::android::status_t writeChunk(::android::Parcel* parcel, const ::std::vector<T>& values,
+                               size_t* position, size_t budget) {
+  const size_t count_position = parcel->dataPosition();
+  ::android::status_t status = parcel->writeInt32(0);
+  if (status != ::android::OK) return status;
+  const size_t start = parcel->dataPosition();
+  int32_t count = 0;
+  while (*position < values.size()) {
+    const size_t element_position = parcel->dataPosition();
+    status = parcel->writeParcelable(values[*position]);
+    if (status != ::android::OK) return status;
+    if (count > 0 && parcel->dataPosition() - start > budget) {
+      parcel->setDataSize(element_position);
+      parcel->setDataPosition(element_position);
+      break;
+    }
+    ++*position;
+    ++count;
+  }
+  const size_t end = parcel->dataPosition();
+  parcel->setDataPosition(count_position);
+  status = parcel->writeInt32(count);
+  parcel->setDataPosition(end);
+  return status;
+}
+
+// Appends the elements of a chunk that writeChunk wrote to |values|.
+template <typename T>
+::android::status_t readChunk(const ::android::Parcel& parcel, ::std::vector<T>* values) {
+  int32_t count;
+  ::android::status_t status = parcel.readInt32(&count);
+  if (status != ::android::OK) return status;
+  // Each element takes at least the 4 bytes that tell it isn't null.
+  if (count < 0 || static_cast<size_t>(count) > parcel.dataAvail() / 4) {
+    return ::android::BAD_VALUE;
+  }
+  if (values->empty()) values->reserve(count);
+  for (int32_t i = 0; i < count; i++) {
+    values->emplace_back();
+    status = parcel.readParcelable(&values->back());
+    if (status != ::android::OK) return status;
+  }
+  return ::android::OK;
+}
+
+// The elements of a @Chunked result that didn't fit in the reply. Each
+// transaction of the client reads the next chunk of them, followed by whether
+// there are more. They are dropped once all are read, or when the client
+// lets go of the cursor.
+template <typename T>
+class ChunkCursor : public ::android::BBinder {
+public:
+  ChunkCursor(::std::vector<T>&& values, size_t position, size_t budget)
+      : values_(::std::move(values)), position_(position), budget_(budget) {}
+
+  ::android::status_t onTransact(uint32_t code, const ::android::Parcel& data,
+                                 ::android::Parcel* reply, uint32_t flags) override {
+    if (code != ::android::IBinder::FIRST_CALL_TRANSACTION) {
+      return ::android::BBinder::onTransact(code, data, reply, flags);
+    }
+    ::std::lock_guard<::std::mutex> lock(mutex_);
+    ::android::status_t status = writeChunk(reply, values_, &position_, budget_);
+    if (status != ::android::OK) return status;
+    const bool more = position_ < values_.size();
+    if (!more) ::std::vector<T>().swap(values_);
+    return reply->writeBool(more);
+  }
+
+private:
+  ::std::mutex mutex_;
+  ::std::vector<T> values_;
+  size_t position_;
+  const size_t budget_;
+};
+
+// Writes the first chunk of |values|, followed by a cursor with the rest, or
+// by null if they all fit.
+template <typename T>
+::android::status_t writeChunks(::android::Parcel* parcel, ::std::vector<T>&& values,
+                                size_t budget) {
+  size_t position = 0;
+  ::android::status_t status = writeChunk(parcel, values, &position, budget);
+  if (status != ::android::OK) return status;
+  if (position == values.size()) return parcel->writeStrongBinder(nullptr);
+  return parcel->writeStrongBinder(::android::sp<::android::IBinder>(
+      new ChunkCursor<T>(::std::move(values), position, budget)));
+}
+
+// Reads a @Chunked result a chunk at a time, so that the caller can work on
+// the first elements while the server still holds the rest. A chunk is only
+// asked for once the one before it is taken, so the binder buffers hold one
+// chunk of the result at a time.
+template <typename T>
+class ChunkReader {
+public:
+  // Reads what writeChunks wrote.
+  ::android::status_t readFromParcel(const ::android::Parcel& parcel) {
+    first_.clear();
+    ::android::status_t status = readChunk(parcel, &first_);
+    if (status != ::android::OK) return status;
+    has_first_ = true;
+    return parcel.readNullableStrongBinder(&cursor_);
+  }
+
+  // Takes a result that is already whole as the only chunk.
+  void reset(::std::vector<T>&& values) {
+    first_ = ::std::move(values);
+    has_first_ = true;
+    cursor_ = nullptr;
+  }
+
+  // Moves the next chunk into |chunk|, which is left empty once all of the
+  // elements are read.
+  ::android::status_t next(::std::vector<T>* chunk) {
+    chunk->clear();
+    if (has_first_) {
+      has_first_ = false;
+      chunk->swap(first_);
+      return ::android::OK;
+    }
+    return cursor_ != nullptr ? pull(chunk) : ::android::OK;
+  }
+
+  // Appends all of the elements that are left to |values|.
+  ::android::status_t readAll(::std::vector<T>* values) {
+    if (has_first_) {
+      has_first_ = false;
+      if (values->empty()) {
+        values->swap(first_);
+      } else {
+        values->insert(values->end(), ::std::make_move_iterator(first_.begin()),
+                       ::std::make_move_iterator(first_.end()));
+        first_.clear();
+      }
+    }
+    while (cursor_ != nullptr) {
+      ::android::status_t status = pull(values);
+      if (status != ::android::OK) return status;
+    }
+    return ::android::OK;
+  }
+
+private:
+  // Appends the next chunk of the cursor to |values|.
+  ::android::status_t pull(::std::vector<T>* values) {
+    ::android::Parcel data;
+    ::android::Parcel reply;
+    ::android::status_t status =
+        cursor_->transact(::android::IBinder::FIRST_CALL_TRANSACTION, data, &reply);
+    if (status != ::android::OK) return status;
+    status = readChunk(reply, values);
+    if (status != ::android::OK) return status;
+    bool more;
+    status = reply.readBool(&more);
+    if (status != ::android::OK) return status;
+    if (!more) cursor_ = nullptr;
+    return ::android::OK;
+  }
+
+  ::std::vector<T> first_;
+  bool has_first_ = false;
+  ::android::sp<::android::IBinder> cursor_;
+};
+
+// Reads the whole of what writeChunks wrote into |values|.
+template <typename T>
+::android::status_t readChunks(const ::android::Parcel& parcel, ::std::vector<T>* values) {
+  values->clear();
+  ChunkReader<T> reader;
+  ::android::status_t status = reader.readFromParcel(parcel);
+  if (status != ::android::OK) return status;
+  return reader.readAll(values);
+}
+
+}  // namespace aidl
+
+}  // namespace android
+
+#endif  // AIDL_CHUNKED_DECLARED_
+)";
+
+const char kArrayViewWriter[] =
+    R"(namespace {
+
+template <typename T>
+::android::status_t WriteArrayView(::android::Parcel* parcel,
+                                   ::android::aidl::ArrayView<T> value) {
+  if (value.size() > INT32_MAX / sizeof(T)) return ::android::BAD_VALUE;
+  ::android::status_t status = parcel->writeInt32(static_cast<int32_t>(value.size()));
+  if (status != ::android::OK || value.empty()) return status;
+  void* data = parcel->writeInplace(value.size() * sizeof(T));
+  if (data == nullptr) return ::android::NO_MEMORY;
+  memcpy(data, value.data(), value.size() * sizeof(T));
+  return ::android::OK;
+}
+
+}  // namespace
+)";
+
+const char kArrayViewReader[] =
+    R"(namespace {
+
+template <typename T>
+::android::status_t ReadArrayView(const ::android::Parcel* parcel,
+                                  ::android::aidl::ArrayView<T>* value) {
+  int32_t size;
+  ::android::status_t status = parcel->readInt32(&size);
+  if (status != ::android::OK) return status;
+  if (size < 0) return ::android::UNEXPECTED_NULL;
+  if (static_cast<size_t>(size) > parcel->dataAvail() / sizeof(T)) return ::android::BAD_VALUE;
+  const void* data = size == 0 ? nullptr : parcel->readInplace(size * sizeof(T));
+  if (size != 0 && data == nullptr) return ::android::BAD_VALUE;
+  *value = ::android::aidl::ArrayView<T>(static_cast<const T*>(data), size);
+  return ::android::OK;
+}
+
+}  // namespace
+)";
+
+// With --bulk-fd-arrays, the parcel grows once for all of the descriptors of
+// an array, and the vector read into is resized once, keeping its capacity.
+// Each descriptor still takes an object of its own, as the driver translates
+// them one by one.
+const char kFileDescriptorArrayHelpers[] =
+    R"(namespace {
+
+// A flat_binder_object
+constexpr size_t kFileDescriptorObjectSize = 24;
+
+inline size_t FileDescriptorEntrySize(const ::android::base::unique_fd*) {
+  return kFileDescriptorObjectSize;
+}
+
+inline ::android::status_t WriteFileDescriptorEntry(::android::Parcel* parcel,
+                                                    const ::android::base::unique_fd& entry) {
+  return parcel->writeUniqueFileDescriptor(entry);
+}
+
+inline ::android::status_t ReadFileDescriptorEntry(const ::android::Parcel* parcel,
+                                                   ::android::base::unique_fd* entry) {
+  return parcel->readUniqueFileDescriptor(entry);
+}
+
+// A ParcelFileDescriptor is written as a parcelable: the non-null marker, the
+// flag of its comm channel and the descriptor.
+inline size_t FileDescriptorEntrySize(const ::android::os::ParcelFileDescriptor*) {
+  return 4 + 4 + kFileDescriptorObjectSize;
+}
+
+inline ::android::status_t WriteFileDescriptorEntry(
+    ::android::Parcel* parcel, const ::android::os::ParcelFileDescriptor& entry) {
+  return parcel->writeParcelable(entry);
+}
+
+inline ::android::status_t ReadFileDescriptorEntry(const ::android::Parcel* parcel,
+                                                   ::android::os::ParcelFileDescriptor* entry) {
+  return parcel->readParcelable(entry);
+}
+
+template <typename T>
+::android::status_t WriteFileDescriptorArray(::android::Parcel* parcel,
+                                             const std::vector<T>& value) {
+  if (value.size() > INT32_MAX) return ::android::BAD_VALUE;
+  ::android::status_t status = parcel->setDataCapacity(
+      parcel->dataSize() + 4 + value.size() * FileDescriptorEntrySize(value.data()));
+  if (status != ::android::OK) return status;
+  status = parcel->writeInt32(static_cast<int32_t>(value.size()));
+  for (size_t i = 0; i < value.size() && status == ::android::OK; i++) {
+    status = WriteFileDescriptorEntry(parcel, value[i]);
+  }
+  return status;
+}
+
+template <typename T>
+::android::status_t ReadFileDescriptorArray(const ::android::Parcel* parcel,
+                                            std::vector<T>* value) {
+  int32_t size;
+  ::android::status_t status = parcel->readInt32(&size);
+  if (status != ::android::OK) return status;
+  if (size < 0) return ::android::UNEXPECTED_NULL;
+  // Each entry is an object of the parcel.
+  if (static_cast<size_t>(size) > parcel->objectsCount()) return ::android::BAD_VALUE;
+  value->resize(size);
+  for (T& entry : *value) {
+    status = ReadFileDescriptorEntry(parcel, &entry);
+    if (status != ::android::OK) return status;
+  }
+  return ::android::OK;
+}
+
+}  // namespace
+)";
+
+// Whether |type| is read and written with the helpers of
+// kFileDescriptorArrayHelpers, which are for non-nullable arrays and Lists of
+// FileDescriptor and ParcelFileDescriptor with --bulk-fd-arrays.
+bool IsBulkFileDescriptorArray(const Options& options, const AidlTypeSpecifier& type) {
+  if (!options.BulkFdArrays() || type.IsNullable() || !(type.IsArray() || type.IsGeneric())) {
+    return false;
+  }
+  const string& element = type.IsGeneric() ? type.GetTypeParameters().at(0)->GetName()
+                                           : type.GetName();
+  return element == "FileDescriptor" || element == "ParcelFileDescriptor";
+}
+
+// Whether one of |types| is read or written with the helpers of
+// kFileDescriptorArrayHelpers, which need binder/ParcelFileDescriptor.h.
+bool UsesFileDescriptorArrayHelpers(const Options& options,
+                                    const vector<const AidlTypeSpecifier*>& types) {
+  return std::any_of(types.begin(), types.end(), [&options](const AidlTypeSpecifier* type) {
+    return IsBulkFileDescriptorArray(options, *type);
+  });
+}
+
+// The types that the methods of |interface| read and write.
+vector<const AidlTypeSpecifier*> MethodTypesOf(const AidlInterface& interface) {
+  vector<const AidlTypeSpecifier*> types;
+  for (const auto& method : interface.GetMethods()) {
+    types.push_back(&method->GetType());
+    for (const auto& arg : method->GetArguments()) {
+      types.push_back(&arg->GetType());
+    }
+  }
+  return types;
+}
+
+// A @FixedSize array is written as other arrays are: its length, then its
+// elements. The reader takes one of that length only. Parcel writes each byte,
+// int, long, float and double as it is laid out in the std::array, so they are
+// copied as one block. A boolean or char takes an int32 of its own.
+const char kFixedSizeArrayHelpers[] =
+    R"(namespace {
+
+template <typename T, size_t N>
+::android::status_t WriteFixedSizeArray(::android::Parcel* parcel,
+                                        const ::std::array<T, N>& value) {
+  ::android::status_t status = parcel->writeInt32(static_cast<int32_t>(N));
+  if (status != ::android::OK) return status;
+  if constexpr (::std::is_same_v<T, bool> || ::std::is_same_v<T, char16_t>) {
+    for (size_t i = 0; i < N && status == ::android::OK; i++) {
+      status = parcel->writeInt32(static_cast<int32_t>(value[i]));
+    }
+    return status;
+  } else {
+    void* bytes = parcel->writeInplace(N * sizeof(T));
+    if (bytes == nullptr) return ::android::NO_MEMORY;
+    memcpy(bytes, value.data(), N * sizeof(T));
+    return ::android::OK;
+  }
+}
+
+template <typename T, size_t N>
+::android::status_t ReadFixedSizeArray(const ::android::Parcel* parcel,
+                                       ::std::array<T, N>* value) {
+  int32_t size;
+  ::android::status_t status = parcel->readInt32(&size);
+  if (status != ::android::OK) return status;
+  if (size < 0) return ::android::UNEXPECTED_NULL;
+  if (static_cast<size_t>(size) != N) return ::android::BAD_VALUE;
+  if constexpr (::std::is_same_v<T, bool> || ::std::is_same_v<T, char16_t>) {
+    for (size_t i = 0; i < N; i++) {
+      int32_t element;
+      status = parcel->readInt32(&element);
+      if (status != ::android::OK) return status;
+      (*value)[i] = static_cast<T>(element);
+    }
+    return ::android::OK;
+  } else {
+    const void* bytes = parcel->readInplace(N * sizeof(T));
+    if (bytes == nullptr) return ::android::BAD_VALUE;
+    memcpy(value->data(), bytes, N * sizeof(T));
+    return ::android::OK;
+  }
+}
+
+}  // namespace
+)";
+
+// Whether one of |types| is read or written with the helpers of
+// kFixedSizeArrayHelpers, which need array, cstring and type_traits.
+bool UsesFixedSizeArrayHelpers(const vector<const AidlTypeSpecifier*>& types) {
+  return std::any_of(types.begin(), types.end(),
+                     [](const AidlTypeSpecifier* type) { return type->IsFixedSize(); });
+}
+
+// The Strings of a @Utf8Strings interface are written as in other interfaces,
+// or as kUtf8StringTag and a byte array of their UTF-8 encoding, which a
+// reader of std::string takes as it is. A null String is always written as
+// in other interfaces. The readers take either form, and tell in |*utf8|
+// that the peer wrote UTF-8, so that the reply can be written the same way.
+const char kUtf8StringHelpers[] =
+    R"(namespace {
+
+constexpr int32_t kUtf8StringTag = -2;
+
+inline ::android::status_t WriteUtf8Bytes(::android::Parcel* parcel, const char* data,
+                                          size_t size) {
+  if (size > INT32_MAX) return ::android::BAD_VALUE;
+  ::android::status_t status = parcel->writeInt32(kUtf8StringTag);
+  if (status != ::android::OK) return status;
+  status = parcel->writeInt32(static_cast<int32_t>(size));
+  if (status != ::android::OK || size == 0) return status;
+  void* bytes = parcel->writeInplace(size);
+  if (bytes == nullptr) return ::android::NO_MEMORY;
+  memcpy(bytes, data, size);
+  return ::android::OK;
+}
+
+// Reads a String written as UTF-8, or leaves the parcel where it was with
+// *tagged set to false.
+inline ::android::status_t ReadUtf8Bytes(const ::android::Parcel* parcel, ::std::string* value,
+                                         bool* tagged) {
+  const size_t start = parcel->dataPosition();
+  int32_t tag;
+  ::android::status_t status = parcel->readInt32(&tag);
+  if (status != ::android::OK) return status;
+  *tagged = tag == kUtf8StringTag;
+  if (!*tagged) {
+    parcel->setDataPosition(start);
+    return ::android::OK;
+  }
+  int32_t size;
+  status = parcel->readInt32(&size);
+  if (status != ::android::OK) return status;
+  if (size < 0 || static_cast<size_t>(size) > parcel->dataAvail()) return ::android::BAD_VALUE;
+  const void* bytes = size == 0 ? nullptr : parcel->readInplace(size);
+  if (size != 0 && bytes == nullptr) return ::android::BAD_VALUE;
+  value->assign(static_cast<const char*>(bytes), size);
+  return ::android::OK;
+}
+
+inline ::android::status_t WriteUtf8String(::android::Parcel* parcel, const ::std::string& value,
+                                           bool utf8) {
+  return utf8 ? WriteUtf8Bytes(parcel, value.data(), value.size())
+              : parcel->writeUtf8AsUtf16(value);
+}
+
+inline ::android::status_t WriteUtf8String(::android::Parcel* parcel,
+                                           const ::std::unique_ptr<::std::string>& value,
+                                           bool utf8) {
+  return value ? WriteUtf8String(parcel, *value, utf8) : parcel->writeUtf8AsUtf16(value);
+}
+
+inline ::android::status_t WriteUtf8String(::android::Parcel* parcel,
+                                           const ::std::optional<::std::string>& value,
+                                           bool utf8) {
+  return value ? WriteUtf8String(parcel, *value, utf8) : parcel->writeUtf8AsUtf16(value);
+}
+
+inline ::android::status_t WriteUtf8String(::android::Parcel* parcel,
+                                           const ::android::String16& value, bool utf8) {
+  if (!utf8) return parcel->writeString16(value);
+  const ::android::String8 bytes(value);
+  return WriteUtf8Bytes(parcel, bytes.string(), bytes.size());
+}
+
+inline ::android::status_t WriteUtf8String(::android::Parcel* parcel,
+                                           const ::std::unique_ptr<::android::String16>& value,
+                                           bool utf8) {
+  return value ? WriteUtf8String(parcel, *value, utf8) : parcel->writeString16(value);
+}
+
+inline ::android::status_t WriteUtf8String(::android::Parcel* parcel,
+                                           const ::std::optional<::android::String16>& value,
+                                           bool utf8) {
+  return value ? WriteUtf8String(parcel, *value, utf8) : parcel->writeString16(value);
+}
+
+inline ::android::status_t ReadUtf8String(const ::android::Parcel* parcel, ::std::string* value,
+                                          bool* utf8) {
+  bool tagged;
+  ::android::status_t status = ReadUtf8Bytes(parcel, value, &tagged);
+  if (status != ::android::OK) return status;
+  if (!tagged) return parcel->readUtf8FromUtf16(value);
+  if (utf8 != nullptr) *utf8 = true;
+  return ::android::OK;
+}
+
+inline ::android::status_t ReadUtf8String(const ::android::Parcel* parcel,
+                                          ::std::unique_ptr<::std::string>* value, bool* utf8) {
+  // Bytes go into the string that |value| holds already, if there is one.
+  ::std::string bytes;
+  ::std::string* target = *value ? value->get() : &bytes;
+  bool tagged;
+  ::android::status_t status = ReadUtf8Bytes(parcel, target, &tagged);
+  if (status != ::android::OK) return status;
+  if (!tagged) return parcel->readUtf8FromUtf16(value);
+  if (utf8 != nullptr) *utf8 = true;
+  if (target == &bytes) *value = ::std::make_unique<::std::string>(::std::move(bytes));
+  return ::android::OK;
+}
+
+inline ::android::status_t ReadUtf8String(const ::android::Parcel* parcel,
+                                          ::std::optional<::std::string>* value, bool* utf8) {
+  ::std::string bytes;
+  ::std::string* target = value->has_value() ? &**value : &bytes;
+  bool tagged;
+  ::android::status_t status = ReadUtf8Bytes(parcel, target, &tagged);
+  if (status != ::android::OK) return status;
+  if (!tagged) return parcel->readUtf8FromUtf16(value);
+  if (utf8 != nullptr) *utf8 = true;
+  if (target == &bytes) *value = ::std::move(bytes);
+  return ::android::OK;
+}
+
+inline ::android::status_t ReadUtf8String(const ::android::Parcel* parcel,
+                                          ::android::String16* value, bool* utf8) {
+  ::std::string bytes;
+  bool tagged;
+  ::android::status_t status = ReadUtf8Bytes(parcel, &bytes, &tagged);
+  if (status != ::android::OK) return status;
+  if (!tagged) return parcel->readString16(value);
+  if (utf8 != nullptr) *utf8 = true;
+  *value = ::android::String16(bytes.data(), bytes.size());
+  return ::android::OK;
+}
+
+inline ::android::status_t ReadUtf8String(const ::android::Parcel* parcel,
+                                          ::std::unique_ptr<::android::String16>* value,
+                                          bool* utf8) {
+  ::std::string bytes;
+  bool tagged;
+  ::android::status_t status = ReadUtf8Bytes(parcel, &bytes, &tagged);
+  if (status != ::android::OK) return status;
+  if (!tagged) return parcel->readString16(value);
+  if (utf8 != nullptr) *utf8 = true;
+  *value = ::std::make_unique<::android::String16>(bytes.data(), bytes.size());
+  return ::android::OK;
+}
+
+inline ::android::status_t ReadUtf8String(const ::android::Parcel* parcel,
+                                          ::std::optional<::android::String16>* value,
+                                          bool* utf8) {
+  ::std::string bytes;
+  bool tagged;
+  ::android::status_t status = ReadUtf8Bytes(parcel, &bytes, &tagged);
+  if (status != ::android::OK) return status;
+  if (!tagged) return parcel->readString16(value);
+  if (utf8 != nullptr) *utf8 = true;
+  value->emplace(bytes.data(), bytes.size());
+  return ::android::OK;
+}
+
+}  // namespace
+)";
+
+// Whether one of |methods| of |interface| reads or writes a String with the
+// helpers of kUtf8StringHelpers, which need cstring, optional and
+// utils/String8.h.
+bool UsesUtf8StringHelpers(const AidlInterface& interface,
+                           const vector<const AidlMethod*>& methods) {
+  return std::any_of(methods.begin(), methods.end(), [&interface](const AidlMethod* method) {
+    return interface.HasUtf8WireStrings(*method);
+  });
+}
+
+// The boolean[] and char[] of a @PackedArrays interface are written as their
+// length, or -1 for null, then a byte array of the elements, one bit per
+// boolean and two little-endian bytes per char. Parcel writes each of them
+// as an int32 otherwise.
+const char kPackedArrayHelpers[] =
+    R"(namespace {
+
+constexpr size_t PackedBitsOf(const ::std::vector<bool>*) {
+  return 1;
+}
+
+constexpr size_t PackedBitsOf(const ::std::vector<char16_t>*) {
+  return 16;
+}
+
+inline void PackArray(const ::std::vector<bool>& value, uint8_t* bytes) {
+  for (size_t i = 0; i < value.size(); i += 8) {
+    uint8_t byte = 0;
+    for (size_t bit = 0; bit < 8 && i + bit < value.size(); bit++) {
+      byte |= static_cast<uint8_t>(value[i + bit]) << bit;
+    }
+    bytes[i / 8] = byte;
+  }
+}
+
+inline void PackArray(const ::std::vector<char16_t>& value, uint8_t* bytes) {
+  memcpy(bytes, value.data(), value.size() * sizeof(char16_t));
+}
+
+inline void UnpackArray(const uint8_t* bytes, ::std::vector<bool>* value) {
+  for (size_t i = 0; i < value->size(); i++) {
+    (*value)[i] = (bytes[i / 8] >> (i % 8)) & 1;
+  }
+}
+
+inline void UnpackArray(const uint8_t* bytes, ::std::vector<char16_t>* value) {
+  memcpy(value->data(), bytes, value->size() * sizeof(char16_t));
+}
+
+template <typename T>
+::android::status_t WritePackedArray(::android::Parcel* parcel, const ::std::vector<T>& value) {
+  const uint64_t size = (static_cast<uint64_t>(value.size()) * PackedBitsOf(&value) + 7) / 8;
+  if (value.size() > INT32_MAX || size > INT32_MAX) return ::android::BAD_VALUE;
+  ::android::status_t status = parcel->writeInt32(static_cast<int32_t>(value.size()));
+  if (status != ::android::OK) return status;
+  status = parcel->writeInt32(static_cast<int32_t>(size));
+  if (status != ::android::OK || size == 0) return status;
+  void* bytes = parcel->writeInplace(size);
+  if (bytes == nullptr) return ::android::NO_MEMORY;
+  PackArray(value, static_cast<uint8_t*>(bytes));
+  return ::android::OK;
+}
+
+template <typename T>
+::android::status_t WritePackedArray(::android::Parcel* parcel,
+                                     const ::std::unique_ptr<::std::vector<T>>& value) {
+  return value ? WritePackedArray(parcel, *value) : parcel->writeInt32(-1);
+}
+
+template <typename T>
+::android::status_t WritePackedArray(::android::Parcel* parcel,
+                                     const ::std::optional<::std::vector<T>>& value) {
+  return value ? WritePackedArray(parcel, *value) : parcel->writeInt32(-1);
+}
+
+template <typename T>
+::android::status_t ReadPackedElements(const ::android::Parcel* parcel, int32_t count,
+                                       ::std::vector<T>* value) {
+  int32_t size;
+  ::android::status_t status = parcel->readInt32(&size);
+  if (status != ::android::OK) return status;
+  const uint64_t expected = (static_cast<uint64_t>(count) * PackedBitsOf(value) + 7) / 8;
+  if (size < 0 || static_cast<uint64_t>(size) != expected) return ::android::BAD_VALUE;
+  const void* bytes = size == 0 ? nullptr : parcel->readInplace(size);
+  if (size != 0 && bytes == nullptr) return ::android::BAD_VALUE;
+  value->resize(count);
+  if (count != 0) UnpackArray(static_cast<const uint8_t*>(bytes), value);
+  return ::android::OK;
+}
+
+template <typename T>
+::android::status_t ReadPackedArray(const ::android::Parcel* parcel, ::std::vector<T>* value) {
+  int32_t count;
+  ::android::status_t status = parcel->readInt32(&count);
+  if (status != ::android::OK) return status;
+  if (count < 0) return ::android::UNEXPECTED_NULL;
+  return ReadPackedElements(parcel, count, value);
+}
+
+template <typename T>
+::android::status_t ReadPackedArray(const ::android::Parcel* parcel,
+                                    ::std::unique_ptr<::std::vector<T>>* value) {
+  int32_t count;
+  ::android::status_t status = parcel->readInt32(&count);
+  if (status != ::android::OK) return status;
+  if (count < 0) {
+    value->reset();
+    return ::android::OK;
+  }
+  if (!*value) *value = ::std::make_unique<::std::vector<T>>();
+  return ReadPackedElements(parcel, count, value->get());
+}
+
+template <typename T>
+::android::status_t ReadPackedArray(const ::android::Parcel* parcel,
+                                    ::std::optional<::std::vector<T>>* value) {
+  int32_t count;
+  ::android::status_t status = parcel->readInt32(&count);
+  if (status != ::android::OK) return status;
+  if (count < 0) {
+    value->reset();
+    return ::android::OK;
+  }
+  if (!value->has_value()) value->emplace();
+  return ReadPackedElements(parcel, count, &**value);
+}
+
+}  // namespace
+)";
+
+// Whether one of |methods| of |interface| reads or writes an array with the
+// helpers of kPackedArrayHelpers, which need cstdint, cstring and optional.
+bool UsesPackedArrayHelpers(const AidlInterface& interface,
+                            const vector<const AidlMethod*>& methods) {
+  return std::any_of(methods.begin(), methods.end(), [&interface](const AidlMethod* method) {
+    return interface.IsPackedWireArray(method->GetType()) ||
+           std::any_of(method->GetArguments().begin(), method->GetArguments().end(),
+                       [&interface](const auto& arg) {
+                         return interface.IsPackedWireArray(arg->GetType());
+                       });
+  });
+}
+
+// The methods of |interface|.
+vector<const AidlMethod*> MethodsOf(const AidlInterface& interface) {
+  vector<const AidlMethod*> methods;
+  for (const auto& method : interface.GetMethods()) {
+    methods.push_back(method.get());
+  }
+  return methods;
+}
+
+// Whether a proxy of |interface| writes the Strings of @Utf8Strings as UTF-8.
+// A versioned one does once the remote has the version of the annotation,
+// which getInterfaceVersion() reads only once.
+string Utf8StringsOfClient(const AidlInterface& interface, const Options& options) {
+  if (options.Version() == 0) {
+    return "true";
+  }
+  return kGetInterfaceVersion + "() >= " + ClassName(interface, ClassNames::INTERFACE) +
+         "::VERSION";
+}
+
+// Returns the element type of |type| if it is a non-nullable array or List of
+// a parcelable that reads and writes vectors of itself with --parcel-traits.
+const AidlTypeSpecifier* FixedLayoutElementOf(const AidlTypenames& typenames,
+                                              const Options& options,
+                                              const AidlTypeSpecifier& type) {
+  if (!options.ParcelTraits() || type.IsNullable() || !(type.IsArray() || type.IsGeneric())) {
+    return nullptr;
+  }
+  const AidlTypeSpecifier& element = type.IsGeneric() ? *type.GetTypeParameters().at(0) : type;
+  const AidlDefinedType* defined_type = typenames.TryGetDefinedType(element.GetName());
+  if (defined_type == nullptr) {
+    return nullptr;
+  }
+  const AidlStructuredParcelable* parcelable = defined_type->AsStructuredParcelable();
+  if (parcelable == nullptr || FixedParcelLayoutOf(*parcelable).fields.empty()) {
+    return nullptr;
+  }
+  return &element;
+}
+
+// Returns the call that reads |variable_name| of |type| from |parcel|, which
+// is a Parcel, or a pointer to one if |parcel_is_pointer|.
+string ParcelReadCall(const AidlTypenames& typenames, const Options& options,
+                      const AidlTypeSpecifier& type, const string& parcel, bool parcel_is_pointer,
+                      const string& variable_name) {
+  if (type.IsFixedSize()) {
+    return StringPrintf("ReadFixedSizeArray(%s%s, %s)", parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str());
+  }
+  if (type.IsView()) {
+    return StringPrintf("ReadArrayView(%s%s, %s)", parcel_is_pointer ? "" : "&", parcel.c_str(),
+                        variable_name.c_str());
+  }
+  if (IsBulkFileDescriptorArray(options, type)) {
+    return StringPrintf("ReadFileDescriptorArray(%s%s, %s)", parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str());
+  }
+  if (auto element = FixedLayoutElementOf(typenames, options, type); element != nullptr) {
+    return StringPrintf("::%s::readVectorFromParcel(%s%s, %s)",
+                        Join(element->GetSplitName(), "::").c_str(), parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str());
+  }
+  return StringPrintf("%s%s%s(%s)", parcel.c_str(), parcel_is_pointer ? "->" : ".",
+                      ParcelReadMethodOf(type, typenames).c_str(),
+                      ParcelReadCastOf(type, typenames, variable_name).c_str());
+}
+
+// Returns the call that writes |variable_name| of |type| to |parcel|, which
+// is a Parcel, or a pointer to one if |parcel_is_pointer|.
+string ParcelWriteCall(const AidlTypenames& typenames, const Options& options,
+                       const AidlTypeSpecifier& type, const string& parcel,
+                       bool parcel_is_pointer, const string& variable_name) {
+  if (type.IsFixedSize()) {
+    return StringPrintf("WriteFixedSizeArray(%s%s, %s)", parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str());
+  }
+  if (type.IsView()) {
+    return StringPrintf("WriteArrayView(%s%s, %s)", parcel_is_pointer ? "" : "&", parcel.c_str(),
+                        variable_name.c_str());
+  }
+  if (IsBulkFileDescriptorArray(options, type)) {
+    return StringPrintf("WriteFileDescriptorArray(%s%s, %s)", parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str());
+  }
+  if (auto element = FixedLayoutElementOf(typenames, options, type); element != nullptr) {
+    return StringPrintf("::%s::writeVectorToParcel(%s%s, %s)",
+                        Join(element->GetSplitName(), "::").c_str(), parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str());
+  }
+  return StringPrintf("%s%s%s(%s)", parcel.c_str(), parcel_is_pointer ? "->" : ".",
+                      ParcelWriteMethodOf(type, typenames).c_str(),
+                      ParcelWriteCastOf(type, typenames, variable_name).c_str());
+}
+
+// ParcelReadCall and ParcelWriteCall for an argument or the return value of
+// a method of |interface|, which the annotations of the interface can give
+// helpers of their own. A String of @Utf8Strings passes |utf8|: whether it
+// is written as UTF-8, or the bool* that the reader sets.
+string MethodReadCall(const AidlTypenames& typenames, const Options& options,
+                      const AidlInterface& interface, const AidlTypeSpecifier& type,
+                      const string& parcel, bool parcel_is_pointer, const string& variable_name,
+                      const string& utf8) {
+  if (interface.IsUtf8WireString(type)) {
+    return StringPrintf("ReadUtf8String(%s%s, %s, %s)", parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str(), utf8.c_str());
+  }
+  if (interface.IsPackedWireArray(type)) {
+    return StringPrintf("ReadPackedArray(%s%s, %s)", parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str());
+  }
+  return ParcelReadCall(typenames, options, type, parcel, parcel_is_pointer, variable_name);
+}
+
+string MethodWriteCall(const AidlTypenames& typenames, const Options& options,
+                       const AidlInterface& interface, const AidlTypeSpecifier& type,
+                       const string& parcel, bool parcel_is_pointer, const string& variable_name,
+                       const string& utf8) {
+  if (interface.IsUtf8WireString(type)) {
+    return StringPrintf("WriteUtf8String(%s%s, %s, %s)", parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str(), utf8.c_str());
+  }
+  if (interface.IsPackedWireArray(type)) {
+    return StringPrintf("WritePackedArray(%s%s, %s)", parcel_is_pointer ? "" : "&",
+                        parcel.c_str(), variable_name.c_str());
+  }
+  return ParcelWriteCall(typenames, options, type, parcel, parcel_is_pointer, variable_name);
 }
 
 unique_ptr<AstNode> ReturnOnStatusNotOk() {
@@ -93,21 +1083,43 @@ unique_ptr<AstNode> ReturnOnStatusNotOk() {
   return unique_ptr<AstNode>(ret);
 }
 
-ArgList BuildArgList(const AidlTypenames& typenames, const AidlMethod& method, bool for_declaration,
-                     bool type_name_only = false) {
+// Whether the in argument |a| is passed by value, so that the stub moves what
+// it read into the implementation.
+bool IsMovedInArgument(const AidlTypenames& typenames, const Options& options,
+                       const AidlArgument& a) {
+  if (a.IsOut()) {
+    return false;
+  }
+  // b/144943748: CppNameOf FileDescriptor is unique_fd. Don't pass it by
+  // const reference but by value to make it easier for the user to keep
+  // it beyond the scope of the call. unique_fd is a thin wrapper for an
+  // int (fd) so passing by value is not expensive.
+  if (IsNonCopyableType(a.GetType(), typenames)) {
+    return true;
+  }
+  // With --in-args-by-value, so is everything else that would be passed by
+  // const reference.
+  if (!options.InArgsByValue()) {
+    return false;
+  }
+  const auto definedType = typenames.TryGetDefinedType(a.GetType().GetName());
+  const bool isEnum = definedType && definedType->AsEnumDeclaration() != nullptr;
+  const bool isPrimitive = AidlTypenames::IsPrimitiveTypename(a.GetType().GetName());
+  return !(isPrimitive || isEnum) || a.GetType().IsArray();
+}
+
+vector<string> BuildArgs(const AidlTypenames& typenames, const Options& options,
+                         const AidlMethod& method, bool for_declaration,
+                         bool type_name_only = false) {
   // Build up the argument list for the server method call.
   vector<string> method_arguments;
   for (const unique_ptr<AidlArgument>& a : method.GetArguments()) {
     string literal;
-    // b/144943748: CppNameOf FileDescriptor is unique_fd. Don't pass it by
-    // const reference but by value to make it easier for the user to keep
-    // it beyond the scope of the call. unique_fd is a thin wrapper for an
-    // int (fd) so passing by value is not expensive.
-    const bool nonCopyable = IsNonCopyableType(a->GetType(), typenames);
+    const bool moved = IsMovedInArgument(typenames, options, *a);
     if (for_declaration) {
       // Method declarations need typenames, pointers to out params, and variable
       // names that match the .aidl specification.
-      literal = CppNameOf(a->GetType(), typenames);
+      literal = CppNameOf(a->GetType(), typenames, options);
 
       if (a->IsOut()) {
         literal = literal + "*";
@@ -118,8 +1130,10 @@ ArgList BuildArgList(const AidlTypenames& typenames, const AidlMethod& method, b
         const bool isPrimitive = AidlTypenames::IsPrimitiveTypename(a->GetType().GetName());
 
         // We pass in parameters that are not primitives by const reference.
-        // Arrays of primitives are not primitives.
-        if (!(isPrimitive || isEnum || nonCopyable) || a->GetType().IsArray()) {
+        // Arrays of primitives are not primitives, but views of them are
+        // passed by value.
+        if (!moved && !a->GetType().IsView() &&
+            (!(isPrimitive || isEnum) || a->GetType().IsArray())) {
           literal = "const " + literal + "&";
         }
       }
@@ -130,7 +1144,7 @@ ArgList BuildArgList(const AidlTypenames& typenames, const AidlMethod& method, b
       std::string varName = BuildVarName(*a);
       if (a->IsOut()) {
         literal = "&" + varName;
-      } else if (nonCopyable) {
+      } else if (moved) {
         literal = "std::move(" + varName + ")";
       } else {
         literal = varName;
@@ -142,7 +1156,7 @@ ArgList BuildArgList(const AidlTypenames& typenames, const AidlMethod& method, b
   if (method.GetType().GetName() != "void") {
     string literal;
     if (for_declaration) {
-      literal = CppNameOf(method.GetType(), typenames) + "*";
+      literal = CppNameOf(method.GetType(), typenames, options) + "*";
       if (!type_name_only) {
         literal += " " + string(kReturnVarName);
       }
@@ -152,11 +1166,36 @@ ArgList BuildArgList(const AidlTypenames& typenames, const AidlMethod& method, b
     method_arguments.push_back(literal);
   }
 
-  return ArgList(method_arguments);
+  return method_arguments;
+}
+
+ArgList BuildArgList(const AidlTypenames& typenames, const Options& options,
+                     const AidlMethod& method, bool for_declaration, bool type_name_only = false) {
+  return ArgList(BuildArgs(typenames, options, method, for_declaration, type_name_only));
+}
+
+// The type of the elements of the @Chunked result of |method|.
+string ChunkElementOf(const AidlTypenames& typenames, const Options& options,
+                      const AidlMethod& method) {
+  const AidlTypeSpecifier& type = method.GetType();
+  if (type.IsArray()) {
+    return CppNameOf(type.ArrayBase(), typenames, options);
+  }
+  return CppNameOf(*type.GetTypeParameters()[0], typenames, options);
+}
+
+// The parameters of <method>Chunks(), the variant of the @Chunked |method|
+// that reads the result a chunk at a time.
+vector<string> BuildChunksArgs(const AidlTypenames& typenames, const Options& options,
+                               const AidlMethod& method) {
+  vector<string> args = BuildArgs(typenames, options, method, true /* for method decl */);
+  args.back() = "::android::aidl::ChunkReader<" + ChunkElementOf(typenames, options, method) +
+                ">* " + kReturnVarName;
+  return args;
 }
 
 unique_ptr<Declaration> BuildMethodDecl(const AidlMethod& method, const AidlTypenames& typenames,
-                                        bool for_interface) {
+                                        const Options& options, bool for_interface) {
   uint32_t modifiers = 0;
   if (for_interface) {
     modifiers |= MethodDecl::IS_VIRTUAL;
@@ -167,7 +1206,8 @@ unique_ptr<Declaration> BuildMethodDecl(const AidlMethod& method, const AidlType
 
   return unique_ptr<Declaration>{
       new MethodDecl{kBinderStatusLiteral, method.GetName(),
-                     BuildArgList(typenames, method, true /* for method decl */), modifiers}};
+                     BuildArgList(typenames, options, method, true /* for method decl */),
+                     modifiers}};
 }
 
 unique_ptr<Declaration> BuildMetaMethodDecl(const AidlMethod& method, const AidlTypenames&,
@@ -221,14 +1261,6 @@ std::vector<unique_ptr<Declaration>> NestInNamespaces(unique_ptr<Declaration> de
   return NestInNamespaces(std::move(decls), package);
 }
 
-bool DeclareLocalVariable(const AidlArgument& a, StatementBlock* b,
-                          const AidlTypenames& typenamespaces) {
-  string type = CppNameOf(a.GetType(), typenamespaces);
-
-  b->AddLiteral(type + " " + BuildVarName(a));
-  return true;
-}
-
 string BuildHeaderGuard(const AidlDefinedType& defined_type, ClassNames header_type) {
   string class_name = ClassName(defined_type, header_type);
   for (size_t i = 1; i < class_name.size(); ++i) {
@@ -248,91 +1280,126 @@ string BuildHeaderGuard(const AidlDefinedType& defined_type, ClassNames header_t
   return ret;
 }
 
-unique_ptr<Declaration> DefineClientTransaction(const AidlTypenames& typenames,
-                                                const AidlInterface& interface,
-                                                const AidlMethod& method, const Options& options) {
-  const string i_name = ClassName(interface, ClassNames::INTERFACE);
-  const string bp_name = ClassName(interface, ClassNames::CLIENT);
-  unique_ptr<MethodImpl> ret{
-      new MethodImpl{kBinderStatusLiteral, bp_name, method.GetName(),
-                     ArgList{BuildArgList(typenames, method, true /* for method decl */)}}};
-  StatementBlock* b = ret->GetStatementBlock();
-
-  // Declare parcels to hold our query and the response.
-  b->AddLiteral(StringPrintf("%s %s", kAndroidParcelLiteral, kDataVarName));
-  // Even if we're oneway, the transact method still takes a parcel.
-  b->AddLiteral(StringPrintf("%s %s", kAndroidParcelLiteral, kReplyVarName));
-
-  // Declare the status_t variable we need for error handling.
-  b->AddLiteral(StringPrintf("%s %s = %s", kAndroidStatusLiteral,
-                             kAndroidStatusVarName,
-                             kAndroidStatusOk));
-  // We unconditionally return a Status object.
-  b->AddLiteral(StringPrintf("%s %s", kBinderStatusLiteral, kStatusVarName));
+// Reserves about as much capacity for the data parcel as the arguments take, so
+// that it isn't reallocated while they are written.
+string BuildDataCapacityHint(const AidlTypenames& typenames, const AidlInterface& interface,
+                             const AidlMethod& method) {
+  // The interface token: strict mode policy, work source and the descriptor
+  // as a String16, which is padded to 4 bytes.
+  size_t fixed_size = 4 + 4 + 4 + ((interface.GetCanonicalName().size() + 1) * 2 + 3) / 4 * 4;
+  vector<string> dynamic_sizes;
+  for (const auto& a : method.GetArguments()) {
+    if (a->GetType().IsSharedMemory()) {
+      // Large payloads do not go through the parcel. Reserve the kind, the
+      // length and the region, but no contents.
+      fixed_size += 4 + 4 + 4 + 4;
+    } else if (a->IsIn()) {
+      const string var_name = ((a->IsOut()) ? "*" : "") + a->GetName();
+      ParcelSizeEstimate estimate = ParcelSizeEstimateOf(a->GetType(), typenames, var_name);
+      fixed_size += estimate.fixed_size;
+      if (!estimate.dynamic_size.empty()) {
+        dynamic_sizes.push_back(estimate.dynamic_size);
+      }
+    } else if (a->GetType().IsArray()) {
+      // The size of the out array.
+      fixed_size += 4;
+    }
+  }
+  string capacity = std::to_string(fixed_size);
+  for (const auto& dynamic_size : dynamic_sizes) {
+    capacity += " + " + dynamic_size;
+  }
+  return StringPrintf("%s.setDataCapacity(%s)", kDataVarName, capacity.c_str());
+}
 
-  if (options.GenTraces()) {
-    b->AddLiteral(StringPrintf("::android::ScopedTrace %s(ATRACE_TAG_AIDL, \"%s::%s::cppClient\")",
-                               kTraceVarName, interface.GetName().c_str(),
-                               method.GetName().c_str()));
+// Returns the descriptor that proxies of |interface| write as the interface
+// token.
+string InterfaceTokenOf(const AidlInterface& interface, const Options& options) {
+  if (options.StaticInterfaceToken()) {
+    return ClassName(interface, ClassNames::INTERFACE) + "::descriptor";
   }
+  return "getInterfaceDescriptor()";
+}
 
-  if (options.GenLog()) {
-    b->AddLiteral(GenLogBeforeExecute(bp_name, method, false /* isServer */, false /* isNdk */),
-                  false /* no semicolon */);
+// Returns the condition under which the interface token in the data parcel of
+// a stub of |interface| is the one it expects.
+string CheckInterfaceTokenOf(const AidlInterface& interface, const Options& options) {
+  if (options.StaticInterfaceToken()) {
+    return StringPrintf("%s.enforceInterface(%s::descriptor)", kDataVarName,
+                        ClassName(interface, ClassNames::INTERFACE).c_str());
   }
+  return StringPrintf("%s.checkInterface(this)", kDataVarName);
+}
 
-  // Add the name of the interface we're hoping to call.
-  b->AddStatement(new Assignment(
-      kAndroidStatusVarName,
-      new MethodCall(StringPrintf("%s.writeInterfaceToken",
-                                  kDataVarName),
-                     "getInterfaceDescriptor()")));
-  b->AddStatement(GotoErrorOnBadStatus());
+// Writes the check that follows each parcel call, which runs |on_error|
+// when the call failed.
+void WriteOnStatusNotOk(CodeWriter& out, const Options& options, const string& on_error) {
+  if (options.ColdErrorPaths()) {
+    out << "if (__builtin_expect(" << kAndroidStatusVarName << " != " << kAndroidStatusOk
+        << ", 0)) {\n";
+  } else {
+    out << "if (((" << kAndroidStatusVarName << ") != (" << kAndroidStatusOk << "))) {\n";
+  }
+  out.Indent();
+  out << on_error << ";\n";
+  out.Dedent();
+  out << "}\n";
+}
 
+// Writes the arguments of a call of |method| to |parcel|, a Parcel.
+void WriteClientArguments(CodeWriter& out, const AidlTypenames& typenames,
+                          const AidlInterface& interface, const AidlMethod& method,
+                          const Options& options, const string& parcel, const string& on_error) {
+  if (HasArgTable(interface, method, options)) {
+    vector<string> arg_names;
+    for (const auto& a : method.GetArguments()) {
+      arg_names.push_back(a->GetName());
+    }
+    // The block keeps the error path from jumping over the initializations.
+    out << "{\n";
+    out.Indent();
+    out << GenArgTable(method, false /* is_ndk */, false /* is_server */, arg_names);
+    out << kAndroidStatusVarName << " = ::android::aidl::writeArgs(&" << parcel
+        << ", _aidl_arg_codes, " << std::to_string(arg_names.size()) << ", _aidl_arg_values);\n";
+    out.Dedent();
+    out << "}\n";
+    WriteOnStatusNotOk(out, options, on_error);
+    return;
+  }
   for (const auto& a: method.GetArguments()) {
     const string var_name = ((a->IsOut()) ? "*" : "") + a->GetName();
 
-    if (a->IsIn()) {
+    if (a->GetType().IsSharedMemory()) {
+      out << kAndroidStatusVarName << " = WriteSharedMemoryByteVector(&" << parcel << ", "
+          << var_name << ");\n";
+      WriteOnStatusNotOk(out, options, on_error);
+    } else if (a->IsIn()) {
       // Serialization looks roughly like:
       //     _aidl_ret_status = _aidl_data.WriteInt32(in_param_name);
       //     if (_aidl_ret_status != ::android::OK) { goto error; }
-      const string& method = ParcelWriteMethodOf(a->GetType(), typenames);
-      b->AddStatement(
-          new Assignment(kAndroidStatusVarName,
-                         new MethodCall(StringPrintf("%s.%s", kDataVarName, method.c_str()),
-                                        ParcelWriteCastOf(a->GetType(), typenames, var_name))));
-      b->AddStatement(GotoErrorOnBadStatus());
+      out << kAndroidStatusVarName << " = "
+          << MethodWriteCall(typenames, options, interface, a->GetType(), parcel, false,
+                             var_name, Utf8StringsOfClient(interface, options))
+          << ";\n";
+      WriteOnStatusNotOk(out, options, on_error);
     } else if (a->IsOut() && a->GetType().IsArray()) {
       // Special case, the length of the out array is written into the parcel.
       //     _aidl_ret_status = _aidl_data.writeVectorSize(&out_param_name);
       //     if (_aidl_ret_status != ::android::OK) { goto error; }
-      b->AddStatement(new Assignment(
-          kAndroidStatusVarName,
-          new MethodCall(StringPrintf("%s.writeVectorSize", kDataVarName), var_name)));
-      b->AddStatement(GotoErrorOnBadStatus());
+      out << kAndroidStatusVarName << " = " << parcel << ".writeVectorSize(" << var_name
+          << ");\n";
+      WriteOnStatusNotOk(out, options, on_error);
     }
   }
+}
 
-  // Invoke the transaction on the remote binder and confirm status.
-  string transaction_code = GetTransactionIdFor(method);
-
-  vector<string> args = {transaction_code, kDataVarName,
-                         StringPrintf("&%s", kReplyVarName)};
-
-  if (method.IsOneway()) {
-    args.push_back("::android::IBinder::FLAG_ONEWAY");
-  }
-
-  b->AddStatement(new Assignment(
-      kAndroidStatusVarName,
-      new MethodCall("remote()->transact",
-                     ArgList(args))));
-
-  // If the method is not implemented in the remote side, try to call the
-  // default implementation, if provided.
+// Returns the arguments with which a proxy passes a call of |method| on to
+// another implementation of the interface.
+vector<string> BuildForwardedArgs(const AidlTypenames& typenames, const Options& options,
+                                  const AidlMethod& method) {
   vector<string> arg_names;
   for (const auto& a : method.GetArguments()) {
-    if (IsNonCopyableType(a->GetType(), typenames)) {
+    if (IsMovedInArgument(typenames, options, *a)) {
       arg_names.emplace_back(StringPrintf("std::move(%s)", a->GetName().c_str()));
     } else {
       arg_names.emplace_back(a->GetName());
@@ -341,56 +1408,210 @@ unique_ptr<Declaration> DefineClientTransaction(const AidlTypenames& typenames,
   if (method.GetType().GetName() != "void") {
     arg_names.emplace_back(kReturnVarName);
   }
-  b->AddLiteral(StringPrintf("if (UNLIKELY(_aidl_ret_status == ::android::UNKNOWN_TRANSACTION && "
-                             "%s::getDefaultImpl())) {\n"
-                             "   return %s::getDefaultImpl()->%s(%s);\n"
-                             "}\n",
-                             i_name.c_str(), i_name.c_str(), method.GetName().c_str(),
-                             Join(arg_names, ", ").c_str()),
-                false /* no semicolon */);
+  return arg_names;
+}
+
+// Declares <method>Chunks() of the @Chunked |method| in the interface. Unless
+// it is overridden, as proxies do, it reads the whole result as one chunk.
+unique_ptr<Declaration> BuildChunksMethodDecl(const AidlMethod& method,
+                                              const AidlTypenames& typenames,
+                                              const Options& options) {
+  vector<string> args = BuildForwardedArgs(typenames, options, method);
+  args.back() = "&_aidl_values";
+  std::ostringstream code;
+  code << "// Reads the result of " << method.GetName() << "() a chunk at a time.\n"
+       << "virtual " << kBinderStatusLiteral << " " << method.GetName() << "Chunks("
+       << Join(BuildChunksArgs(typenames, options, method), ", ") << ") {\n"
+       << "  ::std::vector<" << ChunkElementOf(typenames, options, method) << "> _aidl_values;\n"
+       << "  " << kBinderStatusLiteral << " " << kStatusVarName << " = " << method.GetName()
+       << "(" << Join(args, ", ") << ");\n"
+       << "  if (" << kStatusVarName << ".isOk()) " << kReturnVarName
+       << "->reset(std::move(_aidl_values));\n"
+       << "  return " << kStatusVarName << ";\n"
+       << "}\n";
+  return unique_ptr<Declaration>(new LiteralDecl(code.str()));
+}
+
+// Writes the proxy method of |method|. For a @Chunked method, the |chunks|
+// variant reads the result into a ChunkReader, which asks for the rest of
+// the chunks as the caller takes them.
+void WriteClientTransaction(CodeWriter& out, const AidlTypenames& typenames,
+                            const AidlInterface& interface, const AidlMethod& method,
+                            const Options& options, bool chunks = false) {
+  const string i_name = ClassName(interface, ClassNames::INTERFACE);
+  const string bp_name = ClassName(interface, ClassNames::CLIENT);
+  const string goto_error = StringPrintf("goto %s", kErrorLabel);
+  const string name = method.GetName() + (chunks ? "Chunks" : "");
+  const vector<string> params = chunks ? BuildChunksArgs(typenames, options, method)
+                                       : BuildArgs(typenames, options, method, true);
+  // The elements of a chunked read aren't all there to be logged. The method
+  // that reads them whole is logged.
+  const bool gen_log = options.GenLog() && !chunks;
+
+  // If the method is not implemented in the remote side, try to call the
+  // default implementation, if provided.
+  const vector<string> arg_names = BuildForwardedArgs(typenames, options, method);
+  string default_impl_call =
+      i_name + "::getDefaultImpl()->" + name + "(" + Join(arg_names, ", ") + ")";
+  string default_impl_check = "UNLIKELY(" + string(kAndroidStatusVarName) +
+                              " == ::android::UNKNOWN_TRANSACTION && " + i_name +
+                              "::getDefaultImpl())";
+  // With --cold-error-paths, the lookup and the call are made out of line, so
+  // that they don't take room in the proxy method. The helper reads the
+  // default implementation once, and tells if there was one.
+  if (options.ColdErrorPaths()) {
+    const string helper = "_aidl_defaultImpl_" + name;
+    vector<string> helper_params = params;
+    helper_params.push_back(kBinderStatusLiteral + string("* ") + kStatusVarName);
+    out << "static __attribute__((cold, noinline)) bool " << helper << "("
+        << Join(helper_params, ", ") << ") {\n";
+    out << "  const ::android::sp<" << i_name << ">& _aidl_default_impl = " << i_name
+        << "::getDefaultImpl();\n";
+    out << "  if (!_aidl_default_impl) return false;\n";
+    out << "  *" << kStatusVarName << " = _aidl_default_impl->" << name << "("
+        << Join(arg_names, ", ") << ");\n";
+    out << "  return true;\n";
+    out << "}\n\n";
+    vector<string> helper_args = arg_names;
+    helper_args.push_back(string("&") + kStatusVarName);
+    default_impl_check = "UNLIKELY(" + string(kAndroidStatusVarName) +
+                         " == ::android::UNKNOWN_TRANSACTION) && " + helper + "(" +
+                         Join(helper_args, ", ") + ")";
+    default_impl_call = kStatusVarName;
+  }
+
+  out << kBinderStatusLiteral << " " << bp_name << "::" << name << "(" << Join(params, ", ")
+      << ") {\n";
+  out.Indent();
+
+  // Declare parcels to hold our query and the response.
+  out << kAndroidParcelLiteral << " " << kDataVarName << ";\n";
+  // Even if we're oneway, the transact method still takes a parcel.
+  out << kAndroidParcelLiteral << " " << kReplyVarName << ";\n";
+
+  // Declare the status_t variable we need for error handling.
+  out << kAndroidStatusLiteral << " " << kAndroidStatusVarName << " = " << kAndroidStatusOk
+      << ";\n";
+  // We unconditionally return a Status object.
+  out << kBinderStatusLiteral << " " << kStatusVarName << ";\n";
+
+  if (options.GenTraces()) {
+    out << "::android::ScopedTrace " << kTraceVarName << "(ATRACE_TAG_AIDL, \""
+        << interface.GetName() << "::" << method.GetName() << "::cppClient\");\n";
+  }
+
+  if (options.GenStats()) {
+    out << GenStatsScope(interface, method, false /* isServer */);
+  }
+
+  if (gen_log) {
+    out << GenLogBeforeExecute(bp_name, interface, method, false /* isServer */,
+                               false /* isNdk */);
+  }
+  if (options.GenBinaryLog()) {
+    out << GenBinaryLogBeforeExecute(interface, method, false /* isServer */, false /* isNdk */);
+  }
+
+  if (options.ParcelCapacityHints()) {
+    out << BuildDataCapacityHint(typenames, interface, method) << ";\n";
+  }
+
+  // Batched calls go first, so that the server sees the calls in order.
+  if (HasBatchableMethods(interface)) {
+    out << kAndroidStatusVarName << " = flushBatchedCalls();\n";
+    WriteOnStatusNotOk(out, options, goto_error);
+  }
+
+  // Add the name of the interface we're hoping to call.
+  out << kAndroidStatusVarName << " = " << kDataVarName
+      << ".writeInterfaceToken(" << InterfaceTokenOf(interface, options) << ");\n";
+  WriteOnStatusNotOk(out, options, goto_error);
+
+  if (interface.PropagatesCallContext(method)) {
+    out << kAndroidStatusVarName << " = " << kDataVarName
+        << ".writeInt64(::android::aidl::CallContext::current().deadlineNs);\n";
+    WriteOnStatusNotOk(out, options, goto_error);
+    out << kAndroidStatusVarName << " = " << kDataVarName
+        << ".writeInt32(::android::aidl::CallContext::current().priority);\n";
+    WriteOnStatusNotOk(out, options, goto_error);
+  }
+
+  WriteClientArguments(out, typenames, interface, method, options, kDataVarName, goto_error);
+
+  // Invoke the transaction on the remote binder and confirm status.
+  vector<string> args = {GetTransactionIdFor(method), kDataVarName,
+                         StringPrintf("&%s", kReplyVarName)};
 
-  b->AddStatement(GotoErrorOnBadStatus());
+  if (method.IsOneway()) {
+    args.push_back("::android::IBinder::FLAG_ONEWAY");
+  }
+
+  // The parcel sizes go next to the client span, so that a slow call can be
+  // told apart from a call with a lot of data.
+  const string size_counter = StringPrintf("%s::%s::cppClient", interface.GetName().c_str(),
+                                           method.GetName().c_str());
+  if (options.TraceParcelSizes()) {
+    out << "atrace_int(ATRACE_TAG_AIDL, \"" << size_counter << "::dataSize\", "
+        << "static_cast<int32_t>(" << kDataVarName << ".dataSize()));\n";
+  }
+
+  out << kAndroidStatusVarName << " = remote()->transact(" << Join(args, ", ") << ");\n";
+
+  out << "if (" << default_impl_check << ") {\n"
+      << "   return " << default_impl_call << ";\n"
+      << "}\n";
+
+  WriteOnStatusNotOk(out, options, goto_error);
+
+  if (options.TraceParcelSizes() && !method.IsOneway()) {
+    out << "atrace_int(ATRACE_TAG_AIDL, \"" << size_counter << "::replySize\", "
+        << "static_cast<int32_t>(" << kReplyVarName << ".dataSize()));\n";
+  }
 
   if (!method.IsOneway()) {
     // Strip off the exception header and fail if we see a remote exception.
     // _aidl_ret_status = _aidl_status.readFromParcel(_aidl_reply);
     // if (_aidl_ret_status != ::android::OK) { goto error; }
     // if (!_aidl_status.isOk()) { return _aidl_ret_status; }
-    b->AddStatement(new Assignment(
-        kAndroidStatusVarName,
-        StringPrintf("%s.readFromParcel(%s)", kStatusVarName, kReplyVarName)));
-    b->AddStatement(GotoErrorOnBadStatus());
-    IfStatement* exception_check = new IfStatement(
-        new LiteralExpression(StringPrintf("!%s.isOk()", kStatusVarName)));
-    b->AddStatement(exception_check);
-    exception_check->OnTrue()->AddLiteral(
-        StringPrintf("return %s", kStatusVarName));
+    out << kAndroidStatusVarName << " = " << kStatusVarName << ".readFromParcel(" << kReplyVarName
+        << ");\n";
+    WriteOnStatusNotOk(out, options, goto_error);
+    out << "if (!" << kStatusVarName << ".isOk()) {\n";
+    out.Indent();
+    out << "return " << kStatusVarName << ";\n";
+    out.Dedent();
+    out << "}\n";
   }
 
   // Type checking should guarantee that nothing below emits code until "return
   // status" if we are a oneway method, so no more fear of accessing reply.
 
   // If the method is expected to return something, read it first by convention.
-  if (method.GetType().GetName() != "void") {
-    const string& method_call = ParcelReadMethodOf(method.GetType(), typenames);
-    b->AddStatement(new Assignment(
-        kAndroidStatusVarName,
-        new MethodCall(StringPrintf("%s.%s", kReplyVarName, method_call.c_str()),
-                       ParcelReadCastOf(method.GetType(), typenames, kReturnVarName))));
-    b->AddStatement(GotoErrorOnBadStatus());
+  if (chunks) {
+    out << kAndroidStatusVarName << " = " << kReturnVarName << "->readFromParcel("
+        << kReplyVarName << ");\n";
+    WriteOnStatusNotOk(out, options, goto_error);
+  } else if (method.GetType().IsChunked()) {
+    out << kAndroidStatusVarName << " = ::android::aidl::readChunks(" << kReplyVarName << ", "
+        << kReturnVarName << ");\n";
+    WriteOnStatusNotOk(out, options, goto_error);
+  } else if (method.GetType().GetName() != "void") {
+    out << kAndroidStatusVarName << " = "
+        << MethodReadCall(typenames, options, interface, method.GetType(), kReplyVarName, false,
+                          kReturnVarName, "nullptr")
+        << ";\n";
+    WriteOnStatusNotOk(out, options, goto_error);
   }
 
   for (const AidlArgument* a : method.GetOutArguments()) {
     // Deserialization looks roughly like:
     //     _aidl_ret_status = _aidl_reply.ReadInt32(out_param_name);
     //     if (_aidl_status != ::android::OK) { goto _aidl_error; }
-    string method = ParcelReadMethodOf(a->GetType(), typenames);
-
-    b->AddStatement(
-        new Assignment(kAndroidStatusVarName,
-                       new MethodCall(StringPrintf("%s.%s", kReplyVarName, method.c_str()),
-                                      ParcelReadCastOf(a->GetType(), typenames, a->GetName()))));
-    b->AddStatement(GotoErrorOnBadStatus());
+    out << kAndroidStatusVarName << " = "
+        << MethodReadCall(typenames, options, interface, a->GetType(), kReplyVarName, false,
+                          a->GetName(), "nullptr")
+        << ";\n";
+    WriteOnStatusNotOk(out, options, goto_error);
   }
 
   // If we've gotten to here, one of two things is true:
@@ -398,20 +1619,111 @@ unique_ptr<Declaration> DefineClientTransaction(const AidlTypenames& typenames,
   //   2) We've only read status_t == OK and there was no exception in the
   //      response.
   // In both cases, we're free to set Status from the status_t and return.
-  b->AddLiteral(StringPrintf("%s:\n", kErrorLabel), false /* no semicolon */);
-  b->AddLiteral(
-      StringPrintf("%s.setFromStatusT(%s)", kStatusVarName,
-                   kAndroidStatusVarName));
+  out << kErrorLabel << ":\n";
+  out << kStatusVarName << ".setFromStatusT(" << kAndroidStatusVarName << ");\n";
 
-  if (options.GenLog()) {
-    b->AddLiteral(GenLogAfterExecute(bp_name, interface, method, kStatusVarName, kReturnVarName,
-                                     false /* isServer */, false /* isNdk */),
-                  false /* no semicolon */);
+  if (gen_log) {
+    out << GenLogAfterExecute(bp_name, interface, method, kStatusVarName, kReturnVarName,
+                              false /* isServer */, false /* isNdk */);
+  }
+  if (options.GenBinaryLog()) {
+    out << GenBinaryLogAfterExecute(interface, method, false /* isServer */, false /* isNdk */);
   }
 
-  b->AddLiteral(StringPrintf("return %s", kStatusVarName));
+  out << "return " << kStatusVarName << ";\n";
+  out.Dedent();
+  out << "}\n";
+}
+
+// Appends a call of the @Batchable |method| to the batch of the proxy, which
+// goes out as one transaction once it is full or old enough, or on the next
+// call of a method that isn't batched.
+void WriteClientBatchedCall(CodeWriter& out, const AidlTypenames& typenames,
+                            const AidlInterface& interface, const AidlMethod& method,
+                            const Options& options) {
+  const string bp_name = ClassName(interface, ClassNames::CLIENT);
+  const string goto_error = StringPrintf("goto %s", kErrorLabel);
+  out << kBinderStatusLiteral << " " << bp_name << "::" << method.GetName() << "("
+      << Join(BuildArgs(typenames, options, method, true /* for method decl */), ", ") << ") {\n";
+  out.Indent();
+  out << kAndroidStatusLiteral << " " << kAndroidStatusVarName << " = " << kAndroidStatusOk
+      << ";\n";
+  out << "std::lock_guard<std::mutex> _aidl_lock(_aidl_batch_mutex);\n";
+  out << "const size_t _aidl_batch_size = _aidl_batch.dataSize();\n";
+  out << "if (_aidl_batch_calls == 0) {\n";
+  out.Indent();
+  out << kAndroidStatusVarName << " = _aidl_batch.writeInterfaceToken("
+      << InterfaceTokenOf(interface, options) << ");\n";
+  WriteOnStatusNotOk(out, options, goto_error);
+  out << "_aidl_batch_start = std::chrono::steady_clock::now();\n";
+  out.Dedent();
+  out << "}\n";
+  out << kAndroidStatusVarName << " = _aidl_batch.writeUint32(" << GetTransactionIdFor(method)
+      << ");\n";
+  WriteOnStatusNotOk(out, options, goto_error);
+  WriteClientArguments(out, typenames, interface, method, options, "_aidl_batch", goto_error);
+  out << "if (++_aidl_batch_calls >= kMaxBatchedCalls ||\n"
+      << "    std::chrono::steady_clock::now() - _aidl_batch_start >= kMaxBatchDelay) {\n";
+  out.Indent();
+  out << kAndroidStatusVarName << " = flushBatchedCallsLocked();\n";
+  out.Dedent();
+  out << "}\n";
+  out << "return " << kBinderStatusLiteral << "::fromStatusT(" << kAndroidStatusVarName << ");\n";
+  out << kErrorLabel << ":\n";
+  out << "// Drop what was written of the call.\n";
+  out << "_aidl_batch.setDataSize(_aidl_batch_size);\n";
+  out << "_aidl_batch.setDataPosition(_aidl_batch_size);\n";
+  out << "return " << kBinderStatusLiteral << "::fromStatusT(" << kAndroidStatusVarName << ");\n";
+  out.Dedent();
+  out << "}\n";
+}
+
+// Client methods have no structure that the rest of the generator needs, so
+// they are written as the document is written rather than built as a tree.
+unique_ptr<Declaration> DefineClientTransaction(const AidlTypenames& typenames,
+                                                const AidlInterface& interface,
+                                                const AidlMethod& method, const Options& options) {
+  return unique_ptr<Declaration>(
+      new StreamedDecl([&typenames, &interface, &method, &options](CodeWriter& out) {
+        if (method.GetType().IsBatchable()) {
+          WriteClientBatchedCall(out, typenames, interface, method, options);
+        } else {
+          WriteClientTransaction(out, typenames, interface, method, options);
+        }
+        if (method.GetType().IsChunked()) {
+          out << "\n";
+          WriteClientTransaction(out, typenames, interface, method, options, true);
+        }
+      }));
+}
 
-  return unique_ptr<Declaration>(ret.release());
+// Defines the destructor and flushBatchedCalls() of a proxy with @Batchable
+// methods.
+string BuildClientBatchDefinitions(const AidlInterface& interface) {
+  const string bp_name = ClassName(interface, ClassNames::CLIENT);
+  std::ostringstream code;
+  code << bp_name << "::~" << bp_name << "() {\n"
+       << "  flushBatchedCalls();\n"
+       << "}\n"
+       << "\n"
+       << kAndroidStatusLiteral << " " << bp_name << "::flushBatchedCalls() {\n"
+       << "  std::lock_guard<std::mutex> _aidl_lock(_aidl_batch_mutex);\n"
+       << "  return flushBatchedCallsLocked();\n"
+       << "}\n"
+       << "\n"
+       << kAndroidStatusLiteral << " " << bp_name << "::flushBatchedCallsLocked() {\n"
+       << "  if (_aidl_batch_calls == 0) {\n"
+       << "    return " << kAndroidStatusOk << ";\n"
+       << "  }\n"
+       << "  " << kAndroidParcelLiteral << " " << kReplyVarName << ";\n"
+       << "  " << kAndroidStatusLiteral << " " << kAndroidStatusVarName
+       << " = remote()->transact(::android::IBinder::FIRST_CALL_TRANSACTION + " << kBatchMethodId
+       << " /* batch */, _aidl_batch, &" << kReplyVarName << ", ::android::IBinder::FLAG_ONEWAY);\n"
+       << "  _aidl_batch.freeData();\n"
+       << "  _aidl_batch_calls = 0;\n"
+       << "  return " << kAndroidStatusVarName << ";\n"
+       << "}\n";
+  return code.str();
 }
 
 unique_ptr<Declaration> DefineClientMetaTransaction(const AidlTypenames& /* typenames */,
@@ -422,47 +1734,55 @@ unique_ptr<Declaration> DefineClientMetaTransaction(const AidlTypenames& /* type
   if (method.GetName() == kGetInterfaceVersion && options.Version() > 0) {
     const string iface = ClassName(interface, ClassNames::INTERFACE);
     const string proxy = ClassName(interface, ClassNames::CLIENT);
-    // Note: race condition can happen here, but no locking is required
-    // because 1) writing an interger is atomic and 2) this transaction
-    // will always return the same value, i.e., competing threads will
-    // give write the same value to cached_version_.
+    // Note: competing threads can both do the transaction, but no locking
+    // is required because it always returns the same value, i.e., they
+    // store the same value to the atomic cached_version_.
     std::ostringstream code;
     code << "int32_t " << proxy << "::" << kGetInterfaceVersion << "() {\n"
-         << "  if (cached_version_ == -1) {\n"
+         << "  int32_t version = cached_version_.load(std::memory_order_relaxed);\n"
+         << "  if (version == -1) {\n"
          << "    ::android::Parcel data;\n"
          << "    ::android::Parcel reply;\n"
-         << "    data.writeInterfaceToken(getInterfaceDescriptor());\n"
+         << "    data.writeInterfaceToken(" << InterfaceTokenOf(interface, options) << ");\n"
          << "    ::android::status_t err = remote()->transact(" << GetTransactionIdFor(method)
          << ", data, &reply);\n"
          << "    if (err == ::android::OK) {\n"
          << "      ::android::binder::Status _aidl_status;\n"
          << "      err = _aidl_status.readFromParcel(reply);\n"
          << "      if (err == ::android::OK && _aidl_status.isOk()) {\n"
-         << "        cached_version_ = reply.readInt32();\n"
+         << "        version = reply.readInt32();\n"
+         << "        cached_version_.store(version, std::memory_order_relaxed);\n"
          << "      }\n"
          << "    }\n"
          << "  }\n"
-         << "  return cached_version_;\n"
+         << "  return version;\n"
          << "}\n";
     return unique_ptr<Declaration>(new LiteralDecl(code.str()));
   }
   if (method.GetName() == kGetInterfaceHash && !options.Hash().empty()) {
     const string iface = ClassName(interface, ClassNames::INTERFACE);
     const string proxy = ClassName(interface, ClassNames::CLIENT);
+    // The hash is published once through cached_hash_ready_, so reads after
+    // that take no lock. The mutex only serializes the first calls.
     std::ostringstream code;
     code << "std::string " << proxy << "::" << kGetInterfaceHash << "() {\n"
+         << "  if (cached_hash_ready_.load(std::memory_order_acquire)) {\n"
+         << "    return cached_hash_;\n"
+         << "  }\n"
          << "  std::lock_guard<std::mutex> lockGuard(cached_hash_mutex_);\n"
          << "  if (cached_hash_ == \"-1\") {\n"
          << "    ::android::Parcel data;\n"
          << "    ::android::Parcel reply;\n"
-         << "    data.writeInterfaceToken(getInterfaceDescriptor());\n"
+         << "    data.writeInterfaceToken(" << InterfaceTokenOf(interface, options) << ");\n"
          << "    ::android::status_t err = remote()->transact(" << GetTransactionIdFor(method)
          << ", data, &reply);\n"
          << "    if (err == ::android::OK) {\n"
          << "      ::android::binder::Status _aidl_status;\n"
          << "      err = _aidl_status.readFromParcel(reply);\n"
          << "      if (err == ::android::OK && _aidl_status.isOk()) {\n"
-         << "        reply.readUtf8FromUtf16(&cached_hash_);\n"
+         << "        if (reply.readUtf8FromUtf16(&cached_hash_) == ::android::OK) {\n"
+         << "          cached_hash_ready_.store(true, std::memory_order_release);\n"
+         << "        }\n"
          << "      }\n"
          << "    }\n"
          << "  }\n"
@@ -488,6 +1808,42 @@ unique_ptr<Document> BuildClientSource(const AidlTypenames& typenames,
     include_list.emplace_back("json/value.h");
   }
   vector<unique_ptr<Declaration>> file_decls;
+  // With --source-shards, the methods that use the writers are in the shards.
+  const bool sharded = options.SourceShards() > 0;
+  if (HasSharedMemoryArguments(interface) && !sharded) {
+    include_list.emplace_back("binder/ParcelFileDescriptor.h");
+    include_list.emplace_back("cstring");
+    include_list.emplace_back("sys/mman.h");
+    include_list.emplace_back("unistd.h");
+    file_decls.emplace_back(new LiteralDecl(kSharedMemoryWriter));
+  }
+  if (HasViewArguments(interface) && !sharded) {
+    include_list.emplace_back("cstdint");
+    include_list.emplace_back("cstring");
+    file_decls.emplace_back(new LiteralDecl(kArrayViewWriter));
+  }
+  if (UsesFileDescriptorArrayHelpers(options, MethodTypesOf(interface)) && !sharded) {
+    include_list.emplace_back("binder/ParcelFileDescriptor.h");
+    file_decls.emplace_back(new LiteralDecl(kFileDescriptorArrayHelpers));
+  }
+  if (UsesFixedSizeArrayHelpers(MethodTypesOf(interface)) && !sharded) {
+    include_list.emplace_back("array");
+    include_list.emplace_back("cstring");
+    include_list.emplace_back("type_traits");
+    file_decls.emplace_back(new LiteralDecl(kFixedSizeArrayHelpers));
+  }
+  if (UsesUtf8StringHelpers(interface, MethodsOf(interface)) && !sharded) {
+    include_list.emplace_back("cstring");
+    include_list.emplace_back("optional");
+    include_list.emplace_back("utils/String8.h");
+    file_decls.emplace_back(new LiteralDecl(kUtf8StringHelpers));
+  }
+  if (UsesPackedArrayHelpers(interface, MethodsOf(interface)) && !sharded) {
+    include_list.emplace_back("cstdint");
+    include_list.emplace_back("cstring");
+    include_list.emplace_back("optional");
+    file_decls.emplace_back(new LiteralDecl(kPackedArrayHelpers));
+  }
 
   // The constructor just passes the IBinder instance up to the super
   // class.
@@ -508,10 +1864,17 @@ unique_ptr<Document> BuildClientSource(const AidlTypenames& typenames,
     file_decls.push_back(unique_ptr<Declaration>(new LiteralDecl(code)));
   }
 
+  if (HasBatchableMethods(interface)) {
+    file_decls.push_back(
+        unique_ptr<Declaration>(new LiteralDecl(BuildClientBatchDefinitions(interface))));
+  }
+
   // Clients define a method per transaction.
   for (const auto& method : interface.GetMethods()) {
     unique_ptr<Declaration> m;
-    if (method->IsUserDefined()) {
+    if (method->IsUserDefined() && sharded) {
+      continue;
+    } else if (method->IsUserDefined()) {
       m = DefineClientTransaction(typenames, interface, *method, options);
     } else {
       m = DefineClientMetaTransaction(typenames, interface, *method, options);
@@ -526,149 +1889,371 @@ unique_ptr<Document> BuildClientSource(const AidlTypenames& typenames,
 
 namespace {
 
-bool HandleServerTransaction(const AidlTypenames& typenames, const AidlInterface& interface,
-                             const AidlMethod& method, const Options& options, StatementBlock* b) {
+// Writes the handling of a call of |method|. The calls in a batch share the
+// interface token of the batch, so they don't |check_interface|.
+void WriteServerTransaction(CodeWriter& out, const AidlTypenames& typenames,
+                            const AidlInterface& interface, const AidlMethod& method,
+                            const Options& options, bool check_interface = true) {
+  const string break_on_error = "break";
+  if (options.GenStats()) {
+    out << GenStatsScope(interface, method, true /* isServer */);
+  }
+
   // Declare all the parameters now.  In the common case, we expect no errors
   // in serialization.
   for (const unique_ptr<AidlArgument>& a : method.GetArguments()) {
-    if (!DeclareLocalVariable(*a, b, typenames)) {
-      return false;
-    }
+    out << CppNameOf(a->GetType(), typenames, options) << " " << BuildVarName(*a) << ";\n";
   }
 
   // Declare a variable to hold the return value.
   if (method.GetType().GetName() != "void") {
-    string type = CppNameOf(method.GetType(), typenames);
-    b->AddLiteral(StringPrintf("%s %s", type.c_str(), kReturnVarName));
+    out << CppNameOf(method.GetType(), typenames, options) << " " << kReturnVarName << ";\n";
+  }
+
+  // Whether the Strings of the reply are written as UTF-8, which they are once
+  // the client has written one so. An unversioned peer always does.
+  if (interface.HasUtf8WireStrings(method)) {
+    out << "bool _aidl_utf8 = " << (options.Version() == 0 ? "true" : "false") << ";\n";
   }
 
   // Check that the client is calling the correct interface.
-  IfStatement* interface_check = new IfStatement(
-      new MethodCall(StringPrintf("%s.checkInterface",
-                                  kDataVarName), "this"),
-      true /* invert the check */);
-  b->AddStatement(interface_check);
-  interface_check->OnTrue()->AddStatement(
-      new Assignment(kAndroidStatusVarName, "::android::BAD_TYPE"));
-  interface_check->OnTrue()->AddLiteral("break");
+  if (check_interface) {
+    out << "if (!(" << CheckInterfaceTokenOf(interface, options) << ")) {\n";
+    out.Indent();
+    out << kAndroidStatusVarName << " = ::android::BAD_TYPE;\n";
+    out << "break;\n";
+    out.Dedent();
+    out << "}\n";
+  }
+
+  // An expired call is answered before its arguments are read.
+  const bool propagates_call_context = interface.PropagatesCallContext(method);
+  if (propagates_call_context) {
+    out << "::android::aidl::CallContext _aidl_context;\n";
+    out << kAndroidStatusVarName << " = " << kDataVarName
+        << ".readInt64(&_aidl_context.deadlineNs);\n";
+    WriteOnStatusNotOk(out, options, break_on_error);
+    out << kAndroidStatusVarName << " = " << kDataVarName
+        << ".readInt32(&_aidl_context.priority);\n";
+    WriteOnStatusNotOk(out, options, break_on_error);
+    out << "if (_aidl_context.hasExpired()) {\n";
+    out.Indent();
+    if (!method.IsOneway()) {
+      out << kAndroidStatusVarName << " = " << kBinderStatusLiteral << "::fromExceptionCode("
+          << kBinderStatusLiteral << "::EX_ILLEGAL_STATE, ::android::String8(\"" << method.GetName()
+          << "() missed its deadline\")).writeToParcel(" << kReplyVarName << ");\n";
+    }
+    out << "break;\n";
+    out.Dedent();
+    out << "}\n";
+  }
 
   // Deserialize each "in" parameter to the transaction.
-  for (const auto& a: method.GetArguments()) {
-    // Deserialization looks roughly like:
-    //     _aidl_ret_status = _aidl_data.ReadInt32(&in_param_name);
-    //     if (_aidl_ret_status != ::android::OK) { break; }
-    const string& var_name = "&" + BuildVarName(*a);
-    if (a->IsIn()) {
-      const string& readMethod = ParcelReadMethodOf(a->GetType(), typenames);
-      b->AddStatement(
-          new Assignment{kAndroidStatusVarName,
-                         new MethodCall{string(kDataVarName) + "." + readMethod,
-                                        ParcelReadCastOf(a->GetType(), typenames, var_name)}});
-      b->AddStatement(BreakOnStatusNotOk());
-    } else if (a->IsOut() && a->GetType().IsArray()) {
-      // Special case, the length of the out array is written into the parcel.
-      //     _aidl_ret_status = _aidl_data.resizeOutVector(&out_param_name);
+  if (HasArgTable(interface, method, options)) {
+    vector<string> arg_names;
+    for (const auto& a : method.GetArguments()) {
+      arg_names.push_back(BuildVarName(*a));
+    }
+    out << "{\n";
+    out.Indent();
+    out << GenArgTable(method, false /* is_ndk */, true /* is_server */, arg_names);
+    out << kAndroidStatusVarName << " = ::android::aidl::readArgs(" << kDataVarName
+        << ", _aidl_arg_codes, " << std::to_string(arg_names.size()) << ", _aidl_arg_values);\n";
+    out.Dedent();
+    out << "}\n";
+    WriteOnStatusNotOk(out, options, break_on_error);
+  } else {
+    for (const auto& a : method.GetArguments()) {
+      // Deserialization looks roughly like:
+      //     _aidl_ret_status = _aidl_data.ReadInt32(&in_param_name);
       //     if (_aidl_ret_status != ::android::OK) { break; }
-      b->AddStatement(
-          new Assignment{kAndroidStatusVarName,
-                         new MethodCall{string(kDataVarName) + ".resizeOutVector", var_name}});
-      b->AddStatement(BreakOnStatusNotOk());
+      const string& var_name = "&" + BuildVarName(*a);
+      if (a->GetType().IsSharedMemory()) {
+        out << kAndroidStatusVarName << " = ReadSharedMemoryByteVector(" << kDataVarName << ", "
+            << var_name << ");\n";
+        WriteOnStatusNotOk(out, options, break_on_error);
+      } else if (a->IsIn()) {
+        out << kAndroidStatusVarName << " = "
+            << MethodReadCall(typenames, options, interface, a->GetType(), kDataVarName, false,
+                              var_name, "&_aidl_utf8")
+            << ";\n";
+        WriteOnStatusNotOk(out, options, break_on_error);
+      } else if (a->IsOut() && a->GetType().IsArray()) {
+        // Special case, the length of the out array is written into the parcel.
+        //     _aidl_ret_status = _aidl_data.resizeOutVector(&out_param_name);
+        //     if (_aidl_ret_status != ::android::OK) { break; }
+        out << kAndroidStatusVarName << " = " << kDataVarName << ".resizeOutVector(" << var_name
+            << ");\n";
+        WriteOnStatusNotOk(out, options, break_on_error);
+      }
     }
   }
 
+  const string bn_name = ClassName(interface, ClassNames::SERVER);
+  // The executor makes the call, so it has no reply to write.
+  if (const string pool = DispatchPoolOf(interface, method); !pool.empty()) {
+    out << GenDispatchCall(
+        method, pool, "::android::sp<" + bn_name + ">(this)",
+        [&](const AidlTypeSpecifier& type) { return CppNameOf(type, typenames, options); });
+    return;
+  }
+  if (propagates_call_context) {
+    out << "::android::aidl::ScopedCallContext _aidl_context_scope(_aidl_context);\n";
+  }
+
   if (options.GenTraces()) {
-    b->AddStatement(new Statement(new MethodCall("atrace_begin",
-        ArgList{{"ATRACE_TAG_AIDL",
-        StringPrintf("\"%s::%s::cppServer\"",
-                     interface.GetName().c_str(),
-                     method.GetName().c_str())}})));
+    out << "atrace_begin(ATRACE_TAG_AIDL, \"" << interface.GetName() << "::" << method.GetName()
+        << "::cppServer\");\n";
   }
-  const string bn_name = ClassName(interface, ClassNames::SERVER);
   if (options.GenLog()) {
-    b->AddLiteral(GenLogBeforeExecute(bn_name, method, true /* isServer */, false /* isNdk */),
-                  false);
+    out << GenLogBeforeExecute(bn_name, interface, method, true /* isServer */,
+                               false /* isNdk */);
+  }
+  if (options.GenBinaryLog()) {
+    out << GenBinaryLogBeforeExecute(interface, method, true /* isServer */, false /* isNdk */);
   }
   // Call the actual method.  This is implemented by the subclass.
-  vector<unique_ptr<AstNode>> status_args;
-  status_args.emplace_back(new MethodCall(
-      method.GetName(), BuildArgList(typenames, method, false /* not for method decl */)));
-  b->AddStatement(new Statement(new MethodCall(
-      StringPrintf("%s %s", kBinderStatusLiteral, kStatusVarName),
-      ArgList(std::move(status_args)))));
+  out << kBinderStatusLiteral << " " << kStatusVarName << "(" << method.GetName() << "("
+      << Join(BuildArgs(typenames, options, method, false /* not for method decl */), ", ")
+      << "));\n";
 
   if (options.GenTraces()) {
-    b->AddStatement(new Statement(new MethodCall("atrace_end",
-                                                 "ATRACE_TAG_AIDL")));
+    out << "atrace_end(ATRACE_TAG_AIDL);\n";
   }
 
   if (options.GenLog()) {
-    b->AddLiteral(GenLogAfterExecute(bn_name, interface, method, kStatusVarName, kReturnVarName,
-                                     true /* isServer */, false /* isNdk */),
-                  false);
+    out << GenLogAfterExecute(bn_name, interface, method, kStatusVarName, kReturnVarName,
+                              true /* isServer */, false /* isNdk */);
+  }
+  if (options.GenBinaryLog()) {
+    out << GenBinaryLogAfterExecute(interface, method, true /* isServer */, false /* isNdk */);
   }
 
   // Write exceptions during transaction handling to parcel.
   if (!method.IsOneway()) {
-    b->AddStatement(new Assignment(
-        kAndroidStatusVarName,
-        StringPrintf("%s.writeToParcel(%s)", kStatusVarName, kReplyVarName)));
-    b->AddStatement(BreakOnStatusNotOk());
-    IfStatement* exception_check = new IfStatement(
-        new LiteralExpression(StringPrintf("!%s.isOk()", kStatusVarName)));
-    b->AddStatement(exception_check);
-    exception_check->OnTrue()->AddLiteral("break");
+    out << kAndroidStatusVarName << " = " << kStatusVarName << ".writeToParcel(" << kReplyVarName
+        << ");\n";
+    WriteOnStatusNotOk(out, options, break_on_error);
+    out << "if (!" << kStatusVarName << ".isOk()) {\n";
+    out.Indent();
+    out << "break;\n";
+    out.Dedent();
+    out << "}\n";
   }
 
   // If we have a return value, write it first.
-  if (method.GetType().GetName() != "void") {
-    string writeMethod =
-        string(kReplyVarName) + "->" + ParcelWriteMethodOf(method.GetType(), typenames);
-    b->AddStatement(new Assignment(
-        kAndroidStatusVarName,
-        new MethodCall(writeMethod,
-                       ParcelWriteCastOf(method.GetType(), typenames, kReturnVarName))));
-    b->AddStatement(BreakOnStatusNotOk());
+  if (method.GetType().IsChunked()) {
+    out << kAndroidStatusVarName << " = ::android::aidl::writeChunks(" << kReplyVarName
+        << ", std::move(" << kReturnVarName << "), "
+        << std::to_string(method.GetType().ChunkBytes()) << ");\n";
+    WriteOnStatusNotOk(out, options, break_on_error);
+  } else if (method.GetType().GetName() != "void") {
+    out << kAndroidStatusVarName << " = "
+        << MethodWriteCall(typenames, options, interface, method.GetType(), kReplyVarName, true,
+                           kReturnVarName, "_aidl_utf8")
+        << ";\n";
+    WriteOnStatusNotOk(out, options, break_on_error);
   }
   // Write each out parameter to the reply parcel.
   for (const AidlArgument* a : method.GetOutArguments()) {
     // Serialization looks roughly like:
     //     _aidl_ret_status = data.WriteInt32(out_param_name);
     //     if (_aidl_ret_status != ::android::OK) { break; }
-    const string& writeMethod = ParcelWriteMethodOf(a->GetType(), typenames);
-    b->AddStatement(new Assignment(
-        kAndroidStatusVarName,
-        new MethodCall(string(kReplyVarName) + "->" + writeMethod,
-                       ParcelWriteCastOf(a->GetType(), typenames, BuildVarName(*a)))));
-    b->AddStatement(BreakOnStatusNotOk());
+    out << kAndroidStatusVarName << " = "
+        << MethodWriteCall(typenames, options, interface, a->GetType(), kReplyVarName, true,
+                           BuildVarName(*a), "_aidl_utf8")
+        << ";\n";
+    WriteOnStatusNotOk(out, options, break_on_error);
   }
-
-  return true;
 }
 
-bool HandleServerMetaTransaction(const AidlTypenames&, const AidlInterface& interface,
-                                 const AidlMethod& method, const Options& options,
-                                 StatementBlock* b) {
+// Returns whether the server handles the meta method |method|.
+bool HandlesServerMetaTransaction(const AidlMethod& method, const Options& options) {
   CHECK(!method.IsUserDefined());
+  return (method.GetName() == kGetInterfaceVersion && options.Version() > 0) ||
+         (method.GetName() == kGetInterfaceHash && !options.Hash().empty());
+}
 
-  if (method.GetName() == kGetInterfaceVersion && options.Version() > 0) {
-    std::ostringstream code;
-    code << "_aidl_data.checkInterface(this);\n"
-         << "_aidl_reply->writeNoException();\n"
-         << "_aidl_reply->writeInt32(" << ClassName(interface, ClassNames::INTERFACE)
-         << "::VERSION)";
-    b->AddLiteral(code.str());
-    return true;
+void WriteServerMetaTransaction(CodeWriter& out, const AidlInterface& interface,
+                                const AidlMethod& method, const Options& options) {
+  out << CheckInterfaceTokenOf(interface, options) << ";\n"
+      << "_aidl_reply->writeNoException();\n";
+  if (method.GetName() == kGetInterfaceVersion) {
+    out << "_aidl_reply->writeInt32(" << ClassName(interface, ClassNames::INTERFACE)
+        << "::VERSION);\n";
+  } else {
+    out << "_aidl_reply->writeUtf8AsUtf16(" << ClassName(interface, ClassNames::INTERFACE)
+        << "::HASH);\n";
   }
-  if (method.GetName() == kGetInterfaceHash && !options.Hash().empty()) {
-    std::ostringstream code;
-    code << "_aidl_data.checkInterface(this);\n"
-         << "_aidl_reply->writeNoException();\n"
-         << "_aidl_reply->writeUtf8AsUtf16(" << ClassName(interface, ClassNames::INTERFACE)
-         << "::HASH)";
-    b->AddLiteral(code.str());
-    return true;
+}
+
+// Writes the handling of a batch of calls of the @Batchable methods of
+// |interface|, each one a transaction code followed by the arguments.
+void WriteServerBatchTransaction(CodeWriter& out, const AidlTypenames& typenames,
+                                 const AidlInterface& interface, const Options& options) {
+  out << "if (!(" << CheckInterfaceTokenOf(interface, options) << ")) {\n";
+  out.Indent();
+  out << kAndroidStatusVarName << " = ::android::BAD_TYPE;\n";
+  out << "break;\n";
+  out.Dedent();
+  out << "}\n";
+  out << "while (" << kAndroidStatusVarName << " == " << kAndroidStatusOk << " && "
+      << kDataVarName << ".dataAvail() > 0) {\n";
+  out.Indent();
+  out << "uint32_t _aidl_batched_code;\n";
+  out << kAndroidStatusVarName << " = " << kDataVarName << ".readUint32(&_aidl_batched_code);\n";
+  WriteOnStatusNotOk(out, options, "break");
+  out << "switch (_aidl_batched_code) {\n";
+  for (const auto& method : interface.GetMethods()) {
+    if (!method->GetType().IsBatchable()) {
+      continue;
+    }
+    out << "case " << GetTransactionIdFor(*method) << ":\n";
+    out << "{\n";
+    out.Indent();
+    WriteServerTransaction(out, typenames, interface, *method, options,
+                           false /* check_interface */);
+    out.Dedent();
+    out << "}\n";
+    out << "break;\n";
+  }
+  out << "default:\n";
+  out.Indent();
+  out << kAndroidStatusVarName << " = ::android::BAD_VALUE;\n";
+  out << "break;\n";
+  out.Dedent();
+  out << "}\n";
+  out.Dedent();
+  out << "}\n";
+}
+
+// The signature of the handler of the transactions of |method| for
+// --native-dispatch-table, with the class name |bn_name| if it isn't empty.
+string ServerHandlerSignature(const AidlMethod& method, const string& bn_name) {
+  return StringPrintf("%s %s_aidl_onTransact_%s(const %s& %s, %s* %s, uint32_t %s)",
+                      kAndroidStatusLiteral, bn_name.empty() ? "" : (bn_name + "::").c_str(),
+                      method.GetName().c_str(), kAndroidParcelLiteral, kDataVarName,
+                      kAndroidParcelLiteral, kReplyVarName, kFlagsVarName);
+}
+
+// For --native-dispatch-table, defines the handler of the transactions of
+// the user-defined |method|.
+void WriteServerHandler(CodeWriter& out, const AidlTypenames& typenames,
+                        const AidlInterface& interface, const AidlMethod& method,
+                        const Options& options) {
+  out << HandlerPlacement(interface, method, options)
+      << ServerHandlerSignature(method, ClassName(interface, ClassNames::SERVER)) << " {\n";
+  out.Indent();
+  out << "(void)" << kFlagsVarName << ";\n";
+  out << kAndroidStatusLiteral << " " << kAndroidStatusVarName << " = " << kAndroidStatusOk
+      << ";\n";
+  out << "do {\n";
+  out.Indent();
+  WriteServerTransaction(out, typenames, interface, method, options);
+  out.Dedent();
+  out << "} while (false);\n";
+  out << "return " << kAndroidStatusVarName << ";\n";
+  out.Dedent();
+  out << "}\n";
+}
+
+// Writes onTransact, with a case for each transaction of |interface|. The
+// transactions must be handled, see HandlesServerMetaTransaction(). With
+// --native-dispatch-table, user-defined methods are left to the default case,
+// which looks their handlers up in a table.
+void WriteServerOnTransact(CodeWriter& out, const AidlTypenames& typenames,
+                           const AidlInterface& interface, const Options& options) {
+  const string bn_name = ClassName(interface, ClassNames::SERVER);
+  const size_t table_size = NativeDispatchTableSize(interface, options);
+  out << kAndroidStatusLiteral << " " << ClassName(interface, ClassNames::SERVER)
+      << "::onTransact(uint32_t " << kCodeVarName << ", const " << kAndroidParcelLiteral << "& "
+      << kDataVarName << ", " << kAndroidParcelLiteral << "* " << kReplyVarName << ", uint32_t "
+      << kFlagsVarName << ") {\n";
+  out.Indent();
+
+  // Declare the status_t variable
+  out << kAndroidStatusLiteral << " " << kAndroidStatusVarName << " = " << kAndroidStatusOk
+      << ";\n";
+
+  if (table_size > 0) {
+    vector<string> handlers(table_size, "nullptr");
+    for (const auto& method : interface.GetMethods()) {
+      if (method->IsUserDefined()) {
+        handlers[method->GetId()] = "&" + bn_name + "::_aidl_onTransact_" + method->GetName();
+      }
+    }
+    out << "static constexpr " << kAndroidStatusLiteral << " (" << bn_name
+        << "::*const _aidl_handlers[])(const " << kAndroidParcelLiteral << "&, "
+        << kAndroidParcelLiteral << "*, uint32_t) = {\n";
+    for (const string& handler : handlers) {
+      out << "    " << handler << ",\n";
+    }
+    out << "};\n";
   }
-  return false;
+
+  // The switch statement has a case statement for each transaction code.
+  out << "switch (" << kCodeVarName << ") {\n";
+  for (const AidlMethod* method : MethodsByCallCount(interface, options)) {
+    if (table_size > 0 && method->IsUserDefined()) {
+      continue;
+    }
+    out << "case " << GetTransactionIdFor(*method) << ":\n";
+    out << "{\n";
+    out.Indent();
+    if (method->IsUserDefined()) {
+      WriteServerTransaction(out, typenames, interface, *method, options);
+    } else {
+      WriteServerMetaTransaction(out, interface, *method, options);
+    }
+    out.Dedent();
+    out << "}\n";
+    out << "break;\n";
+  }
+  if (HasBatchableMethods(interface)) {
+    out << "case ::android::IBinder::FIRST_CALL_TRANSACTION + " << std::to_string(kBatchMethodId)
+        << " /* batch */:\n";
+    out << "{\n";
+    out.Indent();
+    WriteServerBatchTransaction(out, typenames, interface, options);
+    out.Dedent();
+    out << "}\n";
+    out << "break;\n";
+  }
+
+  // The switch statement has a default case which defers to the super class.
+  // The superclass handles a few pre-defined transactions.
+  out << "default:\n";
+  out << "{\n";
+  out.Indent();
+  if (table_size > 0) {
+    out << "const uint32_t _aidl_index = " << kCodeVarName
+        << " - ::android::IBinder::FIRST_CALL_TRANSACTION;\n";
+    out << "if (_aidl_index < " << std::to_string(table_size)
+        << " && _aidl_handlers[_aidl_index] != nullptr) {\n";
+    out << "  " << kAndroidStatusVarName << " = (this->*_aidl_handlers[_aidl_index])("
+        << kDataVarName << ", " << kReplyVarName << ", " << kFlagsVarName << ");\n";
+    out << "  break;\n";
+    out << "}\n";
+  }
+  out << kAndroidStatusVarName << " = ::android::BBinder::onTransact(" << kCodeVarName << ", "
+      << kDataVarName << ", " << kReplyVarName << ", " << kFlagsVarName << ");\n";
+  out.Dedent();
+  out << "}\n";
+  out << "break;\n";
+  out << "}\n";
+
+  // If we saw a null reference, we can map that to an appropriate exception.
+  out << "if (" << kAndroidStatusVarName << " == ::android::UNEXPECTED_NULL) {\n";
+  out.Indent();
+  out << kAndroidStatusVarName << " = " << kBinderStatusLiteral << "::fromExceptionCode("
+      << kBinderStatusLiteral << "::EX_NULL_POINTER).writeToParcel(" << kReplyVarName << ");\n";
+  out.Dedent();
+  out << "}\n";
+
+  // Finally, the server's onTransact method just returns a status code.
+  out << "return " << kAndroidStatusVarName << ";\n";
+  out.Dedent();
+  out << "}\n";
 }
 
 }  // namespace
@@ -697,66 +2282,72 @@ unique_ptr<Document> BuildServerSource(const AidlTypenames& typenames,
         "::android::internal::Stability::markCompilationUnit(this)");
   }
 
-  unique_ptr<MethodImpl> on_transact{new MethodImpl{
-      kAndroidStatusLiteral, bn_name, "onTransact",
-      ArgList{{StringPrintf("uint32_t %s", kCodeVarName),
-               StringPrintf("const %s& %s", kAndroidParcelLiteral,
-                            kDataVarName),
-               StringPrintf("%s* %s", kAndroidParcelLiteral, kReplyVarName),
-               StringPrintf("uint32_t %s", kFlagsVarName)}}
-      }};
-
-  // Declare the status_t variable
-  on_transact->GetStatementBlock()->AddLiteral(
-      StringPrintf("%s %s = %s", kAndroidStatusLiteral, kAndroidStatusVarName,
-                   kAndroidStatusOk));
-
-  // Add the all important switch statement, but retain a pointer to it.
-  SwitchStatement* s = new SwitchStatement{kCodeVarName};
-  on_transact->GetStatementBlock()->AddStatement(s);
-
-  // The switch statement has a case statement for each transaction code.
+  // onTransact is written as the document is written. Only check here that
+  // it can be.
+  std::set<string> transaction_ids;
   for (const auto& method : interface.GetMethods()) {
-    StatementBlock* b = s->AddCase(GetTransactionIdFor(*method));
-    if (!b) { return nullptr; }
-
-    bool success = false;
-    if (method->IsUserDefined()) {
-      success = HandleServerTransaction(typenames, interface, *method, options, b);
-    } else {
-      success = HandleServerMetaTransaction(typenames, interface, *method, options, b);
+    if (!transaction_ids.insert(GetTransactionIdFor(*method)).second) {
+      LOG(ERROR) << "internal error: duplicate switch case labels";
+      return nullptr;
     }
-    if (!success) {
+    if (!method->IsUserDefined() && !HandlesServerMetaTransaction(*method, options)) {
       return nullptr;
     }
   }
+  unique_ptr<Declaration> on_transact{
+      new StreamedDecl([&typenames, &interface, &options](CodeWriter& out) {
+        WriteServerOnTransact(out, typenames, interface, options);
+      })};
 
-  // The switch statement has a default case which defers to the super class.
-  // The superclass handles a few pre-defined transactions.
-  StatementBlock* b = s->AddCase("");
-  b->AddLiteral(StringPrintf(
-                "%s = ::android::BBinder::onTransact(%s, %s, "
-                "%s, %s)", kAndroidStatusVarName, kCodeVarName,
-                kDataVarName, kReplyVarName, kFlagsVarName));
-
-  // If we saw a null reference, we can map that to an appropriate exception.
-  IfStatement* null_check = new IfStatement(
-      new LiteralExpression(string(kAndroidStatusVarName) +
-                            " == ::android::UNEXPECTED_NULL"));
-  on_transact->GetStatementBlock()->AddStatement(null_check);
-  null_check->OnTrue()->AddStatement(new Assignment(
-      kAndroidStatusVarName,
-      StringPrintf("%s::fromExceptionCode(%s::EX_NULL_POINTER)"
-                   ".writeToParcel(%s)",
-                   kBinderStatusLiteral, kBinderStatusLiteral,
-                   kReplyVarName)));
-
-  // Finally, the server's onTransact method just returns a status code.
-  on_transact->GetStatementBlock()->AddLiteral(
-      StringPrintf("return %s", kAndroidStatusVarName));
   vector<unique_ptr<Declaration>> decls;
+  // With --source-shards, the handlers of --native-dispatch-table are in the
+  // shards, and only batched calls are read here.
+  const bool sharded_handlers =
+      options.SourceShards() > 0 && NativeDispatchTableSize(interface, options) > 0;
+  const bool reads_arguments = !sharded_handlers || HasBatchableMethods(interface);
+  if (HasSharedMemoryArguments(interface) && reads_arguments) {
+    include_list.emplace_back("binder/ParcelFileDescriptor.h");
+    include_list.emplace_back("sys/mman.h");
+    include_list.emplace_back("sys/stat.h");
+    decls.emplace_back(new LiteralDecl(kSharedMemoryReader));
+  }
+  if (HasViewArguments(interface) && reads_arguments) {
+    decls.emplace_back(new LiteralDecl(kArrayViewReader));
+  }
+  if (UsesFileDescriptorArrayHelpers(options, MethodTypesOf(interface)) && reads_arguments) {
+    include_list.emplace_back("binder/ParcelFileDescriptor.h");
+    decls.emplace_back(new LiteralDecl(kFileDescriptorArrayHelpers));
+  }
+  if (UsesFixedSizeArrayHelpers(MethodTypesOf(interface)) && reads_arguments) {
+    include_list.emplace_back("array");
+    include_list.emplace_back("cstring");
+    include_list.emplace_back("type_traits");
+    decls.emplace_back(new LiteralDecl(kFixedSizeArrayHelpers));
+  }
+  if (UsesUtf8StringHelpers(interface, MethodsOf(interface)) && reads_arguments) {
+    include_list.emplace_back("cstring");
+    include_list.emplace_back("optional");
+    include_list.emplace_back("utils/String8.h");
+    decls.emplace_back(new LiteralDecl(kUtf8StringHelpers));
+  }
+  if (UsesPackedArrayHelpers(interface, MethodsOf(interface)) && reads_arguments) {
+    include_list.emplace_back("cstdint");
+    include_list.emplace_back("cstring");
+    include_list.emplace_back("optional");
+    decls.emplace_back(new LiteralDecl(kPackedArrayHelpers));
+  }
   decls.push_back(std::move(constructor));
   decls.push_back(std::move(on_transact));
+  if (NativeDispatchTableSize(interface, options) > 0 && !sharded_handlers) {
+    for (const auto& method : interface.GetMethods()) {
+      if (method->IsUserDefined()) {
+        decls.emplace_back(
+            new StreamedDecl([&typenames, &interface, &method, &options](CodeWriter& out) {
+              WriteServerHandler(out, typenames, interface, *method, options);
+            }));
+      }
+    }
+  }
 
   if (options.Version() > 0) {
     std::ostringstream code;
@@ -786,13 +2377,153 @@ unique_ptr<Document> BuildServerSource(const AidlTypenames& typenames,
       new CppSource{include_list, NestInNamespaces(std::move(decls), interface.GetSplitPackage())}};
 }
 
+unique_ptr<Document> BuildSourceShard(const AidlTypenames& typenames,
+                                      const AidlInterface& interface, const Options& options,
+                                      size_t shard) {
+  // The user-defined methods are dealt to the shards in the order they are
+  // declared, so that a shard only changes with the methods dealt to it.
+  vector<const AidlMethod*> methods;
+  size_t index = 0;
+  for (const auto& method : interface.GetMethods()) {
+    if (method->IsUserDefined() && index++ % options.SourceShards() == shard) {
+      methods.push_back(method.get());
+    }
+  }
+  const bool has_handlers = NativeDispatchTableSize(interface, options) > 0;
+  auto uses_argument = [&methods](bool (AidlTypeSpecifier::*predicate)() const) {
+    for (const AidlMethod* method : methods) {
+      for (const auto& arg : method->GetArguments()) {
+        if ((arg->GetType().*predicate)()) {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+
+  std::set<string> includes = {
+      HeaderFile(interface, ClassNames::CLIENT, false),
+      HeaderFile(interface, ClassNames::SERVER, false),
+      kParcelHeader,
+      kAndroidBaseMacrosHeader,
+  };
+  if (options.GenLog()) {
+    includes.insert({"chrono", "functional", "json/value.h"});
+  }
+  vector<unique_ptr<Declaration>> decls;
+  if (uses_argument(&AidlTypeSpecifier::IsSharedMemory)) {
+    includes.insert({"binder/ParcelFileDescriptor.h", "cstring", "sys/mman.h", "unistd.h"});
+    decls.emplace_back(new LiteralDecl(kSharedMemoryWriter));
+    if (has_handlers) {
+      includes.insert("sys/stat.h");
+      decls.emplace_back(new LiteralDecl(kSharedMemoryReader));
+    }
+  }
+  if (uses_argument(&AidlTypeSpecifier::IsView)) {
+    includes.insert({"cstdint", "cstring"});
+    decls.emplace_back(new LiteralDecl(kArrayViewWriter));
+    if (has_handlers) {
+      decls.emplace_back(new LiteralDecl(kArrayViewReader));
+    }
+  }
+  if (UsesFileDescriptorArrayHelpers(options, MethodTypesOf(interface))) {
+    includes.insert("binder/ParcelFileDescriptor.h");
+    decls.emplace_back(new LiteralDecl(kFileDescriptorArrayHelpers));
+  }
+  if (UsesFixedSizeArrayHelpers(MethodTypesOf(interface))) {
+    includes.insert({"array", "cstring", "type_traits"});
+    decls.emplace_back(new LiteralDecl(kFixedSizeArrayHelpers));
+  }
+  if (UsesUtf8StringHelpers(interface, methods)) {
+    includes.insert({"cstring", "optional", "utils/String8.h"});
+    decls.emplace_back(new LiteralDecl(kUtf8StringHelpers));
+  }
+  if (UsesPackedArrayHelpers(interface, methods)) {
+    includes.insert({"cstdint", "cstring", "optional"});
+    decls.emplace_back(new LiteralDecl(kPackedArrayHelpers));
+  }
+  for (const AidlMethod* method : methods) {
+    decls.push_back(DefineClientTransaction(typenames, interface, *method, options));
+  }
+  if (has_handlers) {
+    for (const AidlMethod* method : methods) {
+      decls.emplace_back(
+          new StreamedDecl([&typenames, &interface, method, &options](CodeWriter& out) {
+            WriteServerHandler(out, typenames, interface, *method, options);
+          }));
+    }
+  }
+  return unique_ptr<Document>{
+      new CppSource{vector<string>(includes.begin(), includes.end()),
+                    NestInNamespaces(std::move(decls), interface.GetSplitPackage())}};
+}
+
+namespace {
+
+// What DO_NOT_DIRECTLY_USE_ME_IMPLEMENT_META_INTERFACE defines, for
+// --lazy-descriptors. The descriptor and the default implementation are
+// function-local statics, so that loading the library runs no initializer.
+string BuildLazyMetaInterface(const AidlInterface& interface, const string& fq_name) {
+  const string i_name = ClassName(interface, ClassNames::INTERFACE);
+  const string bp_name = ClassName(interface, ClassNames::CLIENT);
+  const char* i = i_name.c_str();
+  std::ostringstream code;
+  code << StringPrintf(
+      "%s::_aidl_Descriptor::operator const ::android::String16&() const {\n"
+      "  static const ::android::String16 value(u\"%s\");\n"
+      "  return value;\n"
+      "}\n"
+      "const ::android::String16& %s::getInterfaceDescriptor() const {\n"
+      "  return descriptor;\n"
+      "}\n",
+      i, fq_name.c_str(), i);
+  code << StringPrintf(
+      "::android::sp<%s> %s::asInterface(const ::android::sp<::android::IBinder>& obj) {\n"
+      "  ::android::sp<%s> intr;\n"
+      "  if (obj != nullptr) {\n"
+      "    intr = static_cast<%s*>(obj->queryLocalInterface(descriptor).get());\n"
+      "    if (intr == nullptr) {\n"
+      "      intr = new %s(obj);\n"
+      "    }\n"
+      "  }\n"
+      "  return intr;\n"
+      "}\n",
+      i, i, i, i, bp_name.c_str());
+  code << StringPrintf(
+      "static ::android::sp<%s>& _aidl_default_impl() {\n"
+      "  static ::android::sp<%s> impl;\n"
+      "  return impl;\n"
+      "}\n"
+      "bool %s::setDefaultImpl(::android::sp<%s> impl) {\n"
+      "  assert(!_aidl_default_impl());\n"
+      "  if (impl) {\n"
+      "    _aidl_default_impl() = std::move(impl);\n"
+      "    return true;\n"
+      "  }\n"
+      "  return false;\n"
+      "}\n"
+      "const ::android::sp<%s>& %s::getDefaultImpl() {\n"
+      "  return _aidl_default_impl();\n"
+      "}\n"
+      "%s::%s() {}\n"
+      "%s::~%s() {}\n",
+      i, i, i, i, i, i, i, i, i, i);
+  return code.str();
+}
+
+}  // namespace
+
 unique_ptr<Document> BuildInterfaceSource(const AidlTypenames& typenames,
-                                          const AidlInterface& interface,
-                                          [[maybe_unused]] const Options& options) {
+                                          const AidlInterface& interface, const Options& options) {
   vector<string> include_list{
       HeaderFile(interface, ClassNames::RAW, false),
       HeaderFile(interface, ClassNames::CLIENT, false),
   };
+  for (const AidlDefinedType* type : ForwardDeclaredTypes(interface, typenames, options)) {
+    set<string> type_headers;
+    AddHeaders(*type, type_headers);
+    include_list.insert(include_list.end(), type_headers.begin(), type_headers.end());
+  }
 
   string fq_name = ClassName(interface, ClassNames::INTERFACE);
   if (!interface.GetPackage().empty()) {
@@ -801,10 +2532,15 @@ unique_ptr<Document> BuildInterfaceSource(const AidlTypenames& typenames,
 
   vector<unique_ptr<Declaration>> decls;
 
-  unique_ptr<MacroDecl> meta_if{new MacroDecl{
-      "DO_NOT_DIRECTLY_USE_ME_IMPLEMENT_META_INTERFACE",
-      ArgList{vector<string>{ClassName(interface, ClassNames::BASE), '"' + fq_name + '"'}}}};
-  decls.push_back(std::move(meta_if));
+  if (options.LazyDescriptors()) {
+    include_list.emplace_back("assert.h");
+    decls.emplace_back(new LiteralDecl(BuildLazyMetaInterface(interface, fq_name)));
+  } else {
+    unique_ptr<MacroDecl> meta_if{new MacroDecl{
+        "DO_NOT_DIRECTLY_USE_ME_IMPLEMENT_META_INTERFACE",
+        ArgList{vector<string>{ClassName(interface, ClassNames::BASE), '"' + fq_name + '"'}}}};
+    decls.push_back(std::move(meta_if));
+  }
 
   for (const auto& constant : interface.GetConstantDeclarations()) {
     const AidlConstantValue& value = constant->GetValue();
@@ -821,6 +2557,20 @@ unique_ptr<Document> BuildInterfaceSource(const AidlTypenames& typenames,
     decls.push_back(std::move(getter));
   }
 
+  if (options.GenStats()) {
+    include_list.emplace_back("algorithm");
+    include_list.emplace_back("cinttypes");
+    include_list.emplace_back("stdio.h");
+    decls.emplace_back(new LiteralDecl(GenStatsDefinitions(interface)));
+  }
+  if (options.GenBinaryLog()) {
+    decls.emplace_back(new LiteralDecl(
+        GenTransactionRecordDecoder(interface, ClassName(interface, ClassNames::INTERFACE))));
+  }
+  if (options.GenLog() || options.GenBinaryLog()) {
+    decls.emplace_back(new LiteralDecl(GenLogSamplingDefinitions(interface)));
+  }
+
   return unique_ptr<Document>{new CppSource{
       include_list,
       NestInNamespaces(std::move(decls), interface.GetSplitPackage())}};
@@ -840,10 +2590,14 @@ unique_ptr<Document> BuildClientHeader(const AidlTypenames& typenames,
                            kImplVarName)},
       ConstructorDecl::IS_EXPLICIT
   }};
-  unique_ptr<ConstructorDecl> destructor{new ConstructorDecl{
-      "~" + bp_name,
-      ArgList{},
-      ConstructorDecl::IS_VIRTUAL | ConstructorDecl::IS_DEFAULT}};
+  // A proxy with @Batchable methods sends the calls it holds back when it goes away.
+  const bool batches = HasBatchableMethods(interface);
+  uint32_t destructor_modifiers = ConstructorDecl::IS_VIRTUAL;
+  if (!batches) {
+    destructor_modifiers |= ConstructorDecl::IS_DEFAULT;
+  }
+  unique_ptr<ConstructorDecl> destructor{
+      new ConstructorDecl{"~" + bp_name, ArgList{}, destructor_modifiers}};
 
   vector<unique_ptr<Declaration>> publics;
   publics.push_back(std::move(constructor));
@@ -851,7 +2605,12 @@ unique_ptr<Document> BuildClientHeader(const AidlTypenames& typenames,
 
   for (const auto& method: interface.GetMethods()) {
     if (method->IsUserDefined()) {
-      publics.push_back(BuildMethodDecl(*method, typenames, false));
+      publics.push_back(BuildMethodDecl(*method, typenames, options, false));
+      if (method->GetType().IsChunked()) {
+        publics.push_back(unique_ptr<Declaration>(new MethodDecl{
+            kBinderStatusLiteral, method->GetName() + "Chunks",
+            ArgList(BuildChunksArgs(typenames, options, *method)), MethodDecl::IS_OVERRIDE}));
+      }
     } else {
       publics.push_back(BuildMetaMethodDecl(*method, typenames, options, false));
     }
@@ -867,11 +2626,37 @@ unique_ptr<Document> BuildClientHeader(const AidlTypenames& typenames,
 
   vector<unique_ptr<Declaration>> privates;
 
+  if (batches) {
+    includes.emplace_back("binder/Parcel.h");
+    includes.emplace_back("chrono");
+    includes.emplace_back("mutex");
+    publics.emplace_back(new LiteralDecl(StringPrintf(
+        "%s flushBatchedCalls() override;\n"
+        "// A batch goes out once it has this many calls, or when a call is made\n"
+        "// this long after the first one in it.\n"
+        "static constexpr size_t kMaxBatchedCalls = 32;\n"
+        "static constexpr std::chrono::milliseconds kMaxBatchDelay{10};\n",
+        kAndroidStatusLiteral)));
+    privates.emplace_back(new LiteralDecl(StringPrintf(
+        "%s flushBatchedCallsLocked();\n"
+        "std::mutex _aidl_batch_mutex;\n"
+        "::android::Parcel _aidl_batch;\n"
+        "size_t _aidl_batch_calls = 0;\n"
+        "std::chrono::steady_clock::time_point _aidl_batch_start;\n",
+        kAndroidStatusLiteral)));
+  }
+
+  if (options.Version() > 0 || !options.Hash().empty()) {
+    includes.emplace_back("atomic");
+  }
   if (options.Version() > 0) {
-    privates.emplace_back(new LiteralDecl("int32_t cached_version_ = -1;\n"));
+    privates.emplace_back(new LiteralDecl("std::atomic<int32_t> cached_version_{-1};\n"));
   }
   if (!options.Hash().empty()) {
+    includes.emplace_back("mutex");
+    includes.emplace_back("string");
     privates.emplace_back(new LiteralDecl("std::string cached_hash_ = \"-1\";\n"));
+    privates.emplace_back(new LiteralDecl("std::atomic<bool> cached_hash_ready_{false};\n"));
     privates.emplace_back(new LiteralDecl("std::mutex cached_hash_mutex_;\n"));
   }
 
@@ -928,11 +2713,20 @@ unique_ptr<Document> BuildServerHeader(const AidlTypenames& /* typenames */,
     publics.emplace_back(
         new LiteralDecl{"static std::function<void(const Json::Value&)> logFunc;\n"});
   }
+  // The handlers of --native-dispatch-table are only called from onTransact.
+  vector<unique_ptr<Declaration>> privates;
+  if (NativeDispatchTableSize(interface, options) > 0) {
+    for (const auto& method : interface.GetMethods()) {
+      if (method->IsUserDefined()) {
+        privates.emplace_back(new LiteralDecl(ServerHandlerSignature(*method, "") + ";\n"));
+      }
+    }
+  }
   unique_ptr<ClassDecl> bn_class{
       new ClassDecl{bn_name,
                     "::android::BnInterface<" + i_name + ">",
                     std::move(publics),
-                    {}
+                    std::move(privates)
       }};
 
   return unique_ptr<Document>{
@@ -946,17 +2740,43 @@ unique_ptr<Document> BuildInterfaceHeader(const AidlTypenames& typenames,
 
   for (const auto& method : interface.GetMethods()) {
     for (const auto& argument : method->GetArguments()) {
-      AddHeaders(argument->GetType(), typenames, includes);
+      AddHeaders(argument->GetType(), typenames, options, includes);
     }
 
-    AddHeaders(method->GetType(), typenames, includes);
+    AddHeaders(method->GetType(), typenames, options, includes);
+  }
+  // The types that are declared instead are included by the source.
+  const vector<const AidlDefinedType*> forward_declared =
+      ForwardDeclaredTypes(interface, typenames, options);
+  for (const AidlDefinedType* type : forward_declared) {
+    set<string> type_headers;
+    AddHeaders(*type, type_headers);
+    for (const string& header : type_headers) {
+      includes.erase(header);
+    }
   }
 
   const string i_name = ClassName(interface, ClassNames::INTERFACE);
   unique_ptr<ClassDecl> if_class{new ClassDecl{i_name, "::android::IInterface"}};
-  if_class->AddPublic(unique_ptr<Declaration>{new MacroDecl{
-      "DECLARE_META_INTERFACE",
-      ArgList{vector<string>{ClassName(interface, ClassNames::BASE)}}}});
+  if (options.LazyDescriptors()) {
+    if_class->AddPublic(unique_ptr<Declaration>(new LiteralDecl(StringPrintf(
+        "// As DECLARE_META_INTERFACE, but descriptor is made on first use\n"
+        "struct _aidl_Descriptor {\n"
+        "  operator const ::android::String16&() const;\n"
+        "};\n"
+        "static constexpr _aidl_Descriptor descriptor{};\n"
+        "static ::android::sp<%s> asInterface(const ::android::sp<::android::IBinder>& obj);\n"
+        "virtual const ::android::String16& getInterfaceDescriptor() const;\n"
+        "%s();\n"
+        "virtual ~%s();\n"
+        "static bool setDefaultImpl(::android::sp<%s> impl);\n"
+        "static const ::android::sp<%s>& getDefaultImpl();\n",
+        i_name.c_str(), i_name.c_str(), i_name.c_str(), i_name.c_str(), i_name.c_str()))));
+  } else {
+    if_class->AddPublic(unique_ptr<Declaration>{new MacroDecl{
+        "DECLARE_META_INTERFACE",
+        ArgList{vector<string>{ClassName(interface, ClassNames::BASE)}}}});
+  }
 
   if (options.Version() > 0) {
     std::ostringstream code;
@@ -1011,17 +2831,104 @@ unique_ptr<Document> BuildInterfaceHeader(const AidlTypenames& typenames,
     includes.insert(kTraceHeader);
   }
 
+  if (options.GenStats()) {
+    includes.insert("atomic");
+    includes.insert("chrono");
+    if_class->AddPublic(unique_ptr<Declaration>(new LiteralDecl(GenStatsDeclarations(interface))));
+  }
+
+  if (options.GenLog() || options.GenBinaryLog()) {
+    includes.insert("atomic");
+    includes.insert("cstdint");
+    includes.insert("string");
+    if_class->AddPublic(
+        unique_ptr<Declaration>(new LiteralDecl(GenLogSamplingDeclarations(interface))));
+  }
+
+  if (options.GenBinaryLog()) {
+    for (const char* header : {"algorithm", "atomic", "chrono", "cstdint", "cstring", "sstream",
+                               "string", "vector"}) {
+      includes.insert(header);
+    }
+    if_class->AddPublic(unique_ptr<Declaration>(new LiteralDecl(
+        "static std::string decodeTransactionRecord("
+        "const ::android::aidl::TransactionRecord& record);\n")));
+  }
+
+  if (options.GenTransactionNames()) {
+    includes.insert("string_view");
+    if_class->AddPublic(unique_ptr<Declaration>(new LiteralDecl(
+        GenTransactionNamesDeclarations(interface, "::android::IBinder::FIRST_CALL_TRANSACTION"))));
+  }
+
+  if (options.GenPrewarm()) {
+    includes.insert("binder/IServiceManager.h");
+    includes.insert(kString16Header);
+    includes.insert("future");
+    if_class->AddPublic(unique_ptr<Declaration>(new LiteralDecl(StringPrintf(
+        "// Gets the service |name| in the background, which starts it if it is a\n"
+        "// lazy service. Holding on to the future keeps the service running.\n"
+        "static std::future<::android::sp<%s>> prewarm(const ::android::String16& name) {\n"
+        "  return std::async(std::launch::async, [name] {\n"
+        "    return ::android::waitForService<%s>(name);\n"
+        "  });\n"
+        "}\n",
+        i_name.c_str(), i_name.c_str()))));
+  }
+
+  if (HasBatchableMethods(interface)) {
+    // Only proxies hold calls back.
+    if_class->AddPublic(unique_ptr<Declaration>(new LiteralDecl(
+        StringPrintf("// Sends the @Batchable calls that haven't been sent yet.\n"
+                     "virtual %s flushBatchedCalls() {\n"
+                     "  return %s;\n"
+                     "}\n",
+                     kAndroidStatusLiteral, kAndroidStatusOk))));
+  }
+
   if (!interface.GetMethods().empty()) {
     for (const auto& method : interface.GetMethods()) {
       if (method->IsUserDefined()) {
         // Each method gets an enum entry and pure virtual declaration.
-        if_class->AddPublic(BuildMethodDecl(*method, typenames, true));
+        if_class->AddPublic(BuildMethodDecl(*method, typenames, options, true));
+        if (method->GetType().IsChunked()) {
+          if_class->AddPublic(BuildChunksMethodDecl(*method, typenames, options));
+        }
       } else {
         if_class->AddPublic(BuildMetaMethodDecl(*method, typenames, options, true));
       }
     }
   }
 
+  const bool declares_executors =
+      options.GenAsync() || options.GenCoroutines() || HasDispatchedMethods(interface);
+  if (declares_executors) {
+    includes.insert("condition_variable");
+    includes.insert("deque");
+    includes.insert("functional");
+    includes.insert("map");
+    includes.insert("memory");
+    includes.insert("mutex");
+    includes.insert("string");
+    includes.insert("thread");
+    includes.insert("tuple");
+  }
+  if (options.GenAsync()) {
+    for (const auto& method : interface.GetMethods()) {
+      if (HasAsyncVariant(*method)) {
+        if_class->AddPublic(unique_ptr<Declaration>(new LiteralDecl(GenAsyncMethod(
+            *method, kBinderStatusLiteral, "::android::sp<" + i_name + ">(this)",
+            [&](const AidlTypeSpecifier& type) { return CppNameOf(type, typenames, options); }))));
+      }
+    }
+  }
+  if (options.GenCoroutines()) {
+    includes.insert("optional");
+    if_class->AddPublic(unique_ptr<Declaration>(new LiteralDecl(GenAwaitMethods(
+        interface, kBinderStatusLiteral, "::android::sp<" + i_name + ">(this)",
+        [&](const AidlTypeSpecifier& type) { return CppNameOf(type, typenames, options); }))));
+  }
+
   // Implement the default impl class.
   vector<unique_ptr<Declaration>> method_decls;
   // onAsBinder returns nullptr as this interface is not associated with a
@@ -1039,7 +2946,7 @@ unique_ptr<Document> BuildInterfaceHeader(const AidlTypenames& typenames,
     if (method->IsUserDefined()) {
       std::ostringstream code;
       code << "::android::binder::Status " << method->GetName()
-           << BuildArgList(typenames, *method, true, true).ToString() << " override {\n"
+           << BuildArgList(typenames, options, *method, true, true).ToString() << " override {\n"
            << "  return ::android::binder::Status::fromStatusT(::android::UNKNOWN_TRANSACTION);\n"
            << "}\n";
       method_decls.emplace_back(new LiteralDecl(code.str()));
@@ -1066,21 +2973,73 @@ unique_ptr<Document> BuildInterfaceHeader(const AidlTypenames& typenames,
   decls.emplace_back(new ClassDecl{
       ClassName(interface, ClassNames::DEFAULT_IMPL), i_name, std::move(method_decls), {}});
 
-  return unique_ptr<Document>{
-      new CppHeader{BuildHeaderGuard(interface, ClassNames::INTERFACE),
-                    vector<string>(includes.begin(), includes.end()),
-                    NestInNamespaces(std::move(decls), interface.GetSplitPackage())}};
+  vector<unique_ptr<Declaration>> file_decls;
+  for (const AidlDefinedType* type : forward_declared) {
+    for (auto& decl : NestInNamespaces(
+             unique_ptr<Declaration>(new LiteralDecl("class " + type->GetName() + ";\n")),
+             type->GetSplitPackage())) {
+      file_decls.push_back(std::move(decl));
+    }
+  }
+  if (HasViewArguments(interface)) {
+    includes.insert("cstddef");
+    includes.insert("vector");
+    file_decls.emplace_back(new LiteralDecl(kArrayViewDeclaration));
+  }
+  if (HasRawParcelables(interface)) {
+    includes.insert(kParcelHeader);
+    includes.insert("binder/Parcelable.h");
+    includes.insert("memory");
+    file_decls.emplace_back(new LiteralDecl(kRawParcelableDeclaration));
+  }
+  if (HasChunkedMethods(interface)) {
+    includes.insert("binder/Binder.h");
+    includes.insert(kParcelHeader);
+    includes.insert("iterator");
+    includes.insert("mutex");
+    includes.insert("vector");
+    file_decls.emplace_back(new LiteralDecl(kChunkedDeclaration));
+  }
+  if (declares_executors) {
+    file_decls.emplace_back(new LiteralDecl(kAsyncExecutorDeclaration));
+  }
+  if (options.GenCoroutines()) {
+    file_decls.emplace_back(new LiteralDecl(kAwaitableDeclaration));
+  }
+  if (HasCallContextMethods(interface)) {
+    includes.insert("chrono");
+    includes.insert("cstdint");
+    file_decls.emplace_back(new LiteralDecl(kCallContextDeclaration));
+  }
+  if (options.GenBinaryLog()) {
+    file_decls.emplace_back(new LiteralDecl(kTransactionLogDeclaration));
+  }
+  if (HasArgTables(interface, options)) {
+    includes.insert(kParcelHeader);
+    includes.insert(kString16Header);
+    includes.insert("cstdint");
+    includes.insert("string");
+    file_decls.emplace_back(new LiteralDecl(kArgCodeDeclaration));
+    file_decls.emplace_back(new LiteralDecl(kCppArgTableDeclaration));
+  }
+  for (auto& decl : NestInNamespaces(std::move(decls), interface.GetSplitPackage())) {
+    file_decls.push_back(std::move(decl));
+  }
+
+  return unique_ptr<Document>{new CppHeader{BuildHeaderGuard(interface, ClassNames::INTERFACE),
+                                            vector<string>(includes.begin(), includes.end()),
+                                            std::move(file_decls)}};
 }
 
 std::unique_ptr<Document> BuildParcelHeader(const AidlTypenames& typenames,
                                             const AidlStructuredParcelable& parcel,
-                                            const Options&) {
+                                            const Options& options) {
   unique_ptr<ClassDecl> parcel_class{new ClassDecl{parcel.GetName(), "::android::Parcelable"}};
 
   set<string> includes = {kStatusHeader, kParcelHeader};
   includes.insert("tuple");
   for (const auto& variable : parcel.GetFields()) {
-    AddHeaders(variable->GetType(), typenames, includes);
+    AddHeaders(variable->GetType(), typenames, options, includes);
   }
 
   set<string> operators = {"<", ">", "==", ">=", "<=", "!="};
@@ -1089,8 +3048,10 @@ std::unique_ptr<Document> BuildParcelHeader(const AidlTypenames& typenames,
     std::vector<std::string> variable_name;
     std::vector<std::string> rhs_variable_name;
     for (const auto& variable : parcel.GetFields()) {
-      variable_name.push_back(variable->GetName());
-      rhs_variable_name.push_back("rhs." + variable->GetName());
+      // A lazy field is compared through its accessor, which decodes it.
+      const string access = variable->GetName() + (variable->GetType().IsLazy() ? "()" : "");
+      variable_name.push_back(access);
+      rhs_variable_name.push_back("rhs." + access);
     }
 
     operator_code << "inline bool operator" << op << "(const " << parcel.GetName()
@@ -1103,10 +3064,40 @@ std::unique_ptr<Document> BuildParcelHeader(const AidlTypenames& typenames,
 
     parcel_class->AddPublic(std::unique_ptr<LiteralDecl>(new LiteralDecl(operator_code.str())));
   }
-  for (const auto& variable : parcel.GetFields()) {
+  // The bytes of a lazy field, which copies of the parcelable share, and the
+  // value decoded from them.
+  if (std::any_of(parcel.GetFields().begin(), parcel.GetFields().end(),
+                  [](const auto& variable) { return variable->GetType().IsLazy(); })) {
+    parcel_class->AddPrivate(unique_ptr<LiteralDecl>(
+        new LiteralDecl("template <typename T>\n"
+                        "struct _aidl_LazyField {\n"
+                        "  ::android::Parcel data;\n"
+                        "  std::once_flag decoded;\n"
+                        "  T value;\n"
+                        "};\n")));
+    includes.insert("memory");
+    includes.insert("mutex");
+  }
+  for (const auto variable : FieldsInDeclarationOrder(parcel, typenames, options)) {
+    if (variable->GetType().IsLazy()) {
+      const string& name = variable->GetName();
+      const string cpp_type = CppNameOf(variable->GetType(), typenames, options);
+      parcel_class->AddPublic(unique_ptr<LiteralDecl>(new LiteralDecl(StringPrintf(
+          "// %s is decoded the first time it is used, and written as it was read\n"
+          "// until it is changed through mutable_%s().\n"
+          "const %s& %s() const;\n"
+          "%s* mutable_%s();\n",
+          name.c_str(), name.c_str(), cpp_type.c_str(), name.c_str(), cpp_type.c_str(),
+          name.c_str()))));
+      parcel_class->AddPrivate(unique_ptr<LiteralDecl>(new LiteralDecl(
+          StringPrintf("%s _aidl_value_%s;\n"
+                       "std::shared_ptr<_aidl_LazyField<%s>> _aidl_pending_%s;\n",
+                       cpp_type.c_str(), name.c_str(), cpp_type.c_str(), name.c_str()))));
+      continue;
+    }
 
     std::ostringstream out;
-    std::string cppType = CppNameOf(variable->GetType(), typenames);
+    std::string cppType = CppNameOf(variable->GetType(), typenames, options);
     out << cppType.c_str() << " " << variable->GetName().c_str();
     if (variable->GetDefaultValue()) {
       out << " = " << cppType.c_str() << "(" << variable->ValueString(ConstantValueDecorator)
@@ -1133,13 +3124,280 @@ std::unique_ptr<Document> BuildParcelHeader(const AidlTypenames& typenames,
       MethodDecl::IS_OVERRIDE | MethodDecl::IS_CONST | MethodDecl::IS_FINAL));
   parcel_class->AddPublic(std::move(write));
 
+  if (const ParcelFieldRun layout = FixedParcelLayoutOf(parcel);
+      options.ParcelTraits() && !layout.fields.empty()) {
+    // The size of an element of a vector: 1 for non-null, the size of the
+    // parcelable and the fields.
+    parcel_class->AddPublic(unique_ptr<LiteralDecl>(new LiteralDecl(StringPrintf(
+        "static constexpr size_t kParcelSize = %zu;\n", 2 * sizeof(int32_t) + layout.size))));
+    parcel_class->AddPublic(unique_ptr<MethodDecl>(new MethodDecl(
+        kAndroidStatusLiteral, "writeVectorToParcel",
+        ArgList(vector<string>{"::android::Parcel* _aidl_parcel",
+                               "const ::std::vector<" + parcel.GetName() + ">& _aidl_vector"}),
+        MethodDecl::IS_STATIC)));
+    parcel_class->AddPublic(unique_ptr<MethodDecl>(new MethodDecl(
+        kAndroidStatusLiteral, "readVectorFromParcel",
+        ArgList(vector<string>{"const ::android::Parcel* _aidl_parcel",
+                               "::std::vector<" + parcel.GetName() + ">* _aidl_vector"}),
+        MethodDecl::IS_STATIC)));
+    includes.insert("vector");
+  }
+
   return unique_ptr<Document>{new CppHeader{
       BuildHeaderGuard(parcel, ClassNames::RAW), vector<string>(includes.begin(), includes.end()),
       NestInNamespaces(std::move(parcel_class), parcel.GetSplitPackage())}};
 }
+
+// Copies the fields of |run| from |buffer| + |offset|, where a Parcel wrote
+// them, to the fields of |object|, e.g. "" for this parcelable.
+string DecodeFieldRun(const AidlTypenames& typenames, const ParcelFieldRun& run,
+                      const string& buffer, size_t offset, const string& object,
+                      const string& indent) {
+  std::ostringstream code;
+  for (const auto variable : run.fields) {
+    const AidlTypeSpecifier& type = variable->GetType();
+    const string field = object + variable->GetName();
+    if (type.GetName() == "boolean" || type.GetName() == "byte" || type.GetName() == "char") {
+      code << indent << "{\n";
+      code << indent << "  int32_t _aidl_value;\n";
+      code << indent << "  memcpy(&_aidl_value, " << buffer << " + " << offset
+           << ", sizeof(_aidl_value));\n";
+      if (type.GetName() == "boolean") {
+        code << indent << "  " << field << " = _aidl_value != 0;\n";
+      } else {
+        code << indent << "  " << field << " = static_cast<" << CppNameOf(type, typenames)
+             << ">(_aidl_value);\n";
+      }
+      code << indent << "}\n";
+    } else {
+      code << indent << "memcpy(&" << field << ", " << buffer << " + " << offset << ", sizeof("
+           << field << "));\n";
+    }
+    offset += ParcelPrimitiveSize(type);
+  }
+  return code.str();
+}
+
+// Copies the fields of |run| of |object| to |buffer| + |offset| the way a
+// Parcel writes them.
+string EncodeFieldRun(const ParcelFieldRun& run, const string& buffer, size_t offset,
+                      const string& object, const string& indent) {
+  std::ostringstream code;
+  for (const auto variable : run.fields) {
+    const AidlTypeSpecifier& type = variable->GetType();
+    const string field = object + variable->GetName();
+    if (type.GetName() == "boolean" || type.GetName() == "byte" || type.GetName() == "char") {
+      code << indent << "{\n";
+      code << indent << "  int32_t _aidl_value = static_cast<int32_t>(" << field << ");\n";
+      code << indent << "  memcpy(" << buffer << " + " << offset
+           << ", &_aidl_value, sizeof(_aidl_value));\n";
+      code << indent << "}\n";
+    } else {
+      code << indent << "memcpy(" << buffer << " + " << offset << ", &" << field << ", sizeof("
+           << field << "));\n";
+    }
+    offset += ParcelPrimitiveSize(type);
+  }
+  return code.str();
+}
+
+// Reads a batched run of primitive fields with a single readInplace() when
+// the parcelable has enough data left for all of them. Otherwise, e.g. when it
+// was written by an older version with fewer fields, they have to be read one
+// by one in the else block of the returned statement.
+IfStatement* BuildReadFieldRun(const AidlTypenames& typenames, const ParcelFieldRun& run) {
+  IfStatement* read = new IfStatement(new LiteralExpression(StringPrintf(
+      "_aidl_parcel->dataPosition() - _aidl_start_pos + %zu <= _aidl_parcelable_size", run.size)));
+  std::ostringstream code;
+  code << "const char* _aidl_run = static_cast<const char*>(_aidl_parcel->readInplace(" << run.size
+       << "));\n";
+  code << "if (_aidl_run == nullptr) return ::android::NOT_ENOUGH_DATA;\n";
+  code << DecodeFieldRun(typenames, run, "_aidl_run", 0, "", "");
+  read->OnTrue()->AddLiteral(code.str(), false);
+  return read;
+}
+
+// Writes a batched run of primitive fields with a single writeInplace().
+string BuildWriteFieldRun(const ParcelFieldRun& run) {
+  std::ostringstream code;
+  code << "{\n";
+  code << "  char* _aidl_run = static_cast<char*>(_aidl_parcel->writeInplace(" << run.size
+       << "));\n";
+  code << "  if (_aidl_run == nullptr) return ::android::NO_MEMORY;\n";
+  code << EncodeFieldRun(run, "_aidl_run", 0, "", "  ");
+  code << "}\n";
+  return code.str();
+}
+
+// With --parcel-traits, a parcelable whose fields are all primitives reads and
+// writes vectors of itself as one block of kParcelSize bytes per element. Each
+// element is laid out as writeParcelable() writes it: 1 for non-null, the size
+// of the parcelable and its fields. Elements that aren't laid out that way,
+// e.g. null ones or ones written by another version, are read one by one.
+vector<unique_ptr<Declaration>> BuildVectorTraits(const AidlTypenames& typenames,
+                                                  const AidlStructuredParcelable& parcel,
+                                                  const ParcelFieldRun& layout) {
+  const string& name = parcel.GetName();
+  const size_t header_size = 2 * sizeof(int32_t);
+
+  unique_ptr<MethodImpl> write{new MethodImpl{
+      kAndroidStatusLiteral, name, "writeVectorToParcel",
+      ArgList(vector<string>{"::android::Parcel* _aidl_parcel",
+                             "const ::std::vector<" + name + ">& _aidl_vector"})}};
+  std::ostringstream write_code;
+  write_code << "if (_aidl_vector.size() > static_cast<size_t>(INT32_MAX) / kParcelSize) {\n"
+             << "  return ::android::BAD_VALUE;\n"
+             << "}\n"
+             << kAndroidStatusLiteral << " " << kAndroidStatusVarName
+             << " = _aidl_parcel->writeInt32(static_cast<int32_t>(_aidl_vector.size()));\n"
+             << "if (" << kAndroidStatusVarName << " != " << kAndroidStatusOk
+             << " || _aidl_vector.empty()) {\n"
+             << "  return " << kAndroidStatusVarName << ";\n"
+             << "}\n"
+             << "char* _aidl_run = static_cast<char*>(\n"
+             << "    _aidl_parcel->writeInplace(_aidl_vector.size() * kParcelSize));\n"
+             << "if (_aidl_run == nullptr) return ::android::NO_MEMORY;\n"
+             << "const int32_t _aidl_header[2] = {1, static_cast<int32_t>(kParcelSize - "
+                "sizeof(int32_t))};\n"
+             << "for (const " << name << "& _aidl_element : _aidl_vector) {\n"
+             << "  memcpy(_aidl_run, _aidl_header, sizeof(_aidl_header));\n"
+             << EncodeFieldRun(layout, "_aidl_run", header_size, "_aidl_element.", "  ")
+             << "  _aidl_run += kParcelSize;\n"
+             << "}\n"
+             << "return " << kAndroidStatusOk << ";\n";
+  write->GetStatementBlock()->AddLiteral(write_code.str(), false);
+
+  unique_ptr<MethodImpl> read{new MethodImpl{
+      kAndroidStatusLiteral, name, "readVectorFromParcel",
+      ArgList(vector<string>{"const ::android::Parcel* _aidl_parcel",
+                             "::std::vector<" + name + ">* _aidl_vector"})}};
+  std::ostringstream read_code;
+  read_code << "size_t _aidl_start_pos = _aidl_parcel->dataPosition();\n"
+            << "int32_t _aidl_size = 0;\n"
+            << kAndroidStatusLiteral << " " << kAndroidStatusVarName
+            << " = _aidl_parcel->readInt32(&_aidl_size);\n"
+            << "if (" << kAndroidStatusVarName << " != " << kAndroidStatusOk << ") {\n"
+            << "  return " << kAndroidStatusVarName << ";\n"
+            << "}\n"
+            << "if (_aidl_size == 0) {\n"
+            << "  _aidl_vector->clear();\n"
+            << "  return " << kAndroidStatusOk << ";\n"
+            << "}\n"
+            << "if (_aidl_size > 0 &&\n"
+            << "    static_cast<size_t>(_aidl_size) <= _aidl_parcel->dataAvail() / kParcelSize) {\n"
+            << "  const char* _aidl_run = static_cast<const char*>(\n"
+            << "      _aidl_parcel->readInplace(static_cast<size_t>(_aidl_size) * kParcelSize));\n"
+            << "  bool _aidl_laid_out = _aidl_run != nullptr;\n"
+            << "  for (int32_t _aidl_i = 0; _aidl_laid_out && _aidl_i < _aidl_size; _aidl_i++) {\n"
+            << "    int32_t _aidl_header[2];\n"
+            << "    memcpy(_aidl_header, _aidl_run + _aidl_i * kParcelSize, "
+               "sizeof(_aidl_header));\n"
+            << "    _aidl_laid_out = _aidl_header[0] == 1 &&\n"
+            << "        _aidl_header[1] == static_cast<int32_t>(kParcelSize - sizeof(int32_t));\n"
+            << "  }\n"
+            << "  if (_aidl_laid_out) {\n"
+            << "    _aidl_vector->resize(static_cast<size_t>(_aidl_size));\n"
+            << "    for (" << name << "& _aidl_element : *_aidl_vector) {\n"
+            << DecodeFieldRun(typenames, layout, "_aidl_run", header_size, "_aidl_element.",
+                              "      ")
+            << "      _aidl_run += kParcelSize;\n"
+            << "    }\n"
+            << "    return " << kAndroidStatusOk << ";\n"
+            << "  }\n"
+            << "}\n"
+            << "_aidl_parcel->setDataPosition(_aidl_start_pos);\n"
+            << "return _aidl_parcel->readParcelableVector(_aidl_vector);\n";
+  read->GetStatementBlock()->AddLiteral(read_code.str(), false);
+
+  vector<unique_ptr<Declaration>> decls;
+  decls.push_back(std::move(write));
+  decls.push_back(std::move(read));
+  return decls;
+}
+
+// Keeps the bytes of the @Lazy field |variable|, a structured parcelable
+// written with its size up front, instead of reading it. The bytes are copied
+// with appendFrom(), which takes the binders and file descriptors in them
+// along.
+string BuildReadLazyField(const AidlTypenames& typenames, const Options& options,
+                          const AidlVariableDeclaration& variable) {
+  std::ostringstream code;
+  code << "{\n"
+       << "  size_t _aidl_lazy_start = _aidl_parcel->dataPosition();\n"
+       << "  if (_aidl_parcel->readInt32() == 0) return ::android::UNEXPECTED_NULL;\n"
+       << "  int32_t _aidl_lazy_raw_size = _aidl_parcel->readInt32();\n"
+       << "  if (_aidl_lazy_raw_size < 4) return ::android::BAD_VALUE;\n"
+       << "  size_t _aidl_lazy_size = 4 + static_cast<size_t>(_aidl_lazy_raw_size);\n"
+       << "  auto _aidl_lazy = std::make_shared<_aidl_LazyField<"
+       << CppNameOf(variable.GetType(), typenames, options) << ">>();\n"
+       << "  " << kAndroidStatusVarName
+       << " = _aidl_lazy->data.appendFrom(_aidl_parcel, _aidl_lazy_start, _aidl_lazy_size);\n"
+       << "  if (" << kAndroidStatusVarName << " != " << kAndroidStatusOk << ") return "
+       << kAndroidStatusVarName << ";\n"
+       << "  _aidl_parcel->setDataPosition(_aidl_lazy_start + _aidl_lazy_size);\n"
+       << "  _aidl_pending_" << variable.GetName() << " = std::move(_aidl_lazy);\n"
+       << "}\n";
+  return code.str();
+}
+
+// Writes the @Lazy field |variable| as it was read if it hasn't been changed
+// since, and from its value otherwise.
+string BuildWriteLazyField(const AidlTypenames& typenames, const Options& options,
+                           const AidlVariableDeclaration& variable) {
+  const string pending = "_aidl_pending_" + variable.GetName();
+  std::ostringstream code;
+  code << "if (" << pending << " != nullptr) {\n"
+       << "  " << kAndroidStatusVarName << " = _aidl_parcel->appendFrom(&" << pending
+       << "->data, 0, " << pending << "->data.dataSize());\n"
+       << "} else {\n"
+       << "  " << kAndroidStatusVarName << " = "
+       << ParcelWriteCall(typenames, options, variable.GetType(), "_aidl_parcel", true,
+                          "_aidl_value_" + variable.GetName())
+       << ";\n"
+       << "}\n";
+  return code.str();
+}
+
+// Defines the accessors of the @Lazy field |variable| of |parcel|. The first
+// call decodes the bytes that were read, once for all of the copies that
+// share them. If they can't be decoded, the field keeps its default value.
+string BuildLazyFieldAccessors(const AidlTypenames& typenames, const Options& options,
+                               const AidlStructuredParcelable& parcel,
+                               const AidlVariableDeclaration& variable) {
+  const string& name = variable.GetName();
+  const string cpp_type = CppNameOf(variable.GetType(), typenames, options);
+  const string pending = "_aidl_pending_" + name;
+  std::ostringstream code;
+  code << "const " << cpp_type << "& " << parcel.GetName() << "::" << name << "() const {\n"
+       << "  if (" << pending << " == nullptr) {\n"
+       << "    return _aidl_value_" << name << ";\n"
+       << "  }\n"
+       << "  _aidl_LazyField<" << cpp_type << ">* _aidl_lazy = " << pending << ".get();\n"
+       << "  std::call_once(_aidl_lazy->decoded, [_aidl_lazy] {\n"
+       << "    _aidl_lazy->data.setDataPosition(0);\n"
+       << "    "
+       << ParcelReadCall(typenames, options, variable.GetType(), "_aidl_lazy->data", false,
+                         "&_aidl_lazy->value")
+       << ";\n"
+       << "  });\n"
+       << "  return _aidl_lazy->value;\n"
+       << "}\n"
+       << "\n"
+       << cpp_type << "* " << parcel.GetName() << "::mutable_" << name << "() {\n"
+       << "  if (" << pending << " != nullptr) {\n"
+       << "    _aidl_value_" << name << " = " << name << "();\n"
+       << "    " << pending << ".reset();\n"
+       << "  }\n"
+       << "  return &_aidl_value_" << name << ";\n"
+       << "}\n";
+  return code.str();
+}
+
 std::unique_ptr<Document> BuildParcelSource(const AidlTypenames& typenames,
                                             const AidlStructuredParcelable& parcel,
-                                            const Options&) {
+                                            const Options& options) {
+  const vector<ParcelFieldRun> runs = SplitParcelFields(parcel, options.BatchPrimitiveFields());
+
   unique_ptr<MethodImpl> read{new MethodImpl{kAndroidStatusLiteral, parcel.GetName(),
                                              "readFromParcel",
                                              ArgList("const ::android::Parcel* _aidl_parcel")}};
@@ -1153,20 +3411,35 @@ std::unique_ptr<Document> BuildParcelSource(const AidlTypenames& typenames,
       "if (_aidl_parcelable_raw_size < 0) return ::android::BAD_VALUE;\n"
       "size_t _aidl_parcelable_size = static_cast<size_t>(_aidl_parcelable_raw_size);\n");
 
-  for (const auto& variable : parcel.GetFields()) {
-    string method = ParcelReadMethodOf(variable->GetType(), typenames);
-
-    read_block->AddStatement(new Assignment(
-        kAndroidStatusVarName, new MethodCall(StringPrintf("_aidl_parcel->%s", method.c_str()),
-                                              ParcelReadCastOf(variable->GetType(), typenames,
-                                                               "&" + variable->GetName()))));
-    read_block->AddStatement(ReturnOnStatusNotOk());
-    read_block->AddLiteral(StringPrintf(
-        "if (_aidl_parcel->dataPosition() - _aidl_start_pos >= _aidl_parcelable_size) {\n"
-        "  _aidl_parcel->setDataPosition(_aidl_start_pos + _aidl_parcelable_size);\n"
-        "  return %s;\n"
-        "}",
-        kAndroidStatusVarName));
+  const string end_of_parcelable_check = StringPrintf(
+      "if (_aidl_parcel->dataPosition() - _aidl_start_pos >= _aidl_parcelable_size) {\n"
+      "  _aidl_parcel->setDataPosition(_aidl_start_pos + _aidl_parcelable_size);\n"
+      "  return %s;\n"
+      "}",
+      kAndroidStatusVarName);
+  for (const auto& run : runs) {
+    StatementBlock* per_field = read_block;
+    if (run.IsBatched()) {
+      IfStatement* batched = BuildReadFieldRun(typenames, run);
+      read_block->AddStatement(batched);
+      per_field = batched->OnFalse();
+    }
+    for (const auto variable : run.fields) {
+      if (variable->GetType().IsLazy()) {
+        per_field->AddLiteral(BuildReadLazyField(typenames, options, *variable), false);
+      } else {
+        per_field->AddStatement(new Assignment(
+            kAndroidStatusVarName,
+            new LiteralExpression(ParcelReadCall(typenames, options, variable->GetType(),
+                                                 "_aidl_parcel", true,
+                                                 "&" + variable->GetName()))));
+        per_field->AddStatement(ReturnOnStatusNotOk());
+      }
+      per_field->AddLiteral(end_of_parcelable_check);
+    }
+    if (run.IsBatched()) {
+      read_block->AddLiteral(end_of_parcelable_check);
+    }
   }
   read_block->AddLiteral(StringPrintf("return %s", kAndroidStatusVarName));
 
@@ -1181,13 +3454,22 @@ std::unique_ptr<Document> BuildParcelSource(const AidlTypenames& typenames,
       "auto _aidl_start_pos = _aidl_parcel->dataPosition();\n"
       "_aidl_parcel->writeInt32(0);");
 
-  for (const auto& variable : parcel.GetFields()) {
-    string method = ParcelWriteMethodOf(variable->GetType(), typenames);
-    write_block->AddStatement(new Assignment(
-        kAndroidStatusVarName,
-        new MethodCall(StringPrintf("_aidl_parcel->%s", method.c_str()),
-                       ParcelWriteCastOf(variable->GetType(), typenames, variable->GetName()))));
-    write_block->AddStatement(ReturnOnStatusNotOk());
+  for (const auto& run : runs) {
+    if (run.IsBatched()) {
+      write_block->AddLiteral(BuildWriteFieldRun(run), false);
+      continue;
+    }
+    for (const auto variable : run.fields) {
+      if (variable->GetType().IsLazy()) {
+        write_block->AddLiteral(BuildWriteLazyField(typenames, options, *variable), false);
+      } else {
+        write_block->AddStatement(new Assignment(
+            kAndroidStatusVarName,
+            new LiteralExpression(ParcelWriteCall(typenames, options, variable->GetType(),
+                                                  "_aidl_parcel", true, variable->GetName()))));
+      }
+      write_block->AddStatement(ReturnOnStatusNotOk());
+    }
   }
 
   write_block->AddLiteral(
@@ -1197,44 +3479,51 @@ std::unique_ptr<Document> BuildParcelSource(const AidlTypenames& typenames,
       "_aidl_parcel->setDataPosition(_aidl_end_pos);");
   write_block->AddLiteral(StringPrintf("return %s", kAndroidStatusVarName));
 
+  vector<const AidlTypeSpecifier*> field_types;
+  for (const auto& variable : parcel.GetFields()) {
+    field_types.push_back(&variable->GetType());
+  }
   vector<unique_ptr<Declaration>> file_decls;
+  if (UsesFileDescriptorArrayHelpers(options, field_types)) {
+    file_decls.emplace_back(new LiteralDecl(kFileDescriptorArrayHelpers));
+  }
+  if (UsesFixedSizeArrayHelpers(field_types)) {
+    file_decls.emplace_back(new LiteralDecl(kFixedSizeArrayHelpers));
+  }
   file_decls.push_back(std::move(read));
   file_decls.push_back(std::move(write));
+  for (const auto& variable : parcel.GetFields()) {
+    if (variable->GetType().IsLazy()) {
+      file_decls.push_back(unique_ptr<Declaration>(new LiteralDecl(
+          BuildLazyFieldAccessors(typenames, options, parcel, *variable))));
+    }
+  }
 
   set<string> includes = {};
   AddHeaders(parcel, includes);
+  if (UsesFileDescriptorArrayHelpers(options, field_types)) {
+    includes.insert("binder/ParcelFileDescriptor.h");
+  }
+  if (UsesFixedSizeArrayHelpers(field_types)) {
+    includes.insert({"array", "cstring", "type_traits"});
+  }
+  if (std::any_of(runs.begin(), runs.end(), [](const auto& run) { return run.IsBatched(); })) {
+    includes.insert("cstring");
+  }
+  if (const ParcelFieldRun layout = FixedParcelLayoutOf(parcel);
+      options.ParcelTraits() && !layout.fields.empty()) {
+    for (auto& decl : BuildVectorTraits(typenames, parcel, layout)) {
+      file_decls.push_back(std::move(decl));
+    }
+    includes.insert("cstdint");
+    includes.insert("cstring");
+  }
 
   return unique_ptr<Document>{
       new CppSource{vector<string>(includes.begin(), includes.end()),
                     NestInNamespaces(std::move(file_decls), parcel.GetSplitPackage())}};
 }
 
-std::string GenerateEnumToString(const AidlTypenames& typenames,
-                                 const AidlEnumDeclaration& enum_decl) {
-  std::ostringstream code;
-  code << "static inline std::string toString(" << enum_decl.GetName() << " val) {\n";
-  code << "  switch(val) {\n";
-  std::set<std::string> unique_cases;
-  for (const auto& enumerator : enum_decl.GetEnumerators()) {
-    std::string c = enumerator->ValueString(enum_decl.GetBackingType(), ConstantValueDecorator);
-    // Only add a case if its value has not yet been used in the switch
-    // statement. C++ does not allow multiple cases with the same value, but
-    // enums does allow this. In this scenario, the first declared
-    // enumerator with the given value is printed.
-    if (unique_cases.count(c) == 0) {
-      unique_cases.insert(c);
-      code << "  case " << enum_decl.GetName() << "::" << enumerator->GetName() << ":\n";
-      code << "    return \"" << enumerator->GetName() << "\";\n";
-    }
-  }
-  code << "  default:\n";
-  code << "    return std::to_string(static_cast<"
-       << CppNameOf(enum_decl.GetBackingType(), typenames) << ">(val));\n";
-  code << "  }\n";
-  code << "}\n";
-  return code.str();
-}
-
 std::unique_ptr<Document> BuildEnumHeader(const AidlTypenames& typenames,
                                           const AidlEnumDeclaration& enum_decl) {
   std::unique_ptr<Enum> generated_enum{
@@ -1249,12 +3538,14 @@ std::unique_ptr<Document> BuildEnumHeader(const AidlTypenames& typenames,
       "array",
       "binder/Enums.h",
       "string",
+      "string_view",
   };
   AddHeaders(enum_decl.GetBackingType(), typenames, includes);
 
   std::vector<std::unique_ptr<Declaration>> decls1;
   decls1.push_back(std::move(generated_enum));
-  decls1.push_back(std::make_unique<LiteralDecl>(GenerateEnumToString(typenames, enum_decl)));
+  decls1.push_back(std::make_unique<LiteralDecl>(
+      GenerateEnumToString(enum_decl, CppNameOf(enum_decl.GetBackingType(), typenames))));
 
   std::vector<std::unique_ptr<Declaration>> decls2;
   decls2.push_back(std::make_unique<LiteralDecl>(GenerateEnumValues(enum_decl, {""})));
@@ -1330,9 +3621,20 @@ bool GenerateCppInterface(const string& output_file, const Options& options,
   const bool success = writer->Close();
   if (!success) {
     io_delegate.RemovePath(output_file);
+    return false;
   }
 
-  return success;
+  const vector<string> shard_files = SourceShardFiles(options, interface, output_file);
+  for (size_t shard = 0; shard < shard_files.size(); shard++) {
+    unique_ptr<CodeWriter> shard_writer = io_delegate.GetCodeWriter(shard_files[shard]);
+    BuildSourceShard(typenames, interface, options, shard)->Write(shard_writer.get());
+    if (!shard_writer->Close()) {
+      io_delegate.RemovePath(shard_files[shard]);
+      return false;
+    }
+  }
+
+  return true;
 }
 
 bool GenerateCppParcel(const string& output_file, const Options& options,
@@ -1420,6 +3722,26 @@ bool GenerateCppEnumDeclaration(const std::string& filename, const Options& opti
   return true;
 }
 
+vector<string> SourceShardFiles(const Options& options, const AidlDefinedType& defined_type,
+                                const string& output_file) {
+  vector<string> files;
+  if (defined_type.AsInterface() == nullptr) {
+    return files;
+  }
+  // '-' can't be part of a type name, so the shards don't collide with the
+  // output of another type.
+  size_t dot = output_file.rfind('.');
+  const size_t separator = output_file.rfind(OS_PATH_SEPARATOR);
+  if (dot == string::npos || (separator != string::npos && dot < separator)) {
+    dot = output_file.size();
+  }
+  for (size_t shard = 1; shard <= options.SourceShards(); shard++) {
+    files.push_back(output_file.substr(0, dot) + "-" + std::to_string(shard) +
+                    output_file.substr(dot));
+  }
+  return files;
+}
+
 bool GenerateCpp(const string& output_file, const Options& options, const AidlTypenames& typenames,
                  const AidlDefinedType& defined_type, const IoDelegate& io_delegate) {
   const AidlStructuredParcelable* parcelable = defined_type.AsStructuredParcelable();
@@ -18,6 +18,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "aidl_language.h"
 #include "aidl_to_cpp.h"
@@ -32,6 +33,12 @@ namespace cpp {
 bool GenerateCpp(const string& output_file, const Options& options, const AidlTypenames& typenames,
                  const AidlDefinedType& parsed_doc, const IoDelegate& io_delegate);
 
+// The sources that --source-shards adds next to |output_file| for
+// |defined_type|: for interfaces, IFoo-1.cpp to IFoo-N.cpp for IFoo.cpp.
+std::vector<std::string> SourceShardFiles(const Options& options,
+                                          const AidlDefinedType& defined_type,
+                                          const std::string& output_file);
+
 namespace internals {
 std::unique_ptr<Document> BuildClientSource(const AidlTypenames& typenames,
                                             const AidlInterface& parsed_doc,
@@ -39,6 +46,9 @@ std::unique_ptr<Document> BuildClientSource(const AidlTypenames& typenames,
 std::unique_ptr<Document> BuildServerSource(const AidlTypenames& typenames,
                                             const AidlInterface& parsed_doc,
                                             const Options& options);
+std::unique_ptr<Document> BuildSourceShard(const AidlTypenames& typenames,
+                                           const AidlInterface& parsed_doc,
+                                           const Options& options, size_t shard);
 std::unique_ptr<Document> BuildInterfaceSource(const AidlTypenames& typenames,
                                                const AidlInterface& parsed_doc,
                                                const Options& options);
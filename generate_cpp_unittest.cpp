@@ -1382,6 +1382,7 @@ const char kExpectedEnumHeaderOutput[] =
 #include <binder/Enums.h>
 #include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace android {
 
@@ -1400,31 +1401,40 @@ enum class TestEnum : int8_t {
   TEN = 10,
 };
 
+static constexpr inline std::string_view toStringView(TestEnum val) {
+  constexpr std::string_view kNames[11] = {
+    "ZERO",
+    "ONE",
+    "",
+    "THREE",
+    "FOUR",
+    "FIVE",
+    "SIX",
+    "SEVEN",
+    "EIGHT",
+    "NINE",
+    "TEN",
+  };
+  const uint64_t index = static_cast<uint64_t>(static_cast<int8_t>(val)) - static_cast<uint64_t>(static_cast<int8_t>(TestEnum::ZERO));
+  if (index >= 11) {
+    return std::string_view();
+  }
+  return kNames[index];
+}
+static inline void toString(TestEnum val, std::string* out) {
+  std::string_view name = toStringView(val);
+  if (!name.empty()) {
+    out->append(name);
+  } else {
+    out->append(std::to_string(static_cast<int8_t>(val)));
+  }
+}
 static inline std::string toString(TestEnum val) {
-  switch(val) {
-  case TestEnum::ZERO:
-    return "ZERO";
-  case TestEnum::ONE:
-    return "ONE";
-  case TestEnum::THREE:
-    return "THREE";
-  case TestEnum::FOUR:
-    return "FOUR";
-  case TestEnum::FIVE:
-    return "FIVE";
-  case TestEnum::SIX:
-    return "SIX";
-  case TestEnum::SEVEN:
-    return "SEVEN";
-  case TestEnum::EIGHT:
-    return "EIGHT";
-  case TestEnum::NINE:
-    return "NINE";
-  case TestEnum::TEN:
-    return "TEN";
-  default:
-    return std::to_string(static_cast<int8_t>(val));
+  std::string_view name = toStringView(val);
+  if (!name.empty()) {
+    return std::string(name);
   }
+  return std::to_string(static_cast<int8_t>(val));
 }
 
 }  // namespace os
@@ -1475,6 +1485,7 @@ const char kExpectedEnumWithBackingTypeHeaderOutput[] =
 #include <binder/Enums.h>
 #include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace android {
 
@@ -1485,15 +1496,31 @@ enum class TestEnum : int64_t {
   BAR = 2L,
 };
 
+static constexpr inline std::string_view toStringView(TestEnum val) {
+  constexpr std::string_view kNames[2] = {
+    "FOO",
+    "BAR",
+  };
+  const uint64_t index = static_cast<uint64_t>(static_cast<int64_t>(val)) - static_cast<uint64_t>(static_cast<int64_t>(TestEnum::FOO));
+  if (index >= 2) {
+    return std::string_view();
+  }
+  return kNames[index];
+}
+static inline void toString(TestEnum val, std::string* out) {
+  std::string_view name = toStringView(val);
+  if (!name.empty()) {
+    out->append(name);
+  } else {
+    out->append(std::to_string(static_cast<int64_t>(val)));
+  }
+}
 static inline std::string toString(TestEnum val) {
-  switch(val) {
-  case TestEnum::FOO:
-    return "FOO";
-  case TestEnum::BAR:
-    return "BAR";
-  default:
-    return std::to_string(static_cast<int64_t>(val));
+  std::string_view name = toStringView(val);
+  if (!name.empty()) {
+    return std::string(name);
   }
+  return std::to_string(static_cast<int64_t>(val));
 }
 
 }  // namespace os
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <map>
 #include <memory>
+#include <optional>
 #include <sstream>
 
 #include <android-base/stringprintf.h>
@@ -40,6 +41,7 @@ namespace java {
 bool generate_java_interface(const string& filename, const AidlInterface* iface,
                              const AidlTypenames& typenames, const IoDelegate& io_delegate,
                              const Options& options) {
+  AstArena arena;
   auto cl = generate_binder_interface_class(iface, typenames, options);
 
   std::unique_ptr<Document> document =
@@ -52,8 +54,10 @@ bool generate_java_interface(const string& filename, const AidlInterface* iface,
 }
 
 bool generate_java_parcel(const std::string& filename, const AidlStructuredParcelable* parcel,
-                          const AidlTypenames& typenames, const IoDelegate& io_delegate) {
-  auto cl = generate_parcel_class(parcel, typenames);
+                          const AidlTypenames& typenames, const IoDelegate& io_delegate,
+                          const Options& options) {
+  AstArena arena;
+  auto cl = generate_parcel_class(parcel, typenames, options);
 
   std::unique_ptr<Document> document =
       std::make_unique<Document>("" /* no comment */, parcel->GetPackage(), std::move(cl));
@@ -77,7 +81,7 @@ bool generate_java(const std::string& filename, const AidlDefinedType* defined_t
                    const Options& options) {
   if (const AidlStructuredParcelable* parcelable = defined_type->AsStructuredParcelable();
       parcelable != nullptr) {
-    return generate_java_parcel(filename, parcelable, typenames, io_delegate);
+    return generate_java_parcel(filename, parcelable, typenames, io_delegate, options);
   }
 
   if (const AidlEnumDeclaration* enum_decl = defined_type->AsEnumDeclaration();
@@ -93,8 +97,35 @@ bool generate_java(const std::string& filename, const AidlDefinedType* defined_t
   return false;
 }
 
+namespace {
+
+// The number of bytes writeToParcel writes for a value of |type|, if it is
+// always the same. Parcels take at least 4 bytes for each primitive.
+std::optional<int> FixedParcelSizeOf(const AidlTypeSpecifier& type,
+                                     const AidlTypenames& typenames) {
+  if (type.IsArray()) {
+    return std::nullopt;
+  }
+  switch (type.GetBackingKind(typenames)) {
+    case AidlBuiltinKind::BOOLEAN:
+    case AidlBuiltinKind::BYTE:
+    case AidlBuiltinKind::CHAR:
+    case AidlBuiltinKind::INT:
+    case AidlBuiltinKind::FLOAT:
+      return 4;
+    case AidlBuiltinKind::LONG:
+    case AidlBuiltinKind::DOUBLE:
+      return 8;
+    default:
+      return std::nullopt;
+  }
+}
+
+}  // namespace
+
 std::unique_ptr<android::aidl::java::Class> generate_parcel_class(
-    const AidlStructuredParcelable* parcel, const AidlTypenames& typenames) {
+    const AidlStructuredParcelable* parcel, const AidlTypenames& typenames,
+    const Options& options) {
   auto parcel_class = std::make_unique<Class>();
   parcel_class->comment = parcel->GetComments();
   parcel_class->modifiers = PUBLIC;
@@ -115,41 +146,58 @@ std::unique_ptr<android::aidl::java::Class> generate_parcel_class(
       out << " = " << variable->ValueString(ConstantValueDecorator);
     }
     out << ";\n";
-    parcel_class->elements.push_back(std::make_shared<LiteralClassElement>(out.str()));
+    parcel_class->elements.push_back(New<LiteralClassElement>(out.str()));
   }
 
+  // Other structured parcelables read this with readFrom(), which, unlike
+  // CREATOR.createFromParcel, is a static call that can be inlined.
   std::ostringstream out;
+  out << "public static " << parcel->GetName() << " readFrom(android.os.Parcel _aidl_source) {\n";
+  out << "  " << parcel->GetName() << " _aidl_out = new " << parcel->GetName() << "();\n";
+  out << "  _aidl_out.readFromParcel(_aidl_source);\n";
+  out << "  return _aidl_out;\n";
+  out << "}\n";
   out << "public static final android.os.Parcelable.Creator<" << parcel->GetName() << "> CREATOR = "
       << "new android.os.Parcelable.Creator<" << parcel->GetName() << ">() {\n";
   out << "  @Override\n";
   out << "  public " << parcel->GetName()
       << " createFromParcel(android.os.Parcel _aidl_source) {\n";
-  out << "    " << parcel->GetName() << " _aidl_out = new " << parcel->GetName() << "();\n";
-  out << "    _aidl_out.readFromParcel(_aidl_source);\n";
-  out << "    return _aidl_out;\n";
+  out << "    return readFrom(_aidl_source);\n";
   out << "  }\n";
   out << "  @Override\n";
   out << "  public " << parcel->GetName() << "[] newArray(int _aidl_size) {\n";
   out << "    return new " << parcel->GetName() << "[_aidl_size];\n";
   out << "  }\n";
   out << "};\n";
-  parcel_class->elements.push_back(std::make_shared<LiteralClassElement>(out.str()));
+  parcel_class->elements.push_back(New<LiteralClassElement>(out.str()));
 
-  auto flag_variable = std::make_shared<Variable>("int", "_aidl_flag");
-  auto parcel_variable = std::make_shared<Variable>("android.os.Parcel", "_aidl_parcel");
+  auto flag_variable = New<Variable>("int", "_aidl_flag");
+  auto parcel_variable = New<Variable>("android.os.Parcel", "_aidl_parcel");
 
-  auto write_method = std::make_shared<Method>();
+  auto write_method = New<Method>();
   write_method->modifiers = PUBLIC | OVERRIDE | FINAL;
   write_method->returnType = "void";
   write_method->name = "writeToParcel";
   write_method->parameters.push_back(parcel_variable);
   write_method->parameters.push_back(flag_variable);
-  write_method->statements = std::make_shared<StatementBlock>();
+  write_method->statements = New<StatementBlock>();
+
+  // A parcelable of fields of fixed sizes is written with its size up front.
+  // Others patch the size in afterwards.
+  std::optional<int> fixed_size = 4;
+  for (const auto& field : parcel->GetFields()) {
+    std::optional<int> size = FixedParcelSizeOf(field->GetType(), typenames);
+    fixed_size = fixed_size && size ? std::optional<int>(*fixed_size + *size) : std::nullopt;
+  }
 
   out.str("");
-  out << "int _aidl_start_pos = _aidl_parcel.dataPosition();\n"
-      << "_aidl_parcel.writeInt(0);\n";
-  write_method->statements->Add(std::make_shared<LiteralStatement>(out.str()));
+  if (fixed_size) {
+    out << "_aidl_parcel.writeInt(" << *fixed_size << ");\n";
+  } else {
+    out << "int _aidl_start_pos = _aidl_parcel.dataPosition();\n"
+        << "_aidl_parcel.writeInt(0);\n";
+  }
+  write_method->statements->Add(New<LiteralStatement>(out.str()));
 
   for (const auto& field : parcel->GetFields()) {
     string code;
@@ -164,25 +212,27 @@ std::unique_ptr<android::aidl::java::Class> generate_parcel_class(
     };
     WriteToParcelFor(context);
     writer->Close();
-    write_method->statements->Add(std::make_shared<LiteralStatement>(code));
+    write_method->statements->Add(New<LiteralStatement>(code));
   }
 
-  out.str("");
-  out << "int _aidl_end_pos = _aidl_parcel.dataPosition();\n"
-      << "_aidl_parcel.setDataPosition(_aidl_start_pos);\n"
-      << "_aidl_parcel.writeInt(_aidl_end_pos - _aidl_start_pos);\n"
-      << "_aidl_parcel.setDataPosition(_aidl_end_pos);\n";
+  if (!fixed_size) {
+    out.str("");
+    out << "int _aidl_end_pos = _aidl_parcel.dataPosition();\n"
+        << "_aidl_parcel.setDataPosition(_aidl_start_pos);\n"
+        << "_aidl_parcel.writeInt(_aidl_end_pos - _aidl_start_pos);\n"
+        << "_aidl_parcel.setDataPosition(_aidl_end_pos);\n";
 
-  write_method->statements->Add(std::make_shared<LiteralStatement>(out.str()));
+    write_method->statements->Add(New<LiteralStatement>(out.str()));
+  }
 
   parcel_class->elements.push_back(write_method);
 
-  auto read_method = std::make_shared<Method>();
+  auto read_method = New<Method>();
   read_method->modifiers = PUBLIC | FINAL;
   read_method->returnType = "void";
   read_method->name = "readFromParcel";
   read_method->parameters.push_back(parcel_variable);
-  read_method->statements = std::make_shared<StatementBlock>();
+  read_method->statements = New<StatementBlock>();
 
   out.str("");
   out << "int _aidl_start_pos = _aidl_parcel.dataPosition();\n"
@@ -190,12 +240,12 @@ std::unique_ptr<android::aidl::java::Class> generate_parcel_class(
       << "if (_aidl_parcelable_size < 0) return;\n"
       << "try {\n";
 
-  read_method->statements->Add(std::make_shared<LiteralStatement>(out.str()));
+  read_method->statements->Add(New<LiteralStatement>(out.str()));
 
   out.str("");
   out << "  if (_aidl_parcel.dataPosition() - _aidl_start_pos >= _aidl_parcelable_size) return;\n";
 
-  std::shared_ptr<LiteralStatement> sizeCheck = nullptr;
+  LiteralStatement* sizeCheck = nullptr;
   // keep this across different fields in order to create the classloader
   // at most once.
   bool is_classloader_created = false;
@@ -211,10 +261,14 @@ std::unique_ptr<android::aidl::java::Class> generate_parcel_class(
         .is_classloader_created = &is_classloader_created,
     };
     context.writer.Indent();
-    CreateFromParcelFor(context);
+    if (options.ReuseContainers()) {
+      RefillFromParcelFor(context);
+    } else {
+      CreateFromParcelFor(context);
+    }
     writer->Close();
-    read_method->statements->Add(std::make_shared<LiteralStatement>(code));
-    if (!sizeCheck) sizeCheck = std::make_shared<LiteralStatement>(out.str());
+    read_method->statements->Add(New<LiteralStatement>(code));
+    if (!sizeCheck) sizeCheck = New<LiteralStatement>(out.str());
     read_method->statements->Add(sizeCheck);
   }
 
@@ -223,16 +277,16 @@ std::unique_ptr<android::aidl::java::Class> generate_parcel_class(
       << "  _aidl_parcel.setDataPosition(_aidl_start_pos + _aidl_parcelable_size);\n"
       << "}\n";
 
-  read_method->statements->Add(std::make_shared<LiteralStatement>(out.str()));
+  read_method->statements->Add(New<LiteralStatement>(out.str()));
 
   parcel_class->elements.push_back(read_method);
 
-  auto describe_contents_method = std::make_shared<Method>();
+  auto describe_contents_method = New<Method>();
   describe_contents_method->modifiers = PUBLIC | OVERRIDE;
   describe_contents_method->returnType = "int";
   describe_contents_method->name = "describeContents";
-  describe_contents_method->statements = std::make_shared<StatementBlock>();
-  describe_contents_method->statements->Add(std::make_shared<LiteralStatement>("return 0;\n"));
+  describe_contents_method->statements = New<StatementBlock>();
+  describe_contents_method->statements->Add(New<LiteralStatement>("return 0;\n"));
   parcel_class->elements.push_back(describe_contents_method);
 
   return parcel_class;
@@ -22,6 +22,7 @@
 #include "options.h"
 
 #include <string>
+#include <unordered_set>
 
 namespace android {
 namespace aidl {
@@ -31,17 +32,26 @@ bool generate_java(const std::string& filename, const AidlDefinedType* iface,
                    const AidlTypenames& typenames, const IoDelegate& io_delegate,
                    const Options& options);
 
+// The nodes of the classes below are made in the current AstArena, which
+// must outlive the classes.
 std::unique_ptr<android::aidl::java::Class> generate_binder_interface_class(
     const AidlInterface* iface, const AidlTypenames& typenames, const Options& options);
 
 std::unique_ptr<android::aidl::java::Class> generate_parcel_class(
-    const AidlStructuredParcelable* parcel, const AidlTypenames& typenames);
+    const AidlStructuredParcelable* parcel, const AidlTypenames& typenames,
+    const Options& options);
 
 void generate_enum(const CodeWriterPtr& code_writer, const AidlEnumDeclaration* enum_decl,
                    const AidlTypenames& typenames);
 
 std::vector<std::string> generate_java_annotations(const AidlAnnotatable& a);
 
+// The methods of |iface| that the stub handles in methods of their own
+// instead of in onTransact(), as compute_outline_methods and
+// compute_dispatch_table decide for |options|.
+std::unordered_set<const AidlMethod*> OutlinedMethods(const AidlInterface& iface,
+                                                      const Options& options);
+
 }  // namespace java
 }  // namespace aidl
 }  // namespace android
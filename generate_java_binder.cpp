@@ -25,6 +25,7 @@
 #include <string.h>
 
 #include <algorithm>
+#include <map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -49,18 +50,18 @@ class VariableFactory {
   using Variable = ::android::aidl::java::Variable;
 
   explicit VariableFactory(const std::string& base) : base_(base), index_(0) {}
-  std::shared_ptr<Variable> Get(const AidlTypeSpecifier& type, const AidlTypenames& typenames) {
-    auto v = std::make_shared<Variable>(JavaSignatureOf(type, typenames),
-                                        StringPrintf("%s%d", base_.c_str(), index_));
+  Variable* Get(const AidlTypeSpecifier& type, const AidlTypenames& typenames) {
+    auto v = New<Variable>(JavaSignatureOf(type, typenames),
+                           StringPrintf("%s%d", base_.c_str(), index_));
     vars_.push_back(v);
     index_++;
     return v;
   }
 
-  std::shared_ptr<Variable> Get(int index) { return vars_[index]; }
+  Variable* Get(int index) { return vars_[index]; }
 
  private:
-  std::vector<std::shared_ptr<Variable>> vars_;
+  std::vector<Variable*> vars_;
   std::string base_;
   int index_;
 
@@ -73,13 +74,13 @@ class StubClass : public Class {
   StubClass(const AidlInterface* interfaceType, const Options& options);
   ~StubClass() override = default;
 
-  std::shared_ptr<Variable> transact_code;
-  std::shared_ptr<Variable> transact_data;
-  std::shared_ptr<Variable> transact_reply;
-  std::shared_ptr<Variable> transact_flags;
-  std::shared_ptr<SwitchStatement> transact_switch;
-  std::shared_ptr<StatementBlock> transact_statements;
-  std::shared_ptr<SwitchStatement> code_to_method_name_switch;
+  Variable* transact_code;
+  Variable* transact_data;
+  Variable* transact_reply;
+  Variable* transact_flags;
+  SwitchStatement* transact_switch;
+  StatementBlock* transact_statements;
+  SwitchStatement* code_to_method_name_switch;
 
   // Where onTransact cases should be generated as separate methods.
   bool transact_outline;
@@ -87,16 +88,23 @@ class StubClass : public Class {
   std::unordered_set<const AidlMethod*> outline_methods;
   // Number of all methods.
   size_t all_method_count;
+  // Whether user-defined methods are dispatched through TRANSACTION_HANDLERS,
+  // indexed by code - FIRST_CALL_TRANSACTION, instead of the switch. All of
+  // them are outlined then.
+  bool transact_dispatch_table;
+  // Names of the outlined methods, indexed by their ids, for the table. Empty
+  // names are ids without methods.
+  std::vector<std::string> transact_handlers;
 
   // Finish generation. This will add a default case to the switch.
   void finish();
 
-  std::shared_ptr<Expression> get_transact_descriptor(const AidlMethod* method);
+  Expression* get_transact_descriptor(const AidlMethod* method);
 
  private:
   void make_as_interface(const AidlInterface* interfaceType);
 
-  std::shared_ptr<Variable> transact_descriptor;
+  Variable* transact_descriptor;
   const Options& options_;
 
   DISALLOW_COPY_AND_ASSIGN(StubClass);
@@ -107,6 +115,7 @@ StubClass::StubClass(const AidlInterface* interfaceType, const Options& options)
   transact_descriptor = nullptr;
   transact_outline = false;
   all_method_count = 0;  // Will be set when outlining may be enabled.
+  transact_dispatch_table = false;
 
   this->comment = "/** Local-side IPC implementation stub class. */";
   this->modifiers = PUBLIC | ABSTRACT | STATIC;
@@ -116,8 +125,8 @@ StubClass::StubClass(const AidlInterface* interfaceType, const Options& options)
   this->interfaces.push_back(interfaceType->GetCanonicalName());
 
   // descriptor
-  auto descriptor = std::make_shared<Field>(
-      STATIC | FINAL | PRIVATE, std::make_shared<Variable>("java.lang.String", "DESCRIPTOR"));
+  auto descriptor = New<Field>(
+      STATIC | FINAL | PRIVATE, New<Variable>("java.lang.String", "DESCRIPTOR"));
   if (options.IsStructured()) {
     // mangle the interface name at build time and demangle it at runtime, to avoid
     // being renamed by jarjar. See b/153843174
@@ -130,21 +139,21 @@ StubClass::StubClass(const AidlInterface* interfaceType, const Options& options)
   this->elements.push_back(descriptor);
 
   // ctor
-  auto ctor = std::make_shared<Method>();
+  auto ctor = New<Method>();
   ctor->modifiers = PUBLIC;
   ctor->comment =
       "/** Construct the stub at attach it to the "
       "interface. */";
   ctor->name = "Stub";
-  ctor->statements = std::make_shared<StatementBlock>();
+  ctor->statements = New<StatementBlock>();
   if (interfaceType->IsVintfStability()) {
-    auto stability = std::make_shared<LiteralStatement>("this.markVintfStability();\n");
+    auto stability = New<LiteralStatement>("this.markVintfStability();\n");
     ctor->statements->Add(stability);
   }
-  auto attach = std::make_shared<MethodCall>(
+  auto attach = New<MethodCall>(
       THIS_VALUE, "attachInterface",
-      std::vector<std::shared_ptr<Expression>>{THIS_VALUE,
-                                               std::make_shared<LiteralExpression>("DESCRIPTOR")});
+      std::vector<Expression*>{THIS_VALUE,
+                               New<LiteralExpression>("DESCRIPTOR")});
   ctor->statements->Add(attach);
   this->elements.push_back(ctor);
 
@@ -152,49 +161,49 @@ StubClass::StubClass(const AidlInterface* interfaceType, const Options& options)
   make_as_interface(interfaceType);
 
   // asBinder
-  auto asBinder = std::make_shared<Method>();
+  auto asBinder = New<Method>();
   asBinder->modifiers = PUBLIC | OVERRIDE;
   asBinder->returnType = "android.os.IBinder";
   asBinder->name = "asBinder";
-  asBinder->statements = std::make_shared<StatementBlock>();
-  asBinder->statements->Add(std::make_shared<ReturnStatement>(THIS_VALUE));
+  asBinder->statements = New<StatementBlock>();
+  asBinder->statements->Add(New<ReturnStatement>(THIS_VALUE));
   this->elements.push_back(asBinder);
 
   if (options_.GenTransactionNames()) {
     // getDefaultTransactionName
-    auto getDefaultTransactionName = std::make_shared<Method>();
+    auto getDefaultTransactionName = New<Method>();
     getDefaultTransactionName->comment = "/** @hide */";
     getDefaultTransactionName->modifiers = PUBLIC | STATIC;
     getDefaultTransactionName->returnType = "java.lang.String";
     getDefaultTransactionName->name = "getDefaultTransactionName";
-    auto code = std::make_shared<Variable>("int", "transactionCode");
+    auto code = New<Variable>("int", "transactionCode");
     getDefaultTransactionName->parameters.push_back(code);
-    getDefaultTransactionName->statements = std::make_shared<StatementBlock>();
-    this->code_to_method_name_switch = std::make_shared<SwitchStatement>(code);
+    getDefaultTransactionName->statements = New<StatementBlock>();
+    this->code_to_method_name_switch = New<SwitchStatement>(code);
     getDefaultTransactionName->statements->Add(this->code_to_method_name_switch);
     this->elements.push_back(getDefaultTransactionName);
 
     // getTransactionName
-    auto getTransactionName = std::make_shared<Method>();
+    auto getTransactionName = New<Method>();
     getTransactionName->comment = "/** @hide */";
     getTransactionName->modifiers = PUBLIC;
     getTransactionName->returnType = "java.lang.String";
     getTransactionName->name = "getTransactionName";
-    auto code2 = std::make_shared<Variable>("int", "transactionCode");
+    auto code2 = New<Variable>("int", "transactionCode");
     getTransactionName->parameters.push_back(code2);
-    getTransactionName->statements = std::make_shared<StatementBlock>();
-    getTransactionName->statements->Add(std::make_shared<ReturnStatement>(
-        std::make_shared<MethodCall>(THIS_VALUE, "getDefaultTransactionName",
-                                     std::vector<std::shared_ptr<Expression>>{code2})));
+    getTransactionName->statements = New<StatementBlock>();
+    getTransactionName->statements->Add(New<ReturnStatement>(
+        New<MethodCall>(THIS_VALUE, "getDefaultTransactionName",
+                        std::vector<Expression*>{code2})));
     this->elements.push_back(getTransactionName);
   }
 
   // onTransact
-  this->transact_code = std::make_shared<Variable>("int", "code");
-  this->transact_data = std::make_shared<Variable>("android.os.Parcel", "data");
-  this->transact_reply = std::make_shared<Variable>("android.os.Parcel", "reply");
-  this->transact_flags = std::make_shared<Variable>("int", "flags");
-  auto onTransact = std::make_shared<Method>();
+  this->transact_code = New<Variable>("int", "code");
+  this->transact_data = New<Variable>("android.os.Parcel", "data");
+  this->transact_reply = New<Variable>("android.os.Parcel", "reply");
+  this->transact_flags = New<Variable>("int", "flags");
+  auto onTransact = New<Method>();
   onTransact->modifiers = PUBLIC | OVERRIDE;
   onTransact->returnType = "boolean";
   onTransact->name = "onTransact";
@@ -202,23 +211,48 @@ StubClass::StubClass(const AidlInterface* interfaceType, const Options& options)
   onTransact->parameters.push_back(this->transact_data);
   onTransact->parameters.push_back(this->transact_reply);
   onTransact->parameters.push_back(this->transact_flags);
-  onTransact->statements = std::make_shared<StatementBlock>();
+  onTransact->statements = New<StatementBlock>();
   transact_statements = onTransact->statements;
   onTransact->exceptions.push_back("android.os.RemoteException");
   this->elements.push_back(onTransact);
-  this->transact_switch = std::make_shared<SwitchStatement>(this->transact_code);
+  this->transact_switch = New<SwitchStatement>(this->transact_code);
 }
 
 void StubClass::finish() {
-  auto default_case = std::make_shared<Case>();
+  auto default_case = New<Case>();
 
-  auto superCall = std::make_shared<MethodCall>(
+  auto superCall = New<MethodCall>(
       SUPER_VALUE, "onTransact",
-      std::vector<std::shared_ptr<Expression>>{this->transact_code, this->transact_data,
-                                               this->transact_reply, this->transact_flags});
-  default_case->statements->Add(std::make_shared<ReturnStatement>(superCall));
+      std::vector<Expression*>{this->transact_code, this->transact_data,
+                               this->transact_reply, this->transact_flags});
+  default_case->statements->Add(New<ReturnStatement>(superCall));
   transact_switch->cases.push_back(default_case);
 
+  if (transact_dispatch_table) {
+    std::ostringstream table;
+    table << "/** Handles the transaction of a method of this interface. */\n"
+          << "private interface TransactionHandler {\n"
+          << "  boolean onTransact(Stub stub, android.os.Parcel data, android.os.Parcel reply)"
+          << " throws android.os.RemoteException;\n"
+          << "}\n"
+          << "private static final TransactionHandler[] TRANSACTION_HANDLERS = {\n";
+    for (const auto& handler : transact_handlers) {
+      if (handler.empty()) {
+        table << "  null,\n";
+      } else {
+        table << "  (stub, data, reply) -> stub." << handler << "(data, reply),\n";
+      }
+    }
+    table << "};\n";
+    this->elements.push_back(New<LiteralClassElement>(table.str()));
+
+    transact_statements->Add(New<LiteralStatement>(
+        "int index = code - android.os.IBinder.FIRST_CALL_TRANSACTION;\n"
+        "if (index >= 0 && index < TRANSACTION_HANDLERS.length"
+        " && TRANSACTION_HANDLERS[index] != null) {\n"
+        "  return TRANSACTION_HANDLERS[index].onTransact(this, data, reply);\n"
+        "}\n"));
+  }
   transact_statements->Add(this->transact_switch);
 
   // getTransactionName
@@ -226,8 +260,8 @@ void StubClass::finish() {
     // Some transaction codes are common, e.g. INTERFACE_TRANSACTION or DUMP_TRANSACTION.
     // Common transaction codes will not be resolved to a string by getTransactionName. The method
     // will return NULL in this case.
-    auto code_switch_default_case = std::make_shared<Case>();
-    code_switch_default_case->statements->Add(std::make_shared<ReturnStatement>(NULL_VALUE));
+    auto code_switch_default_case = New<Case>();
+    code_switch_default_case->statements->Add(New<ReturnStatement>(NULL_VALUE));
     this->code_to_method_name_switch->cases.push_back(code_switch_default_case);
   }
 }
@@ -235,18 +269,18 @@ void StubClass::finish() {
 // The the expression for the interface's descriptor to be used when
 // generating code for the given method. Null is acceptable for method
 // and stands for synthetic cases.
-std::shared_ptr<Expression> StubClass::get_transact_descriptor(const AidlMethod* method) {
+Expression* StubClass::get_transact_descriptor(const AidlMethod* method) {
   if (transact_outline) {
     if (method != nullptr) {
       // When outlining, each outlined method needs its own literal.
       if (outline_methods.count(method) != 0) {
-        return std::make_shared<LiteralExpression>("DESCRIPTOR");
+        return New<LiteralExpression>("DESCRIPTOR");
       }
     } else {
       // Synthetic case. A small number is assumed. Use its own descriptor
       // if there are only synthetic cases.
       if (outline_methods.size() == all_method_count) {
-        return std::make_shared<LiteralExpression>("DESCRIPTOR");
+        return New<LiteralExpression>("DESCRIPTOR");
       }
     }
   }
@@ -254,17 +288,17 @@ std::shared_ptr<Expression> StubClass::get_transact_descriptor(const AidlMethod*
   // When not outlining, store the descriptor literal into a local variable, in
   // an effort to save const-string instructions in each switch case.
   if (transact_descriptor == nullptr) {
-    transact_descriptor = std::make_shared<Variable>("java.lang.String", "descriptor");
-    transact_statements->Add(std::make_shared<VariableDeclaration>(
-        transact_descriptor, std::make_shared<LiteralExpression>("DESCRIPTOR")));
+    transact_descriptor = New<Variable>("java.lang.String", "descriptor");
+    transact_statements->Add(New<VariableDeclaration>(
+        transact_descriptor, New<LiteralExpression>("DESCRIPTOR")));
   }
   return transact_descriptor;
 }
 
 void StubClass::make_as_interface(const AidlInterface* interfaceType) {
-  auto obj = std::make_shared<Variable>("android.os.IBinder", "obj");
+  auto obj = New<Variable>("android.os.IBinder", "obj");
 
-  auto m = std::make_shared<Method>();
+  auto m = New<Method>();
   m->comment = "/**\n * Cast an IBinder object into an ";
   m->comment += interfaceType->GetCanonicalName();
   m->comment += " interface,\n";
@@ -273,19 +307,19 @@ void StubClass::make_as_interface(const AidlInterface* interfaceType) {
   m->returnType = interfaceType->GetCanonicalName();
   m->name = "asInterface";
   m->parameters.push_back(obj);
-  m->statements = std::make_shared<StatementBlock>();
+  m->statements = New<StatementBlock>();
 
-  auto ifstatement = std::make_shared<IfStatement>();
-  ifstatement->expression = std::make_shared<Comparison>(obj, "==", NULL_VALUE);
-  ifstatement->statements = std::make_shared<StatementBlock>();
-  ifstatement->statements->Add(std::make_shared<ReturnStatement>(NULL_VALUE));
+  auto ifstatement = New<IfStatement>();
+  ifstatement->expression = New<Comparison>(obj, "==", NULL_VALUE);
+  ifstatement->statements = New<StatementBlock>();
+  ifstatement->statements->Add(New<ReturnStatement>(NULL_VALUE));
   m->statements->Add(ifstatement);
 
   // IInterface iin = obj.queryLocalInterface(DESCRIPTOR)
-  auto queryLocalInterface = std::make_shared<MethodCall>(obj, "queryLocalInterface");
-  queryLocalInterface->arguments.push_back(std::make_shared<LiteralExpression>("DESCRIPTOR"));
-  auto iin = std::make_shared<Variable>("android.os.IInterface", "iin");
-  auto iinVd = std::make_shared<VariableDeclaration>(iin, queryLocalInterface);
+  auto queryLocalInterface = New<MethodCall>(obj, "queryLocalInterface");
+  queryLocalInterface->arguments.push_back(New<LiteralExpression>("DESCRIPTOR"));
+  auto iin = New<Variable>("android.os.IInterface", "iin");
+  auto iinVd = New<VariableDeclaration>(iin, queryLocalInterface);
   m->statements->Add(iinVd);
 
   // Ensure the instance type of the local object is as expected.
@@ -294,19 +328,19 @@ void StubClass::make_as_interface(const AidlInterface* interfaceType) {
 
   // if (iin != null && iin instanceof <interfaceType>) return (<interfaceType>)
   // iin;
-  auto iinNotNull = std::make_shared<Comparison>(iin, "!=", NULL_VALUE);
-  auto instOfCheck = std::make_shared<Comparison>(
-      iin, " instanceof ", std::make_shared<LiteralExpression>(interfaceType->GetCanonicalName()));
-  auto instOfStatement = std::make_shared<IfStatement>();
-  instOfStatement->expression = std::make_shared<Comparison>(iinNotNull, "&&", instOfCheck);
-  instOfStatement->statements = std::make_shared<StatementBlock>();
-  instOfStatement->statements->Add(std::make_shared<ReturnStatement>(
-      std::make_shared<Cast>(interfaceType->GetCanonicalName(), iin)));
+  auto iinNotNull = New<Comparison>(iin, "!=", NULL_VALUE);
+  auto instOfCheck = New<Comparison>(
+      iin, " instanceof ", New<LiteralExpression>(interfaceType->GetCanonicalName()));
+  auto instOfStatement = New<IfStatement>();
+  instOfStatement->expression = New<Comparison>(iinNotNull, "&&", instOfCheck);
+  instOfStatement->statements = New<StatementBlock>();
+  instOfStatement->statements->Add(New<ReturnStatement>(
+      New<Cast>(interfaceType->GetCanonicalName(), iin)));
   m->statements->Add(instOfStatement);
 
-  auto ne = std::make_shared<NewExpression>(interfaceType->GetCanonicalName() + ".Stub.Proxy");
+  auto ne = New<NewExpression>(interfaceType->GetCanonicalName() + ".Stub.Proxy");
   ne->arguments.push_back(obj);
-  m->statements->Add(std::make_shared<ReturnStatement>(ne));
+  m->statements->Add(New<ReturnStatement>(ne));
 
   this->elements.push_back(m);
 }
@@ -317,7 +351,7 @@ class ProxyClass : public Class {
   ProxyClass(const AidlInterface* interfaceType, const Options& options);
   ~ProxyClass() override;
 
-  std::shared_ptr<Variable> mRemote;
+  Variable* mRemote;
 };
 
 ProxyClass::ProxyClass(const AidlInterface* interfaceType, const Options& options) : Class() {
@@ -327,36 +361,67 @@ ProxyClass::ProxyClass(const AidlInterface* interfaceType, const Options& option
   this->interfaces.push_back(interfaceType->GetCanonicalName());
 
   // IBinder mRemote
-  mRemote = std::make_shared<Variable>("android.os.IBinder", "mRemote");
-  this->elements.push_back(std::make_shared<Field>(PRIVATE, mRemote));
+  mRemote = New<Variable>("android.os.IBinder", "mRemote");
+  this->elements.push_back(New<Field>(PRIVATE, mRemote));
 
   // Proxy()
-  auto remote = std::make_shared<Variable>("android.os.IBinder", "remote");
-  auto ctor = std::make_shared<Method>();
+  auto remote = New<Variable>("android.os.IBinder", "remote");
+  auto ctor = New<Method>();
   ctor->name = "Proxy";
-  ctor->statements = std::make_shared<StatementBlock>();
+  ctor->statements = New<StatementBlock>();
   ctor->parameters.push_back(remote);
-  ctor->statements->Add(std::make_shared<Assignment>(mRemote, remote));
+  ctor->statements->Add(New<Assignment>(mRemote, remote));
   this->elements.push_back(ctor);
 
   if (options.Version() > 0) {
     std::ostringstream code;
     code << "private int mCachedVersion = -1;\n";
-    this->elements.emplace_back(std::make_shared<LiteralClassElement>(code.str()));
+    this->elements.emplace_back(New<LiteralClassElement>(code.str()));
   }
   if (!options.Hash().empty()) {
     std::ostringstream code;
     code << "private String mCachedHash = \"-1\";\n";
-    this->elements.emplace_back(std::make_shared<LiteralClassElement>(code.str()));
+    this->elements.emplace_back(New<LiteralClassElement>(code.str()));
+  }
+  if (interfaceType->IsReuseParcels()) {
+    // A slot is emptied while its parcel is in use, so a nested call on the
+    // same thread (e.g. into a local binder) obtains a parcel of its own.
+    std::ostringstream code;
+    code << "private static final int MAX_REUSED_PARCEL_CAPACITY = 64 * 1024;\n"
+         << "private static final ThreadLocal<android.os.Parcel> sReusedDataParcel =\n"
+         << "    new ThreadLocal<>();\n"
+         << "private static final ThreadLocal<android.os.Parcel> sReusedReplyParcel =\n"
+         << "    new ThreadLocal<>();\n"
+         << "private static android.os.Parcel obtainReusedParcel(\n"
+         << "    ThreadLocal<android.os.Parcel> slot) {\n"
+         << "  android.os.Parcel parcel = slot.get();\n"
+         << "  if (parcel == null) {\n"
+         << "    return android.os.Parcel.obtain();\n"
+         << "  }\n"
+         << "  slot.set(null);\n"
+         << "  return parcel;\n"
+         << "}\n"
+         << "private static void releaseReusedParcel(\n"
+         << "    ThreadLocal<android.os.Parcel> slot, android.os.Parcel parcel) {\n"
+         << "  if (slot.get() != null || parcel.dataCapacity() > MAX_REUSED_PARCEL_CAPACITY) {\n"
+         << "    parcel.recycle();\n"
+         << "    return;\n"
+         << "  }\n"
+         << "  // Drops the contents, including binders and file descriptors, but\n"
+         << "  // keeps the buffer for the next call.\n"
+         << "  parcel.setDataSize(0);\n"
+         << "  slot.set(parcel);\n"
+         << "}\n";
+    this->elements.emplace_back(New<LiteralClassElement>(code.str()));
   }
 
   // IBinder asBinder()
-  auto asBinder = std::make_shared<Method>();
+  auto asBinder = New<Method>();
   asBinder->modifiers = PUBLIC | OVERRIDE;
   asBinder->returnType = "android.os.IBinder";
   asBinder->name = "asBinder";
-  asBinder->statements = std::make_shared<StatementBlock>();
-  asBinder->statements->Add(std::make_shared<ReturnStatement>(mRemote));
+  asBinder->statements = New<StatementBlock>();
+  asBinder->statements->Add(New<ReturnStatement>(mRemote));
   this->elements.push_back(asBinder);
 }
 
@@ -364,25 +429,369 @@ ProxyClass::~ProxyClass() {}
 
 // =================================================
 static void generate_new_array(const AidlTypeSpecifier& type, const AidlTypenames& typenames,
-                               std::shared_ptr<StatementBlock> addTo, std::shared_ptr<Variable> v,
-                               std::shared_ptr<Variable> parcel) {
-  auto len = std::make_shared<Variable>("int", v->name + "_length");
+                               StatementBlock* addTo, Variable* v,
+                               Variable* parcel) {
+  auto len = New<Variable>("int", v->name + "_length");
   addTo->Add(
-      std::make_shared<VariableDeclaration>(len, std::make_shared<MethodCall>(parcel, "readInt")));
-  auto lencheck = std::make_shared<IfStatement>();
+      New<VariableDeclaration>(len, New<MethodCall>(parcel, "readInt")));
+  auto lencheck = New<IfStatement>();
   lencheck->expression =
-      std::make_shared<Comparison>(len, "<", std::make_shared<LiteralExpression>("0"));
-  lencheck->statements->Add(std::make_shared<Assignment>(v, NULL_VALUE));
-  lencheck->elseif = std::make_shared<IfStatement>();
-  lencheck->elseif->statements->Add(std::make_shared<Assignment>(
-      v, std::make_shared<NewArrayExpression>(InstantiableJavaSignatureOf(type, typenames), len)));
+      New<Comparison>(len, "<", New<LiteralExpression>("0"));
+  lencheck->statements->Add(New<Assignment>(v, NULL_VALUE));
+  lencheck->elseif = New<IfStatement>();
+  lencheck->elseif->statements->Add(New<Assignment>(
+      v, New<NewArrayExpression>(InstantiableJavaSignatureOf(type, typenames), len)));
   addTo->Add(lencheck);
 }
 
-static void generate_write_to_parcel(const AidlTypeSpecifier& type,
-                                     std::shared_ptr<StatementBlock> addTo,
-                                     std::shared_ptr<Variable> v, std::shared_ptr<Variable> parcel,
+// Payloads of @SharedMemory arguments above the threshold are copied into a
+// shared memory region and only its fd goes through the parcel. The wire
+// format is an int32 0 followed by the array, or an int32 1 followed by the
+// length and the region as a ParcelFileDescriptor, the same in every backend.
+static const char* kJavaSharedMemoryHelpers =
+    "private static final int SHARED_MEMORY_THRESHOLD = 16 * 1024;\n"
+    "private static void writeSharedMemoryByteArray(android.os.Parcel parcel, byte[] value) {\n"
+    "  android.os.ParcelFileDescriptor region = null;\n"
+    "  if (value != null && value.length > SHARED_MEMORY_THRESHOLD) {\n"
+    "    android.os.SharedMemory shm = null;\n"
+    "    try {\n"
+    "      shm = android.os.SharedMemory.create(DESCRIPTOR, value.length);\n"
+    "      java.nio.ByteBuffer buffer = shm.mapReadWrite();\n"
+    "      buffer.put(value);\n"
+    "      android.os.SharedMemory.unmap(buffer);\n"
+    "      region = android.os.ParcelFileDescriptor.dup(shm.getFileDescriptor());\n"
+    "    } catch (android.system.ErrnoException e) {\n"
+    "      // Sent inline below.\n"
+    "    } catch (java.io.IOException e) {\n"
+    "      // Sent inline below.\n"
+    "    } finally {\n"
+    "      if (shm != null) {\n"
+    "        shm.close();\n"
+    "      }\n"
+    "    }\n"
+    "  }\n"
+    "  if (region == null) {\n"
+    "    parcel.writeInt(0);\n"
+    "    parcel.writeByteArray(value);\n"
+    "    return;\n"
+    "  }\n"
+    "  parcel.writeInt(1);\n"
+    "  parcel.writeInt(value.length);\n"
+    "  parcel.writeInt(1);\n"
+    "  region.writeToParcel(parcel, android.os.Parcelable.PARCELABLE_WRITE_RETURN_VALUE);\n"
+    "}\n"
+    "private static byte[] readSharedMemoryByteArray(android.os.Parcel parcel) {\n"
+    "  if (parcel.readInt() == 0) {\n"
+    "    return parcel.createByteArray();\n"
+    "  }\n"
+    "  int length = parcel.readInt();\n"
+    "  if (length <= 0 || parcel.readInt() == 0) {\n"
+    "    throw new android.os.BadParcelableException(\"Invalid shared memory payload\");\n"
+    "  }\n"
+    "  android.os.ParcelFileDescriptor region =\n"
+    "      android.os.ParcelFileDescriptor.CREATOR.createFromParcel(parcel);\n"
+    "  try {\n"
+    "    // A region smaller than the length would fault when read.\n"
+    "    long size = region.getStatSize();\n"
+    "    if (size >= 0 && size < length) {\n"
+    "      throw new android.os.BadParcelableException(\"Shared memory region is too small\");\n"
+    "    }\n"
+    "    java.nio.ByteBuffer buffer =\n"
+    "        new java.io.FileInputStream(region.getFileDescriptor()).getChannel().map(\n"
+    "            java.nio.channels.FileChannel.MapMode.READ_ONLY, 0, length);\n"
+    "    byte[] value = new byte[length];\n"
+    "    buffer.get(value);\n"
+    "    return value;\n"
+    "  } catch (java.io.IOException e) {\n"
+    "    throw new android.os.BadParcelableException(e);\n"
+    "  } finally {\n"
+    "    try {\n"
+    "      region.close();\n"
+    "    } catch (java.io.IOException e) {\n"
+    "    }\n"
+    "  }\n"
+    "}\n";
+
+// The Strings of a @Utf8Strings interface, in the format of the native
+// backends: as in other interfaces, or as UTF8_STRING_TAG and a byte array of
+// their UTF-8 encoding. Java Strings are UTF-16, so they are still converted,
+// but by the encoder of the JVM rather than by the native Parcel. A reader
+// sets utf8[0] when the peer wrote UTF-8, if utf8 is not null.
+static const char* kJavaUtf8StringHelpers =
+    "private static final int UTF8_STRING_TAG = -2;\n"
+    "private static void writeUtf8String(android.os.Parcel parcel, String value, boolean utf8) {\n"
+    "  if (!utf8 || value == null) {\n"
+    "    parcel.writeString(value);\n"
+    "    return;\n"
+    "  }\n"
+    "  parcel.writeInt(UTF8_STRING_TAG);\n"
+    "  parcel.writeByteArray(value.getBytes(java.nio.charset.StandardCharsets.UTF_8));\n"
+    "}\n"
+    "private static String readUtf8String(android.os.Parcel parcel, boolean[] utf8) {\n"
+    "  int start = parcel.dataPosition();\n"
+    "  if (parcel.readInt() != UTF8_STRING_TAG) {\n"
+    "    parcel.setDataPosition(start);\n"
+    "    return parcel.readString();\n"
+    "  }\n"
+    "  if (utf8 != null) {\n"
+    "    utf8[0] = true;\n"
+    "  }\n"
+    "  return new String(parcel.createByteArray(), java.nio.charset.StandardCharsets.UTF_8);\n"
+    "}\n";
+
+// The boolean[] and char[] of a @PackedArrays interface, in the format of the
+// native backends: the length, or -1 for null, then a byte array of the
+// elements, one bit per boolean and two little-endian bytes per char.
+static const char* kJavaPackedArrayHelpers =
+    "private static void writePackedBooleanArray(android.os.Parcel parcel, boolean[] value) {\n"
+    "  if (value == null) {\n"
+    "    parcel.writeInt(-1);\n"
+    "    return;\n"
+    "  }\n"
+    "  byte[] bytes = new byte[(value.length + 7) / 8];\n"
+    "  for (int i = 0; i < value.length; i++) {\n"
+    "    if (value[i]) {\n"
+    "      bytes[i >> 3] |= (byte) (1 << (i & 7));\n"
+    "    }\n"
+    "  }\n"
+    "  parcel.writeInt(value.length);\n"
+    "  parcel.writeByteArray(bytes);\n"
+    "}\n"
+    "private static boolean[] createPackedBooleanArray(android.os.Parcel parcel) {\n"
+    "  int length = parcel.readInt();\n"
+    "  if (length < 0) {\n"
+    "    return null;\n"
+    "  }\n"
+    "  byte[] bytes = parcel.createByteArray();\n"
+    "  if (bytes == null || bytes.length != (int) (((long) length + 7) / 8)) {\n"
+    "    throw new android.os.BadParcelableException(\"Invalid packed array\");\n"
+    "  }\n"
+    "  boolean[] value = new boolean[length];\n"
+    "  for (int i = 0; i < length; i++) {\n"
+    "    value[i] = (bytes[i >> 3] & (1 << (i & 7))) != 0;\n"
+    "  }\n"
+    "  return value;\n"
+    "}\n"
+    "private static void readPackedBooleanArray(android.os.Parcel parcel, boolean[] value) {\n"
+    "  boolean[] read = createPackedBooleanArray(parcel);\n"
+    "  if (read == null || read.length != value.length) {\n"
+    "    throw new RuntimeException(\"bad array lengths\");\n"
+    "  }\n"
+    "  System.arraycopy(read, 0, value, 0, value.length);\n"
+    "}\n"
+    "private static void writePackedCharArray(android.os.Parcel parcel, char[] value) {\n"
+    "  if (value == null) {\n"
+    "    parcel.writeInt(-1);\n"
+    "    return;\n"
+    "  }\n"
+    "  java.nio.ByteBuffer bytes = java.nio.ByteBuffer.allocate(value.length * 2)\n"
+    "      .order(java.nio.ByteOrder.LITTLE_ENDIAN);\n"
+    "  bytes.asCharBuffer().put(value);\n"
+    "  parcel.writeInt(value.length);\n"
+    "  parcel.writeByteArray(bytes.array());\n"
+    "}\n"
+    "private static char[] createPackedCharArray(android.os.Parcel parcel) {\n"
+    "  int length = parcel.readInt();\n"
+    "  if (length < 0) {\n"
+    "    return null;\n"
+    "  }\n"
+    "  byte[] bytes = parcel.createByteArray();\n"
+    "  if (bytes == null || bytes.length != 2L * length) {\n"
+    "    throw new android.os.BadParcelableException(\"Invalid packed array\");\n"
+    "  }\n"
+    "  char[] value = new char[length];\n"
+    "  java.nio.ByteBuffer.wrap(bytes).order(java.nio.ByteOrder.LITTLE_ENDIAN).asCharBuffer()\n"
+    "      .get(value);\n"
+    "  return value;\n"
+    "}\n"
+    "private static void readPackedCharArray(android.os.Parcel parcel, char[] value) {\n"
+    "  char[] read = createPackedCharArray(parcel);\n"
+    "  if (read == null || read.length != value.length) {\n"
+    "    throw new RuntimeException(\"bad array lengths\");\n"
+    "  }\n"
+    "  System.arraycopy(read, 0, value, 0, value.length);\n"
+    "}\n";
+
+// Declared in every interface with @PropagateCallContext methods, which can't
+// share one class without a library for the generated code.
+static const char* kJavaCallContextClass =
+    "/**\n"
+    " * The deadline and priority class that calls of @PropagateCallContext methods\n"
+    " * carry from the client to the server. Stubs make the context of the call\n"
+    " * current while the implementation runs, so that the calls it makes carry the\n"
+    " * context further. A stub doesn't run a call past its deadline.\n"
+    " */\n"
+    "public static final class CallContext {\n"
+    "  /** The {@link System#nanoTime} by which the call has to start, or 0 for none. */\n"
+    "  public long deadlineNanos;\n"
+    "  public int priority;\n"
+    "  private static final ThreadLocal<CallContext> sCurrent = new ThreadLocal<CallContext>() {\n"
+    "    @Override\n"
+    "    protected CallContext initialValue() {\n"
+    "      return new CallContext();\n"
+    "    }\n"
+    "  };\n"
+    "  /** The context of the calls that this thread makes. */\n"
+    "  public static CallContext current() {\n"
+    "    return sCurrent.get();\n"
+    "  }\n"
+    "  /** Makes {@code context} current, and returns the context that was. */\n"
+    "  public static CallContext setCurrent(CallContext context) {\n"
+    "    CallContext outer = sCurrent.get();\n"
+    "    sCurrent.set(context);\n"
+    "    return outer;\n"
+    "  }\n"
+    "  public boolean hasExpired() {\n"
+    "    return deadlineNanos != 0 && System.nanoTime() - deadlineNanos > 0;\n"
+    "  }\n"
+    "  public void writeToParcel(android.os.Parcel parcel) {\n"
+    "    parcel.writeLong(deadlineNanos);\n"
+    "    parcel.writeInt(priority);\n"
+    "  }\n"
+    "  public static CallContext readFromParcel(android.os.Parcel parcel) {\n"
+    "    CallContext context = new CallContext();\n"
+    "    context.deadlineNanos = parcel.readLong();\n"
+    "    context.priority = parcel.readInt();\n"
+    "    return context;\n"
+    "  }\n"
+    "}\n";
+
+static bool HasCallContextMethods(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (iface.PropagatesCallContext(*method)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool HasSharedMemoryArguments(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    for (const auto& arg : method->GetArguments()) {
+      if (arg->GetType().IsSharedMemory()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool HasUtf8WireStrings(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (iface.HasUtf8WireStrings(*method)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool HasPackedWireArrays(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (iface.IsPackedWireArray(method->GetType())) {
+      return true;
+    }
+    for (const auto& arg : method->GetArguments()) {
+      if (iface.IsPackedWireArray(arg->GetType())) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// The helpers of kJavaPackedArrayHelpers for |type|, e.g. writePacked +
+// "Boolean" + Array, or "" if it isn't packed.
+static string packed_array_name(const AidlInterface& iface, const AidlTypeSpecifier& type) {
+  if (!iface.IsPackedWireArray(type)) {
+    return "";
+  }
+  return type.GetName() == "boolean" ? "Boolean" : "Char";
+}
+
+// The call statistics of --gen-stats: for each method the call count, the
+// total latency and a histogram of the latency, for proxies and for stubs.
+static std::string generate_stats_helpers(const AidlInterface& iface) {
+  std::vector<std::string> names;
+  for (const auto& method : iface.GetMethods()) {
+    names.push_back("\"" + method->GetName() + "\"");
+  }
+  std::ostringstream code;
+  code << "private static final String[] STATS_METHOD_NAMES = {" << Join(names, ", ") << "};\n"
+       << "private static final int STATS_BUCKETS = 32;\n"
+       << "private static final int STATS_STRIDE = 2 + STATS_BUCKETS;\n"
+       << "// For each method: the call count, the total in microseconds, then a\n"
+       << "// histogram whose bucket i counts the calls that took less than 2^i and\n"
+       << "// at least 2^(i-1) microseconds.\n"
+       << "private static final java.util.concurrent.atomic.AtomicLongArray sClientStats =\n"
+       << "    new java.util.concurrent.atomic.AtomicLongArray("
+       << "STATS_METHOD_NAMES.length * STATS_STRIDE);\n"
+       << "private static final java.util.concurrent.atomic.AtomicLongArray sServerStats =\n"
+       << "    new java.util.concurrent.atomic.AtomicLongArray("
+       << "STATS_METHOD_NAMES.length * STATS_STRIDE);\n"
+       << "private static void recordStats(\n"
+       << "    java.util.concurrent.atomic.AtomicLongArray stats, int method, long startNanos) {\n"
+       << "  long us = Math.max(0, (System.nanoTime() - startNanos) / 1000);\n"
+       << "  int bucket = Math.min(64 - Long.numberOfLeadingZeros(us), STATS_BUCKETS - 1);\n"
+       << "  int base = method * STATS_STRIDE;\n"
+       << "  stats.incrementAndGet(base);\n"
+       << "  stats.addAndGet(base + 1, us);\n"
+       << "  stats.incrementAndGet(base + 2 + bucket);\n"
+       << "}\n"
+       << "private static long statsPercentileUs(\n"
+       << "    java.util.concurrent.atomic.AtomicLongArray stats, int base, long count,\n"
+       << "    int permille) {\n"
+       << "  long seen = 0;\n"
+       << "  for (int i = 0; i < STATS_BUCKETS; i++) {\n"
+       << "    seen += stats.get(base + 2 + i);\n"
+       << "    if (seen * 1000 >= count * permille) {\n"
+       << "      return 1L << i;\n"
+       << "    }\n"
+       << "  }\n"
+       << "  return 1L << (STATS_BUCKETS - 1);\n"
+       << "}\n"
+       << "private static void dumpStats(java.io.PrintWriter pw,\n"
+       << "    java.util.concurrent.atomic.AtomicLongArray stats, int method, String side) {\n"
+       << "  int base = method * STATS_STRIDE;\n"
+       << "  long count = stats.get(base);\n"
+       << "  if (count == 0) {\n"
+       << "    return;\n"
+       << "  }\n"
+       << "  pw.println(STATS_METHOD_NAMES[method] + \" \" + side + \": count=\" + count\n"
+       << "      + \" mean=\" + stats.get(base + 1) / count + \"us\"\n"
+       << "      + \" p50<\" + statsPercentileUs(stats, base, count, 500) + \"us\"\n"
+       << "      + \" p90<\" + statsPercentileUs(stats, base, count, 900) + \"us\"\n"
+       << "      + \" p99<\" + statsPercentileUs(stats, base, count, 990) + \"us\");\n"
+       << "}\n"
+       << "/**\n"
+       << " * Writes the call count, mean and percentiles of each method called\n"
+       << " * through a proxy or a stub of this interface.\n"
+       << " */\n"
+       << "public static void dumpStats(java.io.PrintWriter pw) {\n"
+       << "  for (int i = 0; i < STATS_METHOD_NAMES.length; i++) {\n"
+       << "    dumpStats(pw, sClientStats, i, \"client\");\n"
+       << "    dumpStats(pw, sServerStats, i, \"server\");\n"
+       << "  }\n"
+       << "}\n";
+  return code.str();
+}
+
+static size_t method_index(const AidlInterface& iface, const AidlMethod& method) {
+  size_t index = 0;
+  while (iface.GetMethods()[index].get() != &method) {
+    index++;
+  }
+  return index;
+}
+
+static void generate_write_to_parcel(const AidlInterface& iface, const AidlTypeSpecifier& type,
+                                     StatementBlock* addTo,
+                                     Variable* v, Variable* parcel,
                                      bool is_return_value, const AidlTypenames& typenames) {
+  if (const string packed = packed_array_name(iface, type); !packed.empty()) {
+    addTo->Add(New<MethodCall>("writePacked" + packed + "Array",
+                               std::vector<Expression*>{parcel, v}));
+    return;
+  }
   string code;
   CodeWriterPtr writer = CodeWriter::ForString(&code);
   CodeGeneratorContext context{
@@ -395,24 +804,24 @@ static void generate_write_to_parcel(const AidlTypeSpecifier& type,
   };
   WriteToParcelFor(context);
   writer->Close();
-  addTo->Add(std::make_shared<LiteralStatement>(code));
+  addTo->Add(New<LiteralStatement>(code));
 }
 
 static void generate_int_constant(Class* interface, const std::string& name,
                                   const std::string& value) {
   auto code = StringPrintf("public static final int %s = %s;\n", name.c_str(), value.c_str());
-  interface->elements.push_back(std::make_shared<LiteralClassElement>(code));
+  interface->elements.push_back(New<LiteralClassElement>(code));
 }
 
 static void generate_string_constant(Class* interface, const std::string& name,
                                      const std::string& value) {
   auto code = StringPrintf("public static final String %s = %s;\n", name.c_str(), value.c_str());
-  interface->elements.push_back(std::make_shared<LiteralClassElement>(code));
+  interface->elements.push_back(New<LiteralClassElement>(code));
 }
 
-static std::shared_ptr<Method> generate_interface_method(const AidlMethod& method,
-                                                         const AidlTypenames& typenames) {
-  auto decl = std::make_shared<Method>();
+static Method* generate_interface_method(const AidlMethod& method,
+                                         const AidlTypenames& typenames) {
+  auto decl = New<Method>();
   decl->comment = method.GetComments();
   decl->modifiers = PUBLIC;
   decl->returnType = JavaSignatureOf(method.GetType(), typenames);
@@ -421,7 +830,7 @@ static std::shared_ptr<Method> generate_interface_method(const AidlMethod& metho
 
   for (const std::unique_ptr<AidlArgument>& arg : method.GetArguments()) {
     decl->parameters.push_back(
-        std::make_shared<Variable>(JavaSignatureOf(arg->GetType(), typenames), arg->GetName()));
+        New<Variable>(JavaSignatureOf(arg->GetType(), typenames), arg->GetName()));
   }
 
   decl->exceptions.push_back("android.os.RemoteException");
@@ -430,19 +839,51 @@ static std::shared_ptr<Method> generate_interface_method(const AidlMethod& metho
 }
 
 static void generate_stub_code(const AidlInterface& iface, const AidlMethod& method, bool oneway,
-                               std::shared_ptr<Variable> transact_data,
-                               std::shared_ptr<Variable> transact_reply,
+                               Variable* transact_data,
+                               Variable* transact_reply,
                                const AidlTypenames& typenames,
-                               std::shared_ptr<StatementBlock> statements,
-                               std::shared_ptr<StubClass> stubClass, const Options& options) {
-  std::shared_ptr<TryStatement> tryStatement;
-  std::shared_ptr<FinallyStatement> finallyStatement;
-  auto realCall = std::make_shared<MethodCall>(THIS_VALUE, method.GetName());
+                               StatementBlock* statements,
+                               StubClass* stubClass, const Options& options) {
+  TryStatement* tryStatement;
+  FinallyStatement* finallyStatement;
+  auto realCall = New<MethodCall>(THIS_VALUE, method.GetName());
+
+  if (options.GenStats()) {
+    statements->Add(New<LiteralStatement>(
+        "long _aidl_stats_start = System.nanoTime();\n"));
+  }
 
   // interface token validation is the very first thing we do
-  statements->Add(std::make_shared<MethodCall>(
+  statements->Add(New<MethodCall>(
       transact_data, "enforceInterface",
-      std::vector<std::shared_ptr<Expression>>{stubClass->get_transact_descriptor(&method)}));
+      std::vector<Expression*>{stubClass->get_transact_descriptor(&method)}));
+
+  // An expired call is answered before its arguments are read.
+  const bool propagates_call_context = iface.PropagatesCallContext(method);
+  const string call_context = iface.GetCanonicalName() + ".CallContext";
+  if (propagates_call_context) {
+    std::ostringstream code;
+    code << call_context << " _aidl_context = " << call_context << ".readFromParcel("
+         << transact_data->name << ");\n"
+         << "if (_aidl_context.hasExpired()) {\n";
+    if (!oneway) {
+      code << "  " << transact_reply->name << ".writeException(new IllegalStateException(\""
+           << method.GetName() << "() missed its deadline\"));\n";
+    }
+    code << "  return true;\n"
+         << "}\n";
+    statements->Add(New<LiteralStatement>(code.str()));
+  }
+
+  // Whether the Strings of the reply are written as UTF-8, which they are once
+  // the client has written one so. An unversioned peer always does.
+  string utf8_reply = "true";
+  string utf8_flag = "null";
+  if (iface.HasUtf8WireStrings(method) && options.Version() > 0) {
+    statements->Add(New<LiteralStatement>("boolean[] _aidl_utf8 = {false};\n"));
+    utf8_reply = "_aidl_utf8[0]";
+    utf8_flag = "_aidl_utf8";
+  }
 
   // args
   VariableFactory stubArgs("_arg");
@@ -451,11 +892,26 @@ static void generate_stub_code(const AidlInterface& iface, const AidlMethod& met
     // at most once.
     bool is_classloader_created = false;
     for (const std::unique_ptr<AidlArgument>& arg : method.GetArguments()) {
-      std::shared_ptr<Variable> v = stubArgs.Get(arg->GetType(), typenames);
-
-      statements->Add(std::make_shared<VariableDeclaration>(v));
-
-      if (arg->GetDirection() & AidlArgument::IN_DIR) {
+      Variable* v = stubArgs.Get(arg->GetType(), typenames);
+
+      statements->Add(New<VariableDeclaration>(v));
+
+      if (arg->GetType().IsSharedMemory()) {
+        statements->Add(New<Assignment>(
+            v, New<MethodCall>(
+                   "readSharedMemoryByteArray",
+                   std::vector<Expression*>{transact_data})));
+      } else if (iface.IsUtf8WireString(arg->GetType())) {
+        statements->Add(New<Assignment>(
+            v, New<MethodCall>("readUtf8String",
+                               std::vector<Expression*>{transact_data,
+                                                        New<LiteralExpression>(utf8_flag)})));
+      } else if (const string packed = packed_array_name(iface, arg->GetType());
+                 !packed.empty() && (arg->GetDirection() & AidlArgument::IN_DIR)) {
+        statements->Add(New<Assignment>(
+            v, New<MethodCall>("createPacked" + packed + "Array",
+                               std::vector<Expression*>{transact_data})));
+      } else if (arg->GetDirection() & AidlArgument::IN_DIR) {
         string code;
         CodeWriterPtr writer = CodeWriter::ForString(&code);
         CodeGeneratorContext context{.writer = *(writer.get()),
@@ -466,11 +922,11 @@ static void generate_stub_code(const AidlInterface& iface, const AidlMethod& met
                                      .is_classloader_created = &is_classloader_created};
         CreateFromParcelFor(context);
         writer->Close();
-        statements->Add(std::make_shared<LiteralStatement>(code));
+        statements->Add(New<LiteralStatement>(code));
       } else {
         if (!arg->GetType().IsArray()) {
-          statements->Add(std::make_shared<Assignment>(
-              v, std::make_shared<NewExpression>(
+          statements->Add(New<Assignment>(
+              v, New<NewExpression>(
                      InstantiableJavaSignatureOf(arg->GetType(), typenames))));
         } else {
           generate_new_array(arg->GetType(), typenames, statements, v, transact_data);
@@ -481,27 +937,36 @@ static void generate_stub_code(const AidlInterface& iface, const AidlMethod& met
     }
   }
 
+  // try and finally, but only when generating trace code or when the context
+  // of the call has to be restored
+  const bool wraps_call = options.GenTraces() || propagates_call_context;
+  if (wraps_call) {
+    tryStatement = New<TryStatement>();
+    finallyStatement = New<FinallyStatement>();
+  }
+  if (propagates_call_context) {
+    statements->Add(New<LiteralStatement>(call_context + " _aidl_outer_context = " +
+                                          call_context + ".setCurrent(_aidl_context);\n"));
+    finallyStatement->statements->Add(New<LiteralStatement>(
+        call_context + ".setCurrent(_aidl_outer_context);\n"));
+  }
   if (options.GenTraces()) {
-    // try and finally, but only when generating trace code
-    tryStatement = std::make_shared<TryStatement>();
-    finallyStatement = std::make_shared<FinallyStatement>();
-
-    tryStatement->statements->Add(std::make_shared<MethodCall>(
-        std::make_shared<LiteralExpression>("android.os.Trace"), "traceBegin",
-        std::vector<std::shared_ptr<Expression>>{
-            std::make_shared<LiteralExpression>("android.os.Trace.TRACE_TAG_AIDL"),
-            std::make_shared<StringLiteralExpression>(iface.GetName() + "::" + method.GetName() +
-                                                      "::server")}));
-
-    finallyStatement->statements->Add(std::make_shared<MethodCall>(
-        std::make_shared<LiteralExpression>("android.os.Trace"), "traceEnd",
-        std::vector<std::shared_ptr<Expression>>{
-            std::make_shared<LiteralExpression>("android.os.Trace.TRACE_TAG_AIDL")}));
+    tryStatement->statements->Add(New<MethodCall>(
+        New<LiteralExpression>("android.os.Trace"), "traceBegin",
+        std::vector<Expression*>{
+            New<LiteralExpression>("android.os.Trace.TRACE_TAG_AIDL"),
+            New<StringLiteralExpression>(iface.GetName() + "::" + method.GetName() +
+                                         "::server")}));
+
+    finallyStatement->statements->Add(New<MethodCall>(
+        New<LiteralExpression>("android.os.Trace"), "traceEnd",
+        std::vector<Expression*>{
+            New<LiteralExpression>("android.os.Trace.TRACE_TAG_AIDL")}));
   }
 
   // the real call
   if (method.GetType().GetName() == "void") {
-    if (options.GenTraces()) {
+    if (wraps_call) {
       statements->Add(tryStatement);
       tryStatement->statements->Add(realCall);
       statements->Add(finallyStatement);
@@ -511,51 +976,64 @@ static void generate_stub_code(const AidlInterface& iface, const AidlMethod& met
 
     if (!oneway) {
       // report that there were no exceptions
-      auto ex = std::make_shared<MethodCall>(transact_reply, "writeNoException");
+      auto ex = New<MethodCall>(transact_reply, "writeNoException");
       statements->Add(ex);
     }
   } else {
     auto _result =
-        std::make_shared<Variable>(JavaSignatureOf(method.GetType(), typenames), "_result");
-    if (options.GenTraces()) {
-      statements->Add(std::make_shared<VariableDeclaration>(_result));
+        New<Variable>(JavaSignatureOf(method.GetType(), typenames), "_result");
+    if (wraps_call) {
+      statements->Add(New<VariableDeclaration>(_result));
       statements->Add(tryStatement);
-      tryStatement->statements->Add(std::make_shared<Assignment>(_result, realCall));
+      tryStatement->statements->Add(New<Assignment>(_result, realCall));
       statements->Add(finallyStatement);
     } else {
-      statements->Add(std::make_shared<VariableDeclaration>(_result, realCall));
+      statements->Add(New<VariableDeclaration>(_result, realCall));
     }
 
     if (!oneway) {
       // report that there were no exceptions
-      auto ex = std::make_shared<MethodCall>(transact_reply, "writeNoException");
+      auto ex = New<MethodCall>(transact_reply, "writeNoException");
       statements->Add(ex);
     }
 
     // marshall the return value
-    generate_write_to_parcel(method.GetType(), statements, _result, transact_reply, true,
-                             typenames);
+    if (iface.IsUtf8WireString(method.GetType())) {
+      statements->Add(New<MethodCall>(
+          "writeUtf8String", std::vector<Expression*>{transact_reply, _result,
+                                                      New<LiteralExpression>(utf8_reply)}));
+    } else {
+      generate_write_to_parcel(iface, method.GetType(), statements, _result, transact_reply,
+                               true, typenames);
+    }
   }
 
   // out parameters
   int i = 0;
   for (const std::unique_ptr<AidlArgument>& arg : method.GetArguments()) {
-    std::shared_ptr<Variable> v = stubArgs.Get(i++);
+    Variable* v = stubArgs.Get(i++);
 
     if (arg->GetDirection() & AidlArgument::OUT_DIR) {
-      generate_write_to_parcel(arg->GetType(), statements, v, transact_reply, true, typenames);
+      generate_write_to_parcel(iface, arg->GetType(), statements, v, transact_reply, true,
+                               typenames);
     }
   }
 
+  if (options.GenStats()) {
+    statements->Add(New<LiteralStatement>(
+        StringPrintf("recordStats(sServerStats, %zu, _aidl_stats_start);\n",
+                     method_index(iface, method))));
+  }
+
   // return true
-  statements->Add(std::make_shared<ReturnStatement>(TRUE_VALUE));
+  statements->Add(New<ReturnStatement>(TRUE_VALUE));
 }
 
 static void generate_stub_case(const AidlInterface& iface, const AidlMethod& method,
                                const std::string& transactCodeName, bool oneway,
-                               std::shared_ptr<StubClass> stubClass, const AidlTypenames& typenames,
+                               StubClass* stubClass, const AidlTypenames& typenames,
                                const Options& options) {
-  auto c = std::make_shared<Case>(transactCodeName);
+  auto c = New<Case>(transactCodeName);
 
   generate_stub_code(iface, method, oneway, stubClass->transact_data, stubClass->transact_reply,
                      typenames, c->statements, stubClass, options);
@@ -565,20 +1043,20 @@ static void generate_stub_case(const AidlInterface& iface, const AidlMethod& met
 
 static void generate_stub_case_outline(const AidlInterface& iface, const AidlMethod& method,
                                        const std::string& transactCodeName, bool oneway,
-                                       std::shared_ptr<StubClass> stubClass,
+                                       StubClass* stubClass,
                                        const AidlTypenames& typenames, const Options& options) {
   std::string outline_name = "onTransact$" + method.GetName() + "$";
   // Generate an "outlined" method with the actual code.
   {
-    auto transact_data = std::make_shared<Variable>("android.os.Parcel", "data");
-    auto transact_reply = std::make_shared<Variable>("android.os.Parcel", "reply");
-    auto onTransact_case = std::make_shared<Method>();
+    auto transact_data = New<Variable>("android.os.Parcel", "data");
+    auto transact_reply = New<Variable>("android.os.Parcel", "reply");
+    auto onTransact_case = New<Method>();
     onTransact_case->modifiers = PRIVATE;
     onTransact_case->returnType = "boolean";
     onTransact_case->name = outline_name;
     onTransact_case->parameters.push_back(transact_data);
     onTransact_case->parameters.push_back(transact_reply);
-    onTransact_case->statements = std::make_shared<StatementBlock>();
+    onTransact_case->statements = New<StatementBlock>();
     onTransact_case->exceptions.push_back("android.os.RemoteException");
     stubClass->elements.push_back(onTransact_case);
 
@@ -586,105 +1064,152 @@ static void generate_stub_case_outline(const AidlInterface& iface, const AidlMet
                        onTransact_case->statements, stubClass, options);
   }
 
+  if (stubClass->transact_dispatch_table) {
+    stubClass->transact_handlers[method.GetId()] = outline_name;
+    return;
+  }
+
   // Generate the case dispatch.
   {
-    auto c = std::make_shared<Case>(transactCodeName);
+    auto c = New<Case>(transactCodeName);
 
     auto helper_call =
-        std::make_shared<MethodCall>(THIS_VALUE, outline_name,
-                                     std::vector<std::shared_ptr<Expression>>{
+        New<MethodCall>(THIS_VALUE, outline_name,
+                        std::vector<Expression*>{
                                          stubClass->transact_data, stubClass->transact_reply});
-    c->statements->Add(std::make_shared<ReturnStatement>(helper_call));
+    c->statements->Add(New<ReturnStatement>(helper_call));
 
     stubClass->transact_switch->cases.push_back(c);
   }
 }
 
-static std::shared_ptr<Method> generate_proxy_method(
+static Method* generate_proxy_method(
     const AidlInterface& iface, const AidlMethod& method, const std::string& transactCodeName,
-    bool oneway, std::shared_ptr<ProxyClass> proxyClass, const AidlTypenames& typenames,
+    bool oneway, ProxyClass* proxyClass, const AidlTypenames& typenames,
     const Options& options) {
-  auto proxy = std::make_shared<Method>();
+  auto proxy = New<Method>();
   proxy->comment = method.GetComments();
   proxy->modifiers = PUBLIC | OVERRIDE;
   proxy->returnType = JavaSignatureOf(method.GetType(), typenames);
   proxy->name = method.GetName();
-  proxy->statements = std::make_shared<StatementBlock>();
+  proxy->statements = New<StatementBlock>();
   for (const std::unique_ptr<AidlArgument>& arg : method.GetArguments()) {
     proxy->parameters.push_back(
-        std::make_shared<Variable>(JavaSignatureOf(arg->GetType(), typenames), arg->GetName()));
+        New<Variable>(JavaSignatureOf(arg->GetType(), typenames), arg->GetName()));
   }
   proxy->exceptions.push_back("android.os.RemoteException");
 
-  // the parcels
-  auto _data = std::make_shared<Variable>("android.os.Parcel", "_data");
-  proxy->statements->Add(std::make_shared<VariableDeclaration>(
-      _data, std::make_shared<MethodCall>("android.os.Parcel", "obtain")));
-  std::shared_ptr<Variable> _reply = nullptr;
+  // the parcels; @ReuseParcels interfaces take them from per-thread slots
+  // instead of the global Parcel pool
+  const bool reuse_parcels = iface.IsReuseParcels();
+  auto obtain_parcel = [reuse_parcels](const string& slot) -> Expression* {
+    if (reuse_parcels) {
+      return New<MethodCall>(
+          "obtainReusedParcel",
+          std::vector<Expression*>{New<LiteralExpression>(slot)});
+    }
+    return New<MethodCall>("android.os.Parcel", "obtain");
+  };
+  auto release_parcel = [reuse_parcels](const string& slot, Variable* parcel)
+      -> Expression* {
+    if (reuse_parcels) {
+      return New<MethodCall>(
+          "releaseReusedParcel",
+          std::vector<Expression*>{New<LiteralExpression>(slot),
+                                   parcel});
+    }
+    return New<MethodCall>(parcel, "recycle");
+  };
+  auto _data = New<Variable>("android.os.Parcel", "_data");
+  proxy->statements->Add(
+      New<VariableDeclaration>(_data, obtain_parcel("sReusedDataParcel")));
+  Variable* _reply = nullptr;
   if (!oneway) {
-    _reply = std::make_shared<Variable>("android.os.Parcel", "_reply");
-    proxy->statements->Add(std::make_shared<VariableDeclaration>(
-        _reply, std::make_shared<MethodCall>("android.os.Parcel", "obtain")));
+    _reply = New<Variable>("android.os.Parcel", "_reply");
+    proxy->statements->Add(
+        New<VariableDeclaration>(_reply, obtain_parcel("sReusedReplyParcel")));
   }
 
   // the return value
-  std::shared_ptr<Variable> _result = nullptr;
+  Variable* _result = nullptr;
   if (method.GetType().GetName() != "void") {
-    _result = std::make_shared<Variable>(*proxy->returnType, "_result");
-    proxy->statements->Add(std::make_shared<VariableDeclaration>(_result));
+    _result = New<Variable>(*proxy->returnType, "_result");
+    proxy->statements->Add(New<VariableDeclaration>(_result));
+  }
+
+  if (options.GenStats()) {
+    proxy->statements->Add(New<LiteralStatement>(
+        "long _aidl_stats_start = System.nanoTime();\n"));
   }
 
   // try and finally
-  auto tryStatement = std::make_shared<TryStatement>();
+  auto tryStatement = New<TryStatement>();
   proxy->statements->Add(tryStatement);
-  auto finallyStatement = std::make_shared<FinallyStatement>();
+  auto finallyStatement = New<FinallyStatement>();
   proxy->statements->Add(finallyStatement);
 
   if (options.GenTraces()) {
-    tryStatement->statements->Add(std::make_shared<MethodCall>(
-        std::make_shared<LiteralExpression>("android.os.Trace"), "traceBegin",
-        std::vector<std::shared_ptr<Expression>>{
-            std::make_shared<LiteralExpression>("android.os.Trace.TRACE_TAG_AIDL"),
-            std::make_shared<StringLiteralExpression>(iface.GetName() + "::" + method.GetName() +
-                                                      "::client")}));
+    tryStatement->statements->Add(New<MethodCall>(
+        New<LiteralExpression>("android.os.Trace"), "traceBegin",
+        std::vector<Expression*>{
+            New<LiteralExpression>("android.os.Trace.TRACE_TAG_AIDL"),
+            New<StringLiteralExpression>(iface.GetName() + "::" + method.GetName() +
+                                         "::client")}));
   }
 
   // the interface identifier token: the DESCRIPTOR constant, marshalled as a
   // string
-  tryStatement->statements->Add(std::make_shared<MethodCall>(
+  tryStatement->statements->Add(New<MethodCall>(
       _data, "writeInterfaceToken",
-      std::vector<std::shared_ptr<Expression>>{std::make_shared<LiteralExpression>("DESCRIPTOR")}));
+      std::vector<Expression*>{New<LiteralExpression>("DESCRIPTOR")}));
+
+  if (iface.PropagatesCallContext(method)) {
+    tryStatement->statements->Add(New<LiteralStatement>(
+        iface.GetCanonicalName() + ".CallContext.current().writeToParcel(" + _data->name +
+        ");\n"));
+  }
 
   // the parameters
   for (const std::unique_ptr<AidlArgument>& arg : method.GetArguments()) {
-    auto v = std::make_shared<Variable>(JavaSignatureOf(arg->GetType(), typenames), arg->GetName());
+    auto v = New<Variable>(JavaSignatureOf(arg->GetType(), typenames), arg->GetName());
     AidlArgument::Direction dir = arg->GetDirection();
     if (dir == AidlArgument::OUT_DIR && arg->GetType().IsArray()) {
-      auto checklen = std::make_shared<IfStatement>();
-      checklen->expression = std::make_shared<Comparison>(v, "==", NULL_VALUE);
-      checklen->statements->Add(std::make_shared<MethodCall>(
+      auto checklen = New<IfStatement>();
+      checklen->expression = New<Comparison>(v, "==", NULL_VALUE);
+      checklen->statements->Add(New<MethodCall>(
           _data, "writeInt",
-          std::vector<std::shared_ptr<Expression>>{std::make_shared<LiteralExpression>("-1")}));
-      checklen->elseif = std::make_shared<IfStatement>();
-      checklen->elseif->statements->Add(std::make_shared<MethodCall>(
+          std::vector<Expression*>{New<LiteralExpression>("-1")}));
+      checklen->elseif = New<IfStatement>();
+      checklen->elseif->statements->Add(New<MethodCall>(
           _data, "writeInt",
-          std::vector<std::shared_ptr<Expression>>{std::make_shared<FieldVariable>(v, "length")}));
+          std::vector<Expression*>{New<FieldVariable>(v, "length")}));
       tryStatement->statements->Add(checklen);
+    } else if (arg->GetType().IsSharedMemory()) {
+      tryStatement->statements->Add(New<MethodCall>(
+          "writeSharedMemoryByteArray", std::vector<Expression*>{_data, v}));
+    } else if (iface.IsUtf8WireString(arg->GetType())) {
+      // A versioned proxy writes UTF-8 once the remote has the version of the
+      // annotation.
+      const string utf8 =
+          options.Version() > 0 ? "getInterfaceVersion() >= VERSION" : "true";
+      tryStatement->statements->Add(New<MethodCall>(
+          "writeUtf8String",
+          std::vector<Expression*>{_data, v, New<LiteralExpression>(utf8)}));
     } else if (dir & AidlArgument::IN_DIR) {
-      generate_write_to_parcel(arg->GetType(), tryStatement->statements, v, _data, false,
+      generate_write_to_parcel(iface, arg->GetType(), tryStatement->statements, v, _data, false,
                                typenames);
     }
   }
 
   // the transact call
-  auto call = std::make_shared<MethodCall>(
+  auto call = New<MethodCall>(
       proxyClass->mRemote, "transact",
-      std::vector<std::shared_ptr<Expression>>{
-          std::make_shared<LiteralExpression>("Stub." + transactCodeName), _data,
+      std::vector<Expression*>{
+          New<LiteralExpression>("Stub." + transactCodeName), _data,
           _reply ? _reply : NULL_VALUE,
-          std::make_shared<LiteralExpression>(oneway ? "android.os.IBinder.FLAG_ONEWAY" : "0")});
-  auto _status = std::make_shared<Variable>("boolean", "_status");
-  tryStatement->statements->Add(std::make_shared<VariableDeclaration>(_status, call));
+          New<LiteralExpression>(oneway ? "android.os.IBinder.FLAG_ONEWAY" : "0")});
+  auto _status = New<Variable>("boolean", "_status");
+  tryStatement->statements->Add(New<VariableDeclaration>(_status, call));
 
   // If the transaction returns false, which means UNKNOWN_TRANSACTION, fall
   // back to the local method in the default impl, if set before.
@@ -693,7 +1218,7 @@ static std::shared_ptr<Method> generate_proxy_method(
     arg_names.emplace_back(arg->GetName());
   }
   bool has_return_type = method.GetType().GetName() != "void";
-  tryStatement->statements->Add(std::make_shared<LiteralStatement>(
+  tryStatement->statements->Add(New<LiteralStatement>(
       android::base::StringPrintf(has_return_type ? "if (!_status && getDefaultImpl() != null) {\n"
                                                     "  return getDefaultImpl().%s(%s);\n"
                                                     "}\n"
@@ -705,7 +1230,7 @@ static std::shared_ptr<Method> generate_proxy_method(
 
   // throw back exceptions.
   if (_reply) {
-    auto ex = std::make_shared<MethodCall>(_reply, "readException");
+    auto ex = New<MethodCall>(_reply, "readException");
     tryStatement->statements->Add(ex);
   }
 
@@ -714,7 +1239,16 @@ static std::shared_ptr<Method> generate_proxy_method(
     // keep this across return value and arguments in order to create the
     // classloader at most once.
     bool is_classloader_created = false;
-    if (_result != nullptr) {
+    const string packed_result = packed_array_name(iface, method.GetType());
+    if (_result != nullptr && iface.IsUtf8WireString(method.GetType())) {
+      tryStatement->statements->Add(New<Assignment>(
+          _result, New<MethodCall>("readUtf8String",
+                                   std::vector<Expression*>{_reply, NULL_VALUE})));
+    } else if (_result != nullptr && !packed_result.empty()) {
+      tryStatement->statements->Add(New<Assignment>(
+          _result, New<MethodCall>("createPacked" + packed_result + "Array",
+                                   std::vector<Expression*>{_reply})));
+    } else if (_result != nullptr) {
       string code;
       CodeWriterPtr writer = CodeWriter::ForString(&code);
       CodeGeneratorContext context{.writer = *(writer.get()),
@@ -725,12 +1259,17 @@ static std::shared_ptr<Method> generate_proxy_method(
                                    .is_classloader_created = &is_classloader_created};
       CreateFromParcelFor(context);
       writer->Close();
-      tryStatement->statements->Add(std::make_shared<LiteralStatement>(code));
+      tryStatement->statements->Add(New<LiteralStatement>(code));
     }
 
     // the out/inout parameters
     for (const std::unique_ptr<AidlArgument>& arg : method.GetArguments()) {
-      if (arg->GetDirection() & AidlArgument::OUT_DIR) {
+      if (const string packed = packed_array_name(iface, arg->GetType());
+          !packed.empty() && (arg->GetDirection() & AidlArgument::OUT_DIR)) {
+        tryStatement->statements->Add(New<MethodCall>(
+            "readPacked" + packed + "Array",
+            std::vector<Expression*>{_reply, New<LiteralExpression>(arg->GetName())}));
+      } else if (arg->GetDirection() & AidlArgument::OUT_DIR) {
         string code;
         CodeWriterPtr writer = CodeWriter::ForString(&code);
         CodeGeneratorContext context{.writer = *(writer.get()),
@@ -741,31 +1280,36 @@ static std::shared_ptr<Method> generate_proxy_method(
                                      .is_classloader_created = &is_classloader_created};
         ReadFromParcelFor(context);
         writer->Close();
-        tryStatement->statements->Add(std::make_shared<LiteralStatement>(code));
+        tryStatement->statements->Add(New<LiteralStatement>(code));
       }
     }
 
-    finallyStatement->statements->Add(std::make_shared<MethodCall>(_reply, "recycle"));
+    finallyStatement->statements->Add(release_parcel("sReusedReplyParcel", _reply));
+  }
+  finallyStatement->statements->Add(release_parcel("sReusedDataParcel", _data));
+  if (options.GenStats()) {
+    finallyStatement->statements->Add(New<LiteralStatement>(
+        StringPrintf("recordStats(sClientStats, %zu, _aidl_stats_start);\n",
+                     method_index(iface, method))));
   }
-  finallyStatement->statements->Add(std::make_shared<MethodCall>(_data, "recycle"));
 
   if (options.GenTraces()) {
-    finallyStatement->statements->Add(std::make_shared<MethodCall>(
-        std::make_shared<LiteralExpression>("android.os.Trace"), "traceEnd",
-        std::vector<std::shared_ptr<Expression>>{
-            std::make_shared<LiteralExpression>("android.os.Trace.TRACE_TAG_AIDL")}));
+    finallyStatement->statements->Add(New<MethodCall>(
+        New<LiteralExpression>("android.os.Trace"), "traceEnd",
+        std::vector<Expression*>{
+            New<LiteralExpression>("android.os.Trace.TRACE_TAG_AIDL")}));
   }
 
   if (_result != nullptr) {
-    proxy->statements->Add(std::make_shared<ReturnStatement>(_result));
+    proxy->statements->Add(New<ReturnStatement>(_result));
   }
 
   return proxy;
 }
 
 static void generate_methods(const AidlInterface& iface, const AidlMethod& method, Class* interface,
-                             std::shared_ptr<StubClass> stubClass,
-                             std::shared_ptr<ProxyClass> proxyClass, int index,
+                             StubClass* stubClass,
+                             ProxyClass* proxyClass, int index,
                              const AidlTypenames& typenames, const Options& options) {
   const bool oneway = method.IsOneway();
 
@@ -774,21 +1318,21 @@ static void generate_methods(const AidlInterface& iface, const AidlMethod& metho
   transactCodeName += method.GetName();
 
   auto transactCode =
-      std::make_shared<Field>(STATIC | FINAL, std::make_shared<Variable>("int", transactCodeName));
+      New<Field>(STATIC | FINAL, New<Variable>("int", transactCodeName));
   transactCode->value =
       StringPrintf("(android.os.IBinder.FIRST_CALL_TRANSACTION + %d)", index);
   stubClass->elements.push_back(transactCode);
 
   // getTransactionName
   if (options.GenTransactionNames()) {
-    auto c = std::make_shared<Case>(transactCodeName);
-    c->statements->Add(std::make_shared<ReturnStatement>(
-        std::make_shared<StringLiteralExpression>(method.GetName())));
+    auto c = New<Case>(transactCodeName);
+    c->statements->Add(New<ReturnStatement>(
+        New<StringLiteralExpression>(method.GetName())));
     stubClass->code_to_method_name_switch->cases.push_back(c);
   }
 
   // == the declaration in the interface ===================================
-  std::shared_ptr<ClassElement> decl;
+  ClassElement* decl;
   if (method.IsUserDefined()) {
     decl = generate_interface_method(method, typenames);
   } else {
@@ -796,13 +1340,13 @@ static void generate_methods(const AidlInterface& iface, const AidlMethod& metho
       std::ostringstream code;
       code << "public int " << kGetInterfaceVersion << "() "
            << "throws android.os.RemoteException;\n";
-      decl = std::make_shared<LiteralClassElement>(code.str());
+      decl = New<LiteralClassElement>(code.str());
     }
     if (method.GetName() == kGetInterfaceHash && !options.Hash().empty()) {
       std::ostringstream code;
       code << "public String " << kGetInterfaceHash << "() "
            << "throws android.os.RemoteException;\n";
-      decl = std::make_shared<LiteralClassElement>(code.str());
+      decl = New<LiteralClassElement>(code.str());
     }
   }
   interface->elements.push_back(decl);
@@ -819,29 +1363,29 @@ static void generate_methods(const AidlInterface& iface, const AidlMethod& metho
     }
   } else {
     if (method.GetName() == kGetInterfaceVersion && options.Version() > 0) {
-      auto c = std::make_shared<Case>(transactCodeName);
+      auto c = New<Case>(transactCodeName);
       std::ostringstream code;
       code << "data.enforceInterface(descriptor);\n"
            << "reply.writeNoException();\n"
            << "reply.writeInt(" << kGetInterfaceVersion << "());\n"
            << "return true;\n";
-      c->statements->Add(std::make_shared<LiteralStatement>(code.str()));
+      c->statements->Add(New<LiteralStatement>(code.str()));
       stubClass->transact_switch->cases.push_back(c);
     }
     if (method.GetName() == kGetInterfaceHash && !options.Hash().empty()) {
-      auto c = std::make_shared<Case>(transactCodeName);
+      auto c = New<Case>(transactCodeName);
       std::ostringstream code;
       code << "data.enforceInterface(descriptor);\n"
            << "reply.writeNoException();\n"
            << "reply.writeString(" << kGetInterfaceHash << "());\n"
            << "return true;\n";
-      c->statements->Add(std::make_shared<LiteralStatement>(code.str()));
+      c->statements->Add(New<LiteralStatement>(code.str()));
       stubClass->transact_switch->cases.push_back(c);
     }
   }
 
   // == the proxy method ===================================================
-  std::shared_ptr<ClassElement> proxy = nullptr;
+  ClassElement* proxy = nullptr;
   if (method.IsUserDefined()) {
     proxy = generate_proxy_method(iface, method, transactCodeName, oneway, proxyClass, typenames,
                                   options);
@@ -874,7 +1418,7 @@ static void generate_methods(const AidlInterface& iface, const AidlMethod& metho
            << "  }\n"
            << "  return mCachedVersion;\n"
            << "}\n";
-      proxy = std::make_shared<LiteralClassElement>(code.str());
+      proxy = New<LiteralClassElement>(code.str());
     }
     if (method.GetName() == kGetInterfaceHash && !options.Hash().empty()) {
       std::ostringstream code;
@@ -903,7 +1447,7 @@ static void generate_methods(const AidlInterface& iface, const AidlMethod& metho
            << "  }\n"
            << "  return mCachedHash;\n"
            << "}\n";
-      proxy = std::make_shared<LiteralClassElement>(code.str());
+      proxy = New<LiteralClassElement>(code.str());
     }
   }
   if (proxy != nullptr) {
@@ -911,90 +1455,186 @@ static void generate_methods(const AidlInterface& iface, const AidlMethod& metho
   }
 }
 
-static void generate_interface_descriptors(std::shared_ptr<StubClass> stub,
-                                           std::shared_ptr<ProxyClass> proxy) {
+static void generate_interface_descriptors(StubClass* stub,
+                                           ProxyClass* proxy) {
   // the interface descriptor transaction handler
-  auto c = std::make_shared<Case>("INTERFACE_TRANSACTION");
-  c->statements->Add(std::make_shared<MethodCall>(
+  auto c = New<Case>("INTERFACE_TRANSACTION");
+  c->statements->Add(New<MethodCall>(
       stub->transact_reply, "writeString",
-      std::vector<std::shared_ptr<Expression>>{stub->get_transact_descriptor(nullptr)}));
-  c->statements->Add(std::make_shared<ReturnStatement>(TRUE_VALUE));
+      std::vector<Expression*>{stub->get_transact_descriptor(nullptr)}));
+  c->statements->Add(New<ReturnStatement>(TRUE_VALUE));
   stub->transact_switch->cases.push_back(c);
 
   // and the proxy-side method returning the descriptor directly
-  auto getDesc = std::make_shared<Method>();
+  auto getDesc = New<Method>();
   getDesc->modifiers = PUBLIC;
   getDesc->returnType = "java.lang.String";
   getDesc->name = "getInterfaceDescriptor";
-  getDesc->statements = std::make_shared<StatementBlock>();
+  getDesc->statements = New<StatementBlock>();
   getDesc->statements->Add(
-      std::make_shared<ReturnStatement>(std::make_shared<LiteralExpression>("DESCRIPTOR")));
+      New<ReturnStatement>(New<LiteralExpression>("DESCRIPTOR")));
   proxy->elements.push_back(getDesc);
 }
 
-// Check whether (some) methods in this interface should be "outlined," that
-// is, have specific onTransact methods for certain cases. Set up StubClass
-// metadata accordingly.
+// The methods in this interface that should be "outlined," that is, have
+// specific onTransact methods for certain cases. compute_outline_methods sets
+// up StubClass metadata accordingly.
 //
 // Outlining will be enabled if the interface has more than outline_threshold
 // methods. In that case, the methods are sorted by number of arguments
 // (so that more "complex" methods come later), and the first non_outline_count
-// number of methods not outlined (are kept in the onTransact() method).
+// number of methods not outlined (are kept in the onTransact() method). With
+// --transaction-profile, they are sorted by decreasing call count first, so
+// that the hottest methods are kept.
 //
 // Requirements: non_outline_count <= outline_threshold.
-static void compute_outline_methods(const AidlInterface* iface,
-                                    const std::shared_ptr<StubClass> stub, size_t outline_threshold,
-                                    size_t non_outline_count) {
+static std::unordered_set<const AidlMethod*> outline_methods_of(const AidlInterface* iface,
+                                                                size_t outline_threshold,
+                                                                size_t non_outline_count,
+                                                                const Options& options) {
   CHECK_LE(non_outline_count, outline_threshold);
   // We'll outline (create sub methods) if there are more than min_methods
   // cases.
-  stub->transact_outline = iface->GetMethods().size() > outline_threshold;
+  if (iface->GetMethods().size() <= outline_threshold) {
+    return {};
+  }
+  std::vector<const AidlMethod*> methods;
+  methods.reserve(iface->GetMethods().size());
+  for (const std::unique_ptr<AidlMethod>& ptr : iface->GetMethods()) {
+    methods.push_back(ptr.get());
+  }
+
+  const string i_name = iface->GetCanonicalName();
+  std::stable_sort(
+      methods.begin(),
+      methods.end(),
+      [&](const AidlMethod* m1, const AidlMethod* m2) {
+        const uint64_t count1 = options.TransactionCount(i_name, m1->GetName());
+        const uint64_t count2 = options.TransactionCount(i_name, m2->GetName());
+        if (count1 != count2) {
+          return count1 > count2;
+        }
+        return m1->GetArguments().size() < m2->GetArguments().size();
+      });
+
+  return std::unordered_set<const AidlMethod*>(methods.begin() + non_outline_count,
+                                               methods.end());
+}
+
+static void compute_outline_methods(const AidlInterface* iface,
+                                    StubClass* stub, const Options& options) {
+  stub->outline_methods = outline_methods_of(iface, options.onTransact_outline_threshold_,
+                                             options.onTransact_non_outline_count_, options);
+  stub->transact_outline = !stub->outline_methods.empty();
   if (stub->transact_outline) {
     stub->all_method_count = iface->GetMethods().size();
-    std::vector<const AidlMethod*> methods;
-    methods.reserve(iface->GetMethods().size());
-    for (const std::unique_ptr<AidlMethod>& ptr : iface->GetMethods()) {
-      methods.push_back(ptr.get());
+  }
+}
+
+// The largest user-defined method id of |iface| when the transactions of
+// |options| are dispatched through a table, or -1. The table is indexed by
+// method id, so it is used only when the ids are dense enough not to waste
+// much of it.
+static int dispatch_table_max_id(const AidlInterface* iface, const Options& options) {
+  if (!options.JavaDispatchTable()) {
+    return -1;
+  }
+  size_t num_methods = 0;
+  int max_id = -1;
+  for (const auto& method : iface->GetMethods()) {
+    if (method->IsUserDefined()) {
+      num_methods++;
+      max_id = std::max(max_id, method->GetId());
+    }
+  }
+  if (num_methods == 0 || static_cast<size_t>(max_id) >= 2 * num_methods + 16) {
+    return -1;
+  }
+  return max_id;
+}
+
+// Set up StubClass to dispatch the transactions of user-defined methods
+// through a table, if options ask for it.
+static void compute_dispatch_table(const AidlInterface* iface,
+                                   StubClass* stub,
+                                   const Options& options) {
+  const int max_id = dispatch_table_max_id(iface, options);
+  if (max_id < 0) {
+    return;
+  }
+  stub->transact_dispatch_table = true;
+  stub->transact_handlers.resize(max_id + 1);
+  stub->transact_outline = true;
+  stub->all_method_count = iface->GetMethods().size();
+  stub->outline_methods.clear();
+  for (const auto& method : iface->GetMethods()) {
+    if (method->IsUserDefined()) {
+      stub->outline_methods.insert(method.get());
     }
+  }
+}
 
-    std::stable_sort(
-        methods.begin(),
-        methods.end(),
-        [](const AidlMethod* m1, const AidlMethod* m2) {
-          return m1->GetArguments().size() < m2->GetArguments().size();
-        });
+std::unordered_set<const AidlMethod*> OutlinedMethods(const AidlInterface& iface,
+                                                      const Options& options) {
+  if (dispatch_table_max_id(&iface, options) >= 0) {
+    std::unordered_set<const AidlMethod*> methods;
+    for (const auto& method : iface.GetMethods()) {
+      if (method->IsUserDefined()) {
+        methods.insert(method.get());
+      }
+    }
+    return methods;
+  }
+  return outline_methods_of(&iface, options.onTransact_outline_threshold_,
+                            options.onTransact_non_outline_count_, options);
+}
 
-    stub->outline_methods.insert(methods.begin() + non_outline_count,
-                                 methods.end());
+// Orders the cases of the onTransact switch of |stub| by decreasing count in
+// --transaction-profile. Called before StubClass::finish() adds the default
+// case.
+static void order_stub_cases(const AidlInterface& iface, StubClass* stub,
+                             const Options& options) {
+  std::map<string, uint64_t> counts;
+  for (const auto& method : iface.GetMethods()) {
+    counts["TRANSACTION_" + method->GetName()] =
+        options.TransactionCount(iface.GetCanonicalName(), method->GetName());
   }
+  auto count_of = [&counts](const Case* c) -> uint64_t {
+    auto it = c->cases.empty() ? counts.end() : counts.find(c->cases.front());
+    return it != counts.end() ? it->second : 0;
+  };
+  std::vector<Case*>& cases = stub->transact_switch->cases;
+  std::stable_sort(cases.begin(), cases.end(), [&](const Case* c1, const Case* c2) {
+    return count_of(c1) > count_of(c2);
+  });
 }
 
-static shared_ptr<ClassElement> generate_default_impl_method(const AidlMethod& method,
-                                                             const AidlTypenames& typenames) {
-  auto default_method = std::make_shared<Method>();
+static ClassElement* generate_default_impl_method(const AidlMethod& method,
+                                                  const AidlTypenames& typenames) {
+  auto default_method = New<Method>();
   default_method->comment = method.GetComments();
   default_method->modifiers = PUBLIC | OVERRIDE;
   default_method->returnType = JavaSignatureOf(method.GetType(), typenames);
   default_method->name = method.GetName();
-  default_method->statements = std::make_shared<StatementBlock>();
+  default_method->statements = New<StatementBlock>();
   for (const auto& arg : method.GetArguments()) {
     default_method->parameters.push_back(
-        std::make_shared<Variable>(JavaSignatureOf(arg->GetType(), typenames), arg->GetName()));
+        New<Variable>(JavaSignatureOf(arg->GetType(), typenames), arg->GetName()));
   }
   default_method->exceptions.push_back("android.os.RemoteException");
 
   if (method.GetType().GetName() != "void") {
     const string& defaultValue = DefaultJavaValueOf(method.GetType(), typenames);
     default_method->statements->Add(
-        std::make_shared<LiteralStatement>(StringPrintf("return %s;\n", defaultValue.c_str())));
+        New<LiteralStatement>(StringPrintf("return %s;\n", defaultValue.c_str())));
   }
   return default_method;
 }
 
-static shared_ptr<Class> generate_default_impl_class(const AidlInterface& iface,
-                                                     const AidlTypenames& typenames,
-                                                     const Options& options) {
-  auto default_class = std::make_shared<Class>();
+static Class* generate_default_impl_class(const AidlInterface& iface,
+                                          const AidlTypenames& typenames,
+                                          const Options& options) {
+  auto default_class = New<Class>();
   default_class->comment = "/** Default implementation for " + iface.GetName() + ". */";
   default_class->modifiers = PUBLIC | STATIC;
   default_class->what = Class::CLASS;
@@ -1017,7 +1657,7 @@ static shared_ptr<Class> generate_default_impl_class(const AidlInterface& iface,
              << "public int " << kGetInterfaceVersion << "() {\n"
              << "  return 0;\n"
              << "}\n";
-        default_class->elements.emplace_back(std::make_shared<LiteralClassElement>(code.str()));
+        default_class->elements.emplace_back(New<LiteralClassElement>(code.str()));
       }
       if (m->GetName() == kGetInterfaceHash && !options.Hash().empty()) {
         std::ostringstream code;
@@ -1025,16 +1665,16 @@ static shared_ptr<Class> generate_default_impl_class(const AidlInterface& iface,
              << "public String " << kGetInterfaceHash << "() {\n"
              << "  return \"\";\n"
              << "}\n";
-        default_class->elements.emplace_back(std::make_shared<LiteralClassElement>(code.str()));
+        default_class->elements.emplace_back(New<LiteralClassElement>(code.str()));
       }
     }
   }
 
   default_class->elements.emplace_back(
-      std::make_shared<LiteralClassElement>("@Override\n"
-                                            "public android.os.IBinder asBinder() {\n"
-                                            "  return null;\n"
-                                            "}\n"));
+      New<LiteralClassElement>("@Override\n"
+                               "public android.os.IBinder asBinder() {\n"
+                               "  return null;\n"
+                               "}\n"));
 
   return default_class;
 }
@@ -1060,12 +1700,12 @@ std::unique_ptr<Class> generate_binder_interface_class(const AidlInterface* ifac
          << " * that the remote object is implementing.\n"
          << " */\n"
          << "public static final int VERSION = " << options.Version() << ";\n";
-    interface->elements.emplace_back(std::make_shared<LiteralClassElement>(code.str()));
+    interface->elements.emplace_back(New<LiteralClassElement>(code.str()));
   }
   if (!options.Hash().empty()) {
     std::ostringstream code;
     code << "public static final String HASH = \"" << options.Hash() << "\";\n";
-    interface->elements.emplace_back(std::make_shared<LiteralClassElement>(code.str()));
+    interface->elements.emplace_back(New<LiteralClassElement>(code.str()));
   }
 
   // the default impl class
@@ -1073,16 +1713,31 @@ std::unique_ptr<Class> generate_binder_interface_class(const AidlInterface* ifac
   interface->elements.emplace_back(default_impl);
 
   // the stub inner class
-  auto stub = std::make_shared<StubClass>(iface, options);
+  auto stub = New<StubClass>(iface, options);
   interface->elements.push_back(stub);
 
-  compute_outline_methods(iface,
-                          stub,
-                          options.onTransact_outline_threshold_,
-                          options.onTransact_non_outline_count_);
+  compute_outline_methods(iface, stub, options);
+  compute_dispatch_table(iface, stub, options);
+
+  if (options.GenStats()) {
+    stub->elements.emplace_back(
+        New<LiteralClassElement>(generate_stats_helpers(*iface)));
+  }
+  if (HasSharedMemoryArguments(*iface)) {
+    stub->elements.emplace_back(New<LiteralClassElement>(kJavaSharedMemoryHelpers));
+  }
+  if (HasUtf8WireStrings(*iface)) {
+    stub->elements.emplace_back(New<LiteralClassElement>(kJavaUtf8StringHelpers));
+  }
+  if (HasPackedWireArrays(*iface)) {
+    stub->elements.emplace_back(New<LiteralClassElement>(kJavaPackedArrayHelpers));
+  }
+  if (HasCallContextMethods(*iface)) {
+    interface->elements.emplace_back(New<LiteralClassElement>(kJavaCallContextClass));
+  }
 
   // the proxy inner class
-  auto proxy = std::make_shared<ProxyClass>(iface, options);
+  auto proxy = New<ProxyClass>(iface, options);
   stub->elements.push_back(proxy);
 
   // stub and proxy support for getInterfaceDescriptor()
@@ -1094,7 +1749,7 @@ std::unique_ptr<Class> generate_binder_interface_class(const AidlInterface* ifac
     auto comment = constant->GetType().GetComments();
     if (comment.length() != 0) {
       auto code = StringPrintf("%s\n", comment.c_str());
-      interface->elements.push_back(std::make_shared<LiteralClassElement>(code));
+      interface->elements.push_back(New<LiteralClassElement>(code));
     }
     switch (value.GetType()) {
       case AidlConstantValue::Type::STRING: {
@@ -1121,6 +1776,9 @@ std::unique_ptr<Class> generate_binder_interface_class(const AidlInterface* ifac
     generate_methods(*iface, *item, interface.get(), stub, proxy, item->GetId(), typenames,
                      options);
   }
+  if (options.HasTransactionProfile()) {
+    order_stub_cases(*iface, stub, options);
+  }
 
   // additional static methods for the default impl set/get to the
   // stub class. Can't add them to the interface as the generated java files
@@ -1129,7 +1787,7 @@ std::unique_ptr<Class> generate_binder_interface_class(const AidlInterface* ifac
   // TODO(b/111417145) make this conditional depending on the Java language
   // version requested
   const string i_name = iface->GetCanonicalName();
-  stub->elements.emplace_back(std::make_shared<LiteralClassElement>(
+  stub->elements.emplace_back(New<LiteralClassElement>(
       StringPrintf("public static boolean setDefaultImpl(%s impl) {\n"
                    "  // Only one user of this interface can use this function\n"
                    "  // at a time. This is a heuristic to detect if two different\n"
@@ -1145,14 +1803,14 @@ std::unique_ptr<Class> generate_binder_interface_class(const AidlInterface* ifac
                    "}\n",
                    i_name.c_str())));
   stub->elements.emplace_back(
-      std::make_shared<LiteralClassElement>(StringPrintf("public static %s getDefaultImpl() {\n"
-                                                         "  return Stub.Proxy.sDefaultImpl;\n"
-                                                         "}\n",
-                                                         i_name.c_str())));
+      New<LiteralClassElement>(StringPrintf("public static %s getDefaultImpl() {\n"
+                                            "  return Stub.Proxy.sDefaultImpl;\n"
+                                            "}\n",
+                                            i_name.c_str())));
 
   // the static field is defined in the proxy class, not in the interface class
   // because all fields in an interface class are by default final.
-  proxy->elements.emplace_back(std::make_shared<LiteralClassElement>(
+  proxy->elements.emplace_back(New<LiteralClassElement>(
       StringPrintf("public static %s sDefaultImpl;\n", i_name.c_str())));
 
   stub->finish();
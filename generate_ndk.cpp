@@ -22,6 +22,8 @@
 #include "aidl_to_ndk.h"
 
 #include <android-base/logging.h>
+#include <algorithm>
+#include <set>
 
 namespace android {
 namespace aidl {
@@ -34,8 +36,15 @@ static constexpr const char* kHash = "hash";
 static constexpr const char* kCachedVersion = "_aidl_cached_version";
 static constexpr const char* kCachedHash = "_aidl_cached_hash";
 static constexpr const char* kCachedHashMutex = "_aidl_cached_hash_mutex";
+static constexpr const char* kCachedHashReady = "_aidl_cached_hash_ready";
 
 using namespace internals;
+
+// The binder class of the interface, which --lazy-descriptors defines on
+// first use.
+static std::string ClazzOf(const Options& options) {
+  return options.LazyDescriptors() ? std::string(kClazz) + "()" : kClazz;
+}
 using cpp::ClassNames;
 
 void GenerateNdkInterface(const string& output_file, const Options& options,
@@ -161,18 +170,27 @@ void LeaveNdkNamespace(CodeWriter& out, const AidlDefinedType& defined_type) {
   out << "}  // namespace aidl\n";
 }
 
-static void StatusCheckGoto(CodeWriter& out) {
-  out << "if (_aidl_ret_status != STATUS_OK) goto _aidl_error;\n\n";
+// With --cold-error-paths, the checks are expected to pass.
+static std::string StatusNotOk(const Options& options) {
+  return options.ColdErrorPaths() ? "__builtin_expect(_aidl_ret_status != STATUS_OK, 0)"
+                                  : "_aidl_ret_status != STATUS_OK";
+}
+static void StatusCheckGoto(CodeWriter& out, const Options& options) {
+  out << "if (" << StatusNotOk(options) << ") goto _aidl_error;\n\n";
 }
-static void StatusCheckBreak(CodeWriter& out) {
-  out << "if (_aidl_ret_status != STATUS_OK) break;\n\n";
+static void StatusCheckBreak(CodeWriter& out, const Options& options) {
+  out << "if (" << StatusNotOk(options) << ") break;\n\n";
 }
-static void StatusCheckReturn(CodeWriter& out) {
-  out << "if (_aidl_ret_status != STATUS_OK) return _aidl_ret_status;\n\n";
+static void StatusCheckReturn(CodeWriter& out, const Options& options) {
+  out << "if (" << StatusNotOk(options) << ") return _aidl_ret_status;\n\n";
 }
 
-static void GenerateHeaderIncludes(CodeWriter& out, const AidlTypenames& types,
-                                   const AidlDefinedType& defined_type) {
+// Includes the headers of the types in |types|, but declares those in
+// |forward_declared| instead.
+static void GenerateHeaderIncludes(
+    CodeWriter& out, const AidlTypenames& types, const AidlDefinedType& defined_type,
+    const std::vector<const AidlDefinedType*>& forward_declared = {}) {
+  out << "#include <array>\n";
   out << "#include <cstdint>\n";
   out << "#include <memory>\n";
   out << "#include <optional>\n";
@@ -184,6 +202,10 @@ static void GenerateHeaderIncludes(CodeWriter& out, const AidlTypenames& types,
 
   types.IterateTypes([&](const AidlDefinedType& other_defined_type) {
     if (&other_defined_type == &defined_type) return;
+    if (std::find(forward_declared.begin(), forward_declared.end(), &other_defined_type) !=
+        forward_declared.end()) {
+      return;
+    }
 
     if (other_defined_type.AsInterface() != nullptr) {
       out << "#include <"
@@ -200,10 +222,483 @@ static void GenerateHeaderIncludes(CodeWriter& out, const AidlTypenames& types,
       AIDL_FATAL(defined_type) << "Unrecognized type.";
     }
   });
+  for (const AidlDefinedType* other_defined_type : forward_declared) {
+    EnterNdkNamespace(out, *other_defined_type);
+    out << "class " << other_defined_type->GetName() << ";\n";
+    LeaveNdkNamespace(out, *other_defined_type);
+  }
+}
+// Payloads of @SharedMemory arguments above the threshold go through a memfd
+// region, in the wire format of the other backends: an int32 0 followed by the
+// vector, or an int32 1 followed by the length and a ParcelFileDescriptor.
+// memfd_create needs API 30, so older clients always send inline.
+static const char* kSharedMemoryHelpers =
+    R"(namespace {
+
+constexpr size_t kSharedMemoryThreshold = 16 * 1024;
+
+binder_status_t WriteSharedMemoryByteVector(AParcel* parcel, const std::vector<int8_t>& value) {
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 30
+  if (value.size() > kSharedMemoryThreshold && value.size() <= INT32_MAX) {
+    ::ndk::ScopedFileDescriptor fd(memfd_create("aidl", MFD_CLOEXEC));
+    void* addr = MAP_FAILED;
+    if (fd.get() >= 0 && ftruncate(fd.get(), value.size()) == 0) {
+      addr = mmap(nullptr, value.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+    }
+    if (addr != MAP_FAILED) {
+      memcpy(addr, value.data(), value.size());
+      munmap(addr, value.size());
+      binder_status_t status = AParcel_writeInt32(parcel, 1);
+      if (status != STATUS_OK) return status;
+      status = AParcel_writeInt32(parcel, static_cast<int32_t>(value.size()));
+      if (status != STATUS_OK) return status;
+      return ::ndk::AParcel_writeRequiredParcelFileDescriptor(parcel, fd);
+    }
+  }
+#endif
+  binder_status_t status = AParcel_writeInt32(parcel, 0);
+  if (status != STATUS_OK) return status;
+  return ::ndk::AParcel_writeVector(parcel, value);
+}
+
+binder_status_t ReadSharedMemoryByteVector(const AParcel* parcel, std::vector<int8_t>* value) {
+  int32_t kind;
+  binder_status_t status = AParcel_readInt32(parcel, &kind);
+  if (status != STATUS_OK) return status;
+  if (kind == 0) return ::ndk::AParcel_readVector(parcel, value);
+  int32_t size;
+  status = AParcel_readInt32(parcel, &size);
+  if (status != STATUS_OK) return status;
+  if (size <= 0) return STATUS_BAD_VALUE;
+  ::ndk::ScopedFileDescriptor region;
+  status = ::ndk::AParcel_readRequiredParcelFileDescriptor(parcel, &region);
+  if (status != STATUS_OK) return status;
+  // A region smaller than the size would fault when read.
+  struct stat st;
+  if (fstat(region.get(), &st) != 0 || (S_ISREG(st.st_mode) && st.st_size < size)) {
+    return STATUS_BAD_VALUE;
+  }
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, region.get(), 0);
+  if (addr == MAP_FAILED) return STATUS_NO_MEMORY;
+  const int8_t* begin = static_cast<const int8_t*>(addr);
+  value->assign(begin, begin + size);
+  munmap(addr, size);
+  return STATUS_OK;
+}
+
+}  // namespace
+)";
+
+// With --bulk-fd-arrays, ParcelFileDescriptor arrays are read and written
+// in a loop rather than through the element callbacks of
+// AParcel_{read,write}ParcelableArray, in the same format. The vector read
+// into is resized once, keeping its capacity. Bounding its size needs
+// AParcel_getDataSize, from API 31.
+static const char* kFileDescriptorArrayHelpers =
+    R"(namespace {
+
+binder_status_t WriteFileDescriptorArray(AParcel* parcel,
+                                         const std::vector<::ndk::ScopedFileDescriptor>& value) {
+  if (value.size() > INT32_MAX) return STATUS_BAD_VALUE;
+  binder_status_t status = AParcel_writeInt32(parcel, static_cast<int32_t>(value.size()));
+  for (size_t i = 0; i < value.size() && status == STATUS_OK; i++) {
+    status = ::ndk::AParcel_writeRequiredParcelFileDescriptor(parcel, value[i]);
+  }
+  return status;
+}
+
+binder_status_t ReadFileDescriptorArray(const AParcel* parcel,
+                                        std::vector<::ndk::ScopedFileDescriptor>* value) {
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 31
+  int32_t size;
+  binder_status_t status = AParcel_readInt32(parcel, &size);
+  if (status != STATUS_OK) return status;
+  if (size < 0) return STATUS_UNEXPECTED_NULL;
+  // Each entry starts with its non-null marker.
+  const size_t avail = AParcel_getDataSize(parcel) - AParcel_getDataPosition(parcel);
+  if (static_cast<size_t>(size) > avail / 4) return STATUS_BAD_VALUE;
+  value->resize(size);
+  for (auto& entry : *value) {
+    status = ::ndk::AParcel_readRequiredParcelFileDescriptor(parcel, &entry);
+    if (status != STATUS_OK) return status;
+  }
+  return STATUS_OK;
+#else
+  return ::ndk::AParcel_readVector(parcel, value);
+#endif
+}
+
+}  // namespace
+)";
+
+// Whether |type| is read and written with the helpers of
+// kFileDescriptorArrayHelpers, with --bulk-fd-arrays.
+static bool IsBulkFileDescriptorArray(const Options& options, const AidlTypeSpecifier& type) {
+  if (!options.BulkFdArrays() || type.IsNullable() || !(type.IsArray() || type.IsGeneric())) {
+    return false;
+  }
+  const AidlTypeSpecifier& element = type.IsGeneric() ? *type.GetTypeParameters().at(0) : type;
+  return element.GetName() == "ParcelFileDescriptor";
+}
+
+static bool UsesFileDescriptorArrayHelpers(const Options& options, const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (IsBulkFileDescriptorArray(options, method->GetType())) {
+      return true;
+    }
+    for (const auto& arg : method->GetArguments()) {
+      if (IsBulkFileDescriptorArray(options, arg->GetType())) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// The Strings of a @Utf8Strings interface, in the format of the C++ backend:
+// as in other interfaces, or as kUtf8StringTag and a byte array of their
+// UTF-8 encoding, which the reader takes as it is.
+static const char* kUtf8StringHelpers =
+    R"(namespace {
+
+constexpr int32_t kUtf8StringTag = -2;
+
+binder_status_t WriteUtf8String(AParcel* parcel, const std::string& value, bool utf8) {
+  if (!utf8) return ::ndk::AParcel_writeString(parcel, value);
+  if (value.size() > INT32_MAX) return STATUS_BAD_VALUE;
+  binder_status_t status = AParcel_writeInt32(parcel, kUtf8StringTag);
+  if (status != STATUS_OK) return status;
+  return AParcel_writeByteArray(parcel, reinterpret_cast<const int8_t*>(value.data()),
+                                static_cast<int32_t>(value.size()));
+}
+
+binder_status_t WriteUtf8String(AParcel* parcel, const std::optional<std::string>& value,
+                                bool utf8) {
+  return value ? WriteUtf8String(parcel, *value, utf8) : ::ndk::AParcel_writeString(parcel, value);
+}
+
+// Reads a String written as UTF-8, or leaves the parcel where it was with
+// *tagged set to false.
+binder_status_t ReadUtf8Bytes(const AParcel* parcel, std::string* value, bool* tagged) {
+  const int32_t start = AParcel_getDataPosition(parcel);
+  int32_t tag;
+  binder_status_t status = AParcel_readInt32(parcel, &tag);
+  if (status != STATUS_OK) return status;
+  *tagged = tag == kUtf8StringTag;
+  if (!*tagged) return AParcel_setDataPosition(parcel, start);
+  return AParcel_readByteArray(parcel, value, [](void* data, int32_t length, int8_t** buffer) {
+    if (length < 0) return false;
+    std::string* bytes = static_cast<std::string*>(data);
+    bytes->resize(length);
+    *buffer = reinterpret_cast<int8_t*>(bytes->data());
+    return true;
+  });
+}
+
+binder_status_t ReadUtf8String(const AParcel* parcel, std::string* value, bool* utf8) {
+  bool tagged;
+  binder_status_t status = ReadUtf8Bytes(parcel, value, &tagged);
+  if (status != STATUS_OK) return status;
+  if (!tagged) return ::ndk::AParcel_readString(parcel, value);
+  if (utf8 != nullptr) *utf8 = true;
+  return STATUS_OK;
+}
+
+binder_status_t ReadUtf8String(const AParcel* parcel, std::optional<std::string>* value,
+                               bool* utf8) {
+  std::string bytes;
+  bool tagged;
+  binder_status_t status = ReadUtf8Bytes(parcel, &bytes, &tagged);
+  if (status != STATUS_OK) return status;
+  if (!tagged) return ::ndk::AParcel_readString(parcel, value);
+  if (utf8 != nullptr) *utf8 = true;
+  *value = std::move(bytes);
+  return STATUS_OK;
+}
+
+}  // namespace
+)";
+
+// The boolean[] and char[] of a @PackedArrays interface, in the format of the
+// C++ backend. Chars go through AParcel_{read,write}ByteArray as they are.
+static const char* kPackedArrayHelpers =
+    R"(namespace {
+
+binder_status_t WritePackedElements(AParcel* parcel, const std::vector<bool>& value) {
+  std::vector<int8_t> bytes((value.size() + 7) / 8);
+  for (size_t i = 0; i < value.size(); i += 8) {
+    uint8_t byte = 0;
+    for (size_t bit = 0; bit < 8 && i + bit < value.size(); bit++) {
+      byte |= static_cast<uint8_t>(value[i + bit]) << bit;
+    }
+    bytes[i / 8] = static_cast<int8_t>(byte);
+  }
+  return AParcel_writeByteArray(parcel, bytes.data(), static_cast<int32_t>(bytes.size()));
+}
+
+binder_status_t WritePackedElements(AParcel* parcel, const std::vector<char16_t>& value) {
+  if (value.size() > INT32_MAX / sizeof(char16_t)) return STATUS_BAD_VALUE;
+  return AParcel_writeByteArray(parcel, reinterpret_cast<const int8_t*>(value.data()),
+                                static_cast<int32_t>(value.size() * sizeof(char16_t)));
+}
+
+template <typename T>
+binder_status_t WritePackedArray(AParcel* parcel, const std::vector<T>& value) {
+  if (value.size() > INT32_MAX) return STATUS_BAD_VALUE;
+  binder_status_t status = AParcel_writeInt32(parcel, static_cast<int32_t>(value.size()));
+  if (status != STATUS_OK) return status;
+  return WritePackedElements(parcel, value);
+}
+
+template <typename T>
+binder_status_t WritePackedArray(AParcel* parcel, const std::optional<std::vector<T>>& value) {
+  return value ? WritePackedArray(parcel, *value) : AParcel_writeInt32(parcel, -1);
+}
+
+// The allocators only take a byte array of the size of the elements.
+template <typename T>
+struct PackedRead {
+  std::vector<T>* elements;
+  uint64_t size;
+};
+
+binder_status_t ReadPackedElements(const AParcel* parcel, int32_t count,
+                                   std::vector<bool>* value) {
+  std::vector<int8_t> bytes;
+  PackedRead<int8_t> read{&bytes, (static_cast<uint64_t>(count) + 7) / 8};
+  binder_status_t status =
+      AParcel_readByteArray(parcel, &read, [](void* data, int32_t length, int8_t** buffer) {
+        auto* read = static_cast<PackedRead<int8_t>*>(data);
+        if (length < 0 || static_cast<uint64_t>(length) != read->size) return false;
+        read->elements->resize(length);
+        *buffer = read->elements->data();
+        return true;
+      });
+  if (status != STATUS_OK) return status;
+  value->resize(count);
+  for (size_t i = 0; i < value->size(); i++) {
+    (*value)[i] = (static_cast<uint8_t>(bytes[i / 8]) >> (i % 8)) & 1;
+  }
+  return STATUS_OK;
+}
+
+binder_status_t ReadPackedElements(const AParcel* parcel, int32_t count,
+                                   std::vector<char16_t>* value) {
+  PackedRead<char16_t> read{value, static_cast<uint64_t>(count) * sizeof(char16_t)};
+  return AParcel_readByteArray(parcel, &read, [](void* data, int32_t length, int8_t** buffer) {
+    auto* read = static_cast<PackedRead<char16_t>*>(data);
+    if (length < 0 || static_cast<uint64_t>(length) != read->size) return false;
+    read->elements->resize(length / sizeof(char16_t));
+    *buffer = reinterpret_cast<int8_t*>(read->elements->data());
+    return true;
+  });
+}
+
+template <typename T>
+binder_status_t ReadPackedArray(const AParcel* parcel, std::vector<T>* value) {
+  int32_t count;
+  binder_status_t status = AParcel_readInt32(parcel, &count);
+  if (status != STATUS_OK) return status;
+  if (count < 0) return STATUS_UNEXPECTED_NULL;
+  return ReadPackedElements(parcel, count, value);
+}
+
+template <typename T>
+binder_status_t ReadPackedArray(const AParcel* parcel, std::optional<std::vector<T>>* value) {
+  int32_t count;
+  binder_status_t status = AParcel_readInt32(parcel, &count);
+  if (status != STATUS_OK) return status;
+  if (count < 0) {
+    value->reset();
+    return STATUS_OK;
+  }
+  if (!value->has_value()) value->emplace();
+  return ReadPackedElements(parcel, count, &**value);
+}
+
+}  // namespace
+)";
+
+static bool UsesPackedArrayHelpers(const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (iface.IsPackedWireArray(method->GetType())) {
+      return true;
+    }
+    for (const auto& arg : method->GetArguments()) {
+      if (iface.IsPackedWireArray(arg->GetType())) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Arrays and Lists of String and of parcelables are read and written in a
+// loop rather than through the allocator and element callbacks of
+// AParcel_{read,write}{String,Parcelable}Array, in the same format. The
+// vector read into is resized once, keeping its capacity. Bounding its size
+// needs AParcel_getDataSize, from API 31.
+static const char* kElementVectorHelpers =
+    R"(namespace {
+
+inline binder_status_t WriteVectorElement(AParcel* parcel, const std::string& value) {
+  return ::ndk::AParcel_writeString(parcel, value);
 }
-static void GenerateSourceIncludes(CodeWriter& out, const AidlTypenames& types,
-                                   const AidlDefinedType& /*defined_type*/) {
+
+inline binder_status_t WriteVectorElement(AParcel* parcel,
+                                          const std::optional<std::string>& value) {
+  return ::ndk::AParcel_writeString(parcel, value);
+}
+
+template <typename P>
+binder_status_t WriteVectorElement(AParcel* parcel, const P& value) {
+  return ::ndk::AParcel_writeParcelable(parcel, value);
+}
+
+inline binder_status_t ReadVectorElement(const AParcel* parcel, std::string* value) {
+  return ::ndk::AParcel_readString(parcel, value);
+}
+
+inline binder_status_t ReadVectorElement(const AParcel* parcel, std::optional<std::string>* value) {
+  return ::ndk::AParcel_readString(parcel, value);
+}
+
+template <typename P>
+binder_status_t ReadVectorElement(const AParcel* parcel, P* value) {
+  return ::ndk::AParcel_readParcelable(parcel, value);
+}
+
+template <typename T>
+binder_status_t WriteElementVector(AParcel* parcel, const std::vector<T>& value) {
+  if (value.size() > INT32_MAX) return STATUS_BAD_VALUE;
+  binder_status_t status = AParcel_writeInt32(parcel, static_cast<int32_t>(value.size()));
+  for (size_t i = 0; i < value.size() && status == STATUS_OK; i++) {
+    status = WriteVectorElement(parcel, value[i]);
+  }
+  return status;
+}
+
+template <typename T>
+binder_status_t WriteElementVector(AParcel* parcel, const std::optional<std::vector<T>>& value) {
+  return value ? WriteElementVector(parcel, *value) : AParcel_writeInt32(parcel, -1);
+}
+
+template <typename T>
+binder_status_t ReadVectorElements(const AParcel* parcel, int32_t size, std::vector<T>* value) {
+  // Each element starts with its length or its non-null marker.
+  const size_t avail = AParcel_getDataSize(parcel) - AParcel_getDataPosition(parcel);
+  if (static_cast<size_t>(size) > avail / 4) return STATUS_BAD_VALUE;
+  value->resize(size);
+  for (T& element : *value) {
+    binder_status_t status = ReadVectorElement(parcel, &element);
+    if (status != STATUS_OK) return status;
+  }
+  return STATUS_OK;
+}
+
+template <typename T>
+binder_status_t ReadElementVector(const AParcel* parcel, std::vector<T>* value) {
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 31
+  int32_t size;
+  binder_status_t status = AParcel_readInt32(parcel, &size);
+  if (status != STATUS_OK) return status;
+  if (size < 0) return STATUS_UNEXPECTED_NULL;
+  return ReadVectorElements(parcel, size, value);
+#else
+  return ::ndk::AParcel_readVector(parcel, value);
+#endif
+}
+
+template <typename T>
+binder_status_t ReadElementVector(const AParcel* parcel, std::optional<std::vector<T>>* value) {
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 31
+  int32_t size;
+  binder_status_t status = AParcel_readInt32(parcel, &size);
+  if (status != STATUS_OK) return status;
+  if (size < 0) {
+    value->reset();
+    return STATUS_OK;
+  }
+  if (!value->has_value()) value->emplace();
+  return ReadVectorElements(parcel, size, &**value);
+#else
+  return ::ndk::AParcel_readVector(parcel, value);
+#endif
+}
+
+}  // namespace
+)";
+
+// Whether a method of |iface| reads or writes a type with the helpers of
+// kElementVectorHelpers.
+static bool UsesElementVectorHelpers(const AidlTypenames& types, const AidlInterface& iface) {
+  for (const auto& method : iface.GetMethods()) {
+    if (ndk::UsesElementVectorHelpers(types, method->GetType())) {
+      return true;
+    }
+    for (const auto& arg : method->GetArguments()) {
+      if (ndk::UsesElementVectorHelpers(types, arg->GetType())) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool UsesUtf8StringHelpers(const AidlInterface& iface) {
+  return std::any_of(iface.GetMethods().begin(), iface.GetMethods().end(),
+                     [&iface](const auto& method) { return iface.HasUtf8WireStrings(*method); });
+}
+
+// WriteToParcelFor and ReadFromParcelFor for an argument or the return value
+// of a method of |iface|, but with the helpers of kFileDescriptorArrayHelpers,
+// kUtf8StringHelpers and kPackedArrayHelpers where they apply. A String of
+// @Utf8Strings passes |utf8|: whether it is written as UTF-8, or the bool*
+// that the reader sets.
+static void WriteArgToParcel(const Options& options, const AidlInterface& iface,
+                             const CodeGeneratorContext& c, const std::string& utf8) {
+  if (iface.IsUtf8WireString(c.type)) {
+    c.writer << "WriteUtf8String(" << c.parcel << ", " << c.var << ", " << utf8 << ")";
+    return;
+  }
+  if (iface.IsPackedWireArray(c.type)) {
+    c.writer << "WritePackedArray(" << c.parcel << ", " << c.var << ")";
+    return;
+  }
+  if (IsBulkFileDescriptorArray(options, c.type)) {
+    c.writer << "WriteFileDescriptorArray(" << c.parcel << ", " << c.var << ")";
+    return;
+  }
+  WriteToParcelFor(c);
+}
+static void ReadArgFromParcel(const Options& options, const AidlInterface& iface,
+                              const CodeGeneratorContext& c, const std::string& utf8) {
+  if (iface.IsUtf8WireString(c.type)) {
+    c.writer << "ReadUtf8String(" << c.parcel << ", " << c.var << ", " << utf8 << ")";
+    return;
+  }
+  if (iface.IsPackedWireArray(c.type)) {
+    c.writer << "ReadPackedArray(" << c.parcel << ", " << c.var << ")";
+    return;
+  }
+  if (IsBulkFileDescriptorArray(options, c.type)) {
+    c.writer << "ReadFileDescriptorArray(" << c.parcel << ", " << c.var << ")";
+    return;
+  }
+  ReadFromParcelFor(c);
+}
+
+static void GenerateSourceIncludes(
+    CodeWriter& out, const AidlTypenames& types, const AidlDefinedType& /*defined_type*/,
+    const std::vector<const AidlDefinedType*>& forward_declared = {}) {
   out << "#include <android/binder_parcel_utils.h>\n";
+  // The interface header only declares these.
+  for (const AidlDefinedType* other_defined_type : forward_declared) {
+    if (other_defined_type->AsStructuredParcelable() != nullptr) {
+      out << "#include <"
+          << NdkHeaderFile(*other_defined_type, ClassNames::RAW, false /*use_os_sep*/) << ">\n";
+    }
+  }
 
   types.IterateTypes([&](const AidlDefinedType& a_defined_type) {
     if (a_defined_type.AsInterface() != nullptr) {
@@ -273,10 +768,50 @@ static void GenerateConstantDefinitions(CodeWriter& out, const AidlInterface& in
 
 void GenerateSource(CodeWriter& out, const AidlTypenames& types, const AidlInterface& defined_type,
                     const Options& options) {
-  GenerateSourceIncludes(out, types, defined_type);
+  GenerateSourceIncludes(out, types, defined_type,
+                         cpp::ForwardDeclaredTypes(defined_type, types, options));
+  const bool has_shared_memory = cpp::HasSharedMemoryArguments(defined_type);
+  if (has_shared_memory) {
+    out << "#include <cstring>\n";
+    out << "#include <sys/mman.h>\n";
+    out << "#include <sys/stat.h>\n";
+    out << "#include <unistd.h>\n";
+  }
+  if (options.GenTraces()) {
+    out << "#include <android/trace.h>\n";
+  }
+  if (options.GenStats()) {
+    out << "#include <algorithm>\n";
+    out << "#include <cinttypes>\n";
+    out << "#include <stdio.h>\n";
+  }
   out << "\n";
 
   EnterNdkNamespace(out, defined_type);
+  if (has_shared_memory) {
+    out << kSharedMemoryHelpers;
+  }
+  if (UsesFileDescriptorArrayHelpers(options, defined_type)) {
+    out << kFileDescriptorArrayHelpers;
+  }
+  if (UsesUtf8StringHelpers(defined_type)) {
+    out << kUtf8StringHelpers;
+  }
+  if (UsesPackedArrayHelpers(defined_type)) {
+    out << kPackedArrayHelpers;
+  }
+  if (UsesElementVectorHelpers(types, defined_type)) {
+    out << kElementVectorHelpers;
+  }
+  if (options.GenTraces()) {
+    out << "namespace {\n"
+        << "class ScopedTrace {\n"
+        << " public:\n"
+        << "  explicit ScopedTrace(const char* name) { ATrace_beginSection(name); }\n"
+        << "  ~ScopedTrace() { ATrace_endSection(); }\n"
+        << "};\n"
+        << "}  // namespace\n";
+  }
   GenerateClassSource(out, types, defined_type, options);
   GenerateClientSource(out, types, defined_type, options);
   GenerateServerSource(out, types, defined_type, options);
@@ -288,61 +823,170 @@ static std::string MethodId(const AidlMethod& m) {
   return "(FIRST_CALL_TRANSACTION + " + std::to_string(m.GetId()) + " /*" + m.GetName() + "*/)";
 }
 
+// For --optimize-for=size, marshals the arguments of |method| to or from
+// |parcel| with its table.
+static void GenerateArgTableCall(CodeWriter& out, const AidlMethod& method, bool is_server,
+                                 const std::string& parcel) {
+  std::vector<std::string> arg_names;
+  for (const auto& arg : method.GetArguments()) {
+    arg_names.push_back(cpp::BuildVarName(*arg));
+  }
+  // The block keeps the error path from jumping over the initializations.
+  out << "{\n";
+  out.Indent();
+  out << cpp::GenArgTable(method, true /* is_ndk */, is_server, arg_names);
+  out << "_aidl_ret_status = ::android::aidl::" << (is_server ? "readNdkArgs(" : "writeNdkArgs(")
+      << parcel << ", _aidl_arg_codes, " << std::to_string(arg_names.size())
+      << ", _aidl_arg_values);\n";
+  out.Dedent();
+  out << "}\n";
+}
+
+// The status of |status|, a binder_status_t. With --static-ok-status, a
+// successful call gets the status of AStatus_newOk(), which isn't allocated.
+static std::string StatusFrom(const Options& options, const std::string& status) {
+  if (!options.StaticOkStatus()) {
+    return "AStatus_fromStatus(" + status + ")";
+  }
+  return status + " == STATUS_OK ? AStatus_newOk() : AStatus_fromStatus(" + status + ")";
+}
+
 static void GenerateClientMethodDefinition(CodeWriter& out, const AidlTypenames& types,
                                            const AidlInterface& defined_type,
                                            const AidlMethod& method,
                                            const Options& options) {
   const std::string clazz = ClassName(defined_type, ClassNames::CLIENT);
+  const std::string iface = ClassName(defined_type, ClassNames::INTERFACE);
+
+  std::string default_impl_call = iface + "::getDefaultImpl()->" + method.GetName() + "(" +
+                                  NdkArgList(types, method, FormatArgNameOnly) + ")";
+  std::string default_impl_check =
+      "_aidl_ret_status == STATUS_UNKNOWN_TRANSACTION && " + iface + "::getDefaultImpl()";
+  // With --cold-error-paths, the lookup and the fallback are made out of
+  // line. The helper reads the default implementation once, and tells if
+  // there was one.
+  if (options.ColdErrorPaths()) {
+    const std::string helper = "_aidl_defaultImpl_" + method.GetName();
+    std::string params = NdkArgList(types, method, FormatArgForDecl);
+    std::string args = NdkArgList(types, method, FormatArgNameOnly);
+    params += std::string(params.empty() ? "" : ", ") + "::ndk::ScopedAStatus* _aidl_status";
+    args += std::string(args.empty() ? "" : ", ") + "&_aidl_status";
+    out << "static __attribute__((cold, noinline)) bool " << helper << "(" << params << ") {\n";
+    out << "  const std::shared_ptr<" << iface << ">& _aidl_default_impl = " << iface
+        << "::getDefaultImpl();\n";
+    out << "  if (!_aidl_default_impl) return false;\n";
+    out << "  *_aidl_status = _aidl_default_impl->" << method.GetName() << "("
+        << NdkArgList(types, method, FormatArgNameOnly) << ");\n";
+    out << "  return true;\n";
+    out << "}\n";
+    default_impl_check = "__builtin_expect(_aidl_ret_status == STATUS_UNKNOWN_TRANSACTION, 0) && " +
+                         helper + "(" + args + ")";
+    default_impl_call = "_aidl_status";
+  }
 
   out << NdkMethodDecl(types, method, clazz) << " {\n";
   out.Indent();
   out << "binder_status_t _aidl_ret_status = STATUS_OK;\n";
   out << "::ndk::ScopedAStatus _aidl_status;\n";
+  const std::string trace_name = defined_type.GetName() + "::" + method.GetName() + "::ndkClient";
+  if (options.GenTraces()) {
+    out << "ScopedTrace _aidl_trace(\"" << trace_name << "\");\n";
+  }
+  if (options.GenStats()) {
+    out << cpp::GenStatsScope(defined_type, method, false /* isServer */);
+  }
 
   if (method.GetName() == kGetInterfaceHash && !options.Hash().empty()) {
-    out << "const std::lock_guard<std::mutex> lock(" << kCachedHashMutex << ");\n";
-    out << "if (" << kCachedHash << " != \"-1\") {\n";
+    out << "if (" << kCachedHashReady << ".load(std::memory_order_acquire)) {\n";
     out.Indent();
     out << "*_aidl_return = " << kCachedHash << ";\n"
-        << "_aidl_status.set(AStatus_fromStatus(_aidl_ret_status));\n"
+        << "_aidl_status.set(" << StatusFrom(options, "_aidl_ret_status") << ");\n"
         << "return _aidl_status;\n";
     out.Dedent();
     out << "}\n";
   } else if (method.GetName() == kGetInterfaceVersion && options.Version() > 0) {
-    out << "if (" << kCachedVersion << " != -1) {\n";
+    out << "if (int32_t _aidl_version = " << kCachedVersion
+        << ".load(std::memory_order_relaxed); _aidl_version != -1) {\n";
     out.Indent();
-    out << "*_aidl_return = " << kCachedVersion << ";\n"
-        << "_aidl_status.set(AStatus_fromStatus(_aidl_ret_status));\n"
+    out << "*_aidl_return = _aidl_version;\n"
+        << "_aidl_status.set(" << StatusFrom(options, "_aidl_ret_status") << ");\n"
         << "return _aidl_status;\n";
     out.Dedent();
     out << "}\n";
   }
+  // A versioned proxy writes the Strings of @Utf8Strings as UTF-8 once the
+  // remote has the version of the annotation.
+  const bool writes_utf8 = std::any_of(
+      method.GetArguments().begin(), method.GetArguments().end(),
+      [&defined_type](const auto& arg) { return defined_type.IsUtf8WireString(arg->GetType()); });
+  if (writes_utf8 && options.Version() > 0) {
+    out << "int32_t _aidl_remote_version = -1;\n"
+        << "const bool _aidl_utf8 = " << kGetInterfaceVersion
+        << "(&_aidl_remote_version).isOk() && _aidl_remote_version >= "
+        << ClassName(defined_type, ClassNames::INTERFACE) << "::" << kVersion << ";\n";
+  } else if (writes_utf8) {
+    out << "const bool _aidl_utf8 = true;\n";
+  }
   out << "::ndk::ScopedAParcel _aidl_in;\n";
   out << "::ndk::ScopedAParcel _aidl_out;\n";
   out << "\n";
 
   if (options.GenLog()) {
-    out << cpp::GenLogBeforeExecute(ClassName(defined_type, ClassNames::CLIENT), method,
-                                    false /* isServer */, true /* isNdk */);
+    out << cpp::GenLogBeforeExecute(ClassName(defined_type, ClassNames::CLIENT), defined_type,
+                                    method, false /* isServer */, true /* isNdk */);
+  }
+  if (options.GenBinaryLog()) {
+    out << cpp::GenBinaryLogBeforeExecute(defined_type, method, false /* isServer */,
+                                          true /* isNdk */);
   }
 
   out << "_aidl_ret_status = AIBinder_prepareTransaction(asBinder().get(), _aidl_in.getR());\n";
-  StatusCheckGoto(out);
-
-  for (const auto& arg : method.GetArguments()) {
-    const std::string var_name = cpp::BuildVarName(*arg);
+  StatusCheckGoto(out, options);
+
+  if (defined_type.PropagatesCallContext(method)) {
+    out << "_aidl_ret_status = AParcel_writeInt64(_aidl_in.get(), "
+           "::android::aidl::CallContext::current().deadlineNs);\n";
+    StatusCheckGoto(out, options);
+    out << "_aidl_ret_status = AParcel_writeInt32(_aidl_in.get(), "
+           "::android::aidl::CallContext::current().priority);\n";
+    StatusCheckGoto(out, options);
+  }
 
-    if (arg->IsIn()) {
-      out << "_aidl_ret_status = ";
-      const std::string prefix = (arg->IsOut() ? "*" : "");
-      WriteToParcelFor({out, types, arg->GetType(), "_aidl_in.get()", prefix + var_name});
-      out << ";\n";
-      StatusCheckGoto(out);
-    } else if (arg->IsOut() && arg->GetType().IsArray()) {
-      out << "_aidl_ret_status = ::ndk::AParcel_writeVectorSize(_aidl_in.get(), *" << var_name
-          << ");\n";
+  if (cpp::HasArgTable(defined_type, method, options)) {
+    GenerateArgTableCall(out, method, false /* is_server */, "_aidl_in.get()");
+    StatusCheckGoto(out, options);
+  } else {
+    for (const auto& arg : method.GetArguments()) {
+      const std::string var_name = cpp::BuildVarName(*arg);
+
+      if (arg->GetType().IsSharedMemory()) {
+        out << "_aidl_ret_status = WriteSharedMemoryByteVector(_aidl_in.get(), " << var_name
+            << ");\n";
+        StatusCheckGoto(out, options);
+      } else if (arg->IsIn()) {
+        out << "_aidl_ret_status = ";
+        const std::string prefix = (arg->IsOut() ? "*" : "");
+        WriteArgToParcel(options, defined_type,
+                         {out, types, arg->GetType(), "_aidl_in.get()", prefix + var_name},
+                         "_aidl_utf8");
+        out << ";\n";
+        StatusCheckGoto(out, options);
+      } else if (arg->IsOut() && arg->GetType().IsArray()) {
+        out << "_aidl_ret_status = ::ndk::AParcel_writeVectorSize(_aidl_in.get(), *" << var_name
+            << ");\n";
+      }
     }
   }
+  if (options.TraceParcelSizes()) {
+    // ATrace_setCounter is only in API level 29 and later
+    out << "#if !defined(__ANDROID__) || __ANDROID_API__ >= 29\n";
+    out << "ATrace_setCounter(\"" << trace_name
+        << "::dataSize\", AParcel_getDataPosition(_aidl_in.get()));\n";
+    out << "#endif\n";
+  }
+  if (options.GenBinaryLog()) {
+    out << "_aidl_log_data_size = AParcel_getDataPosition(_aidl_in.get());\n";
+  }
   out << "_aidl_ret_status = AIBinder_transact(\n";
   out.Indent();
   out << "asBinder().get(),\n";
@@ -358,59 +1002,90 @@ static void GenerateClientMethodDefinition(CodeWriter& out, const AidlTypenames&
 
   // If the method is not implmented in the server side but the client has
   // provided the default implementation, call it instead of failing hard.
-  const std::string iface = ClassName(defined_type, ClassNames::INTERFACE);
-  out << "if (_aidl_ret_status == STATUS_UNKNOWN_TRANSACTION && ";
-  out << iface << "::getDefaultImpl()) {\n";
+  out << "if (" << default_impl_check << ") {\n";
   out.Indent();
-  out << "return " << iface << "::getDefaultImpl()->" << method.GetName() << "(";
-  out << NdkArgList(types, method, FormatArgNameOnly) << ");\n";
+  out << "return " << default_impl_call << ";\n";
   out.Dedent();
   out << "}\n";
 
-  StatusCheckGoto(out);
+  StatusCheckGoto(out, options);
 
   if (!method.IsOneway()) {
     out << "_aidl_ret_status = AParcel_readStatusHeader(_aidl_out.get(), _aidl_status.getR());\n";
-    StatusCheckGoto(out);
+    StatusCheckGoto(out, options);
 
     out << "if (!AStatus_isOk(_aidl_status.get())) return _aidl_status;\n\n";
   }
 
   if (method.GetType().GetName() != "void") {
     out << "_aidl_ret_status = ";
-    ReadFromParcelFor({out, types, method.GetType(), "_aidl_out.get()", "_aidl_return"});
+    ReadArgFromParcel(options, defined_type,
+                      {out, types, method.GetType(), "_aidl_out.get()", "_aidl_return"},
+                      "nullptr");
     out << ";\n";
-    StatusCheckGoto(out);
+    StatusCheckGoto(out, options);
     if (method.GetName() == kGetInterfaceHash && !options.Hash().empty()) {
+      // Publish the hash once; later calls read it without taking the lock.
+      out << "{\n";
+      out.Indent();
+      out << "const std::lock_guard<std::mutex> lock(" << kCachedHashMutex << ");\n";
+      out << "if (!" << kCachedHashReady << ".load(std::memory_order_relaxed)) {\n";
+      out.Indent();
       out << kCachedHash << " = *_aidl_return;\n";
+      out << kCachedHashReady << ".store(true, std::memory_order_release);\n";
+      out.Dedent();
+      out << "}\n";
+      out.Dedent();
+      out << "}\n";
     } else if (method.GetName() == kGetInterfaceVersion && options.Version() > 0) {
-      out << kCachedVersion << " = *_aidl_return;\n";
+      out << kCachedVersion << ".store(*_aidl_return, std::memory_order_relaxed);\n";
     }
   }
   for (const AidlArgument* arg : method.GetOutArguments()) {
     out << "_aidl_ret_status = ";
-    ReadFromParcelFor({out, types, arg->GetType(), "_aidl_out.get()", cpp::BuildVarName(*arg)});
+    ReadArgFromParcel(options, defined_type,
+                      {out, types, arg->GetType(), "_aidl_out.get()", cpp::BuildVarName(*arg)},
+                      "nullptr");
     out << ";\n";
-    StatusCheckGoto(out);
+    StatusCheckGoto(out, options);
+  }
+
+  if (options.TraceParcelSizes() && !method.IsOneway()) {
+    // Everything has been read, so the position is the size of the reply.
+    out << "#if !defined(__ANDROID__) || __ANDROID_API__ >= 29\n";
+    out << "ATrace_setCounter(\"" << trace_name
+        << "::replySize\", AParcel_getDataPosition(_aidl_out.get()));\n";
+    out << "#endif\n";
   }
 
   out << "_aidl_error:\n";
-  out << "_aidl_status.set(AStatus_fromStatus(_aidl_ret_status));\n";
+  out << "_aidl_status.set(" << StatusFrom(options, "_aidl_ret_status") << ");\n";
   if (options.GenLog()) {
     out << cpp::GenLogAfterExecute(ClassName(defined_type, ClassNames::CLIENT), defined_type,
                                    method, "_aidl_status", "_aidl_return", false /* isServer */,
                                    true /* isNdk */);
   }
+  if (options.GenBinaryLog()) {
+    out << cpp::GenBinaryLogAfterExecute(defined_type, method, false /* isServer */,
+                                         true /* isNdk */);
+  }
   out << "return _aidl_status;\n";
   out.Dedent();
   out << "}\n";
 }
 
-static void GenerateServerCaseDefinition(CodeWriter& out, const AidlTypenames& types,
-                                         const AidlInterface& defined_type,
-                                         const AidlMethod& method, const Options& options) {
-  out << "case " << MethodId(method) << ": {\n";
-  out.Indent();
+// Writes the handling of a transaction of |method|, which breaks out of the
+// enclosing statement when it is done.
+static void GenerateServerCaseBody(CodeWriter& out, const AidlTypenames& types,
+                                   const AidlInterface& defined_type, const AidlMethod& method,
+                                   const Options& options) {
+  if (options.GenTraces()) {
+    out << "ScopedTrace _aidl_trace(\"" << defined_type.GetName() << "::" << method.GetName()
+        << "::ndkServer\");\n";
+  }
+  if (options.GenStats()) {
+    out << cpp::GenStatsScope(defined_type, method, true /* isServer */);
+  }
   for (const auto& arg : method.GetArguments()) {
     out << NdkNameOf(types, arg->GetType(), StorageMode::STACK) << " " << cpp::BuildVarName(*arg)
         << ";\n";
@@ -418,23 +1093,77 @@ static void GenerateServerCaseDefinition(CodeWriter& out, const AidlTypenames& t
   if (method.GetType().GetName() != "void") {
     out << NdkNameOf(types, method.GetType(), StorageMode::STACK) << " _aidl_return;\n";
   }
+  // Whether the Strings of the reply are written as UTF-8, which they are once
+  // the client has written one so. An unversioned peer always does.
+  if (defined_type.HasUtf8WireStrings(method)) {
+    out << "bool _aidl_utf8 = " << (options.Version() == 0 ? "true" : "false") << ";\n";
+  }
   out << "\n";
 
-  for (const auto& arg : method.GetArguments()) {
-    const std::string var_name = cpp::BuildVarName(*arg);
+  // An expired call is answered before its arguments are read.
+  const bool propagates_call_context = defined_type.PropagatesCallContext(method);
+  if (propagates_call_context) {
+    out << "::android::aidl::CallContext _aidl_context;\n";
+    out << "_aidl_ret_status = AParcel_readInt64(_aidl_in, &_aidl_context.deadlineNs);\n";
+    StatusCheckBreak(out, options);
+    out << "_aidl_ret_status = AParcel_readInt32(_aidl_in, &_aidl_context.priority);\n";
+    StatusCheckBreak(out, options);
+    out << "if (_aidl_context.hasExpired()) {\n";
+    out.Indent();
+    if (method.IsOneway()) {
+      out << "_aidl_ret_status = STATUS_OK;\n";
+    } else {
+      out << "_aidl_ret_status = AParcel_writeStatusHeader(_aidl_out, "
+          << "::ndk::ScopedAStatus::fromExceptionCodeWithMessage(EX_ILLEGAL_STATE, \""
+          << method.GetName() << "() missed its deadline\").get());\n";
+    }
+    out << "break;\n";
+    out.Dedent();
+    out << "}\n";
+  }
 
-    if (arg->IsIn()) {
-      out << "_aidl_ret_status = ";
-      ReadFromParcelFor({out, types, arg->GetType(), "_aidl_in", "&" + var_name});
-      out << ";\n";
-      StatusCheckBreak(out);
-    } else if (arg->IsOut() && arg->GetType().IsArray()) {
-      out << "_aidl_ret_status = ::ndk::AParcel_resizeVector(_aidl_in, &" << var_name << ");\n";
+  if (cpp::HasArgTable(defined_type, method, options)) {
+    GenerateArgTableCall(out, method, true /* is_server */, "_aidl_in");
+    StatusCheckBreak(out, options);
+  } else {
+    for (const auto& arg : method.GetArguments()) {
+      const std::string var_name = cpp::BuildVarName(*arg);
+
+      if (arg->GetType().IsSharedMemory()) {
+        out << "_aidl_ret_status = ReadSharedMemoryByteVector(_aidl_in, &" << var_name << ");\n";
+        StatusCheckBreak(out, options);
+      } else if (arg->IsIn()) {
+        out << "_aidl_ret_status = ";
+        ReadArgFromParcel(options, defined_type,
+                          {out, types, arg->GetType(), "_aidl_in", "&" + var_name},
+                          "&_aidl_utf8");
+        out << ";\n";
+        StatusCheckBreak(out, options);
+      } else if (arg->IsOut() && arg->GetType().IsArray()) {
+        out << "_aidl_ret_status = ::ndk::AParcel_resizeVector(_aidl_in, &" << var_name << ");\n";
+      }
     }
   }
+  // The executor makes the call. The kernel has already replied to the
+  // oneway transaction.
+  if (const std::string pool = cpp::DispatchPoolOf(defined_type, method); !pool.empty()) {
+    out << cpp::GenDispatchCall(method, pool, "_aidl_impl", [&](const AidlTypeSpecifier& type) {
+      return NdkNameOf(types, type, StorageMode::STACK);
+    });
+    out << "_aidl_ret_status = STATUS_OK;\n";
+    out << "break;\n";
+    return;
+  }
+  if (propagates_call_context) {
+    out << "::android::aidl::ScopedCallContext _aidl_context_scope(_aidl_context);\n";
+  }
   if (options.GenLog()) {
-    out << cpp::GenLogBeforeExecute(ClassName(defined_type, ClassNames::SERVER), method,
-                                    true /* isServer */, true /* isNdk */);
+    out << cpp::GenLogBeforeExecute(ClassName(defined_type, ClassNames::SERVER), defined_type,
+                                    method, true /* isServer */, true /* isNdk */);
+  }
+  if (options.GenBinaryLog()) {
+    out << cpp::GenBinaryLogBeforeExecute(defined_type, method, true /* isServer */,
+                                          true /* isNdk */);
   }
   out << "::ndk::ScopedAStatus _aidl_status = _aidl_impl->" << method.GetName() << "("
       << NdkArgList(types, method, FormatArgForCall) << ");\n";
@@ -444,39 +1173,94 @@ static void GenerateServerCaseDefinition(CodeWriter& out, const AidlTypenames& t
                                    method, "_aidl_status", "_aidl_return", true /* isServer */,
                                    true /* isNdk */);
   }
+  if (options.GenBinaryLog()) {
+    out << cpp::GenBinaryLogAfterExecute(defined_type, method, true /* isServer */,
+                                         true /* isNdk */);
+  }
   if (method.IsOneway()) {
     // For a oneway transaction, the kernel will have already returned a result. This is for the
     // in-process case when a oneway transaction is parceled/unparceled in the same process.
     out << "_aidl_ret_status = STATUS_OK;\n";
   } else {
     out << "_aidl_ret_status = AParcel_writeStatusHeader(_aidl_out, _aidl_status.get());\n";
-    StatusCheckBreak(out);
+    StatusCheckBreak(out, options);
 
     out << "if (!AStatus_isOk(_aidl_status.get())) break;\n\n";
 
     if (method.GetType().GetName() != "void") {
       out << "_aidl_ret_status = ";
-      WriteToParcelFor({out, types, method.GetType(), "_aidl_out", "_aidl_return"});
+      WriteArgToParcel(options, defined_type,
+                       {out, types, method.GetType(), "_aidl_out", "_aidl_return"}, "_aidl_utf8");
       out << ";\n";
-      StatusCheckBreak(out);
+      StatusCheckBreak(out, options);
     }
     for (const AidlArgument* arg : method.GetOutArguments()) {
       out << "_aidl_ret_status = ";
-      WriteToParcelFor({out, types, arg->GetType(), "_aidl_out", cpp::BuildVarName(*arg)});
+      WriteArgToParcel(options, defined_type,
+                       {out, types, arg->GetType(), "_aidl_out", cpp::BuildVarName(*arg)},
+                       "_aidl_utf8");
       out << ";\n";
-      StatusCheckBreak(out);
+      StatusCheckBreak(out, options);
     }
   }
   out << "break;\n";
+}
+
+static void GenerateServerCaseDefinition(CodeWriter& out, const AidlTypenames& types,
+                                         const AidlInterface& defined_type,
+                                         const AidlMethod& method, const Options& options) {
+  out << "case " << MethodId(method) << ": {\n";
+  out.Indent();
+  GenerateServerCaseBody(out, types, defined_type, method, options);
   out.Dedent();
   out << "}\n";
 }
 
+// For --native-dispatch-table, the handler of the transactions of a
+// user-defined method.
+static void GenerateServerHandler(CodeWriter& out, const AidlTypenames& types,
+                                  const AidlInterface& defined_type, const AidlMethod& method,
+                                  const Options& options) {
+  const std::string bn_clazz = ClassName(defined_type, ClassNames::SERVER);
+  out << "static " << cpp::HandlerPlacement(defined_type, method, options)
+      << "binder_status_t _aidl_onTransact_" << method.GetName() << "(const std::shared_ptr<"
+      << bn_clazz << ">& _aidl_impl, const AParcel* _aidl_in, AParcel* _aidl_out) {\n";
+  out.Indent();
+  out << "(void)_aidl_out;\n";
+  out << "binder_status_t _aidl_ret_status = STATUS_UNKNOWN_TRANSACTION;\n";
+  out << "do {\n";
+  out.Indent();
+  GenerateServerCaseBody(out, types, defined_type, method, options);
+  out.Dedent();
+  out << "} while (false);\n";
+  out << "return _aidl_ret_status;\n";
+  out.Dedent();
+  out << "}\n\n";
+}
+
 void GenerateClassSource(CodeWriter& out, const AidlTypenames& types,
                          const AidlInterface& defined_type, const Options& options) {
   const std::string clazz = ClassName(defined_type, ClassNames::INTERFACE);
   const std::string bn_clazz = ClassName(defined_type, ClassNames::SERVER);
 
+  const size_t table_size = cpp::NativeDispatchTableSize(defined_type, options);
+  if (table_size > 0) {
+    std::vector<std::string> handlers(table_size, "nullptr");
+    for (const auto& method : defined_type.GetMethods()) {
+      if (method->IsUserDefined()) {
+        GenerateServerHandler(out, types, defined_type, *method, options);
+        handlers[method->GetId()] = "_aidl_onTransact_" + method->GetName();
+      }
+    }
+    out << "using _aidl_Handler = binder_status_t (*)(const std::shared_ptr<" << bn_clazz
+        << ">&, const AParcel*, AParcel*);\n";
+    out << "static constexpr _aidl_Handler _aidl_handlers[] = {\n";
+    for (const std::string& handler : handlers) {
+      out << "    " << handler << ",\n";
+    }
+    out << "};\n\n";
+  }
+
   out << "static binder_status_t "
       << "_aidl_onTransact"
       << "(AIBinder* _aidl_binder, transaction_code_t _aidl_code, const AParcel* _aidl_in, "
@@ -490,10 +1274,19 @@ void GenerateClassSource(CodeWriter& out, const AidlTypenames& types,
     // AIBinder_Class object which is associated with this class.
     out << "std::shared_ptr<" << bn_clazz << "> _aidl_impl = std::static_pointer_cast<" << bn_clazz
         << ">(::ndk::ICInterface::asInterface(_aidl_binder));\n";
+    if (table_size > 0) {
+      out << "const uint32_t _aidl_index = _aidl_code - FIRST_CALL_TRANSACTION;\n";
+      out << "if (_aidl_index < " << std::to_string(table_size)
+          << " && _aidl_handlers[_aidl_index] != nullptr) {\n";
+      out << "  return _aidl_handlers[_aidl_index](_aidl_impl, _aidl_in, _aidl_out);\n";
+      out << "}\n";
+    }
     out << "switch (_aidl_code) {\n";
     out.Indent();
-    for (const auto& method : defined_type.GetMethods()) {
-      GenerateServerCaseDefinition(out, types, defined_type, *method, options);
+    for (const AidlMethod* method : cpp::MethodsByCallCount(defined_type, options)) {
+      if (table_size == 0 || !method->IsUserDefined()) {
+        GenerateServerCaseDefinition(out, types, defined_type, *method, options);
+      }
     }
     out.Dedent();
     out << "}\n";
@@ -505,8 +1298,16 @@ void GenerateClassSource(CodeWriter& out, const AidlTypenames& types,
   out.Dedent();
   out << "}\n\n";
 
-  out << "static AIBinder_Class* " << kClazz << " = ::ndk::ICInterface::defineClass(" << clazz
-      << "::" << kDescriptor << ", _aidl_onTransact);\n\n";
+  if (options.LazyDescriptors()) {
+    out << "static AIBinder_Class* " << kClazz << "() {\n";
+    out << "  static AIBinder_Class* clazz = ::ndk::ICInterface::defineClass(" << clazz
+        << "::" << kDescriptor << ", _aidl_onTransact);\n";
+    out << "  return clazz;\n";
+    out << "}\n\n";
+  } else {
+    out << "static AIBinder_Class* " << kClazz << " = ::ndk::ICInterface::defineClass(" << clazz
+        << "::" << kDescriptor << ", _aidl_onTransact);\n\n";
+  }
 }
 void GenerateClientSource(CodeWriter& out, const AidlTypenames& types,
                           const AidlInterface& defined_type, const Options& options) {
@@ -535,7 +1336,7 @@ void GenerateServerSource(CodeWriter& out, const AidlTypenames& types,
   }
   out << "::ndk::SpAIBinder " << clazz << "::createBinder() {\n";
   out.Indent();
-  out << "AIBinder* binder = AIBinder_new(" << kClazz << ", static_cast<void*>(this));\n";
+  out << "AIBinder* binder = AIBinder_new(" << ClazzOf(options) << ", static_cast<void*>(this));\n";
 
   out << "#ifdef BINDER_STABILITY_SUPPORT\n";
   if (defined_type.IsVintfStability()) {
@@ -585,11 +1386,24 @@ void GenerateInterfaceSource(CodeWriter& out, const AidlTypenames& types,
   out << "\n";
   GenerateConstantDefinitions(out, defined_type);
   out << "\n";
+  if (options.GenStats()) {
+    out << cpp::GenStatsDefinitions(defined_type);
+    out << "\n";
+  }
+  if (options.GenBinaryLog()) {
+    out << cpp::GenTransactionRecordDecoder(defined_type, clazz);
+    out << "\n";
+  }
+  if (options.GenLog() || options.GenBinaryLog()) {
+    out << cpp::GenLogSamplingDefinitions(defined_type);
+    out << "\n";
+  }
 
   out << "std::shared_ptr<" << clazz << "> " << clazz
       << "::fromBinder(const ::ndk::SpAIBinder& binder) {\n";
   out.Indent();
-  out << "if (!AIBinder_associateClass(binder.get(), " << kClazz << ")) { return nullptr; }\n";
+  out << "if (!AIBinder_associateClass(binder.get(), " << ClazzOf(options)
+      << ")) { return nullptr; }\n";
   out << "std::shared_ptr<::ndk::ICInterface> interface = "
          "::ndk::ICInterface::asInterface(binder.get());\n";
   out << "if (interface) {\n";
@@ -709,6 +1523,13 @@ void GenerateClientHeader(CodeWriter& out, const AidlTypenames& types,
     out << "#include <chrono>\n";
     out << "#include <sstream>\n";
   }
+  if (options.Version() > 0 || !options.Hash().empty()) {
+    out << "#include <atomic>\n";
+  }
+  if (!options.Hash().empty()) {
+    out << "#include <mutex>\n";
+    out << "#include <string>\n";
+  }
   out << "\n";
   EnterNdkNamespace(out, defined_type);
   out << "class " << clazz << " : public ::ndk::BpCInterface<"
@@ -723,12 +1544,13 @@ void GenerateClientHeader(CodeWriter& out, const AidlTypenames& types,
   }
 
   if (options.Version() > 0) {
-    out << "int32_t " << kCachedVersion << " = -1;\n";
+    out << "std::atomic<int32_t> " << kCachedVersion << "{-1};\n";
   }
 
   if (!options.Hash().empty()) {
     out << "std::string " << kCachedHash << " = \"-1\";\n";
     out << "std::mutex " << kCachedHashMutex << ";\n";
+    out << "std::atomic<bool> " << kCachedHashReady << "{false};\n";
   }
   if (options.GenLog()) {
     out << "static std::function<void(const Json::Value&)> logFunc;\n";
@@ -787,18 +1609,89 @@ void GenerateInterfaceHeader(CodeWriter& out, const AidlTypenames& types,
   const std::string clazz = ClassName(defined_type, ClassNames::INTERFACE);
 
   out << "#pragma once\n\n";
-  out << "#include <android/binder_interface_utils.h>\n";
+  // The headers that the features below need. Several need the same ones,
+  // which are included once.
+  std::set<std::string> includes = {"android/binder_interface_utils.h"};
   if (options.GenLog()) {
-    out << "#include <json/value.h>\n";
-    out << "#include <functional>\n";
-    out << "#include <chrono>\n";
-    out << "#include <sstream>\n";
+    includes.insert("json/value.h");
+    includes.insert("functional");
+    includes.insert("chrono");
+    includes.insert("sstream");
+  }
+  if (options.GenStats()) {
+    includes.insert("atomic");
+    includes.insert("chrono");
+  }
+  if (options.GenTransactionNames()) {
+    includes.insert("string_view");
+  }
+  if (options.GenPrewarm()) {
+    includes.insert("android/binder_manager.h");
+    includes.insert("future");
+    includes.insert("string");
+  }
+  const bool declares_executors =
+      options.GenAsync() || options.GenCoroutines() || cpp::HasDispatchedMethods(defined_type);
+  if (declares_executors) {
+    includes.insert("condition_variable");
+    includes.insert("deque");
+    includes.insert("functional");
+    includes.insert("map");
+    includes.insert("memory");
+    includes.insert("mutex");
+    includes.insert("string");
+    includes.insert("thread");
+    includes.insert("tuple");
+  }
+  if (options.GenCoroutines()) {
+    includes.insert("optional");
+  }
+  if (cpp::HasCallContextMethods(defined_type)) {
+    includes.insert("chrono");
+    includes.insert("cstdint");
+  }
+  if (options.GenLog() || options.GenBinaryLog()) {
+    includes.insert("atomic");
+    includes.insert("cstdint");
+    includes.insert("string");
+  }
+  if (options.GenBinaryLog()) {
+    includes.insert("algorithm");
+    includes.insert("chrono");
+    includes.insert("cstring");
+    includes.insert("sstream");
+    includes.insert("vector");
+  }
+  if (cpp::HasArgTables(defined_type, options)) {
+    includes.insert("android/binder_parcel_utils.h");
+    includes.insert("cstdint");
+    includes.insert("string");
+  }
+  for (const auto& include : includes) {
+    out << "#include <" << include << ">\n";
   }
   out << "\n";
 
-  GenerateHeaderIncludes(out, types, defined_type);
+  GenerateHeaderIncludes(out, types, defined_type,
+                         cpp::ForwardDeclaredTypes(defined_type, types, options));
   out << "\n";
 
+  if (declares_executors) {
+    out << cpp::kAsyncExecutorDeclaration << "\n";
+  }
+  if (options.GenCoroutines()) {
+    out << cpp::kAwaitableDeclaration << "\n";
+  }
+  if (cpp::HasCallContextMethods(defined_type)) {
+    out << cpp::kCallContextDeclaration << "\n";
+  }
+  if (options.GenBinaryLog()) {
+    out << cpp::kTransactionLogDeclaration << "\n";
+  }
+  if (cpp::HasArgTables(defined_type, options)) {
+    out << cpp::kArgCodeDeclaration << "\n";
+    out << cpp::kNdkArgTableDeclaration << "\n";
+  }
   EnterNdkNamespace(out, defined_type);
   out << "class " << clazz << " : public ::ndk::ICInterface {\n";
   out << "public:\n";
@@ -827,9 +1720,49 @@ void GenerateInterfaceHeader(CodeWriter& out, const AidlTypenames& types,
   out << "\n";
   out << "static const std::shared_ptr<" << clazz << ">& getDefaultImpl();";
   out << "\n";
+  if (options.GenPrewarm()) {
+    out << "// Gets the service |instance| in the background, which starts it if it is a\n"
+        << "// lazy service. Holding on to the future keeps the service running.\n"
+        << "static std::future<std::shared_ptr<" << clazz
+        << ">> prewarm(const std::string& instance) {\n"
+        << "  return std::async(std::launch::async, [instance] {\n"
+        << "    return fromBinder(\n"
+        << "        ::ndk::SpAIBinder(AServiceManager_getService(instance.c_str())));\n"
+        << "  });\n"
+        << "}\n";
+  }
+  if (options.GenStats()) {
+    out << cpp::GenStatsDeclarations(defined_type);
+  }
+  if (options.GenTransactionNames()) {
+    out << cpp::GenTransactionNamesDeclarations(defined_type, "FIRST_CALL_TRANSACTION");
+  }
+  if (options.GenLog() || options.GenBinaryLog()) {
+    out << cpp::GenLogSamplingDeclarations(defined_type);
+  }
+  if (options.GenBinaryLog()) {
+    out << "static std::string decodeTransactionRecord("
+        << "const ::android::aidl::TransactionRecord& record);\n";
+  }
   for (const auto& method : defined_type.GetMethods()) {
     out << "virtual " << NdkMethodDecl(types, *method) << " = 0;\n";
   }
+  if (options.GenAsync()) {
+    for (const auto& method : defined_type.GetMethods()) {
+      if (cpp::HasAsyncVariant(*method)) {
+        out << cpp::GenAsyncMethod(*method, "::ndk::ScopedAStatus", "ref<" + clazz + ">()",
+                                   [&](const AidlTypeSpecifier& type) {
+                                     return NdkNameOf(types, type, StorageMode::STACK);
+                                   });
+      }
+    }
+  }
+  if (options.GenCoroutines()) {
+    out << cpp::GenAwaitMethods(defined_type, "::ndk::ScopedAStatus", "ref<" + clazz + ">()",
+                                [&](const AidlTypeSpecifier& type) {
+                                  return NdkNameOf(types, type, StorageMode::STACK);
+                                });
+  }
   out.Dedent();
   out << "private:\n";
   out.Indent();
@@ -860,7 +1793,7 @@ void GenerateInterfaceHeader(CodeWriter& out, const AidlTypenames& types,
 }
 void GenerateParcelHeader(CodeWriter& out, const AidlTypenames& types,
                           const AidlStructuredParcelable& defined_type,
-                          const Options& /*options*/) {
+                          const Options& options) {
   const std::string clazz = ClassName(defined_type, ClassNames::RAW);
 
   out << "#pragma once\n";
@@ -875,7 +1808,7 @@ void GenerateParcelHeader(CodeWriter& out, const AidlTypenames& types,
   out.Indent();
   out << "static const char* descriptor;\n";
   out << "\n";
-  for (const auto& variable : defined_type.GetFields()) {
+  for (const auto variable : cpp::FieldsInDeclarationOrder(defined_type, types, options)) {
     out << NdkNameOf(types, variable->GetType(), StorageMode::STACK) << " " << variable->GetName();
     if (variable->GetDefaultValue()) {
       out << " = " << variable->ValueString(ConstantValueDecorator);
@@ -896,10 +1829,20 @@ void GenerateParcelHeader(CodeWriter& out, const AidlTypenames& types,
   out << "};\n";
   LeaveNdkNamespace(out, defined_type);
 }
+
+static void GenerateEndOfParcelableCheck(CodeWriter& out) {
+  out << "if (AParcel_getDataPosition(parcel) - _aidl_start_pos >= _aidl_parcelable_size) {\n"
+      << "  AParcel_setDataPosition(parcel, _aidl_start_pos + _aidl_parcelable_size);\n"
+      << "  return _aidl_ret_status;\n"
+      << "}\n";
+}
+
 void GenerateParcelSource(CodeWriter& out, const AidlTypenames& types,
                           const AidlStructuredParcelable& defined_type,
-                          const Options& /*options*/) {
+                          const Options& options) {
   const std::string clazz = ClassName(defined_type, ClassNames::RAW);
+  const std::vector<cpp::ParcelFieldRun> runs =
+      cpp::SplitParcelFields(defined_type, options.BatchPrimitiveFields());
 
   out << "#include \"" << NdkHeaderFile(defined_type, ClassNames::RAW, false /*use_os_sep*/)
       << "\"\n";
@@ -907,6 +1850,12 @@ void GenerateParcelSource(CodeWriter& out, const AidlTypenames& types,
   GenerateSourceIncludes(out, types, defined_type);
   out << "\n";
   EnterNdkNamespace(out, defined_type);
+  if (std::any_of(defined_type.GetFields().begin(), defined_type.GetFields().end(),
+                  [&types](const auto& field) {
+                    return ndk::UsesElementVectorHelpers(types, field->GetType());
+                  })) {
+    out << kElementVectorHelpers;
+  }
   out << "const char* " << clazz << "::" << kDescriptor << " = \""
       << defined_type.GetCanonicalName() << "\";\n";
   out << "\n";
@@ -917,17 +1866,38 @@ void GenerateParcelSource(CodeWriter& out, const AidlTypenames& types,
   out << "int32_t _aidl_start_pos = AParcel_getDataPosition(parcel);\n";
   out << "binder_status_t _aidl_ret_status = AParcel_readInt32(parcel, &_aidl_parcelable_size);\n";
   out << "if (_aidl_parcelable_size < 0) return STATUS_BAD_VALUE;\n";
-  StatusCheckReturn(out);
+  StatusCheckReturn(out, options);
 
-  for (const auto& variable : defined_type.GetFields()) {
-    out << "_aidl_ret_status = ";
-    ReadFromParcelFor({out, types, variable->GetType(), "parcel", "&" + variable->GetName()});
-    out << ";\n";
-    StatusCheckReturn(out);
-    out << "if (AParcel_getDataPosition(parcel) - _aidl_start_pos >= _aidl_parcelable_size) {\n"
-        << "  AParcel_setDataPosition(parcel, _aidl_start_pos + _aidl_parcelable_size);\n"
-        << "  return _aidl_ret_status;\n"
-        << "}\n";
+  auto read_fields = [&](const std::vector<const AidlVariableDeclaration*>& fields,
+                         bool check_end_of_parcelable) {
+    for (const auto variable : fields) {
+      out << "_aidl_ret_status = ";
+      ReadFromParcelFor({out, types, variable->GetType(), "parcel", "&" + variable->GetName()});
+      out << ";\n";
+      StatusCheckReturn(out, options);
+      if (check_end_of_parcelable) {
+        GenerateEndOfParcelableCheck(out);
+      }
+    }
+  };
+  for (const auto& run : runs) {
+    if (!run.IsBatched()) {
+      read_fields(run.fields, true);
+      continue;
+    }
+    // There is no bulk read that keeps the wire format, but when all of the
+    // run is there, one position check does for all of its fields.
+    out << "if (AParcel_getDataPosition(parcel) - _aidl_start_pos + " << std::to_string(run.size)
+        << " <= _aidl_parcelable_size) {\n";
+    out.Indent();
+    read_fields(run.fields, false);
+    out.Dedent();
+    out << "} else {\n";
+    out.Indent();
+    read_fields(run.fields, true);
+    out.Dedent();
+    out << "}\n";
+    GenerateEndOfParcelableCheck(out);
   }
   out << "AParcel_setDataPosition(parcel, _aidl_start_pos + _aidl_parcelable_size);\n"
       << "return _aidl_ret_status;\n";
@@ -940,13 +1910,13 @@ void GenerateParcelSource(CodeWriter& out, const AidlTypenames& types,
 
   out << "size_t _aidl_start_pos = AParcel_getDataPosition(parcel);\n";
   out << "_aidl_ret_status = AParcel_writeInt32(parcel, 0);\n";
-  StatusCheckReturn(out);
+  StatusCheckReturn(out, options);
 
   for (const auto& variable : defined_type.GetFields()) {
     out << "_aidl_ret_status = ";
     WriteToParcelFor({out, types, variable->GetType(), "parcel", variable->GetName()});
     out << ";\n";
-    StatusCheckReturn(out);
+    StatusCheckReturn(out, options);
   }
   out << "size_t _aidl_end_pos = AParcel_getDataPosition(parcel);\n";
   out << "AParcel_setDataPosition(parcel, _aidl_start_pos);\n";
@@ -960,32 +1930,6 @@ void GenerateParcelSource(CodeWriter& out, const AidlTypenames& types,
   LeaveNdkNamespace(out, defined_type);
 }
 
-std::string GenerateEnumToString(const AidlTypenames& typenames,
-                                 const AidlEnumDeclaration& enum_decl) {
-  std::ostringstream code;
-  code << "static inline std::string toString(" << enum_decl.GetName() << " val) {\n";
-  code << "  switch(val) {\n";
-  std::set<std::string> unique_cases;
-  for (const auto& enumerator : enum_decl.GetEnumerators()) {
-    std::string c = enumerator->ValueString(enum_decl.GetBackingType(), ConstantValueDecorator);
-    // Only add a case if its value has not yet been used in the switch
-    // statement. C++ does not allow multiple cases with the same value, but
-    // enums does allow this. In this scenario, the first declared
-    // enumerator with the given value is printed.
-    if (unique_cases.count(c) == 0) {
-      unique_cases.insert(c);
-      code << "  case " << enum_decl.GetName() << "::" << enumerator->GetName() << ":\n";
-      code << "    return \"" << enumerator->GetName() << "\";\n";
-    }
-  }
-  code << "  default:\n";
-  code << "    return std::to_string(static_cast<"
-       << NdkNameOf(typenames, enum_decl.GetBackingType(), StorageMode::STACK) << ">(val));\n";
-  code << "  }\n";
-  code << "}\n";
-  return code.str();
-}
-
 void GenerateEnumHeader(CodeWriter& out, const AidlTypenames& types,
                         const AidlEnumDeclaration& enum_decl, const Options& /*options*/) {
   out << "#pragma once\n";
@@ -994,6 +1938,7 @@ void GenerateEnumHeader(CodeWriter& out, const AidlTypenames& types,
   GenerateHeaderIncludes(out, types, enum_decl);
   // enum specific headers
   out << "#include <array>\n";
+  out << "#include <string_view>\n";
   out << "#include <android/binder_enums.h>\n";
 
   EnterNdkNamespace(out, enum_decl);
@@ -1007,7 +1952,8 @@ void GenerateEnumHeader(CodeWriter& out, const AidlTypenames& types,
   out.Dedent();
   out << "};\n";
   out << "\n";
-  out << GenerateEnumToString(types, enum_decl);
+  out << cpp::GenerateEnumToString(
+      enum_decl, NdkNameOf(types, enum_decl.GetBackingType(), StorageMode::STACK));
   LeaveNdkNamespace(out, enum_decl);
 
   out << "namespace ndk {\n";
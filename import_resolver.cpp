@@ -50,6 +50,26 @@ ImportResolver::ImportResolver(const IoDelegate& io_delegate, const string& inpu
 }
 
 string ImportResolver::FindImportFile(const string& canonical_name) const {
+  auto found = found_paths_.find(canonical_name);
+  if (found == found_paths_.end()) {
+    found = found_paths_.emplace(canonical_name, FindImportPaths(canonical_name)).first;
+  }
+  const vector<string>& found_paths = found->second;
+
+  int num_found = found_paths.size();
+  if (num_found == 0) {
+    return "";
+  } else if (num_found == 1) {
+    return found_paths.front();
+  } else {
+    AIDL_ERROR(input_file_name_) << "Duplicate files found for " << canonical_name
+                                 << " from:" << std::endl
+                                 << android::base::Join(found_paths, "\n");
+    return "";
+  }
+}
+
+vector<string> ImportResolver::FindImportPaths(const string& canonical_name) const {
   // Convert the canonical name to a relative file path.
   string relative_path = canonical_name;
   for (char& c : relative_path) {
@@ -58,11 +78,17 @@ string ImportResolver::FindImportFile(const string& canonical_name) const {
     }
   }
   relative_path += ".aidl";
+  const size_t last_separator = relative_path.rfind(OS_PATH_SEPARATOR);
+  const string relative_dir =
+      last_separator == string::npos ? "" : relative_path.substr(0, last_separator + 1);
 
   // Look for that relative path at each of our import roots.
   vector<string> found_paths;
-  for (string path : import_paths_) {
-    path = path + relative_path;
+  for (const string& import_path : import_paths_) {
+    if (!relative_dir.empty() && !DirectoryExists(import_path + relative_dir)) {
+      continue;
+    }
+    string path = import_path + relative_path;
     if (io_delegate_.FileIsReadable(path)) {
       found_paths.emplace_back(path);
     }
@@ -71,18 +97,15 @@ string ImportResolver::FindImportFile(const string& canonical_name) const {
   std::sort(found_paths.begin(), found_paths.end());
   auto last = std::unique(found_paths.begin(), found_paths.end());
   found_paths.erase(last, found_paths.end());
+  return found_paths;
+}
 
-  int num_found = found_paths.size();
-  if (num_found == 0) {
-    return "";
-  } else if (num_found == 1) {
-    return found_paths.front();
-  } else {
-    AIDL_ERROR(input_file_name_) << "Duplicate files found for " << canonical_name
-                                 << " from:" << std::endl
-                                 << android::base::Join(found_paths, "\n");
-    return "";
+bool ImportResolver::DirectoryExists(const string& dir) const {
+  auto found = existing_dirs_.find(dir);
+  if (found == existing_dirs_.end()) {
+    found = existing_dirs_.emplace(dir, io_delegate_.DirectoryExists(dir)).first;
   }
+  return found->second;
 }
 
 }  // namespace aidl
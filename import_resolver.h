@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -39,10 +40,19 @@ class ImportResolver {
   std::string FindImportFile(const std::string& canonical_name) const;
 
  private:
+  // Returns all files for |canonical_name| found in the import paths, sorted.
+  std::vector<std::string> FindImportPaths(const std::string& canonical_name) const;
+  bool DirectoryExists(const std::string& dir) const;
+
   const IoDelegate& io_delegate_;
   const std::string& input_file_name_;
   std::vector<std::string> import_paths_;
   std::vector<std::string> input_files_;
+  // Results of FindImportPaths, per canonical name
+  mutable std::map<std::string, std::vector<std::string>> found_paths_;
+  // Whether a (package) directory exists, per path. Import paths not having
+  // the package directory of a type are skipped without checking the file.
+  mutable std::map<std::string, bool> existing_dirs_;
 
   DISALLOW_COPY_AND_ASSIGN(ImportResolver);
 };
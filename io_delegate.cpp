@@ -16,15 +16,26 @@
 
 #include "io_delegate.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <vector>
 
+#include <sys/stat.h>
+
 #ifdef _WIN32
 #include <direct.h>
 #else
 #include <dirent.h>
-#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 #endif
@@ -33,6 +44,7 @@
 
 #include "logging.h"
 #include "os.h"
+#include "profile.h"
 
 using std::string;
 using std::unique_ptr;
@@ -43,6 +55,34 @@ using android::base::Split;
 namespace android {
 namespace aidl {
 
+namespace {
+
+unique_ptr<string> ReadFileContents(const string& filename, const string& content_suffix) {
+  unique_ptr<string> contents;
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  if (!in) {
+    return contents;
+  }
+  contents.reset(new string);
+  in.seekg(0, std::ios::end);
+  ssize_t file_size = in.tellg();
+  contents->resize(file_size + content_suffix.length());
+  in.seekg(0, std::ios::beg);
+  // Read the file contents into the beginning of the string
+  in.read(&(*contents)[0], file_size);
+  // Drop the suffix in at the end.
+  contents->replace(file_size, content_suffix.length(), content_suffix);
+  in.close();
+
+  return contents;
+}
+
+}  // namespace
+
+IoDelegate::IoDelegate() = default;
+
+IoDelegate::~IoDelegate() = default;
+
 bool IoDelegate::GetAbsolutePath(const string& path, string* absolute_path) {
 #ifdef _WIN32
 
@@ -85,23 +125,181 @@ bool IoDelegate::GetAbsolutePath(const string& path, string* absolute_path) {
 unique_ptr<string> IoDelegate::GetFileContents(
     const string& filename,
     const string& content_suffix) const {
-  unique_ptr<string> contents;
-  std::ifstream in(filename, std::ios::in | std::ios::binary);
-  if (!in) {
-    return contents;
+  return ReadFileContents(filename, content_suffix);
+}
+
+namespace {
+
+// The lexer needs two NULs after the contents of a file.
+const string kScanBufferSuffix(2u, '\0');
+
+class StringScanBuffer : public ScanBuffer {
+ public:
+  explicit StringScanBuffer(unique_ptr<string> contents) : contents_(std::move(contents)) {}
+  char* Data() override { return &(*contents_)[0]; }
+  size_t Size() const override { return contents_->size(); }
+
+ private:
+  unique_ptr<string> contents_;
+};
+
+#ifndef _WIN32
+// Files smaller than this are read; mapping them costs more than copying them.
+constexpr size_t kMinMappedFileSize = 16 * 1024;
+
+// The file is mapped privately, so the lexer can write to the buffer without
+// changing the file. The two NULs come from the zero-filled tail of the last
+// page, so the file is mapped only if it ends inside a page with at least two
+// bytes left. A file that fills its last page exactly has no such tail.
+class MappedScanBuffer : public ScanBuffer {
+ public:
+  static unique_ptr<ScanBuffer> Map(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return nullptr;
+    }
+    unique_ptr<ScanBuffer> buffer;
+    struct stat st;
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        static_cast<size_t>(st.st_size) >= kMinMappedFileSize && st.st_size % page_size != 0 &&
+        page_size - st.st_size % page_size >= kScanBufferSuffix.size()) {
+      const size_t file_size = st.st_size;
+      void* addr = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        buffer.reset(new MappedScanBuffer(static_cast<char*>(addr), file_size));
+      }
+    }
+    close(fd);
+    return buffer;
   }
-  contents.reset(new string);
-  in.seekg(0, std::ios::end);
-  ssize_t file_size = in.tellg();
-  contents->resize(file_size + content_suffix.length());
-  in.seekg(0, std::ios::beg);
-  // Read the file contents into the beginning of the string
-  in.read(&(*contents)[0], file_size);
-  // Drop the suffix in at the end.
-  contents->replace(file_size, content_suffix.length(), content_suffix);
-  in.close();
+  ~MappedScanBuffer() override { munmap(addr_, file_size_); }
+  char* Data() override { return addr_; }
+  size_t Size() const override { return file_size_ + kScanBufferSuffix.size(); }
+
+ private:
+  MappedScanBuffer(char* addr, size_t file_size) : addr_(addr), file_size_(file_size) {}
+  char* const addr_;
+  const size_t file_size_;
+};
+#endif
 
-  return contents;
+}  // namespace
+
+// Reads the requested files on up to |depth| threads, which are started as
+// requests come in. A file counts against the depth until it is taken.
+class IoDelegate::Prefetcher {
+ public:
+  explicit Prefetcher(size_t depth) : depth_(depth) {}
+
+  ~Prefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    queued_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void Request(const string& filename) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.size() >= depth_ || entries_.count(filename) != 0) {
+      return;
+    }
+    entries_[filename];
+    queue_.push_back(filename);
+    if (threads_.size() < depth_) {
+      threads_.emplace_back(&Prefetcher::Work, this);
+    }
+    queued_.notify_one();
+  }
+
+  // Returns false if |filename| wasn't requested. Otherwise waits for its read
+  // and moves the contents, which are null if it couldn't be read, to
+  // |*contents|.
+  bool Take(const string& filename, unique_ptr<string>* contents) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = entries_.find(filename);
+    done_.wait(lock, [&]() {
+      it = entries_.find(filename);
+      return it == entries_.end() || it->second.done;
+    });
+    if (it == entries_.end()) {
+      return false;
+    }
+    *contents = std::move(it->second.contents);
+    entries_.erase(it);
+    return true;
+  }
+
+ private:
+  struct Entry {
+    bool done = false;
+    unique_ptr<string> contents;
+  };
+
+  void Work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      queued_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      const string filename = std::move(queue_.front());
+      queue_.pop_front();
+      lock.unlock();
+      unique_ptr<string> contents = ReadFileContents(filename, kScanBufferSuffix);
+      lock.lock();
+      Entry& entry = entries_[filename];
+      entry.contents = std::move(contents);
+      entry.done = true;
+      done_.notify_all();
+    }
+  }
+
+  const size_t depth_;
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable done_;
+  std::map<string, Entry> entries_;
+  std::deque<string> queue_;
+  vector<std::thread> threads_;
+  bool stopping_ = false;
+};
+
+void IoDelegate::SetPrefetchDepth(size_t depth) {
+  prefetcher_.reset(depth > 0 ? new Prefetcher(depth) : nullptr);
+}
+
+void IoDelegate::Prefetch(const string& filename) const {
+  if (prefetcher_ != nullptr) {
+    prefetcher_->Request(filename);
+  }
+}
+
+unique_ptr<ScanBuffer> ScanBuffer::FromString(unique_ptr<string> contents) {
+  if (contents == nullptr) {
+    return nullptr;
+  }
+  return unique_ptr<ScanBuffer>(new StringScanBuffer(std::move(contents)));
+}
+
+unique_ptr<ScanBuffer> IoDelegate::GetScanBuffer(const string& filename) const {
+  if (prefetcher_ != nullptr) {
+    // A file that couldn't be read gives a null buffer, as below.
+    unique_ptr<string> contents;
+    if (prefetcher_->Take(filename, &contents)) {
+      return ScanBuffer::FromString(std::move(contents));
+    }
+  }
+#ifndef _WIN32
+  if (unique_ptr<ScanBuffer> mapped = MappedScanBuffer::Map(filename); mapped != nullptr) {
+    return mapped;
+  }
+#endif
+  return ScanBuffer::FromString(GetFileContents(filename, kScanBufferSuffix));
 }
 
 unique_ptr<LineReader> IoDelegate::GetLineReader(
@@ -110,6 +308,7 @@ unique_ptr<LineReader> IoDelegate::GetLineReader(
 }
 
 bool IoDelegate::FileIsReadable(const string& path) const {
+  Profile::Count(ProfileCounter::FILE_IS_READABLE_CALLS);
 #ifdef _WIN32
   // check that the file exists and is not write-only
   return (0 == _access(path.c_str(), 0)) &&  // mode 0=exist
@@ -119,7 +318,30 @@ bool IoDelegate::FileIsReadable(const string& path) const {
 #endif
 }
 
-static bool CreateNestedDirs(const string& caller_base_dir, const vector<string>& nested_subdirs) {
+bool IoDelegate::DirectoryExists(const string& path) const {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool IoDelegate::GetFileStamp(const string& path, FileStamp* stamp) const {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+  stamp->size = st.st_size;
+#if defined(_WIN32)
+  stamp->mtime_ns = static_cast<int64_t>(st.st_mtime) * 1000000000;
+#elif defined(__APPLE__)
+  stamp->mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 +
+                    st.st_mtimespec.tv_nsec;
+#else
+  stamp->mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+static bool CreateNestedDirs(const string& caller_base_dir, const vector<string>& nested_subdirs,
+                             std::set<string>* made) {
   string base_dir = caller_base_dir;
   if (base_dir.empty()) {
     base_dir = ".";
@@ -129,6 +351,9 @@ static bool CreateNestedDirs(const string& caller_base_dir, const vector<string>
       base_dir += OS_PATH_SEPARATOR;
     }
     base_dir += subdir;
+    if (made != nullptr && !made->insert(base_dir).second) {
+      continue;
+    }
     bool success;
 #ifdef _WIN32
     success = _mkdir(base_dir.c_str()) == 0;
@@ -146,7 +371,7 @@ static bool CreateNestedDirs(const string& caller_base_dir, const vector<string>
   return true;
 }
 
-bool IoDelegate::CreateDirForPath(const string& path) const {
+bool IoDelegate::CreateDirForPath(const string& path, std::set<string>* made) const {
   if (path.empty()) {
     return true;
   }
@@ -173,12 +398,112 @@ bool IoDelegate::CreateDirForPath(const string& path) const {
     directories.pop_back();
   }
 
-  return CreateNestedDirs(base, directories);
+  return CreateNestedDirs(base, directories, made);
+}
+
+// The outputs kept in memory by SetStageOutputs(). Jobs of -j can write them
+// at the same time.
+class IoDelegate::Stage {
+ public:
+  explicit Stage(size_t num_threads) : num_threads_(num_threads) {}
+
+  size_t NumThreads() const { return num_threads_; }
+
+  unique_ptr<CodeWriter> GetCodeWriter(const string& file_path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    removed_.erase(file_path);
+    // A writer keeps a pointer to the contents, which a map doesn't move.
+    return CodeWriter::ForString(&outputs_[file_path]);
+  }
+
+  // The contents stay, as a writer may still refer to them.
+  void Remove(const string& file_path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    removed_.insert(file_path);
+  }
+
+  // Moves the outputs that weren't removed out of the stage, in path order.
+  vector<std::pair<string, string>> Take() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    vector<std::pair<string, string>> outputs;
+    for (auto& [path, contents] : outputs_) {
+      if (removed_.count(path) == 0) {
+        outputs.emplace_back(path, std::move(contents));
+      }
+    }
+    outputs_.clear();
+    removed_.clear();
+    return outputs;
+  }
+
+ private:
+  const size_t num_threads_;
+  std::mutex mutex_;
+  std::map<string, string> outputs_;
+  std::set<string> removed_;
+};
+
+void IoDelegate::SetStageOutputs(size_t num_threads) {
+  stage_ = num_threads > 0 ? std::make_unique<Stage>(num_threads) : nullptr;
+}
+
+bool IoDelegate::FlushStagedOutputs() const {
+  if (stage_ == nullptr) {
+    return true;
+  }
+  const vector<std::pair<string, string>> outputs = stage_->Take();
+
+  // The outputs are sorted by path, so the outputs of a directory are next to
+  // each other, and each directory is made only once.
+  std::set<string> made;
+  string last_dir;
+  bool ok = true;
+  for (const auto& [path, contents] : outputs) {
+    const string dir = path.substr(0, path.rfind(OS_PATH_SEPARATOR) + 1);
+    if (!dir.empty() && dir != last_dir) {
+      if (!CreateDirForPath(dir, &made)) {
+        ok = false;
+      }
+      last_dir = dir;
+    }
+  }
+  if (!ok) {
+    return false;
+  }
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> written{true};
+  auto write = [&]() {
+    for (size_t i = next++; i < outputs.size(); i = next++) {
+      const auto& [path, contents] = outputs[i];
+      unique_ptr<CodeWriter> writer = write_if_changed_ ? CodeWriter::ForFileIfChanged(path)
+                                                        : CodeWriter::ForFile(path);
+      if (!writer->WriteRaw(contents) || !writer->Close()) {
+        LOG(ERROR) << "Error while writing " << path;
+        written = false;
+      }
+    }
+  };
+  vector<std::thread> threads;
+  for (size_t i = 1; i < std::min(stage_->NumThreads(), outputs.size()); i++) {
+    threads.emplace_back(write);
+  }
+  write();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return written;
 }
 
 unique_ptr<CodeWriter> IoDelegate::GetCodeWriter(
     const string& file_path) const {
+  if (stage_ != nullptr) {
+    return stage_->GetCodeWriter(file_path);
+  }
   if (CreateDirForPath(file_path)) {
+    if (write_if_changed_) {
+      return CodeWriter::ForFileIfChanged(file_path);
+    }
     return CodeWriter::ForFile(file_path);
   } else {
     return nullptr;
@@ -186,6 +511,9 @@ unique_ptr<CodeWriter> IoDelegate::GetCodeWriter(
 }
 
 void IoDelegate::RemovePath(const std::string& file_path) const {
+  if (stage_ != nullptr) {
+    stage_->Remove(file_path);
+  }
 #ifdef _WIN32
   _unlink(file_path.c_str());
 #else
@@ -18,7 +18,10 @@
 
 #include <android-base/macros.h>
 
+#include <stdint.h>
+
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -28,10 +31,38 @@
 namespace android {
 namespace aidl {
 
+// Contents of a file followed by two NUL characters, in a writable buffer.
+// This is what the lexer needs to scan a file in place.
+class ScanBuffer {
+ public:
+  ScanBuffer() = default;
+  virtual ~ScanBuffer() = default;
+
+  // Takes |contents| that already end with the two NULs.
+  static std::unique_ptr<ScanBuffer> FromString(std::unique_ptr<std::string> contents);
+
+  virtual char* Data() = 0;
+  // Size of the buffer, including the two NULs.
+  virtual size_t Size() const = 0;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ScanBuffer);
+};
+
+// What tells whether a file was written since it was last looked at, without
+// reading it.
+struct FileStamp {
+  int64_t size = 0;
+  int64_t mtime_ns = 0;
+  bool operator==(const FileStamp& other) const {
+    return size == other.size && mtime_ns == other.mtime_ns;
+  }
+};
+
 class IoDelegate {
  public:
-  IoDelegate() = default;
-  virtual ~IoDelegate() = default;
+  IoDelegate();
+  virtual ~IoDelegate();
 
   // Stores an absolute version of |path| to |*absolute_path|,
   // possibly prefixing it with the current working directory.
@@ -45,22 +76,67 @@ class IoDelegate {
       const std::string& filename,
       const std::string& content_suffix = "") const;
 
+  // Returns the contents of |filename| for the lexer. Large files are mapped
+  // into memory instead of being read when possible. A file passed to
+  // Prefetch() before is taken from memory, once its read is done.
+  virtual std::unique_ptr<ScanBuffer> GetScanBuffer(const std::string& filename) const;
+
+  // Starts reading |filename| in the background, for GetScanBuffer() to pick
+  // up. Does nothing if prefetching is off or its queue is full.
+  virtual void Prefetch(const std::string& filename) const;
+
   virtual std::unique_ptr<LineReader> GetLineReader(
       const std::string& file_path) const;
 
   virtual bool FileIsReadable(const std::string& path) const;
 
+  virtual bool DirectoryExists(const std::string& path) const;
+
+  // Stores the size and modification time of |path| to |*stamp|. Returns
+  // false if they aren't known, in which case the contents have to be
+  // compared instead.
+  virtual bool GetFileStamp(const std::string& path, FileStamp* stamp) const;
+
   virtual std::unique_ptr<CodeWriter> GetCodeWriter(
       const std::string& file_path) const;
 
+  // When set, GetCodeWriter() leaves files whose contents don't change
+  // untouched, so that their mtimes don't trigger rebuilds.
+  void SetWriteIfChanged(bool write_if_changed) { write_if_changed_ = write_if_changed; }
+  bool WriteIfChanged() const { return write_if_changed_; }
+
+  // Lets Prefetch() keep up to |depth| files queued, being read or waiting
+  // for GetScanBuffer(). Zero, the default, turns prefetching off.
+  void SetPrefetchDepth(size_t depth);
+
+  // When |num_threads| isn't zero, GetCodeWriter() keeps the outputs in
+  // memory until FlushStagedOutputs() writes them with |num_threads|
+  // threads. Zero, the default, writes each output as it is closed.
+  void SetStageOutputs(size_t num_threads);
+
+  // Makes the directories of the staged outputs, each once, and then writes
+  // the outputs, as they would have been written without staging. Returns
+  // false if one of them cannot be written.
+  bool FlushStagedOutputs() const;
+
   virtual void RemovePath(const std::string& file_path) const;
 
   virtual std::vector<std::string> ListFiles(const std::string& dir) const;
 
  private:
   // Create the directory when path is a dir or the parent directory when
-  // path is a file. Path is a dir if it ends with the path separator.
-  bool CreateDirForPath(const std::string& path) const;
+  // path is a file. Path is a dir if it ends with the path separator. The
+  // directories in |made|, if given, are taken to exist, and the ones made
+  // are added to it.
+  bool CreateDirForPath(const std::string& path, std::set<std::string>* made = nullptr) const;
+
+  bool write_if_changed_ = false;
+
+  class Prefetcher;
+  std::unique_ptr<Prefetcher> prefetcher_;
+
+  class Stage;
+  std::unique_ptr<Stage> stage_;
 
   DISALLOW_COPY_AND_ASSIGN(IoDelegate);
 };  // class IoDelegate
@@ -16,8 +16,11 @@
 
 #include <string>
 
+#include <android-base/file.h>
 #include <gtest/gtest.h>
 
+#include "aidl_language.h"
+#include "aidl_typenames.h"
 #include "io_delegate.h"
 
 using std::string;
@@ -42,5 +45,97 @@ TEST(IoDelegateTest, CurrentlyInfersLinuxAbsolutePath) {
   EXPECT_EQ(absolute_path[0], '/');
 }
 
+TEST(IoDelegateTest, ScanBufferEndsWithTwoNuls) {
+  IoDelegate io_delegate;
+  // A small file is read, a large one is mapped. Both must look the same.
+  for (size_t size : {10u, 64u * 1024 + 10}) {
+    TemporaryFile file;
+    const string contents(size, 'a');
+    ASSERT_TRUE(android::base::WriteStringToFile(contents, file.path));
+
+    std::unique_ptr<ScanBuffer> buffer = io_delegate.GetScanBuffer(file.path);
+    ASSERT_NE(nullptr, buffer);
+    ASSERT_EQ(size + 2, buffer->Size());
+    EXPECT_EQ(contents, string(buffer->Data(), size));
+    EXPECT_EQ('\0', buffer->Data()[size]);
+    EXPECT_EQ('\0', buffer->Data()[size + 1]);
+
+    // Writing to the buffer doesn't change the file
+    buffer->Data()[0] = 'b';
+    EXPECT_EQ(contents, *io_delegate.GetFileContents(file.path));
+  }
+  EXPECT_EQ(nullptr, io_delegate.GetScanBuffer("/does/not/exist.aidl"));
+}
+
+TEST(IoDelegateTest, ParsesFilesThatFillWholePages) {
+  IoDelegate io_delegate;
+  // Such files have no zero-filled tail to end a mapping with, whatever the
+  // page size is.
+  for (size_t size : {4096u, 16384u}) {
+    TemporaryFile file;
+    string contents = "package p; parcelable Foo { int x; } // ";
+    contents += string(size - contents.size() - 1, 'a') + "\n";
+    ASSERT_EQ(size, contents.size());
+    ASSERT_TRUE(android::base::WriteStringToFile(contents, file.path));
+
+    std::unique_ptr<ScanBuffer> buffer = io_delegate.GetScanBuffer(file.path);
+    ASSERT_NE(nullptr, buffer);
+    ASSERT_EQ(size + 2, buffer->Size());
+    EXPECT_EQ('\0', buffer->Data()[size]);
+    EXPECT_EQ('\0', buffer->Data()[size + 1]);
+
+    AidlTypenames typenames;
+    std::unique_ptr<Parser> parser = Parser::Parse(file.path, io_delegate, typenames);
+    ASSERT_NE(nullptr, parser);
+    ASSERT_EQ(1u, parser->GetDefinedTypes().size());
+    EXPECT_EQ("p.Foo", parser->GetDefinedTypes()[0]->GetCanonicalName());
+  }
+}
+
+TEST(IoDelegateTest, PrefetchedFilesAreScannedFromMemory) {
+  IoDelegate io_delegate;
+  io_delegate.SetPrefetchDepth(2);
+  TemporaryFile file;
+  ASSERT_TRUE(android::base::WriteStringToFile("interface IFoo {}", file.path));
+
+  io_delegate.Prefetch(file.path);
+  io_delegate.Prefetch("/does/not/exist.aidl");
+  std::unique_ptr<ScanBuffer> buffer = io_delegate.GetScanBuffer(file.path);
+  ASSERT_NE(nullptr, buffer);
+  EXPECT_EQ(string("interface IFoo {}\0\0", 19), string(buffer->Data(), buffer->Size()));
+  EXPECT_EQ(nullptr, io_delegate.GetScanBuffer("/does/not/exist.aidl"));
+
+  // Once taken, the file is read again.
+  ASSERT_TRUE(android::base::WriteStringToFile("parcelable Foo;", file.path));
+  buffer = io_delegate.GetScanBuffer(file.path);
+  ASSERT_NE(nullptr, buffer);
+  EXPECT_EQ(string("parcelable Foo;\0\0", 17), string(buffer->Data(), buffer->Size()));
+}
+
+TEST(IoDelegateTest, StagedOutputsAreWrittenOnFlush) {
+  IoDelegate io_delegate;
+  io_delegate.SetStageOutputs(2);
+  TemporaryDir dir;
+  const string foo = string(dir.path) + "/a/b/Foo.java";
+  const string bar = string(dir.path) + "/a/b/Bar.java";
+  const string removed = string(dir.path) + "/c/Baz.java";
+  for (const string& path : {foo, bar, removed}) {
+    std::unique_ptr<CodeWriter> writer = io_delegate.GetCodeWriter(path);
+    ASSERT_NE(nullptr, writer);
+    writer->Write("class %s {}", path.c_str());
+    EXPECT_TRUE(writer->Close());
+  }
+  io_delegate.RemovePath(removed);
+  EXPECT_FALSE(io_delegate.DirectoryExists(string(dir.path) + "/a"));
+
+  EXPECT_TRUE(io_delegate.FlushStagedOutputs());
+  for (const string& path : {foo, bar}) {
+    string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(path, &contents));
+    EXPECT_EQ("class " + path + " {}", contents);
+  }
+  EXPECT_FALSE(io_delegate.DirectoryExists(string(dir.path) + "/c"));
+}
+
 }  // namespace aidl
 }  // namespace android
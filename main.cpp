@@ -19,6 +19,7 @@
 #include "io_delegate.h"
 #include "logging.h"
 #include "options.h"
+#include "profile.h"
 
 #include <iostream>
 
@@ -30,8 +31,7 @@ constexpr Options::Language kDefaultLang = Options::Language::JAVA;
 
 using android::aidl::Options;
 
-int process_options(const Options& options) {
-  android::aidl::IoDelegate io_delegate;
+int run_task(const Options& options, const android::aidl::IoDelegate& io_delegate) {
   switch (options.GetTask()) {
     case Options::Task::COMPILE:
       return android::aidl::compile_aidl(options, io_delegate);
@@ -43,12 +43,33 @@ int process_options(const Options& options) {
       return android::aidl::check_api(options, io_delegate) ? 0 : 1;
     case Options::Task::DUMP_MAPPINGS:
       return android::aidl::dump_mappings(options, io_delegate) ? 0 : 1;
+    case Options::Task::COMPUTE_HASH:
+      return android::aidl::compute_api_hash(options, io_delegate) ? 0 : 1;
+    case Options::Task::SERVER:
+      return android::aidl::run_server(io_delegate, std::cin, std::cout);
+    case Options::Task::BATCH:
+      return android::aidl::run_batch(options, io_delegate);
     default:
       LOG(FATAL) << "aidl: internal error" << std::endl;
       return 1;
   }
 }
 
+int process_options(const Options& options) {
+  android::aidl::IoDelegate io_delegate;
+  io_delegate.SetWriteIfChanged(options.WriteIfChanged());
+  io_delegate.SetPrefetchDepth(options.PrefetchDepth());
+  // A server writes the outputs of each request before it answers it.
+  if (options.GetTask() != Options::Task::SERVER) {
+    io_delegate.SetStageOutputs(options.StageOutputs());
+  }
+  int ret = run_task(options, io_delegate);
+  if (!io_delegate.FlushStagedOutputs()) {
+    ret = 1;
+  }
+  return ret;
+}
+
 int main(int argc, char* argv[]) {
   android::base::InitLogging(argv);
   LOG(DEBUG) << "aidl starting";
@@ -60,13 +81,24 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  if (!options.ProfileFile().empty()) {
+    android::aidl::Profile::Enable();
+  }
+
   int ret = process_options(options);
 
+  if (!options.ProfileFile().empty() &&
+      !android::aidl::Profile::Write(
+          android::aidl::CodeWriter::ForFile(options.ProfileFile()).get())) {
+    LOG(ERROR) << "Failed to write " << options.ProfileFile();
+  }
+
   // compiler invariants
 
   // once AIDL_ERROR/AIDL_FATAL are used everywhere instead of std::cerr/LOG, we
   // can make this assertion in both directions.
-  if (ret == 0) {
+  // The server reports the status of each request separately.
+  if (ret == 0 && options.GetTask() != Options::Task::SERVER) {
     AIDL_FATAL_IF(AidlError::hadError(), "Compiler success, but error emitted");
   }
 
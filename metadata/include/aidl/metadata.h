@@ -16,11 +16,33 @@
 
 #pragma once
 
+#include <cstddef>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace android {
 
+// An array with static storage.
+template <typename T>
+struct AidlMetadataSpan {
+  const T* data;
+  size_t size;
+
+  constexpr const T* begin() const { return data; }
+  constexpr const T* end() const { return data + size; }
+  constexpr const T& operator[](size_t i) const { return data[i]; }
+};
+
+// AidlInterfaceMetadata, with static storage, so that reading it allocates
+// nothing.
+struct AidlInterfaceMetadataView {
+  std::string_view name;
+  std::string_view stability;
+  AidlMetadataSpan<std::string_view> types;
+  AidlMetadataSpan<std::string_view> hashes;
+};
+
 struct AidlInterfaceMetadata {
   // name of module defining package
   std::string name;
@@ -34,7 +56,17 @@ struct AidlInterfaceMetadata {
   // list of all hashes
   std::vector<std::string> hashes;
 
+  // Copies of views(), in the same order.
   static std::vector<AidlInterfaceMetadata> all();
+
+  // All of the interface modules, in the order of the metadata.
+  static AidlMetadataSpan<AidlInterfaceMetadataView> views();
+
+  // The module of the given name, or of the given type, e.g.
+  // android.hardware.foo::IFoo, or nullptr if there is none. These search
+  // indices that are sorted when the table is generated.
+  static const AidlInterfaceMetadataView* findByName(std::string_view name);
+  static const AidlInterfaceMetadataView* findByType(std::string_view type);
 };
 
 }  // namespace android
@@ -14,8 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <json/json.h>
 
@@ -36,29 +40,97 @@ int main(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
+  // AIDL interface characters guaranteed to be accepted in C++ string
+  auto quoted = [](const Json::Value& value) { return "\"" + value.asString() + "\""; };
+
+  // Lookups by module name and by type binary search these, so they are
+  // sorted here rather than at run time.
+  std::vector<std::pair<std::string, size_t>> by_name;
+  std::vector<std::pair<std::string, size_t>> by_type;
+
   std::cout << "#include <aidl/metadata.h>" << std::endl;
+  std::cout << "#include <algorithm>" << std::endl;
+  std::cout << "#include <array>" << std::endl;
   std::cout << "namespace android {" << std::endl;
-  std::cout << "std::vector<AidlInterfaceMetadata> AidlInterfaceMetadata::all() {" << std::endl;
-  std::cout << "return std::vector<AidlInterfaceMetadata>{" << std::endl;
-  for (const Json::Value& entry : root) {
-    std::cout << "AidlInterfaceMetadata{" << std::endl;
-    // AIDL interface characters guaranteed to be accepted in C++ string
-    std::cout << "std::string(\"" << entry["name"].asString() << "\")," << std::endl;
-    std::cout << "std::string(\"" << entry["stability"].asString() << "\")," << std::endl;
-    std::cout << "std::vector<std::string>{" << std::endl;
-    for (const Json::Value& intf : entry["types"]) {
-      std::cout << "std::string(\"" << intf.asString() << "\")," << std::endl;
+  std::cout << "namespace {" << std::endl;
+  for (Json::ArrayIndex i = 0; i < root.size(); i++) {
+    const Json::Value& entry = root[i];
+    by_name.emplace_back(entry["name"].asString(), i);
+    for (const char* list : {"types", "hashes"}) {
+      std::cout << "constexpr std::array<std::string_view, " << entry[list].size() << "> k_" << list
+                << "_" << i << "{" << std::endl;
+      for (const Json::Value& value : entry[list]) {
+        std::cout << quoted(value) << "," << std::endl;
+      }
+      std::cout << "};" << std::endl;
     }
-    std::cout << "}," << std::endl;
-    std::cout << "std::vector<std::string>{" << std::endl;
-    for (const Json::Value& intf : entry["hashes"]) {
-      std::cout << "std::string(\"" << intf.asString() << "\")," << std::endl;
+    for (const Json::Value& type : entry["types"]) {
+      by_type.emplace_back(type.asString(), i);
     }
-    std::cout << "}," << std::endl;
-    std::cout << "}," << std::endl;
   }
-  std::cout << "};" << std::endl;
-  std::cout << "}" << std::endl;
+  std::cout << "constexpr std::array<AidlInterfaceMetadataView, " << root.size()
+            << "> kInterfaces{{" << std::endl;
+  for (Json::ArrayIndex i = 0; i < root.size(); i++) {
+    const Json::Value& entry = root[i];
+    std::cout << "{" << quoted(entry["name"]) << ", " << quoted(entry["stability"]) << ", "
+              << "{k_types_" << i << ".data(), k_types_" << i << ".size()}, "
+              << "{k_hashes_" << i << ".data(), k_hashes_" << i << ".size()}}," << std::endl;
+  }
+  std::cout << "}};" << std::endl;
+
+  std::cout << "struct IndexEntry {" << std::endl
+            << "  std::string_view key;" << std::endl
+            << "  size_t index;" << std::endl
+            << "};" << std::endl;
+  for (auto [name, index] : {std::make_pair("kByName", &by_name),
+                             std::make_pair("kByType", &by_type)}) {
+    std::stable_sort(index->begin(), index->end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    std::cout << "constexpr std::array<IndexEntry, " << index->size() << "> " << name << "{{"
+              << std::endl;
+    for (const auto& [key, i] : *index) {
+      std::cout << "{\"" << key << "\", " << i << "}," << std::endl;
+    }
+    std::cout << "}};" << std::endl;
+  }
+  std::cout << "template <size_t N>" << std::endl
+            << "const AidlInterfaceMetadataView* Find(const std::array<IndexEntry, N>& index,"
+            << " std::string_view key) {" << std::endl
+            << "  auto it = std::lower_bound(index.begin(), index.end(), key,"
+            << " [](const IndexEntry& entry, std::string_view key) { return entry.key < key; });"
+            << std::endl
+            << "  if (it == index.end() || it->key != key) return nullptr;" << std::endl
+            << "  return &kInterfaces[it->index];" << std::endl
+            << "}" << std::endl;
+  std::cout << "}  // namespace" << std::endl;
+
+  std::cout << "AidlMetadataSpan<AidlInterfaceMetadataView> AidlInterfaceMetadata::views() {"
+            << std::endl
+            << "  return {kInterfaces.data(), kInterfaces.size()};" << std::endl
+            << "}" << std::endl;
+  std::cout << "const AidlInterfaceMetadataView* AidlInterfaceMetadata::findByName("
+            << "std::string_view name) {" << std::endl
+            << "  return Find(kByName, name);" << std::endl
+            << "}" << std::endl;
+  std::cout << "const AidlInterfaceMetadataView* AidlInterfaceMetadata::findByType("
+            << "std::string_view type) {" << std::endl
+            << "  return Find(kByType, type);" << std::endl
+            << "}" << std::endl;
+  std::cout << "std::vector<AidlInterfaceMetadata> AidlInterfaceMetadata::all() {" << std::endl
+            << "  std::vector<AidlInterfaceMetadata> metadata;" << std::endl
+            << "  metadata.reserve(kInterfaces.size());" << std::endl
+            << "  for (const AidlInterfaceMetadataView& view : kInterfaces) {" << std::endl
+            << "    metadata.push_back(AidlInterfaceMetadata{" << std::endl
+            << "        std::string(view.name)," << std::endl
+            << "        std::string(view.stability)," << std::endl
+            << "        std::vector<std::string>(view.types.begin(), view.types.end()),"
+            << std::endl
+            << "        std::vector<std::string>(view.hashes.begin(), view.hashes.end()),"
+            << std::endl
+            << "    });" << std::endl
+            << "  }" << std::endl
+            << "  return metadata;" << std::endl
+            << "}" << std::endl;
   std::cout << "}  // namespace android" << std::endl;
   return EXIT_SUCCESS;
 }
@@ -26,6 +26,8 @@
 #include <sstream>
 #include <string>
 
+#include <android-base/file.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
 
 using android::base::Split;
@@ -36,6 +38,23 @@ using std::string;
 namespace android {
 namespace aidl {
 
+namespace {
+// Codes of the options that have no short form. They are past any character
+// so that they can't clash with the letters of the other options.
+enum LongOnlyOption : int {
+  kOptNullableOptional = 256,
+  kOptCompactParcelLayout,
+  kOptReuseContainers,
+  kOptStageOutputs,
+  kOptCodegenReport,
+  kOptTransactionProfile,
+  kOptOutlineThreshold,
+  kOptNonOutlineCount,
+  kOptLazyDescriptors,
+  kOptScanDeclarations,
+};
+}  // namespace
+
 string Options::GetUsage() const {
   std::ostringstream sstr;
   sstr << "usage:" << endl
@@ -49,10 +68,36 @@ string Options::GetUsage() const {
        << myname_ << " --dumpapi --out=DIR INPUT..." << endl
        << "   Dump API signature of AIDL file(s) to DIR." << endl
        << endl
-       << myname_ << " --checkapi OLD_DIR NEW_DIR" << endl
+       << myname_ << " --checkapi OLD_DIR NEW_DIR..." << endl
        << "   Checkes whether API dump NEW_DIR is backwards compatible extension " << endl
-       << "   of the API dump OLD_DIR." << endl
+       << "   of the API dump OLD_DIR. With more than two dumps, in version order," << endl
+       << "   each one is checked against the one before it, and each dump is" << endl
+       << "   loaded once." << endl
+       << endl
+       << myname_ << " --compute-hash [--version=N] HASH_FILE DIR" << endl
+       << "   Write the hash of the API dump DIR to HASH_FILE. The hash is of the" << endl
+       << "   parsed types, so whitespace and comments do not change it. Use -I" << endl
+       << "   DIR if the types of DIR refer to each other." << endl
 #endif
+       << endl
+       << myname_ << " --server" << endl
+       << "   Read command lines from stdin, one per line, and run them. For each" << endl
+       << "   one, a line 'STATUS LENGTH' is written to stdout, followed by the" << endl
+       << "   LENGTH bytes of its answer. Parsed imported and preprocessed files" << endl
+       << "   are kept in memory between the commands." << endl
+       << "   Editors can also request 'check COMMAND', which writes the errors" << endl
+       << "   of the inputs of COMMAND without generating anything, and" << endl
+       << "   'definition FILE:LINE:COLUMN COMMAND', which writes where the type" << endl
+       << "   at that position of FILE is defined. Only edited files are parsed" << endl
+       << "   again." << endl
+       << endl
+       << myname_ << " --batch MANIFEST" << endl
+       << "   Run the command lines in MANIFEST, one per line, as --server does," << endl
+       << "   and stop at the first one that fails. Empty lines and lines" << endl
+       << "   starting with # are skipped." << endl
+       << endl
+       << "Any argument @FILE is replaced by the whitespace-separated arguments" << endl
+       << "in FILE." << endl
        << endl;
 
   // Legacy option formats
@@ -75,7 +120,11 @@ string Options::GetUsage() const {
        << "          Include FILE which is created by --preprocess." << endl
        << "  -d FILE, --dep=FILE" << endl
        << "          Generate dependency file as FILE. Don't use this when" << endl
-       << "          there are multiple input files. Use -a then." << endl
+       << "          there are multiple input files. Use -a or --combined-dep then." << endl
+       << "  --combined-dep=FILE" << endl
+       << "          Generate one dependency file as FILE for all input files." << endl
+       << "          Its targets are all of the generated files, and its sources" << endl
+       << "          are all of the input files and the files they import." << endl
        << "  -o DIR, --out=DIR" << endl
        << "          Use DIR as the base output directory for generated files." << endl
        << "  -h DIR, --header_out=DIR" << endl
@@ -96,8 +145,14 @@ string Options::GetUsage() const {
        << "          Include tracing code for systrace. Note that if either" << endl
        << "          the client or service code is not auto-generated by this" << endl
        << "          tool, that part will not be traced." << endl
+       << "  --trace-parcel-sizes" << endl
+       << "          With --trace, also emit the size of the data and reply" << endl
+       << "          parcels of each call in C++ and NDK proxies as counters." << endl
        << "  --transaction_names" << endl
-       << "          Generate transaction names." << endl
+       << "          Generate transaction names. In Java, the stub gets" << endl
+       << "          getTransactionName(). In C++ and NDK, the interface gets" << endl
+       << "          constexpr tables mapping transaction codes to method" << endl
+       << "          names and back." << endl
        << "  --apimapping" << endl
        << "          Generates a mapping of declared aidl method signatures to" << endl
        << "          the original line number. e.g.: " << endl
@@ -111,12 +166,156 @@ string Options::GetUsage() const {
        << "          VER must be an interger greater than 0." << endl
        << "  --hash=HASH" << endl
        << "          Set the interface hash to HASH." << endl
-       << "  --log" << endl
-       << "          Information about the transaction, e.g., method name, argument" << endl
-       << "          values, execution time, etc., is provided via callback." << endl
+       << "  --log[=json|binary]" << endl
+       << "          json (default): Information about the transaction, e.g., method" << endl
+       << "          name, argument values, execution time, etc., is provided via" << endl
+       << "          callback." << endl
+       << "          binary: Each transaction is recorded as a fixed-size record in a" << endl
+       << "          per-process ring buffer, which the decodeTransactionRecord() of" << endl
+       << "          the interface turns into JSON." << endl
        << "  --parcelable-to-string" << endl
        << "          Generates an implementation of toString() for Java parcelables," << endl
        << "          and ostream& operator << for C++ parcelables." << endl
+       << "  --binary-preprocessed" << endl
+       << "          With --preprocess, write the output in a binary form that" << endl
+       << "          is faster to load with -p." << endl
+       << "  --scan-declarations" << endl
+       << "          With --preprocess, read only the package and the names of" << endl
+       << "          the declarations of each file, skipping the bodies of the" << endl
+       << "          types, and read the files in parallel with -j. Errors inside" << endl
+       << "          the bodies aren't reported." << endl
+       << "  --write-if-changed" << endl
+       << "          Don't rewrite output files whose contents are unchanged, so" << endl
+       << "          that their timestamps stay the same." << endl
+       << "  --batch-primitive-fields" << endl
+       << "          For C++ and NDK parcelables, read and write runs of adjacent" << endl
+       << "          primitive fields as one block. The wire format is the same." << endl
+       << "  --parcel-capacity-hints" << endl
+       << "          For C++ proxies, reserve the capacity of the parcel for the" << endl
+       << "          arguments, estimated from their types, before writing them." << endl
+       << "  --static-interface-token" << endl
+       << "          In C++ proxies and stubs, write and check the interface token" << endl
+       << "          with the static descriptor of the interface rather than the" << endl
+       << "          one returned by the virtual getInterfaceDescriptor()." << endl
+       << "  --forward-declare-types" << endl
+       << "          In C++ and NDK interface headers, declare the interfaces and" << endl
+       << "          structured parcelables that methods refer to rather than" << endl
+       << "          include their headers, which only the sources include. Code" << endl
+       << "          that calls the methods includes the headers of the types it" << endl
+       << "          uses. Headers that need the complete types, e.g. with" << endl
+       << "          --gen-async or --in-args-by-value, include them as before." << endl
+       << "  --java-dispatch-table" << endl
+       << "          In Java stubs, dispatch transactions through a table of" << endl
+       << "          handlers indexed by the transaction code rather than a switch." << endl
+       << "          The generated code uses lambdas and needs Java 8." << endl
+       << "  --native-dispatch-table" << endl
+       << "          In C++ and NDK stubs, handle each transaction in a function of" << endl
+       << "          its own, and dispatch through a table of them indexed by the" << endl
+       << "          transaction code rather than a switch." << endl
+       << "  --bulk-fd-arrays" << endl
+       << "          In C++ and NDK code, read and write the non-nullable arrays" << endl
+       << "          of FileDescriptor and ParcelFileDescriptor with generated" << endl
+       << "          helpers. They size the parcel and the vector once for all" << endl
+       << "          of the descriptors." << endl
+       << "  --static-ok-status" << endl
+       << "          In NDK proxies, return the shared status of AStatus_newOk()" << endl
+       << "          when a call succeeds rather than allocate a status for it." << endl
+       << "          AStatus_newOk() allocates nothing since Android 12." << endl
+       << "  --source-shards=N" << endl
+       << "          Move the C++ proxy methods, and the stub handlers of" << endl
+       << "          --native-dispatch-table, of each interface into N more" << endl
+       << "          sources, IFoo-1.cpp to IFoo-N.cpp next to IFoo.cpp, so that" << endl
+       << "          they can be compiled in parallel. The methods are dealt to" << endl
+       << "          the sources in the order they are declared." << endl
+       << "  --cold-error-paths" << endl
+       << "          In C++ and NDK code, mark the status checks as unlikely to fail," << endl
+       << "          and move the lookup of and the fallback to the default" << endl
+       << "          implementation of proxies out of line into cold functions." << endl
+       << "  --optimize-for=speed|size" << endl
+       << "          speed (default): C++ and NDK proxies and stubs marshal each" << endl
+       << "          argument with code of its own." << endl
+       << "          size: methods whose arguments are all primitives or Strings" << endl
+       << "          marshal them with a shared routine driven by a table of" << endl
+       << "          their types." << endl
+       << "  --parcel-traits" << endl
+       << "          For C++ parcelables whose fields are all primitives, read and" << endl
+       << "          write vectors of them as one block. The parcelables must be" << endl
+       << "          compiled with it, too. The wire format is the same." << endl
+       << "  --in-args-by-value" << endl
+       << "          In C++ interfaces, pass in arguments that would be passed by" << endl
+       << "          const reference by value instead, so that stubs move them into" << endl
+       << "          the implementation." << endl
+       << "  --gen-prewarm" << endl
+       << "          In C++ and NDK interfaces, generate prewarm(), which gets the" << endl
+       << "          service in the background, so that a lazy service is" << endl
+       << "          started before its first call." << endl
+       << "  --gen-async" << endl
+       << "          In C++ and NDK interfaces, generate an Async() variant of each" << endl
+       << "          method, which makes the call on a worker thread and passes" << endl
+       << "          its results to a callback." << endl
+       << "  --gen-coroutines" << endl
+       << "          In C++ and NDK interfaces, generate an Await() variant of each" << endl
+       << "          method, which a C++20 coroutine can co_await. The call is made" << endl
+       << "          on the same executor as the Async() methods." << endl
+       << "  --nullable-optional" << endl
+       << "          In C++ code, hold @nullable values in std::optional instead of" << endl
+       << "          std::unique_ptr, so that present values aren't allocated on" << endl
+       << "          the heap. The wire format is the same." << endl
+       << "  --compact-parcel-layout" << endl
+       << "          In C++ and NDK parcelables, declare the fields by decreasing" << endl
+       << "          alignment to leave less padding between them. They are still" << endl
+       << "          read, written and compared in the order of the AIDL file." << endl
+       << "  --reuse-containers" << endl
+       << "          In Java parcelables, readFromParcel() refills the arrays and" << endl
+       << "          Lists that the fields hold already, when they fit, instead of" << endl
+       << "          replacing them. Other references to them see the new values." << endl
+       << "  --lazy-descriptors" << endl
+       << "          Make the C++ descriptor and the NDK binder class of each" << endl
+       << "          interface on first use instead of when the library is" << endl
+       << "          loaded. In C++, descriptor then converts to a String16" << endl
+       << "          instead of being one." << endl
+       << "  --gen-stats" << endl
+       << "          Record the call count and a latency histogram of each method" << endl
+       << "          in proxies and stubs, which dumpStats() writes out." << endl
+       << "  --profile=FILE" << endl
+       << "          Write how long each phase took and counters such as the" << endl
+       << "          number of files parsed to FILE as Chrome trace-event JSON." << endl
+       << "          aidl-allocation-profile also records the allocations and" << endl
+       << "          the peak RSS of each phase." << endl
+       << "  --transaction-profile=FILE" << endl
+       << "          Use the call counts of FILE, one method and its count per" << endl
+       << "          line or the output of dumpStats() of --gen-stats, to keep the" << endl
+       << "          most called methods in Java onTransact() when it is outlined," << endl
+       << "          to order the cases of onTransact by decreasing count, and to" << endl
+       << "          mark the handlers of --native-dispatch-table hot or cold." << endl
+       << "  --outline-threshold=N, --non-outline-count=M" << endl
+       << "          In Java, handle transactions in methods of their own when" << endl
+       << "          an interface has more than N methods, except for M of them." << endl
+       << "          Both default to 275." << endl
+       << "  --codegen-report=FILE" << endl
+       << "          Write to FILE as JSON the lines and bytes generated for each" << endl
+       << "          type and, for each method, the parcel reads and writes of a" << endl
+       << "          call, how deeply its parcelables nest and, in Java, whether" << endl
+       << "          onTransact() outlines it." << endl
+       << "  -j N, --jobs=N" << endl
+       << "          Generate code for the input files with N threads, and parse" << endl
+       << "          the files each of them imports with N threads. With" << endl
+       << "          --checkapi, load the dumps and compare their types" << endl
+       << "          with N threads." << endl
+       << "  --prefetch-depth=N" << endl
+       << "          Read up to N of the files to import in the background while" << endl
+       << "          the compiler is busy with others. 0, the default, reads each" << endl
+       << "          one when it is parsed." << endl
+       << "  --stage-outputs=N" << endl
+       << "          Keep the generated files in memory until all of them are" << endl
+       << "          generated, and then write them with N threads, after making" << endl
+       << "          each of their directories once. Not used with --server." << endl
+       << "  --output-cache=DIR" << endl
+       << "          Keep the code generated for each type in DIR, keyed by the" << endl
+       << "          contents of the files it is generated from and the flags" << endl
+       << "          that change it. Later builds with the same key copy the code" << endl
+       << "          from DIR instead of generating it again. DIR must only be" << endl
+       << "          shared by builds that use the same aidl binary." << endl
        << "  --help" << endl
        << "          Show this help." << endl
        << endl
@@ -143,6 +342,28 @@ bool Options::StabilityFromString(const std::string& stability, Stability* out_s
   return false;
 }
 
+string Options::OutputCacheFlags() const {
+  // --out, --header_out, --dep, --combined-dep, -a, --ninja, --jobs,
+  // --prefetch-depth, --write-if-changed, --profile, --output-cache and
+  // --stage-outputs. The contents of the files named by --include, --import
+  // and --preprocessed are part of the cache key instead of their names, and
+  // so are the counts of --transaction-profile.
+  static const std::set<int> kIgnored = {'o', 'h', 'd', 'N', 'a', 'n', 'j', 'D',
+                                         'W', 'F', 'g', 'I', 'm', 'p', kOptStageOutputs,
+                                         kOptCodegenReport, kOptTransactionProfile};
+  std::ostringstream flags;
+  flags << static_cast<int>(language_) << " " << static_cast<int>(task_) << "\n";
+  for (const auto& [c, arg] : flags_) {
+    if (kIgnored.count(c) == 0) {
+      flags << c << " " << arg << "\n";
+    }
+  }
+  for (const auto& [name, count] : transaction_profile_) {
+    flags << "profile " << name << " " << count << "\n";
+  }
+  return flags.str();
+}
+
 Options Options::From(const string& cmdline) {
   vector<string> args = Split(cmdline, " ");
   return From(args);
@@ -163,9 +384,85 @@ Options Options::From(const vector<string>& args) {
   return Options(argc, argv, lang);
 }
 
+// Replaces each argument @FILE in |args| with the arguments in FILE. Returns
+// false if a file cannot be read.
+static bool ExpandResponseFiles(vector<string>* args, ErrorMessage* error) {
+  vector<string> expanded;
+  for (const string& arg : *args) {
+    if (arg.size() < 2 || arg[0] != '@') {
+      expanded.push_back(arg);
+      continue;
+    }
+    string contents;
+    if (!android::base::ReadFileToString(arg.substr(1), &contents)) {
+      *error << "Cannot read response file " << arg.substr(1) << "." << endl;
+      return false;
+    }
+    for (const string& token : Split(contents, " \t\r\n")) {
+      if (!token.empty()) {
+        expanded.push_back(token);
+      }
+    }
+  }
+  *args = std::move(expanded);
+  return true;
+}
+
+// Each line of a profile is a method, or an interface and a method separated
+// by a dot, followed either by its call count or, as in the lines that
+// dumpStats() of --gen-stats writes, by "server: count=N ...". Lines of
+// client calls, empty lines and lines starting with # are skipped.
+bool Options::AddTransactionProfile(const string& file, const string& contents) {
+  const vector<string> lines = Split(contents, "\n");
+  for (size_t i = 0; i < lines.size(); i++) {
+    const string line = Trim(lines[i]);
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    vector<string> words = Split(line, " ");
+    if (words.size() >= 2 && words[1] == "client:") {
+      continue;
+    }
+    if (words.size() >= 3 && words[1] == "server:" &&
+        android::base::StartsWith(words[2], "count=")) {
+      words[1] = words[2].substr(strlen("count="));
+    }
+    uint64_t count;
+    if (words.size() < 2 || !android::base::ParseUint(words[1], &count)) {
+      LOG(ERROR) << file << ":" << i + 1 << ": Invalid transaction profile line.";
+      return false;
+    }
+    transaction_profile_[words[0]] += count;
+  }
+  return true;
+}
+
+uint64_t Options::TransactionCount(const string& interface_name, const string& method) const {
+  auto it = transaction_profile_.find(interface_name + "." + method);
+  if (it == transaction_profile_.end()) {
+    it = transaction_profile_.find(method);
+  }
+  return it != transaction_profile_.end() ? it->second : 0;
+}
+
 Options::Options(int argc, const char* const argv[], Options::Language default_lang)
     : myname_(argv[0]), language_(default_lang) {
   bool lang_option_found = false;
+  // Keeps the arguments of response files alive while they are parsed
+  vector<string> expanded_args;
+  vector<const char*> expanded_argv;
+  if (std::any_of(argv + 1, argv + argc, [](const char* arg) { return arg[0] == '@'; })) {
+    expanded_args.assign(argv, argv + argc);
+    if (!ExpandResponseFiles(&expanded_args, &error_message_)) {
+      return;
+    }
+    for (const string& arg : expanded_args) {
+      expanded_argv.push_back(arg.c_str());
+    }
+    expanded_argv.push_back(nullptr);
+    argc = expanded_args.size();
+    argv = expanded_argv.data();
+  }
   optind = 0;
   while (true) {
     static struct option long_options[] = {
@@ -174,32 +471,71 @@ Options::Options(int argc, const char* const argv[], Options::Language default_l
 #ifndef _WIN32
         {"dumpapi", no_argument, 0, 'u'},
         {"checkapi", no_argument, 0, 'A'},
+        {"compute-hash", no_argument, 0, 'Z'},
 #endif
+        {"server", no_argument, 0, 'R'},
+        {"batch", no_argument, 0, 'k'},
         {"apimapping", required_argument, 0, 'i'},
         {"include", required_argument, 0, 'I'},
         {"import", required_argument, 0, 'm'},
         {"preprocessed", required_argument, 0, 'p'},
         {"dep", required_argument, 0, 'd'},
+        {"combined-dep", required_argument, 0, 'N'},
         {"out", required_argument, 0, 'o'},
         {"header_out", required_argument, 0, 'h'},
         {"ninja", no_argument, 0, 'n'},
         {"stability", required_argument, 0, 'Y'},
         {"structured", no_argument, 0, 'S'},
         {"trace", no_argument, 0, 't'},
+        {"trace-parcel-sizes", no_argument, 0, 'X'},
         {"transaction_names", no_argument, 0, 'c'},
         {"version", required_argument, 0, 'v'},
-        {"log", no_argument, 0, 'L'},
+        {"log", optional_argument, 0, 'L'},
         {"parcelable-to-string", no_argument, 0, 'P'},
         {"hash", required_argument, 0, 'H'},
+        {"jobs", required_argument, 0, 'j'},
+        {"prefetch-depth", required_argument, 0, 'D'},
+        {"output-cache", required_argument, 0, 'g'},
+        {"binary-preprocessed", no_argument, 0, 'B'},
+        {"write-if-changed", no_argument, 0, 'W'},
+        {"profile", required_argument, 0, 'F'},
+        {"batch-primitive-fields", no_argument, 0, 'G'},
+        {"parcel-capacity-hints", no_argument, 0, 'K'},
+        {"static-interface-token", no_argument, 0, 'q'},
+        {"forward-declare-types", no_argument, 0, 'w'},
+        {"source-shards", required_argument, 0, 'x'},
+        {"static-ok-status", no_argument, 0, 'y'},
+        {"bulk-fd-arrays", no_argument, 0, 'z'},
+        {"java-dispatch-table", no_argument, 0, 'J'},
+        {"native-dispatch-table", no_argument, 0, 'M'},
+        {"cold-error-paths", no_argument, 0, 'O'},
+        {"optimize-for", required_argument, 0, 'f'},
+        {"gen-stats", no_argument, 0, 'Q'},
+        {"parcel-traits", no_argument, 0, 'T'},
+        {"in-args-by-value", no_argument, 0, 'U'},
+        {"gen-prewarm", no_argument, 0, 'V'},
+        {"gen-async", no_argument, 0, 'C'},
+        {"gen-coroutines", no_argument, 0, 'E'},
+        {"nullable-optional", no_argument, 0, kOptNullableOptional},
+        {"compact-parcel-layout", no_argument, 0, kOptCompactParcelLayout},
+        {"reuse-containers", no_argument, 0, kOptReuseContainers},
+        {"stage-outputs", required_argument, 0, kOptStageOutputs},
+        {"codegen-report", required_argument, 0, kOptCodegenReport},
+        {"transaction-profile", required_argument, 0, kOptTransactionProfile},
+        {"outline-threshold", required_argument, 0, kOptOutlineThreshold},
+        {"non-outline-count", required_argument, 0, kOptNonOutlineCount},
+        {"lazy-descriptors", no_argument, 0, kOptLazyDescriptors},
+        {"scan-declarations", no_argument, 0, kOptScanDeclarations},
         {"help", no_argument, 0, 'e'},
         {0, 0, 0, 0},
     };
     const int c = getopt_long(argc, const_cast<char* const*>(argv),
-                              "I:m:p:d:o:h:abtv:", long_options, nullptr);
+                              "I:m:p:d:o:h:abtv:j:", long_options, nullptr);
     if (c == -1) {
       // no more options
       break;
     }
+    flags_.emplace_back(c, optarg != nullptr ? optarg : "");
     switch (c) {
       case 'l':
         if (language_ == Options::Language::CPP) {
@@ -243,7 +579,23 @@ Options::Options(int argc, const char* const argv[], Options::Language default_l
           structured_ = true;
         }
         break;
+      case 'Z':
+        if (task_ != Options::Task::UNSPECIFIED) {
+          task_ = Options::Task::COMPUTE_HASH;
+          structured_ = true;
+        }
+        break;
 #endif
+      case 'R':
+        if (task_ != Options::Task::UNSPECIFIED) {
+          task_ = Options::Task::SERVER;
+        }
+        break;
+      case 'k':
+        if (task_ != Options::Task::UNSPECIFIED) {
+          task_ = Options::Task::BATCH;
+        }
+        break;
       case 'I': {
         import_dirs_.emplace(Trim(optarg));
         break;
@@ -258,6 +610,9 @@ Options::Options(int argc, const char* const argv[], Options::Language default_l
       case 'd':
         dependency_file_ = Trim(optarg);
         break;
+      case 'N':
+        combined_dependency_file_ = Trim(optarg);
+        break;
       case 'o':
         output_dir_ = Trim(optarg);
         if (output_dir_.back() != OS_PATH_SEPARATOR) {
@@ -288,6 +643,9 @@ Options::Options(int argc, const char* const argv[], Options::Language default_l
       case 't':
         gen_traces_ = true;
         break;
+      case 'X':
+        trace_parcel_sizes_ = true;
+        break;
       case 'a':
         auto_dep_file_ = true;
         break;
@@ -312,9 +670,43 @@ Options::Options(int argc, const char* const argv[], Options::Language default_l
       case 'H':
         hash_ = Trim(optarg);
         break;
-      case 'L':
-        gen_log_ = true;
+      case 'j': {
+        const string jobs_str = Trim(optarg);
+        int jobs = atoi(jobs_str.c_str());
+        if (jobs > 0) {
+          jobs_ = jobs;
+        } else {
+          error_message_ << "Invalid number of jobs: '" << jobs_str << "'. "
+                         << "It must be a positive natural number." << endl;
+          return;
+        }
+        break;
+      }
+      case 'D': {
+        const string depth_str = Trim(optarg);
+        int depth = atoi(depth_str.c_str());
+        if (depth > 0 || depth_str == "0") {
+          prefetch_depth_ = depth;
+        } else {
+          error_message_ << "Invalid prefetch depth: '" << depth_str << "'. "
+                         << "It must be a natural number." << endl;
+          return;
+        }
         break;
+      }
+      case 'L': {
+        const string format = optarg != nullptr ? Trim(optarg) : "json";
+        if (format == "json") {
+          gen_log_ = true;
+        } else if (format == "binary") {
+          gen_binary_log_ = true;
+        } else {
+          error_message_ << "Invalid --log format: '" << format << "'. "
+                         << "It must be json or binary." << endl;
+          return;
+        }
+        break;
+      }
       case 'e':
         std::cerr << GetUsage();
         exit(0);
@@ -325,6 +717,136 @@ Options::Options(int argc, const char* const argv[], Options::Language default_l
       case 'P':
         gen_parcelable_to_string_ = true;
         break;
+      case 'B':
+        binary_preprocessed_ = true;
+        break;
+      case 'W':
+        write_if_changed_ = true;
+        break;
+      case 'F':
+        profile_file_ = Trim(optarg);
+        break;
+      case 'g':
+        output_cache_dir_ = Trim(optarg);
+        if (!output_cache_dir_.empty() && output_cache_dir_.back() != OS_PATH_SEPARATOR) {
+          output_cache_dir_.push_back(OS_PATH_SEPARATOR);
+        }
+        break;
+      case 'G':
+        batch_primitive_fields_ = true;
+        break;
+      case 'K':
+        parcel_capacity_hints_ = true;
+        break;
+      case 'q':
+        static_interface_token_ = true;
+        break;
+      case 'w':
+        forward_declare_types_ = true;
+        break;
+      case 'y':
+        static_ok_status_ = true;
+        break;
+      case 'z':
+        bulk_fd_arrays_ = true;
+        break;
+      case 'x': {
+        const string shards_str = Trim(optarg);
+        int shards = atoi(shards_str.c_str());
+        if (shards > 0) {
+          source_shards_ = shards;
+        } else {
+          error_message_ << "Invalid number of source shards: '" << shards_str << "'. "
+                         << "It must be a positive natural number." << endl;
+          return;
+        }
+        break;
+      }
+      case 'J':
+        java_dispatch_table_ = true;
+        break;
+      case 'M':
+        native_dispatch_table_ = true;
+        break;
+      case 'O':
+        cold_error_paths_ = true;
+        break;
+      case 'f': {
+        const string goal = Trim(optarg);
+        if (goal == "speed") {
+          optimize_for_size_ = false;
+        } else if (goal == "size") {
+          optimize_for_size_ = true;
+        } else {
+          error_message_ << "Invalid --optimize-for: '" << goal << "'. "
+                         << "It must be speed or size." << endl;
+          return;
+        }
+        break;
+      }
+      case 'Q':
+        gen_stats_ = true;
+        break;
+      case 'T':
+        parcel_traits_ = true;
+        break;
+      case 'U':
+        in_args_by_value_ = true;
+        break;
+      case 'V':
+        gen_prewarm_ = true;
+        break;
+      case 'C':
+        gen_async_ = true;
+        break;
+      case 'E':
+        gen_coroutines_ = true;
+        break;
+      case kOptNullableOptional:
+        nullable_optional_ = true;
+        break;
+      case kOptCompactParcelLayout:
+        compact_parcel_layout_ = true;
+        break;
+      case kOptReuseContainers:
+        reuse_containers_ = true;
+        break;
+      case kOptLazyDescriptors:
+        lazy_descriptors_ = true;
+        break;
+      case kOptScanDeclarations:
+        scan_declarations_ = true;
+        break;
+      case kOptStageOutputs: {
+        const string threads_str = Trim(optarg);
+        int threads = atoi(threads_str.c_str());
+        if (threads > 0) {
+          stage_outputs_ = threads;
+        } else {
+          error_message_ << "Invalid number of threads: '" << threads_str << "'. "
+                         << "It must be a positive natural number." << endl;
+          return;
+        }
+        break;
+      }
+      case kOptCodegenReport:
+        codegen_report_file_ = Trim(optarg);
+        break;
+      case kOptTransactionProfile:
+        transaction_profile_files_.push_back(Trim(optarg));
+        break;
+      case kOptOutlineThreshold:
+      case kOptNonOutlineCount: {
+        const string count_str = Trim(optarg);
+        size_t count;
+        if (!android::base::ParseUint(count_str, &count)) {
+          error_message_ << "Invalid number of methods: '" << count_str << "'." << endl;
+          return;
+        }
+        (c == kOptOutlineThreshold ? onTransact_outline_threshold_
+                                   : onTransact_non_outline_count_) = count;
+        break;
+      }
       default:
         std::cerr << GetUsage();
         exit(1);
@@ -375,7 +897,17 @@ Options::Options(int argc, const char* const argv[], Options::Language default_l
     }
   } else {
     // the new arguments format
-    if (task_ == Options::Task::COMPILE || task_ == Options::Task::DUMP_API) {
+    if (task_ == Options::Task::SERVER) {
+      if (argc - optind > 0) {
+        error_message_ << "--server doesn't take any input file." << endl;
+        return;
+      }
+    } else if (task_ == Options::Task::BATCH) {
+      if (argc - optind != 1) {
+        error_message_ << "--batch takes exactly one manifest file." << endl;
+        return;
+      }
+    } else if (task_ == Options::Task::COMPILE || task_ == Options::Task::DUMP_API) {
       if (argc - optind < 1) {
         error_message_ << "No input file." << endl;
         return;
@@ -437,10 +969,20 @@ Options::Options(int argc, const char* const argv[], Options::Language default_l
       error_message_ << "-d or --dep doesn't work when compiling multiple AIDL "
                      << "files. Use '-a' to generate dependency file next to "
                      << "the output file with the name based on the input "
-                     << "file." << endl;
+                     << "file, or --combined-dep to generate one for all of "
+                     << "them." << endl;
+      return;
+    }
+    if (!dependency_file_.empty() && !combined_dependency_file_.empty()) {
+      error_message_ << "-d or --dep can't be used with --combined-dep." << endl;
       return;
     }
-    if (gen_log_ && (language_ != Options::Language::CPP && language_ != Options::Language::NDK)) {
+    if (trace_parcel_sizes_ && !gen_traces_) {
+      error_message_ << "--trace-parcel-sizes requires --trace" << endl;
+      return;
+    }
+    if ((gen_log_ || gen_binary_log_) &&
+        (language_ != Options::Language::CPP && language_ != Options::Language::NDK)) {
       error_message_ << "--log is currently supported for either --lang=cpp or --lang=ndk" << endl;
       return;
     }
@@ -450,10 +992,28 @@ Options::Options(int argc, const char* const argv[], Options::Language default_l
       error_message_ << "--version should not be used with '--preprocess'." << endl;
       return;
     }
+  } else if (binary_preprocessed_) {
+    error_message_ << "--binary-preprocessed can be used only with '--preprocess'." << endl;
+    return;
+  } else if (scan_declarations_) {
+    error_message_ << "--scan-declarations can be used only with '--preprocess'." << endl;
+    return;
+  }
+  if (onTransact_non_outline_count_ > onTransact_outline_threshold_) {
+    error_message_ << "--non-outline-count must not be greater than --outline-threshold."
+                   << endl;
+    return;
   }
   if (task_ == Options::Task::CHECK_API) {
-    if (input_files_.size() != 2) {
-      error_message_ << "--checkapi requires two inputs for comparing, "
+    if (input_files_.size() < 2) {
+      error_message_ << "--checkapi requires at least two inputs for comparing, "
+                     << "but got " << input_files_.size() << "." << endl;
+      return;
+    }
+  }
+  if (task_ == Options::Task::COMPUTE_HASH) {
+    if (input_files_.size() != 1) {
+      error_message_ << "--compute-hash requires one input directory, "
                      << "but got " << input_files_.size() << "." << endl;
       return;
     }
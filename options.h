@@ -15,6 +15,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <map>
 #include <set>
 #include <sstream>
 #include <string>
@@ -61,11 +63,23 @@ class Options final {
  public:
   enum class Language { UNSPECIFIED, JAVA, CPP, NDK };
 
-  enum class Task { UNSPECIFIED, COMPILE, PREPROCESS, DUMP_API, CHECK_API, DUMP_MAPPINGS };
+  enum class Task {
+    UNSPECIFIED,
+    COMPILE,
+    PREPROCESS,
+    DUMP_API,
+    CHECK_API,
+    DUMP_MAPPINGS,
+    COMPUTE_HASH,
+    SERVER,
+    BATCH
+  };
 
   enum class Stability { UNSPECIFIED, VINTF };
   bool StabilityFromString(const std::string& stability, Stability* out_stability);
 
+  // An argument @FILE is replaced by the whitespace-separated arguments in
+  // FILE, for command lines that would be too long otherwise.
   Options(int argc, const char* const argv[], Language default_lang = Language::UNSPECIFIED);
 
   static Options From(const string& cmdline);
@@ -96,8 +110,14 @@ class Options final {
 
   bool AutoDepFile() const { return auto_dep_file_; }
 
+  // One dependency file for all of the input files, if not empty.
+  const string& CombinedDependencyFile() const { return combined_dependency_file_; }
+
   bool GenTraces() const { return gen_traces_; }
 
+  // Whether C++ and NDK proxies trace the sizes of their parcels as counters.
+  bool TraceParcelSizes() const { return trace_parcel_sizes_; }
+
   bool GenTransactionNames() const { return gen_transaction_names_; }
 
   bool DependencyFileNinja() const { return dependency_file_ninja_; }
@@ -125,8 +145,150 @@ class Options final {
 
   bool GenLog() const { return gen_log_; }
 
+  // Whether proxies and stubs record each call in the binary transaction log
+  // of --log=binary, instead of building JSON for GenLog().
+  bool GenBinaryLog() const { return gen_binary_log_; }
+
   bool GenParcelableToString() const { return gen_parcelable_to_string_; }
 
+  // Whether --preprocess writes the binary form of preprocessed files.
+  bool BinaryPreprocessed() const { return binary_preprocessed_; }
+
+  // Whether --preprocess reads only the declarations of the files instead of
+  // parsing them.
+  bool ScanDeclarations() const { return scan_declarations_; }
+
+  // Whether output files are left untouched when their contents don't change.
+  bool WriteIfChanged() const { return write_if_changed_; }
+
+  // Whether runs of adjacent primitive fields of parcelables are read and
+  // written as one block in the C++ and NDK backends.
+  bool BatchPrimitiveFields() const { return batch_primitive_fields_; }
+
+  // Whether C++ proxies reserve the capacity of the data parcel for the
+  // arguments before writing them.
+  bool ParcelCapacityHints() const { return parcel_capacity_hints_; }
+
+  // Whether C++ proxies and stubs use the static descriptor of the interface
+  // as its token, instead of getting it through the virtual
+  // getInterfaceDescriptor().
+  bool StaticInterfaceToken() const { return static_interface_token_; }
+
+  // Whether C++ and NDK interface headers declare the interfaces and
+  // structured parcelables that their methods refer to, and leave including
+  // their headers to the sources.
+  bool ForwardDeclareTypes() const { return forward_declare_types_; }
+
+  // Whether NDK proxies return the status of AStatus_newOk() for successful
+  // calls instead of allocating one.
+  bool StaticOkStatus() const { return static_ok_status_; }
+
+  // Whether C++ and NDK code reads and writes arrays of file descriptors with
+  // generated helpers that size the parcel and the vector once.
+  bool BulkFdArrays() const { return bulk_fd_arrays_; }
+
+  // The number of sources, besides the output file, that the methods of C++
+  // proxies and stubs are split into. 0 keeps them in the output file.
+  size_t SourceShards() const { return source_shards_; }
+
+  // Whether Java stubs dispatch transactions through a table of handlers
+  // instead of a switch.
+  bool JavaDispatchTable() const { return java_dispatch_table_; }
+
+  // Whether C++ and NDK stubs handle each transaction in a function of its
+  // own, and dispatch through a table of them instead of a switch.
+  bool NativeDispatchTable() const { return native_dispatch_table_; }
+
+  // Whether C++ and NDK code marks status checks as unlikely to fail, and
+  // looks up and calls the default implementation from cold functions.
+  bool ColdErrorPaths() const { return cold_error_paths_; }
+
+  // Whether C++ and NDK code is generated for --optimize-for=size, which
+  // marshals the arguments of simple methods with tables of their types.
+  bool OptimizeForSize() const { return optimize_for_size_; }
+
+  // Whether proxies and stubs record per-method call statistics.
+  bool GenStats() const { return gen_stats_; }
+
+  // Whether C++ parcelables with only primitive fields read and write vectors
+  // of themselves as one block, and whether vectors of them are read and
+  // written that way.
+  bool ParcelTraits() const { return parcel_traits_; }
+
+  // Whether C++ interfaces take in arguments that aren't primitives by value,
+  // so that stubs can move them into the implementation.
+  bool InArgsByValue() const { return in_args_by_value_; }
+
+  // Whether C++ and NDK interfaces have prewarm(), which gets the service in
+  // the background.
+  bool GenPrewarm() const { return gen_prewarm_; }
+
+  // Whether C++ and NDK interfaces have an Async() variant of each method,
+  // which makes the call on a worker thread and passes its results to a
+  // callback.
+  bool GenAsync() const { return gen_async_; }
+
+  // Whether C++ and NDK interfaces have an Await() variant of each method,
+  // which a coroutine can co_await.
+  bool GenCoroutines() const { return gen_coroutines_; }
+
+  // Whether C++ code holds @nullable values in std::optional instead of
+  // std::unique_ptr.
+  bool NullableOptional() const { return nullable_optional_; }
+
+  // Whether C++ and NDK parcelables declare their fields by decreasing
+  // alignment instead of in the order of the AIDL file.
+  bool CompactParcelLayout() const { return compact_parcel_layout_; }
+
+  // Whether Java parcelables read into the arrays and Lists their fields
+  // hold instead of replacing them.
+  bool ReuseContainers() const { return reuse_containers_; }
+
+  // Whether the C++ descriptor and the NDK binder class of interfaces are
+  // made on first use, so that they don't run static initializers.
+  bool LazyDescriptors() const { return lazy_descriptors_; }
+
+  // Where the per-phase timings and counters are written, if not empty.
+  const string& ProfileFile() const { return profile_file_; }
+
+  // Where the size and cost of the generated code are written, if not empty.
+  const string& CodegenReportFile() const { return codegen_report_file_; }
+
+  // Number of threads used to generate code. 1 means everything is generated
+  // on the calling thread.
+  size_t Jobs() const { return jobs_; }
+
+  // Number of files to import that may be read ahead of time. 0 disables it.
+  size_t PrefetchDepth() const { return prefetch_depth_; }
+
+  // Number of threads that write the generated files once all of them are
+  // generated. 0 means each file is written as soon as it is generated.
+  size_t StageOutputs() const { return stage_outputs_; }
+
+  // How often the method |method| of the interface |interface_name|, given by
+  // its canonical name, is called according to --transaction-profile. 0 if
+  // it isn't in the profile. HasTransactionProfile() tells whether there is
+  // one.
+  uint64_t TransactionCount(const string& interface_name, const string& method) const;
+  bool HasTransactionProfile() const { return !transaction_profile_.empty(); }
+
+  // The files of --transaction-profile. They are read by compile_aidl(),
+  // through its IoDelegate, which adds them with AddTransactionProfile().
+  const vector<string>& TransactionProfileFiles() const { return transaction_profile_files_; }
+
+  // Adds the counts of the profile |file|, whose text is |contents|. Returns
+  // false after logging an error for a line that isn't valid.
+  bool AddTransactionProfile(const string& file, const string& contents);
+
+  // Directory of the generated-code cache, or empty if there is none.
+  const string& OutputCacheDir() const { return output_cache_dir_; }
+
+  // The target language and the flags given that can change the generated
+  // code. Flags naming where outputs go or how they are produced, such as
+  // --out or --jobs, are left out, so that builds into different directories
+  // share cache entries.
+  string OutputCacheFlags() const;
+
   bool Ok() const { return error_message_.stream_.str().empty(); }
 
   string GetErrorMessage() const { return error_message_.stream_.str(); }
@@ -135,7 +297,7 @@ class Options final {
 
   bool GenApiMapping() const { return task_ == Task::DUMP_MAPPINGS; }
 
-  // The following are for testability, but cannot be influenced on the command line.
+  // Set by --outline-threshold and --non-outline-count.
   // Threshold of interface methods to enable outlining of onTransact cases.
   size_t onTransact_outline_threshold_{275u};
   // Number of cases to _not_ outline, if outlining is enabled.
@@ -151,7 +313,9 @@ class Options final {
   set<string> import_files_;
   vector<string> preprocessed_files_;
   string dependency_file_;
+  string combined_dependency_file_;
   bool gen_traces_ = false;
+  bool trace_parcel_sizes_ = false;
   bool gen_transaction_names_ = false;
   bool dependency_file_ninja_ = false;
   bool structured_ = false;
@@ -165,7 +329,43 @@ class Options final {
   int version_ = 0;
   string hash_ = "";
   bool gen_log_ = false;
+  bool gen_binary_log_ = false;
   bool gen_parcelable_to_string_ = false;
+  size_t jobs_ = 1;
+  size_t prefetch_depth_ = 0;
+  size_t stage_outputs_ = 0;
+  bool binary_preprocessed_ = false;
+  bool scan_declarations_ = false;
+  bool write_if_changed_ = false;
+  string profile_file_;
+  string codegen_report_file_;
+  vector<string> transaction_profile_files_;
+  // Call counts by method, or by interface and method
+  std::map<string, uint64_t> transaction_profile_;
+  string output_cache_dir_;
+  // Every option given, with its argument if it has one, in order
+  vector<std::pair<int, string>> flags_;
+  bool batch_primitive_fields_ = false;
+  bool parcel_capacity_hints_ = false;
+  bool static_interface_token_ = false;
+  bool forward_declare_types_ = false;
+  size_t source_shards_ = 0;
+  bool static_ok_status_ = false;
+  bool bulk_fd_arrays_ = false;
+  bool java_dispatch_table_ = false;
+  bool native_dispatch_table_ = false;
+  bool cold_error_paths_ = false;
+  bool optimize_for_size_ = false;
+  bool gen_stats_ = false;
+  bool parcel_traits_ = false;
+  bool in_args_by_value_ = false;
+  bool gen_prewarm_ = false;
+  bool gen_async_ = false;
+  bool gen_coroutines_ = false;
+  bool nullable_optional_ = false;
+  bool compact_parcel_layout_ = false;
+  bool reuse_containers_ = false;
+  bool lazy_descriptors_ = false;
   ErrorMessage error_message_;
 };
 
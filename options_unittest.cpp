@@ -21,6 +21,7 @@
 #include <string>
 #include <vector>
 
+#include <android-base/file.h>
 #include <gtest/gtest.h>
 
 using std::cerr;
@@ -287,6 +288,155 @@ TEST(OptionsTests, ParsesCompileCppMultiInput) {
   EXPECT_EQ(string{"src_out/"}, options->OutputDir());
 }
 
+TEST(OptionsTests, ParsesJobs) {
+  const char* argv[] = {
+      "aidl",        "--lang=cpp", "-h header_out", "-o src_out", "-j 8", "directory/input1.aidl",
+      "directory/input2.aidl", nullptr,
+  };
+  unique_ptr<Options> options = GetOptions(argv);
+  EXPECT_TRUE(options->Ok());
+  EXPECT_EQ(8u, options->Jobs());
+
+  const char* arg_with_bad_jobs[] = {
+      "aidl", "--lang=cpp", "-h header_out", "-o src_out", "--jobs=0", "directory/input1.aidl",
+      nullptr,
+  };
+  EXPECT_EQ(false, GetOptions(arg_with_bad_jobs)->Ok());
+}
+
+TEST(OptionsTests, ParsesPrefetchDepth) {
+  const char* argv[] = {
+      "aidl", "--lang=cpp", "-h header_out", "-o src_out", "--prefetch-depth=16",
+      "directory/input1.aidl", nullptr,
+  };
+  unique_ptr<Options> options = GetOptions(argv);
+  EXPECT_TRUE(options->Ok());
+  EXPECT_EQ(16u, options->PrefetchDepth());
+
+  const char* arg_with_bad_depth[] = {
+      "aidl", "--lang=cpp", "-h header_out", "-o src_out", "--prefetch-depth=many",
+      "directory/input1.aidl", nullptr,
+  };
+  EXPECT_EQ(false, GetOptions(arg_with_bad_depth)->Ok());
+}
+
+TEST(OptionsTests, ParsesComputeHash) {
+  const char* argv[] = {"aidl", "--compute-hash", "--version=3", "out/.hash", "api/3", nullptr};
+  unique_ptr<Options> options = GetOptions(argv);
+  EXPECT_TRUE(options->Ok());
+  EXPECT_EQ(Options::Task::COMPUTE_HASH, options->GetTask());
+  EXPECT_EQ("out/.hash", options->OutputFile());
+  EXPECT_EQ(vector<string>{"api/3"}, options->InputFiles());
+  EXPECT_EQ(3, options->Version());
+
+  const char* two_dirs[] = {"aidl", "--compute-hash", "out/.hash", "api/2", "api/3", nullptr};
+  EXPECT_EQ(false, GetOptions(two_dirs)->Ok());
+}
+
+TEST(OptionsTests, ParsesTraceParcelSizes) {
+  const char* argv[] = {
+      "aidl", "--lang=cpp", "-t", "--trace-parcel-sizes", "-h header_out", "-o src_out",
+      "directory/input1.aidl", nullptr,
+  };
+  unique_ptr<Options> options = GetOptions(argv);
+  EXPECT_TRUE(options->Ok());
+  EXPECT_TRUE(options->TraceParcelSizes());
+
+  const char* arg_without_trace[] = {
+      "aidl", "--lang=cpp", "--trace-parcel-sizes", "-h header_out", "-o src_out",
+      "directory/input1.aidl", nullptr,
+  };
+  EXPECT_EQ(false, GetOptions(arg_without_trace)->Ok());
+}
+
+TEST(OptionsTests, ParsesServer) {
+  const char* argv[] = {"aidl", "--server", nullptr};
+  unique_ptr<Options> options = GetOptions(argv);
+  EXPECT_TRUE(options->Ok());
+  EXPECT_EQ(Options::Task::SERVER, options->GetTask());
+
+  const char* arg_with_input[] = {"aidl", "--server", "directory/input1.aidl", nullptr};
+  EXPECT_EQ(false, GetOptions(arg_with_input)->Ok());
+}
+
+TEST(OptionsTests, ParsesBatch) {
+  const char* argv[] = {"aidl", "--batch", "manifest.txt", nullptr};
+  unique_ptr<Options> options = GetOptions(argv);
+  EXPECT_TRUE(options->Ok());
+  EXPECT_EQ(Options::Task::BATCH, options->GetTask());
+  EXPECT_EQ(vector<string>{"manifest.txt"}, options->InputFiles());
+
+  const char* arg_without_manifest[] = {"aidl", "--batch", nullptr};
+  EXPECT_EQ(false, GetOptions(arg_without_manifest)->Ok());
+}
+
+TEST(OptionsTests, ExpandsResponseFiles) {
+  TemporaryFile file;
+  ASSERT_TRUE(android::base::WriteStringToFile(
+      "--lang=cpp -h header_out\n\t-o src_out\ndirectory/input1.aidl  directory/input2.aidl\n",
+      file.path));
+  const string response_file = string("@") + file.path;
+  const char* argv[] = {"aidl", response_file.c_str(), "directory/input3.aidl", nullptr};
+  unique_ptr<Options> options = GetOptions(argv);
+  EXPECT_TRUE(options->Ok());
+  EXPECT_EQ(Options::Language::CPP, options->TargetLanguage());
+  EXPECT_EQ("src_out/", options->OutputDir());
+  EXPECT_EQ((vector<string>{"directory/input1.aidl", "directory/input2.aidl",
+                            "directory/input3.aidl"}),
+            options->InputFiles());
+
+  const char* arg_missing_file[] = {"aidl", "@/does/not/exist", nullptr};
+  EXPECT_EQ(false, GetOptions(arg_missing_file)->Ok());
+}
+
+TEST(OptionsTests, ParsesTransactionProfile) {
+  const char* argv[] = {
+      "aidl", "--lang=java", "--transaction-profile=calls.txt", "--outline-threshold=4",
+      "--non-outline-count=2", "-o", "out", "p/IFoo.aidl", nullptr,
+  };
+  unique_ptr<Options> options = GetOptions(argv);
+  EXPECT_TRUE(options->Ok());
+  EXPECT_EQ(vector<string>{"calls.txt"}, options->TransactionProfileFiles());
+  EXPECT_FALSE(options->HasTransactionProfile());
+  EXPECT_TRUE(options->AddTransactionProfile(
+      "calls.txt",
+      "# counts\n"
+      "foo 10\n"
+      "p.IBar.foo 3\n"
+      "bar server: count=7 mean=12us p50<16us p90<32us p99<64us\n"
+      "bar client: count=100 mean=20us p50<32us p90<64us p99<128us\n"
+      "bar server: count=1 mean=12us p50<16us p90<32us p99<64us\n"));
+  EXPECT_TRUE(options->HasTransactionProfile());
+  EXPECT_EQ(10u, options->TransactionCount("p.IFoo", "foo"));
+  EXPECT_EQ(3u, options->TransactionCount("p.IBar", "foo"));
+  EXPECT_EQ(8u, options->TransactionCount("p.IFoo", "bar"));
+  EXPECT_EQ(0u, options->TransactionCount("p.IFoo", "baz"));
+  EXPECT_EQ(4u, options->onTransact_outline_threshold_);
+  EXPECT_EQ(2u, options->onTransact_non_outline_count_);
+
+  EXPECT_FALSE(GetOptions(argv)->AddTransactionProfile("calls.txt", "foo many\n"));
+
+  const char* inverted[] = {"aidl", "--lang=java", "--outline-threshold=2",
+                            "--non-outline-count=4", "p/IFoo.aidl", nullptr};
+  EXPECT_FALSE(GetOptions(inverted)->Ok());
+}
+
+TEST(OptionsTests, ParsesCombinedDependencyFile) {
+  const char* argv[] = {
+      "aidl", "--lang=java", "--combined-dep=out/all.d", "-o src_out",
+      "directory/input1.aidl", "directory/input2.aidl", nullptr,
+  };
+  unique_ptr<Options> options = GetOptions(argv);
+  EXPECT_TRUE(options->Ok());
+  EXPECT_EQ("out/all.d", options->CombinedDependencyFile());
+
+  const char* arg_with_dep[] = {
+      "aidl", "--lang=java", "--combined-dep=out/all.d", "-d out/input1.d", "-o src_out",
+      "directory/input1.aidl", nullptr,
+  };
+  EXPECT_EQ(false, GetOptions(arg_with_dep)->Ok());
+}
+
 TEST(OptionsTests, ParsesCompileCppInvalid) {
   // -o option is required
   const char* arg_with_no_out_dir[] = {
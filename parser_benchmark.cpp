@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "aidl.h"
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "aidl_typenames.h"
+#include "options.h"
+#include "tests/fake_io_delegate.h"
+
+using android::aidl::test::FakeIoDelegate;
+using std::string;
+using std::vector;
+
+namespace android {
+namespace aidl {
+
+namespace {
+
+// An interface with |num_methods| methods. Each has a few arguments with
+// annotations and directions, so that every kind of node is allocated.
+string LargeInterface(int num_methods) {
+  string source = "package p;\n/** Lots of methods. */\ninterface IFoo {\n";
+  for (int i = 0; i < num_methods; i++) {
+    source += "  /** Method " + std::to_string(i) + ". */\n";
+    source += "  @utf8InCpp String method" + std::to_string(i) +
+              "(int a, in @nullable String[] b, out List<String> c, inout long[] d);\n";
+  }
+  source += "  const int VALUE = 1 << 3 | 2;\n}\n";
+  return source;
+}
+
+void Load(const Options& options, const IoDelegate& io_delegate, benchmark::State& state) {
+  for (auto _ : state) {
+    AidlTypenames typenames;
+    vector<AidlDefinedType*> defined_types;
+    if (internals::load_and_validate_aidl(options.InputFiles().front(), options, io_delegate,
+                                          &typenames, &defined_types,
+                                          nullptr) != AidlError::OK) {
+      state.SkipWithError("Cannot load the input");
+      return;
+    }
+    benchmark::DoNotOptimize(defined_types);
+  }
+}
+
+void BM_LoadLargeInterface(benchmark::State& state) {
+  FakeIoDelegate io_delegate;
+  io_delegate.SetFileContents("p/IFoo.aidl", LargeInterface(state.range(0)));
+  Load(Options::From("aidl --lang=cpp -o out -h out p/IFoo.aidl"), io_delegate, state);
+}
+BENCHMARK(BM_LoadLargeInterface)->Arg(100)->Arg(1000);
+
+// Run from system/tools/aidl, which has the test interfaces.
+void BM_LoadTestService(benchmark::State& state) {
+  IoDelegate io_delegate;
+  Load(Options::From("aidl --lang=cpp -I tests -o out -h out "
+                     "tests/android/aidl/tests/ITestService.aidl"),
+       io_delegate, state);
+}
+BENCHMARK(BM_LoadTestService);
+
+}  // namespace
+
+}  // namespace aidl
+}  // namespace android
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "profile.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "code_writer.h"
+
+using android::base::Join;
+using android::base::StringPrintf;
+using std::string;
+using std::vector;
+using std::chrono::steady_clock;
+
+namespace android {
+namespace aidl {
+
+namespace {
+
+struct Span {
+  const char* name;
+  string detail;
+  int thread;
+  steady_clock::time_point start;
+  steady_clock::time_point end;
+  uint64_t allocations;
+  uint64_t allocated_bytes;
+  long max_rss_kb;
+};
+
+constexpr const char* kCounterNames[] = {
+    "files_parsed",
+    "bytes_lexed",
+    "file_is_readable_calls",
+    "bytes_written",
+    "allocations",
+    "allocated_bytes",
+};
+constexpr size_t kNumCounters = sizeof(kCounterNames) / sizeof(kCounterNames[0]);
+
+std::atomic<bool> enabled{false};
+std::atomic<uint64_t> counters[kNumCounters];
+std::mutex spans_mutex;
+vector<Span> spans;
+steady_clock::time_point enabled_time;
+// Whether the counting operator new is linked in
+std::atomic<bool> allocations_counted{false};
+thread_local uint64_t thread_allocations = 0;
+thread_local uint64_t thread_allocated_bytes = 0;
+
+// Threads are numbered in the order they record their first span.
+int CurrentThread() {
+  static std::atomic<int> next_thread{1};
+  thread_local int thread = next_thread++;
+  return thread;
+}
+
+// The peak resident set size of the process so far, or 0 if unknown.
+long MaxRssKb() {
+#if !defined(_WIN32)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    return usage.ru_maxrss;
+  }
+#endif
+  return 0;
+}
+
+long long Microseconds(steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(time - enabled_time).count();
+}
+
+}  // namespace
+
+string EscapeJson(const string& str) {
+  string escaped;
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += StringPrintf("\\u%04x", c);
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+void Profile::Enable() {
+  std::lock_guard<std::mutex> lock(spans_mutex);
+  enabled_time = steady_clock::now();
+  enabled = true;
+}
+
+void Profile::Disable() {
+  std::lock_guard<std::mutex> lock(spans_mutex);
+  enabled = false;
+  allocations_counted = false;
+  spans.clear();
+  for (auto& counter : counters) {
+    counter = 0;
+  }
+}
+
+bool Profile::IsEnabled() {
+  return enabled;
+}
+
+void Profile::Count(ProfileCounter counter, uint64_t n) {
+  if (enabled) {
+    counters[static_cast<size_t>(counter)] += n;
+  }
+}
+
+uint64_t Profile::GetCount(ProfileCounter counter) {
+  return counters[static_cast<size_t>(counter)];
+}
+
+void Profile::CountAllocation(size_t bytes) {
+  if (enabled) {
+    if (!allocations_counted.load(std::memory_order_relaxed)) {
+      allocations_counted = true;
+    }
+    thread_allocations++;
+    thread_allocated_bytes += bytes;
+    counters[static_cast<size_t>(ProfileCounter::ALLOCATIONS)].fetch_add(
+        1, std::memory_order_relaxed);
+    counters[static_cast<size_t>(ProfileCounter::ALLOCATED_BYTES)].fetch_add(
+        bytes, std::memory_order_relaxed);
+  }
+}
+
+Profile::ThreadAllocations Profile::GetThreadAllocations() {
+  return {thread_allocations, thread_allocated_bytes};
+}
+
+void Profile::AddSpan(const char* name, const string& detail, steady_clock::time_point start,
+                      steady_clock::time_point end, const ThreadAllocations& allocations) {
+  const int thread = CurrentThread();
+  const long max_rss_kb = allocations_counted ? MaxRssKb() : 0;
+  std::lock_guard<std::mutex> lock(spans_mutex);
+  spans.push_back({name, detail, thread, start, end, allocations.allocations,
+                   allocations.bytes, max_rss_kb});
+}
+
+bool Profile::Write(CodeWriter* writer) {
+  std::lock_guard<std::mutex> lock(spans_mutex);
+  writer->Write("{\"traceEvents\":[\n");
+  for (const Span& span : spans) {
+    writer->Write("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+                  span.name, span.thread, Microseconds(span.start),
+                  Microseconds(span.end) - Microseconds(span.start));
+    vector<string> args;
+    if (!span.detail.empty()) {
+      args.push_back(StringPrintf("\"detail\":\"%s\"", EscapeJson(span.detail).c_str()));
+    }
+    if (allocations_counted) {
+      args.push_back(StringPrintf("\"allocations\":%llu,\"allocated_bytes\":%llu,"
+                                  "\"max_rss_kb\":%ld",
+                                  static_cast<unsigned long long>(span.allocations),
+                                  static_cast<unsigned long long>(span.allocated_bytes),
+                                  span.max_rss_kb));
+    }
+    if (!args.empty()) {
+      writer->Write(",\"args\":{%s}", Join(args, ",").c_str());
+    }
+    writer->Write("},\n");
+  }
+  writer->Write("{\"name\":\"aidl\",\"ph\":\"C\",\"pid\":1,\"ts\":%lld,\"args\":{",
+                Microseconds(steady_clock::now()));
+  for (size_t i = 0; i < kNumCounters; i++) {
+    writer->Write("%s\"%s\":%llu", i == 0 ? "" : ",", kCounterNames[i],
+                  static_cast<unsigned long long>(counters[i].load()));
+  }
+  writer->Write("}}\n]}\n");
+  return writer->Close();
+}
+
+ProfileScope::ProfileScope(const char* name, const string& detail)
+    : name_(name), running_(Profile::IsEnabled()) {
+  if (running_) {
+    detail_ = detail;
+    start_ = steady_clock::now();
+    start_allocations_ = Profile::GetThreadAllocations();
+  }
+}
+
+void ProfileScope::End() {
+  if (running_) {
+    running_ = false;
+    const Profile::ThreadAllocations end_allocations = Profile::GetThreadAllocations();
+    Profile::AddSpan(name_, detail_, start_, steady_clock::now(),
+                     {end_allocations.allocations - start_allocations_.allocations,
+                      end_allocations.bytes - start_allocations_.bytes});
+  }
+}
+
+}  // namespace aidl
+}  // namespace android
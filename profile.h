@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <android-base/macros.h>
+
+namespace android {
+namespace aidl {
+
+class CodeWriter;
+
+enum class ProfileCounter {
+  FILES_PARSED,
+  BYTES_LEXED,
+  FILE_IS_READABLE_CALLS,
+  BYTES_WRITTEN,
+  ALLOCATIONS,
+  ALLOCATED_BYTES,
+};
+
+// Records how long the phases of the compiler take and counts what they do,
+// for --profile. Nothing is recorded until Enable() is called. It is safe to
+// record from multiple threads. Allocations are counted only by binaries that
+// link profile_allocations.cpp, like aidl-allocation-profile. Each span then
+// also shows the allocations its thread made and the peak RSS at its end.
+class Profile {
+ public:
+  static void Enable();
+  // Stops recording and forgets what has been recorded.
+  static void Disable();
+  static bool IsEnabled();
+
+  static void Count(ProfileCounter counter, uint64_t n = 1);
+  static uint64_t GetCount(ProfileCounter counter);
+
+  // Called for each allocation by the counting operator new. It doesn't
+  // allocate itself.
+  static void CountAllocation(size_t bytes);
+
+  // Writes the spans and counters as Chrome trace-event JSON.
+  static bool Write(CodeWriter* writer);
+
+ private:
+  friend class ProfileScope;
+  struct ThreadAllocations {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+  };
+  static ThreadAllocations GetThreadAllocations();
+  static void AddSpan(const char* name, const std::string& detail,
+                      std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point end,
+                      const ThreadAllocations& allocations);
+};
+
+// Escapes |str| to be written between the quotes of a JSON string.
+std::string EscapeJson(const std::string& str);
+
+// Records a span named |name| from construction until End() or destruction.
+// |detail|, e.g. the file being parsed, is shown with the span.
+class ProfileScope {
+ public:
+  explicit ProfileScope(const char* name, const std::string& detail = "");
+  ~ProfileScope() { End(); }
+  void End();
+
+ private:
+  const char* const name_;
+  std::string detail_;
+  bool running_;
+  std::chrono::steady_clock::time_point start_;
+  Profile::ThreadAllocations start_allocations_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProfileScope);
+};
+
+}  // namespace aidl
+}  // namespace android
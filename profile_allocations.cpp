@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replaces the global operator new so that --profile counts allocations.
+// This is linked only into aidl-allocation-profile, so that aidl itself
+// doesn't pay for it.
+
+#include <cstdlib>
+#include <new>
+
+#include "profile.h"
+
+using android::aidl::Profile;
+
+namespace {
+
+void* Allocate(size_t size) {
+  Profile::CountAllocation(size);
+  return malloc(size == 0 ? 1 : size);
+}
+
+// aidl is built without exceptions, so running out of memory aborts.
+void* AllocateOrAbort(size_t size) {
+  void* p = Allocate(size);
+  if (p == nullptr) {
+    abort();
+  }
+  return p;
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  return AllocateOrAbort(size);
+}
+
+void* operator new[](size_t size) {
+  return AllocateOrAbort(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
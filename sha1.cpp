@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sha1.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace android {
+namespace aidl {
+
+namespace {
+
+uint32_t RotateLeft(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+}  // namespace
+
+Sha1::Sha1() : state_{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0} {}
+
+void Sha1::ProcessBlock(const uint8_t* block) {
+  uint32_t w[80];
+  for (int i = 0; i < 16; i++) {
+    w[i] = static_cast<uint32_t>(block[4 * i]) << 24 |
+           static_cast<uint32_t>(block[4 * i + 1]) << 16 |
+           static_cast<uint32_t>(block[4 * i + 2]) << 8 | static_cast<uint32_t>(block[4 * i + 3]);
+  }
+  for (int i = 16; i < 80; i++) {
+    w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3], e = state_[4];
+  for (int i = 0; i < 80; i++) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    const uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = RotateLeft(b, 30);
+    b = a;
+    a = temp;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+}
+
+void Sha1::Update(const std::string& data) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  size_t size = data.size();
+  length_ += size;
+  while (size > 0) {
+    const size_t n = std::min(size, sizeof(buffer_) - buffered_);
+    memcpy(buffer_ + buffered_, bytes, n);
+    buffered_ += n;
+    bytes += n;
+    size -= n;
+    if (buffered_ == sizeof(buffer_)) {
+      ProcessBlock(buffer_);
+      buffered_ = 0;
+    }
+  }
+}
+
+std::string Sha1::HexDigest() {
+  const uint64_t bit_length = length_ * 8;
+  std::string padding(1, '\x80');
+  padding.append((buffered_ < 56 ? 55 : 119) - buffered_, '\0');
+  for (int i = 7; i >= 0; i--) {
+    padding.push_back(static_cast<char>(bit_length >> (8 * i)));
+  }
+  Update(padding);
+
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string digest;
+  for (uint32_t word : state_) {
+    for (int i = 28; i >= 0; i -= 4) {
+      digest.push_back(kHexDigits[(word >> i) & 0xf]);
+    }
+  }
+  return digest;
+}
+
+std::string Sha1::Of(const std::string& data) {
+  Sha1 sha1;
+  sha1.Update(data);
+  return sha1.HexDigest();
+}
+
+}  // namespace aidl
+}  // namespace android
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <android-base/macros.h>
+
+namespace android {
+namespace aidl {
+
+// SHA-1, for the hashes of frozen API dumps which used to be computed with
+// sha1sum. It is not used for anything security related.
+class Sha1 {
+ public:
+  Sha1();
+
+  void Update(const std::string& data);
+  // The digest of everything passed to Update, as 40 lowercase hex digits.
+  // Update must not be called afterwards.
+  std::string HexDigest();
+
+  static std::string Of(const std::string& data);
+
+ private:
+  void ProcessBlock(const uint8_t* block);
+
+  uint32_t state_[5];
+  uint64_t length_ = 0;  // in bytes
+  uint8_t buffer_[64];
+  size_t buffered_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(Sha1);
+};
+
+}  // namespace aidl
+}  // namespace android
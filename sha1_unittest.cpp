@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sha1.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+using std::string;
+
+namespace android {
+namespace aidl {
+
+TEST(Sha1Test, HashesKnownVectors) {
+  EXPECT_EQ("da39a3ee5e6b4b0d3255bfef95601890afd80709", Sha1::Of(""));
+  EXPECT_EQ("a9993e364706816aba3e25717850c26c9cd0d89d", Sha1::Of("abc"));
+  EXPECT_EQ("84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+            Sha1::Of("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"));
+  EXPECT_EQ("34aa973cd4c4daa4f61eeb2bdbad27316534016f", Sha1::Of(string(1000000, 'a')));
+}
+
+TEST(Sha1Test, UpdatesInPieces) {
+  const string data = "The quick brown fox jumps over the lazy dog, many times over. " +
+                      string(100, 'x');
+  Sha1 sha1;
+  for (size_t i = 0; i < data.size(); i += 7) {
+    sha1.Update(data.substr(i, 7));
+  }
+  EXPECT_EQ(Sha1::Of(data), sha1.HexDigest());
+}
+
+}  // namespace aidl
+}  // namespace android
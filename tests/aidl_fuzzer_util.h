@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AIDL_TESTS_AIDL_FUZZER_UTIL_H_
+#define AIDL_TESTS_AIDL_FUZZER_UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace android {
+namespace aidl {
+namespace test {
+
+// The file that the fuzzers compile. aidl_parser_fuzzer.dict has its path.
+constexpr char kFuzzInputFile[] = "a/path/Foo.aidl";
+
+// Splits the input of a fuzzer into its first byte, which is kept for flags,
+// and the contents of kFuzzInputFile. Returns false for inputs that aren't
+// worth a run.
+inline bool SplitFuzzInput(const uint8_t* data, size_t size, uint8_t* flags,
+                           std::string* content) {
+  if (size <= 1) return false;  // no use
+
+  // b/145447540, large nested expressions sometimes hit the stack depth limit.
+  // Fuzzing things of this size don't provide any additional meaningful
+  // coverage. This is an approximate value which should allow us to explore all
+  // of the language w/o hitting a stack overflow.
+  if (size > 2000) return false;
+
+  *flags = *data;
+  content->assign(reinterpret_cast<const char*>(data + 1), size - 1);
+  return true;
+}
+
+}  // namespace test
+}  // namespace aidl
+}  // namespace android
+
+#endif  // AIDL_TESTS_AIDL_FUZZER_UTIL_H_
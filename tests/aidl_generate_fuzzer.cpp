@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Loads the input file once, and generates the code of every backend that
+// takes it from the same types. Unlike aidl_parser_fuzzer, which runs
+// compile_aidl once per backend, the file is parsed and validated once, and
+// there are no Options to parse, output names to work out, or dependency
+// files to write.
+
+#include <vector>
+
+#include "aidl.h"
+#include "aidl_fuzzer_util.h"
+#include "aidl_language.h"
+#include "aidl_typenames.h"
+#include "fake_io_delegate.h"
+#include "generate_cpp.h"
+#include "generate_java.h"
+#include "generate_ndk.h"
+#include "options.h"
+
+using android::aidl::AidlTypenames;
+using android::aidl::internals::load_and_validate_aidl;
+using android::aidl::test::FakeIoDelegate;
+using android::aidl::test::kFuzzInputFile;
+using android::aidl::test::SplitFuzzInput;
+
+namespace {
+
+const Options& NdkOptions() {
+  static const Options* const options =
+      new Options(Options::From("aidl --lang=ndk -b -o out -h out a/path/Foo.aidl"));
+  return *options;
+}
+
+const Options& CppOptions() {
+  static const Options* const options =
+      new Options(Options::From("aidl --lang=cpp -b -o out -h out a/path/Foo.aidl"));
+  return *options;
+}
+
+const Options& JavaOptions() {
+  static const Options* const options =
+      new Options(Options::From("aidl --lang=java -b -o out a/path/Foo.aidl"));
+  return *options;
+}
+
+// Generates the code of |defined_types| for the backend of |options|, unless
+// the backend doesn't support them.
+void Generate(const Options& options, const AidlTypenames& typenames,
+              const std::vector<AidlDefinedType*>& defined_types) {
+  const Options::Language lang = options.TargetLanguage();
+  for (const AidlDefinedType* type : defined_types) {
+    if (!type->LanguageSpecificCheckValid(lang)) return;
+  }
+  // What a run writes is dropped with it.
+  FakeIoDelegate out;
+  for (const AidlDefinedType* type : defined_types) {
+    if (lang == Options::Language::NDK) {
+      android::aidl::ndk::GenerateNdk("out/Foo.cpp", options, typenames, *type, out);
+    } else if (lang == Options::Language::CPP) {
+      android::aidl::cpp::GenerateCpp("out/Foo.cpp", options, typenames, *type, out);
+    } else if (type->AsUnstructuredParcelable() == nullptr) {
+      android::aidl::java::generate_java("out/Foo.java", type, typenames, out, options);
+    }
+  }
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  uint8_t flags;
+  std::string content;
+  if (!SplitFuzzInput(data, size, &flags, &content)) return 0;
+
+  // Each run replaces the contents of the file of the run before.
+  static FakeIoDelegate* io = new FakeIoDelegate;
+  io->SetFileContents(kFuzzInputFile, content);
+
+  // As in aidl_parse_fuzzer, errors are kept, and the nodes of a run go back to
+  // the node pool with the types.
+  AidlErrorCapture errors;
+  AidlTypenames typenames;
+  std::vector<AidlDefinedType*> defined_types;
+  // The types are validated for the backend that the low bits of the flags
+  // pick. The checks that only some backends make are run for each of the
+  // others before it generates code.
+  const Options* const options[] = {&NdkOptions(), &CppOptions(), &JavaOptions()};
+  if (load_and_validate_aidl(kFuzzInputFile, *options[flags % 3], *io, &typenames,
+                             &defined_types, nullptr) != android::aidl::AidlError::OK) {
+    return 0;
+  }
+  for (const Options* backend_options : options) {
+    Generate(*backend_options, typenames, defined_types);
+  }
+
+  return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the two ways that NDK code can read and write String and
+// parcelable vectors, on the same parcel contents: ::ndk::AParcel_readVector
+// and ::ndk::AParcel_writeVector, which go through the allocator and element
+// callbacks of AParcel_{read,write}{String,Parcelable}Array, and the loops
+// of the generated Strings and Elements parcelables.
+
+#include <stdlib.h>
+
+#include <string>
+
+#include <aidl/android/aidl/benchmark/Element.h>
+#include <aidl/android/aidl/benchmark/Elements.h>
+#include <aidl/android/aidl/benchmark/Strings.h>
+#include <android/binder_auto_utils.h>
+#include <android/binder_parcel_utils.h>
+#include <benchmark/benchmark.h>
+
+using aidl::android::aidl::benchmark::Element;
+using aidl::android::aidl::benchmark::Elements;
+using aidl::android::aidl::benchmark::Strings;
+
+namespace {
+
+constexpr int64_t kElements = 10000;
+
+// Where the one field of a parcelable starts, past the size of the parcelable.
+constexpr int32_t kFieldPosition = 4;
+
+Strings MakeStrings(size_t size) {
+  Strings strings;
+  for (size_t i = 0; i < size; i++) {
+    strings.values.push_back("element " + std::to_string(i));
+  }
+  return strings;
+}
+
+Elements MakeElements(size_t size) {
+  Elements elements;
+  for (size_t i = 0; i < size; i++) {
+    Element element;
+    element.id = static_cast<int32_t>(i);
+    element.name = "element " + std::to_string(i);
+    elements.values.push_back(element);
+  }
+  return elements;
+}
+
+template <typename T>
+ndk::ScopedAParcel WriteParcelable(const T& value) {
+  ndk::ScopedAParcel parcel(AParcel_create());
+  if (value.writeToParcel(parcel.get()) != STATUS_OK) abort();
+  return parcel;
+}
+
+template <typename T>
+void ReadWithCallbacks(benchmark::State& state, const T& value) {
+  ndk::ScopedAParcel parcel = WriteParcelable(value);
+  for (auto _ : state) {
+    AParcel_setDataPosition(parcel.get(), kFieldPosition);
+    decltype(value.values) values;
+    if (::ndk::AParcel_readVector(parcel.get(), &values) != STATUS_OK) {
+      state.SkipWithError("Cannot read the vector");
+      return;
+    }
+    benchmark::DoNotOptimize(values.data());
+  }
+  state.SetItemsProcessed(state.iterations() * value.values.size());
+}
+
+template <typename T>
+void ReadWithLoop(benchmark::State& state, const T& value) {
+  ndk::ScopedAParcel parcel = WriteParcelable(value);
+  for (auto _ : state) {
+    AParcel_setDataPosition(parcel.get(), 0);
+    T read;
+    if (read.readFromParcel(parcel.get()) != STATUS_OK) {
+      state.SkipWithError("Cannot read the parcelable");
+      return;
+    }
+    benchmark::DoNotOptimize(read.values.data());
+  }
+  state.SetItemsProcessed(state.iterations() * value.values.size());
+}
+
+template <typename T>
+void WriteWithCallbacks(benchmark::State& state, const T& value) {
+  ndk::ScopedAParcel parcel(AParcel_create());
+  for (auto _ : state) {
+    AParcel_setDataPosition(parcel.get(), kFieldPosition);
+    if (::ndk::AParcel_writeVector(parcel.get(), value.values) != STATUS_OK) {
+      state.SkipWithError("Cannot write the vector");
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * value.values.size());
+}
+
+template <typename T>
+void WriteWithLoop(benchmark::State& state, const T& value) {
+  ndk::ScopedAParcel parcel(AParcel_create());
+  for (auto _ : state) {
+    AParcel_setDataPosition(parcel.get(), 0);
+    if (value.writeToParcel(parcel.get()) != STATUS_OK) {
+      state.SkipWithError("Cannot write the parcelable");
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * value.values.size());
+}
+
+void BM_ReadStringVectorCallbacks(benchmark::State& state) {
+  ReadWithCallbacks(state, MakeStrings(state.range(0)));
+}
+BENCHMARK(BM_ReadStringVectorCallbacks)->Arg(kElements);
+
+void BM_ReadStringVectorLoop(benchmark::State& state) {
+  ReadWithLoop(state, MakeStrings(state.range(0)));
+}
+BENCHMARK(BM_ReadStringVectorLoop)->Arg(kElements);
+
+void BM_WriteStringVectorCallbacks(benchmark::State& state) {
+  WriteWithCallbacks(state, MakeStrings(state.range(0)));
+}
+BENCHMARK(BM_WriteStringVectorCallbacks)->Arg(kElements);
+
+void BM_WriteStringVectorLoop(benchmark::State& state) {
+  WriteWithLoop(state, MakeStrings(state.range(0)));
+}
+BENCHMARK(BM_WriteStringVectorLoop)->Arg(kElements);
+
+void BM_ReadParcelableVectorCallbacks(benchmark::State& state) {
+  ReadWithCallbacks(state, MakeElements(state.range(0)));
+}
+BENCHMARK(BM_ReadParcelableVectorCallbacks)->Arg(kElements);
+
+void BM_ReadParcelableVectorLoop(benchmark::State& state) {
+  ReadWithLoop(state, MakeElements(state.range(0)));
+}
+BENCHMARK(BM_ReadParcelableVectorLoop)->Arg(kElements);
+
+void BM_WriteParcelableVectorCallbacks(benchmark::State& state) {
+  WriteWithCallbacks(state, MakeElements(state.range(0)));
+}
+BENCHMARK(BM_WriteParcelableVectorCallbacks)->Arg(kElements);
+
+void BM_WriteParcelableVectorLoop(benchmark::State& state) {
+  WriteWithLoop(state, MakeElements(state.range(0)));
+}
+BENCHMARK(BM_WriteParcelableVectorLoop)->Arg(kElements);
+
+}  // namespace
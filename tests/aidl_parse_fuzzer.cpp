@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Runs the lexer and the parser only, on the input file alone. Imports,
+// resolution and validation are left to aidl_validate_fuzzer.
+
+#include "aidl_fuzzer_util.h"
+#include "aidl_language.h"
+#include "aidl_typenames.h"
+#include "fake_io_delegate.h"
+
+using android::aidl::AidlTypenames;
+using android::aidl::test::FakeIoDelegate;
+using android::aidl::test::kFuzzInputFile;
+using android::aidl::test::SplitFuzzInput;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  uint8_t flags;
+  std::string content;
+  if (!SplitFuzzInput(data, size, &flags, &content)) return 0;
+
+  // Each run replaces the contents of the file of the run before.
+  static FakeIoDelegate* io = new FakeIoDelegate;
+  io->SetFileContents(kFuzzInputFile, content);
+
+  // The errors of a run are kept rather than printed, so that they cost
+  // neither writes to stderr nor a mark in AidlError::hadError().
+  AidlErrorCapture errors;
+  // The nodes of a run go back to the node pool when the types go away, so the
+  // next run starts from the same state.
+  AidlTypenames typenames;
+  const Parser::Comments comments = (flags & 1) ? Parser::Comments::LAZY : Parser::Comments::COPY;
+  Parser::Parse(kFuzzInputFile, *io, typenames, comments);
+
+  return 0;
+}
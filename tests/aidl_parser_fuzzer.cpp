@@ -15,6 +15,7 @@
  */
 
 #include "aidl.h"
+#include "aidl_fuzzer_util.h"
 #include "fake_io_delegate.h"
 #include "options.h"
 
@@ -27,12 +28,14 @@ constexpr bool kFuzzLog = false;
 #endif
 
 using android::aidl::test::FakeIoDelegate;
+using android::aidl::test::kFuzzInputFile;
+using android::aidl::test::SplitFuzzInput;
 
 void fuzz(const std::string& langOpt, const std::string& content) {
   // TODO: fuzz multiple files
   // TODO: fuzz arguments
   FakeIoDelegate io;
-  io.SetFileContents("a/path/Foo.aidl", content);
+  io.SetFileContents(kFuzzInputFile, content);
 
   std::vector<std::string> args;
   args.emplace_back("aidl");
@@ -41,7 +44,7 @@ void fuzz(const std::string& langOpt, const std::string& content) {
   args.emplace_back("-I .");
   args.emplace_back("-o out");
   // corresponding items also in aidl_parser_fuzzer.dict
-  args.emplace_back("a/path/Foo.aidl");
+  args.emplace_back(kFuzzInputFile);
 
   if (kFuzzLog) {
     std::cout << "lang: " << langOpt << " content: " << content << std::endl;
@@ -78,19 +81,10 @@ void fuzz(uint8_t options, const std::string& content) {
 }
 
 extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
-  if (size <= 1) return 0;  // no use
+  uint8_t options;
+  std::string content;
+  if (!SplitFuzzInput(data, size, &options, &content)) return 0;
 
-  // b/145447540, large nested expressions sometimes hit the stack depth limit.
-  // Fuzzing things of this size don't provide any additional meaningful
-  // coverage. This is an approximate value which should allow us to explore all
-  // of the language w/o hitting a stack overflow.
-  if (size > 2000) return 0;
-
-  uint8_t options = *data;
-  data++;
-  size--;
-
-  std::string content(reinterpret_cast<const char*>(data), size);
   fuzz(options, content);
 
   return 0;
@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures round trips to the ITestService implementation registered with
+// servicemanager. The service is whichever backend was started before the
+// benchmark, e.g. aidl_test_service for the cpp backend. Pass
+// --service=NAME to measure a service registered under another name.
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+#include <binder/IServiceManager.h>
+#include <binder/ParcelFileDescriptor.h>
+#include <binder/ProcessState.h>
+#include <utils/String16.h>
+#include <utils/StrongPointer.h>
+
+#include "android/aidl/tests/ITestService.h"
+#include "android/aidl/tests/StructuredParcelable.h"
+
+using android::sp;
+using android::String16;
+using android::aidl::tests::ITestService;
+using android::aidl::tests::StructuredParcelable;
+using android::base::unique_fd;
+using android::binder::Status;
+using android::os::ParcelFileDescriptor;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+// The number of allocations the process has made, so that benchmarks can
+// report how many each call makes.
+std::atomic<size_t> allocations{0};
+}  // namespace
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+namespace {
+
+string service_name = "android.aidl.tests.ITestService";
+
+sp<ITestService> GetService() {
+  static sp<ITestService> service = [] {
+    sp<ITestService> s;
+    android::getService(String16(service_name.c_str()), &s);
+    return s;
+  }();
+  return service;
+}
+
+// Runs |call| once per iteration, and stops with an error if it fails.
+template <typename Call>
+void RoundTrip(benchmark::State& state, Call call) {
+  sp<ITestService> service = GetService();
+  if (service == nullptr) {
+    state.SkipWithError("Cannot get the test service");
+    return;
+  }
+  for (auto _ : state) {
+    Status status = call(service);
+    if (!status.isOk()) {
+      state.SkipWithError(status.toString8().c_str());
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Reports the bytes of |size| elements of |T| sent and received per call.
+template <typename T>
+void SetBytesProcessed(benchmark::State& state, size_t size) {
+  state.SetBytesProcessed(state.iterations() * size * sizeof(T) * 2);
+}
+
+void BM_RepeatInt(benchmark::State& state) {
+  RoundTrip(state, [](const sp<ITestService>& s) {
+    int32_t reply;
+    return s->RepeatInt(42, &reply);
+  });
+}
+BENCHMARK(BM_RepeatInt)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_RepeatLong(benchmark::State& state) {
+  RoundTrip(state, [](const sp<ITestService>& s) {
+    int64_t reply;
+    return s->RepeatLong(42, &reply);
+  });
+}
+BENCHMARK(BM_RepeatLong)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_RepeatDouble(benchmark::State& state) {
+  RoundTrip(state, [](const sp<ITestService>& s) {
+    double reply;
+    return s->RepeatDouble(4.2, &reply);
+  });
+}
+BENCHMARK(BM_RepeatDouble)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_RepeatString(benchmark::State& state) {
+  const String16 input(string(state.range(0), 'a').c_str());
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    String16 reply;
+    return s->RepeatString(input, &reply);
+  });
+  SetBytesProcessed<char16_t>(state, state.range(0));
+}
+BENCHMARK(BM_RepeatString)->RangeMultiplier(8)->Range(8, 32 << 10);
+
+void BM_RepeatUtf8CppString(benchmark::State& state) {
+  const string input(state.range(0), 'a');
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    string reply;
+    return s->RepeatUtf8CppString(input, &reply);
+  });
+  SetBytesProcessed<char>(state, state.range(0));
+}
+BENCHMARK(BM_RepeatUtf8CppString)->RangeMultiplier(8)->Range(8, 32 << 10);
+
+void BM_ReverseByte(benchmark::State& state) {
+  const vector<uint8_t> input(state.range(0), 1);
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    vector<uint8_t> repeated;
+    vector<uint8_t> reversed;
+    return s->ReverseByte(input, &repeated, &reversed);
+  });
+  SetBytesProcessed<uint8_t>(state, state.range(0));
+}
+BENCHMARK(BM_ReverseByte)->RangeMultiplier(8)->Range(8, 64 << 10);
+
+void BM_ReverseInt(benchmark::State& state) {
+  const vector<int32_t> input(state.range(0), 1);
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    vector<int32_t> repeated;
+    vector<int32_t> reversed;
+    return s->ReverseInt(input, &repeated, &reversed);
+  });
+  SetBytesProcessed<int32_t>(state, state.range(0));
+}
+BENCHMARK(BM_ReverseInt)->RangeMultiplier(8)->Range(8, 64 << 10);
+
+void BM_ReverseString(benchmark::State& state) {
+  const vector<String16> input(state.range(0), String16("a string"));
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    vector<String16> repeated;
+    vector<String16> reversed;
+    return s->ReverseString(input, &repeated, &reversed);
+  });
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReverseString)->RangeMultiplier(8)->Range(8, 4 << 10);
+
+void BM_ReverseUtf8CppString(benchmark::State& state) {
+  const vector<string> input(state.range(0), "a string");
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    vector<string> repeated;
+    vector<string> reversed;
+    return s->ReverseUtf8CppString(input, &repeated, &reversed);
+  });
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReverseUtf8CppString)->RangeMultiplier(8)->Range(8, 4 << 10);
+
+void BM_FillOutStructuredParcelable(benchmark::State& state) {
+  RoundTrip(state, [](const sp<ITestService>& s) {
+    StructuredParcelable parcelable;
+    parcelable.f = 17;
+    return s->FillOutStructuredParcelable(&parcelable);
+  });
+}
+BENCHMARK(BM_FillOutStructuredParcelable)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_RepeatNullableIntArray(benchmark::State& state) {
+  const bool null = state.range(0) == 0;
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    unique_ptr<vector<int32_t>> input;
+    if (!null) {
+      input.reset(new vector<int32_t>(state.range(0), 1));
+    }
+    unique_ptr<vector<int32_t>> reply;
+    return s->RepeatNullableIntArray(input, &reply);
+  });
+}
+BENCHMARK(BM_RepeatNullableIntArray)->Arg(0)->Arg(8)->Arg(1 << 10);
+
+void BM_RepeatNullableUtf8CppString(benchmark::State& state) {
+  RoundTrip(state, [](const sp<ITestService>& s) {
+    unique_ptr<string> reply;
+    return s->RepeatNullableUtf8CppString(nullptr, &reply);
+  });
+}
+BENCHMARK(BM_RepeatNullableUtf8CppString);
+
+// Reports the allocations that the client makes per call for a present
+// @nullable value. Each one held in a std::unique_ptr costs an allocation
+// that --nullable-optional avoids.
+void BM_RepeatNullableStringAllocations(benchmark::State& state) {
+  const unique_ptr<String16> input = std::make_unique<String16>("a string");
+  const size_t before = allocations.load();
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    unique_ptr<String16> reply;
+    return s->RepeatNullableString(input, &reply);
+  });
+  state.counters["allocations"] = benchmark::Counter(
+      static_cast<double>(allocations.load() - before), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_RepeatNullableStringAllocations);
+
+void BM_RepeatFileDescriptor(benchmark::State& state) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    state.SkipWithError(strerror(errno));
+    return;
+  }
+  unique_fd read_fd(fds[0]);
+  unique_fd write_fd(fds[1]);
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    unique_fd reply;
+    return s->RepeatFileDescriptor(unique_fd(dup(write_fd.get())), &reply);
+  });
+}
+BENCHMARK(BM_RepeatFileDescriptor);
+
+void BM_ReverseParcelFileDescriptorArray(benchmark::State& state) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    state.SkipWithError(strerror(errno));
+    return;
+  }
+  unique_fd read_fd(fds[0]);
+  unique_fd write_fd(fds[1]);
+  RoundTrip(state, [&](const sp<ITestService>& s) {
+    vector<ParcelFileDescriptor> input;
+    for (int i = 0; i < state.range(0); i++) {
+      input.emplace_back(unique_fd(dup(write_fd.get())));
+    }
+    vector<ParcelFileDescriptor> repeated;
+    vector<ParcelFileDescriptor> reversed;
+    return s->ReverseParcelFileDescriptorArray(input, &repeated, &reversed);
+  });
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReverseParcelFileDescriptorArray)->Arg(1)->Arg(16);
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  for (int i = 1; i < argc; i++) {
+    const string arg = argv[i];
+    if (arg.rfind("--service=", 0) == 0) {
+      service_name = arg.substr(strlen("--service="));
+    }
+  }
+  android::ProcessState::self()->startThreadPool();
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
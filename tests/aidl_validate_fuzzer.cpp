@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Loads and validates the input file for one backend, and stops before code
+// is generated. The Options of each backend are made once for all runs.
+
+#include <vector>
+
+#include "aidl.h"
+#include "aidl_fuzzer_util.h"
+#include "aidl_language.h"
+#include "aidl_typenames.h"
+#include "fake_io_delegate.h"
+#include "options.h"
+
+using android::aidl::AidlTypenames;
+using android::aidl::internals::load_and_validate_aidl;
+using android::aidl::test::FakeIoDelegate;
+using android::aidl::test::kFuzzInputFile;
+using android::aidl::test::SplitFuzzInput;
+
+namespace {
+
+// The low bits of the flags pick the backend.
+const Options& OptionsFor(uint8_t flags) {
+  static const Options* const kOptions[] = {
+      new Options(Options::From("aidl --lang=ndk -b -o out -h out a/path/Foo.aidl")),
+      new Options(Options::From("aidl --lang=cpp -b -o out -h out a/path/Foo.aidl")),
+      new Options(Options::From("aidl --lang=java -b -o out a/path/Foo.aidl")),
+  };
+  return *kOptions[flags % 3];
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  uint8_t flags;
+  std::string content;
+  if (!SplitFuzzInput(data, size, &flags, &content)) return 0;
+
+  // Each run replaces the contents of the file of the run before.
+  static FakeIoDelegate* io = new FakeIoDelegate;
+  io->SetFileContents(kFuzzInputFile, content);
+
+  // As in aidl_parse_fuzzer, errors are kept, and the nodes of a run go back to
+  // the node pool with the types.
+  AidlErrorCapture errors;
+  AidlTypenames typenames;
+  std::vector<AidlDefinedType*> defined_types;
+  load_and_validate_aidl(kFuzzInputFile, OptionsFor(flags), *io, &typenames, &defined_types,
+                         nullptr);
+
+  return 0;
+}
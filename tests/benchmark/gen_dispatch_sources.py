@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2020, The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Writes the sources of DispatchBenchmark.
+
+For each of ISwitchDispatch and ITableDispatch, writes a .aidl file of an
+interface with NUM_METHODS methods and a .java file with a service that
+implements it. The interfaces are the same; they are compiled with and
+without --java-dispatch-table.
+"""
+
+import os
+import sys
+
+NUM_METHODS = 500
+PACKAGE = 'android.aidl.benchmark'
+
+
+def write(path, contents):
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'w') as f:
+        f.write(contents)
+
+
+def main(aidl_dir, java_dir):
+    package_dir = PACKAGE.replace('.', '/')
+    for name in ['SwitchDispatch', 'TableDispatch']:
+        methods = ''.join('    int method%d(int a);\n' % i for i in range(NUM_METHODS))
+        write(os.path.join(aidl_dir, package_dir, 'I%s.aidl' % name),
+              'package %s;\ninterface I%s {\n%s}\n' % (PACKAGE, name, methods))
+        impls = ''.join('    @Override public int method%d(int a) { return a + %d; }\n' % (i, i)
+                        for i in range(NUM_METHODS))
+        write(os.path.join(java_dir, package_dir, '%sService.java' % name),
+              'package %s;\npublic class %sService extends I%s.Stub {\n%s}\n' %
+              (PACKAGE, name, name, impls))
+
+
+if __name__ == '__main__':
+    main(sys.argv[1], sys.argv[2])
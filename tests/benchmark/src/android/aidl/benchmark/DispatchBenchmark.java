@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2020, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.aidl.benchmark;
+
+import android.os.Binder;
+import android.os.IBinder;
+import android.os.Parcel;
+import android.os.RemoteException;
+import androidx.benchmark.BenchmarkState;
+import androidx.benchmark.junit4.BenchmarkRule;
+import org.junit.Rule;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/**
+ * Compares the cost of Stub.onTransact() of a 500-method interface with the
+ * switch with that of the same interface compiled with --java-dispatch-table.
+ * The stub is called through Binder.transact() in the same process, which
+ * does little more than call onTransact(), so mostly the dispatch and the
+ * unmarshalling are measured.
+ */
+@RunWith(JUnit4.class)
+public class DispatchBenchmark {
+  @Rule public BenchmarkRule benchmarkRule = new BenchmarkRule();
+
+  private void transact(Binder stub, int method) throws RemoteException {
+    Parcel data = Parcel.obtain();
+    Parcel reply = Parcel.obtain();
+    try {
+      data.writeInterfaceToken(stub.getInterfaceDescriptor());
+      data.writeInt(method);
+      final int code = IBinder.FIRST_CALL_TRANSACTION + method;
+      BenchmarkState state = benchmarkRule.getState();
+      while (state.keepRunning()) {
+        data.setDataPosition(0);
+        reply.setDataPosition(0);
+        stub.transact(code, data, reply, 0);
+      }
+    } finally {
+      reply.recycle();
+      data.recycle();
+    }
+  }
+
+  @Test
+  public void switchFirstMethod() throws RemoteException {
+    transact(new SwitchDispatchService(), 0);
+  }
+
+  @Test
+  public void switchLastMethod() throws RemoteException {
+    transact(new SwitchDispatchService(), 499);
+  }
+
+  @Test
+  public void tableFirstMethod() throws RemoteException {
+    transact(new TableDispatchService(), 0);
+  }
+
+  @Test
+  public void tableLastMethod() throws RemoteException {
+    transact(new TableDispatchService(), 499);
+  }
+}
@@ -56,6 +56,10 @@ unique_ptr<string> FakeIoDelegate::GetFileContents(
   return contents;
 }
 
+unique_ptr<ScanBuffer> FakeIoDelegate::GetScanBuffer(const string& filename) const {
+  return ScanBuffer::FromString(GetFileContents(filename, string(2u, '\0')));
+}
+
 unique_ptr<LineReader> FakeIoDelegate::GetLineReader(
     const string& file_path) const {
   unique_ptr<LineReader> ret;
@@ -70,17 +74,41 @@ bool FakeIoDelegate::FileIsReadable(const string& path) const {
   return file_contents_.find(CleanPath(path)) != file_contents_.end();
 }
 
+// Fake files have no modification time, so their contents are compared.
+bool FakeIoDelegate::GetFileStamp(const string&, FileStamp*) const {
+  return false;
+}
+
+bool FakeIoDelegate::DirectoryExists(const string& path) const {
+  string dir = CleanPath(path);
+  if (dir.empty() || dir == ".") {
+    return true;
+  }
+  if (dir.back() != OS_PATH_SEPARATOR) {
+    dir += OS_PATH_SEPARATOR;
+  }
+  // A directory exists if any of the files is in it.
+  for (const auto& file : file_contents_) {
+    if (android::base::StartsWith(file.first, dir)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 std::unique_ptr<CodeWriter> FakeIoDelegate::GetCodeWriter(
     const std::string& file_path) const {
   if (broken_files_.count(file_path) > 0) {
     return unique_ptr<CodeWriter>(new BrokenCodeWriter);
   }
+  std::lock_guard<std::mutex> lock(mutex_);
   removed_files_.erase(file_path);
   written_file_contents_[file_path] = "";
   return CodeWriter::ForString(&written_file_contents_[file_path]);
 }
 
 void FakeIoDelegate::RemovePath(const std::string& file_path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
   removed_files_.insert(file_path);
 }
 
@@ -21,6 +21,7 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <vector>
@@ -40,9 +41,12 @@ class FakeIoDelegate : public IoDelegate {
   std::unique_ptr<std::string> GetFileContents(
       const std::string& filename,
       const std::string& append_content_suffix = "") const override;
+  std::unique_ptr<ScanBuffer> GetScanBuffer(const std::string& filename) const override;
   std::unique_ptr<LineReader> GetLineReader(
       const std::string& file_path) const override;
   bool FileIsReadable(const std::string& path) const override;
+  bool DirectoryExists(const std::string& path) const override;
+  bool GetFileStamp(const std::string& path, FileStamp* stamp) const override;
   std::unique_ptr<CodeWriter> GetCodeWriter(
       const std::string& file_path) const override;
   void RemovePath(const std::string& file_path) const override;
@@ -78,6 +82,8 @@ class FakeIoDelegate : public IoDelegate {
   // files in this list, we simulate I/O errors.
   std::set<std::string> broken_files_;
   mutable std::set<std::string> removed_files_;
+  // Guards the mutable members above, for code generated on multiple threads.
+  mutable std::mutex mutex_;
 
   DISALLOW_COPY_AND_ASSIGN(FakeIoDelegate);
 };  // class FakeIoDelegate
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how long the calls to a lazy service take while init starts it
+// on demand, once it is running, and how long it takes to shut down and come
+// back. Every benchmark but BM_SteadyState waits for the service to shut down
+// between iterations, so they take a while to run.
+
+#include <chrono>
+#include <thread>
+
+#include <ILazyTestService.h>
+#include <benchmark/benchmark.h>
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
+#include <binder/ProcessState.h>
+#include <utils/String16.h>
+
+using ::ILazyTestService;
+using ::android::IPCThreadState;
+using ::android::sp;
+using ::android::String16;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+namespace {
+
+const String16 kServiceName("aidl_lazy_test_1");
+
+// The lazy service registrar shuts the service down a few seconds after the
+// last client goes away.
+constexpr auto kShutdownTimeout = std::chrono::seconds(30);
+constexpr auto kPollInterval = std::chrono::milliseconds(10);
+
+bool IsServiceRunning() {
+  return android::defaultServiceManager()->checkService(kServiceName) != nullptr;
+}
+
+// Drops the calling process's references to the service, and waits for it to
+// shut down. Returns false if it doesn't in time.
+bool WaitForShutdown() {
+  IPCThreadState::self()->flushCommands();
+  const auto deadline = steady_clock::now() + kShutdownTimeout;
+  while (IsServiceRunning()) {
+    if (steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(kPollInterval);
+  }
+  return true;
+}
+
+// The first call of a client, made while the service isn't running.
+bool FirstCall(sp<ILazyTestService>* service) {
+  *service = android::waitForService<ILazyTestService>(kServiceName);
+  return *service != nullptr && (*service)->forcePersist(false).isOk();
+}
+
+void BM_ColdStart(benchmark::State& state) {
+  for (auto _ : state) {
+    if (!WaitForShutdown()) {
+      state.SkipWithError("The service didn't shut down");
+      return;
+    }
+    const auto start = steady_clock::now();
+    sp<ILazyTestService> service;
+    if (!FirstCall(&service)) {
+      state.SkipWithError("Cannot call the service");
+      return;
+    }
+    state.SetIterationTime(duration<double>(steady_clock::now() - start).count());
+  }
+}
+BENCHMARK(BM_ColdStart)->UseManualTime()->Iterations(5)->Unit(benchmark::kMillisecond);
+
+// The first call after prewarm() got the service while the client was busy
+// with something else for state.range(0) milliseconds.
+void BM_PrewarmedColdStart(benchmark::State& state) {
+  for (auto _ : state) {
+    if (!WaitForShutdown()) {
+      state.SkipWithError("The service didn't shut down");
+      return;
+    }
+    auto prewarmed = ILazyTestService::prewarm(kServiceName);
+    std::this_thread::sleep_for(std::chrono::milliseconds(state.range(0)));
+    const auto start = steady_clock::now();
+    sp<ILazyTestService> service = prewarmed.get();
+    if (service == nullptr || !service->forcePersist(false).isOk()) {
+      state.SkipWithError("Cannot call the service");
+      return;
+    }
+    state.SetIterationTime(duration<double>(steady_clock::now() - start).count());
+  }
+}
+BENCHMARK(BM_PrewarmedColdStart)
+    ->UseManualTime()
+    ->Iterations(5)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(0)
+    ->Arg(100)
+    ->Arg(500);
+
+void BM_SteadyState(benchmark::State& state) {
+  sp<ILazyTestService> service;
+  if (!FirstCall(&service)) {
+    state.SkipWithError("Cannot call the service");
+    return;
+  }
+  for (auto _ : state) {
+    if (!service->forcePersist(false).isOk()) {
+      state.SkipWithError("Cannot call the service");
+      return;
+    }
+  }
+}
+BENCHMARK(BM_SteadyState);
+
+// From the last client dropping the service to the first call after it shut
+// down and was started again.
+void BM_ShutdownRestartCycle(benchmark::State& state) {
+  sp<ILazyTestService> service;
+  if (!FirstCall(&service)) {
+    state.SkipWithError("Cannot call the service");
+    return;
+  }
+  for (auto _ : state) {
+    const auto start = steady_clock::now();
+    service = nullptr;
+    if (!WaitForShutdown()) {
+      state.SkipWithError("The service didn't shut down");
+      return;
+    }
+    state.counters["shutdown_ms"] += std::chrono::duration<double, std::milli>(
+                                         steady_clock::now() - start)
+                                         .count();
+    if (!FirstCall(&service)) {
+      state.SkipWithError("Cannot call the service");
+      return;
+    }
+    state.SetIterationTime(duration<double>(steady_clock::now() - start).count());
+  }
+  state.counters["shutdown_ms"] /= state.iterations();
+}
+BENCHMARK(BM_ShutdownRestartCycle)->UseManualTime()->Iterations(5)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  android::ProcessState::self()->startThreadPool();
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -658,7 +658,8 @@ BpPingResponder::BpPingResponder(const ::android::sp<::android::IBinder>& _aidl_
 }
 
 int32_t BpPingResponder::getInterfaceVersion() {
-  if (cached_version_ == -1) {
+  int32_t version = cached_version_.load(std::memory_order_relaxed);
+  if (version == -1) {
     ::android::Parcel data;
     ::android::Parcel reply;
     data.writeInterfaceToken(getInterfaceDescriptor());
@@ -667,14 +668,18 @@ int32_t BpPingResponder::getInterfaceVersion() {
       ::android::binder::Status _aidl_status;
       err = _aidl_status.readFromParcel(reply);
       if (err == ::android::OK && _aidl_status.isOk()) {
-        cached_version_ = reply.readInt32();
+        version = reply.readInt32();
+        cached_version_.store(version, std::memory_order_relaxed);
       }
     }
   }
-  return cached_version_;
+  return version;
 }
 
 std::string BpPingResponder::getInterfaceHash() {
+  if (cached_hash_ready_.load(std::memory_order_acquire)) {
+    return cached_hash_;
+  }
   std::lock_guard<std::mutex> lockGuard(cached_hash_mutex_);
   if (cached_hash_ == "-1") {
     ::android::Parcel data;
@@ -685,7 +690,9 @@ std::string BpPingResponder::getInterfaceHash() {
       ::android::binder::Status _aidl_status;
       err = _aidl_status.readFromParcel(reply);
       if (err == ::android::OK && _aidl_status.isOk()) {
-        reply.readUtf8FromUtf16(&cached_hash_);
+        if (reply.readUtf8FromUtf16(&cached_hash_) == ::android::OK) {
+          cached_hash_ready_.store(true, std::memory_order_release);
+        }
       }
     }
   }
@@ -924,6 +931,9 @@ R"(#ifndef AIDL_GENERATED_ANDROID_OS_BP_PING_RESPONDER_H_
 #include <binder/IInterface.h>
 #include <utils/Errors.h>
 #include <android/os/IPingResponder.h>
+#include <atomic>
+#include <mutex>
+#include <string>
 
 namespace android {
 
@@ -940,8 +950,9 @@ public:
   int32_t getInterfaceVersion() override;
   std::string getInterfaceHash() override;
 private:
-  int32_t cached_version_ = -1;
+  std::atomic<int32_t> cached_version_{-1};
   std::string cached_hash_ = "-1";
+  std::atomic<bool> cached_hash_ready_{false};
   std::mutex cached_hash_mutex_;
 };  // class BpPingResponder
 
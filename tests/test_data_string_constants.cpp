@@ -484,7 +484,8 @@ BpStringConstants::BpStringConstants(const ::android::sp<::android::IBinder>& _a
 }
 
 int32_t BpStringConstants::getInterfaceVersion() {
-  if (cached_version_ == -1) {
+  int32_t version = cached_version_.load(std::memory_order_relaxed);
+  if (version == -1) {
     ::android::Parcel data;
     ::android::Parcel reply;
     data.writeInterfaceToken(getInterfaceDescriptor());
@@ -493,14 +494,18 @@ int32_t BpStringConstants::getInterfaceVersion() {
       ::android::binder::Status _aidl_status;
       err = _aidl_status.readFromParcel(reply);
       if (err == ::android::OK && _aidl_status.isOk()) {
-        cached_version_ = reply.readInt32();
+        version = reply.readInt32();
+        cached_version_.store(version, std::memory_order_relaxed);
       }
     }
   }
-  return cached_version_;
+  return version;
 }
 
 std::string BpStringConstants::getInterfaceHash() {
+  if (cached_hash_ready_.load(std::memory_order_acquire)) {
+    return cached_hash_;
+  }
   std::lock_guard<std::mutex> lockGuard(cached_hash_mutex_);
   if (cached_hash_ == "-1") {
     ::android::Parcel data;
@@ -511,7 +516,9 @@ std::string BpStringConstants::getInterfaceHash() {
       ::android::binder::Status _aidl_status;
       err = _aidl_status.readFromParcel(reply);
       if (err == ::android::OK && _aidl_status.isOk()) {
-        reply.readUtf8FromUtf16(&cached_hash_);
+        if (reply.readUtf8FromUtf16(&cached_hash_) == ::android::OK) {
+          cached_hash_ready_.store(true, std::memory_order_release);
+        }
       }
     }
   }